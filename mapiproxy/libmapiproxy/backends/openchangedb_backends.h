@@ -49,6 +49,7 @@ struct openchangedb_context {
 	enum MAPISTATUS (*lookup_folder_property)(struct openchangedb_context *, uint32_t, uint64_t);
 	enum MAPISTATUS (*set_folder_properties)(struct openchangedb_context *, const char *, uint64_t, struct SRow *);
 	enum MAPISTATUS (*get_folder_property)(TALLOC_CTX *, struct openchangedb_context *, const char *, uint32_t, uint64_t, void **);
+	enum MAPISTATUS (*get_folder_properties)(TALLOC_CTX *, struct openchangedb_context *, const char *, uint64_t, struct SPropTagArray *, void **, enum MAPISTATUS *);
 	enum MAPISTATUS (*get_folder_count)(struct openchangedb_context *, const char *, uint64_t, uint32_t *);
 	enum MAPISTATUS (*get_message_count)(struct openchangedb_context *, const char *, uint64_t, uint32_t *, bool);
 	enum MAPISTATUS (*get_system_idx)(struct openchangedb_context *, const char *, uint64_t, int *);
@@ -85,10 +86,25 @@ struct openchangedb_context {
 	bool (*set_locale)(struct openchangedb_context *, const char *, uint32_t);
 
 	const char **(*get_folders_names)(TALLOC_CTX *, struct openchangedb_context *, const char *, const char *);
+
+	/* Give back the resources held for the last call - optional */
+	void (*release)(struct openchangedb_context *);
+
 	const char *backend_type;
 	void *data;
 };
 
+/* Called once the backend is done with a call: let it give back what it
+   held for it, such as database connections, and pass the result on */
+static inline enum MAPISTATUS openchangedb_backend_done(struct openchangedb_context *oc_ctx,
+							 enum MAPISTATUS retval)
+{
+	if (oc_ctx->release) {
+		oc_ctx->release(oc_ctx);
+	}
+	return retval;
+}
+
 const char *nil_string;
 
 
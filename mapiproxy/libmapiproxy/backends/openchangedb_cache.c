@@ -0,0 +1,987 @@
+/*
+   MAPI Proxy - OpenchangeDB folder metadata cache
+
+   OpenChange Project
+
+   This program is free software; you can redistribute it and/or modify
+   it under the terms of the GNU General Public License as published by
+   the Free Software Foundation; either version 3 of the License, or
+   (at your option) any later version.
+
+   This program is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+   GNU General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/*
+  Decorator keeping the folder facts emsmdbp asks over and over (system
+  and special folder identifiers, parent folders, mapistore URIs and
+  mailbox GUID/replica) in a bounded LRU cache. Entries expire after a
+  TTL, which bounds how long a change made by another process goes
+  unnoticed, and the changes made through this context invalidate the
+  entries they affect. Only successful lookups are cached.
+ */
+
+#include "openchangedb_cache.h"
+
+#include "../libmapiproxy.h"
+#include "libmapi/libmapi.h"
+#include "libmapi/libmapi_private.h"
+#include "utils/dlinklist.h"
+#include "mapiproxy/util/ccan/htable/htable.h"
+#include "mapiproxy/util/ccan/hash/hash.h"
+
+#include <time.h>
+#include <inttypes.h>
+
+enum ocdb_cache_kind {
+	OCDB_CACHE_SYSTEM_FOLDER	= 0x01,
+	OCDB_CACHE_SPECIAL_FOLDER	= 0x02,
+	OCDB_CACHE_PUBLIC_FOLDER	= 0x04,
+	OCDB_CACHE_MAILBOX_GUID		= 0x08,
+	OCDB_CACHE_MAILBOX_REPLICA	= 0x10,
+	OCDB_CACHE_MAPISTORE_URI	= 0x20,
+	OCDB_CACHE_PARENT_FID		= 0x40,
+	OCDB_CACHE_ALL			= 0xff
+};
+
+struct ocdb_cache_entry {
+	struct ocdb_cache_entry	*prev, *next;
+	char			*key;
+	enum ocdb_cache_kind	kind;
+	char			*username;
+	uint64_t		fid;	/* folder the entry is about, 0 if none */
+	time_t			expires;
+	uint64_t		id;
+	uint16_t		repl_id;
+	struct GUID		guid;
+	char			*uri;
+};
+
+struct ocdb_cache_data {
+	struct openchangedb_context	*backend;
+	uint32_t			max_entries;
+	uint32_t			ttl;
+	uint32_t			count;
+	struct htable			ht;
+	struct ocdb_cache_entry		*entries;	/* most recently used first */
+};
+
+static struct openchangedb_cache_stats ocdb_cache_stats;
+
+static struct ocdb_cache_data * _ocdb_cache_data_get(struct openchangedb_context *self)
+{
+	return talloc_get_type(self->data, struct ocdb_cache_data);
+}
+
+/* Rehash function for the entries table */
+static size_t _ocdb_cache_rehash(const void *e, void *unused)
+{
+	return hash_string(((const struct ocdb_cache_entry *)e)->key);
+}
+
+static bool _ocdb_cache_cmp(const void *e, void *key)
+{
+	return strcmp(((const struct ocdb_cache_entry *)e)->key, (const char *)key) == 0;
+}
+
+static void _ocdb_cache_remove(struct ocdb_cache_data *data, struct ocdb_cache_entry *entry)
+{
+	htable_del(&data->ht, hash_string(entry->key), entry);
+	DLIST_REMOVE(data->entries, entry);
+	talloc_free(entry);
+	data->count--;
+	ocdb_cache_stats.entries--;
+}
+
+static char *_ocdb_cache_key(TALLOC_CTX *mem_ctx, enum ocdb_cache_kind kind,
+			     const char *username, uint64_t arg, bool flag)
+{
+	return talloc_asprintf(mem_ctx, "%x/%s/%"PRIx64"/%d", kind,
+			       username ? username : "", arg, flag);
+}
+
+/**
+   \details Look an entry up, expired entries are dropped
+
+   \return pointer to the entry on hit, otherwise NULL
+ */
+static struct ocdb_cache_entry *_ocdb_cache_get(struct ocdb_cache_data *data, enum ocdb_cache_kind kind,
+						const char *username, uint64_t arg, bool flag)
+{
+	struct ocdb_cache_entry	*entry;
+	char			*key;
+
+	key = _ocdb_cache_key(NULL, kind, username, arg, flag);
+	if (!key) return NULL;
+
+	entry = htable_get(&data->ht, hash_string(key), _ocdb_cache_cmp, key);
+	talloc_free(key);
+	if (entry && entry->expires <= time(NULL)) {
+		_ocdb_cache_remove(data, entry);
+		ocdb_cache_stats.expirations++;
+		entry = NULL;
+	}
+	if (!entry) {
+		ocdb_cache_stats.misses++;
+		return NULL;
+	}
+
+	DLIST_PROMOTE(data->entries, entry);
+	ocdb_cache_stats.hits++;
+
+	return entry;
+}
+
+/**
+   \details Create the entry of a successful lookup, evicting the least
+   recently used entry when the cache is full. The caller fills the
+   value in.
+
+   \return pointer to the new entry, NULL when it can't be cached
+ */
+static struct ocdb_cache_entry *_ocdb_cache_add(struct ocdb_cache_data *data, enum ocdb_cache_kind kind,
+						const char *username, uint64_t arg, bool flag,
+						uint64_t fid)
+{
+	struct ocdb_cache_entry	*entry;
+
+	if (!data->max_entries) return NULL;
+
+	entry = talloc_zero(data, struct ocdb_cache_entry);
+	if (!entry) return NULL;
+
+	entry->key = _ocdb_cache_key(entry, kind, username, arg, flag);
+	entry->username = talloc_strdup(entry, username ? username : "");
+	if (!entry->key || !entry->username) {
+		talloc_free(entry);
+		return NULL;
+	}
+	entry->kind = kind;
+	entry->fid = fid;
+	entry->expires = time(NULL) + data->ttl;
+
+	/* A concurrent lookup may have cached it already */
+	if (htable_get(&data->ht, hash_string(entry->key), _ocdb_cache_cmp, entry->key)) {
+		talloc_free(entry);
+		return NULL;
+	}
+
+	while (data->count >= data->max_entries && data->entries) {
+		_ocdb_cache_remove(data, DLIST_TAIL(data->entries));
+		ocdb_cache_stats.evictions++;
+	}
+
+	if (!htable_add(&data->ht, hash_string(entry->key), entry)) {
+		talloc_free(entry);
+		return NULL;
+	}
+	DLIST_ADD(data->entries, entry);
+	data->count++;
+	ocdb_cache_stats.entries++;
+
+	return entry;
+}
+
+/**
+   \details Drop the entries of the given kinds which belong to a user
+   or are about a folder
+
+   \param data pointer to the cache
+   \param username the user whose entries are dropped - optional
+   \param fid the folder whose entries are dropped, 0 for none
+   \param kinds bitmask of enum ocdb_cache_kind
+ */
+static void _ocdb_cache_invalidate(struct ocdb_cache_data *data, const char *username,
+				   uint64_t fid, uint32_t kinds)
+{
+	struct ocdb_cache_entry	*entry, *next;
+
+	for (entry = data->entries; entry; entry = next) {
+		next = entry->next;
+		if (!(entry->kind & kinds)) continue;
+		if ((username && !strcmp(entry->username, username)) ||
+		    (fid && (entry->fid == fid ||
+			     (entry->kind == OCDB_CACHE_PARENT_FID && entry->id == fid)))) {
+			_ocdb_cache_remove(data, entry);
+			ocdb_cache_stats.invalidations++;
+		}
+	}
+}
+
+/**
+   \details Retrieve the counters of the openchangedb caches of this
+   process
+
+   \param stats pointer to the returned counters
+ */
+_PUBLIC_ void openchangedb_cache_get_stats(struct openchangedb_cache_stats *stats)
+{
+	if (!stats) return;
+
+	*stats = ocdb_cache_stats;
+}
+
+/* Write the cache counters into a statistics file */
+static void openchangedb_cache_dump_stats(FILE *fp)
+{
+	struct openchangedb_cache_stats	*stats = &ocdb_cache_stats;
+
+	fprintf(fp, "# openchangedb_cache hits misses hit_rate entries evictions expirations invalidations\n");
+	fprintf(fp, "cache %"PRIu64" %"PRIu64" %.2f %"PRIu64" %"PRIu64" %"PRIu64" %"PRIu64"\n",
+		stats->hits, stats->misses,
+		(stats->hits + stats->misses) ? (double) stats->hits / (stats->hits + stats->misses) : 0.0,
+		stats->entries, stats->evictions, stats->expirations, stats->invalidations);
+}
+
+/* Forget the cache counters, the number of cached entries is kept */
+static void openchangedb_cache_reset_stats(void)
+{
+	uint64_t	entries = ocdb_cache_stats.entries;
+
+	memset(&ocdb_cache_stats, 0, sizeof (struct openchangedb_cache_stats));
+	ocdb_cache_stats.entries = entries;
+}
+
+// v openchangedb cached lookups ----------------------------------------------
+
+static enum MAPISTATUS get_SpecialFolderID(struct openchangedb_context *self,
+					  const char *recipient, uint32_t system_idx,
+					  uint64_t *folder_id)
+{
+	enum MAPISTATUS			retval;
+	struct ocdb_cache_data		*priv_data = _ocdb_cache_data_get(self);
+	struct ocdb_cache_entry		*entry;
+
+	entry = _ocdb_cache_get(priv_data, OCDB_CACHE_SPECIAL_FOLDER, recipient, system_idx, false);
+	if (entry) {
+		*folder_id = entry->id;
+		return MAPI_E_SUCCESS;
+	}
+
+	retval = priv_data->backend->get_SpecialFolderID(priv_data->backend, recipient, system_idx, folder_id);
+	if (retval == MAPI_E_SUCCESS) {
+		entry = _ocdb_cache_add(priv_data, OCDB_CACHE_SPECIAL_FOLDER, recipient, system_idx, false, *folder_id);
+		if (entry) entry->id = *folder_id;
+	}
+
+	return retval;
+}
+
+static enum MAPISTATUS get_SystemFolderID(struct openchangedb_context *self,
+					  const char *recipient, uint32_t SystemIdx,
+					  uint64_t *FolderId)
+{
+	enum MAPISTATUS			retval;
+	struct ocdb_cache_data		*priv_data = _ocdb_cache_data_get(self);
+	struct ocdb_cache_entry		*entry;
+
+	entry = _ocdb_cache_get(priv_data, OCDB_CACHE_SYSTEM_FOLDER, recipient, SystemIdx, false);
+	if (entry) {
+		*FolderId = entry->id;
+		return MAPI_E_SUCCESS;
+	}
+
+	retval = priv_data->backend->get_SystemFolderID(priv_data->backend, recipient, SystemIdx, FolderId);
+	if (retval == MAPI_E_SUCCESS) {
+		entry = _ocdb_cache_add(priv_data, OCDB_CACHE_SYSTEM_FOLDER, recipient, SystemIdx, false, *FolderId);
+		if (entry) entry->id = *FolderId;
+	}
+
+	return retval;
+}
+
+static enum MAPISTATUS get_PublicFolderID(struct openchangedb_context *self,
+					  const char *username,
+					  uint32_t SystemIdx,
+					  uint64_t *FolderId)
+{
+	enum MAPISTATUS			retval;
+	struct ocdb_cache_data		*priv_data = _ocdb_cache_data_get(self);
+	struct ocdb_cache_entry		*entry;
+
+	entry = _ocdb_cache_get(priv_data, OCDB_CACHE_PUBLIC_FOLDER, username, SystemIdx, false);
+	if (entry) {
+		*FolderId = entry->id;
+		return MAPI_E_SUCCESS;
+	}
+
+	retval = priv_data->backend->get_PublicFolderID(priv_data->backend, username, SystemIdx, FolderId);
+	if (retval == MAPI_E_SUCCESS) {
+		entry = _ocdb_cache_add(priv_data, OCDB_CACHE_PUBLIC_FOLDER, username, SystemIdx, false, *FolderId);
+		if (entry) entry->id = *FolderId;
+	}
+
+	return retval;
+}
+
+static enum MAPISTATUS get_MailboxGuid(struct openchangedb_context *self,
+				       const char *recipient,
+				       struct GUID *MailboxGUID)
+{
+	enum MAPISTATUS			retval;
+	struct ocdb_cache_data		*priv_data = _ocdb_cache_data_get(self);
+	struct ocdb_cache_entry		*entry;
+
+	entry = _ocdb_cache_get(priv_data, OCDB_CACHE_MAILBOX_GUID, recipient, 0, false);
+	if (entry) {
+		*MailboxGUID = entry->guid;
+		return MAPI_E_SUCCESS;
+	}
+
+	retval = priv_data->backend->get_MailboxGuid(priv_data->backend, recipient, MailboxGUID);
+	if (retval == MAPI_E_SUCCESS) {
+		entry = _ocdb_cache_add(priv_data, OCDB_CACHE_MAILBOX_GUID, recipient, 0, false, 0);
+		if (entry) entry->guid = *MailboxGUID;
+	}
+
+	return retval;
+}
+
+static enum MAPISTATUS get_MailboxReplica(struct openchangedb_context *self,
+					  const char *recipient, uint16_t *ReplID,
+					  struct GUID *ReplGUID)
+{
+	enum MAPISTATUS			retval;
+	struct ocdb_cache_data		*priv_data = _ocdb_cache_data_get(self);
+	struct ocdb_cache_entry		*entry;
+	uint16_t			repl_id = 0;
+	struct GUID			repl_guid;
+
+	entry = _ocdb_cache_get(priv_data, OCDB_CACHE_MAILBOX_REPLICA, recipient, 0, false);
+	if (entry) {
+		if (ReplID) *ReplID = entry->repl_id;
+		if (ReplGUID) *ReplGUID = entry->guid;
+		return MAPI_E_SUCCESS;
+	}
+
+	/* Fetch both values so the entry answers every caller */
+	retval = priv_data->backend->get_MailboxReplica(priv_data->backend, recipient, &repl_id, &repl_guid);
+	if (retval == MAPI_E_SUCCESS) {
+		if (ReplID) *ReplID = repl_id;
+		if (ReplGUID) *ReplGUID = repl_guid;
+		entry = _ocdb_cache_add(priv_data, OCDB_CACHE_MAILBOX_REPLICA, recipient, 0, false, 0);
+		if (entry) {
+			entry->repl_id = repl_id;
+			entry->guid = repl_guid;
+		}
+	}
+
+	return retval;
+}
+
+static enum MAPISTATUS get_mapistoreURI(TALLOC_CTX *parent_ctx,
+				        struct openchangedb_context *self,
+				        const char *username,
+				        uint64_t fid, char **mapistoreURL,
+				        bool mailboxstore)
+{
+	enum MAPISTATUS			retval;
+	struct ocdb_cache_data		*priv_data = _ocdb_cache_data_get(self);
+	struct ocdb_cache_entry		*entry;
+
+	entry = _ocdb_cache_get(priv_data, OCDB_CACHE_MAPISTORE_URI, username, fid, mailboxstore);
+	if (entry) {
+		*mapistoreURL = talloc_strdup(parent_ctx, entry->uri);
+		OPENCHANGE_RETVAL_IF(!*mapistoreURL, MAPI_E_NOT_ENOUGH_MEMORY, NULL);
+		return MAPI_E_SUCCESS;
+	}
+
+	retval = priv_data->backend->get_mapistoreURI(parent_ctx, priv_data->backend, username, fid, mapistoreURL, mailboxstore);
+	if (retval == MAPI_E_SUCCESS && *mapistoreURL) {
+		entry = _ocdb_cache_add(priv_data, OCDB_CACHE_MAPISTORE_URI, username, fid, mailboxstore, fid);
+		if (entry) {
+			entry->uri = talloc_strdup(entry, *mapistoreURL);
+			if (!entry->uri) _ocdb_cache_remove(priv_data, entry);
+		}
+	}
+
+	return retval;
+}
+
+static enum MAPISTATUS get_parent_fid(struct openchangedb_context *self,
+				      const char *username, uint64_t fid,
+				      uint64_t *parent_fidp, bool mailboxstore)
+{
+	enum MAPISTATUS			retval;
+	struct ocdb_cache_data		*priv_data = _ocdb_cache_data_get(self);
+	struct ocdb_cache_entry		*entry;
+
+	entry = _ocdb_cache_get(priv_data, OCDB_CACHE_PARENT_FID, username, fid, mailboxstore);
+	if (entry) {
+		*parent_fidp = entry->id;
+		return MAPI_E_SUCCESS;
+	}
+
+	retval = priv_data->backend->get_parent_fid(priv_data->backend, username, fid, parent_fidp, mailboxstore);
+	if (retval == MAPI_E_SUCCESS) {
+		entry = _ocdb_cache_add(priv_data, OCDB_CACHE_PARENT_FID, username, fid, mailboxstore, fid);
+		if (entry) entry->id = *parent_fidp;
+	}
+
+	return retval;
+}
+
+// ^ openchangedb cached lookups ----------------------------------------------
+
+// v openchangedb invalidating changes ----------------------------------------
+
+static enum MAPISTATUS set_mapistoreURI(struct openchangedb_context *self,
+					const char *username, uint64_t fid,
+					const char *mapistoreURL)
+{
+	struct ocdb_cache_data *priv_data = _ocdb_cache_data_get(self);
+
+	_ocdb_cache_invalidate(priv_data, NULL, fid, OCDB_CACHE_ALL);
+	return priv_data->backend->set_mapistoreURI(priv_data->backend, username, fid, mapistoreURL);
+}
+
+static enum MAPISTATUS set_folder_properties(struct openchangedb_context *self,
+					     const char *username, uint64_t fid,
+					     struct SRow *row)
+{
+	struct ocdb_cache_data *priv_data = _ocdb_cache_data_get(self);
+
+	/* Special folders are found through the properties of the mailbox
+	 * and inbox, the parent and URI of the folder are properties too */
+	_ocdb_cache_invalidate(priv_data, username, 0, OCDB_CACHE_SPECIAL_FOLDER);
+	_ocdb_cache_invalidate(priv_data, NULL, fid, OCDB_CACHE_PARENT_FID | OCDB_CACHE_MAPISTORE_URI);
+	return priv_data->backend->set_folder_properties(priv_data->backend, username, fid, row);
+}
+
+static enum MAPISTATUS delete_folder(struct openchangedb_context *self,
+				     const char *username, uint64_t fid)
+{
+	struct ocdb_cache_data *priv_data = _ocdb_cache_data_get(self);
+
+	_ocdb_cache_invalidate(priv_data, NULL, fid, OCDB_CACHE_ALL);
+	return priv_data->backend->delete_folder(priv_data->backend, username, fid);
+}
+
+static enum MAPISTATUS create_mailbox(struct openchangedb_context *self,
+				      const char *username,
+				      const char *organization_name,
+				      const char *groupo_name,
+				      int systemIdx, uint64_t fid,
+				      const char *display_name)
+{
+	struct ocdb_cache_data *priv_data = _ocdb_cache_data_get(self);
+
+	_ocdb_cache_invalidate(priv_data, username, fid, OCDB_CACHE_ALL);
+	return priv_data->backend->create_mailbox(priv_data->backend, username,
+						  organization_name, groupo_name,
+						  systemIdx, fid, display_name);
+}
+
+static enum MAPISTATUS create_folder(struct openchangedb_context *self,
+				     const char *username,
+				     uint64_t parentFolderID, uint64_t fid,
+				     uint64_t changeNumber,
+				     const char *MAPIStoreURI, int systemIdx)
+{
+	struct ocdb_cache_data *priv_data = _ocdb_cache_data_get(self);
+
+	/* A new system folder changes what the SystemIdx lookups return */
+	_ocdb_cache_invalidate(priv_data, systemIdx ? username : NULL, fid, OCDB_CACHE_ALL);
+	return priv_data->backend->create_folder(priv_data->backend, username, parentFolderID, fid, changeNumber, MAPIStoreURI, systemIdx);
+}
+
+static enum MAPISTATUS set_system_idx(struct openchangedb_context *self,
+				      const char *username, uint64_t fid,
+				      int system_idx)
+{
+	struct ocdb_cache_data *priv_data = _ocdb_cache_data_get(self);
+
+	_ocdb_cache_invalidate(priv_data, username, fid, OCDB_CACHE_ALL);
+	return priv_data->backend->set_system_idx(priv_data->backend, username, fid, system_idx);
+}
+
+// ^ openchangedb invalidating changes ----------------------------------------
+
+// v openchangedb pass-through ------------------------------------------------
+
+static enum MAPISTATUS get_distinguishedName(TALLOC_CTX *parent_ctx,
+					     struct openchangedb_context *self,
+					     uint64_t fid,
+					     char **distinguishedName)
+{
+	struct ocdb_cache_data *priv_data = _ocdb_cache_data_get(self);
+
+	return priv_data->backend->get_distinguishedName(parent_ctx, priv_data->backend, fid, distinguishedName);
+}
+
+static enum MAPISTATUS get_PublicFolderReplica(struct openchangedb_context *self,
+					       const char *username,
+					       uint16_t *ReplID,
+					       struct GUID *ReplGUID)
+{
+	struct ocdb_cache_data *priv_data = _ocdb_cache_data_get(self);
+
+	return priv_data->backend->get_PublicFolderReplica(priv_data->backend, username, ReplID, ReplGUID);
+}
+
+static enum MAPISTATUS get_fid(struct openchangedb_context *self,
+			       const char *mapistoreURL, uint64_t *fidp)
+{
+	struct ocdb_cache_data *priv_data = _ocdb_cache_data_get(self);
+
+	return priv_data->backend->get_fid(priv_data->backend, mapistoreURL, fidp);
+}
+
+static enum MAPISTATUS get_MAPIStoreURIs(struct openchangedb_context *self,
+					 const char *username,
+					 TALLOC_CTX *mem_ctx,
+					 struct StringArrayW_r **urisP)
+{
+	struct ocdb_cache_data *priv_data = _ocdb_cache_data_get(self);
+
+	return priv_data->backend->get_MAPIStoreURIs(priv_data->backend, username, mem_ctx, urisP);
+}
+
+static enum MAPISTATUS get_ReceiveFolder(TALLOC_CTX *parent_ctx,
+					 struct openchangedb_context *self,
+					 const char *recipient,
+					 const char *MessageClass,
+					 uint64_t *fid,
+					 const char **ExplicitMessageClass)
+{
+	struct ocdb_cache_data *priv_data = _ocdb_cache_data_get(self);
+
+	return priv_data->backend->get_ReceiveFolder(parent_ctx, priv_data->backend, recipient, MessageClass, fid, ExplicitMessageClass);
+}
+
+static enum MAPISTATUS get_ReceiveFolderTable(TALLOC_CTX *parent_ctx,
+					      struct openchangedb_context *self,
+					      const char *recipient,
+					      uint32_t *cValues,
+					      struct ReceiveFolder **entries)
+{
+	struct ocdb_cache_data *priv_data = _ocdb_cache_data_get(self);
+
+	return priv_data->backend->get_ReceiveFolderTable(parent_ctx, priv_data->backend, recipient, cValues, entries);
+}
+
+static enum MAPISTATUS get_TransportFolder(struct openchangedb_context *self,
+					   const char *recipient,
+					   uint64_t *FolderId)
+{
+	struct ocdb_cache_data *priv_data = _ocdb_cache_data_get(self);
+
+	return priv_data->backend->get_TransportFolder(priv_data->backend, recipient, FolderId);
+}
+
+static enum MAPISTATUS get_folder_count(struct openchangedb_context *self,
+					const char *username, uint64_t fid,
+					uint32_t *RowCount)
+{
+	struct ocdb_cache_data *priv_data = _ocdb_cache_data_get(self);
+
+	return priv_data->backend->get_folder_count(priv_data->backend, username, fid, RowCount);
+}
+
+static enum MAPISTATUS lookup_folder_property(struct openchangedb_context *self,
+					      uint32_t proptag, uint64_t fid)
+{
+	struct ocdb_cache_data *priv_data = _ocdb_cache_data_get(self);
+
+	return priv_data->backend->lookup_folder_property(priv_data->backend, proptag, fid);
+}
+
+static enum MAPISTATUS get_new_changeNumber(struct openchangedb_context *self,
+					    const char *username, uint64_t *cn)
+{
+	struct ocdb_cache_data *priv_data = _ocdb_cache_data_get(self);
+
+	return priv_data->backend->get_new_changeNumber(priv_data->backend, username, cn);
+}
+
+static enum MAPISTATUS get_new_changeNumbers(struct openchangedb_context *self,
+					     TALLOC_CTX *mem_ctx,
+					     const char *username,
+					     uint64_t max,
+					     struct UI8Array_r **cns_p)
+{
+	struct ocdb_cache_data *priv_data = _ocdb_cache_data_get(self);
+
+	return priv_data->backend->get_new_changeNumbers(priv_data->backend, mem_ctx, username, max, cns_p);
+}
+
+static enum MAPISTATUS get_next_changeNumber(struct openchangedb_context *self,
+					     const char *username,
+					     uint64_t *cn)
+{
+	struct ocdb_cache_data *priv_data = _ocdb_cache_data_get(self);
+
+	return priv_data->backend->get_next_changeNumber(priv_data->backend, username, cn);
+}
+
+static enum MAPISTATUS get_folder_property(TALLOC_CTX *parent_ctx,
+					   struct openchangedb_context *self,
+					   const char *username,
+					   uint32_t proptag, uint64_t fid,
+					   void **data)
+{
+	struct ocdb_cache_data *priv_data = _ocdb_cache_data_get(self);
+
+	return priv_data->backend->get_folder_property(parent_ctx, priv_data->backend, username, proptag, fid, data);
+}
+
+static enum MAPISTATUS get_folder_properties(TALLOC_CTX *parent_ctx,
+					     struct openchangedb_context *self,
+					     const char *username, uint64_t fid,
+					     struct SPropTagArray *properties,
+					     void **data, enum MAPISTATUS *retvals)
+{
+	struct ocdb_cache_data *priv_data = _ocdb_cache_data_get(self);
+
+	return openchangedb_get_folder_properties(parent_ctx, priv_data->backend, username, fid, properties, data, retvals);
+}
+
+static enum MAPISTATUS get_table_property(TALLOC_CTX *parent_ctx,
+					  struct openchangedb_context *self,
+					  const char *ldb_filter,
+					  uint32_t proptag, uint32_t pos,
+					  void **data)
+{
+	struct ocdb_cache_data *priv_data = _ocdb_cache_data_get(self);
+
+	return priv_data->backend->get_table_property(parent_ctx, priv_data->backend, ldb_filter, proptag, pos, data);
+}
+
+static enum MAPISTATUS get_fid_by_name(struct openchangedb_context *self,
+				       const char *username,
+				       uint64_t parent_fid,
+				       const char* foldername, uint64_t *fid)
+{
+	struct ocdb_cache_data *priv_data = _ocdb_cache_data_get(self);
+
+	return priv_data->backend->get_fid_by_name(priv_data->backend, username, parent_fid, foldername, fid);
+}
+
+static enum MAPISTATUS get_mid_by_subject(struct openchangedb_context *self,
+					  const char *username,
+					  uint64_t parent_fid,
+					  const char *subject,
+					  bool mailboxstore, uint64_t *mid)
+{
+	struct ocdb_cache_data *priv_data = _ocdb_cache_data_get(self);
+
+	return priv_data->backend->get_mid_by_subject(priv_data->backend, username, parent_fid, subject, mailboxstore, mid);
+}
+
+static enum MAPISTATUS set_ReceiveFolder(struct openchangedb_context *self,
+					 const char *recipient,
+					 const char *MessageClass, uint64_t fid)
+{
+	struct ocdb_cache_data *priv_data = _ocdb_cache_data_get(self);
+
+	return priv_data->backend->set_ReceiveFolder(priv_data->backend, recipient, MessageClass, fid);
+}
+
+static enum MAPISTATUS get_fid_from_partial_uri(struct openchangedb_context *self,
+						const char *partialURI, uint64_t *fid)
+{
+	struct ocdb_cache_data *priv_data = _ocdb_cache_data_get(self);
+
+	return priv_data->backend->get_fid_from_partial_uri(priv_data->backend, partialURI, fid);
+}
+
+static enum MAPISTATUS get_users_from_partial_uri(TALLOC_CTX *parent_ctx,
+						  struct openchangedb_context *self,
+						  const char *partialURI,
+						  uint32_t *count,
+						  char ***MAPIStoreURI,
+						  char ***users)
+{
+	struct ocdb_cache_data *priv_data = _ocdb_cache_data_get(self);
+
+	return priv_data->backend->get_users_from_partial_uri(parent_ctx, priv_data->backend, partialURI, count, MAPIStoreURI, users);
+}
+
+static enum MAPISTATUS get_message_count(struct openchangedb_context *self,
+					 const char *username, uint64_t fid,
+					 uint32_t *RowCount, bool fai)
+{
+	struct ocdb_cache_data *priv_data = _ocdb_cache_data_get(self);
+
+	return priv_data->backend->get_message_count(priv_data->backend, username, fid, RowCount, fai);
+}
+
+static enum MAPISTATUS get_system_idx(struct openchangedb_context *self,
+				      const char *username, uint64_t fid,
+				      int *system_idx_p)
+{
+	struct ocdb_cache_data *priv_data = _ocdb_cache_data_get(self);
+
+	return priv_data->backend->get_system_idx(priv_data->backend, username, fid, system_idx_p);
+}
+
+static enum MAPISTATUS transaction_start(struct openchangedb_context *self)
+{
+	struct ocdb_cache_data *priv_data = _ocdb_cache_data_get(self);
+
+	return priv_data->backend->transaction_start(priv_data->backend);
+}
+
+static enum MAPISTATUS transaction_commit(struct openchangedb_context *self)
+{
+	struct ocdb_cache_data *priv_data = _ocdb_cache_data_get(self);
+
+	return priv_data->backend->transaction_commit(priv_data->backend);
+}
+
+static enum MAPISTATUS get_new_public_folderID(struct openchangedb_context *self,
+					       const char *username,
+					       uint64_t *fid)
+{
+	struct ocdb_cache_data *priv_data = _ocdb_cache_data_get(self);
+
+	return priv_data->backend->get_new_public_folderID(priv_data->backend, username, fid);
+}
+
+static bool is_public_folder_id(struct openchangedb_context *self, uint64_t fid)
+{
+	struct ocdb_cache_data *priv_data = _ocdb_cache_data_get(self);
+
+	return priv_data->backend->is_public_folder_id(priv_data->backend, fid);
+}
+
+static enum MAPISTATUS get_indexing_url(struct openchangedb_context *self,
+					const char *username,
+					const char **indexing_url)
+{
+	struct ocdb_cache_data *priv_data = _ocdb_cache_data_get(self);
+
+	return priv_data->backend->get_indexing_url(priv_data->backend, username, indexing_url);
+}
+
+static bool set_locale(struct openchangedb_context *self, const char *username, uint32_t lcid)
+{
+	struct ocdb_cache_data *priv_data = _ocdb_cache_data_get(self);
+
+	return priv_data->backend->set_locale(priv_data->backend, username, lcid);
+}
+
+static const char **get_folders_names(TALLOC_CTX *mem_ctx, struct openchangedb_context *self, const char *locale, const char *type)
+{
+	struct ocdb_cache_data *priv_data = _ocdb_cache_data_get(self);
+
+	return priv_data->backend->get_folders_names(mem_ctx, priv_data->backend, locale, type);
+}
+
+static void release(struct openchangedb_context *self)
+{
+	struct ocdb_cache_data *priv_data = _ocdb_cache_data_get(self);
+
+	if (priv_data->backend->release) {
+		priv_data->backend->release(priv_data->backend);
+	}
+}
+
+static enum MAPISTATUS table_init(TALLOC_CTX *mem_ctx,
+				  struct openchangedb_context *self,
+				  const char *username,
+				  uint8_t table_type, uint64_t folderID,
+				  void **table_object)
+{
+	struct ocdb_cache_data *priv_data = _ocdb_cache_data_get(self);
+
+	return priv_data->backend->table_init(mem_ctx, priv_data->backend, username, table_type, folderID, table_object);
+}
+
+static enum MAPISTATUS table_set_sort_order(struct openchangedb_context *self,
+					    void *table_object,
+					    struct SSortOrderSet *lpSortCriteria)
+{
+	struct ocdb_cache_data *priv_data = _ocdb_cache_data_get(self);
+
+	return priv_data->backend->table_set_sort_order(priv_data->backend, table_object, lpSortCriteria);
+}
+
+static enum MAPISTATUS table_set_restrictions(struct openchangedb_context *self,
+					      void *table_object,
+					      struct mapi_SRestriction *res)
+{
+	struct ocdb_cache_data *priv_data = _ocdb_cache_data_get(self);
+
+	return priv_data->backend->table_set_restrictions(priv_data->backend, table_object, res);
+}
+
+static enum MAPISTATUS table_get_property(TALLOC_CTX *mem_ctx,
+					  struct openchangedb_context *self,
+					  void *table_object,
+					  enum MAPITAGS proptag, uint32_t pos,
+					  bool live_filtered, void **data)
+{
+	struct ocdb_cache_data *priv_data = _ocdb_cache_data_get(self);
+
+	return priv_data->backend->table_get_property(mem_ctx, priv_data->backend, table_object, proptag, pos, live_filtered, data);
+}
+
+static enum MAPISTATUS message_create(TALLOC_CTX *mem_ctx,
+				      struct openchangedb_context *self,
+				      const char *username,
+				      uint64_t messageID, uint64_t folderID,
+				      bool fai, void **message_object)
+{
+	struct ocdb_cache_data *priv_data = _ocdb_cache_data_get(self);
+
+	return priv_data->backend->message_create(mem_ctx, priv_data->backend, username, messageID, folderID, fai, message_object);
+}
+
+static enum MAPISTATUS message_save(struct openchangedb_context *self,
+				    void *_msg, uint8_t SaveFlags)
+{
+	struct ocdb_cache_data *priv_data = _ocdb_cache_data_get(self);
+
+	return priv_data->backend->message_save(priv_data->backend, _msg, SaveFlags);
+}
+
+static enum MAPISTATUS message_open(TALLOC_CTX *mem_ctx,
+				    struct openchangedb_context *self,
+				    const char *username,
+				    uint64_t messageID, uint64_t folderID,
+				    void **message_object, void **msgp)
+{
+	struct ocdb_cache_data *priv_data = _ocdb_cache_data_get(self);
+
+	return priv_data->backend->message_open(mem_ctx, priv_data->backend, username, messageID, folderID, message_object, msgp);
+}
+
+static enum MAPISTATUS message_get_property(TALLOC_CTX *mem_ctx,
+					    struct openchangedb_context *self,
+					    void *message_object,
+					    uint32_t proptag, void **data)
+{
+	struct ocdb_cache_data *priv_data = _ocdb_cache_data_get(self);
+
+	return priv_data->backend->message_get_property(mem_ctx, priv_data->backend, message_object, proptag, data);
+}
+
+static enum MAPISTATUS message_set_properties(TALLOC_CTX *mem_ctx,
+					      struct openchangedb_context *self,
+					      void *message_object,
+					      struct SRow *row)
+{
+	struct ocdb_cache_data *priv_data = _ocdb_cache_data_get(self);
+
+	return priv_data->backend->message_set_properties(mem_ctx, priv_data->backend, message_object, row);
+}
+
+// ^ openchangedb pass-through ------------------------------------------------
+
+static int openchangedb_cache_destructor(struct ocdb_cache_data *data)
+{
+	ocdb_cache_stats.entries -= data->count;
+	htable_clear(&data->ht);
+	return 0;
+}
+
+/**
+   \details Put a folder metadata cache in front of an openchangedb
+   backend
+
+   \param mem_ctx pointer to the memory context
+   \param max_entries maximum number of entries cached, 0 disables
+   caching
+   \param ttl seconds an entry is served before it is looked up again
+   \param backend pointer to the openchangedb context to decorate
+   \param ctx pointer to the returned openchangedb context
+
+   \return MAPI_E_SUCCESS on success, otherwise MAPI error
+ */
+_PUBLIC_ enum MAPISTATUS openchangedb_cache_initialize(TALLOC_CTX *mem_ctx,
+						       uint32_t max_entries,
+						       uint32_t ttl,
+						       struct openchangedb_context *backend,
+						       struct openchangedb_context **ctx)
+{
+	struct openchangedb_context	*oc_ctx;
+	struct ocdb_cache_data		*data;
+
+	OPENCHANGE_RETVAL_IF(!backend || !ctx, MAPI_E_INVALID_PARAMETER, NULL);
+
+	oc_ctx = talloc_zero(mem_ctx, struct openchangedb_context);
+	OPENCHANGE_RETVAL_IF(oc_ctx == NULL, MAPI_E_NOT_ENOUGH_RESOURCES, NULL);
+	data = talloc_zero(oc_ctx, struct ocdb_cache_data);
+	OPENCHANGE_RETVAL_IF(data == NULL, MAPI_E_NOT_ENOUGH_RESOURCES, oc_ctx);
+
+	data->backend = backend;
+	data->max_entries = max_entries;
+	data->ttl = ttl;
+	htable_init(&data->ht, _ocdb_cache_rehash, NULL);
+	talloc_set_destructor(data, openchangedb_cache_destructor);
+	mapiproxy_stats_register("openchangedb_cache", openchangedb_cache_dump_stats, openchangedb_cache_reset_stats);
+
+	oc_ctx->data = data;
+
+	// Initialize struct with function pointers
+	oc_ctx->backend_type = talloc_strdup(oc_ctx, "cache_module");
+	OPENCHANGE_RETVAL_IF(oc_ctx->backend_type == NULL, MAPI_E_NOT_ENOUGH_RESOURCES, oc_ctx);
+
+	oc_ctx->get_new_changeNumber = get_new_changeNumber;
+	oc_ctx->get_new_changeNumbers = get_new_changeNumbers;
+	oc_ctx->get_next_changeNumber = get_next_changeNumber;
+	oc_ctx->get_SystemFolderID = get_SystemFolderID;
+	oc_ctx->get_SpecialFolderID = get_SpecialFolderID;
+	oc_ctx->get_PublicFolderID = get_PublicFolderID;
+	oc_ctx->get_distinguishedName = get_distinguishedName;
+	oc_ctx->get_MailboxGuid = get_MailboxGuid;
+	oc_ctx->get_MailboxReplica = get_MailboxReplica;
+	oc_ctx->get_PublicFolderReplica = get_PublicFolderReplica;
+	oc_ctx->get_parent_fid = get_parent_fid;
+	oc_ctx->get_MAPIStoreURIs = get_MAPIStoreURIs;
+	oc_ctx->get_mapistoreURI = get_mapistoreURI;
+	oc_ctx->set_mapistoreURI = set_mapistoreURI;
+	oc_ctx->get_fid = get_fid;
+	oc_ctx->get_ReceiveFolder = get_ReceiveFolder;
+	oc_ctx->get_ReceiveFolderTable = get_ReceiveFolderTable;
+	oc_ctx->get_TransportFolder = get_TransportFolder;
+	oc_ctx->lookup_folder_property = lookup_folder_property;
+	oc_ctx->set_folder_properties = set_folder_properties;
+	oc_ctx->get_folder_property = get_folder_property;
+	oc_ctx->get_folder_properties = get_folder_properties;
+	oc_ctx->get_folder_count = get_folder_count;
+	oc_ctx->get_message_count = get_message_count;
+	oc_ctx->get_system_idx = get_system_idx;
+	oc_ctx->set_system_idx = set_system_idx;
+	oc_ctx->get_table_property = get_table_property;
+	oc_ctx->get_fid_by_name = get_fid_by_name;
+	oc_ctx->get_mid_by_subject = get_mid_by_subject;
+	oc_ctx->set_ReceiveFolder = set_ReceiveFolder;
+	oc_ctx->create_mailbox = create_mailbox;
+	oc_ctx->create_folder = create_folder;
+	oc_ctx->delete_folder = delete_folder;
+	oc_ctx->get_fid_from_partial_uri = get_fid_from_partial_uri;
+	oc_ctx->get_users_from_partial_uri = get_users_from_partial_uri;
+
+	oc_ctx->table_init = table_init;
+	oc_ctx->table_set_sort_order = table_set_sort_order;
+	oc_ctx->table_set_restrictions = table_set_restrictions;
+	oc_ctx->table_get_property = table_get_property;
+
+	oc_ctx->message_create = message_create;
+	oc_ctx->message_save = message_save;
+	oc_ctx->message_open = message_open;
+	oc_ctx->message_get_property = message_get_property;
+	oc_ctx->message_set_properties = message_set_properties;
+
+	oc_ctx->transaction_start = transaction_start;
+	oc_ctx->transaction_commit = transaction_commit;
+
+	oc_ctx->get_new_public_folderID = get_new_public_folderID;
+	oc_ctx->is_public_folder_id = is_public_folder_id;
+
+	oc_ctx->get_indexing_url = get_indexing_url;
+	oc_ctx->set_locale = set_locale;
+	oc_ctx->get_folders_names = get_folders_names;
+	oc_ctx->release = release;
+
+	*ctx = oc_ctx;
+
+	return MAPI_E_SUCCESS;
+}
@@ -0,0 +1,46 @@
+/*
+   MAPI Proxy - OpenchangeDB folder metadata cache
+
+   OpenChange Project
+
+   This program is free software; you can redistribute it and/or modify
+   it under the terms of the GNU General Public License as published by
+   the Free Software Foundation; either version 3 of the License, or
+   (at your option) any later version.
+
+   This program is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+   GNU General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef __OPENCHANGEDB_CACHE_H__
+#define __OPENCHANGEDB_CACHE_H__
+
+#include "openchangedb_backends.h"
+
+/* Cache defaults, see openchangedb_cache_initialize */
+#define	OPENCHANGEDB_CACHE_DEFAULT_SIZE	4096
+#define	OPENCHANGEDB_CACHE_DEFAULT_TTL	300
+
+/* Counters of every cache of the process */
+struct openchangedb_cache_stats {
+	uint64_t	hits;
+	uint64_t	misses;
+	uint64_t	evictions;
+	uint64_t	expirations;
+	uint64_t	invalidations;
+	uint64_t	entries;
+};
+
+enum MAPISTATUS openchangedb_cache_initialize(TALLOC_CTX *mem_ctx,
+					      uint32_t max_entries,
+					      uint32_t ttl,
+					      struct openchangedb_context *backend,
+					      struct openchangedb_context **ctx);
+void openchangedb_cache_get_stats(struct openchangedb_cache_stats *);
+
+#endif /* __OPENCHANGEDB_CACHE_H__ */
@@ -30,6 +30,9 @@
 
 #define	OPENCHANGE_LDB_NAME "openchange.ldb"
 
+/* Attempts at reserving change numbers while other processes race us */
+#define	OPENCHANGE_LDB_CN_RETRIES	16
+
 extern struct ldb_val ldb_binary_decode(TALLOC_CTX *, const char *);
 
 
@@ -942,32 +945,87 @@ static enum MAPISTATUS get_ReceiveFolderTable(TALLOC_CTX *mem_ctx,
 	return MAPI_E_SUCCESS;
 }
 
-static enum MAPISTATUS get_new_changeNumber(struct openchangedb_context *self, const char *username, uint64_t *cn)
+/**
+   \details Reserve a range of change numbers on the server object.
+
+   The modify request deletes the value we read and adds the new one:
+   it fails if another process updated the counter in between, in
+   which case we read it again and retry.
+
+   \param ldb_ctx pointer to the openchange LDB context
+   \param count number of change numbers to reserve
+   \param first pointer to the first reserved change number the
+   function returns
+ */
+static enum MAPISTATUS reserve_change_numbers(struct ldb_context *ldb_ctx, uint64_t count, uint64_t *first)
 {
-	TALLOC_CTX		*mem_ctx;
-	int			ret;
-	struct ldb_result	*res;
-	struct ldb_message	*msg;
-	const char * const	attrs[] = { "*", NULL };
-	struct ldb_context	*ldb_ctx = self->data;
+	TALLOC_CTX			*mem_ctx;
+	int				ret;
+	int				retries;
+	struct ldb_result		*res;
+	struct ldb_message		*msg;
+	struct ldb_message_element	*el;
+	struct ldb_message_element	*old_el;
+	struct ldb_val			*new_val;
+	const char * const		attrs[] = { "ChangeNumber", NULL };
+	uint64_t			cn;
 
-	/* Get the current GlobalCount */
-	mem_ctx = talloc_named(NULL, 0, "get_next_changeNumber");
-	ret = ldb_search(ldb_ctx, mem_ctx, &res, ldb_get_root_basedn(ldb_ctx),
-			 LDB_SCOPE_SUBTREE, attrs, "(objectClass=server)");
-	OPENCHANGE_RETVAL_IF(ret != LDB_SUCCESS || !res->count, MAPI_E_NOT_FOUND, mem_ctx);
+	mem_ctx = talloc_named(NULL, 0, "reserve_change_numbers");
+	OPENCHANGE_RETVAL_IF(!mem_ctx, MAPI_E_NOT_ENOUGH_MEMORY, NULL);
 
-	*cn = ldb_msg_find_attr_as_uint64(res->msgs[0], "ChangeNumber", 1);
+	for (retries = 0; retries < OPENCHANGE_LDB_CN_RETRIES; retries++) {
+		/* Get the current GlobalCount */
+		ret = ldb_search(ldb_ctx, mem_ctx, &res, ldb_get_root_basedn(ldb_ctx),
+				 LDB_SCOPE_SUBTREE, attrs, "(objectClass=server)");
+		OPENCHANGE_RETVAL_IF(ret != LDB_SUCCESS || !res->count, MAPI_E_NOT_FOUND, mem_ctx);
 
-	/* Update GlobalCount value */
-	msg = ldb_msg_new(mem_ctx);
-	msg->dn = ldb_dn_copy(msg, ldb_msg_find_attr_as_dn(ldb_ctx, mem_ctx, res->msgs[0], "distinguishedName"));
-	ldb_msg_add_fmt(msg, "ChangeNumber", "%"PRIu64, ((*cn) + 1));
-	msg->elements[0].flags = LDB_FLAG_MOD_REPLACE;
-	ret = ldb_modify(ldb_ctx, msg);
-	OPENCHANGE_RETVAL_IF(ret != LDB_SUCCESS, MAPI_E_NO_SUPPORT, mem_ctx);
+		cn = ldb_msg_find_attr_as_uint64(res->msgs[0], "ChangeNumber", 1);
+		old_el = ldb_msg_find_element(res->msgs[0], "ChangeNumber");
+
+		/* Update GlobalCount value */
+		msg = ldb_msg_new(mem_ctx);
+		OPENCHANGE_RETVAL_IF(!msg, MAPI_E_NOT_ENOUGH_MEMORY, mem_ctx);
+		msg->dn = res->msgs[0]->dn;
+		if (old_el && old_el->num_values) {
+			ret = ldb_msg_add_empty(msg, "ChangeNumber", LDB_FLAG_MOD_DELETE, &el);
+			OPENCHANGE_RETVAL_IF(ret != LDB_SUCCESS, MAPI_E_NOT_ENOUGH_MEMORY, mem_ctx);
+			el->num_values = 1;
+			el->values = &old_el->values[0];
+		}
+		ret = ldb_msg_add_empty(msg, "ChangeNumber", LDB_FLAG_MOD_ADD, &el);
+		OPENCHANGE_RETVAL_IF(ret != LDB_SUCCESS, MAPI_E_NOT_ENOUGH_MEMORY, mem_ctx);
+		new_val = talloc_zero(msg, struct ldb_val);
+		OPENCHANGE_RETVAL_IF(!new_val, MAPI_E_NOT_ENOUGH_MEMORY, mem_ctx);
+		*new_val = data_blob_string_const(talloc_asprintf(msg, "%"PRIu64, cn + count));
+		OPENCHANGE_RETVAL_IF(!new_val->data, MAPI_E_NOT_ENOUGH_MEMORY, mem_ctx);
+		el->num_values = 1;
+		el->values = new_val;
+
+		ret = ldb_modify(ldb_ctx, msg);
+		if (ret == LDB_SUCCESS) {
+			*first = cn;
+			talloc_free(mem_ctx);
+			return MAPI_E_SUCCESS;
+		}
+		if (ret != LDB_ERR_NO_SUCH_ATTRIBUTE && ret != LDB_ERR_ATTRIBUTE_OR_VALUE_EXISTS) {
+			break;
+		}
+		talloc_free(res);
+		talloc_free(msg);
+	}
 
+	OC_DEBUG(1, "Unable to reserve %"PRIu64" change numbers: %s\n", count, ldb_errstring(ldb_ctx));
 	talloc_free(mem_ctx);
+	return MAPI_E_NO_SUPPORT;
+}
+
+static enum MAPISTATUS get_new_changeNumber(struct openchangedb_context *self, const char *username, uint64_t *cn)
+{
+	enum MAPISTATUS		retval;
+	struct ldb_context	*ldb_ctx = self->data;
+
+	retval = reserve_change_numbers(ldb_ctx, 1, cn);
+	OPENCHANGE_RETVAL_IF(retval != MAPI_E_SUCCESS, retval, NULL);
 
 	*cn = (exchange_globcnt(*cn) << 16) | 0x0001;
 
@@ -980,42 +1038,25 @@ static enum MAPISTATUS get_new_changeNumbers(struct openchangedb_context *self,
 					     uint64_t max,
 					     struct UI8Array_r **cns_p)
 {
-	TALLOC_CTX		*local_mem_ctx;
-	int			ret;
-	struct ldb_result	*res;
-	struct ldb_message	*msg;
-	const char * const	attrs[] = { "*", NULL };
+	enum MAPISTATUS		retval;
 	uint64_t		cn, count;
 	struct UI8Array_r	*cns;
 	struct ldb_context	*ldb_ctx = self->data;
 
-	/* Get the current GlobalCount */
-	local_mem_ctx = talloc_named(NULL, 0, "get_new_changeNumber");
-	ret = ldb_search(ldb_ctx, local_mem_ctx, &res, ldb_get_root_basedn(ldb_ctx),
-			 LDB_SCOPE_SUBTREE, attrs, "(objectClass=server)");
-	OPENCHANGE_RETVAL_IF(ret != LDB_SUCCESS || !res->count, MAPI_E_NOT_FOUND, local_mem_ctx);
-
-	cn = ldb_msg_find_attr_as_uint64(res->msgs[0], "ChangeNumber", 1);
+	retval = reserve_change_numbers(ldb_ctx, max, &cn);
+	OPENCHANGE_RETVAL_IF(retval != MAPI_E_SUCCESS, retval, NULL);
 
-	cns = talloc_zero(local_mem_ctx, struct UI8Array_r);
+	cns = talloc_zero(mem_ctx, struct UI8Array_r);
+	OPENCHANGE_RETVAL_IF(!cns, MAPI_E_NOT_ENOUGH_MEMORY, NULL);
 	cns->cValues = max;
 	cns->lpui8 = talloc_array(cns, uint64_t, max);
+	OPENCHANGE_RETVAL_IF(!cns->lpui8, MAPI_E_NOT_ENOUGH_MEMORY, cns);
 
 	for (count = 0; count < max; count++) {
 		cns->lpui8[count] = (exchange_globcnt(cn + count) << 16) | 0x0001;
 	}
 
-	/* Update GlobalCount value */
-	msg = ldb_msg_new(local_mem_ctx);
-	msg->dn = ldb_dn_copy(msg, ldb_msg_find_attr_as_dn(ldb_ctx, local_mem_ctx, res->msgs[0], "distinguishedName"));
-	ldb_msg_add_fmt(msg, "ChangeNumber", "%"PRIu64, (cn + max));
-	msg->elements[0].flags = LDB_FLAG_MOD_REPLACE;
-	ret = ldb_modify(ldb_ctx, msg);
-	OPENCHANGE_RETVAL_IF(ret != LDB_SUCCESS, MAPI_E_NO_SUPPORT, local_mem_ctx);
-
 	*cns_p = cns;
-	(void) talloc_reference(mem_ctx, cns);
-	talloc_free(local_mem_ctx);
 
 	return MAPI_E_SUCCESS;
 }
@@ -1086,6 +1127,66 @@ static enum MAPISTATUS get_folder_property(TALLOC_CTX *parent_ctx,
 	return MAPI_E_NOT_FOUND;
 }
 
+/**
+   \details Retrieve several properties of a folder record with a
+   single search, see get_folder_property.
+ */
+static enum MAPISTATUS get_folder_properties(TALLOC_CTX *parent_ctx,
+					     struct openchangedb_context *self,
+					     const char *username,
+					     uint64_t fid,
+					     struct SPropTagArray *properties,
+					     void **data,
+					     enum MAPISTATUS *retvals)
+{
+	TALLOC_CTX		*mem_ctx;
+	struct ldb_result	*res = NULL;
+	const char * const	attrs[] = { "*", NULL };
+	const char		*PidTagAttr = NULL;
+	uint32_t		proptag;
+	uint32_t		i;
+	int			ret;
+	struct ldb_context	*ldb_ctx = self->data;
+
+	mem_ctx = talloc_named(NULL, 0, "get_folder_properties");
+
+	/* Step 1. Find PidTagFolderId record */
+	ret = ldb_search(ldb_ctx, mem_ctx, &res, ldb_get_default_basedn(ldb_ctx),
+			 LDB_SCOPE_SUBTREE, attrs, "(PidTagFolderId=%"PRIu64")", fid);
+	OPENCHANGE_RETVAL_IF(ret != LDB_SUCCESS || !res->count, MAPI_E_NOT_FOUND, mem_ctx);
+
+	for (i = 0; i < properties->cValues; i++) {
+		proptag = properties->aulPropTag[i];
+		data[i] = NULL;
+		retvals[i] = MAPI_E_NOT_FOUND;
+
+		/* Step 2. Convert proptag into PidTag attribute */
+		PidTagAttr = openchangedb_property_get_attribute(proptag);
+		if (!PidTagAttr) {
+			PidTagAttr = _unknown_property(mem_ctx, proptag);
+		}
+
+		/* Step 3. Ensure the element exists */
+		if (!ldb_msg_find_element(res->msgs[0], PidTagAttr)) continue;
+
+		/* Step 4. Check if this is a "special property" */
+		data[i] = _get_special_property(parent_ctx, ldb_ctx, res, proptag, PidTagAttr);
+
+		/* Step 5. If this is not a "special property" */
+		if (!data[i]) {
+			data[i] = get_property_data(parent_ctx, res, 0, proptag, PidTagAttr);
+		}
+
+		if (data[i]) {
+			retvals[i] = MAPI_E_SUCCESS;
+		}
+	}
+
+	talloc_free(mem_ctx);
+
+	return MAPI_E_SUCCESS;
+}
+
 static enum MAPISTATUS set_folder_properties(struct openchangedb_context *self,
 					     const char *username, uint64_t fid,
 					     struct SRow *row)
@@ -2364,6 +2465,105 @@ static enum MAPISTATUS message_set_properties(TALLOC_CTX *mem_ctx,
 
 // ^ openchangedb message -----------------------------------------------------
 
+/* Attributes the backend searches on, keep in sync with
+ * setup/openchangedb/oc_provision_openchange_init.ldif */
+static const char *openchangedb_ldb_indexes[] = {
+	"cn",
+	"objectClass",
+	"PidTagFolderId",
+	"PidTagParentFolderId",
+	"PidTagMessageId",
+	"MAPIStoreURI",
+	"SystemIdx",
+	"PidTagMessageClass",
+	"PidTagDisplayName",
+	"PidTagNormalizedSubject",
+	"MailboxGUID",
+	"mailboxDN",
+	NULL
+};
+
+/**
+   \details Add the attribute indexes the backend relies on which are
+   missing from an openchangedb database. Databases provisioned prior
+   to these indexes are migrated this way, ldb rebuilds the indexes
+   when @INDEXLIST changes.
+
+   \param ldb_ctx pointer to the openchangedb ldb context
+   \param added pointer to the returned number of indexes added -
+   optional
+
+   \return MAPI_E_SUCCESS on success, otherwise MAPI error
+ */
+_PUBLIC_ enum MAPISTATUS openchangedb_ldb_update_indexes(struct ldb_context *ldb_ctx, uint32_t *added)
+{
+	TALLOC_CTX			*mem_ctx;
+	struct ldb_result		*res = NULL;
+	struct ldb_message		*msg;
+	struct ldb_message_element	*el = NULL;
+	struct ldb_dn			*dn;
+	const char * const		attrs[] = { "@IDXATTR", NULL };
+	uint32_t			i, j;
+	size_t				len;
+	int				ret;
+
+	OPENCHANGE_RETVAL_IF(!ldb_ctx, MAPI_E_INVALID_PARAMETER, NULL);
+
+	mem_ctx = talloc_named(NULL, 0, "openchangedb_ldb_update_indexes");
+	OPENCHANGE_RETVAL_IF(!mem_ctx, MAPI_E_NOT_ENOUGH_MEMORY, NULL);
+
+	dn = ldb_dn_new(mem_ctx, ldb_ctx, "@INDEXLIST");
+	OPENCHANGE_RETVAL_IF(!dn, MAPI_E_NOT_ENOUGH_MEMORY, mem_ctx);
+
+	ret = ldb_search(ldb_ctx, mem_ctx, &res, dn, LDB_SCOPE_BASE, attrs, NULL);
+	OPENCHANGE_RETVAL_IF(ret != LDB_SUCCESS && ret != LDB_ERR_NO_SUCH_OBJECT, MAPI_E_CALL_FAILED, mem_ctx);
+	if (ret == LDB_SUCCESS && res->count) {
+		el = ldb_msg_find_element(res->msgs[0], "@IDXATTR");
+	}
+
+	msg = ldb_msg_new(mem_ctx);
+	OPENCHANGE_RETVAL_IF(!msg, MAPI_E_NOT_ENOUGH_MEMORY, mem_ctx);
+	msg->dn = dn;
+
+	for (i = 0; openchangedb_ldb_indexes[i]; i++) {
+		len = strlen(openchangedb_ldb_indexes[i]);
+		for (j = 0; el && j < el->num_values; j++) {
+			if (el->values[j].length == len &&
+			    !strncasecmp((const char *)el->values[j].data, openchangedb_ldb_indexes[i], len)) {
+				break;
+			}
+		}
+		if (el && j < el->num_values) continue;
+
+		ret = ldb_msg_add_string(msg, "@IDXATTR", openchangedb_ldb_indexes[i]);
+		OPENCHANGE_RETVAL_IF(ret != LDB_SUCCESS, MAPI_E_NOT_ENOUGH_MEMORY, mem_ctx);
+	}
+
+	if (added) {
+		*added = msg->num_elements ? msg->elements[0].num_values : 0;
+	}
+	if (!msg->num_elements) {
+		talloc_free(mem_ctx);
+		return MAPI_E_SUCCESS;
+	}
+
+	OC_DEBUG(1, "openchangedb: indexing %u more attribute(s), this may take a while",
+		 msg->elements[0].num_values);
+	msg->elements[0].flags = LDB_FLAG_MOD_ADD;
+	if (el) {
+		ret = ldb_modify(ldb_ctx, msg);
+	} else {
+		ret = ldb_add(ldb_ctx, msg);
+	}
+	if (ret != LDB_SUCCESS) {
+		OC_DEBUG(0, "openchangedb: unable to update indexes: %s", ldb_errstring(ldb_ctx));
+	}
+	OPENCHANGE_RETVAL_IF(ret != LDB_SUCCESS, MAPI_E_CALL_FAILED, mem_ctx);
+
+	talloc_free(mem_ctx);
+	return MAPI_E_SUCCESS;
+}
+
 _PUBLIC_ enum MAPISTATUS openchangedb_ldb_initialize(TALLOC_CTX *mem_ctx,
 						     const char *private_dir,
 						     struct openchangedb_context **ctx)
@@ -2410,6 +2610,11 @@ _PUBLIC_ enum MAPISTATUS openchangedb_ldb_initialize(TALLOC_CTX *mem_ctx,
 					 "defaultNamingContext");
 	ldb_set_opaque(ldb_ctx, "defaultNamingContext", tmp_dn);
 
+	/* Step 4. Index the attributes we search on */
+	if (openchangedb_ldb_update_indexes(ldb_ctx, NULL) != MAPI_E_SUCCESS) {
+		OC_DEBUG(1, "openchangedb: searches will not be indexed");
+	}
+
 	oc_ctx->data = ldb_ctx;
 
 	// Initialize struct with function pointers
@@ -2436,6 +2641,7 @@ _PUBLIC_ enum MAPISTATUS openchangedb_ldb_initialize(TALLOC_CTX *mem_ctx,
 	oc_ctx->lookup_folder_property = lookup_folder_property;
 	oc_ctx->set_folder_properties = set_folder_properties;
 	oc_ctx->get_folder_property = get_folder_property;
+	oc_ctx->get_folder_properties = get_folder_properties;
 	oc_ctx->get_folder_count = get_folder_count;
 	oc_ctx->get_message_count = get_message_count;
 	oc_ctx->get_system_idx = get_system_idx;
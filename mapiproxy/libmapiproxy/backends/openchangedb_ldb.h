@@ -25,6 +25,9 @@
 
 #include "openchangedb_backends.h"
 
+struct ldb_context;
+
 enum MAPISTATUS openchangedb_ldb_initialize(TALLOC_CTX *, const char *, struct openchangedb_context **);
+enum MAPISTATUS openchangedb_ldb_update_indexes(struct ldb_context *, uint32_t *);
 
 #endif /* __OPENCHANGEDB_LDB_H__ */
@@ -390,6 +390,24 @@ static enum MAPISTATUS get_folder_property(TALLOC_CTX *parent_ctx,
 	return retval;
 }
 
+static enum MAPISTATUS get_folder_properties(TALLOC_CTX *parent_ctx,
+					     struct openchangedb_context *self,
+					     const char *username, uint64_t fid,
+					     struct SPropTagArray *properties,
+					     void **data, enum MAPISTATUS *retvals)
+{
+	enum MAPISTATUS retval;
+	struct ocdb_logger_data *priv_data = _ocdb_logger_data_get(self);
+
+	OC_DEBUG(priv_data->log_level, "%s[in]: username=[%s], fid=[0x%016"PRIx64"], count=[%u]",
+					priv_data->log_prefix, username, fid, properties->cValues);
+	retval = openchangedb_get_folder_properties(parent_ctx, priv_data->backend, username, fid, properties, data, retvals);
+	OC_DEBUG(priv_data->log_level, "%s[out]: retval=[%s]",
+					priv_data->log_prefix, mapi_get_errstr(retval));
+
+	return retval;
+}
+
 static enum MAPISTATUS set_folder_properties(struct openchangedb_context *self,
 					     const char *username, uint64_t fid,
 					     struct SRow *row)
@@ -689,6 +707,15 @@ static const char **get_folders_names(TALLOC_CTX *mem_ctx, struct openchangedb_c
 
 	return names;
 }
+
+static void release(struct openchangedb_context *self)
+{
+	struct ocdb_logger_data *priv_data = _ocdb_logger_data_get(self);
+
+	if (priv_data->backend->release) {
+		priv_data->backend->release(priv_data->backend);
+	}
+}
 // ^ openchangedb -------------------------------------------------------------
 
 // v openchangedb table -------------------------------------------------------
@@ -876,6 +903,7 @@ _PUBLIC_ enum MAPISTATUS openchangedb_logger_initialize(TALLOC_CTX *mem_ctx,
 	oc_ctx->lookup_folder_property = lookup_folder_property;
 	oc_ctx->set_folder_properties = set_folder_properties;
 	oc_ctx->get_folder_property = get_folder_property;
+	oc_ctx->get_folder_properties = get_folder_properties;
 	oc_ctx->get_folder_count = get_folder_count;
 	oc_ctx->get_message_count = get_message_count;
 	oc_ctx->get_system_idx = get_system_idx;
@@ -910,6 +938,7 @@ _PUBLIC_ enum MAPISTATUS openchangedb_logger_initialize(TALLOC_CTX *mem_ctx,
 	oc_ctx->get_indexing_url = get_indexing_url;
 	oc_ctx->set_locale = set_locale;
 	oc_ctx->get_folders_names = get_folders_names;
+	oc_ctx->release = release;
 
 	*ctx = oc_ctx;
 
@@ -37,6 +37,11 @@
 
 #define THRESHOLD_SLOW_QUERIES 0.25
 
+/* Connection for queries of a session, see mysql_rw_init */
+#define READER(self, session)	mysql_rw_reader((struct mysql_rw *)(self)->data, (session))
+#define WRITER(self, session)	mysql_rw_writer((struct mysql_rw *)(self)->data, (session))
+/* Connection for reads which can't tell their session */
+#define READER_ANY(self)	mysql_rw_reader_any((struct mysql_rw *)(self)->data)
 
 static enum MAPISTATUS _not_implemented(const char *caller) {
 	OC_DEBUG(0, "Called not implemented function `%s` from mysql backend", caller);
@@ -71,7 +76,7 @@ static enum MAPISTATUS get_SpecialFolderID(struct openchangedb_context *self,
 
 	mem_ctx = talloc_named(NULL, 0, "get_SpecialFolderId");
 	OPENCHANGE_RETVAL_IF(!mem_ctx, MAPI_E_NOT_ENOUGH_MEMORY, NULL);
-	conn = self->data;
+	conn = READER(self, recipient);
 	OPENCHANGE_RETVAL_IF(!conn, MAPI_E_BAD_VALUE, mem_ctx);
 
 	sql = talloc_asprintf(mem_ctx,
@@ -102,7 +107,7 @@ static enum MAPISTATUS get_SystemFolderID(struct openchangedb_context *self,
 
 	mem_ctx = talloc_named(NULL, 0, "get_SystemFolderId");
 	OPENCHANGE_RETVAL_IF(!mem_ctx, MAPI_E_NOT_ENOUGH_MEMORY, NULL);
-	conn = self->data;
+	conn = READER(self, recipient);
 	OPENCHANGE_RETVAL_IF(!conn, MAPI_E_BAD_VALUE, mem_ctx);
 
 	if (SystemIdx == 0x1) {
@@ -139,7 +144,7 @@ static enum MAPISTATUS get_PublicFolderID(struct openchangedb_context *self,
 
 	mem_ctx = talloc_named(NULL, 0, "get_PublicFolderID");
 	OPENCHANGE_RETVAL_IF(!mem_ctx, MAPI_E_NOT_ENOUGH_MEMORY, NULL);
-	conn = self->data;
+	conn = READER(self, username);
 	OPENCHANGE_RETVAL_IF(!conn, MAPI_E_BAD_VALUE, mem_ctx);
 
 	sql = talloc_asprintf(mem_ctx,
@@ -177,7 +182,7 @@ static enum MAPISTATUS get_MailboxGuid(struct openchangedb_context *self,
 
 	mem_ctx = talloc_named(NULL, 0, "get_MailboxGuid");
 	OPENCHANGE_RETVAL_IF(!mem_ctx, MAPI_E_NOT_ENOUGH_MEMORY, NULL);
-	conn = self->data;
+	conn = READER(self, recipient);
 	OPENCHANGE_RETVAL_IF(!conn, MAPI_E_BAD_VALUE, mem_ctx);
 
 	sql = talloc_asprintf(mem_ctx,
@@ -210,7 +215,7 @@ static enum MAPISTATUS get_MailboxReplica(struct openchangedb_context *self,
 
 	mem_ctx = talloc_named(NULL, 0, "get_MailboxReplica");
 	OPENCHANGE_RETVAL_IF(!mem_ctx, MAPI_E_NOT_ENOUGH_MEMORY, NULL);
-	conn = self->data;
+	conn = READER(self, recipient);
 	OPENCHANGE_RETVAL_IF(!conn, MAPI_E_BAD_VALUE, mem_ctx);
 
 	if (ReplID) {
@@ -255,7 +260,7 @@ static enum MAPISTATUS get_PublicFolderReplica(struct openchangedb_context *self
 
 	mem_ctx = talloc_named(NULL, 0, "get_PublicFolderReplica");
 	OPENCHANGE_RETVAL_IF(!mem_ctx, MAPI_E_NOT_ENOUGH_MEMORY, NULL);
-	conn = self->data;
+	conn = READER(self, username);
 	OPENCHANGE_RETVAL_IF(!conn, MAPI_E_BAD_VALUE, mem_ctx);
 
 	if (ReplID) {
@@ -299,7 +304,7 @@ static enum MAPISTATUS get_mapistoreURI(TALLOC_CTX *parent_ctx,
 
 	mem_ctx = talloc_named(NULL, 0, "get_mapistoreURI");
 	OPENCHANGE_RETVAL_IF(!mem_ctx, MAPI_E_NOT_ENOUGH_MEMORY, NULL);
-	conn = self->data;
+	conn = READER(self, username);
 	OPENCHANGE_RETVAL_IF(!conn, MAPI_E_BAD_VALUE, mem_ctx);
 
 	if (!mailboxstore) {
@@ -330,7 +335,7 @@ static enum MAPISTATUS get_fid(struct openchangedb_context *self,
 
 	mem_ctx = talloc_named(NULL, 0, "get_fid");
 	OPENCHANGE_RETVAL_IF(!mem_ctx, MAPI_E_NOT_ENOUGH_MEMORY, NULL);
-	conn = self->data;
+	conn = READER_ANY(self);
 	OPENCHANGE_RETVAL_IF(!conn, MAPI_E_BAD_VALUE, mem_ctx);
 
 	mapistore_uri_2 = talloc_strdup(mem_ctx, mapistore_uri);
@@ -365,7 +370,7 @@ static enum MAPISTATUS set_mapistoreURI(struct openchangedb_context *self,
 
 	mem_ctx = talloc_named(NULL, 0, "set_mapistoreURI");
 	OPENCHANGE_RETVAL_IF(!mem_ctx, MAPI_E_NOT_ENOUGH_MEMORY, NULL);
-	conn = self->data;
+	conn = WRITER(self, username);
 	OPENCHANGE_RETVAL_IF(!conn, MAPI_E_BAD_VALUE, mem_ctx);
 
 	sql = talloc_asprintf(mem_ctx,
@@ -401,7 +406,7 @@ static enum MAPISTATUS get_parent_fid(struct openchangedb_context *self,
 
 	mem_ctx = talloc_named(NULL, 0, "get_parent_fid");
 	OPENCHANGE_RETVAL_IF(!mem_ctx, MAPI_E_NOT_ENOUGH_MEMORY, NULL);
-	conn = self->data;
+	conn = READER(self, username);
 	OPENCHANGE_RETVAL_IF(!conn, MAPI_E_BAD_VALUE, mem_ctx);
 
 	if (mailboxstore) {
@@ -449,7 +454,7 @@ static enum MAPISTATUS get_MAPIStoreURIs(struct openchangedb_context *self,
 
 	mem_ctx = talloc_named(NULL, 0, "get_MAPIStoreURIs");
 	OPENCHANGE_RETVAL_IF(!mem_ctx, MAPI_E_NOT_ENOUGH_MEMORY, NULL);
-	conn = self->data;
+	conn = READER(self, username);
 	OPENCHANGE_RETVAL_IF(!conn, MAPI_E_BAD_VALUE, mem_ctx);
 
 	sql = talloc_asprintf(mem_ctx,
@@ -486,7 +491,7 @@ static enum MAPISTATUS get_ReceiveFolder(TALLOC_CTX *parent_ctx,
 	OPENCHANGE_RETVAL_IF(!fid, MAPI_E_INVALID_PARAMETER, NULL);
 	OPENCHANGE_RETVAL_IF(!ExplicitMessageClass, MAPI_E_INVALID_PARAMETER, NULL);
 
-	conn = self->data;
+	conn = READER(self, recipient);
 
 	mem_ctx = talloc_named(NULL, 0, "get_ReceiveFolder");
 	OPENCHANGE_RETVAL_IF(!mem_ctx, MAPI_E_NOT_ENOUGH_MEMORY, NULL);
@@ -570,7 +575,7 @@ static enum MAPISTATUS get_ReceiveFolderTable(TALLOC_CTX *parent_ctx,
 
 	mem_ctx = talloc_named(NULL, 0, "get_ReceiveFolderTable");
 	OPENCHANGE_RETVAL_IF(!mem_ctx, MAPI_E_NOT_ENOUGH_MEMORY, NULL);
-	conn = self->data;
+	conn = READER(self, recipient);
 	OPENCHANGE_RETVAL_IF(!conn, MAPI_E_BAD_VALUE, mem_ctx);
 
 	sql = talloc_asprintf(mem_ctx,
@@ -655,56 +660,33 @@ static enum MAPISTATUS get_mailbox_ids_by_name(MYSQL *conn,
 					       uint64_t *mailbox_folder_id,
 					       uint64_t *ou_id)
 {
-	TALLOC_CTX	*mem_ctx;
-	enum MAPISTATUS	retval;
-	char		*sql;
-	MYSQL_RES	*res;
-	MYSQL_ROW	row;
+	enum MAPISTATUS		retval;
+	struct stmt_value	params[] = { STMT_STRING_VALUE(username) };
+	struct stmt_value	results[] = { STMT_UINT_VALUE(0), STMT_UINT_VALUE(0), STMT_UINT_VALUE(0) };
 
 	/* Sanity checks */
 	OPENCHANGE_RETVAL_IF(!conn, MAPI_E_INVALID_PARAMETER, NULL);
 	OPENCHANGE_RETVAL_IF(!username, MAPI_E_INVALID_PARAMETER, NULL);
 
-	mem_ctx = talloc_named(NULL, 0, "get_mailbox_ids_by_name");
-	OPENCHANGE_RETVAL_IF(!mem_ctx, MAPI_E_NOT_ENOUGH_MEMORY, NULL);
-
-	sql = talloc_asprintf(mem_ctx,
+	retval = status(stmt_select_first(NULL, conn,
 		"SELECT m.id, m.folder_id, m.ou_id FROM mailboxes m "
-		"WHERE m.name = '%s'", _sql(mem_ctx, username));
-	OPENCHANGE_RETVAL_IF(!sql, MAPI_E_NOT_ENOUGH_MEMORY, mem_ctx);
-
-	retval = status(select_without_fetch(conn, sql, &res));
-	OPENCHANGE_RETVAL_IF(retval != MAPI_E_SUCCESS, retval, mem_ctx);
-	row = mysql_fetch_row(res);
-	if (row == NULL) {
-		OC_DEBUG(0, "Error getting user's mailbox `%s`: %s", sql,
-			  mysql_error(conn));
-		retval = MAPI_E_NOT_FOUND;
-		goto end;
-	}
+		"WHERE m.name = ?", params, 1, results, 3));
+	OPENCHANGE_RETVAL_IF(retval != MAPI_E_SUCCESS, retval, NULL);
 
 	if (mailbox_id) {
-		if (!convert_string_to_ull(row[0], mailbox_id)) {
-			retval = MAPI_E_CALL_FAILED;
-			goto end;
-		}
+		OPENCHANGE_RETVAL_IF(results[0].is_null, MAPI_E_CALL_FAILED, NULL);
+		*mailbox_id = results[0].n;
 	}
 	if (mailbox_folder_id) {
-		if (!convert_string_to_ull(row[1], mailbox_folder_id)) {
-			retval = MAPI_E_CALL_FAILED;
-			goto end;
-		}
+		OPENCHANGE_RETVAL_IF(results[1].is_null, MAPI_E_CALL_FAILED, NULL);
+		*mailbox_folder_id = results[1].n;
 	}
 	if (ou_id) {
-		if (!convert_string_to_ull(row[2], ou_id)) {
-			retval = MAPI_E_CALL_FAILED;
-			goto end;
-		}
+		OPENCHANGE_RETVAL_IF(results[2].is_null, MAPI_E_CALL_FAILED, NULL);
+		*ou_id = results[2].n;
 	}
-end:
-	mysql_free_result(res);
-	talloc_free(mem_ctx);
-	return retval;
+
+	return MAPI_E_SUCCESS;
 }
 
 #define is_public_folder(id) is_public_folder_id(NULL, id)
@@ -727,7 +709,7 @@ static enum MAPISTATUS get_folder_count(struct openchangedb_context *self,
 
 	mem_ctx = talloc_named(NULL, 0, "get_folder_count");
 	OPENCHANGE_RETVAL_IF(!mem_ctx, MAPI_E_NOT_ENOUGH_MEMORY, NULL);
-	conn = self->data;
+	conn = READER(self, username);
 	OPENCHANGE_RETVAL_IF(!conn, MAPI_E_BAD_VALUE, mem_ctx);
 
 	if (is_public_folder(fid)) {
@@ -807,35 +789,61 @@ static enum MAPISTATUS get_server_change_number(MYSQL *conn,
 }
 
 /**
-   \details Set the current change number field
+   \details Reserve a range of change numbers on the server. The
+   counter is incremented by a single statement, so concurrent
+   processes never get overlapping ranges.
+
+   \param conn pointer to the MySQL connection
+   \param username the mailbox the change numbers are reserved for
+   \param count number of change numbers to reserve
+   \param first pointer to the first reserved change number the
+   function returns
  */
-static enum MAPISTATUS set_server_change_number(MYSQL *conn,
-						const char *username,
-						uint64_t change_number)
+static enum MAPISTATUS reserve_server_change_numbers(MYSQL *conn,
+						     const char *username,
+						     uint64_t count,
+						     uint64_t *first)
 {
 	TALLOC_CTX	*mem_ctx;
 	enum MAPISTATUS	retval;
 	char		*sql;
+	const char	*info;
+	unsigned long	matched = 0;
 
 	/* Sanity checks */
 	OPENCHANGE_RETVAL_IF(!conn, MAPI_E_INVALID_PARAMETER, NULL);
 	OPENCHANGE_RETVAL_IF(!username, MAPI_E_INVALID_PARAMETER, NULL);
-	OPENCHANGE_RETVAL_IF(!change_number, MAPI_E_INVALID_PARAMETER, NULL);
+	OPENCHANGE_RETVAL_IF(!count, MAPI_E_INVALID_PARAMETER, NULL);
+	OPENCHANGE_RETVAL_IF(!first, MAPI_E_INVALID_PARAMETER, NULL);
 
-	mem_ctx = talloc_named(NULL, 0, "set_server_change_number");
+	mem_ctx = talloc_named(NULL, 0, "reserve_server_change_numbers");
 	OPENCHANGE_RETVAL_IF(!mem_ctx, MAPI_E_NOT_ENOUGH_MEMORY, NULL);
 
+	/* LAST_INSERT_ID(expr) hands the new value back to the client
+	 * through mysql_insert_id(), no SELECT needed */
 	sql = talloc_asprintf(mem_ctx,
 		"UPDATE servers s "
 		"JOIN mailboxes m ON m.ou_id = s.ou_id AND m.name = '%s' "
-		"SET s.change_number=%"PRIu64,
-		_sql(mem_ctx, username), change_number);
+		"SET s.change_number = LAST_INSERT_ID(s.change_number + %"PRIu64")",
+		_sql(mem_ctx, username), count);
 	OPENCHANGE_RETVAL_IF(!sql, MAPI_E_NOT_ENOUGH_MEMORY, mem_ctx);
 
 	retval = status(execute_query(conn, sql));
+	OPENCHANGE_RETVAL_IF(retval != MAPI_E_SUCCESS, retval, mem_ctx);
+
+	/* Only a missing mailbox means no change number was reserved:
+	 * look at the rows the UPDATE matched, not at the rows it
+	 * changed or at the value it returned, which may be 0 */
+	info = mysql_info(conn);
+	if (!info || sscanf(info, "Rows matched: %lu", &matched) != 1) {
+		matched = mysql_affected_rows(conn);
+	}
+	OPENCHANGE_RETVAL_IF(matched == 0, MAPI_E_NOT_FOUND, mem_ctx);
+
+	*first = mysql_insert_id(conn) - count;
 
 	talloc_free(mem_ctx);
-	return retval;
+	return MAPI_E_SUCCESS;
 }
 
 static enum MAPISTATUS get_new_changeNumber(struct openchangedb_context *self,
@@ -845,13 +853,10 @@ static enum MAPISTATUS get_new_changeNumber(struct openchangedb_context *self,
 	MYSQL		*conn;
 	enum MAPISTATUS	retval;
 
-	conn = self->data;
+	conn = WRITER(self, username);
 	OPENCHANGE_RETVAL_IF(!conn, MAPI_E_BAD_VALUE, NULL);
 
-	retval = get_server_change_number(conn, username, cn);
-	OPENCHANGE_RETVAL_IF(retval != MAPI_E_SUCCESS, retval, NULL);
-
-	retval = set_server_change_number(conn, username, (*cn) + 1);
+	retval = reserve_server_change_numbers(conn, username, 1, cn);
 	OPENCHANGE_RETVAL_IF(retval != MAPI_E_SUCCESS, retval, NULL);
 
 	// Transform the number the way exchange protocol likes it
@@ -872,24 +877,23 @@ static enum MAPISTATUS get_new_changeNumbers(struct openchangedb_context *self,
 	uint64_t		cn = 0;
 	size_t			count = 0;
 
-	conn = self->data;
+	conn = WRITER(self, username);
 	OPENCHANGE_RETVAL_IF(!conn, MAPI_E_BAD_VALUE, NULL);
 
-	retval = get_server_change_number(conn, username, &cn);
+	retval = reserve_server_change_numbers(conn, username, max, &cn);
 	OPENCHANGE_RETVAL_IF(retval != MAPI_E_SUCCESS, retval, NULL);
 
 	// Transform the numbers the way exchange protocol likes it
 	cns = talloc_zero(mem_ctx, struct UI8Array_r);
+	OPENCHANGE_RETVAL_IF(!cns, MAPI_E_NOT_ENOUGH_MEMORY, NULL);
 	cns->cValues = max;
 	cns->lpui8 = talloc_array(cns, uint64_t, max);
+	OPENCHANGE_RETVAL_IF(!cns->lpui8, MAPI_E_NOT_ENOUGH_MEMORY, cns);
 
 	for (count = 0; count < max; count++) {
 		cns->lpui8[count] = (exchange_globcnt(cn + count) << 16) | 0x0001;
 	}
 
-	retval = set_server_change_number(conn, username, cn + max);
-	OPENCHANGE_RETVAL_IF(retval != MAPI_E_SUCCESS, retval, NULL);
-
 	*cns_p = cns;
 
 	return retval;
@@ -901,7 +905,7 @@ static enum MAPISTATUS get_next_changeNumber(struct openchangedb_context *self,
 	MYSQL		*conn;
 	enum MAPISTATUS	retval;
 
-	conn = self->data;
+	conn = WRITER(self, username);
 	OPENCHANGE_RETVAL_IF(!conn, MAPI_E_BAD_VALUE, NULL);
 
 	retval = get_server_change_number(conn, username, cn);
@@ -1115,14 +1119,15 @@ static enum MAPISTATUS get_folder_property(TALLOC_CTX *parent_ctx,
 	TALLOC_CTX	*mem_ctx;
 	MYSQL		*conn;
 	enum MAPISTATUS	retval = MAPI_E_SUCCESS;
-	char		*sql = NULL;
 	uint64_t	mailbox_id = 0, mailbox_folder_id = 0;
 	uint64_t	*n = NULL;
-	const char	*attr, *value;
+	const char	*attr;
+	struct stmt_value	params[3];
+	struct stmt_value	value = STMT_STRING_VALUE(NULL);
 
 	mem_ctx = talloc_named(NULL, 0, "get_folder_property");
 	OPENCHANGE_RETVAL_IF(!mem_ctx, MAPI_E_NOT_ENOUGH_MEMORY, NULL);
-	conn = self->data;
+	conn = READER(self, username);
 	OPENCHANGE_RETVAL_IF(!conn, MAPI_E_BAD_VALUE, mem_ctx);
 
 	attr = openchangedb_property_get_attribute(proptag);
@@ -1151,25 +1156,30 @@ static enum MAPISTATUS get_folder_property(TALLOC_CTX *parent_ctx,
 			goto end;
 		}
 
-		sql = talloc_asprintf(mem_ctx,
+		params[0] = (struct stmt_value) STMT_UINT_VALUE(fid);
+		params[1] = (struct stmt_value) STMT_STRING_VALUE(username);
+		params[2] = (struct stmt_value) STMT_STRING_VALUE(attr);
+		retval = status(stmt_select_first(mem_ctx, conn,
 			"SELECT fp.value FROM folders_properties fp "
 			"JOIN folders f ON f.id = fp.folder_id "
 			"  AND f.folder_class = '"PUBLIC_FOLDER"'"
-			"  AND f.folder_id = %"PRIu64" "
+			"  AND f.folder_id = ? "
 			"JOIN mailboxes m ON m.ou_id = f.ou_id"
-			"  AND m.name = '%s' "
-			"WHERE fp.name = '%s'",
-			fid, _sql(mem_ctx, username), _sql(mem_ctx, attr));
+			"  AND m.name = ? "
+			"WHERE fp.name = ?",
+			params, 3, &value, 1));
 	} else {
 		// system folder
 		retval = get_mailbox_ids_by_name(conn, username, &mailbox_id, &mailbox_folder_id, NULL);
 		OPENCHANGE_RETVAL_IF(retval != MAPI_E_SUCCESS, retval, mem_ctx);
 
 		if (mailbox_folder_id == fid) {
-			sql = talloc_asprintf(mem_ctx,
+			params[0] = (struct stmt_value) STMT_UINT_VALUE(mailbox_id);
+			params[1] = (struct stmt_value) STMT_STRING_VALUE(attr);
+			retval = status(stmt_select_first(mem_ctx, conn,
 				"SELECT mp.value FROM mailboxes_properties mp "
-				"WHERE mp.mailbox_id = %"PRIu64" AND mp.name = '%s'",
-				mailbox_id, _sql(mem_ctx, attr));
+				"WHERE mp.mailbox_id = ? AND mp.name = ?",
+				params, 2, &value, 1));
 		} else if (proptag == PidTagParentFolderId) {
 			n = talloc_zero(parent_ctx, uint64_t);
 			OPENCHANGE_RETVAL_IF(!n, MAPI_E_NOT_ENOUGH_MEMORY, mem_ctx);
@@ -1178,20 +1188,21 @@ static enum MAPISTATUS get_folder_property(TALLOC_CTX *parent_ctx,
 			*data = (void *) n;
 			goto end;
 		} else {
-			sql = talloc_asprintf(mem_ctx,
+			params[0] = (struct stmt_value) STMT_UINT_VALUE(mailbox_id);
+			params[1] = (struct stmt_value) STMT_UINT_VALUE(fid);
+			params[2] = (struct stmt_value) STMT_STRING_VALUE(attr);
+			retval = status(stmt_select_first(mem_ctx, conn,
 				"SELECT fp.value FROM folders_properties fp "
 				"JOIN folders f ON f.id = fp.folder_id "
-				"  AND f.mailbox_id = %"PRIu64" "
-				"  AND f.folder_id = %"PRIu64" "
-				"WHERE fp.name = '%s'",
-				mailbox_id, fid, _sql(mem_ctx, attr));
+				"  AND f.mailbox_id = ? "
+				"  AND f.folder_id = ? "
+				"WHERE fp.name = ?",
+				params, 3, &value, 1));
 		}
 	}
-	OPENCHANGE_RETVAL_IF(!sql, MAPI_E_NOT_ENOUGH_MEMORY, mem_ctx);
-	retval = status(select_first_string(mem_ctx, conn, sql, &value));
 	OPENCHANGE_RETVAL_IF(retval != MAPI_E_SUCCESS, retval, mem_ctx);
 	// Transform string into the expected data type
-	*data = get_property_data(parent_ctx, proptag, value);
+	*data = get_property_data(parent_ctx, proptag, value.s);
 end:
 	talloc_free(mem_ctx);
 	return retval;
@@ -1217,6 +1228,144 @@ static char *str_list_join_for_sql(TALLOC_CTX *mem_ctx, const char **list)
 	return ret;
 }
 
+/**
+   \details Retrieve several properties of a folder record at once:
+   all the stored values are fetched with a single query instead of
+   one per property.
+
+   data and retvals are filled in for each tag of properties, tags
+   without a stored value get MAPI_E_NOT_FOUND.
+ */
+static enum MAPISTATUS get_folder_properties(TALLOC_CTX *parent_ctx,
+					     struct openchangedb_context *self,
+					     const char *username,
+					     uint64_t fid,
+					     struct SPropTagArray *properties,
+					     void **data,
+					     enum MAPISTATUS *retvals)
+{
+	TALLOC_CTX	*mem_ctx;
+	MYSQL		*conn;
+	MYSQL_RES	*res;
+	MYSQL_ROW	row;
+	enum MAPISTATUS	retval;
+	char		*sql = NULL;
+	char		*names = NULL;
+	const char	**attrs;
+	uint64_t	mailbox_id = 0, mailbox_folder_id = 0;
+	uint64_t	*n;
+	uint32_t	proptag;
+	uint32_t	i;
+	bool		public_folder;
+
+	mem_ctx = talloc_named(NULL, 0, "get_folder_properties");
+	OPENCHANGE_RETVAL_IF(!mem_ctx, MAPI_E_NOT_ENOUGH_MEMORY, NULL);
+	conn = READER(self, username);
+	OPENCHANGE_RETVAL_IF(!conn, MAPI_E_BAD_VALUE, mem_ctx);
+
+	attrs = talloc_zero_array(mem_ctx, const char *, properties->cValues);
+	OPENCHANGE_RETVAL_IF(!attrs, MAPI_E_NOT_ENOUGH_MEMORY, mem_ctx);
+
+	public_folder = is_public_folder(fid);
+	if (!public_folder) {
+		retval = get_mailbox_ids_by_name(conn, username, &mailbox_id, &mailbox_folder_id, NULL);
+		OPENCHANGE_RETVAL_IF(retval != MAPI_E_SUCCESS, retval, mem_ctx);
+	}
+
+	/* Step 1. Answer the properties which are not stored and
+	 * collect the names of the others */
+	for (i = 0; i < properties->cValues; i++) {
+		proptag = properties->aulPropTag[i];
+		data[i] = NULL;
+		retvals[i] = MAPI_E_SUCCESS;
+
+		data[i] = _get_special_property(parent_ctx, proptag);
+		if (data[i]) continue;
+
+		if (proptag == PidTagFolderId) {
+			n = talloc_zero(parent_ctx, uint64_t);
+			OPENCHANGE_RETVAL_IF(!n, MAPI_E_NOT_ENOUGH_MEMORY, mem_ctx);
+			*n = fid;
+			data[i] = (void *) n;
+			continue;
+		}
+
+		if (proptag == PidTagParentFolderId && (public_folder || mailbox_folder_id != fid)) {
+			n = talloc_zero(parent_ctx, uint64_t);
+			OPENCHANGE_RETVAL_IF(!n, MAPI_E_NOT_ENOUGH_MEMORY, mem_ctx);
+			retvals[i] = get_parent_fid(self, username, fid, n, true);
+			if (retvals[i] != MAPI_E_SUCCESS) {
+				talloc_free(n);
+				continue;
+			}
+			data[i] = (void *) n;
+			continue;
+		}
+
+		attrs[i] = openchangedb_property_get_attribute(proptag);
+		if (!attrs[i]) {
+			attrs[i] = _unknown_property(mem_ctx, proptag);
+			OPENCHANGE_RETVAL_IF(!attrs[i], MAPI_E_NOT_ENOUGH_MEMORY, mem_ctx);
+		}
+		retvals[i] = MAPI_E_NOT_FOUND;
+
+		if (names) {
+			names = talloc_asprintf_append_buffer(names, ",'%s'", _sql(mem_ctx, attrs[i]));
+		} else {
+			names = talloc_asprintf(mem_ctx, "'%s'", _sql(mem_ctx, attrs[i]));
+		}
+		OPENCHANGE_RETVAL_IF(!names, MAPI_E_NOT_ENOUGH_MEMORY, mem_ctx);
+	}
+
+	if (!names) goto end;
+
+	/* Step 2. Fetch all the stored values in one go */
+	if (public_folder) {
+		sql = talloc_asprintf(mem_ctx,
+			"SELECT fp.name, fp.value FROM folders_properties fp "
+			"JOIN folders f ON f.id = fp.folder_id "
+			"  AND f.folder_class = '"PUBLIC_FOLDER"'"
+			"  AND f.folder_id = %"PRIu64" "
+			"JOIN mailboxes m ON m.ou_id = f.ou_id"
+			"  AND m.name = '%s' "
+			"WHERE fp.name IN (%s)",
+			fid, _sql(mem_ctx, username), names);
+	} else if (mailbox_folder_id == fid) {
+		sql = talloc_asprintf(mem_ctx,
+			"SELECT mp.name, mp.value FROM mailboxes_properties mp "
+			"WHERE mp.mailbox_id = %"PRIu64" AND mp.name IN (%s)",
+			mailbox_id, names);
+	} else {
+		sql = talloc_asprintf(mem_ctx,
+			"SELECT fp.name, fp.value FROM folders_properties fp "
+			"JOIN folders f ON f.id = fp.folder_id "
+			"  AND f.mailbox_id = %"PRIu64" "
+			"  AND f.folder_id = %"PRIu64" "
+			"WHERE fp.name IN (%s)",
+			mailbox_id, fid, names);
+	}
+	OPENCHANGE_RETVAL_IF(!sql, MAPI_E_NOT_ENOUGH_MEMORY, mem_ctx);
+
+	retval = status(select_without_fetch(conn, sql, &res));
+	if (retval == MAPI_E_NOT_FOUND) goto end;
+	OPENCHANGE_RETVAL_IF(retval != MAPI_E_SUCCESS, retval, mem_ctx);
+
+	/* Step 3. Transform each string into the expected data type */
+	while ((row = mysql_fetch_row(res)) != NULL) {
+		if (!row[0] || !row[1]) continue;
+		for (i = 0; i < properties->cValues; i++) {
+			if (!attrs[i] || data[i] || strcmp(attrs[i], row[0])) continue;
+			data[i] = get_property_data(parent_ctx, properties->aulPropTag[i], row[1]);
+			retvals[i] = data[i] ? MAPI_E_SUCCESS : MAPI_E_NOT_FOUND;
+		}
+	}
+	mysql_free_result(res);
+
+end:
+	talloc_free(mem_ctx);
+	return MAPI_E_SUCCESS;
+}
+
 static enum MAPISTATUS set_folder_properties(struct openchangedb_context *self,
 					     const char *username, uint64_t fid,
 					     struct SRow *row)
@@ -1237,7 +1386,7 @@ static enum MAPISTATUS set_folder_properties(struct openchangedb_context *self,
 
 	mem_ctx = talloc_named(NULL, 0, "set_folder_property");
 	OPENCHANGE_RETVAL_IF(!mem_ctx, MAPI_E_NOT_ENOUGH_MEMORY, NULL);
-	conn = self->data;
+	conn = WRITER(self, username);
 	OPENCHANGE_RETVAL_IF(!conn, MAPI_E_BAD_VALUE, mem_ctx);
 
 	if (is_public_folder(fid)) {
@@ -1414,7 +1563,7 @@ static enum MAPISTATUS get_fid_by_name(struct openchangedb_context *self,
 
 	mem_ctx = talloc_named(NULL, 0, "get_fid_by_name");
 	OPENCHANGE_RETVAL_IF(!mem_ctx, MAPI_E_NOT_ENOUGH_MEMORY, NULL);
-	conn = self->data;
+	conn = READER(self, username);
 	OPENCHANGE_RETVAL_IF(!conn, MAPI_E_BAD_VALUE, mem_ctx);
 
 	is_public = is_public_folder(parent_fid);
@@ -1474,7 +1623,7 @@ static enum MAPISTATUS get_mid_by_subject_from_public_folder(struct openchangedb
 
 	mem_ctx = talloc_named(NULL, 0, "get_mid_by_subject_from_public_folder");
 	OPENCHANGE_RETVAL_IF(!mem_ctx, MAPI_E_NOT_ENOUGH_MEMORY, NULL);
-	conn = self->data;
+	conn = READER(self, username);
 	OPENCHANGE_RETVAL_IF(!conn, MAPI_E_BAD_VALUE, mem_ctx);
 
 	// Parent folder is a public folder
@@ -1508,7 +1657,7 @@ static enum MAPISTATUS get_mid_by_subject_from_system_folder(struct openchangedb
 
 	mem_ctx = talloc_named(NULL, 0, "get_mid_by_subject_from_system_folder");
 	OPENCHANGE_RETVAL_IF(!mem_ctx, MAPI_E_NOT_ENOUGH_MEMORY, NULL);
-	conn = self->data;
+	conn = READER(self, username);
 	OPENCHANGE_RETVAL_IF(!conn, MAPI_E_BAD_VALUE, mem_ctx);
 
 	retval = get_mailbox_ids_by_name(conn, username, &mailbox_id, &mailbox_folder_id, NULL);
@@ -1568,7 +1717,7 @@ static enum MAPISTATUS delete_folder(struct openchangedb_context *self,
 
 	mem_ctx = talloc_named(NULL, 0, "delete_folder");
 	OPENCHANGE_RETVAL_IF(!mem_ctx, MAPI_E_NOT_ENOUGH_MEMORY, NULL);
-	conn = self->data;
+	conn = WRITER(self, username);
 	OPENCHANGE_RETVAL_IF(!conn, MAPI_E_BAD_VALUE, mem_ctx);
 
 	if (is_public_folder(fid)) {
@@ -1606,7 +1755,7 @@ static enum MAPISTATUS set_ReceiveFolder(struct openchangedb_context *self,
 
 	mem_ctx = talloc_named(NULL, 0, "set_ReceiveFolder");
 	OPENCHANGE_RETVAL_IF(!mem_ctx, MAPI_E_NOT_ENOUGH_MEMORY, NULL);
-	conn = self->data;
+	conn = WRITER(self, recipient);
 	OPENCHANGE_RETVAL_IF(!conn, MAPI_E_BAD_VALUE, mem_ctx);
 
 	// Delete current receive folder for that message class if exists
@@ -1690,13 +1839,13 @@ static enum MAPISTATUS create_mailbox(struct openchangedb_context *self,
 	char		*sql, *mailbox_guid, *replica_guid, *values_sql, *value;
 	const char	**l;
 	struct GUID	guid;
-	uint64_t	change_number, ou_id;
+	uint64_t	change_number, ou_id, mailbox_id;
 	time_t		unix_time;
 	NTTIME		now;
 
 	mem_ctx = talloc_named(NULL, 0, "create_mailbox");
 	OPENCHANGE_RETVAL_IF(!mem_ctx, MAPI_E_NOT_ENOUGH_MEMORY, NULL);
-	conn = self->data;
+	conn = WRITER(self, username);
 	OPENCHANGE_RETVAL_IF(!conn, MAPI_E_BAD_VALUE, mem_ctx);
 
 	unix_time = time(NULL);
@@ -1731,37 +1880,47 @@ static enum MAPISTATUS create_mailbox(struct openchangedb_context *self,
 	OPENCHANGE_RETVAL_IF(!sql, MAPI_E_NOT_ENOUGH_MEMORY, mem_ctx);
 	retval = status(execute_query(conn, sql));
 	OPENCHANGE_RETVAL_IF(retval != MAPI_E_SUCCESS, retval, mem_ctx);
+	// Reserving the change number below overwrites LAST_INSERT_ID()
+	mailbox_id = mysql_insert_id(conn);
 
 	// Insert mailboxes properties
 	l = (const char **) str_list_make_empty(mem_ctx);
 	OPENCHANGE_RETVAL_IF(!l, MAPI_E_NOT_ENOUGH_MEMORY, mem_ctx);
 
-	l = str_list_add(l, "(LAST_INSERT_ID(), 'PidTagAccess', '63')");
+	value = talloc_asprintf(mem_ctx, "(%"PRIu64", 'PidTagAccess', '63')", mailbox_id);
+	OPENCHANGE_RETVAL_IF(!value, MAPI_E_NOT_ENOUGH_MEMORY, mem_ctx);
+	l = str_list_add(l, value);
 	OPENCHANGE_RETVAL_IF(!l, MAPI_E_NOT_ENOUGH_MEMORY, mem_ctx);
 
-	l = str_list_add(l, "(LAST_INSERT_ID(), 'PidTagRights', '2043')");
+	value = talloc_asprintf(mem_ctx, "(%"PRIu64", 'PidTagRights', '2043')", mailbox_id);
+	OPENCHANGE_RETVAL_IF(!value, MAPI_E_NOT_ENOUGH_MEMORY, mem_ctx);
+	l = str_list_add(l, value);
 	OPENCHANGE_RETVAL_IF(!l, MAPI_E_NOT_ENOUGH_MEMORY, mem_ctx);
 
-	l = str_list_add(l, "(LAST_INSERT_ID(), 'PidTagFolderType', '1')");
+	value = talloc_asprintf(mem_ctx, "(%"PRIu64", 'PidTagFolderType', '1')", mailbox_id);
+	OPENCHANGE_RETVAL_IF(!value, MAPI_E_NOT_ENOUGH_MEMORY, mem_ctx);
+	l = str_list_add(l, value);
 	OPENCHANGE_RETVAL_IF(!l, MAPI_E_NOT_ENOUGH_MEMORY, mem_ctx);
 
-	l = str_list_add(l, "(LAST_INSERT_ID(), 'PidTagSubFolders', 'TRUE')");
+	value = talloc_asprintf(mem_ctx, "(%"PRIu64", 'PidTagSubFolders', 'TRUE')", mailbox_id);
+	OPENCHANGE_RETVAL_IF(!value, MAPI_E_NOT_ENOUGH_MEMORY, mem_ctx);
+	l = str_list_add(l, value);
 	OPENCHANGE_RETVAL_IF(!l, MAPI_E_NOT_ENOUGH_MEMORY, mem_ctx);
 
 	value = talloc_asprintf(mem_ctx,
-		"(LAST_INSERT_ID(), 'PidTagDisplayName', '%s')", display_name);
+		"(%"PRIu64", 'PidTagDisplayName', '%s')", mailbox_id, display_name);
 	OPENCHANGE_RETVAL_IF(!value, MAPI_E_NOT_ENOUGH_MEMORY, mem_ctx);
 	l = str_list_add(l, value);
 	OPENCHANGE_RETVAL_IF(!l, MAPI_E_NOT_ENOUGH_MEMORY, mem_ctx);
 
 	value = talloc_asprintf(mem_ctx,
-		"(LAST_INSERT_ID(), 'PidTagCreationTime', '%"PRId64"')", now);
+		"(%"PRIu64", 'PidTagCreationTime', '%"PRId64"')", mailbox_id, now);
 	OPENCHANGE_RETVAL_IF(!value, MAPI_E_NOT_ENOUGH_MEMORY, mem_ctx);
 	l = str_list_add(l, value);
 	OPENCHANGE_RETVAL_IF(!l, MAPI_E_NOT_ENOUGH_MEMORY, mem_ctx);
 
 	value = talloc_asprintf(mem_ctx,
-		"(LAST_INSERT_ID(), 'PidTagLastModificationTime', '%"PRId64"')", now);
+		"(%"PRIu64", 'PidTagLastModificationTime', '%"PRId64"')", mailbox_id, now);
 	OPENCHANGE_RETVAL_IF(!value, MAPI_E_NOT_ENOUGH_MEMORY, mem_ctx);
 	l = str_list_add(l, value);
 	OPENCHANGE_RETVAL_IF(!l, MAPI_E_NOT_ENOUGH_MEMORY, mem_ctx);
@@ -1769,7 +1928,7 @@ static enum MAPISTATUS create_mailbox(struct openchangedb_context *self,
 	retval = get_new_changeNumber(self, username, &change_number);
 	OPENCHANGE_RETVAL_IF(retval != MAPI_E_SUCCESS, retval, mem_ctx);
 	value = talloc_asprintf(mem_ctx,
-		"(LAST_INSERT_ID(), 'PidTagChangeNumber', '%"PRIu64"')", change_number);
+		"(%"PRIu64", 'PidTagChangeNumber', '%"PRIu64"')", mailbox_id, change_number);
 	OPENCHANGE_RETVAL_IF(!value, MAPI_E_NOT_ENOUGH_MEMORY, mem_ctx);
 	l = str_list_add(l, value);
 	OPENCHANGE_RETVAL_IF(!l, MAPI_E_NOT_ENOUGH_MEMORY, mem_ctx);
@@ -1801,7 +1960,7 @@ static enum MAPISTATUS create_folder(struct openchangedb_context *self,
 
 	mem_ctx = talloc_named(NULL, 0, "create_folder");
 	OPENCHANGE_RETVAL_IF(!mem_ctx, MAPI_E_NOT_ENOUGH_MEMORY, NULL);
-	conn = self->data;
+	conn = WRITER(self, username);
 	OPENCHANGE_RETVAL_IF(!conn, MAPI_E_BAD_VALUE, mem_ctx);
 
 	unix_time = time(NULL);
@@ -1965,7 +2124,7 @@ static enum MAPISTATUS get_message_count(struct openchangedb_context *self,
 
 	mem_ctx = talloc_named(NULL, 0, "get_message_count");
 	OPENCHANGE_RETVAL_IF(!mem_ctx, MAPI_E_NOT_ENOUGH_MEMORY, NULL);
-	conn = self->data;
+	conn = READER(self, username);
 	OPENCHANGE_RETVAL_IF(!conn, MAPI_E_BAD_VALUE, mem_ctx);
 
 	if (fai) {
@@ -2028,7 +2187,7 @@ static enum MAPISTATUS get_system_idx(struct openchangedb_context *self,
 
 	mem_ctx = talloc_named(NULL, 0, "get_system_idx");
 	OPENCHANGE_RETVAL_IF(!mem_ctx, MAPI_E_NOT_ENOUGH_MEMORY, NULL);
-	conn = self->data;
+	conn = READER(self, username);
 	OPENCHANGE_RETVAL_IF(!conn, MAPI_E_BAD_VALUE, mem_ctx);
 
 	if (is_public_folder(fid)) {
@@ -2064,7 +2223,7 @@ static enum MAPISTATUS set_system_idx(struct openchangedb_context *self,
 
 	mem_ctx = talloc_named(NULL, 0, "set_system_idx");
 	OPENCHANGE_RETVAL_IF(!mem_ctx, MAPI_E_NOT_ENOUGH_MEMORY, NULL);
-	conn = self->data;
+	conn = WRITER(self, username);
 	OPENCHANGE_RETVAL_IF(!conn, MAPI_E_BAD_VALUE, mem_ctx);
 
 	sql = talloc_asprintf(mem_ctx,
@@ -2094,10 +2253,12 @@ static enum MAPISTATUS transaction_start(struct openchangedb_context *self)
 	MYSQL	*conn;
 	int	res;
 
-	conn = self->data;
+	conn = WRITER(self, NULL);
 	OPENCHANGE_RETVAL_IF(!conn, MAPI_E_BAD_VALUE, NULL);
 	res = mysql_query(conn, "START TRANSACTION");
 	OPENCHANGE_RETVAL_IF(res, MAPI_E_CALL_FAILED, NULL);
+	/* Reads have to see the uncommitted writes */
+	mysql_rw_pin(self->data, true);
 	return MAPI_E_SUCCESS;
 }
 
@@ -2106,9 +2267,10 @@ static enum MAPISTATUS transaction_rollback(struct openchangedb_context *self)
 	MYSQL	*conn;
 	int	res;
 
-	conn = self->data;
+	conn = WRITER(self, NULL);
 	OPENCHANGE_RETVAL_IF(!conn, MAPI_E_BAD_VALUE, NULL);
 	res = mysql_query(conn, "ROLLBACK");
+	mysql_rw_pin(self->data, false);
 	OPENCHANGE_RETVAL_IF(res, MAPI_E_CALL_FAILED, NULL);
 	return MAPI_E_SUCCESS;
 }
@@ -2118,9 +2280,10 @@ static enum MAPISTATUS transaction_commit(struct openchangedb_context *self)
 	MYSQL	*conn;
 	int	res;
 
-	conn = self->data;
+	conn = WRITER(self, NULL);
 	OPENCHANGE_RETVAL_IF(!conn, MAPI_E_BAD_VALUE, NULL);
 	res = mysql_query(conn, "COMMIT");
+	mysql_rw_pin(self->data, false);
 	OPENCHANGE_RETVAL_IF(res, MAPI_E_CALL_FAILED, NULL);
 	return MAPI_E_SUCCESS;
 }
@@ -2136,7 +2299,7 @@ static enum MAPISTATUS get_new_public_folderID(struct openchangedb_context *self
 
 	mem_ctx = talloc_named(NULL, 0, "get_new_public_folderID");
 	OPENCHANGE_RETVAL_IF(!mem_ctx, MAPI_E_NOT_ENOUGH_MEMORY, NULL);
-	conn = self->data;
+	conn = WRITER(self, username);
 	OPENCHANGE_RETVAL_IF(!conn, MAPI_E_BAD_VALUE, mem_ctx);
 
 	sql = talloc_asprintf(mem_ctx,
@@ -2186,7 +2349,7 @@ static enum MAPISTATUS get_indexing_url(struct openchangedb_context *self,
 
 	mem_ctx = talloc_named(NULL, 0, "get_indexing_url");
 	OPENCHANGE_RETVAL_IF(!mem_ctx, MAPI_E_NOT_ENOUGH_MEMORY, NULL);
-	conn = self->data;
+	conn = READER(self, username);
 	OPENCHANGE_RETVAL_IF(!conn, MAPI_E_BAD_VALUE, mem_ctx);
 
 	sql = talloc_asprintf(mem_ctx,
@@ -2209,7 +2372,7 @@ static bool set_locale(struct openchangedb_context *self, const char *username,
 	const char		*locale, *current_locale;
 	enum MYSQLRESULT	ret;
 
-	conn = self->data;
+	conn = WRITER(self, username);
 	if (!conn) return false;
 
 	locale = mapi_get_locale_from_lcid(lcid);
@@ -2262,7 +2425,7 @@ static const char **get_folders_names(TALLOC_CTX *parent_ctx,
 
 	mem_ctx = talloc_named(NULL, 0, "get_folders_name");
 	if (!mem_ctx) return NULL;
-	conn = self->data;
+	conn = READER(self, NULL);
 	if (!conn) return NULL;
 	table = talloc_asprintf(mem_ctx, "provisioning_%s", type);
 	if (!table) return NULL;
@@ -2306,13 +2469,29 @@ struct openchangedb_table_results {
 	};
 };
 
+/* Restriction as kept by the table: property values are stored with
+ * the same string representation as in the properties tables so they
+ * can be compared either in SQL or against a fetched row */
+struct openchangedb_table_restriction {
+	uint8_t					rt;
+	uint8_t					relop;
+	uint32_t				fuzzy;
+	uint32_t				mask;
+	enum MAPITAGS				proptag;
+	enum MAPITAGS				proptag2;
+	const char				*value;
+	uint32_t				count;
+	struct openchangedb_table_restriction	*children;
+	bool					in_sql;
+};
+
 struct openchangedb_table {
 	uint64_t				folder_id;
 	uint64_t				ou_id;
 	const char				*username;
 	uint8_t					table_type;
 	struct SSortOrderSet			*lpSortCriteria;
-	struct mapi_SRestriction		*restrictions;
+	struct openchangedb_table_restriction	*restrictions;
 	struct openchangedb_table_results	*res;
 };
 
@@ -2330,8 +2509,9 @@ static enum MAPISTATUS table_init(TALLOC_CTX *mem_ctx,
 	OPENCHANGE_RETVAL_IF(!table, MAPI_E_NOT_ENOUGH_MEMORY, NULL);
 
 	table->folder_id = folder_id;
-	table->username = _sql(table, username);
-	retval = get_mailbox_ids_by_name(self->data, username, NULL, NULL, &table->ou_id);
+	table->username = talloc_strdup(table, username);
+	OPENCHANGE_RETVAL_IF(!table->username, MAPI_E_NOT_ENOUGH_MEMORY, table);
+	retval = get_mailbox_ids_by_name(READER(self, username), username, NULL, NULL, &table->ou_id);
 	if (retval != MAPI_E_SUCCESS) {
 		OC_DEBUG(0, "Error initializing table, we couldn't fetch mailbox for user %s", username);
 		return retval;
@@ -2377,11 +2557,102 @@ static enum MAPISTATUS table_set_sort_order(struct openchangedb_context *self,
 	return MAPI_E_SUCCESS;
 }
 
+static const char *_table_restriction_value(TALLOC_CTX *mem_ctx, struct mapi_SPropValue *lpProp)
+{
+	struct SPropValue	value;
+
+	if (!cast_SPropValue(mem_ctx, lpProp, &value)) return NULL;
+
+	return openchangedb_set_folder_property_data(mem_ctx, &value);
+}
+
+static enum MAPISTATUS _table_compile_restriction(TALLOC_CTX *mem_ctx,
+						  struct mapi_SRestriction *res,
+						  struct openchangedb_table_restriction *node)
+{
+	struct mapi_SRestriction	*sub;
+	enum MAPISTATUS			retval;
+	uint32_t			i;
+
+	node->rt = res->rt;
+	switch (res->rt) {
+	case RES_AND:
+	case RES_OR:
+		node->count = (res->rt == RES_AND) ? res->res.resAnd.cRes : res->res.resOr.cRes;
+		node->children = talloc_zero_array(mem_ctx, struct openchangedb_table_restriction, node->count);
+		OPENCHANGE_RETVAL_IF(node->count && !node->children, MAPI_E_NOT_ENOUGH_MEMORY, NULL);
+		for (i = 0; i < node->count; i++) {
+			sub = (res->rt == RES_AND) ? (struct mapi_SRestriction *) &res->res.resAnd.res[i]
+						   : (struct mapi_SRestriction *) &res->res.resOr.res[i];
+			retval = _table_compile_restriction(node->children, sub, &node->children[i]);
+			OPENCHANGE_RETVAL_IF(retval != MAPI_E_SUCCESS, retval, NULL);
+		}
+		break;
+	case RES_NOT:
+		node->count = 1;
+		node->children = talloc_zero(mem_ctx, struct openchangedb_table_restriction);
+		OPENCHANGE_RETVAL_IF(!node->children, MAPI_E_NOT_ENOUGH_MEMORY, NULL);
+		sub = (struct mapi_SRestriction *) &res->res.resNot.res;
+		return _table_compile_restriction(node->children, sub, node->children);
+	case RES_CONTENT:
+		node->fuzzy = res->res.resContent.fuzzy;
+		node->proptag = res->res.resContent.ulPropTag;
+		node->value = _table_restriction_value(mem_ctx, &res->res.resContent.lpProp);
+		OPENCHANGE_RETVAL_IF(!node->value, MAPI_E_TOO_COMPLEX, NULL);
+		break;
+	case RES_PROPERTY:
+		node->relop = res->res.resProperty.relop;
+		node->proptag = res->res.resProperty.ulPropTag;
+		node->value = _table_restriction_value(mem_ctx, &res->res.resProperty.lpProp);
+		OPENCHANGE_RETVAL_IF(!node->value, MAPI_E_TOO_COMPLEX, NULL);
+		break;
+	case RES_COMPAREPROPS:
+		node->relop = res->res.resCompareProps.relop;
+		node->proptag = res->res.resCompareProps.ulPropTag1;
+		node->proptag2 = res->res.resCompareProps.ulPropTag2;
+		break;
+	case RES_BITMASK:
+		node->relop = res->res.resBitmask.relMBR;
+		node->proptag = res->res.resBitmask.ulPropTag;
+		node->mask = res->res.resBitmask.ulMask;
+		break;
+	case RES_EXIST:
+		node->proptag = res->res.resExist.ulPropTag;
+		break;
+	case RES_COMMENT:
+		/* Only the optional restriction matters, not the comment */
+		if (res->res.resComment.RestrictionPresent && res->res.resComment.Restriction.res) {
+			node->count = 1;
+			node->children = talloc_zero(mem_ctx, struct openchangedb_table_restriction);
+			OPENCHANGE_RETVAL_IF(!node->children, MAPI_E_NOT_ENOUGH_MEMORY, NULL);
+			sub = (struct mapi_SRestriction *) res->res.resComment.Restriction.res;
+			return _table_compile_restriction(node->children, sub, node->children);
+		}
+		break;
+	default:
+		OC_DEBUG(5, "Unsupported restriction type: 0x%x\n", res->rt);
+		return MAPI_E_TOO_COMPLEX;
+	}
+
+	return MAPI_E_SUCCESS;
+}
+
+static char *_table_restriction_sql(TALLOC_CTX *, MYSQL *, struct openchangedb_table *,
+				    struct openchangedb_table_restriction *, const char *);
+
 static enum MAPISTATUS table_set_restrictions(struct openchangedb_context *self,
 					      void *_table,
 					      struct mapi_SRestriction *res)
 {
-	struct openchangedb_table *table = (struct openchangedb_table *)_table;
+	struct openchangedb_table		*table = (struct openchangedb_table *)_table;
+	struct openchangedb_table_restriction	*conjuncts;
+	TALLOC_CTX				*mem_ctx;
+	MYSQL					*conn;
+	enum MAPISTATUS				retval;
+	uint32_t				count, i;
+
+	conn = READER(self, table->username);
+	OPENCHANGE_RETVAL_IF(!conn, MAPI_E_BAD_VALUE, NULL);
 
 	if (table->res) {
 		talloc_free(table->res);
@@ -2393,59 +2664,427 @@ static enum MAPISTATUS table_set_restrictions(struct openchangedb_context *self,
 		table->restrictions = NULL;
 	}
 
-	table->restrictions = talloc_zero(table, struct mapi_SRestriction);
+	table->restrictions = talloc_zero(table, struct openchangedb_table_restriction);
 	OPENCHANGE_RETVAL_IF(!table->restrictions, MAPI_E_NOT_ENOUGH_MEMORY, NULL);
 
-	if (res->rt != RES_PROPERTY) {
-		OC_DEBUG(5, "Unsupported restriction type: 0x%x\n", res->rt);
-		return MAPI_E_INVALID_PARAMETER;
+	retval = _table_compile_restriction(table->restrictions, res, table->restrictions);
+	if (retval != MAPI_E_SUCCESS) {
+		talloc_free(table->restrictions);
+		table->restrictions = NULL;
+		return retval;
 	}
 
-	table->restrictions->rt = res->rt;
-	table->restrictions->res.resProperty.relop = res->res.resProperty.relop;
-	table->restrictions->res.resProperty.ulPropTag = res->res.resProperty.ulPropTag;
-	table->restrictions->res.resProperty.lpProp.ulPropTag = res->res.resProperty.lpProp.ulPropTag;
+	/* Find out which terms of the top level AND can be evaluated
+	 * by MySQL, the other ones are checked against each row */
+	if (table->restrictions->rt == RES_AND) {
+		conjuncts = table->restrictions->children;
+		count = table->restrictions->count;
+	} else {
+		conjuncts = table->restrictions;
+		count = 1;
+	}
+	mem_ctx = talloc_named(NULL, 0, "table_set_restrictions");
+	OPENCHANGE_RETVAL_IF(!mem_ctx, MAPI_E_NOT_ENOUGH_MEMORY, NULL);
+	for (i = 0; i < count; i++) {
+		conjuncts[i].in_sql = _table_restriction_sql(mem_ctx, conn, table, &conjuncts[i], "r") != NULL;
+	}
+	talloc_free(mem_ctx);
 
-	switch (table->restrictions->res.resProperty.lpProp.ulPropTag & 0xFFFF) {
+	return MAPI_E_SUCCESS;
+}
+
+static bool _table_restriction_is_numeric(enum MAPITAGS proptag)
+{
+	switch (proptag & 0xFFFF) {
+	case PT_SHORT:
+	case PT_LONG:
+	case PT_I8:
+	case PT_SYSTIME:
+		return true;
+	default:
+		return false;
+	}
+}
+
+static bool _table_restriction_is_string(enum MAPITAGS proptag)
+{
+	return (proptag & 0xFFFF) == PT_STRING8 || (proptag & 0xFFFF) == PT_UNICODE;
+}
+
+static bool _table_is_number(const char *value)
+{
+	if (*value == '-') value++;
+	if (!*value) return false;
+	for (; *value; value++) {
+		if (*value < '0' || *value > '9') return false;
+	}
+	return true;
+}
+
+static const char *_table_relop_sql(uint8_t relop)
+{
+	switch (relop) {
+	case RELOP_LT: return "<";
+	case RELOP_LE: return "<=";
+	case RELOP_GT: return ">";
+	case RELOP_GE: return ">=";
+	case RELOP_EQ: return "=";
+	case RELOP_NE: return "<>";
+	default: return NULL;
+	}
+}
+
+/**
+   \details Build the SQL condition applying predicate to the value of
+   proptag for the row aliased by alias. A NULL predicate checks the
+   property exists.
+ */
+static char *_table_property_sql(TALLOC_CTX *mem_ctx, MYSQL *conn, struct openchangedb_table *table,
+				 const char *alias, enum MAPITAGS proptag,
+				 bool numeric, const char *predicate)
+{
+	const char	*column = NULL;
+	const char	*attr;
+	char		*name;
+	bool		is_message;
+
+	is_message = table->table_type == 0x3 || table->table_type == 0x2;
+
+	/* Properties stored as columns of the row itself */
+	if (is_message && proptag == PidTagMid) {
+		column = "message_id";
+	} else if (is_message && proptag == PidTagNormalizedSubject) {
+		column = "normalized_subject";
+	} else if (!is_message && proptag == PidTagFolderId) {
+		column = "folder_id";
+	}
+	if (column) {
+		if (!predicate) return talloc_strdup(mem_ctx, "TRUE");
+		return talloc_asprintf(mem_ctx, "%s.%s %s", alias, column, predicate);
+	}
+
+	attr = openchangedb_property_get_attribute(proptag);
+	if (!attr) {
+		attr = _unknown_property(mem_ctx, proptag);
+		if (!attr) return NULL;
+	}
+	name = _sql_real_escape(mem_ctx, conn, attr);
+	if (!name) return NULL;
+
+	return talloc_asprintf(mem_ctx,
+		"EXISTS (SELECT 1 FROM %s p WHERE p.%s = %s.id AND p.name = '%s'%s%s%s)",
+		is_message ? "messages_properties" : "folders_properties",
+		is_message ? "message_id" : "folder_id",
+		alias, name,
+		predicate ? " AND " : "",
+		predicate ? (numeric ? "CAST(p.value AS DECIMAL(20,0)) " : "p.value ") : "",
+		predicate ? predicate : "");
+}
+
+static char *_table_like_sql(TALLOC_CTX *mem_ctx, MYSQL *conn, const char *value, uint32_t fuzzy)
+{
+	char		*pattern;
+	const char	*s;
+	size_t		len;
+
+	pattern = talloc_array(mem_ctx, char, 2 * strlen(value) + 3);
+	if (!pattern) return NULL;
+
+	/* Wildcards and backslashes are escaped for LIKE here, the
+	 * pattern is then escaped as any string literal */
+	len = 0;
+	if ((fuzzy & 0xFFFF) == FL_SUBSTRING) pattern[len++] = '%';
+	for (s = value; *s; s++) {
+		if (*s == '\\' || *s == '%' || *s == '_') {
+			pattern[len++] = '\\';
+		}
+		pattern[len++] = *s;
+	}
+	if ((fuzzy & 0xFFFF) == FL_SUBSTRING || (fuzzy & 0xFFFF) == FL_PREFIX) pattern[len++] = '%';
+	pattern[len] = '\0';
+
+	pattern = _sql_real_escape(mem_ctx, conn, pattern);
+	if (!pattern) return NULL;
+
+	return talloc_asprintf(mem_ctx, "LIKE %s'%s'", (fuzzy & FL_IGNORECASE) ? "" : "BINARY ",
+			       pattern);
+}
+
+/**
+   \details Translate a restriction into a SQL condition on the row
+   aliased by alias
+
+   \return the condition, NULL if the restriction cannot be evaluated
+   by MySQL
+ */
+static char *_table_restriction_sql(TALLOC_CTX *mem_ctx, MYSQL *conn, struct openchangedb_table *table,
+				    struct openchangedb_table_restriction *node, const char *alias)
+{
+	char		*sql = NULL;
+	char		*sub, *predicate, *value;
+	const char	*op;
+	uint32_t	i;
+	bool		numeric;
+
+	switch (node->rt) {
+	case RES_AND:
+	case RES_OR:
+		if (!node->count) {
+			return talloc_strdup(mem_ctx, node->rt == RES_AND ? "TRUE" : "FALSE");
+		}
+		for (i = 0; i < node->count; i++) {
+			sub = _table_restriction_sql(mem_ctx, conn, table, &node->children[i], alias);
+			if (!sub) return NULL;
+			if (sql) {
+				sql = talloc_asprintf_append_buffer(sql, " %s (%s)",
+								    node->rt == RES_AND ? "AND" : "OR", sub);
+			} else {
+				sql = talloc_asprintf(mem_ctx, "(%s)", sub);
+			}
+			if (!sql) return NULL;
+		}
+		return talloc_asprintf(mem_ctx, "(%s)", sql);
+	case RES_NOT:
+		sub = _table_restriction_sql(mem_ctx, conn, table, node->children, alias);
+		if (!sub) return NULL;
+		return talloc_asprintf(mem_ctx, "NOT (%s)", sub);
+	case RES_COMMENT:
+		if (!node->count) return talloc_strdup(mem_ctx, "TRUE");
+		return _table_restriction_sql(mem_ctx, conn, table, node->children, alias);
+	case RES_EXIST:
+		return _table_property_sql(mem_ctx, conn, table, alias, node->proptag, false, NULL);
+	case RES_PROPERTY:
+		op = _table_relop_sql(node->relop);
+		if (!op) return NULL;
+		numeric = _table_restriction_is_numeric(node->proptag);
+		if (numeric) {
+			if (!_table_is_number(node->value)) return NULL;
+			predicate = talloc_asprintf(mem_ctx, "%s %s", op, node->value);
+		} else {
+			/* Only strings have a meaningful ordering */
+			if (node->relop != RELOP_EQ && node->relop != RELOP_NE &&
+			    !_table_restriction_is_string(node->proptag)) {
+				return NULL;
+			}
+			value = _sql_real_escape(mem_ctx, conn, node->value);
+			if (!value) return NULL;
+			predicate = talloc_asprintf(mem_ctx, "%s '%s'", op, value);
+		}
+		if (!predicate) return NULL;
+		return _table_property_sql(mem_ctx, conn, table, alias, node->proptag, numeric, predicate);
+	case RES_CONTENT:
+		if (!_table_restriction_is_string(node->proptag)) return NULL;
+		predicate = _table_like_sql(mem_ctx, conn, node->value, node->fuzzy);
+		if (!predicate) return NULL;
+		return _table_property_sql(mem_ctx, conn, table, alias, node->proptag, false, predicate);
+	case RES_BITMASK:
+		if (!_table_restriction_is_numeric(node->proptag)) return NULL;
+		predicate = talloc_asprintf(mem_ctx, "& %u %s 0", node->mask,
+					    node->relop == BMR_EQZ ? "=" : "<>");
+		if (!predicate) return NULL;
+		return _table_property_sql(mem_ctx, conn, table, alias, node->proptag, true, predicate);
+	default:
+		return NULL;
+	}
+}
+
+/**
+   \details Return the SQL condition on the row aliased by alias for
+   the restriction terms MySQL can evaluate
+ */
+static char *_table_restrictions_sql(TALLOC_CTX *mem_ctx, MYSQL *conn, struct openchangedb_table *table,
+				     const char *alias)
+{
+	struct openchangedb_table_restriction	*conjuncts;
+	char					*sql = NULL;
+	char					*sub;
+	uint32_t				count, i;
+
+	if (!table->restrictions) return talloc_strdup(mem_ctx, "TRUE");
+
+	if (table->restrictions->rt == RES_AND) {
+		conjuncts = table->restrictions->children;
+		count = table->restrictions->count;
+	} else {
+		conjuncts = table->restrictions;
+		count = 1;
+	}
+
+	for (i = 0; i < count; i++) {
+		if (!conjuncts[i].in_sql) continue;
+		sub = _table_restriction_sql(mem_ctx, conn, table, &conjuncts[i], alias);
+		if (!sub) return NULL;
+		if (sql) {
+			sql = talloc_asprintf_append_buffer(sql, " AND %s", sub);
+		} else {
+			sql = sub;
+		}
+		if (!sql) return NULL;
+	}
+
+	return sql ? sql : talloc_strdup(mem_ctx, "TRUE");
+}
+
+static const char *_table_fetch_attribute(MYSQL *, struct openchangedb_table *, uint32_t, enum MAPITAGS);
+
+static int _table_compare_values(enum MAPITAGS proptag, const char *a, const char *b)
+{
+	int64_t		sa, sb;
+	uint64_t	ua, ub;
+
+	switch (proptag & 0xFFFF) {
+	case PT_SHORT:
+	case PT_LONG:
+		sa = strtoll(a, NULL, 10);
+		sb = strtoll(b, NULL, 10);
+		return (sa > sb) - (sa < sb);
+	case PT_I8:
+	case PT_SYSTIME:
+		ua = strtoull(a, NULL, 10);
+		ub = strtoull(b, NULL, 10);
+		return (ua > ub) - (ua < ub);
 	case PT_STRING8:
-		table->restrictions->res.resProperty.lpProp.value.lpszA =
-			talloc_strdup(table->restrictions, res->res.resProperty.lpProp.value.lpszA);
-		OPENCHANGE_RETVAL_IF(!table->restrictions->res.resProperty.lpProp.value.lpszA, MAPI_E_NOT_ENOUGH_MEMORY, NULL);
-		break;
 	case PT_UNICODE:
-		table->restrictions->res.resProperty.lpProp.value.lpszW =
-			talloc_strdup(table->restrictions, res->res.resProperty.lpProp.value.lpszW);
-		OPENCHANGE_RETVAL_IF(!table->restrictions->res.resProperty.lpProp.value.lpszW, MAPI_E_NOT_ENOUGH_MEMORY, NULL);
-		break;
+		return strcasecmp(a, b);
 	default:
-		OC_DEBUG(0, "Unsupported property type for RES_PROPERTY restriction\n");
-		return MAPI_E_INVALID_PARAMETER;
+		return strcmp(a, b);
 	}
+}
 
-	return MAPI_E_SUCCESS;
+static bool _table_relop_match(uint8_t relop, int cmp)
+{
+	switch (relop) {
+	case RELOP_LT: return cmp < 0;
+	case RELOP_LE: return cmp <= 0;
+	case RELOP_GT: return cmp > 0;
+	case RELOP_GE: return cmp >= 0;
+	case RELOP_EQ: return cmp == 0;
+	case RELOP_NE: return cmp != 0;
+	default: return false;
+	}
 }
 
-static enum MAPISTATUS _table_get_attr_and_value_from_restrictions(
-	TALLOC_CTX *mem_ctx, struct mapi_SRestriction *restrictions,
-	const char **attr, const char **value)
+static bool _table_content_match(const char *value, const char *pattern, uint32_t fuzzy)
 {
-	if (restrictions) {
-		*attr = openchangedb_property_get_attribute(restrictions->res.resProperty.ulPropTag);
-		switch (restrictions->res.resProperty.ulPropTag & 0xFFFF) {
-		case PT_STRING8:
-			*value = _sql(mem_ctx, restrictions->res.resProperty.lpProp.value.lpszA);
-			break;
-		case PT_UNICODE:
-			*value = _sql(mem_ctx, restrictions->res.resProperty.lpProp.value.lpszW);
-			break;
-		default:
-			OC_DEBUG(0, "Unsupported RES_PROPERTY property type: 0x%.4x\n",
-				  (restrictions->res.resProperty.ulPropTag & 0xFFFF));
-			return MAPI_E_TOO_COMPLEX;
+	int		(*cmpn)(const char *, const char *, size_t);
+	size_t		len;
+	const char	*s;
+
+	cmpn = (fuzzy & FL_IGNORECASE) ? strncasecmp : strncmp;
+	len = strlen(pattern);
+
+	switch (fuzzy & 0xFFFF) {
+	case FL_SUBSTRING:
+		for (s = value; strlen(s) >= len; s++) {
+			if (!cmpn(s, pattern, len)) return true;
 		}
+		return false;
+	case FL_PREFIX:
+		return !cmpn(value, pattern, len);
+	default:
+		return strlen(value) == len && !cmpn(value, pattern, len);
 	}
-	return MAPI_E_SUCCESS;
+}
 
+/**
+   \details Evaluate a restriction against the row at position pos,
+   fetching the needed properties one by one. This is the fallback for
+   the restrictions MySQL cannot evaluate.
+ */
+static bool _table_restriction_match(MYSQL *conn, struct openchangedb_table *table,
+				     uint32_t pos, struct openchangedb_table_restriction *node)
+{
+	const char	*value, *value2;
+	uint32_t	i;
+
+	switch (node->rt) {
+	case RES_AND:
+		for (i = 0; i < node->count; i++) {
+			if (!_table_restriction_match(conn, table, pos, &node->children[i])) return false;
+		}
+		return true;
+	case RES_OR:
+		for (i = 0; i < node->count; i++) {
+			if (_table_restriction_match(conn, table, pos, &node->children[i])) return true;
+		}
+		return false;
+	case RES_NOT:
+		return !_table_restriction_match(conn, table, pos, node->children);
+	case RES_COMMENT:
+		return !node->count || _table_restriction_match(conn, table, pos, node->children);
+	case RES_EXIST:
+		return _table_fetch_attribute(conn, table, pos, node->proptag) != NULL;
+	case RES_PROPERTY:
+		value = _table_fetch_attribute(conn, table, pos, node->proptag);
+		if (!value) return false;
+		return _table_relop_match(node->relop, _table_compare_values(node->proptag, value, node->value));
+	case RES_COMPAREPROPS:
+		value = _table_fetch_attribute(conn, table, pos, node->proptag);
+		value2 = _table_fetch_attribute(conn, table, pos, node->proptag2);
+		if (!value || !value2) return false;
+		return _table_relop_match(node->relop, _table_compare_values(node->proptag, value, value2));
+	case RES_CONTENT:
+		value = _table_fetch_attribute(conn, table, pos, node->proptag);
+		if (!value) return false;
+		return _table_content_match(value, node->value, node->fuzzy);
+	case RES_BITMASK:
+		value = _table_fetch_attribute(conn, table, pos, node->proptag);
+		if (!value) return false;
+		return ((strtoll(value, NULL, 10) & node->mask) == 0) == (node->relop == BMR_EQZ);
+	default:
+		return false;
+	}
+}
+
+/**
+   \details Check the row at position pos against the restriction
+   terms which were not part of the SQL query
+ */
+static bool _table_check_fallback_restrictions(MYSQL *conn, struct openchangedb_table *table,
+					       uint32_t pos)
+{
+	struct openchangedb_table_restriction	*conjuncts;
+	uint32_t				count, i;
+
+	if (!table->restrictions) return true;
+
+	if (table->restrictions->rt == RES_AND) {
+		conjuncts = table->restrictions->children;
+		count = table->restrictions->count;
+	} else {
+		conjuncts = table->restrictions;
+		count = 1;
+	}
+
+	for (i = 0; i < count; i++) {
+		if (conjuncts[i].in_sql) continue;
+		if (!_table_restriction_match(conn, table, pos, &conjuncts[i])) return false;
+	}
+
+	return true;
+}
+
+/**
+   \details Drop from the results the rows rejected by the restriction
+   terms which were not part of the SQL query
+ */
+static void _table_apply_fallback_restrictions(MYSQL *conn, struct openchangedb_table *table)
+{
+	struct openchangedb_table_results	*results = table->res;
+	bool					is_message;
+	size_t					i, count = 0;
+
+	is_message = table->table_type == 0x3 || table->table_type == 0x2;
+
+	for (i = 0; i < results->count; i++) {
+		if (!_table_check_fallback_restrictions(conn, table, i)) continue;
+		if (is_message) {
+			results->messages[count++] = results->messages[i];
+		} else {
+			results->folders[count++] = results->folders[i];
+		}
+	}
+	results->count = count;
 }
 
 static enum MAPISTATUS _table_fetch_messages(MYSQL *conn,
@@ -2453,153 +3092,61 @@ static enum MAPISTATUS _table_fetch_messages(MYSQL *conn,
 					     bool fai, bool live_filtered)
 {
 	TALLOC_CTX				*mem_ctx;
-	char					*sql, *msg_type;
-	const char				*attr, *value;
+	char					*sql, *msg_type, *username;
+	const char				*filter[3];
+	const char				*alias[3] = { "m1", "m2", "m" };
 	MYSQL_RES				*res = NULL;
 	MYSQL_ROW				row;
 	enum MAPISTATUS				retval;
-	uint64_t				id;
 	size_t 					i;
 	struct openchangedb_table_results	*results;
 	struct openchangedb_table_message_row	*msg_row;
-	struct mapi_SRestriction		*restrictions;
 
 	mem_ctx = talloc_named(NULL, 0, "_table_fetch_messages");
 	OPENCHANGE_RETVAL_IF(!mem_ctx, MAPI_E_NOT_ENOUGH_MEMORY, NULL);
 
 	OPENCHANGE_RETVAL_IF(!table, MAPI_E_INVALID_PARAMETER, NULL);
-	restrictions = table->restrictions;
 
 	msg_type = talloc_strdup(mem_ctx, fai ? "faiMessage" : "systemMessage");
 	OPENCHANGE_RETVAL_IF(!msg_type, MAPI_E_NOT_ENOUGH_MEMORY, mem_ctx);
-
-	retval = _table_get_attr_and_value_from_restrictions(mem_ctx, restrictions, &attr, &value);
-	OPENCHANGE_RETVAL_IF(retval != MAPI_E_SUCCESS, retval, mem_ctx);
-
-	if (live_filtered || !restrictions) {
-		sql = talloc_asprintf(mem_ctx,
-			"SELECT m1.id, m1.message_id, m1.normalized_subject "
-			"FROM messages m1 "
-			"JOIN mailboxes mb1 ON mb1.id = m1.mailbox_id "
-			"  AND mb1.folder_id = %"PRIu64" AND mb1.name = '%s' "
-			"WHERE m1.message_type = '%s' "
-			"UNION "
-			"SELECT m2.id, m2.message_id, m2.normalized_subject "
-			"FROM messages m2 "
-			"JOIN folders f ON f.id = m2.folder_id "
-			"  AND f.folder_id = %"PRIu64" "
-			"JOIN mailboxes mb2 ON mb2.id = f.mailbox_id AND mb2.name = '%s' "
-			"WHERE m2.message_type = '%s' "
-			"UNION "
-			"SELECT m.id, m.message_id, m.normalized_subject "
-			"FROM messages m "
-			"JOIN folders f ON f.id = m.folder_id "
-			"  AND f.folder_id = %"PRIu64
-			"  AND f.ou_id = %"PRIu64
-			"  AND f.folder_class = '"PUBLIC_FOLDER"' "
-			"WHERE m2.message_type = '%s' ",
-			table->folder_id, table->username, msg_type,
-			table->folder_id, table->username, msg_type,
-			table->folder_id, table->ou_id, msg_type);
-	} else if (restrictions->res.resProperty.ulPropTag == PidTagMid) {
-		if (!convert_string_to_ull(value, &id)) {
-			OC_DEBUG(0, "Invalid MessageId, conversion failed\n");
-			retval = MAPI_E_CALL_FAILED;
-			goto end;
-		}
-		sql = talloc_asprintf(mem_ctx,
-			"SELECT m1.id, m1.message_id, m1.normalized_subject "
-			"FROM messages m1 "
-			"JOIN mailboxes mb1 ON mb1.id = m1.mailbox_id "
-			"  AND mb1.folder_id = %"PRIu64" AND mb1.name = '%s' "
-			"WHERE m1.message_type = '%s' "
-			"  AND m1.message_id = %"PRIu64" "
-			"UNION "
-			"SELECT m2.id, m2.message_id, m2.normalized_subject "
-			"FROM messages m2 "
-			"JOIN folders f ON f.id = m2.folder_id "
-			"  AND f.folder_id = %"PRIu64" "
-			"JOIN mailboxes mb2 ON mb2.id = f.mailbox_id AND mb2.name = '%s' "
-			"WHERE m2.message_type = '%s'"
-			"  AND m2.message_id = %"PRIu64" "
-			"UNION "
-			"SELECT m.id, m.message_id, m.normalized_subject "
-			"FROM messages m "
-			"JOIN folders f ON f.id = m.folder_id "
-			"  AND f.folder_id = %"PRIu64" "
-			"  AND f.ou_id = %"PRIu64
-			"  AND f.folder_class = '"PUBLIC_FOLDER"' "
-			"WHERE m.message_type = '%s'"
-			"  AND m.message_id = %"PRIu64,
-			table->folder_id, table->username, msg_type, id,
-			table->folder_id, table->username, msg_type, id,
-			table->folder_id, table->ou_id, msg_type, id);
-	} else if (restrictions->res.resProperty.ulPropTag == PidTagNormalizedSubject) {
-		sql = talloc_asprintf(mem_ctx,
-			"SELECT m1.id, m1.message_id, m1.normalized_subject "
-			"FROM messages m1 "
-			"JOIN mailboxes mb1 ON mb1.id = m1.mailbox_id "
-			"  AND mb1.folder_id = %"PRIu64" AND mb1.name = '%s' "
-			"WHERE m1.message_type = '%s' "
-			"  AND m1.normalized_subject = '%s' "
-			"UNION "
-			"SELECT m2.id, m2.message_id, m2.normalized_subject "
-			"FROM messages m2 "
-			"JOIN folders f ON f.id = m2.folder_id "
-			"  AND f.folder_id = %"PRIu64" "
-			"JOIN mailboxes mb2 ON mb2.id = f.mailbox_id AND mb2.name = '%s' "
-			"WHERE m2.message_type = '%s'"
-			"  AND m2.normalized_subject = '%s' "
-			"UNION "
-			"SELECT m.id, m.message_id, m.normalized_subject "
-			"FROM messages m "
-			"JOIN folders f ON f.id = m.folder_id "
-			"  AND f.folder_id = %"PRIu64
-			"  AND f.ou_id = %"PRIu64
-			"  AND f.folder_class = '"PUBLIC_FOLDER"' "
-			"WHERE m.message_type = '%s'"
-			"  AND m.normalized_subject = '%s'",
-			table->folder_id, table->username, msg_type, value,
-			table->folder_id, table->username, msg_type, value,
-			table->folder_id, table->ou_id, msg_type, value);
-	} else {
-		sql = talloc_asprintf(mem_ctx,
-			"SELECT m1.id, m1.message_id, m1.normalized_subject "
-			"FROM messages m1 "
-			"JOIN mailboxes mb1 ON mb1.id = m1.mailbox_id "
-			"  AND mb1.folder_id = %"PRIu64" AND mb1.name = '%s' "
-			"WHERE m1.message_type = '%s' "
-			"  AND EXISTS ("
-			"     SELECT mp.message_id FROM messages_properties mp "
-			"     WHERE mp.message_id = m1.id "
-			"       AND mp.name = '%s' AND mp.value = '%s') "
-			"UNION "
-			"SELECT m2.id, m2.message_id, m2.normalized_subject "
-			"FROM messages m2 "
-			"JOIN folders f ON f.id = m2.folder_id "
-			"  AND f.folder_id = %"PRIu64" "
-			"JOIN mailboxes mb2 ON mb2.id = f.mailbox_id AND mb2.name = '%s' "
-			"WHERE m2.message_type = '%s'"
-			"  AND EXISTS ("
-			"     SELECT mp.message_id FROM messages_properties mp "
-			"     WHERE mp.message_id = m2.id "
-			"       AND mp.name = '%s' AND mp.value = '%s') "
-			"UNION "
-			"SELECT m.id, m.message_id, m.normalized_subject "
-			"FROM messages m "
-			"JOIN folders f ON f.id = m.folder_id "
-			"  AND f.folder_id = %"PRIu64
-			"  AND f.ou_id = %"PRIu64
-			"  AND f.folder_class = '"PUBLIC_FOLDER"' "
-			"WHERE m.message_type = '%s'"
-			"  AND EXISTS ("
-			"     SELECT mp.message_id FROM messages_properties mp "
-			"     WHERE mp.message_id = m.id "
-			"       AND mp.name = '%s' AND mp.value = '%s')",
-			table->folder_id, table->username, msg_type, attr, value,
-			table->folder_id, table->username, msg_type, attr, value,
-			table->folder_id, table->ou_id, msg_type, attr, value);
+	username = _sql_real_escape(mem_ctx, conn, table->username);
+	OPENCHANGE_RETVAL_IF(!username, MAPI_E_NOT_ENOUGH_MEMORY, mem_ctx);
+
+	/* Restrictions are evaluated by MySQL as a filter. When live
+	 * filtering, properties may change after the fetch, so each row
+	 * is checked when it is read instead */
+	for (i = 0; i < 3; i++) {
+		filter[i] = live_filtered ? "TRUE" : _table_restrictions_sql(mem_ctx, conn, table, alias[i]);
+		OPENCHANGE_RETVAL_IF(!filter[i], MAPI_E_NOT_ENOUGH_MEMORY, mem_ctx);
 	}
+
+	sql = talloc_asprintf(mem_ctx,
+		"SELECT m1.id, m1.message_id, m1.normalized_subject "
+		"FROM messages m1 "
+		"JOIN mailboxes mb1 ON mb1.id = m1.mailbox_id "
+		"  AND mb1.folder_id = %"PRIu64" AND mb1.name = '%s' "
+		"WHERE m1.message_type = '%s' "
+		"  AND %s "
+		"UNION "
+		"SELECT m2.id, m2.message_id, m2.normalized_subject "
+		"FROM messages m2 "
+		"JOIN folders f ON f.id = m2.folder_id "
+		"  AND f.folder_id = %"PRIu64" "
+		"JOIN mailboxes mb2 ON mb2.id = f.mailbox_id AND mb2.name = '%s' "
+		"WHERE m2.message_type = '%s' "
+		"  AND %s "
+		"UNION "
+		"SELECT m.id, m.message_id, m.normalized_subject "
+		"FROM messages m "
+		"JOIN folders f ON f.id = m.folder_id "
+		"  AND f.folder_id = %"PRIu64
+		"  AND f.ou_id = %"PRIu64
+		"  AND f.folder_class = '"PUBLIC_FOLDER"' "
+		"WHERE m.message_type = '%s' "
+		"  AND %s",
+		table->folder_id, username, msg_type, filter[0],
+		table->folder_id, username, msg_type, filter[1],
+		table->folder_id, table->ou_id, msg_type, filter[2]);
 	OPENCHANGE_RETVAL_IF(!sql, MAPI_E_NOT_ENOUGH_MEMORY, mem_ctx);
 	retval = status(select_without_fetch(conn, sql, &res));
 	OPENCHANGE_RETVAL_IF(retval != MAPI_E_SUCCESS, retval, mem_ctx);
@@ -2631,6 +3178,10 @@ static enum MAPISTATUS _table_fetch_messages(MYSQL *conn,
 
 		results->messages[i] = msg_row;
 	}
+
+	if (!live_filtered) {
+		_table_apply_fallback_restrictions(conn, table);
+	}
 end:
 	if (res) mysql_free_result(res);
 	talloc_free(mem_ctx);
@@ -2642,109 +3193,53 @@ static enum MAPISTATUS _table_fetch_folders(MYSQL *conn,
 					    bool live_filtered)
 {
 	TALLOC_CTX				*mem_ctx;
-	char					*sql;
-	const char				*attr, *value;
+	char					*sql, *username;
+	const char				*filter[3];
+	const char				*alias[3] = { "f1", "f3", "f1" };
 	MYSQL_RES				*res = NULL;
 	MYSQL_ROW				row;
 	enum MAPISTATUS				retval;
-	uint64_t				id;
 	size_t					i;
 	struct openchangedb_table_results	*results;
 	struct openchangedb_table_folder_row	*folder_row;
-	struct mapi_SRestriction		*restrictions;
 
 	mem_ctx = talloc_named(NULL, 0, "_table_fetch_folders");
 	OPENCHANGE_RETVAL_IF(!mem_ctx, MAPI_E_NOT_ENOUGH_MEMORY, NULL);
 
 	OPENCHANGE_RETVAL_IF(!table, MAPI_E_INVALID_PARAMETER, NULL);
-	restrictions = table->restrictions;
 
-	retval = _table_get_attr_and_value_from_restrictions(mem_ctx, restrictions, &attr, &value);
-	OPENCHANGE_RETVAL_IF(retval != MAPI_E_SUCCESS, retval, mem_ctx);
+	username = _sql_real_escape(mem_ctx, conn, table->username);
+	OPENCHANGE_RETVAL_IF(!username, MAPI_E_NOT_ENOUGH_MEMORY, mem_ctx);
 
-	if (live_filtered || !restrictions) {
-		sql = talloc_asprintf(mem_ctx,
-			"SELECT f1.id, f1.folder_id FROM folders f1 "
-			"JOIN folders f2 ON f2.id = f1.parent_folder_id "
-			"   AND f2.folder_id = %"PRIu64" "
-			"JOIN mailboxes mb1 ON mb1.id = f1.mailbox_id "
-			"   AND mb1.name = '%s' "
-			"UNION "
-			"SELECT f3.id, f3.folder_id FROM folders f3 "
-			"JOIN mailboxes mb2 ON mb2.id = f3.mailbox_id "
-			"   AND mb2.folder_id = %"PRIu64" AND mb2.name = '%s' "
-			"WHERE f3.parent_folder_id IS NULL "
-			"UNION "
-			"SELECT f1.id, f1.folder_id FROM folders f1 "
-			"JOIN folders f2 ON f2.id = f1.parent_folder_id "
-			"   AND f2.folder_id = %"PRIu64" "
-			"WHERE f1.ou_id = %"PRIu64
-			"   AND f1.folder_class = '"PUBLIC_FOLDER"'",
-			table->folder_id, table->username,
-			table->folder_id, table->username,
-			table->folder_id, table->ou_id);
-	} else if (restrictions->res.resProperty.ulPropTag == PidTagFolderId) {
-		if (!convert_string_to_ull(value, &id)) {
-			OC_DEBUG(0, "Invalid FolderId, conversion failed\n");
-			retval = MAPI_E_CALL_FAILED;
-			goto end;
-		}
-		sql = talloc_asprintf(mem_ctx,
-			"SELECT f1.id, f1.folder_id FROM folders f1 "
-			"JOIN folders f2 ON f2.id = f1.parent_folder_id "
-			"   AND f2.folder_id = %"PRIu64" "
-			"JOIN mailboxes mb1 ON mb1.id = f1.mailbox_id "
-			"   AND mb1.name = '%s' "
-			"WHERE f1.folder_id = %"PRIu64" "
-			"UNION "
-			"SELECT f3.id, f3.folder_id FROM folders f3 "
-			"JOIN mailboxes mb2 ON mb2.id = f3.mailbox_id "
-			"   AND mb2.folder_id = %"PRIu64" AND mb2.name = '%s' "
-			"WHERE f3.parent_folder_id IS NULL"
-			"   AND f3.folder_id = %"PRIu64" "
-			"UNION "
-			"SELECT f1.id, f1.folder_id FROM folders f1 "
-			"JOIN folders f2 ON f2.id = f1.parent_folder_id "
-			"   AND f2.folder_id = %"PRIu64" "
-			"WHERE f1.ou_id = %"PRIu64
-			"   AND f1.folder_id = %"PRIu64" "
-			"   AND f1.folder_class = '"PUBLIC_FOLDER"'",
-			table->folder_id, table->username, id,
-			table->folder_id, table->username, id,
-			table->folder_id, table->ou_id, id);
-	} else {
-		sql = talloc_asprintf(mem_ctx,
-			"SELECT f1.id, f1.folder_id FROM folders f1 "
-			"JOIN folders f2 ON f2.id = f1.parent_folder_id "
-			"   AND f2.folder_id = %"PRIu64" "
-			"JOIN mailboxes mb ON mb.id = f1.mailbox_id "
-			"   AND mb.name = '%s' "
-			"WHERE EXISTS ("
-			"     SELECT fp.folder_id FROM folders_properties fp "
-			"     WHERE fp.folder_id = f1.id "
-			"       AND fp.name = '%s' AND fp.value = '%s') "
-			"UNION "
-			"SELECT f.id, f.folder_id FROM folders f "
-			"JOIN mailboxes mb ON mb.id = f.mailbox_id "
-			"   AND mb.folder_id = %"PRIu64" AND mb.name = '%s' "
-			"WHERE f.parent_folder_id IS NULL"
-			"  AND EXISTS ("
-			"     SELECT fp.folder_id FROM folders_properties fp "
-			"     WHERE fp.folder_id = f.id "
-			"       AND fp.name = '%s' AND fp.value = '%s') "
-			"UNION "
-			"SELECT f1.id, f1.folder_id FROM folders f1 "
-			"JOIN folders f2 ON f2.id = f1.parent_folder_id "
-			"   AND f2.folder_id = %"PRIu64" "
-			"WHERE f1.ou_id = %"PRIu64
-			" AND f1.folder_class = '"PUBLIC_FOLDER"' AND EXISTS ("
-			"     SELECT fp.folder_id FROM folders_properties fp "
-			"     WHERE fp.folder_id = f1.id "
-			"       AND fp.name = '%s' AND fp.value = '%s') ",
-			table->folder_id, table->username, attr, value,
-			table->folder_id, table->username, attr, value,
-			table->folder_id, table->ou_id, attr, value);
+	/* See _table_fetch_messages */
+	for (i = 0; i < 3; i++) {
+		filter[i] = live_filtered ? "TRUE" : _table_restrictions_sql(mem_ctx, conn, table, alias[i]);
+		OPENCHANGE_RETVAL_IF(!filter[i], MAPI_E_NOT_ENOUGH_MEMORY, mem_ctx);
 	}
+
+	sql = talloc_asprintf(mem_ctx,
+		"SELECT f1.id, f1.folder_id FROM folders f1 "
+		"JOIN folders f2 ON f2.id = f1.parent_folder_id "
+		"   AND f2.folder_id = %"PRIu64" "
+		"JOIN mailboxes mb1 ON mb1.id = f1.mailbox_id "
+		"   AND mb1.name = '%s' "
+		"WHERE %s "
+		"UNION "
+		"SELECT f3.id, f3.folder_id FROM folders f3 "
+		"JOIN mailboxes mb2 ON mb2.id = f3.mailbox_id "
+		"   AND mb2.folder_id = %"PRIu64" AND mb2.name = '%s' "
+		"WHERE f3.parent_folder_id IS NULL "
+		"   AND %s "
+		"UNION "
+		"SELECT f1.id, f1.folder_id FROM folders f1 "
+		"JOIN folders f2 ON f2.id = f1.parent_folder_id "
+		"   AND f2.folder_id = %"PRIu64" "
+		"WHERE f1.ou_id = %"PRIu64
+		"   AND f1.folder_class = '"PUBLIC_FOLDER"'"
+		"   AND %s",
+		table->folder_id, username, filter[0],
+		table->folder_id, username, filter[1],
+		table->folder_id, table->ou_id, filter[2]);
 	OPENCHANGE_RETVAL_IF(!sql, MAPI_E_NOT_ENOUGH_MEMORY, mem_ctx);
 	retval = status(select_without_fetch(conn, sql, &res));
 	OPENCHANGE_RETVAL_IF(retval != MAPI_E_SUCCESS, retval, mem_ctx);
@@ -2773,6 +3268,10 @@ static enum MAPISTATUS _table_fetch_folders(MYSQL *conn,
 		}
 		results->folders[i] = folder_row;
 	}
+
+	if (!live_filtered) {
+		_table_apply_fallback_restrictions(conn, table);
+	}
 end:
 	if (res) mysql_free_result(res);
 	talloc_free(mem_ctx);
@@ -2798,172 +3297,49 @@ static enum MAPISTATUS _table_fetch_results(MYSQL *conn,
 	}
 }
 
-static bool _table_check_message_match_restrictions(MYSQL *conn,
-						    struct openchangedb_table *table,
-						    bool fai,
-						    struct openchangedb_table_message_row *row)
-{
-	TALLOC_CTX			*mem_ctx;
-	char				*sql = NULL, *msg_type = NULL;
-	const char			*attr, *value;
-	struct mapi_SRestriction	*restrictions;
-	uint64_t			id = 0;
-	bool				ret = false;
-
-	mem_ctx = talloc_named(NULL, 0, "_table_check_message_match_restrictions");
-	if (!mem_ctx) return false;
-
-	if (!conn || !table || !row) goto end;
-	restrictions = table->restrictions;
-
-	ret = _table_get_attr_and_value_from_restrictions(mem_ctx, restrictions, &attr, &value);
-	if (ret != MAPI_E_SUCCESS) goto end;
-
-	if (restrictions->res.resProperty.ulPropTag == PidTagMid) {
-		if (convert_string_to_ull(value, &id)) {
-			ret = row->mid == id;
-		} else {
-			OC_DEBUG(0, "Invalid TagMid, conversion failed\n");
-		}
-		goto end;
-	} else if (restrictions->res.resProperty.ulPropTag == PidTagNormalizedSubject) {
-		ret = strcmp(row->normalized_subject, value) == 0;
-		goto end;
-	}
-
-	msg_type = talloc_strdup(mem_ctx, fai ? "faiMessage" : "systemMessage");
-	if (!msg_type) goto end;
-
-	sql = talloc_asprintf(mem_ctx,
-		"SELECT m1.id FROM messages m1 "
-		"JOIN mailboxes mb1 ON mb1.id = m1.mailbox_id "
-		"  AND mb1.folder_id = %"PRIu64" AND mb1.name = '%s' "
-		"WHERE m1.message_type = '%s' "
-		"  AND EXISTS ("
-		"     SELECT mp.message_id FROM messages_properties mp "
-		"     WHERE mp.message_id = m1.id "
-		"       AND mp.name = '%s' AND mp.value = '%s') "
-		"  AND m1.id = %"PRIu64" "
-		"UNION "
-		"SELECT m2.id FROM messages m2 "
-		"JOIN folders f ON f.id = m2.folder_id "
-		"  AND f.folder_id = %"PRIu64" "
-		"JOIN mailboxes mb2 ON mb2.id = f.mailbox_id AND mb2.name = '%s' "
-		"WHERE m2.message_type = '%s'"
-		"  AND EXISTS ("
-		"     SELECT mp.message_id FROM messages_properties mp "
-		"     WHERE mp.message_id = m2.id "
-		"       AND mp.name = '%s' AND mp.value = '%s') "
-		"  AND m2.id = %"PRIu64" "
-		"UNION "
-		"SELECT m.id FROM messages m "
-		"JOIN folders f ON f.id = m.folder_id "
-		"  AND f.folder_id = %"PRIu64
-		"  AND f.ou_id = %"PRIu64
-		"  AND f.folder_class = '"PUBLIC_FOLDER"' "
-		"WHERE m2.message_type = '%s'"
-		"  AND EXISTS ("
-		"     SELECT mp.message_id FROM messages_properties mp "
-		"     WHERE mp.message_id = m2.id "
-		"       AND mp.name = '%s' AND mp.value = '%s') "
-		"  AND m2.id = %"PRIu64,
-		table->folder_id, table->username, msg_type, attr, value, row->id,
-		table->folder_id, table->username, msg_type, attr, value, row->id,
-		table->folder_id, table->ou_id, msg_type, attr, value, row->id);
-	if (!sql) goto end;
-	ret = status(select_first_uint(conn, sql, &id)) == MAPI_E_SUCCESS;
-end:
-	talloc_free(mem_ctx);
-	return ret;
-}
-
-static bool _table_check_folder_match_restrictions(MYSQL *conn,
-						   struct openchangedb_table *table,
-						   struct openchangedb_table_folder_row *row)
-{
-	TALLOC_CTX			*mem_ctx;
-	char				*sql;
-	const char			*attr, *value;
-	struct mapi_SRestriction	*restrictions;
-	uint64_t			id;
-	bool				ret = false;
-
-	mem_ctx = talloc_named(NULL, 0, "_table_check_folder_match_restrictions");
-	if (!mem_ctx) return false;
-
-	if (!conn || !table || !row) goto end;
-	restrictions = table->restrictions;
-
-	ret = _table_get_attr_and_value_from_restrictions(mem_ctx, restrictions, &attr, &value);
-	if (ret != MAPI_E_SUCCESS) goto end;
-
-	if (restrictions->res.resProperty.ulPropTag == PidTagFolderId) {
-		if (convert_string_to_ull(value, &id)) {
-			ret = row->fid == id;
-		} else {
-			OC_DEBUG(0, "Invalid TagFolderId, conversion failed\n");
-		}
-		goto end;
-	}
-
-	sql = talloc_asprintf(mem_ctx,
-		"SELECT f1.id FROM folders f1 "
-		"JOIN folders f2 ON f2.id = f1.parent_folder_id "
-		"   AND f2.folder_id = %"PRIu64" "
-		"JOIN mailboxes mb1 ON mb1.id = f1.mailbox_id "
-		"   AND mb1.name = '%s' "
-		"WHERE EXISTS ("
-		"     SELECT fp.folder_id FROM folders_properties fp "
-		"     WHERE fp.folder_id = f1.id "
-		"       AND fp.name = '%s' AND fp.value = '%s') "
-		"   AND f1.id = %"PRIu64" "
-		"UNION "
-		"SELECT f3.id FROM folders f3 "
-		"JOIN mailboxes mb2 ON mb2.id = f3.mailbox_id "
-		"   AND mb2.folder_id = %"PRIu64" AND mb2.name = '%s' "
-		"WHERE f3.parent_folder_id IS NULL"
-		"  AND EXISTS ("
-		"     SELECT fp.folder_id FROM folders_properties fp "
-		"     WHERE fp.folder_id = f3.id "
-		"       AND fp.name = '%s' AND fp.value = '%s') "
-		"   AND f3.id = %"PRIu64" "
-		"UNION "
-		"SELECT f1.id FROM folders f1 "
-		"JOIN folders f2 ON f2.id = f1.parent_folder_id "
-		"   AND f2.folder_id = %"PRIu64" "
-		"WHERE f1.ou_id = %"PRIu64
-		"   AND f1.folder_class = '"PUBLIC_FOLDER"' AND EXISTS ("
-		"     SELECT fp.folder_id FROM folders_properties fp "
-		"     WHERE fp.folder_id = f1.id "
-		"       AND fp.name = '%s' AND fp.value = '%s') "
-		"   AND f1.id = %"PRIu64" ",
-		table->folder_id, table->username, attr, value, row->id,
-		table->folder_id, table->username, attr, value, row->id,
-		table->folder_id, table->ou_id, attr, value, row->id);
-	if (!sql) goto end;
-	ret = status(select_first_uint(conn, sql, &id)) == MAPI_E_SUCCESS;
-end:
-	talloc_free(mem_ctx);
-	return ret;
-}
-
+/**
+   \details Check the row at position pos against the restrictions with
+   its current properties, which may have changed since the results
+   were fetched
+ */
 static bool _table_check_match_restrictions(MYSQL *conn,
-					    struct openchangedb_table *table,
-					    uint32_t pos)
+					     struct openchangedb_table *table,
+					     uint32_t pos)
 {
-	bool is_message;
+	TALLOC_CTX	*mem_ctx;
+	const char	*cond, *value = NULL;
+	char		*sql = NULL;
+	bool		is_message;
+	bool		matched;
 
 	if (!conn || !table) return false;
 
 	if (!table->restrictions) return true;
 
+	mem_ctx = talloc_named(NULL, 0, "_table_check_match_restrictions");
+	if (!mem_ctx) return false;
+
 	is_message = table->table_type == 0x3 || table->table_type == 0x2;
 	if (is_message) {
-		bool fai = table->table_type == 0x3;
-		return _table_check_message_match_restrictions(conn, table, fai, table->res->messages[pos]);
+		cond = _table_restrictions_sql(mem_ctx, conn, table, "m");
+		if (cond) {
+			sql = talloc_asprintf(mem_ctx,
+				"SELECT %s FROM messages m WHERE m.id = %"PRIu64,
+				cond, table->res->messages[pos]->id);
+		}
 	} else {
-		return _table_check_folder_match_restrictions(conn, table, table->res->folders[pos]);
+		cond = _table_restrictions_sql(mem_ctx, conn, table, "f");
+		if (cond) {
+			sql = talloc_asprintf(mem_ctx,
+				"SELECT %s FROM folders f WHERE f.id = %"PRIu64,
+				cond, table->res->folders[pos]->id);
+		}
 	}
+	matched = sql && select_first_string(mem_ctx, conn, sql, &value) == MYSQL_SUCCESS &&
+		value && strcmp(value, "0");
+	talloc_free(mem_ctx);
+
+	return matched && _table_check_fallback_restrictions(conn, table, pos);
 }
 
 static const char *_table_fetch_message_attribute(MYSQL *conn,
@@ -3072,7 +3448,7 @@ static enum MAPISTATUS table_get_property(TALLOC_CTX *mem_ctx,
 	struct openchangedb_table_results	*res;
 	uint32_t				*id;
 
-	conn = self->data;
+	conn = READER(self, table->username);
 	OPENCHANGE_RETVAL_IF(!conn, MAPI_E_BAD_VALUE, NULL);
 
 	/* Fetch results */
@@ -3146,6 +3522,7 @@ struct openchangedb_message {
 	uint64_t				folder_id; // id from database
 	uint64_t				mailbox_id;
 	char					*normalized_subject;
+	const char				*username;
 	struct openchangedb_message_properties	properties;
 };
 
@@ -3201,7 +3578,7 @@ static enum MAPISTATUS message_create(TALLOC_CTX *parent_ctx,
 	MYSQL				*conn;
 	bool				parent_is_mailbox = false;
 
-	conn = self->data;
+	conn = WRITER(self, username);
 	OPENCHANGE_RETVAL_IF(!conn, MAPI_E_BAD_VALUE, NULL);
 
 	retval = get_mailbox_ids_by_name(conn, username, &mailbox_id, &mailbox_folder_id, &ou_id);
@@ -3223,6 +3600,8 @@ static enum MAPISTATUS message_create(TALLOC_CTX *parent_ctx,
 		msg->folder_id = folder_id;
 	if (mailbox_id)
 		msg->mailbox_id = mailbox_id;
+	msg->username = talloc_strdup(msg, username);
+	OPENCHANGE_RETVAL_IF(!msg->username, MAPI_E_NOT_ENOUGH_MEMORY, msg);
 
 	msg->properties.size = 4;
 	msg->properties.names = (const char **)talloc_zero_array(msg, char *, msg->properties.size);
@@ -3277,7 +3656,7 @@ static enum MAPISTATUS message_save(struct openchangedb_context *self,
 
 	mem_ctx = talloc_named(NULL, 0, "message_save");
 	OPENCHANGE_RETVAL_IF(!mem_ctx, MAPI_E_NOT_ENOUGH_MEMORY, NULL);
-	conn = self->data;
+	conn = WRITER(self, NULL);
 	OPENCHANGE_RETVAL_IF(!conn, MAPI_E_BAD_VALUE, mem_ctx);
 
 	fields = (const char **)str_list_make_empty(mem_ctx);
@@ -3430,12 +3809,14 @@ static enum MAPISTATUS message_open(TALLOC_CTX *parent_ctx,
 
 	mem_ctx = talloc_named(NULL, 0, "message_open");
 	OPENCHANGE_RETVAL_IF(!mem_ctx, MAPI_E_NOT_ENOUGH_MEMORY, NULL);
-	conn = self->data;
+	conn = READER(self, username);
 	OPENCHANGE_RETVAL_IF(!conn, MAPI_E_BAD_VALUE, mem_ctx);
 
 	msg = talloc_zero(mem_ctx, struct openchangedb_message);
 	OPENCHANGE_RETVAL_IF(!msg, MAPI_E_NOT_ENOUGH_MEMORY, mem_ctx);
 	msg->message_id = message_id;
+	msg->username = talloc_strdup(msg, username);
+	OPENCHANGE_RETVAL_IF(!msg->username, MAPI_E_NOT_ENOUGH_MEMORY, mem_ctx);
 
 	retval = get_mailbox_ids_by_name(conn, username, &mailbox_id,&mailbox_folder_id, NULL);
 	OPENCHANGE_RETVAL_IF(retval != MAPI_E_SUCCESS, retval, mem_ctx);
@@ -3571,7 +3952,7 @@ static enum MAPISTATUS message_get_property(TALLOC_CTX *parent_ctx,
 
 	mem_ctx = talloc_named(NULL, 0, "message_get_property");
 	OPENCHANGE_RETVAL_IF(!mem_ctx, MAPI_E_NOT_ENOUGH_MEMORY, NULL);
-	conn = self->data;
+	conn = READER(self, msg->username);
 	OPENCHANGE_RETVAL_IF(!conn, MAPI_E_BAD_VALUE, mem_ctx);
 
 	// Special properties (they are on messages table instead of
@@ -3718,12 +4099,18 @@ static const char *openchangedb_data_dir(void)
 	return OPENCHANGEDB_DATA_DIR; // defined on compilation time
 }
 
+static void release(struct openchangedb_context *self)
+{
+	mysql_rw_release(self->data);
+}
+
 static int openchangedb_mysql_destructor(struct openchangedb_context *self)
 {
 	OC_DEBUG(5, "Destroying openchangedb mysql context\n");
 	if (self && self->data) {
-		MYSQL *conn = self->data;
-		release_connection(conn);
+		/* Connections are checked in along with the read/write split */
+		talloc_free(self->data);
+		self->data = NULL;
 	} else {
 		OC_DEBUG(0, "Error: tried to destroy corrupted openchangedb mysql context\n");
 	}
@@ -3738,6 +4125,8 @@ enum MAPISTATUS openchangedb_mysql_initialize(TALLOC_CTX *mem_ctx,
 	struct openchangedb_context 	*oc_ctx;
 	MYSQL				*conn = NULL;
 	const char			*connection_string;
+	const char			*replica_connection_string;
+	bool				schema_exists;
 	int				schema_created_ret;
 
 	oc_ctx = talloc_zero(mem_ctx, struct openchangedb_context);
@@ -3765,6 +4154,7 @@ enum MAPISTATUS openchangedb_mysql_initialize(TALLOC_CTX *mem_ctx,
 	oc_ctx->lookup_folder_property = lookup_folder_property;
 	oc_ctx->set_folder_properties = set_folder_properties;
 	oc_ctx->get_folder_property = get_folder_property;
+	oc_ctx->get_folder_properties = get_folder_properties;
 	oc_ctx->get_folder_count = get_folder_count;
 	oc_ctx->get_message_count = get_message_count;
 	oc_ctx->get_system_idx = get_system_idx;
@@ -3800,6 +4190,8 @@ enum MAPISTATUS openchangedb_mysql_initialize(TALLOC_CTX *mem_ctx,
 	oc_ctx->set_locale = set_locale;
 	oc_ctx->get_folders_names = get_folders_names;
 
+	oc_ctx->release = release;
+
 	connection_string = lpcfg_parm_string(lp_ctx, NULL, "mapiproxy", "openchangedb");
 	if (!connection_string) {
 		OC_DEBUG(0, "mapiproxy:openchangedb must be defined");
@@ -3808,9 +4200,16 @@ enum MAPISTATUS openchangedb_mysql_initialize(TALLOC_CTX *mem_ctx,
 	// Connect to mysql
 	create_connection(connection_string, &conn);
 	OPENCHANGE_RETVAL_IF(!conn, MAPI_E_NOT_INITIALIZED, oc_ctx);
-	oc_ctx->data = conn;
+	schema_exists = table_exists(conn, "folders");
+	release_connection(conn);
+	// Queries check connections out on demand, optionally from a replica
+	replica_connection_string = lpcfg_parm_string(lp_ctx, NULL, "mapiproxy", "openchangedb_replica");
+	oc_ctx->data = mysql_rw_init(oc_ctx, connection_string, replica_connection_string,
+				     lpcfg_parm_int(lp_ctx, NULL, "mapiproxy", "openchangedb_replica_sticky",
+						    MYSQL_RW_DEFAULT_STICKY));
+	OPENCHANGE_RETVAL_IF(!oc_ctx->data, MAPI_E_NOT_ENOUGH_MEMORY, oc_ctx);
 	talloc_set_destructor(oc_ctx, openchangedb_mysql_destructor);
-	if (!table_exists(oc_ctx->data, "folders")) {
+	if (!schema_exists) {
 		OC_DEBUG(3, "Creating schema for openchangedb on mysql %s\n",
 			  connection_string);
 		schema_created_ret = migrate_openchangedb_schema(connection_string);
@@ -0,0 +1,1257 @@
+/*
+   MAPI Proxy - OpenchangeDB profiler
+
+   OpenChange Project
+
+   This program is free software; you can redistribute it and/or modify
+   it under the terms of the GNU General Public License as published by
+   the Free Software Foundation; either version 3 of the License, or
+   (at your option) any later version.
+
+   This program is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+   GNU General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/*
+  Decorator timing every call made to an openchangedb backend. Each
+  operation gets a call count, its error and not found counts and a
+  latency histogram. The calls slower than a threshold are also kept,
+  along with their arguments, in a small ring of samples. Statistics
+  are per process and are written out with the emsmdbp ones.
+ */
+
+#include "openchangedb_profiler.h"
+
+#include "../libmapiproxy.h"
+#include "libmapi/libmapi.h"
+#include "libmapi/libmapi_private.h"
+
+#include <stdarg.h>
+#include <inttypes.h>
+
+enum ocdb_profiler_op {
+	OCDB_PROFILER_get_SpecialFolderID,
+	OCDB_PROFILER_get_SystemFolderID,
+	OCDB_PROFILER_get_PublicFolderID,
+	OCDB_PROFILER_get_distinguishedName,
+	OCDB_PROFILER_get_MailboxGuid,
+	OCDB_PROFILER_get_MailboxReplica,
+	OCDB_PROFILER_get_PublicFolderReplica,
+	OCDB_PROFILER_get_mapistoreURI,
+	OCDB_PROFILER_set_mapistoreURI,
+	OCDB_PROFILER_get_parent_fid,
+	OCDB_PROFILER_get_fid,
+	OCDB_PROFILER_get_MAPIStoreURIs,
+	OCDB_PROFILER_get_ReceiveFolder,
+	OCDB_PROFILER_get_ReceiveFolderTable,
+	OCDB_PROFILER_get_TransportFolder,
+	OCDB_PROFILER_get_folder_count,
+	OCDB_PROFILER_lookup_folder_property,
+	OCDB_PROFILER_get_new_changeNumber,
+	OCDB_PROFILER_get_new_changeNumbers,
+	OCDB_PROFILER_get_next_changeNumber,
+	OCDB_PROFILER_get_folder_property,
+	OCDB_PROFILER_get_folder_properties,
+	OCDB_PROFILER_set_folder_properties,
+	OCDB_PROFILER_get_table_property,
+	OCDB_PROFILER_get_fid_by_name,
+	OCDB_PROFILER_get_mid_by_subject,
+	OCDB_PROFILER_delete_folder,
+	OCDB_PROFILER_set_ReceiveFolder,
+	OCDB_PROFILER_get_fid_from_partial_uri,
+	OCDB_PROFILER_get_users_from_partial_uri,
+	OCDB_PROFILER_create_mailbox,
+	OCDB_PROFILER_create_folder,
+	OCDB_PROFILER_get_message_count,
+	OCDB_PROFILER_get_system_idx,
+	OCDB_PROFILER_set_system_idx,
+	OCDB_PROFILER_transaction_start,
+	OCDB_PROFILER_transaction_commit,
+	OCDB_PROFILER_get_new_public_folderID,
+	OCDB_PROFILER_is_public_folder_id,
+	OCDB_PROFILER_get_indexing_url,
+	OCDB_PROFILER_set_locale,
+	OCDB_PROFILER_get_folders_names,
+	OCDB_PROFILER_table_init,
+	OCDB_PROFILER_table_set_sort_order,
+	OCDB_PROFILER_table_set_restrictions,
+	OCDB_PROFILER_table_get_property,
+	OCDB_PROFILER_message_create,
+	OCDB_PROFILER_message_save,
+	OCDB_PROFILER_message_open,
+	OCDB_PROFILER_message_get_property,
+	OCDB_PROFILER_message_set_properties,
+	OCDB_PROFILER_OPS
+};
+
+static const char *ocdb_profiler_names[OCDB_PROFILER_OPS] = {
+	"get_SpecialFolderID",
+	"get_SystemFolderID",
+	"get_PublicFolderID",
+	"get_distinguishedName",
+	"get_MailboxGuid",
+	"get_MailboxReplica",
+	"get_PublicFolderReplica",
+	"get_mapistoreURI",
+	"set_mapistoreURI",
+	"get_parent_fid",
+	"get_fid",
+	"get_MAPIStoreURIs",
+	"get_ReceiveFolder",
+	"get_ReceiveFolderTable",
+	"get_TransportFolder",
+	"get_folder_count",
+	"lookup_folder_property",
+	"get_new_changeNumber",
+	"get_new_changeNumbers",
+	"get_next_changeNumber",
+	"get_folder_property",
+	"get_folder_properties",
+	"set_folder_properties",
+	"get_table_property",
+	"get_fid_by_name",
+	"get_mid_by_subject",
+	"delete_folder",
+	"set_ReceiveFolder",
+	"get_fid_from_partial_uri",
+	"get_users_from_partial_uri",
+	"create_mailbox",
+	"create_folder",
+	"get_message_count",
+	"get_system_idx",
+	"set_system_idx",
+	"transaction_start",
+	"transaction_commit",
+	"get_new_public_folderID",
+	"is_public_folder_id",
+	"get_indexing_url",
+	"set_locale",
+	"get_folders_names",
+	"table_init",
+	"table_set_sort_order",
+	"table_set_restrictions",
+	"table_get_property",
+	"message_create",
+	"message_save",
+	"message_open",
+	"message_get_property",
+	"message_set_properties",
+};
+
+struct ocdb_profiler_data {
+	uint64_t			slow_usec;
+	struct openchangedb_context	*backend;
+};
+
+static struct openchangedb_profiler_stats	ocdb_profiler_stats[OCDB_PROFILER_OPS];
+static struct openchangedb_profiler_sample	ocdb_profiler_samples[OPENCHANGEDB_PROFILER_SAMPLES];
+static uint32_t					ocdb_profiler_next_sample = 0;
+
+static struct ocdb_profiler_data * _ocdb_profiler_data_get(struct openchangedb_context *self)
+{
+	return talloc_get_type(self->data, struct ocdb_profiler_data);
+}
+
+static uint64_t _ocdb_profiler_now(void)
+{
+	struct timespec	ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (uint64_t)ts.tv_sec * 1000000ULL + ts.tv_nsec / 1000;
+}
+
+static uint32_t _ocdb_profiler_bucket(uint64_t usec)
+{
+	uint32_t	idx;
+
+	for (idx = 0; usec && idx < OPENCHANGEDB_PROFILER_BUCKETS - 1; idx++) {
+		usec >>= 1;
+	}
+
+	return idx;
+}
+
+/**
+   \details Record the outcome of a backend call. The arguments are only
+   formatted when the call is slow.
+ */
+static void _ocdb_profiler_record(struct ocdb_profiler_data *priv_data, enum ocdb_profiler_op op,
+				  uint64_t start, enum MAPISTATUS retval, const char *fmt, ...) PRINTF_ATTRIBUTE(5,6);
+static void _ocdb_profiler_record(struct ocdb_profiler_data *priv_data, enum ocdb_profiler_op op,
+				  uint64_t start, enum MAPISTATUS retval, const char *fmt, ...)
+{
+	struct openchangedb_profiler_stats	*stats = &ocdb_profiler_stats[op];
+	struct openchangedb_profiler_sample	*sample;
+	uint64_t				usec;
+	va_list					ap;
+
+	usec = _ocdb_profiler_now() - start;
+
+	stats->count++;
+	if (retval == MAPI_E_NOT_FOUND) {
+		stats->not_found++;
+	} else if (retval != MAPI_E_SUCCESS) {
+		stats->errors++;
+	}
+	stats->latency_total += usec;
+	if (usec > stats->latency_max) {
+		stats->latency_max = usec;
+	}
+	stats->buckets[_ocdb_profiler_bucket(usec)]++;
+
+	if (!priv_data->slow_usec || usec < priv_data->slow_usec) return;
+
+	sample = &ocdb_profiler_samples[ocdb_profiler_next_sample];
+	ocdb_profiler_next_sample = (ocdb_profiler_next_sample + 1) % OPENCHANGEDB_PROFILER_SAMPLES;
+
+	sample->op = ocdb_profiler_names[op];
+	sample->usec = usec;
+	sample->retval = retval;
+	sample->when = time(NULL);
+	sample->args[0] = '\0';
+	if (fmt) {
+		va_start(ap, fmt);
+		vsnprintf(sample->args, sizeof (sample->args), fmt, ap);
+		va_end(ap);
+	}
+}
+
+/**
+   \details Retrieve the statistics of an openchangedb operation
+
+   \param op the name of the operation, as in struct openchangedb_context
+
+   \return pointer to the statistics, or NULL if the operation is
+   unknown or was not called since the last reset
+ */
+_PUBLIC_ const struct openchangedb_profiler_stats *openchangedb_profiler_get_stats(const char *op)
+{
+	uint32_t	i;
+
+	if (!op) return NULL;
+
+	for (i = 0; i < OCDB_PROFILER_OPS; i++) {
+		if (!strcmp(ocdb_profiler_names[i], op)) {
+			return ocdb_profiler_stats[i].count ? &ocdb_profiler_stats[i] : NULL;
+		}
+	}
+
+	return NULL;
+}
+
+/**
+   \details Retrieve a slow call sample
+
+   \param idx the index of the sample, 0 being the most recent one
+
+   \return pointer to the sample, or NULL if there is no such sample
+ */
+_PUBLIC_ const struct openchangedb_profiler_sample *openchangedb_profiler_get_sample(uint32_t idx)
+{
+	const struct openchangedb_profiler_sample	*sample;
+
+	if (idx >= OPENCHANGEDB_PROFILER_SAMPLES) return NULL;
+
+	sample = &ocdb_profiler_samples[(ocdb_profiler_next_sample + OPENCHANGEDB_PROFILER_SAMPLES - 1 - idx)
+					% OPENCHANGEDB_PROFILER_SAMPLES];
+
+	return sample->op ? sample : NULL;
+}
+
+/**
+   \details Estimate a latency percentile from an operation histogram
+
+   \param stats pointer to the operation statistics
+   \param percentile the percentile to compute, between 0 and 100
+
+   \return the upper bound in microseconds of the bucket holding the
+   percentile, which is at most twice the exact value
+ */
+_PUBLIC_ uint64_t openchangedb_profiler_percentile(const struct openchangedb_profiler_stats *stats, double percentile)
+{
+	uint64_t	target;
+	uint64_t	seen = 0;
+	uint64_t	bound;
+	uint32_t	i;
+
+	if (!stats || !stats->count) return 0;
+
+	target = (uint64_t)((percentile / 100.0) * stats->count + 0.5);
+	if (target < 1) target = 1;
+	if (target > stats->count) target = stats->count;
+
+	for (i = 0; i < OPENCHANGEDB_PROFILER_BUCKETS; i++) {
+		seen += stats->buckets[i];
+		if (seen >= target) {
+			break;
+		}
+	}
+	if (i >= OPENCHANGEDB_PROFILER_BUCKETS - 1) {
+		return stats->latency_max;
+	}
+
+	bound = (1ULL << i) - 1;
+	return (bound < stats->latency_max) ? bound : stats->latency_max;
+}
+
+/**
+   \details Forget the statistics and samples recorded so far
+ */
+_PUBLIC_ void openchangedb_profiler_reset(void)
+{
+	memset(ocdb_profiler_stats, 0, sizeof (ocdb_profiler_stats));
+	memset(ocdb_profiler_samples, 0, sizeof (ocdb_profiler_samples));
+	ocdb_profiler_next_sample = 0;
+}
+
+/**
+   \details Write the statistics of every called operation into a file,
+   one line per operation, followed by the slow call samples.
+
+   \param fp the file to write to
+ */
+_PUBLIC_ void openchangedb_profiler_dump_stats(FILE *fp)
+{
+	const struct openchangedb_profiler_stats	*stats;
+	const struct openchangedb_profiler_sample	*sample;
+	uint32_t					i;
+
+	if (!fp) return;
+
+	fprintf(fp, "# openchangedb op count errors not_found avg_us max_us p50_us p90_us p99_us\n");
+	for (i = 0; i < OCDB_PROFILER_OPS; i++) {
+		stats = &ocdb_profiler_stats[i];
+		if (!stats->count) continue;
+
+		fprintf(fp, "%s %"PRIu64" %"PRIu64" %"PRIu64" %"PRIu64" %"PRIu64" %"PRIu64" %"PRIu64" %"PRIu64"\n",
+			ocdb_profiler_names[i], stats->count, stats->errors, stats->not_found,
+			stats->latency_total / stats->count, stats->latency_max,
+			openchangedb_profiler_percentile(stats, 50.0),
+			openchangedb_profiler_percentile(stats, 90.0),
+			openchangedb_profiler_percentile(stats, 99.0));
+	}
+
+	for (i = 0; (sample = openchangedb_profiler_get_sample(i)); i++) {
+		fprintf(fp, "# slow %s %"PRIu64"us at %"PRIu64" %s: %s\n", sample->op, sample->usec,
+			(uint64_t) sample->when, mapi_get_errstr(sample->retval), sample->args);
+	}
+}
+
+// v openchangedb profiled calls ----------------------------------------------
+
+static enum MAPISTATUS get_SpecialFolderID(struct openchangedb_context *self,
+					  const char *recipient, uint32_t system_idx,
+					  uint64_t *folder_id)
+{
+	enum MAPISTATUS retval;
+	struct ocdb_profiler_data *priv_data = _ocdb_profiler_data_get(self);
+	uint64_t start = _ocdb_profiler_now();
+
+	retval = priv_data->backend->get_SpecialFolderID(priv_data->backend, recipient, system_idx, folder_id);
+	_ocdb_profiler_record(priv_data, OCDB_PROFILER_get_SpecialFolderID, start, retval,
+			      "recipient=[%s], system_idx=[0x%08"PRIx32"]", recipient, system_idx);
+
+	return retval;
+}
+
+static enum MAPISTATUS get_SystemFolderID(struct openchangedb_context *self,
+					  const char *recipient, uint32_t SystemIdx,
+					  uint64_t *FolderId)
+{
+	enum MAPISTATUS retval;
+	struct ocdb_profiler_data *priv_data = _ocdb_profiler_data_get(self);
+	uint64_t start = _ocdb_profiler_now();
+
+	retval = priv_data->backend->get_SystemFolderID(priv_data->backend, recipient, SystemIdx, FolderId);
+	_ocdb_profiler_record(priv_data, OCDB_PROFILER_get_SystemFolderID, start, retval,
+			      "recipient=[%s], SystemIdx=[0x%08"PRIx32"]", recipient, SystemIdx);
+
+	return retval;
+}
+
+static enum MAPISTATUS get_PublicFolderID(struct openchangedb_context *self,
+					  const char *username,
+					  uint32_t SystemIdx,
+					  uint64_t *FolderId)
+{
+	enum MAPISTATUS retval;
+	struct ocdb_profiler_data *priv_data = _ocdb_profiler_data_get(self);
+	uint64_t start = _ocdb_profiler_now();
+
+	retval = priv_data->backend->get_PublicFolderID(priv_data->backend, username, SystemIdx, FolderId);
+	_ocdb_profiler_record(priv_data, OCDB_PROFILER_get_PublicFolderID, start, retval,
+			      "username=[%s], SystemIdx=[0x%08"PRIx32"]", username, SystemIdx);
+
+	return retval;
+}
+
+static enum MAPISTATUS get_distinguishedName(TALLOC_CTX *parent_ctx,
+					     struct openchangedb_context *self,
+					     uint64_t fid,
+					     char **distinguishedName)
+{
+	enum MAPISTATUS retval;
+	struct ocdb_profiler_data *priv_data = _ocdb_profiler_data_get(self);
+	uint64_t start = _ocdb_profiler_now();
+
+	retval = priv_data->backend->get_distinguishedName(parent_ctx, priv_data->backend, fid, distinguishedName);
+	_ocdb_profiler_record(priv_data, OCDB_PROFILER_get_distinguishedName, start, retval,
+			      "fid=[0x%016"PRIx64"]", fid);
+
+	return retval;
+}
+
+static enum MAPISTATUS get_MailboxGuid(struct openchangedb_context *self,
+				       const char *recipient,
+				       struct GUID *MailboxGUID)
+{
+	enum MAPISTATUS retval;
+	struct ocdb_profiler_data *priv_data = _ocdb_profiler_data_get(self);
+	uint64_t start = _ocdb_profiler_now();
+
+	retval = priv_data->backend->get_MailboxGuid(priv_data->backend, recipient, MailboxGUID);
+	_ocdb_profiler_record(priv_data, OCDB_PROFILER_get_MailboxGuid, start, retval,
+			      "recipient=[%s]", recipient);
+
+	return retval;
+}
+
+static enum MAPISTATUS get_MailboxReplica(struct openchangedb_context *self,
+					  const char *recipient, uint16_t *ReplID,
+				  	  struct GUID *ReplGUID)
+{
+	enum MAPISTATUS retval;
+	struct ocdb_profiler_data *priv_data = _ocdb_profiler_data_get(self);
+	uint64_t start = _ocdb_profiler_now();
+
+	retval = priv_data->backend->get_MailboxReplica(priv_data->backend, recipient, ReplID, ReplGUID);
+	_ocdb_profiler_record(priv_data, OCDB_PROFILER_get_MailboxReplica, start, retval,
+			      "recipient=[%s]", recipient);
+
+	return retval;
+}
+
+static enum MAPISTATUS get_PublicFolderReplica(struct openchangedb_context *self,
+					       const char *username,
+					       uint16_t *ReplID,
+					       struct GUID *ReplGUID)
+{
+	enum MAPISTATUS retval;
+	struct ocdb_profiler_data *priv_data = _ocdb_profiler_data_get(self);
+	uint64_t start = _ocdb_profiler_now();
+
+	retval = priv_data->backend->get_PublicFolderReplica(priv_data->backend, username, ReplID, ReplGUID);
+	_ocdb_profiler_record(priv_data, OCDB_PROFILER_get_PublicFolderReplica, start, retval,
+			      "username=[%s]", username);
+
+	return retval;
+}
+
+static enum MAPISTATUS get_mapistoreURI(TALLOC_CTX *parent_ctx,
+				        struct openchangedb_context *self,
+				        const char *username,
+				        uint64_t fid, char **mapistoreURL,
+				        bool mailboxstore)
+{
+	enum MAPISTATUS retval;
+	struct ocdb_profiler_data *priv_data = _ocdb_profiler_data_get(self);
+	uint64_t start = _ocdb_profiler_now();
+
+	retval = priv_data->backend->get_mapistoreURI(parent_ctx, priv_data->backend, username, fid, mapistoreURL, mailboxstore);
+	_ocdb_profiler_record(priv_data, OCDB_PROFILER_get_mapistoreURI, start, retval,
+			      "username=[%s], fid=[0x%016"PRIx64"], mailboxstore=[%d]",
+			      username, fid, mailboxstore);
+
+	return retval;
+}
+
+static enum MAPISTATUS set_mapistoreURI(struct openchangedb_context *self,
+					const char *username, uint64_t fid,
+					const char *mapistoreURL)
+{
+	enum MAPISTATUS retval;
+	struct ocdb_profiler_data *priv_data = _ocdb_profiler_data_get(self);
+	uint64_t start = _ocdb_profiler_now();
+
+	retval = priv_data->backend->set_mapistoreURI(priv_data->backend, username, fid, mapistoreURL);
+	_ocdb_profiler_record(priv_data, OCDB_PROFILER_set_mapistoreURI, start, retval,
+			      "username=[%s], fid=[0x%016"PRIx64"], mapistoreURL=[%s]",
+			      username, fid, mapistoreURL);
+
+	return retval;
+}
+
+static enum MAPISTATUS get_parent_fid(struct openchangedb_context *self,
+				      const char *username, uint64_t fid,
+				      uint64_t *parent_fidp, bool mailboxstore)
+{
+	enum MAPISTATUS retval;
+	struct ocdb_profiler_data *priv_data = _ocdb_profiler_data_get(self);
+	uint64_t start = _ocdb_profiler_now();
+
+	retval = priv_data->backend->get_parent_fid(priv_data->backend, username, fid, parent_fidp, mailboxstore);
+	_ocdb_profiler_record(priv_data, OCDB_PROFILER_get_parent_fid, start, retval,
+			      "username=[%s], fid=[0x%016"PRIx64"], mailboxstore=[%d]",
+			      username, fid, mailboxstore);
+
+	return retval;
+}
+
+static enum MAPISTATUS get_fid(struct openchangedb_context *self,
+			       const char *mapistoreURL, uint64_t *fidp)
+{
+	enum MAPISTATUS retval;
+	struct ocdb_profiler_data *priv_data = _ocdb_profiler_data_get(self);
+	uint64_t start = _ocdb_profiler_now();
+
+	retval = priv_data->backend->get_fid(priv_data->backend, mapistoreURL, fidp);
+	_ocdb_profiler_record(priv_data, OCDB_PROFILER_get_fid, start, retval,
+			      "mapistoreURL=[%s]", mapistoreURL);
+
+	return retval;
+}
+
+static enum MAPISTATUS get_MAPIStoreURIs(struct openchangedb_context *self,
+					 const char *username,
+					 TALLOC_CTX *mem_ctx,
+					 struct StringArrayW_r **urisP)
+{
+	enum MAPISTATUS retval;
+	struct ocdb_profiler_data *priv_data = _ocdb_profiler_data_get(self);
+	uint64_t start = _ocdb_profiler_now();
+
+	retval = priv_data->backend->get_MAPIStoreURIs(priv_data->backend, username, mem_ctx, urisP);
+	_ocdb_profiler_record(priv_data, OCDB_PROFILER_get_MAPIStoreURIs, start, retval,
+			      "username=[%s]", username);
+
+	return retval;
+}
+
+static enum MAPISTATUS get_ReceiveFolder(TALLOC_CTX *parent_ctx,
+					 struct openchangedb_context *self,
+					 const char *recipient,
+					 const char *MessageClass,
+					 uint64_t *fid,
+					 const char **ExplicitMessageClass)
+{
+	enum MAPISTATUS retval;
+	struct ocdb_profiler_data *priv_data = _ocdb_profiler_data_get(self);
+	uint64_t start = _ocdb_profiler_now();
+
+	retval = priv_data->backend->get_ReceiveFolder(parent_ctx, priv_data->backend, recipient, MessageClass, fid, ExplicitMessageClass);
+	_ocdb_profiler_record(priv_data, OCDB_PROFILER_get_ReceiveFolder, start, retval,
+			      "recipient=[%s], MessageClass=[%s]", recipient, MessageClass);
+
+	return retval;
+}
+
+static enum MAPISTATUS get_ReceiveFolderTable(TALLOC_CTX *parent_ctx,
+					      struct openchangedb_context *self,
+					      const char *recipient,
+					      uint32_t *cValues,
+					      struct ReceiveFolder **entries)
+{
+	enum MAPISTATUS retval;
+	struct ocdb_profiler_data *priv_data = _ocdb_profiler_data_get(self);
+	uint64_t start = _ocdb_profiler_now();
+
+	retval = priv_data->backend->get_ReceiveFolderTable(parent_ctx, priv_data->backend,
+							    recipient, cValues, entries);
+	_ocdb_profiler_record(priv_data, OCDB_PROFILER_get_ReceiveFolderTable, start, retval,
+			      "recipient=[%s]", recipient);
+
+	return retval;
+}
+
+static enum MAPISTATUS get_TransportFolder(struct openchangedb_context *self,
+					   const char *recipient,
+					   uint64_t *FolderId)
+{
+	enum MAPISTATUS retval;
+	struct ocdb_profiler_data *priv_data = _ocdb_profiler_data_get(self);
+	uint64_t start = _ocdb_profiler_now();
+
+	retval = priv_data->backend->get_TransportFolder(priv_data->backend, recipient, FolderId);
+	_ocdb_profiler_record(priv_data, OCDB_PROFILER_get_TransportFolder, start, retval,
+			      "recipient=[%s]", recipient);
+
+	return retval;
+}
+
+static enum MAPISTATUS get_folder_count(struct openchangedb_context *self,
+					const char *username, uint64_t fid,
+					uint32_t *RowCount)
+{
+	enum MAPISTATUS retval;
+	struct ocdb_profiler_data *priv_data = _ocdb_profiler_data_get(self);
+	uint64_t start = _ocdb_profiler_now();
+
+	retval = priv_data->backend->get_folder_count(priv_data->backend, username, fid, RowCount);
+	_ocdb_profiler_record(priv_data, OCDB_PROFILER_get_folder_count, start, retval,
+			      "username=[%s], fid=[0x%016"PRIx64"]", username, fid);
+
+	return retval;
+}
+
+static enum MAPISTATUS lookup_folder_property(struct openchangedb_context *self,
+					      uint32_t proptag, uint64_t fid)
+{
+	enum MAPISTATUS retval;
+	struct ocdb_profiler_data *priv_data = _ocdb_profiler_data_get(self);
+	uint64_t start = _ocdb_profiler_now();
+
+	retval = priv_data->backend->lookup_folder_property(priv_data->backend, proptag, fid);
+	_ocdb_profiler_record(priv_data, OCDB_PROFILER_lookup_folder_property, start, retval,
+			      "proptag=[0x%08"PRIx32"], fid=[0x%016"PRIx64"]", proptag, fid);
+
+	return retval;
+}
+
+static enum MAPISTATUS get_new_changeNumber(struct openchangedb_context *self,
+					    const char *username, uint64_t *cn)
+{
+	enum MAPISTATUS retval;
+	struct ocdb_profiler_data *priv_data = _ocdb_profiler_data_get(self);
+	uint64_t start = _ocdb_profiler_now();
+
+	retval = priv_data->backend->get_new_changeNumber(priv_data->backend, username, cn);
+	_ocdb_profiler_record(priv_data, OCDB_PROFILER_get_new_changeNumber, start, retval,
+			      "username=[%s]", username);
+
+	return retval;
+}
+
+static enum MAPISTATUS get_new_changeNumbers(struct openchangedb_context *self,
+					     TALLOC_CTX *mem_ctx,
+					     const char *username,
+					     uint64_t max,
+					     struct UI8Array_r **cns_p)
+{
+	enum MAPISTATUS retval;
+	struct ocdb_profiler_data *priv_data = _ocdb_profiler_data_get(self);
+	uint64_t start = _ocdb_profiler_now();
+
+	retval = priv_data->backend->get_new_changeNumbers(priv_data->backend, mem_ctx, username, max, cns_p);
+	_ocdb_profiler_record(priv_data, OCDB_PROFILER_get_new_changeNumbers, start, retval,
+			      "username=[%s], max=[0x%016"PRIx64"]", username, max);
+
+	return retval;
+}
+
+static enum MAPISTATUS get_next_changeNumber(struct openchangedb_context *self,
+					     const char *username,
+					     uint64_t *cn)
+{
+	enum MAPISTATUS retval;
+	struct ocdb_profiler_data *priv_data = _ocdb_profiler_data_get(self);
+	uint64_t start = _ocdb_profiler_now();
+
+	retval = priv_data->backend->get_next_changeNumber(priv_data->backend, username, cn);
+	_ocdb_profiler_record(priv_data, OCDB_PROFILER_get_next_changeNumber, start, retval,
+			      "username=[%s]", username);
+
+	return retval;
+}
+
+static enum MAPISTATUS get_folder_property(TALLOC_CTX *parent_ctx,
+					   struct openchangedb_context *self,
+					   const char *username,
+					   uint32_t proptag, uint64_t fid,
+					   void **data)
+{
+	enum MAPISTATUS retval;
+	struct ocdb_profiler_data *priv_data = _ocdb_profiler_data_get(self);
+	uint64_t start = _ocdb_profiler_now();
+
+	retval = priv_data->backend->get_folder_property(parent_ctx, priv_data->backend, username, proptag, fid, data);
+	_ocdb_profiler_record(priv_data, OCDB_PROFILER_get_folder_property, start, retval,
+			      "username=[%s], proptag=[0x%08"PRIx32"], fid=[0x%016"PRIx64"]",
+			      username, proptag, fid);
+
+	return retval;
+}
+
+static enum MAPISTATUS get_folder_properties(TALLOC_CTX *parent_ctx,
+					     struct openchangedb_context *self,
+					     const char *username, uint64_t fid,
+					     struct SPropTagArray *properties,
+					     void **data, enum MAPISTATUS *retvals)
+{
+	enum MAPISTATUS retval;
+	struct ocdb_profiler_data *priv_data = _ocdb_profiler_data_get(self);
+	uint64_t start = _ocdb_profiler_now();
+
+	retval = openchangedb_get_folder_properties(parent_ctx, priv_data->backend, username, fid, properties, data, retvals);
+	_ocdb_profiler_record(priv_data, OCDB_PROFILER_get_folder_properties, start, retval,
+			      "username=[%s], fid=[0x%016"PRIx64"], properties=[%u]",
+			      username, fid, properties ? properties->cValues : 0);
+
+	return retval;
+}
+
+static enum MAPISTATUS set_folder_properties(struct openchangedb_context *self,
+					     const char *username, uint64_t fid,
+					     struct SRow *row)
+{
+	enum MAPISTATUS retval;
+	struct ocdb_profiler_data *priv_data = _ocdb_profiler_data_get(self);
+	uint64_t start = _ocdb_profiler_now();
+
+	retval = priv_data->backend->set_folder_properties(priv_data->backend, username, fid, row);
+	_ocdb_profiler_record(priv_data, OCDB_PROFILER_set_folder_properties, start, retval,
+			      "username=[%s], fid=[0x%016"PRIx64"]", username, fid);
+
+	return retval;
+}
+
+static enum MAPISTATUS get_table_property(TALLOC_CTX *parent_ctx,
+					  struct openchangedb_context *self,
+					  const char *ldb_filter,
+					  uint32_t proptag, uint32_t pos,
+					  void **data)
+{
+	enum MAPISTATUS retval;
+	struct ocdb_profiler_data *priv_data = _ocdb_profiler_data_get(self);
+	uint64_t start = _ocdb_profiler_now();
+
+	retval = priv_data->backend->get_table_property(parent_ctx, priv_data->backend, ldb_filter, proptag, pos, data);
+	_ocdb_profiler_record(priv_data, OCDB_PROFILER_get_table_property, start, retval,
+			      "ldb_filter=[%s], proptag=[0x%08"PRIx32"], pos=[0x%08"PRIx32"]",
+			      ldb_filter, proptag, pos);
+
+	return retval;
+}
+
+static enum MAPISTATUS get_fid_by_name(struct openchangedb_context *self,
+				       const char *username,
+				       uint64_t parent_fid,
+				       const char* foldername, uint64_t *fid)
+{
+	enum MAPISTATUS retval;
+	struct ocdb_profiler_data *priv_data = _ocdb_profiler_data_get(self);
+	uint64_t start = _ocdb_profiler_now();
+
+	retval = priv_data->backend->get_fid_by_name(priv_data->backend, username, parent_fid, foldername, fid);
+	_ocdb_profiler_record(priv_data, OCDB_PROFILER_get_fid_by_name, start, retval,
+			      "username=[%s], parent_fid=[0x%016"PRIx64"]", username, parent_fid);
+
+	return retval;
+}
+
+static enum MAPISTATUS get_mid_by_subject(struct openchangedb_context *self,
+					  const char *username,
+					  uint64_t parent_fid,
+					  const char *subject,
+					  bool mailboxstore, uint64_t *mid)
+{
+	enum MAPISTATUS retval;
+	struct ocdb_profiler_data *priv_data = _ocdb_profiler_data_get(self);
+	uint64_t start = _ocdb_profiler_now();
+
+	retval = priv_data->backend->get_mid_by_subject(priv_data->backend, username, parent_fid, subject, mailboxstore, mid);
+	_ocdb_profiler_record(priv_data, OCDB_PROFILER_get_mid_by_subject, start, retval,
+			      "username=[%s], parent_fid=[0x%016"PRIx64"], subject=[%s], mailboxstore=[%d]",
+			      username, parent_fid, subject, mailboxstore);
+
+	return retval;
+}
+
+static enum MAPISTATUS delete_folder(struct openchangedb_context *self,
+				     const char *username, uint64_t fid)
+{
+	enum MAPISTATUS retval;
+	struct ocdb_profiler_data *priv_data = _ocdb_profiler_data_get(self);
+	uint64_t start = _ocdb_profiler_now();
+
+	retval = priv_data->backend->delete_folder(priv_data->backend, username, fid);
+	_ocdb_profiler_record(priv_data, OCDB_PROFILER_delete_folder, start, retval,
+			      "username=[%s], fid=[0x%016"PRIx64"]", username, fid);
+
+	return retval;
+}
+
+static enum MAPISTATUS set_ReceiveFolder(struct openchangedb_context *self,
+					 const char *recipient,
+					 const char *MessageClass, uint64_t fid)
+{
+	enum MAPISTATUS retval;
+	struct ocdb_profiler_data *priv_data = _ocdb_profiler_data_get(self);
+	uint64_t start = _ocdb_profiler_now();
+
+	retval = priv_data->backend->set_ReceiveFolder(priv_data->backend, recipient, MessageClass, fid);
+	_ocdb_profiler_record(priv_data, OCDB_PROFILER_set_ReceiveFolder, start, retval,
+			      "recipient=[%s], MessageClass=[%s], fid=[0x%016"PRIx64"]",
+			      recipient, MessageClass, fid);
+
+	return retval;
+}
+
+static enum MAPISTATUS get_fid_from_partial_uri(struct openchangedb_context *self,
+						const char *partialURI, uint64_t *fid)
+{
+	enum MAPISTATUS retval;
+	struct ocdb_profiler_data *priv_data = _ocdb_profiler_data_get(self);
+	uint64_t start = _ocdb_profiler_now();
+
+	retval = priv_data->backend->get_fid_from_partial_uri(priv_data->backend, partialURI, fid);
+	_ocdb_profiler_record(priv_data, OCDB_PROFILER_get_fid_from_partial_uri, start, retval,
+			      "partialURI=[%s]", partialURI);
+
+	return retval;
+}
+
+static enum MAPISTATUS get_users_from_partial_uri(TALLOC_CTX *parent_ctx,
+						  struct openchangedb_context *self,
+						  const char *partialURI,
+						  uint32_t *count,
+						  char ***MAPIStoreURI,
+						  char ***users)
+{
+	enum MAPISTATUS retval;
+	struct ocdb_profiler_data *priv_data = _ocdb_profiler_data_get(self);
+	uint64_t start = _ocdb_profiler_now();
+
+	retval = priv_data->backend->get_users_from_partial_uri(parent_ctx, priv_data->backend, partialURI, count, MAPIStoreURI, users);
+	_ocdb_profiler_record(priv_data, OCDB_PROFILER_get_users_from_partial_uri, start, retval,
+			      "partialURI=[%s]", partialURI);
+
+	return retval;
+}
+
+static enum MAPISTATUS create_mailbox(struct openchangedb_context *self,
+				      const char *username,
+				      const char *organization_name,
+				      const char *groupo_name,
+				      int systemIdx, uint64_t fid,
+				      const char *display_name)
+{
+	enum MAPISTATUS retval;
+	struct ocdb_profiler_data *priv_data = _ocdb_profiler_data_get(self);
+	uint64_t start = _ocdb_profiler_now();
+
+	retval = priv_data->backend->create_mailbox(priv_data->backend, username,
+						    organization_name, groupo_name,
+						    systemIdx, fid, display_name);
+	_ocdb_profiler_record(priv_data, OCDB_PROFILER_create_mailbox, start, retval,
+			      "username=[%s], organization_name=[%s], groupo_name=[%s], systemIdx=[%d], fid=[0x%016"PRIx64"], display_name=[%s]",
+			      username, organization_name, groupo_name, systemIdx, fid, display_name);
+
+	return retval;
+}
+
+static enum MAPISTATUS create_folder(struct openchangedb_context *self,
+				     const char *username,
+				     uint64_t parentFolderID, uint64_t fid,
+				     uint64_t changeNumber,
+				     const char *MAPIStoreURI, int systemIdx)
+{
+	enum MAPISTATUS retval;
+	struct ocdb_profiler_data *priv_data = _ocdb_profiler_data_get(self);
+	uint64_t start = _ocdb_profiler_now();
+
+	retval = priv_data->backend->create_folder(priv_data->backend, username, parentFolderID, fid, changeNumber, MAPIStoreURI, systemIdx);
+	_ocdb_profiler_record(priv_data, OCDB_PROFILER_create_folder, start, retval,
+			      "username=[%s], parentFolderID=[0x%016"PRIx64"], fid=[0x%016"PRIx64"], changeNumber=[0x%016"PRIx64"], MAPIStoreURI=[%s], systemIdx=[%d]",
+			      username, parentFolderID, fid, changeNumber, MAPIStoreURI, systemIdx);
+
+	return retval;
+}
+
+static enum MAPISTATUS get_message_count(struct openchangedb_context *self,
+					 const char *username, uint64_t fid,
+					 uint32_t *RowCount, bool fai)
+{
+	enum MAPISTATUS retval;
+	struct ocdb_profiler_data *priv_data = _ocdb_profiler_data_get(self);
+	uint64_t start = _ocdb_profiler_now();
+
+	retval = priv_data->backend->get_message_count(priv_data->backend, username, fid, RowCount, fai);
+	_ocdb_profiler_record(priv_data, OCDB_PROFILER_get_message_count, start, retval,
+			      "username=[%s], fid=[0x%016"PRIx64"], fai=[%d]", username, fid, fai);
+
+	return retval;
+}
+
+static enum MAPISTATUS get_system_idx(struct openchangedb_context *self,
+				      const char *username, uint64_t fid,
+				      int *system_idx_p)
+{
+	enum MAPISTATUS retval;
+	struct ocdb_profiler_data *priv_data = _ocdb_profiler_data_get(self);
+	uint64_t start = _ocdb_profiler_now();
+
+	retval = priv_data->backend->get_system_idx(priv_data->backend, username, fid, system_idx_p);
+	_ocdb_profiler_record(priv_data, OCDB_PROFILER_get_system_idx, start, retval,
+			      "username=[%s], fid=[0x%016"PRIx64"]", username, fid);
+
+	return retval;
+}
+
+static enum MAPISTATUS set_system_idx(struct openchangedb_context *self,
+				      const char *username, uint64_t fid,
+				      int system_idx)
+{
+	enum MAPISTATUS retval;
+	struct ocdb_profiler_data *priv_data = _ocdb_profiler_data_get(self);
+	uint64_t start = _ocdb_profiler_now();
+
+	retval = priv_data->backend->set_system_idx(priv_data->backend, username, fid, system_idx);
+	_ocdb_profiler_record(priv_data, OCDB_PROFILER_set_system_idx, start, retval,
+			      "username=[%s], fid=[0x%016"PRIx64"], system_idx=[%d]",
+			      username, fid, system_idx);
+
+	return retval;
+}
+
+static enum MAPISTATUS transaction_start(struct openchangedb_context *self)
+{
+	enum MAPISTATUS retval;
+	struct ocdb_profiler_data *priv_data = _ocdb_profiler_data_get(self);
+	uint64_t start = _ocdb_profiler_now();
+
+	retval = priv_data->backend->transaction_start(priv_data->backend);
+	_ocdb_profiler_record(priv_data, OCDB_PROFILER_transaction_start, start, retval, NULL);
+
+	return retval;
+}
+
+static enum MAPISTATUS transaction_commit(struct openchangedb_context *self)
+{
+	enum MAPISTATUS retval;
+	struct ocdb_profiler_data *priv_data = _ocdb_profiler_data_get(self);
+	uint64_t start = _ocdb_profiler_now();
+
+	retval = priv_data->backend->transaction_commit(priv_data->backend);
+	_ocdb_profiler_record(priv_data, OCDB_PROFILER_transaction_commit, start, retval, NULL);
+
+	return retval;
+}
+
+static enum MAPISTATUS get_new_public_folderID(struct openchangedb_context *self,
+					       const char *username,
+					       uint64_t *fid)
+{
+	enum MAPISTATUS retval;
+	struct ocdb_profiler_data *priv_data = _ocdb_profiler_data_get(self);
+	uint64_t start = _ocdb_profiler_now();
+
+	retval = priv_data->backend->get_new_public_folderID(priv_data->backend, username, fid);
+	_ocdb_profiler_record(priv_data, OCDB_PROFILER_get_new_public_folderID, start, retval,
+			      "username=[%s]", username);
+
+	return retval;
+}
+
+static bool is_public_folder_id(struct openchangedb_context *self, uint64_t fid)
+{
+	bool ret;
+	struct ocdb_profiler_data *priv_data = _ocdb_profiler_data_get(self);
+	uint64_t start = _ocdb_profiler_now();
+
+	ret = priv_data->backend->is_public_folder_id(priv_data->backend, fid);
+	_ocdb_profiler_record(priv_data, OCDB_PROFILER_is_public_folder_id, start, MAPI_E_SUCCESS,
+			      "fid=[0x%016"PRIx64"]", fid);
+
+	return ret;
+}
+
+static enum MAPISTATUS get_indexing_url(struct openchangedb_context *self,
+					const char *username,
+					const char **indexing_url)
+{
+	enum MAPISTATUS retval;
+	struct ocdb_profiler_data *priv_data = _ocdb_profiler_data_get(self);
+	uint64_t start = _ocdb_profiler_now();
+
+	retval = priv_data->backend->get_indexing_url(priv_data->backend, username, indexing_url);
+	_ocdb_profiler_record(priv_data, OCDB_PROFILER_get_indexing_url, start, retval,
+			      "username=[%s]", username);
+
+	return retval;
+}
+
+static bool set_locale(struct openchangedb_context *self, const char *username, uint32_t lcid)
+{
+	bool ret;
+	struct ocdb_profiler_data *priv_data = _ocdb_profiler_data_get(self);
+	uint64_t start = _ocdb_profiler_now();
+
+	ret = priv_data->backend->set_locale(priv_data->backend, username, lcid);
+	_ocdb_profiler_record(priv_data, OCDB_PROFILER_set_locale, start, ret ? MAPI_E_SUCCESS : MAPI_E_CALL_FAILED,
+			      "username=[%s], lcid=[0x%08"PRIx32"]", username, lcid);
+
+	return ret;
+}
+
+static const char **get_folders_names(TALLOC_CTX *mem_ctx, struct openchangedb_context *self, const char *locale, const char *type)
+{
+	const char **names;
+	struct ocdb_profiler_data *priv_data = _ocdb_profiler_data_get(self);
+	uint64_t start = _ocdb_profiler_now();
+
+	names = priv_data->backend->get_folders_names(mem_ctx, priv_data->backend, locale, type);
+	_ocdb_profiler_record(priv_data, OCDB_PROFILER_get_folders_names, start, names ? MAPI_E_SUCCESS : MAPI_E_NOT_FOUND,
+			      "locale=[%s], type=[%s]", locale, type);
+
+	return names;
+}
+
+static void release(struct openchangedb_context *self)
+{
+	struct ocdb_profiler_data *priv_data = _ocdb_profiler_data_get(self);
+
+	if (priv_data->backend->release) {
+		priv_data->backend->release(priv_data->backend);
+	}
+}
+
+static enum MAPISTATUS table_init(TALLOC_CTX *mem_ctx,
+				  struct openchangedb_context *self,
+				  const char *username,
+				  uint8_t table_type, uint64_t folderID,
+				  void **table_object)
+{
+	enum MAPISTATUS retval;
+	struct ocdb_profiler_data *priv_data = _ocdb_profiler_data_get(self);
+	uint64_t start = _ocdb_profiler_now();
+
+	retval = priv_data->backend->table_init(mem_ctx, priv_data->backend, username, table_type, folderID, table_object);
+	_ocdb_profiler_record(priv_data, OCDB_PROFILER_table_init, start, retval,
+			      "username=[%s], table_type=[%d], folderID=[0x%016"PRIx64"]",
+			      username, table_type, folderID);
+
+	return retval;
+}
+
+static enum MAPISTATUS table_set_sort_order(struct openchangedb_context *self,
+					    void *table_object,
+					    struct SSortOrderSet *lpSortCriteria)
+{
+	enum MAPISTATUS retval;
+	struct ocdb_profiler_data *priv_data = _ocdb_profiler_data_get(self);
+	uint64_t start = _ocdb_profiler_now();
+
+	retval = priv_data->backend->table_set_sort_order(priv_data->backend, table_object, lpSortCriteria);
+	_ocdb_profiler_record(priv_data, OCDB_PROFILER_table_set_sort_order, start, retval, NULL);
+
+	return retval;
+}
+
+static enum MAPISTATUS table_set_restrictions(struct openchangedb_context *self,
+					      void *table_object,
+					      struct mapi_SRestriction *res)
+{
+	enum MAPISTATUS retval;
+	struct ocdb_profiler_data *priv_data = _ocdb_profiler_data_get(self);
+	uint64_t start = _ocdb_profiler_now();
+
+	retval = priv_data->backend->table_set_restrictions(priv_data->backend, table_object, res);
+	_ocdb_profiler_record(priv_data, OCDB_PROFILER_table_set_restrictions, start, retval, NULL);
+
+	return retval;
+}
+
+static enum MAPISTATUS table_get_property(TALLOC_CTX *mem_ctx,
+					  struct openchangedb_context *self,
+					  void *table_object,
+					  enum MAPITAGS proptag, uint32_t pos,
+					  bool live_filtered, void **data)
+{
+	enum MAPISTATUS retval;
+	struct ocdb_profiler_data *priv_data = _ocdb_profiler_data_get(self);
+	uint64_t start = _ocdb_profiler_now();
+
+	retval = priv_data->backend->table_get_property(mem_ctx, priv_data->backend, table_object, proptag, pos, live_filtered, data);
+	_ocdb_profiler_record(priv_data, OCDB_PROFILER_table_get_property, start, retval,
+			      "proptag=[0x%08"PRIx32"], pos=[0x%08"PRIx32"], live_filtered=[%d]",
+			      proptag, pos, live_filtered);
+
+	return retval;
+}
+
+static enum MAPISTATUS message_create(TALLOC_CTX *mem_ctx,
+				      struct openchangedb_context *self,
+				      const char *username,
+				      uint64_t messageID, uint64_t folderID,
+				      bool fai, void **message_object)
+{
+	enum MAPISTATUS retval;
+	struct ocdb_profiler_data *priv_data = _ocdb_profiler_data_get(self);
+	uint64_t start = _ocdb_profiler_now();
+
+	retval = priv_data->backend->message_create(mem_ctx, priv_data->backend, username, messageID, folderID, fai, message_object);
+	_ocdb_profiler_record(priv_data, OCDB_PROFILER_message_create, start, retval,
+			      "username=[%s], messageID=[0x%016"PRIx64"], folderID=[0x%016"PRIx64"], fai=[%d]",
+			      username, messageID, folderID, fai);
+
+	return retval;
+}
+
+static enum MAPISTATUS message_save(struct openchangedb_context *self,
+				    void *_msg, uint8_t SaveFlags)
+{
+	enum MAPISTATUS retval;
+	struct ocdb_profiler_data *priv_data = _ocdb_profiler_data_get(self);
+	uint64_t start = _ocdb_profiler_now();
+
+	retval = priv_data->backend->message_save(priv_data->backend, _msg, SaveFlags);
+	_ocdb_profiler_record(priv_data, OCDB_PROFILER_message_save, start, retval,
+			      "SaveFlags=[%d]", SaveFlags);
+
+	return retval;
+}
+
+static enum MAPISTATUS message_open(TALLOC_CTX *mem_ctx,
+				    struct openchangedb_context *self,
+				    const char *username,
+				    uint64_t messageID, uint64_t folderID,
+				    void **message_object, void **msgp)
+{
+	enum MAPISTATUS retval;
+	struct ocdb_profiler_data *priv_data = _ocdb_profiler_data_get(self);
+	uint64_t start = _ocdb_profiler_now();
+
+	retval = priv_data->backend->message_open(mem_ctx, priv_data->backend, username, messageID, folderID, message_object, msgp);
+	_ocdb_profiler_record(priv_data, OCDB_PROFILER_message_open, start, retval,
+			      "username=[%s], messageID=[0x%016"PRIx64"], folderID=[0x%016"PRIx64"]",
+			      username, messageID, folderID);
+
+	return retval;
+}
+
+static enum MAPISTATUS message_get_property(TALLOC_CTX *mem_ctx,
+					    struct openchangedb_context *self,
+					    void *message_object,
+					    uint32_t proptag, void **data)
+{
+	enum MAPISTATUS retval;
+	struct ocdb_profiler_data *priv_data = _ocdb_profiler_data_get(self);
+	uint64_t start = _ocdb_profiler_now();
+
+	retval = priv_data->backend->message_get_property(mem_ctx, priv_data->backend, message_object, proptag, data);
+	_ocdb_profiler_record(priv_data, OCDB_PROFILER_message_get_property, start, retval,
+			      "proptag=[0x%08"PRIx32"]", proptag);
+
+	return retval;
+}
+
+static enum MAPISTATUS message_set_properties(TALLOC_CTX *mem_ctx,
+					      struct openchangedb_context *self,
+					      void *message_object,
+					      struct SRow *row)
+{
+	enum MAPISTATUS retval;
+	struct ocdb_profiler_data *priv_data = _ocdb_profiler_data_get(self);
+	uint64_t start = _ocdb_profiler_now();
+
+	retval = priv_data->backend->message_set_properties(mem_ctx, priv_data->backend, message_object, row);
+	_ocdb_profiler_record(priv_data, OCDB_PROFILER_message_set_properties, start, retval, NULL);
+
+	return retval;
+}
+
+// ^ openchangedb profiled calls ----------------------------------------------
+
+/**
+   \details Time every call made to an openchangedb backend
+
+   \param mem_ctx pointer to the memory context
+   \param slow_usec calls lasting at least that many microseconds are
+   kept as slow call samples, 0 keeps none
+   \param backend pointer to the openchangedb context to decorate
+   \param ctx pointer to the returned openchangedb context
+
+   \return MAPI_E_SUCCESS on success, otherwise MAPI error
+ */
+_PUBLIC_ enum MAPISTATUS openchangedb_profiler_initialize(TALLOC_CTX *mem_ctx,
+							  uint64_t slow_usec,
+							  struct openchangedb_context *backend,
+							  struct openchangedb_context **ctx)
+{
+	struct openchangedb_context	*oc_ctx;
+	struct ocdb_profiler_data	*data;
+
+	OPENCHANGE_RETVAL_IF(!backend || !ctx, MAPI_E_INVALID_PARAMETER, NULL);
+
+	oc_ctx = talloc_zero(mem_ctx, struct openchangedb_context);
+	OPENCHANGE_RETVAL_IF(oc_ctx == NULL, MAPI_E_NOT_ENOUGH_RESOURCES, NULL);
+	data = talloc_zero(oc_ctx, struct ocdb_profiler_data);
+	OPENCHANGE_RETVAL_IF(data == NULL, MAPI_E_NOT_ENOUGH_RESOURCES, oc_ctx);
+
+	data->slow_usec = slow_usec;
+	data->backend = backend;
+	mapiproxy_stats_register("openchangedb_profiler", openchangedb_profiler_dump_stats, openchangedb_profiler_reset);
+
+	oc_ctx->data = data;
+
+	// Initialize struct with function pointers
+	oc_ctx->backend_type = talloc_strdup(oc_ctx, "profiler_module");
+	OPENCHANGE_RETVAL_IF(oc_ctx->backend_type == NULL, MAPI_E_NOT_ENOUGH_RESOURCES, oc_ctx);
+
+	oc_ctx->get_new_changeNumber = get_new_changeNumber;
+	oc_ctx->get_new_changeNumbers = get_new_changeNumbers;
+	oc_ctx->get_next_changeNumber = get_next_changeNumber;
+	oc_ctx->get_SystemFolderID = get_SystemFolderID;
+	oc_ctx->get_SpecialFolderID = get_SpecialFolderID;
+	oc_ctx->get_PublicFolderID = get_PublicFolderID;
+	oc_ctx->get_distinguishedName = get_distinguishedName;
+	oc_ctx->get_MailboxGuid = get_MailboxGuid;
+	oc_ctx->get_MailboxReplica = get_MailboxReplica;
+	oc_ctx->get_PublicFolderReplica = get_PublicFolderReplica;
+	oc_ctx->get_parent_fid = get_parent_fid;
+	oc_ctx->get_MAPIStoreURIs = get_MAPIStoreURIs;
+	oc_ctx->get_mapistoreURI = get_mapistoreURI;
+	oc_ctx->set_mapistoreURI = set_mapistoreURI;
+	oc_ctx->get_fid = get_fid;
+	oc_ctx->get_ReceiveFolder = get_ReceiveFolder;
+	oc_ctx->get_ReceiveFolderTable = get_ReceiveFolderTable;
+	oc_ctx->get_TransportFolder = get_TransportFolder;
+	oc_ctx->lookup_folder_property = lookup_folder_property;
+	oc_ctx->set_folder_properties = set_folder_properties;
+	oc_ctx->get_folder_property = get_folder_property;
+	oc_ctx->get_folder_properties = get_folder_properties;
+	oc_ctx->get_folder_count = get_folder_count;
+	oc_ctx->get_message_count = get_message_count;
+	oc_ctx->get_system_idx = get_system_idx;
+	oc_ctx->set_system_idx = set_system_idx;
+	oc_ctx->get_table_property = get_table_property;
+	oc_ctx->get_fid_by_name = get_fid_by_name;
+	oc_ctx->get_mid_by_subject = get_mid_by_subject;
+	oc_ctx->set_ReceiveFolder = set_ReceiveFolder;
+	oc_ctx->create_mailbox = create_mailbox;
+	oc_ctx->create_folder = create_folder;
+	oc_ctx->delete_folder = delete_folder;
+	oc_ctx->get_fid_from_partial_uri = get_fid_from_partial_uri;
+	oc_ctx->get_users_from_partial_uri = get_users_from_partial_uri;
+
+	oc_ctx->table_init = table_init;
+	oc_ctx->table_set_sort_order = table_set_sort_order;
+	oc_ctx->table_set_restrictions = table_set_restrictions;
+	oc_ctx->table_get_property = table_get_property;
+
+	oc_ctx->message_create = message_create;
+	oc_ctx->message_save = message_save;
+	oc_ctx->message_open = message_open;
+	oc_ctx->message_get_property = message_get_property;
+	oc_ctx->message_set_properties = message_set_properties;
+
+	oc_ctx->transaction_start = transaction_start;
+	oc_ctx->transaction_commit = transaction_commit;
+
+	oc_ctx->get_new_public_folderID = get_new_public_folderID;
+	oc_ctx->is_public_folder_id = is_public_folder_id;
+
+	oc_ctx->get_indexing_url = get_indexing_url;
+	oc_ctx->set_locale = set_locale;
+	oc_ctx->get_folders_names = get_folders_names;
+	oc_ctx->release = release;
+
+	*ctx = oc_ctx;
+
+	return MAPI_E_SUCCESS;
+}
@@ -0,0 +1,62 @@
+/*
+   MAPI Proxy - OpenchangeDB profiler
+
+   OpenChange Project
+
+   This program is free software; you can redistribute it and/or modify
+   it under the terms of the GNU General Public License as published by
+   the Free Software Foundation; either version 3 of the License, or
+   (at your option) any later version.
+
+   This program is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+   GNU General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef __OPENCHANGEDB_PROFILER_H__
+#define __OPENCHANGEDB_PROFILER_H__
+
+#include "openchangedb_backends.h"
+
+#include <stdio.h>
+#include <time.h>
+
+/* Latency histogram: bucket i > 0 holds [2^(i-1), 2^i) microseconds */
+#define	OPENCHANGEDB_PROFILER_BUCKETS		32
+/* Number of slow calls kept, most recent first */
+#define	OPENCHANGEDB_PROFILER_SAMPLES		16
+#define	OPENCHANGEDB_PROFILER_SAMPLE_ARGS	256
+#define	OPENCHANGEDB_PROFILER_DEFAULT_SLOW	100000
+
+struct openchangedb_profiler_stats {
+	uint64_t	count;
+	uint64_t	errors;
+	uint64_t	not_found;
+	uint64_t	latency_total;
+	uint64_t	latency_max;
+	uint64_t	buckets[OPENCHANGEDB_PROFILER_BUCKETS];
+};
+
+struct openchangedb_profiler_sample {
+	const char	*op;
+	uint64_t	usec;
+	enum MAPISTATUS	retval;
+	time_t		when;
+	char		args[OPENCHANGEDB_PROFILER_SAMPLE_ARGS];
+};
+
+enum MAPISTATUS openchangedb_profiler_initialize(TALLOC_CTX *mem_ctx,
+						 uint64_t slow_usec,
+						 struct openchangedb_context *backend,
+						 struct openchangedb_context **ctx);
+const struct openchangedb_profiler_stats *openchangedb_profiler_get_stats(const char *);
+const struct openchangedb_profiler_sample *openchangedb_profiler_get_sample(uint32_t);
+uint64_t openchangedb_profiler_percentile(const struct openchangedb_profiler_stats *, double);
+void openchangedb_profiler_reset(void);
+void openchangedb_profiler_dump_stats(FILE *);
+
+#endif /* __OPENCHANGEDB_PROFILER_H__ */
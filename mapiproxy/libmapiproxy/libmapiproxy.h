@@ -120,19 +120,53 @@ struct mapi_handles {
 	void		       	*private_data;
 	struct mapi_handles	*prev;
 	struct mapi_handles	*next;
+	struct mapi_handles	*parent;
+	struct mapi_handles	*children;
+	struct mapi_handles	*sibling_prev;
+	struct mapi_handles	*sibling_next;
+};
+
+
+struct mapi_handles_stats {
+	uint64_t		release_calls;
+	uint64_t		released_handles;
+	uint32_t		last_fanout;
+	uint32_t		max_fanout;
+};
+
+
+struct mapi_handles_slot {
+	struct mapi_handles	*rec;
+	uint32_t		generation;
+	uint32_t		next_free;
 };
 
 
 struct mapi_handles_context {
-	TDB_CONTEXT	       	*tdb_ctx;
-	uint32_t		last_handle;
-	struct mapi_handles    	*handles;
+	struct mapi_handles_slot	*slots;
+	uint32_t			slots_count;
+	uint32_t			slots_used;
+	uint32_t			free_slot;
+	uint32_t			handles_count;
+	struct mapi_handles    		*handles;
+	struct mapi_handles_stats	stats;
 };
 
 
-#define	MAPI_HANDLES_RESERVED	0xFFFFFFFF
-#define	MAPI_HANDLES_ROOT	"root"
-#define	MAPI_HANDLES_NULL	"null"
+#define	MAPI_HANDLES_RESERVED		0xFFFFFFFF
+
+/**
+   A MAPI handle is made of a slot index (plus one, so handles are
+   never 0) in the low bits and a generation counter in the high
+   bits. The generation is bumped every time a slot is released so
+   stale handles held by clients are detected.
+ */
+#define	MAPI_HANDLES_INDEX_BITS		20
+#define	MAPI_HANDLES_INDEX_MASK		((1 << MAPI_HANDLES_INDEX_BITS) - 1)
+#define	MAPI_HANDLES_GENERATION_MASK	(0xFFFFFFFF >> MAPI_HANDLES_INDEX_BITS)
+#define	MAPI_HANDLES_MAX_SLOTS		(MAPI_HANDLES_INDEX_MASK - 1)
+#define	MAPI_HANDLES_SLOT_NONE		0xFFFFFFFF
+#define	MAPI_HANDLES_INITIAL_SLOTS	64
 
 
 /**
@@ -221,6 +255,7 @@ enum MAPISTATUS openchangedb_lookup_folder_property(struct openchangedb_context
 enum MAPISTATUS openchangedb_set_folder_properties(struct openchangedb_context *, const char *, uint64_t, struct SRow *);
 char *          openchangedb_set_folder_property_data(TALLOC_CTX *, struct SPropValue *);
 enum MAPISTATUS openchangedb_get_folder_property(TALLOC_CTX *, struct openchangedb_context *, const char *, uint32_t, uint64_t, void **);
+enum MAPISTATUS openchangedb_get_folder_properties(TALLOC_CTX *, struct openchangedb_context *, const char *, uint64_t, struct SPropTagArray *, void **, enum MAPISTATUS *);
 enum MAPISTATUS openchangedb_get_folder_count(struct openchangedb_context *, const char *, uint64_t, uint32_t *);
 enum MAPISTATUS openchangedb_get_message_count(struct openchangedb_context *, const char *, uint64_t, uint32_t *, bool);
 enum MAPISTATUS openchangedb_get_system_idx(struct openchangedb_context *, const char *, uint64_t, int *);
@@ -266,6 +301,7 @@ enum MAPISTATUS	mapi_handles_release(struct mapi_handles_context *);
 enum MAPISTATUS mapi_handles_search(struct mapi_handles_context *, uint32_t, struct mapi_handles **);
 enum MAPISTATUS mapi_handles_add(struct mapi_handles_context *, uint32_t, struct mapi_handles **);
 enum MAPISTATUS mapi_handles_delete(struct mapi_handles_context *, uint32_t);
+enum MAPISTATUS mapi_handles_get_stats(struct mapi_handles_context *, struct mapi_handles_stats *);
 enum MAPISTATUS mapi_handles_get_private_data(struct mapi_handles *, void **);
 enum MAPISTATUS mapi_handles_set_private_data(struct mapi_handles *, void *);
 enum MAPISTATUS mapi_handles_get_systemfolder(struct mapi_handles *, int *);
@@ -279,6 +315,13 @@ enum MAPISTATUS entryid_set_folder_EntryID(TALLOC_CTX *, struct GUID *, struct G
 typedef NTSTATUS (*openchange_plugin_init_fn) (void);
 openchange_plugin_init_fn *load_openchange_plugins(TALLOC_CTX *mem_ctx, const char *path);
 
+/* definitions from stats.c */
+typedef void (*mapiproxy_stats_dump_fn) (FILE *);
+typedef void (*mapiproxy_stats_reset_fn) (void);
+bool mapiproxy_stats_register(const char *, mapiproxy_stats_dump_fn, mapiproxy_stats_reset_fn);
+void mapiproxy_stats_dump(FILE *);
+void mapiproxy_stats_reset(void);
+
 __END_DECLS
 
 #endif /* ! __LIBMAPIPROXY_H__ */
@@ -45,15 +45,20 @@ _PUBLIC_ struct mapi_handles_context *mapi_handles_init(TALLOC_CTX *mem_ctx)
 	handles_ctx = talloc_zero(mem_ctx, struct mapi_handles_context);
 	if (!handles_ctx) return NULL;
 
-	/* Step 2. Initialize the TDB context */
-	handles_ctx->tdb_ctx = tdb_open(NULL, 0, TDB_INTERNAL, O_RDWR|O_CREAT, 0600);
+	/* Step 2. Initialize the slot table */
+	handles_ctx->slots = talloc_zero_array(handles_ctx, struct mapi_handles_slot, MAPI_HANDLES_INITIAL_SLOTS);
+	if (!handles_ctx->slots) {
+		talloc_free(handles_ctx);
+		return NULL;
+	}
+	handles_ctx->slots_count = MAPI_HANDLES_INITIAL_SLOTS;
+	handles_ctx->slots_used = 0;
+	handles_ctx->free_slot = MAPI_HANDLES_SLOT_NONE;
+	handles_ctx->handles_count = 0;
 
 	/* Step 3. Initialize the handles list */
 	handles_ctx->handles = NULL;
 
-	/* Step 4. Set last_handle to the first valid value */
-	handles_ctx->last_handle = 1;
-
 	return handles_ctx;
 }
 
@@ -70,7 +75,6 @@ _PUBLIC_ enum MAPISTATUS mapi_handles_release(struct mapi_handles_context *handl
 	/* Sanity checks */
 	OPENCHANGE_RETVAL_IF(!handles_ctx, MAPI_E_NOT_INITIALIZED, NULL);
 
-	tdb_close(handles_ctx->tdb_ctx);
 	talloc_free(handles_ctx);
 
 	return MAPI_E_SUCCESS;
@@ -78,7 +82,36 @@ _PUBLIC_ enum MAPISTATUS mapi_handles_release(struct mapi_handles_context *handl
 
 
 /**
-   \details Search for a record in the TDB database
+   \details Retrieve the slot associated to a MAPI handle
+
+   \param handles_ctx pointer to the MAPI handles context
+   \param handle MAPI handle to lookup
+
+   \return pointer to the slot on success, otherwise NULL if the
+   handle is out of range, free or belongs to a previous generation
+ */
+static struct mapi_handles_slot *mapi_handles_get_slot(struct mapi_handles_context *handles_ctx,
+						       uint32_t handle)
+{
+	struct mapi_handles_slot	*slot;
+	uint32_t			idx;
+
+	idx = handle & MAPI_HANDLES_INDEX_MASK;
+	if (idx == 0 || idx > handles_ctx->slots_used) {
+		return NULL;
+	}
+
+	slot = &handles_ctx->slots[idx - 1];
+	if (!slot->rec || slot->rec->handle != handle) {
+		return NULL;
+	}
+
+	return slot;
+}
+
+
+/**
+   \details Search for a MAPI handle
 
    \param handles_ctx pointer to the MAPI handles context
    \param handle MAPI handle to lookup
@@ -90,173 +123,131 @@ _PUBLIC_ enum MAPISTATUS mapi_handles_release(struct mapi_handles_context *handl
 _PUBLIC_ enum MAPISTATUS mapi_handles_search(struct mapi_handles_context *handles_ctx,
 					     uint32_t handle, struct mapi_handles **rec)
 {
-	TALLOC_CTX		*mem_ctx;
-	TDB_DATA		key;
-	TDB_DATA		dbuf;
-	struct mapi_handles	*el;
+	struct mapi_handles_slot	*slot;
 
 	/* Sanity checks */
 	OPENCHANGE_RETVAL_IF(!handles_ctx, MAPI_E_NOT_INITIALIZED, NULL);
-	OPENCHANGE_RETVAL_IF(!handles_ctx->tdb_ctx, MAPI_E_NOT_INITIALIZED, NULL);
+	OPENCHANGE_RETVAL_IF(!handles_ctx->slots, MAPI_E_NOT_INITIALIZED, NULL);
 	OPENCHANGE_RETVAL_IF(handle == MAPI_HANDLES_RESERVED, MAPI_E_INVALID_PARAMETER, NULL);
 	OPENCHANGE_RETVAL_IF(!rec, MAPI_E_INVALID_PARAMETER, NULL);
 
-	mem_ctx = talloc_named(NULL, 0, "mapi_handles_search");
-
-	/* Step 1. Search for the handle within TDB database */
-	key.dptr = (unsigned char *) talloc_asprintf(mem_ctx, "0x%x", handle);
-	key.dsize = strlen((const char *)key.dptr);
+	slot = mapi_handles_get_slot(handles_ctx, handle);
+	OPENCHANGE_RETVAL_IF(!slot, MAPI_E_NOT_FOUND, NULL);
 
-	dbuf = tdb_fetch(handles_ctx->tdb_ctx, key);
-	talloc_free(key.dptr);
-	OPENCHANGE_RETVAL_IF(!dbuf.dptr, MAPI_E_NOT_FOUND, mem_ctx);
-	OPENCHANGE_RETVAL_IF(!dbuf.dsize, MAPI_E_NOT_FOUND, mem_ctx);
+	*rec = slot->rec;
 
-	talloc_free(mem_ctx);
-	/* Ensure this is not a free'd record */
-	if (dbuf.dsize == (sizeof(MAPI_HANDLES_NULL) - 1) && !strncmp((char *)dbuf.dptr, MAPI_HANDLES_NULL, dbuf.dsize)) {
-		free(dbuf.dptr);
-		return MAPI_E_NOT_FOUND;
-	}
-	free(dbuf.dptr);
-
-	/* Step 2. Return the record within the double chained list */
-	for (el = handles_ctx->handles; el; el = el->next) {
-		if (el->handle == handle) {
-			*rec = el;
-			return MAPI_E_SUCCESS;
-		}
-	}
-
-	return MAPI_E_CORRUPT_STORE;
+	return MAPI_E_SUCCESS;
 }
 
 
 /**
-   \details Set a TDB record data as null meaning it can be reused in
-   the future.
+   \details Reserve a slot within the handles table, either from the
+   free list or by extending the table.
 
    \param handles_ctx pointer to the MAPI handles context
-   \param handle handle key value to free
+   \param idx pointer to the slot index the function returns
 
    \return MAPI_E_SUCCESS on success, otherwise MAPI error
  */
-static enum MAPISTATUS mapi_handles_tdb_free(struct mapi_handles_context *handles_ctx,
-					     uint32_t handle)
+static enum MAPISTATUS mapi_handles_slot_alloc(struct mapi_handles_context *handles_ctx,
+					       uint32_t *idx)
 {
-	TALLOC_CTX		*mem_ctx;
-	TDB_DATA		key;
-	TDB_DATA		dbuf;
-	int			ret;
-
-	/* Sanity checks */
-	OPENCHANGE_RETVAL_IF(!handles_ctx, MAPI_E_NOT_INITIALIZED, NULL);
-	OPENCHANGE_RETVAL_IF(!handles_ctx->tdb_ctx, MAPI_E_NOT_INITIALIZED, NULL);
-	OPENCHANGE_RETVAL_IF(handle == MAPI_HANDLES_RESERVED, MAPI_E_INVALID_PARAMETER, NULL);
+	struct mapi_handles_slot	*slots;
+	uint32_t			slots_count;
+
+	/* Step 1. Reuse the most recently released slot */
+	if (handles_ctx->free_slot != MAPI_HANDLES_SLOT_NONE) {
+		*idx = handles_ctx->free_slot;
+		handles_ctx->free_slot = handles_ctx->slots[*idx].next_free;
+		handles_ctx->slots[*idx].next_free = MAPI_HANDLES_SLOT_NONE;
+		return MAPI_E_SUCCESS;
+	}
 
-	mem_ctx = talloc_named(NULL, 0, "mapi_handles_tdb_free");
-	
-	key.dptr = (unsigned char *) talloc_asprintf(mem_ctx, "0x%x", handle);
-	key.dsize = strlen((const char *)key.dptr);
-
-	/* Step 1. Makes sure the record exists */
-	ret = tdb_exists(handles_ctx->tdb_ctx, key);
-	OPENCHANGE_RETVAL_IF(!ret, MAPI_E_NOT_FOUND, mem_ctx);
-
-	/* Step 2. Update existing record */
-	dbuf.dptr = (unsigned char *)MAPI_HANDLES_NULL;
-	dbuf.dsize = sizeof(MAPI_HANDLES_NULL) - 1;
-
-	ret = tdb_store(handles_ctx->tdb_ctx, key, dbuf, TDB_MODIFY);
-	talloc_free(mem_ctx);
-	if (ret == -1) {
-		OC_DEBUG(3, "Unable to create 0x%x record: %s\n",
-			  handle, tdb_errorstr(handles_ctx->tdb_ctx));
-		return MAPI_E_CORRUPT_STORE;
+	/* Step 2. Grow the table if no slot is available */
+	OPENCHANGE_RETVAL_IF(handles_ctx->slots_used >= MAPI_HANDLES_MAX_SLOTS, MAPI_E_NOT_ENOUGH_RESOURCES, NULL);
+	if (handles_ctx->slots_used == handles_ctx->slots_count) {
+		slots_count = handles_ctx->slots_count * 2;
+		if (slots_count > MAPI_HANDLES_MAX_SLOTS) {
+			slots_count = MAPI_HANDLES_MAX_SLOTS;
+		}
+		slots = talloc_realloc(handles_ctx, handles_ctx->slots, struct mapi_handles_slot, slots_count);
+		OPENCHANGE_RETVAL_IF(!slots, MAPI_E_NOT_ENOUGH_RESOURCES, NULL);
+		memset(&slots[handles_ctx->slots_count], 0,
+		       (slots_count - handles_ctx->slots_count) * sizeof (struct mapi_handles_slot));
+		handles_ctx->slots = slots;
+		handles_ctx->slots_count = slots_count;
 	}
 
+	*idx = handles_ctx->slots_used;
+	handles_ctx->slots[*idx].generation = 0;
+	handles_ctx->slots[*idx].next_free = MAPI_HANDLES_SLOT_NONE;
+	handles_ctx->slots_used += 1;
+
 	return MAPI_E_SUCCESS;
 }
 
 
 /**
-   \details Update a TDB record
+   \details Return a slot to the free list and bump its generation so
+   any handle still referencing it becomes stale.
 
-   
+   \param handles_ctx pointer to the MAPI handles context
+   \param slot pointer to the slot to release
  */
-static enum MAPISTATUS mapi_handles_tdb_update(struct mapi_handles_context *handles_ctx,
-					       uint32_t handle, uint32_t container_handle)
+static void mapi_handles_slot_free(struct mapi_handles_context *handles_ctx,
+				   struct mapi_handles_slot *slot)
 {
-	TALLOC_CTX	*mem_ctx;
-	TDB_DATA	key;
-	TDB_DATA	dbuf;
-	int		ret;
-
-	/* Sanity checks */
-	OPENCHANGE_RETVAL_IF(!handles_ctx, MAPI_E_NOT_INITIALIZED, NULL);
-	OPENCHANGE_RETVAL_IF(!handles_ctx->tdb_ctx, MAPI_E_NOT_INITIALIZED, NULL);
-	OPENCHANGE_RETVAL_IF(!handle, MAPI_E_INVALID_PARAMETER, NULL);
-
-	mem_ctx = talloc_named(NULL, 0, "mapi_handles_tdb_update");
-
-	key.dptr = (unsigned char *) talloc_asprintf(mem_ctx, "0x%x", handle);
-	key.dsize = strlen((const char *)key.dptr);
-
-	/* Step 1. Makes sure the record exists */
-	ret = tdb_exists(handles_ctx->tdb_ctx, key);
-	OPENCHANGE_RETVAL_IF(!ret, MAPI_E_NOT_FOUND, mem_ctx);
+	slot->rec = NULL;
+	slot->generation = (slot->generation + 1) & MAPI_HANDLES_GENERATION_MASK;
+	slot->next_free = handles_ctx->free_slot;
+	handles_ctx->free_slot = slot - handles_ctx->slots;
+}
 
-	/* Step 2. Update record */
-	dbuf.dptr = (unsigned char *) talloc_asprintf(mem_ctx, "0x%x", container_handle);
-	dbuf.dsize = strlen((const char *)dbuf.dptr);
 
-	ret = tdb_store(handles_ctx->tdb_ctx, key, dbuf, TDB_MODIFY);
-	talloc_free(mem_ctx);
-	if (ret == -1) {
-		OC_DEBUG(3, "Unable to update 0x%x record: %s\n",
-			  handle, tdb_errorstr(handles_ctx->tdb_ctx));
+/**
+   \details Attach a MAPI handle to the children list of its parent
 
-		return MAPI_E_CORRUPT_STORE;
+   \param parent pointer to the parent MAPI handle
+   \param el pointer to the MAPI handle to attach
+ */
+static void mapi_handles_link_child(struct mapi_handles *parent,
+				    struct mapi_handles *el)
+{
+	el->parent = parent;
+	el->sibling_prev = NULL;
+	el->sibling_next = parent->children;
+	if (parent->children) {
+		parent->children->sibling_prev = el;
 	}
-
-	return MAPI_E_SUCCESS;
+	parent->children = el;
 }
 
 
 /**
-   \details Traverse TDB database and search for the first record
-   which dbuf value is "null" string.
- 
-   \param tdb_ctx pointer to the TDB context
-   \param key the current TDB key
-   \param dbuf the current TDB value
-   \param state pointer on private data
-
-   \return 1 when a free record is found, otherwise 0
-*/
-static int mapi_handles_traverse_null(TDB_CONTEXT *tdb_ctx,
-				      TDB_DATA key, TDB_DATA dbuf,
-				      void *state)
-{
-	TALLOC_CTX	*mem_ctx;
-	uint32_t	*handle = (uint32_t *) state;
-	char		*handle_str = NULL;
+   \details Detach a MAPI handle from the children list of its parent
 
-	if (dbuf.dptr && (dbuf.dsize == sizeof(MAPI_HANDLES_NULL) - 1) && strncmp((const char *)dbuf.dptr, MAPI_HANDLES_NULL, dbuf.dsize) == 0) {
-		mem_ctx = talloc_named(NULL, 0, "mapi_handles_traverse_null");
-		handle_str = talloc_strndup(mem_ctx, (char *)key.dptr, key.dsize);
-		*handle = strtol((const char *) handle_str, NULL, 16);
-		talloc_free(mem_ctx);
+   \param el pointer to the MAPI handle to detach
+ */
+static void mapi_handles_unlink_child(struct mapi_handles *el)
+{
+	if (!el->parent) return;
 
-		return 1;
+	if (el->sibling_prev) {
+		el->sibling_prev->sibling_next = el->sibling_next;
+	} else {
+		el->parent->children = el->sibling_next;
 	}
-
-	return 0;
+	if (el->sibling_next) {
+		el->sibling_next->sibling_prev = el->sibling_prev;
+	}
+	el->parent = NULL;
+	el->sibling_prev = NULL;
+	el->sibling_next = NULL;
 }
 
 
 /**
-   \details Add a handles to the database and return a pointer on
+   \details Add a handles to the handles table and return a pointer on
    created record
 
    \param handles_ctx pointer to the MAPI handles context
@@ -269,84 +260,48 @@ static int mapi_handles_traverse_null(TDB_CONTEXT *tdb_ctx,
 _PUBLIC_ enum MAPISTATUS mapi_handles_add(struct mapi_handles_context *handles_ctx,
 					  uint32_t container_handle, struct mapi_handles **rec)
 {
-	TALLOC_CTX		*mem_ctx;
-	enum MAPISTATUS		retval;
-	TDB_DATA		key;
-	TDB_DATA		dbuf;
-	uint32_t		handle = 0;
-	struct mapi_handles	*el;
-	int			ret;
+	enum MAPISTATUS			retval;
+	struct mapi_handles_slot	*slot;
+	struct mapi_handles_slot	*parent_slot;
+	struct mapi_handles		*el;
+	uint32_t			idx;
 
 	/* Sanity checks */
 	OPENCHANGE_RETVAL_IF(!handles_ctx, MAPI_E_NOT_INITIALIZED, NULL);
-	OPENCHANGE_RETVAL_IF(!handles_ctx->tdb_ctx, MAPI_E_NOT_INITIALIZED, NULL);
-	OPENCHANGE_RETVAL_IF(handle == MAPI_HANDLES_RESERVED, MAPI_E_INVALID_PARAMETER, NULL);
+	OPENCHANGE_RETVAL_IF(!handles_ctx->slots, MAPI_E_NOT_INITIALIZED, NULL);
 	OPENCHANGE_RETVAL_IF(!rec, MAPI_E_INVALID_PARAMETER, NULL);
 
-	mem_ctx = talloc_named(NULL, 0, "mapi_handles_add");
-
-	/* Step 1. Seek the TDB database for the first free record */
-	ret = tdb_traverse(handles_ctx->tdb_ctx, mapi_handles_traverse_null, (void *)&handle);
-	if (ret > -1 && handle > 0) {
-		OC_DEBUG(5, "We have found free record 0x%x", handle);
-		retval = mapi_handles_tdb_update(handles_ctx, handle, container_handle);
-		OPENCHANGE_RETVAL_IF(retval, retval, mem_ctx);
-		
-		el = talloc_zero((TALLOC_CTX *)handles_ctx, struct mapi_handles);
-		if (!el) {
-			mapi_handles_tdb_free(handles_ctx, handle);
-			talloc_free(mem_ctx);
-			return MAPI_E_NOT_ENOUGH_RESOURCES;
-		}
-
-		el->handle = handle;
-		el->parent_handle = container_handle;
-		el->private_data = NULL;
-		*rec = el;
-		DLIST_ADD_END(handles_ctx->handles, el, struct mapi_handles *);
-
-		talloc_free(mem_ctx);
-
-		return MAPI_E_SUCCESS;
-	}
-
-	/* Step 2. If no record is available, create a new one */
-	key.dptr = (unsigned char *) talloc_asprintf(mem_ctx, "0x%x", handles_ctx->last_handle);
-	key.dsize = strlen((const char *)key.dptr);
-
-	if (container_handle) {
-		dbuf.dptr = (unsigned char *) talloc_asprintf(mem_ctx, "0x%x", container_handle);
-		dbuf.dsize = strlen((const char *)dbuf.dptr);
-	} else {
-		dbuf.dptr = (unsigned char *) MAPI_HANDLES_ROOT;
-		dbuf.dsize = strlen(MAPI_HANDLES_ROOT);
-	}
-
-	ret = tdb_store(handles_ctx->tdb_ctx, key, dbuf, TDB_INSERT);
-	if (ret == -1) {
-		OC_DEBUG(3, "Unable to create 0x%x record: %s",
-			  handles_ctx->last_handle, tdb_errorstr(handles_ctx->tdb_ctx));
-		talloc_free(mem_ctx);
-
-		return MAPI_E_CORRUPT_STORE;
-	}
-
+	/* Step 1. Allocate the record */
 	el = talloc_zero((TALLOC_CTX *)handles_ctx, struct mapi_handles);
-	if (!el) {
-		mapi_handles_tdb_free(handles_ctx, handles_ctx->last_handle);
-		talloc_free(mem_ctx);
-		return MAPI_E_NOT_ENOUGH_RESOURCES;
+	OPENCHANGE_RETVAL_IF(!el, MAPI_E_NOT_ENOUGH_RESOURCES, NULL);
+
+	/* Step 2. Reserve a slot for it */
+	retval = mapi_handles_slot_alloc(handles_ctx, &idx);
+	if (retval) {
+		OC_DEBUG(3, "Unable to allocate a new MAPI handle: %s", mapi_get_errstr(retval));
+		talloc_free(el);
+		return retval;
 	}
+	slot = &handles_ctx->slots[idx];
 
-	el->handle = handles_ctx->last_handle;
+	el->handle = (slot->generation << MAPI_HANDLES_INDEX_BITS) | (idx + 1);
 	el->parent_handle = container_handle;
 	el->private_data = NULL;
-	*rec = el;
+	slot->rec = el;
 	DLIST_ADD_END(handles_ctx->handles, el, struct mapi_handles *);
+	handles_ctx->handles_count += 1;
+
+	/* Step 3. Attach the record to its container */
+	if (container_handle && container_handle != MAPI_HANDLES_RESERVED) {
+		parent_slot = mapi_handles_get_slot(handles_ctx, container_handle);
+		if (parent_slot) {
+			mapi_handles_link_child(parent_slot->rec, el);
+		}
+	}
+
+	*rec = el;
 
 	OC_DEBUG(5, "handle 0x%.2x is a father of 0x%.2x", container_handle, el->handle);
-	handles_ctx->last_handle += 1;
-	talloc_free(mem_ctx);
 
 	return MAPI_E_SUCCESS;
 }
@@ -395,55 +350,11 @@ _PUBLIC_ enum MAPISTATUS mapi_handles_set_private_data(struct mapi_handles *hand
 }
 
 
-struct mapi_handles_private {
-	struct mapi_handles_context	*handles_ctx;
-	uint32_t			container_handle;
-};
-
-/**
-   \details Traverse TDB database and search for records
-   which dbuf value is set to state.
- 
-   \param tdb_ctx pointer to the TDB context
-   \param key the current TDB key (potential child handle)
-   \param dbuf the current TDB value (parent handle)
-   \param state pointer on private data
-
-   \return 1 when a free record is found, otherwise 0
-*/
-static int mapi_handles_traverse_delete(TDB_CONTEXT *tdb_ctx,
-					TDB_DATA key, TDB_DATA dbuf,
-					void *state)
-{
-	TALLOC_CTX			*mem_ctx;
-	struct mapi_handles_private	*handles_private = (struct mapi_handles_private *) state;
-	uint32_t			handle;
-	char				*container_handle_str = NULL;
-	char				*handle_str = NULL;
-
-	mem_ctx = talloc_named(NULL, 0, "mapi_handles_traverse_delete");
-	container_handle_str = talloc_asprintf(mem_ctx, "0x%x", handles_private->container_handle);
-
-	if (dbuf.dptr && strlen(container_handle_str) == dbuf.dsize && strncmp((const char *)dbuf.dptr, container_handle_str, dbuf.dsize) == 0) {
-		handle_str = talloc_strndup(mem_ctx, (char *)key.dptr, key.dsize);
-		OC_DEBUG(5, "handles being released must NOT have child handles attached to them (%s is a child of %s)", handle_str, container_handle_str);
-		handle = strtol((const char *) handle_str, NULL, 16);
-		/* abort(); */
-		/* DEBUG(5, ("deleting child handle: %d, %s\n", handle, handle_str)); */
-		mapi_handles_delete(handles_private->handles_ctx, handle);
-	}
-
-	talloc_free(mem_ctx);
-
-	return 0;
-}
-
-
-
 /**
    \details Remove the MAPI handle referenced by the handle parameter
-   from the double chained list and mark its associated TDB record as
-   null
+   from the handles table along with the whole hierarchy of children
+   handles attached to it. The cost is proportional to the size of
+   the released subtree.
 
    \param handles_ctx pointer to the MAPI handles context
    \param handle the handle to delete
@@ -453,58 +364,84 @@ static int mapi_handles_traverse_delete(TDB_CONTEXT *tdb_ctx,
 _PUBLIC_ enum MAPISTATUS mapi_handles_delete(struct mapi_handles_context *handles_ctx, 
 					     uint32_t handle)
 {
-	TALLOC_CTX			*mem_ctx;
-	enum MAPISTATUS			retval;
-	TDB_DATA			key;
+	struct mapi_handles_slot	*slot;
+	struct mapi_handles		*pending;
 	struct mapi_handles		*el;
-	struct mapi_handles_private	handles_private;
-	int				ret;
-	bool				found = false;
+	struct mapi_handles		*last;
+	uint32_t			fanout = 0;
 
 	/* Sanity checks */
 	OPENCHANGE_RETVAL_IF(!handles_ctx, MAPI_E_NOT_INITIALIZED, NULL);
-	OPENCHANGE_RETVAL_IF(!handles_ctx->tdb_ctx, MAPI_E_NOT_INITIALIZED, NULL);
+	OPENCHANGE_RETVAL_IF(!handles_ctx->slots, MAPI_E_NOT_INITIALIZED, NULL);
 	OPENCHANGE_RETVAL_IF(handle == MAPI_HANDLES_RESERVED, MAPI_E_INVALID_PARAMETER, NULL);
 
-	OC_DEBUG(4, "Deleting MAPI handle 0x%x (handles_ctx: %p, tdb_ctx: %p)",
-		  handle, handles_ctx, handles_ctx->tdb_ctx);
+	OC_DEBUG(4, "Deleting MAPI handle 0x%x (handles_ctx: %p)", handle, handles_ctx);
 
-	mem_ctx = talloc_named(NULL, 0, "mapi_handles_delete");
+	/* Step 1. Make sure the record exists */
+	slot = mapi_handles_get_slot(handles_ctx, handle);
+	OPENCHANGE_RETVAL_IF(!slot, MAPI_E_NOT_FOUND, NULL);
+
+	/* Step 2. Detach the subtree root from its container */
+	pending = slot->rec;
+	mapi_handles_unlink_child(pending);
+
+	/* Step 3. Release the subtree: the sibling pointers of the
+	 * records being released are reused as the pending list */
+	while (pending) {
+		el = pending;
+		pending = el->sibling_next;
+
+		if (el->children) {
+			for (last = el->children; last->sibling_next; last = last->sibling_next);
+			last->sibling_next = pending;
+			pending = el->children;
+		}
 
-	key.dptr = (unsigned char *) talloc_asprintf(mem_ctx, "0x%x", handle);
-	key.dsize = strlen((const char *)key.dptr);
+		if (el->handle != handle) {
+			OC_DEBUG(5, "handles being released must NOT have child handles attached to them (0x%x is a child of 0x%x)",
+				 el->handle, el->parent_handle);
+		}
 
-	/* Step 1. Make sure the record exists */
-	ret = tdb_exists(handles_ctx->tdb_ctx, key);
-	OPENCHANGE_RETVAL_IF(!ret, MAPI_E_NOT_FOUND, mem_ctx);
-
-	/* Step 2. Delete this record from the double chained list */
-	for (el = handles_ctx->handles; el; el = el->next) {
-		if (el->handle == handle) {
-			DLIST_REMOVE(handles_ctx->handles, el);
-			talloc_free(el);
-			found = true;
-			break;
+		slot = mapi_handles_get_slot(handles_ctx, el->handle);
+		DLIST_REMOVE(handles_ctx->handles, el);
+		talloc_free(el);
+		if (slot) {
+			mapi_handles_slot_free(handles_ctx, slot);
 		}
+		handles_ctx->handles_count -= 1;
+		fanout++;
 	}
-	/* This case should never occur */
-	OPENCHANGE_RETVAL_IF(found == false, MAPI_E_CORRUPT_STORE, mem_ctx);
 
-	/* Step 3. Free this record within the TDB database */
-	retval = mapi_handles_tdb_free(handles_ctx, handle);
-	/* if (retval) { */
-	/* 	abort(); */
-	/* } */
-	OPENCHANGE_RETVAL_IF(retval, retval, mem_ctx);
+	/* Step 4. Update release statistics */
+	handles_ctx->stats.release_calls += 1;
+	handles_ctx->stats.released_handles += fanout;
+	handles_ctx->stats.last_fanout = fanout;
+	if (fanout > handles_ctx->stats.max_fanout) {
+		handles_ctx->stats.max_fanout = fanout;
+	}
 
-	/* Step 4. Delete hierarchy of children */
-	handles_private.handles_ctx = handles_ctx;
-	handles_private.container_handle = handle;
-	ret = tdb_traverse(handles_ctx->tdb_ctx, mapi_handles_traverse_delete, (void *)&handles_private);
+	OC_DEBUG(4, "Deleting MAPI handle 0x%x COMPLETE (%d handles released)", handle, fanout);
 
-	talloc_free(mem_ctx);
+	return MAPI_E_SUCCESS;
+}
+
+
+/**
+   \details Retrieve the handles release statistics
+
+   \param handles_ctx pointer to the MAPI handles context
+   \param stats pointer to the statistics structure the function fills
+
+   \return MAPI_E_SUCCESS on success, otherwise MAPI error
+ */
+_PUBLIC_ enum MAPISTATUS mapi_handles_get_stats(struct mapi_handles_context *handles_ctx,
+						struct mapi_handles_stats *stats)
+{
+	/* Sanity checks */
+	OPENCHANGE_RETVAL_IF(!handles_ctx, MAPI_E_NOT_INITIALIZED, NULL);
+	OPENCHANGE_RETVAL_IF(!stats, MAPI_E_INVALID_PARAMETER, NULL);
 
-	OC_DEBUG(4, "Deleting MAPI handle 0x%x COMPLETE", handle);
+	*stats = handles_ctx->stats;
 
 	return MAPI_E_SUCCESS;
 }
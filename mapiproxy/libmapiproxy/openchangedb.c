@@ -37,6 +37,8 @@
 #include "mapiproxy/libmapiproxy/backends/openchangedb_mysql.h"
 #include "mapiproxy/libmapiproxy/backends/openchangedb_ldb.h"
 #include "mapiproxy/libmapiproxy/backends/openchangedb_logger.h"
+#include "mapiproxy/libmapiproxy/backends/openchangedb_cache.h"
+#include "mapiproxy/libmapiproxy/backends/openchangedb_profiler.h"
 
 const char *nil_string = "<nil>";
 
@@ -69,6 +71,35 @@ _PUBLIC_ enum MAPISTATUS openchangedb_initialize(TALLOC_CTX *mem_ctx,
 		return retval;
 	}
 
+	if (lpcfg_parm_bool(lp_ctx, NULL, "mapiproxy", "openchangedb_cache", false)) {
+		int cache_size = lpcfg_parm_int(lp_ctx, NULL, "mapiproxy", "openchangedb_cache_size",
+						OPENCHANGEDB_CACHE_DEFAULT_SIZE);
+		int cache_ttl = lpcfg_parm_int(lp_ctx, NULL, "mapiproxy", "openchangedb_cache_ttl",
+					       OPENCHANGEDB_CACHE_DEFAULT_TTL);
+		OC_DEBUG(0, "Loading OpenchangeDB cache module (%d entries, %d seconds)\n",
+			 cache_size, cache_ttl);
+		retval = openchangedb_cache_initialize(mem_ctx, (cache_size > 0) ? cache_size : 0,
+						       (cache_ttl > 0) ? cache_ttl : 0, *oc_ctx, oc_ctx);
+		if (retval != MAPI_E_SUCCESS) {
+			return retval;
+		}
+	}
+
+	if (lpcfg_parm_bool(lp_ctx, NULL, "mapiproxy", "openchangedb_profiler", false)) {
+		int slow_ms = lpcfg_parm_int(lp_ctx, NULL, "mapiproxy", "openchangedb_profiler_slow",
+					     OPENCHANGEDB_PROFILER_DEFAULT_SLOW / 1000);
+		if (slow_ms > 0) {
+			OC_DEBUG(0, "Loading OpenchangeDB profiler module (slow calls from %d ms)\n", slow_ms);
+		} else {
+			OC_DEBUG(0, "Loading OpenchangeDB profiler module (no slow call samples)\n");
+		}
+		retval = openchangedb_profiler_initialize(mem_ctx, (slow_ms > 0) ? slow_ms * 1000ULL : 0,
+							  *oc_ctx, oc_ctx);
+		if (retval != MAPI_E_SUCCESS) {
+			return retval;
+		}
+	}
+
 	if (lpcfg_parm_bool(lp_ctx, NULL, "mapiproxy", "openchangedb_logger", false)) {
 		const char *prefix = lpcfg_parm_string(lp_ctx, NULL, "mapiproxy",
 						       "openchangedb_logger_prefix");
@@ -98,7 +129,8 @@ _PUBLIC_ enum MAPISTATUS openchangedb_get_SpecialFolderID(struct openchangedb_co
 	OPENCHANGE_RETVAL_IF(!recipient, MAPI_E_INVALID_PARAMETER, NULL);
 	OPENCHANGE_RETVAL_IF(!FolderId, MAPI_E_INVALID_PARAMETER, NULL);
 
-	return oc_ctx->get_SpecialFolderID(oc_ctx, recipient, SystemIdx, FolderId);
+	return openchangedb_backend_done(oc_ctx,
+		oc_ctx->get_SpecialFolderID(oc_ctx, recipient, SystemIdx, FolderId));
 }
 
 /**
@@ -120,7 +152,8 @@ _PUBLIC_ enum MAPISTATUS openchangedb_get_SystemFolderID(struct openchangedb_con
 	OPENCHANGE_RETVAL_IF(!recipient, MAPI_E_INVALID_PARAMETER, NULL);
 	OPENCHANGE_RETVAL_IF(!FolderId, MAPI_E_INVALID_PARAMETER, NULL);
 
-	return oc_ctx->get_SystemFolderID(oc_ctx, recipient, SystemIdx, FolderId);
+	return openchangedb_backend_done(oc_ctx,
+		oc_ctx->get_SystemFolderID(oc_ctx, recipient, SystemIdx, FolderId));
 }
 
 /**
@@ -141,7 +174,8 @@ _PUBLIC_ enum MAPISTATUS openchangedb_get_PublicFolderID(struct openchangedb_con
 	OPENCHANGE_RETVAL_IF(!username, MAPI_E_INVALID_PARAMETER, NULL);
 	OPENCHANGE_RETVAL_IF(!FolderId, MAPI_E_INVALID_PARAMETER, NULL);
 
-	return oc_ctx->get_PublicFolderID(oc_ctx, username, SystemIdx, FolderId);
+	return openchangedb_backend_done(oc_ctx,
+		oc_ctx->get_PublicFolderID(oc_ctx, username, SystemIdx, FolderId));
 }
 
 /**
@@ -164,7 +198,8 @@ _PUBLIC_ enum MAPISTATUS openchangedb_get_distinguishedName(TALLOC_CTX *parent_c
 	OPENCHANGE_RETVAL_IF(!oc_ctx, MAPI_E_NOT_INITIALIZED, NULL);
 	OPENCHANGE_RETVAL_IF(!distinguishedName, MAPI_E_INVALID_PARAMETER, NULL);
 
-	return oc_ctx->get_distinguishedName(parent_ctx, oc_ctx, fid, distinguishedName);
+	return openchangedb_backend_done(oc_ctx,
+		oc_ctx->get_distinguishedName(parent_ctx, oc_ctx, fid, distinguishedName));
 }
 
 /**
@@ -184,7 +219,8 @@ _PUBLIC_ enum MAPISTATUS openchangedb_get_MailboxGuid(struct openchangedb_contex
 	OPENCHANGE_RETVAL_IF(!recipient, MAPI_E_INVALID_PARAMETER, NULL);
 	OPENCHANGE_RETVAL_IF(!MailboxGUID, MAPI_E_INVALID_PARAMETER, NULL);
 
-	return oc_ctx->get_MailboxGuid(oc_ctx, recipient, MailboxGUID);
+	return openchangedb_backend_done(oc_ctx,
+		oc_ctx->get_MailboxGuid(oc_ctx, recipient, MailboxGUID));
 }
 
 /**
@@ -205,7 +241,8 @@ _PUBLIC_ enum MAPISTATUS openchangedb_get_MailboxReplica(struct openchangedb_con
 	OPENCHANGE_RETVAL_IF(!oc_ctx, MAPI_E_NOT_INITIALIZED, NULL);
 	OPENCHANGE_RETVAL_IF(!recipient, MAPI_E_INVALID_PARAMETER, NULL);
 
-	return oc_ctx->get_MailboxReplica(oc_ctx, recipient, ReplID, ReplGUID);
+	return openchangedb_backend_done(oc_ctx,
+		oc_ctx->get_MailboxReplica(oc_ctx, recipient, ReplID, ReplGUID));
 }
 
 /**
@@ -226,7 +263,8 @@ _PUBLIC_ enum MAPISTATUS openchangedb_get_PublicFolderReplica(struct openchanged
 	OPENCHANGE_RETVAL_IF(!oc_ctx, MAPI_E_NOT_INITIALIZED, NULL);
 	OPENCHANGE_RETVAL_IF(!username, MAPI_E_INVALID_PARAMETER, NULL);
 
-	return oc_ctx->get_PublicFolderReplica(oc_ctx, username, ReplID, ReplGUID);
+	return openchangedb_backend_done(oc_ctx,
+		oc_ctx->get_PublicFolderReplica(oc_ctx, username, ReplID, ReplGUID));
 }
 
 /**
@@ -255,8 +293,9 @@ _PUBLIC_ enum MAPISTATUS openchangedb_get_mapistoreURI(TALLOC_CTX *parent_ctx,
 	OPENCHANGE_RETVAL_IF(!username, MAPI_E_INVALID_PARAMETER, NULL);
 	OPENCHANGE_RETVAL_IF(!mapistoreURL, MAPI_E_INVALID_PARAMETER, NULL);
 
-	return oc_ctx->get_mapistoreURI(parent_ctx, oc_ctx, username, fid,
-					mapistoreURL, mailboxstore);
+	return openchangedb_backend_done(oc_ctx,
+		oc_ctx->get_mapistoreURI(parent_ctx, oc_ctx, username, fid,
+					 mapistoreURL, mailboxstore));
 }
 
 /**
@@ -278,7 +317,8 @@ _PUBLIC_ enum MAPISTATUS openchangedb_set_mapistoreURI(struct openchangedb_conte
 	OPENCHANGE_RETVAL_IF(!username, MAPI_E_INVALID_PARAMETER, NULL);
 	OPENCHANGE_RETVAL_IF(!mapistoreURL, MAPI_E_INVALID_PARAMETER, NULL);
 
-	return oc_ctx->set_mapistoreURI(oc_ctx, username, fid, mapistoreURL);
+	return openchangedb_backend_done(oc_ctx,
+		oc_ctx->set_mapistoreURI(oc_ctx, username, fid, mapistoreURL));
 }
 
 /**
@@ -301,7 +341,8 @@ _PUBLIC_ enum MAPISTATUS openchangedb_set_system_idx(struct openchangedb_context
 	OPENCHANGE_RETVAL_IF(!fid, MAPI_E_INVALID_PARAMETER, NULL);
 	OPENCHANGE_RETVAL_IF(system_idx < -1, MAPI_E_INVALID_PARAMETER, NULL);
 
-	return oc_ctx->set_system_idx(oc_ctx, username, fid, system_idx);
+	return openchangedb_backend_done(oc_ctx,
+		oc_ctx->set_system_idx(oc_ctx, username, fid, system_idx));
 }
 
 /**
@@ -327,8 +368,9 @@ _PUBLIC_ enum MAPISTATUS openchangedb_get_parent_fid(struct openchangedb_context
 	OPENCHANGE_RETVAL_IF(!username, MAPI_E_INVALID_PARAMETER, NULL);
 	OPENCHANGE_RETVAL_IF(!parent_fidp, MAPI_E_INVALID_PARAMETER, NULL);
 
-	return oc_ctx->get_parent_fid(oc_ctx, username, fid, parent_fidp,
-				      mailboxstore);
+	return openchangedb_backend_done(oc_ctx,
+		oc_ctx->get_parent_fid(oc_ctx, username, fid, parent_fidp,
+				       mailboxstore));
 }
 
 /**
@@ -348,7 +390,8 @@ _PUBLIC_ enum MAPISTATUS openchangedb_get_fid(struct openchangedb_context *oc_ct
 	OPENCHANGE_RETVAL_IF(!mapistoreURL, MAPI_E_INVALID_PARAMETER, NULL);
 	OPENCHANGE_RETVAL_IF(!fidp, MAPI_E_INVALID_PARAMETER, NULL);
 
-	return oc_ctx->get_fid(oc_ctx, mapistoreURL, fidp);
+	return openchangedb_backend_done(oc_ctx,
+		oc_ctx->get_fid(oc_ctx, mapistoreURL, fidp));
 }
 
 /**
@@ -369,7 +412,8 @@ _PUBLIC_ enum MAPISTATUS openchangedb_get_MAPIStoreURIs(struct openchangedb_cont
 	OPENCHANGE_RETVAL_IF(!username, MAPI_E_INVALID_PARAMETER, NULL);
 	OPENCHANGE_RETVAL_IF(!urisP, MAPI_E_INVALID_PARAMETER, NULL);
 
-	return oc_ctx->get_MAPIStoreURIs(oc_ctx, username, mem_ctx, urisP);
+	return openchangedb_backend_done(oc_ctx,
+		oc_ctx->get_MAPIStoreURIs(oc_ctx, username, mem_ctx, urisP));
 }
 
 /**
@@ -399,8 +443,9 @@ _PUBLIC_ enum MAPISTATUS openchangedb_get_ReceiveFolder(TALLOC_CTX *parent_ctx,
 	OPENCHANGE_RETVAL_IF(!fid, MAPI_E_INVALID_PARAMETER, NULL);
 	OPENCHANGE_RETVAL_IF(!ExplicitMessageClass, MAPI_E_INVALID_PARAMETER, NULL);
 
-	return oc_ctx->get_ReceiveFolder(parent_ctx, oc_ctx, recipient,
-					 MessageClass, fid, ExplicitMessageClass);
+	return openchangedb_backend_done(oc_ctx,
+		oc_ctx->get_ReceiveFolder(parent_ctx, oc_ctx, recipient,
+					  MessageClass, fid, ExplicitMessageClass));
 }
 
 
@@ -431,8 +476,9 @@ _PUBLIC_ enum MAPISTATUS openchangedb_get_ReceiveFolderTable(TALLOC_CTX *mem_ctx
 	OPENCHANGE_RETVAL_IF(!cValues, MAPI_E_INVALID_PARAMETER, NULL);
 	OPENCHANGE_RETVAL_IF(!entries, MAPI_E_INVALID_PARAMETER, NULL);
 
-	return oc_ctx->get_ReceiveFolderTable(mem_ctx, oc_ctx, recipient,
-					      cValues, entries);
+	return openchangedb_backend_done(oc_ctx,
+		oc_ctx->get_ReceiveFolderTable(mem_ctx, oc_ctx, recipient,
+					       cValues, entries));
 }
 
 /**
@@ -452,7 +498,8 @@ _PUBLIC_ enum MAPISTATUS openchangedb_get_TransportFolder(struct openchangedb_co
 	OPENCHANGE_RETVAL_IF(!recipient, MAPI_E_INVALID_PARAMETER, NULL);
 	OPENCHANGE_RETVAL_IF(!FolderId, MAPI_E_INVALID_PARAMETER, NULL);
 
-	return oc_ctx->get_TransportFolder(oc_ctx, recipient, FolderId);
+	return openchangedb_backend_done(oc_ctx,
+		oc_ctx->get_TransportFolder(oc_ctx, recipient, FolderId));
 }
 
 /**
@@ -474,7 +521,8 @@ _PUBLIC_ enum MAPISTATUS openchangedb_get_folder_count(struct openchangedb_conte
 	OPENCHANGE_RETVAL_IF(!username, MAPI_E_INVALID_PARAMETER, NULL);
 	OPENCHANGE_RETVAL_IF(!RowCount, MAPI_E_INVALID_PARAMETER, NULL);
 
-	return oc_ctx->get_folder_count(oc_ctx, username, fid, RowCount);
+	return openchangedb_backend_done(oc_ctx,
+		oc_ctx->get_folder_count(oc_ctx, username, fid, RowCount));
 }
 
 /**
@@ -493,7 +541,8 @@ _PUBLIC_ enum MAPISTATUS openchangedb_lookup_folder_property(struct openchangedb
 {
 	OPENCHANGE_RETVAL_IF(!oc_ctx, MAPI_E_NOT_INITIALIZED, NULL);
 
-	return oc_ctx->lookup_folder_property(oc_ctx, proptag, fid);
+	return openchangedb_backend_done(oc_ctx,
+		oc_ctx->lookup_folder_property(oc_ctx, proptag, fid));
 }
 
 /**
@@ -582,7 +631,8 @@ _PUBLIC_ enum MAPISTATUS openchangedb_get_new_changeNumber(struct openchangedb_c
 	OPENCHANGE_RETVAL_IF(!username, MAPI_E_INVALID_PARAMETER, NULL);
 	OPENCHANGE_RETVAL_IF(!cn, MAPI_E_INVALID_PARAMETER, NULL);
 
-	return oc_ctx->get_new_changeNumber(oc_ctx, username, cn);
+	return openchangedb_backend_done(oc_ctx,
+		oc_ctx->get_new_changeNumber(oc_ctx, username, cn));
 }
 
 /**
@@ -607,7 +657,8 @@ _PUBLIC_ enum MAPISTATUS openchangedb_get_new_changeNumbers(struct openchangedb_
 	OPENCHANGE_RETVAL_IF(!username, MAPI_E_INVALID_PARAMETER, NULL);
 	OPENCHANGE_RETVAL_IF(!cns_p, MAPI_E_INVALID_PARAMETER, NULL);
 
-	return oc_ctx->get_new_changeNumbers(oc_ctx, mem_ctx, username, max, cns_p);
+	return openchangedb_backend_done(oc_ctx,
+		oc_ctx->get_new_changeNumbers(oc_ctx, mem_ctx, username, max, cns_p));
 }
 
 /**
@@ -626,7 +677,8 @@ _PUBLIC_ enum MAPISTATUS openchangedb_get_next_changeNumber(struct openchangedb_
 	OPENCHANGE_RETVAL_IF(!username, MAPI_E_INVALID_PARAMETER, NULL);
 	OPENCHANGE_RETVAL_IF(!cn, MAPI_E_INVALID_PARAMETER, NULL);
 
-	return oc_ctx->get_next_changeNumber(oc_ctx, username, cn);
+	return openchangedb_backend_done(oc_ctx,
+		oc_ctx->get_next_changeNumber(oc_ctx, username, cn));
 }
 
 /**
@@ -652,8 +704,61 @@ _PUBLIC_ enum MAPISTATUS openchangedb_get_folder_property(TALLOC_CTX *parent_ctx
 	OPENCHANGE_RETVAL_IF(!username, MAPI_E_INVALID_PARAMETER, NULL);
 	OPENCHANGE_RETVAL_IF(!data, MAPI_E_INVALID_PARAMETER, NULL);
 
-	return oc_ctx->get_folder_property(parent_ctx, oc_ctx, username,
-					   proptag, fid, data);
+	return openchangedb_backend_done(oc_ctx,
+		oc_ctx->get_folder_property(parent_ctx, oc_ctx, username,
+					    proptag, fid, data));
+}
+
+/**
+   \details Retrieve several MAPI property values from a folder record
+
+   Backends which support it fetch all the values in a single
+   lookup, others get one openchangedb_get_folder_property call per
+   property.
+
+   \param parent_ctx pointer to the memory context
+   \param oc_ctx pointer to the openchange DB context
+   \param username mailbox name where the folder is
+   \param fid the record folder identifier
+   \param properties the MAPI property tags to retrieve values for
+   \param data array of properties->cValues pointers the values are
+   returned in
+   \param retvals array of properties->cValues status, one per
+   property
+
+   \return MAPI_E_SUCCESS on success, otherwise MAPI error. A property
+   which could not be found is reported through retvals.
+ */
+_PUBLIC_ enum MAPISTATUS openchangedb_get_folder_properties(TALLOC_CTX *parent_ctx,
+							    struct openchangedb_context *oc_ctx,
+							    const char *username,
+							    uint64_t fid,
+							    struct SPropTagArray *properties,
+							    void **data,
+							    enum MAPISTATUS *retvals)
+{
+	uint32_t	i;
+
+	OPENCHANGE_RETVAL_IF(!oc_ctx, MAPI_E_NOT_INITIALIZED, NULL);
+	OPENCHANGE_RETVAL_IF(!username, MAPI_E_INVALID_PARAMETER, NULL);
+	OPENCHANGE_RETVAL_IF(!properties, MAPI_E_INVALID_PARAMETER, NULL);
+	OPENCHANGE_RETVAL_IF(!data, MAPI_E_INVALID_PARAMETER, NULL);
+	OPENCHANGE_RETVAL_IF(!retvals, MAPI_E_INVALID_PARAMETER, NULL);
+
+	if (oc_ctx->get_folder_properties) {
+		return openchangedb_backend_done(oc_ctx,
+			oc_ctx->get_folder_properties(parent_ctx, oc_ctx, username, fid,
+						      properties, data, retvals));
+	}
+
+	for (i = 0; i < properties->cValues; i++) {
+		data[i] = NULL;
+		retvals[i] = oc_ctx->get_folder_property(parent_ctx, oc_ctx, username,
+							 properties->aulPropTag[i], fid,
+							 data + i);
+	}
+
+	return openchangedb_backend_done(oc_ctx, MAPI_E_SUCCESS);
 }
 
 /**
@@ -675,7 +780,8 @@ _PUBLIC_ enum MAPISTATUS openchangedb_set_folder_properties(struct openchangedb_
 	OPENCHANGE_RETVAL_IF(!username, MAPI_E_INVALID_PARAMETER, NULL);
 	OPENCHANGE_RETVAL_IF(!row, MAPI_E_INVALID_PARAMETER, NULL);
 
-	return oc_ctx->set_folder_properties(oc_ctx, username, fid, row);
+	return openchangedb_backend_done(oc_ctx,
+		oc_ctx->set_folder_properties(oc_ctx, username, fid, row));
 }
 
 /**
@@ -702,7 +808,8 @@ _PUBLIC_ enum MAPISTATUS openchangedb_get_table_property(TALLOC_CTX *parent_ctx,
 	OPENCHANGE_RETVAL_IF(!ldb_filter, MAPI_E_INVALID_PARAMETER, NULL);
 	OPENCHANGE_RETVAL_IF(!data, MAPI_E_INVALID_PARAMETER, NULL);
 
-	return oc_ctx->get_table_property(parent_ctx, oc_ctx, ldb_filter, proptag, pos, data);
+	return openchangedb_backend_done(oc_ctx,
+		oc_ctx->get_table_property(parent_ctx, oc_ctx, ldb_filter, proptag, pos, data));
 }
 
 /**
@@ -732,7 +839,8 @@ _PUBLIC_ enum MAPISTATUS openchangedb_get_fid_by_name(struct openchangedb_contex
 	OPENCHANGE_RETVAL_IF(!foldername, MAPI_E_INVALID_PARAMETER, NULL);
 	OPENCHANGE_RETVAL_IF(!fid, MAPI_E_INVALID_PARAMETER, NULL);
 	
-	return oc_ctx->get_fid_by_name(oc_ctx, username, parent_fid, foldername, fid);
+	return openchangedb_backend_done(oc_ctx,
+		oc_ctx->get_fid_by_name(oc_ctx, username, parent_fid, foldername, fid));
 }
 
 /**
@@ -759,8 +867,9 @@ _PUBLIC_ enum MAPISTATUS openchangedb_get_mid_by_subject(struct openchangedb_con
 	OPENCHANGE_RETVAL_IF(!subject, MAPI_E_INVALID_PARAMETER, NULL);
 	OPENCHANGE_RETVAL_IF(!mid, MAPI_E_INVALID_PARAMETER, NULL);
 
-	return oc_ctx->get_mid_by_subject(oc_ctx, username, parent_fid, subject,
-					  mailboxstore, mid);
+	return openchangedb_backend_done(oc_ctx,
+		oc_ctx->get_mid_by_subject(oc_ctx, username, parent_fid, subject,
+					   mailboxstore, mid));
 }
 
 /**
@@ -779,7 +888,8 @@ _PUBLIC_ enum MAPISTATUS openchangedb_delete_folder(struct openchangedb_context
 	OPENCHANGE_RETVAL_IF(!oc_ctx, MAPI_E_NOT_INITIALIZED, NULL);
 	OPENCHANGE_RETVAL_IF(!username, MAPI_E_INVALID_PARAMETER, NULL);
 	
-	return oc_ctx->delete_folder(oc_ctx, username, fid);
+	return openchangedb_backend_done(oc_ctx,
+		oc_ctx->delete_folder(oc_ctx, username, fid));
 }
 
 /**
@@ -800,7 +910,8 @@ _PUBLIC_ enum MAPISTATUS openchangedb_set_ReceiveFolder(struct openchangedb_cont
 	OPENCHANGE_RETVAL_IF(!recipient, MAPI_E_INVALID_PARAMETER, NULL);
 	OPENCHANGE_RETVAL_IF(!MessageClass, MAPI_E_INVALID_PARAMETER, NULL);
 	
-	return oc_ctx->set_ReceiveFolder(oc_ctx, recipient, MessageClass, fid);
+	return openchangedb_backend_done(oc_ctx,
+		oc_ctx->set_ReceiveFolder(oc_ctx, recipient, MessageClass, fid));
 }
 
 /**
@@ -821,7 +932,8 @@ _PUBLIC_ enum MAPISTATUS openchangedb_get_fid_from_partial_uri(struct openchange
 	OPENCHANGE_RETVAL_IF(!partialURI, MAPI_E_INVALID_PARAMETER, NULL);
 	OPENCHANGE_RETVAL_IF(!fid, MAPI_E_INVALID_PARAMETER, NULL);
 	
-	return oc_ctx->get_fid_from_partial_uri(oc_ctx, partialURI, fid);
+	return openchangedb_backend_done(oc_ctx,
+		oc_ctx->get_fid_from_partial_uri(oc_ctx, partialURI, fid));
 }
 
 /**
@@ -851,8 +963,9 @@ _PUBLIC_ enum MAPISTATUS openchangedb_get_users_from_partial_uri(TALLOC_CTX *par
 	OPENCHANGE_RETVAL_IF(!MAPIStoreURI, MAPI_E_INVALID_PARAMETER, NULL);
 	OPENCHANGE_RETVAL_IF(!users, MAPI_E_INVALID_PARAMETER, NULL);
 	
-	return oc_ctx->get_users_from_partial_uri(parent_ctx, oc_ctx, partialURI,
-						  count, MAPIStoreURI, users);
+	return openchangedb_backend_done(oc_ctx,
+		oc_ctx->get_users_from_partial_uri(parent_ctx, oc_ctx, partialURI,
+						   count, MAPIStoreURI, users));
 
 }
 
@@ -881,9 +994,10 @@ _PUBLIC_ enum MAPISTATUS openchangedb_create_mailbox(struct openchangedb_context
 	OPENCHANGE_RETVAL_IF(!group_name, MAPI_E_INVALID_PARAMETER, NULL);
 	OPENCHANGE_RETVAL_IF(!display_name, MAPI_E_INVALID_PARAMETER, NULL);
 
-	return oc_ctx->create_mailbox(oc_ctx, username, organization_name,
-				      group_name, EMSMDBP_MAILBOX_ROOT, fid,
-				      display_name);
+	return openchangedb_backend_done(oc_ctx,
+		oc_ctx->create_mailbox(oc_ctx, username, organization_name,
+				       group_name, EMSMDBP_MAILBOX_ROOT, fid,
+				       display_name));
 }
 
 /**
@@ -913,8 +1027,9 @@ _PUBLIC_ enum MAPISTATUS openchangedb_create_folder(struct openchangedb_context
 	OPENCHANGE_RETVAL_IF(!fid, MAPI_E_INVALID_PARAMETER, NULL);
 	OPENCHANGE_RETVAL_IF(!changeNumber, MAPI_E_INVALID_PARAMETER, NULL);
 
-	return oc_ctx->create_folder(oc_ctx, username, parentFolderID, fid,
-				     changeNumber, MAPIStoreURI, systemIdx);
+	return openchangedb_backend_done(oc_ctx,
+		oc_ctx->create_folder(oc_ctx, username, parentFolderID, fid,
+				      changeNumber, MAPIStoreURI, systemIdx));
 }
 
 /**
@@ -938,7 +1053,8 @@ _PUBLIC_ enum MAPISTATUS openchangedb_get_message_count(struct openchangedb_cont
 	OPENCHANGE_RETVAL_IF(!username, MAPI_E_INVALID_PARAMETER, NULL);
 	OPENCHANGE_RETVAL_IF(!RowCount, MAPI_E_INVALID_PARAMETER, NULL);
 
-	return oc_ctx->get_message_count(oc_ctx, username, fid, RowCount, fai);
+	return openchangedb_backend_done(oc_ctx,
+		oc_ctx->get_message_count(oc_ctx, username, fid, RowCount, fai));
 }
 
 /**
@@ -960,21 +1076,24 @@ _PUBLIC_ enum MAPISTATUS openchangedb_get_system_idx(struct openchangedb_context
 	OPENCHANGE_RETVAL_IF(!username, MAPI_E_INVALID_PARAMETER, NULL);
 	OPENCHANGE_RETVAL_IF(!system_idx_p, MAPI_E_INVALID_PARAMETER, NULL);
 
-	return oc_ctx->get_system_idx(oc_ctx, username, fid, system_idx_p);
+	return openchangedb_backend_done(oc_ctx,
+		oc_ctx->get_system_idx(oc_ctx, username, fid, system_idx_p));
 }
 
 _PUBLIC_ enum MAPISTATUS openchangedb_transaction_start(struct openchangedb_context *oc_ctx)
 {
 	OPENCHANGE_RETVAL_IF(!oc_ctx, MAPI_E_NOT_INITIALIZED, NULL);
 
-	return oc_ctx->transaction_start(oc_ctx);
+	return openchangedb_backend_done(oc_ctx,
+		oc_ctx->transaction_start(oc_ctx));
 }
 
 _PUBLIC_ enum MAPISTATUS openchangedb_transaction_commit(struct openchangedb_context *oc_ctx)
 {
 	OPENCHANGE_RETVAL_IF(!oc_ctx, MAPI_E_NOT_INITIALIZED, NULL);
 
-	return oc_ctx->transaction_commit(oc_ctx);
+	return openchangedb_backend_done(oc_ctx,
+		oc_ctx->transaction_commit(oc_ctx));
 }
 
 /**
@@ -995,7 +1114,8 @@ _PUBLIC_ enum MAPISTATUS openchangedb_get_new_public_folderID(struct openchanged
 	OPENCHANGE_RETVAL_IF(!username, MAPI_E_INVALID_PARAMETER, NULL);
 	OPENCHANGE_RETVAL_IF(!fid, MAPI_E_INVALID_PARAMETER, NULL);
 
-	return oc_ctx->get_new_public_folderID(oc_ctx, username, fid);
+	return openchangedb_backend_done(oc_ctx,
+		oc_ctx->get_new_public_folderID(oc_ctx, username, fid));
 }
 
 /**
@@ -1010,11 +1130,16 @@ _PUBLIC_ enum MAPISTATUS openchangedb_get_new_public_folderID(struct openchanged
 _PUBLIC_ bool openchangedb_is_public_folder_id(struct openchangedb_context *oc_ctx,
 					       uint64_t fid)
 {
+	bool	ret;
+
 	if (!oc_ctx) {
 		OC_DEBUG(0, "Bad parameters when calling openchangedb_is_public_folder_id");
 		return false;
 	}
-	return oc_ctx->is_public_folder_id(oc_ctx, fid);
+	ret = oc_ctx->is_public_folder_id(oc_ctx, fid);
+	openchangedb_backend_done(oc_ctx, MAPI_E_SUCCESS);
+
+	return ret;
 }
 
 /**
@@ -1037,7 +1162,8 @@ _PUBLIC_ enum MAPISTATUS openchangedb_get_indexing_url(struct openchangedb_conte
 	OPENCHANGE_RETVAL_IF(!username, MAPI_E_INVALID_PARAMETER, NULL);
 	OPENCHANGE_RETVAL_IF(!indexing_url, MAPI_E_INVALID_PARAMETER, NULL);
 
-	retval = oc_ctx->get_indexing_url(oc_ctx, username, indexing_url);
+	retval = openchangedb_backend_done(oc_ctx,
+		oc_ctx->get_indexing_url(oc_ctx, username, indexing_url));
 	OPENCHANGE_RETVAL_IF(retval != MAPI_E_SUCCESS, retval, NULL);
 
 	/* check indexing_url we are about to return */
@@ -1063,11 +1189,16 @@ _PUBLIC_ enum MAPISTATUS openchangedb_get_indexing_url(struct openchangedb_conte
 _PUBLIC_ bool openchangedb_set_locale(struct openchangedb_context *oc_ctx,
 				      const char *username, uint32_t lcid)
 {
+	bool	ret;
+
 	if (!oc_ctx || !username) {
 		OC_DEBUG(0, "Bad parameters when calling openchangedb_set_locale");
 		return false;
 	}
-	return oc_ctx->set_locale(oc_ctx, username, lcid);
+	ret = oc_ctx->set_locale(oc_ctx, username, lcid);
+	openchangedb_backend_done(oc_ctx, MAPI_E_SUCCESS);
+
+	return ret;
 }
 
 /**
@@ -1087,6 +1218,8 @@ _PUBLIC_ const char **openchangedb_get_folders_names(TALLOC_CTX *mem_ctx,
 						     const char *locale,
 						     const char *type)
 {
+	const char	**names;
+
 	if (!oc_ctx || !locale || !type) {
 		OC_DEBUG(0, "Bad parameters when calling openchangedb_get_folders_names");
 		return NULL;
@@ -1095,5 +1228,8 @@ _PUBLIC_ const char **openchangedb_get_folders_names(TALLOC_CTX *mem_ctx,
 		OC_DEBUG(0, "Bad type parameter (%s) for openchangedb_get_folders_names", type);
 		return NULL;
 	}
-	return oc_ctx->get_folders_names(mem_ctx, oc_ctx, locale, type);
+	names = oc_ctx->get_folders_names(mem_ctx, oc_ctx, locale, type);
+	openchangedb_backend_done(oc_ctx, MAPI_E_SUCCESS);
+
+	return names;
 }
@@ -61,8 +61,9 @@ enum MAPISTATUS openchangedb_message_create(TALLOC_CTX *mem_ctx,
 	OPENCHANGE_RETVAL_IF(!oc_ctx, MAPI_E_NOT_INITIALIZED, NULL);
 	OPENCHANGE_RETVAL_IF(!message_object, MAPI_E_NOT_INITIALIZED, NULL);
 
-	return oc_ctx->message_create(mem_ctx, oc_ctx, username, messageID,
-				      folderID, fai, message_object);
+	return openchangedb_backend_done(oc_ctx,
+		oc_ctx->message_create(mem_ctx, oc_ctx, username, messageID,
+				       folderID, fai, message_object));
 }
 
 /**
@@ -80,7 +81,8 @@ enum MAPISTATUS openchangedb_message_save(struct openchangedb_context *oc_ctx,
 	OPENCHANGE_RETVAL_IF(!oc_ctx, MAPI_E_NOT_INITIALIZED, NULL);
 	OPENCHANGE_RETVAL_IF(!msg, MAPI_E_NOT_INITIALIZED, NULL);
 
-	return oc_ctx->message_save(oc_ctx, msg, SaveFlags);
+	return openchangedb_backend_done(oc_ctx,
+		oc_ctx->message_save(oc_ctx, msg, SaveFlags));
 }
 
 /**
@@ -107,8 +109,9 @@ enum MAPISTATUS openchangedb_message_open(TALLOC_CTX *mem_ctx,
 	OPENCHANGE_RETVAL_IF(!oc_ctx, MAPI_E_NOT_INITIALIZED, NULL);
 	OPENCHANGE_RETVAL_IF(!message_object, MAPI_E_NOT_INITIALIZED, NULL);
 
-	return oc_ctx->message_open(mem_ctx, oc_ctx, username, messageID,
-				    folderID, message_object, msgp);
+	return openchangedb_backend_done(oc_ctx,
+		oc_ctx->message_open(mem_ctx, oc_ctx, username, messageID,
+				     folderID, message_object, msgp));
 }
 
 
@@ -132,8 +135,9 @@ enum MAPISTATUS openchangedb_message_get_property(TALLOC_CTX *mem_ctx,
 	OPENCHANGE_RETVAL_IF(!message_object, MAPI_E_NOT_INITIALIZED, NULL);
 	OPENCHANGE_RETVAL_IF(!data, MAPI_E_NOT_INITIALIZED, NULL);
 
-	return oc_ctx->message_get_property(mem_ctx, oc_ctx, message_object,
-					    proptag, data);
+	return openchangedb_backend_done(oc_ctx,
+		oc_ctx->message_get_property(mem_ctx, oc_ctx, message_object,
+					     proptag, data));
 }
 
 /**
@@ -156,6 +160,7 @@ enum MAPISTATUS openchangedb_message_set_properties(TALLOC_CTX *mem_ctx,
 	OPENCHANGE_RETVAL_IF(!message_object, MAPI_E_NOT_INITIALIZED, NULL);
 	OPENCHANGE_RETVAL_IF(!row, MAPI_E_NOT_INITIALIZED, NULL);
 
-	return oc_ctx->message_set_properties(mem_ctx, oc_ctx, message_object,
-					      row);
+	return openchangedb_backend_done(oc_ctx,
+		oc_ctx->message_set_properties(mem_ctx, oc_ctx, message_object,
+					       row));
 }
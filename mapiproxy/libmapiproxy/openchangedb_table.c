@@ -55,8 +55,9 @@ _PUBLIC_ enum MAPISTATUS openchangedb_table_init(TALLOC_CTX *mem_ctx,
 	MAPI_RETVAL_IF(!self, MAPI_E_NOT_INITIALIZED, NULL);
 	MAPI_RETVAL_IF(!table_object, MAPI_E_NOT_INITIALIZED, NULL);
 
-	return self->table_init(mem_ctx, self, username, table_type, folderID,
-				table_object);
+	return openchangedb_backend_done(self,
+		self->table_init(mem_ctx, self, username, table_type, folderID,
+				 table_object));
 }
 
 
@@ -76,7 +77,8 @@ _PUBLIC_ enum MAPISTATUS openchangedb_table_set_sort_order(struct openchangedb_c
 	MAPI_RETVAL_IF(!table_object, MAPI_E_NOT_INITIALIZED, NULL);
 	MAPI_RETVAL_IF(!lpSortCriteria, MAPI_E_INVALID_PARAMETER, NULL);
 
-	return self->table_set_sort_order(self, table_object, lpSortCriteria);
+	return openchangedb_backend_done(self,
+		self->table_set_sort_order(self, table_object, lpSortCriteria));
 }
 
 
@@ -88,7 +90,8 @@ _PUBLIC_ enum MAPISTATUS openchangedb_table_set_restrictions(struct openchangedb
 	MAPI_RETVAL_IF(!table_object, MAPI_E_NOT_INITIALIZED, NULL);
 	MAPI_RETVAL_IF(!res, MAPI_E_INVALID_PARAMETER, NULL);
 
-	return self->table_set_restrictions(self, table_object, res);
+	return openchangedb_backend_done(self,
+		self->table_set_restrictions(self, table_object, res));
 }
 
 _PUBLIC_ enum MAPISTATUS openchangedb_table_get_property(TALLOC_CTX *mem_ctx,
@@ -103,5 +106,6 @@ _PUBLIC_ enum MAPISTATUS openchangedb_table_get_property(TALLOC_CTX *mem_ctx,
 	OPENCHANGE_RETVAL_IF(!table_object, MAPI_E_NOT_INITIALIZED, NULL);
 	OPENCHANGE_RETVAL_IF(!data, MAPI_E_NOT_INITIALIZED, NULL);
 
-	return self->table_get_property(mem_ctx, self, table_object, proptag, pos, live_filtered, data);
+	return openchangedb_backend_done(self,
+		self->table_get_property(mem_ctx, self, table_object, proptag, pos, live_filtered, data));
 }
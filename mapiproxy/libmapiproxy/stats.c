@@ -0,0 +1,138 @@
+/*
+   MAPI Proxy
+
+   OpenChange Project
+
+   This program is free software; you can redistribute it and/or modify
+   it under the terms of the GNU General Public License as published by
+   the Free Software Foundation; either version 3 of the License, or
+   (at your option) any later version.
+
+   This program is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+   GNU General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "libmapi/libmapi.h"
+#include "libmapiproxy.h"
+#include "utils/dlinklist.h"
+
+#if defined(HAVE_PTHREADS)
+#include <pthread.h>
+#endif
+
+/**
+   \file stats.c
+
+   \brief Statistics of the subsystems of a process
+
+   Each subsystem keeping statistics (the openchangedb cache and
+   profiler, the MySQL pools, the FMID leases) registers the callbacks
+   writing them out and forgetting them. The server dumping its own
+   statistics goes through the registered ones afterwards, so a new
+   subsystem never has to be known by the server.
+ */
+
+static struct mapiproxy_stats {
+	struct mapiproxy_stats		*prev, *next;
+	const char			*name;
+	mapiproxy_stats_dump_fn		dump;
+	mapiproxy_stats_reset_fn	reset;
+} *stats_list = NULL;
+
+#if defined(HAVE_PTHREADS)
+static pthread_mutex_t	stats_lock = PTHREAD_MUTEX_INITIALIZER;
+#define	STATS_LOCK()	pthread_mutex_lock(&stats_lock)
+#define	STATS_UNLOCK()	pthread_mutex_unlock(&stats_lock)
+#else
+#define	STATS_LOCK()
+#define	STATS_UNLOCK()
+#endif
+
+/**
+   \details Register the statistics of a subsystem. Registering the
+   same dump callback again does nothing, so subsystems can register
+   every time they are initialized.
+
+   Callbacks are called with the registry locked: they must not
+   register statistics themselves, nor be registered while holding a
+   lock they take.
+
+   \param name the name of the subsystem
+   \param dump the callback writing the statistics into a file
+   \param reset the callback forgetting the statistics, NULL if they
+   can't be reset
+
+   \return true on success, otherwise false
+ */
+_PUBLIC_ bool mapiproxy_stats_register(const char *name,
+				       mapiproxy_stats_dump_fn dump,
+				       mapiproxy_stats_reset_fn reset)
+{
+	struct mapiproxy_stats	*stats;
+
+	if (!name || !dump) return false;
+
+	STATS_LOCK();
+	for (stats = stats_list; stats; stats = stats->next) {
+		if (stats->dump == dump) {
+			STATS_UNLOCK();
+			return true;
+		}
+	}
+
+	// This entries live as long as the process
+	stats = talloc_zero(talloc_autofree_context(), struct mapiproxy_stats);
+	if (!stats) {
+		STATS_UNLOCK();
+		return false;
+	}
+	stats->name = talloc_strdup(stats, name);
+	stats->dump = dump;
+	stats->reset = reset;
+	DLIST_ADD_END(stats_list, stats, struct mapiproxy_stats *);
+	STATS_UNLOCK();
+
+	OC_DEBUG(5, "MAPIPROXY statistics of '%s' registered", name);
+
+	return true;
+}
+
+/**
+   \details Write the statistics of every registered subsystem into a
+   file, in their registration order
+
+   \param fp the file to write to
+ */
+_PUBLIC_ void mapiproxy_stats_dump(FILE *fp)
+{
+	struct mapiproxy_stats	*stats;
+
+	if (!fp) return;
+
+	STATS_LOCK();
+	for (stats = stats_list; stats; stats = stats->next) {
+		stats->dump(fp);
+	}
+	STATS_UNLOCK();
+}
+
+/**
+   \details Forget the statistics of every registered subsystem
+ */
+_PUBLIC_ void mapiproxy_stats_reset(void)
+{
+	struct mapiproxy_stats	*stats;
+
+	STATS_LOCK();
+	for (stats = stats_list; stats; stats = stats->next) {
+		if (stats->reset) {
+			stats->reset();
+		}
+	}
+	STATS_UNLOCK();
+}
@@ -37,7 +37,9 @@
 #include <talloc.h>
 #include <libmemcached/memcached.h>
 
-#define MYSQL(context)	((MYSQL *)context->data)
+/* Each indexing context serves a single user, it is the session */
+#define MYSQL(context)		mysql_rw_writer((struct mysql_rw *)(context)->data, NULL)
+#define MYSQL_READ(context)	mysql_rw_reader((struct mysql_rw *)(context)->data, NULL)
 
 
 /**
@@ -126,7 +128,8 @@ static memcached_st *_memcached_setup(struct indexing_context *ictx,
 			      "WHERE username = '%s' AND soft_deleted = '%d'",
 			      _sql(mem_ctx, username), 0);
 
-	mret = select_without_fetch(MYSQL(ictx), sql, &res);
+	/* The cache outlives the replication lag, fill it from the primary */
+	mret = select_without_fetch(mysql_rw_primary(ictx->data), sql, &res);
 	if (mret != MYSQL_SUCCESS) {
 		talloc_free(mem_ctx);
 		return NULL;
@@ -345,10 +348,9 @@ static enum mapistore_error mysql_search_existing_fmid(struct indexing_context *
 						       const char *username,
 						       uint64_t fmid, bool *is_soft_deleted)
 {
-	int		ret;
-	uint64_t	soft_deleted;
-	char		*sql;
-	TALLOC_CTX	*mem_ctx;
+	int			ret;
+	struct stmt_value	params[] = { STMT_STRING_VALUE(username), STMT_UINT_VALUE(fmid) };
+	struct stmt_value	result = STMT_UINT_VALUE(0);
 
 	/* Sanity */
 	MAPISTORE_RETVAL_IF(!ictx, MAPISTORE_ERR_NOT_INITIALIZED, NULL);
@@ -356,16 +358,13 @@ static enum mapistore_error mysql_search_existing_fmid(struct indexing_context *
 	MAPISTORE_RETVAL_IF(!fmid, MAPISTORE_ERR_INVALID_PARAMETER, NULL);
 	MAPISTORE_RETVAL_IF(!is_soft_deleted, MAPISTORE_ERR_INVALID_PARAMETER, NULL);
 
-	mem_ctx = talloc_new(NULL);
-	sql = talloc_asprintf(mem_ctx,
-		"SELECT soft_deleted FROM %s "
-		"WHERE username = '%s' AND fmid = '%"PRIu64"'",
-		INDEXING_TABLE, _sql(mem_ctx, username), fmid);
-	ret = select_first_uint(MYSQL(ictx), sql, &soft_deleted);
-	MAPI_RETVAL_IF(ret != MYSQL_SUCCESS, MAPISTORE_ERR_EXIST, mem_ctx);
+	ret = stmt_select_first(NULL, MYSQL(ictx),
+		"SELECT soft_deleted FROM "INDEXING_TABLE" "
+		"WHERE username = ? AND fmid = ?",
+		params, 2, &result, 1);
+	MAPI_RETVAL_IF(ret != MYSQL_SUCCESS, MAPISTORE_ERR_EXIST, NULL);
 
-	*is_soft_deleted = (soft_deleted == 1);
-	talloc_free(mem_ctx);
+	*is_soft_deleted = (result.n == 1);
 	return MAPISTORE_SUCCESS;
 }
 
@@ -389,10 +388,10 @@ static enum mapistore_error mysql_record_add(struct indexing_context *ictx,
 					   const char *mapistore_URI)
 {
 	enum mapistore_error	retval;
-	TALLOC_CTX		*mem_ctx;
 	int			ret;
 	bool			IsSoftDeleted = false;
-	char			*sql;
+	struct stmt_value	params[] = { STMT_STRING_VALUE(username), STMT_UINT_VALUE(fmid),
+					     STMT_STRING_VALUE(mapistore_URI) };
 
 	/* Sanity checks */
 	MAPISTORE_RETVAL_IF(!ictx, MAPISTORE_ERR_NOT_INITIALIZED, NULL);
@@ -404,16 +403,12 @@ static enum mapistore_error mysql_record_add(struct indexing_context *ictx,
 	ret = mysql_search_existing_fmid(ictx, username, fmid, &IsSoftDeleted);
 	MAPISTORE_RETVAL_IF(ret == MAPISTORE_SUCCESS, MAPISTORE_ERR_EXIST, NULL);
 
-	mem_ctx = talloc_new(NULL);
-	sql = talloc_asprintf(mem_ctx,
-		"INSERT INTO %s "
+	ret = stmt_execute(MYSQL(ictx),
+		"INSERT INTO "INDEXING_TABLE" "
 		"(username, fmid, url, soft_deleted) "
-		"VALUES ('%s', '%"PRIu64"', '%s', '%d')",
-		INDEXING_TABLE, _sql(mem_ctx, username), fmid,
-		_sql(mem_ctx, mapistore_URI), 0);
-
-	ret = execute_query(MYSQL(ictx), sql);
-	MAPISTORE_RETVAL_IF(ret != MYSQL_SUCCESS, MAPISTORE_ERR_DATABASE_OPS, mem_ctx);
+		"VALUES (?, ?, ?, 0)",
+		params, 3, NULL);
+	MAPISTORE_RETVAL_IF(ret != MYSQL_SUCCESS, MAPISTORE_ERR_DATABASE_OPS, NULL);
 
 	retval = _memcached_add_record(ictx, mapistore_URI, fmid);
 	if (retval != MAPISTORE_SUCCESS) {
@@ -421,7 +416,6 @@ static enum mapistore_error mysql_record_add(struct indexing_context *ictx,
 			 mapistore_URI, fmid, mapistore_errstr(retval));
 	}
 
-	talloc_free(mem_ctx);
 	return MAPISTORE_SUCCESS;
 }
 
@@ -446,8 +440,9 @@ static enum mapistore_error mysql_record_update(struct indexing_context *ictx,
 {
 	enum mapistore_error	retval;
 	int			ret;
-	char			*sql;
-	TALLOC_CTX		*mem_ctx;
+	uint64_t		affected_rows = 0;
+	struct stmt_value	params[] = { STMT_STRING_VALUE(mapistore_URI), STMT_STRING_VALUE(username),
+					     STMT_UINT_VALUE(fmid) };
 
 	/* Sanity checks */
 	MAPISTORE_RETVAL_IF(!ictx, MAPISTORE_ERR_NOT_INITIALIZED, NULL);
@@ -455,24 +450,18 @@ static enum mapistore_error mysql_record_update(struct indexing_context *ictx,
 	MAPISTORE_RETVAL_IF(!fmid, MAPISTORE_ERR_INVALID_PARAMETER, NULL);
 	MAPISTORE_RETVAL_IF(!mapistore_URI, MAPISTORE_ERR_INVALID_PARAMETER, NULL);
 
-	mem_ctx = talloc_new(NULL);
-	MAPISTORE_RETVAL_IF(!mem_ctx, MAPISTORE_ERR_NO_MEMORY, NULL);
-
-	sql = talloc_asprintf(mem_ctx,
-		"UPDATE %s "
-		"SET url = '%s' "
-		"WHERE username = '%s' AND fmid = '%"PRIu64"'",
-		INDEXING_TABLE, _sql(mem_ctx, mapistore_URI), _sql(mem_ctx, username), fmid);
-	MAPISTORE_RETVAL_IF(!sql, MAPISTORE_ERR_NO_MEMORY, mem_ctx);
-
-	ret = execute_query(MYSQL(ictx), sql);
-	MAPISTORE_RETVAL_IF(ret != MYSQL_SUCCESS, MAPISTORE_ERR_DATABASE_OPS, mem_ctx);
+	ret = stmt_execute(MYSQL(ictx),
+		"UPDATE "INDEXING_TABLE" "
+		"SET url = ? "
+		"WHERE username = ? AND fmid = ?",
+		params, 3, &affected_rows);
+	MAPISTORE_RETVAL_IF(ret != MYSQL_SUCCESS, MAPISTORE_ERR_DATABASE_OPS, NULL);
 
 	/* did we updated anything? */
-	if (mysql_affected_rows(MYSQL(ictx)) == 0) {
+	if (affected_rows == 0) {
 		bool _is_soft_deleted;
 		ret = mysql_search_existing_fmid(ictx, username, fmid, &_is_soft_deleted);
-		MAPISTORE_RETVAL_IF(ret != MYSQL_SUCCESS, MAPISTORE_ERR_NOT_FOUND, mem_ctx);
+		MAPISTORE_RETVAL_IF(ret != MYSQL_SUCCESS, MAPISTORE_ERR_NOT_FOUND, NULL);
 	}
 
 	retval = _memcached_update_record(ictx, mapistore_URI, fmid);
@@ -481,7 +470,6 @@ static enum mapistore_error mysql_record_update(struct indexing_context *ictx,
 			 mapistore_URI, fmid, mapistore_errstr(retval));
 	}
 
-	talloc_free(mem_ctx);
 	return MAPISTORE_SUCCESS;
 }
 
@@ -507,10 +495,9 @@ static enum mapistore_error mysql_record_get_uri(struct indexing_context *ictx,
 						 char **urip,
 						 bool *soft_deletedp)
 {
-	int		ret;
-	char		*sql;
-	MYSQL_RES	*res = NULL;
-	MYSQL_ROW	row;
+	int			ret;
+	struct stmt_value	params[] = { STMT_STRING_VALUE(username), STMT_UINT_VALUE(fmid) };
+	struct stmt_value	results[] = { STMT_STRING_VALUE(NULL), STMT_UINT_VALUE(0) };
 
 	/* Sanity checks */
 	MAPISTORE_RETVAL_IF(!ictx, MAPISTORE_ERR_NOT_INITIALIZED, NULL);
@@ -519,24 +506,15 @@ static enum mapistore_error mysql_record_get_uri(struct indexing_context *ictx,
 	MAPISTORE_RETVAL_IF(!urip, MAPISTORE_ERR_INVALID_PARAMETER, NULL);
 	MAPISTORE_RETVAL_IF(!soft_deletedp, MAPISTORE_ERR_INVALID_PARAMETER, NULL);
 
+	ret = stmt_select_first(mem_ctx, MYSQL_READ(ictx),
+		"SELECT url, soft_deleted FROM "INDEXING_TABLE" "
+		"WHERE username = ? AND fmid = ?",
+		params, 2, results, 2);
+	MAPISTORE_RETVAL_IF(ret == MYSQL_NOT_FOUND, MAPISTORE_ERR_NOT_FOUND, NULL);
+	MAPISTORE_RETVAL_IF(ret != MYSQL_SUCCESS, MAPISTORE_ERR_DATABASE_OPS, NULL);
 
-	sql = talloc_asprintf(mem_ctx,
-		"SELECT url, soft_deleted FROM %s "
-		"WHERE username = '%s' AND fmid = '%"PRIu64"'",
-		INDEXING_TABLE, _sql(mem_ctx, username), fmid);
-	MAPISTORE_RETVAL_IF(!sql, MAPISTORE_ERR_NO_MEMORY, NULL);
-
-	ret = select_without_fetch(MYSQL(ictx), sql, &res);
-	MAPISTORE_RETVAL_IF(ret == MYSQL_NOT_FOUND, MAPISTORE_ERR_NOT_FOUND, sql);
-	MAPISTORE_RETVAL_IF(ret != MYSQL_SUCCESS, MAPISTORE_ERR_DATABASE_OPS, sql);
-
-	row = mysql_fetch_row(res);
-
-	*urip = talloc_strdup(mem_ctx, row[0]);
-	*soft_deletedp = strtoull(row[1], NULL, 0) == 1;
-
-	mysql_free_result(res);
-	talloc_free(sql);
+	*urip = (char *) results[0].s;
+	*soft_deletedp = results[1].n == 1;
 
 	return MAPISTORE_SUCCESS;
 }
@@ -642,11 +620,11 @@ static enum mapistore_error mysql_record_get_fmid(struct indexing_context *ictx,
 {
 	enum mapistore_error	retval;
 	enum MYSQLRESULT	ret;
-	char			*sql, *uri_like;
-	MYSQL_RES		*res;
-	MYSQL_ROW		row;
+	char			*uri_like = NULL;
 	TALLOC_CTX		*mem_ctx;
 	uint64_t		fmid = 0;
+	struct stmt_value	params[2];
+	struct stmt_value	results[] = { STMT_UINT_VALUE(0), STMT_UINT_VALUE(0) };
 
 	// Sanity checks
 	MAPISTORE_RETVAL_IF(!ictx, MAPISTORE_ERR_NOT_INITIALIZED, NULL);
@@ -664,32 +642,475 @@ static enum mapistore_error mysql_record_get_fmid(struct indexing_context *ictx,
 
 	mem_ctx = talloc_named(NULL, 0, "mysql_record_get_fmid");
 
-	sql = talloc_asprintf(mem_ctx,
-		"SELECT fmid, soft_deleted FROM "INDEXING_TABLE" "
-		"WHERE username = '%s'", _sql(mem_ctx, username));
-
+	params[0] = (struct stmt_value) STMT_STRING_VALUE(username);
 	if (partial) {
 		uri_like = talloc_strdup(mem_ctx, uri);
+		MAPISTORE_RETVAL_IF(!uri_like, MAPISTORE_ERR_NO_MEMORY, mem_ctx);
 		string_replace(uri_like, '*', '%');
-		sql = talloc_asprintf_append(sql, " AND url LIKE '%s'",
-					     _sql(mem_ctx, uri_like));
+		params[1] = (struct stmt_value) STMT_STRING_VALUE(uri_like);
+		ret = stmt_select_first(mem_ctx, MYSQL_READ(ictx),
+			"SELECT fmid, soft_deleted FROM "INDEXING_TABLE" "
+			"WHERE username = ? AND url LIKE ?",
+			params, 2, results, 2);
 	} else {
-		sql = talloc_asprintf_append(sql, " AND url = '%s'",
-					     _sql(mem_ctx, uri));
+		params[1] = (struct stmt_value) STMT_STRING_VALUE(uri);
+		ret = stmt_select_first(mem_ctx, MYSQL_READ(ictx),
+			"SELECT fmid, soft_deleted FROM "INDEXING_TABLE" "
+			"WHERE username = ? AND url = ?",
+			params, 2, results, 2);
 	}
-
-	ret = select_without_fetch(MYSQL(ictx), sql, &res);
 	MAPISTORE_RETVAL_IF(ret == MYSQL_NOT_FOUND, MAPISTORE_ERR_NOT_FOUND, mem_ctx);
 	MAPISTORE_RETVAL_IF(ret != MYSQL_SUCCESS, MAPISTORE_ERR_DATABASE_OPS, mem_ctx);
 
-	row = mysql_fetch_row(res);
+	*fmidp = results[0].n;
+	*soft_deletedp = results[1].n == 1;
 
-	*fmidp = strtoull(row[0], NULL, 0);
-	*soft_deletedp = strtoull(row[1], NULL, 0) == 1;
+	talloc_free(mem_ctx);
+
+	return MAPISTORE_SUCCESS;
+}
+
+
+/**
+   \details Build the SQL list of a set of fmids, for use within IN ()
+
+   \param mem_ctx pointer to the memory context
+   \param count the number of fmids
+   \param fmids array of count fmids
+
+   \return String allocated with TALLOC on success, otherwise NULL
+ */
+static char *_sql_fmid_list(TALLOC_CTX *mem_ctx, uint32_t count, const uint64_t *fmids)
+{
+	char		*list;
+	uint32_t	i;
+
+	list = talloc_strdup(mem_ctx, "");
+	for (i = 0; list && i < count; i++) {
+		list = talloc_asprintf_append(list, "%s'%"PRIu64"'", i ? "," : "", fmids[i]);
+	}
+
+	return list;
+}
+
+
+/**
+  \details Adds a set of FMIDs and their related URLs in the indexing
+  database with one query per INDEXING_BATCH_SIZE records. Either all
+  records are added or none.
+
+  \param ictx valid pointer to indexing context
+  \param username samAccountName for current user
+  \param count number of records to add
+  \param fmids array of count FMIDs to record
+  \param mapistore_URIs array of count mapistore URIs to associate with fmids
+
+  \return MAPISTORE_SUCCESS on success,
+	  MAPISTORE_ERR_EXIST if one of the entries already exists
+	  MAPISTORE_ERR_NOT_INITIALIZED if ictx pointer is invalid (NULL)
+	  MAPISTORE_ERR_INVALID_PARAMETER in case other parameters are not valid
+	  MAPISTORE_ERR_DATABASE_OPS in case of MySQL error
+ */
+static enum mapistore_error mysql_record_add_multi(struct indexing_context *ictx,
+						   const char *username,
+						   uint32_t count,
+						   const uint64_t *fmids,
+						   const char **mapistore_URIs)
+{
+	enum mapistore_error	retval = MAPISTORE_SUCCESS;
+	enum MYSQLRESULT	ret;
+	TALLOC_CTX		*mem_ctx;
+	MYSQL_RES		*res;
+	char			*sql;
+	uint32_t		i;
+	uint32_t		j;
+	uint32_t		n;
+
+	/* Sanity checks */
+	MAPISTORE_RETVAL_IF(!ictx, MAPISTORE_ERR_NOT_INITIALIZED, NULL);
+	MAPISTORE_RETVAL_IF(!username, MAPISTORE_ERR_INVALID_PARAMETER, NULL);
+	MAPISTORE_RETVAL_IF(!fmids, MAPISTORE_ERR_INVALID_PARAMETER, NULL);
+	MAPISTORE_RETVAL_IF(!mapistore_URIs, MAPISTORE_ERR_INVALID_PARAMETER, NULL);
+	for (i = 0; i < count; i++) {
+		MAPISTORE_RETVAL_IF(!fmids[i], MAPISTORE_ERR_INVALID_PARAMETER, NULL);
+		MAPISTORE_RETVAL_IF(!mapistore_URIs[i], MAPISTORE_ERR_INVALID_PARAMETER, NULL);
+	}
+	MAPISTORE_RETVAL_IF(!count, MAPISTORE_SUCCESS, NULL);
+
+	mem_ctx = talloc_named(NULL, 0, "mysql_record_add_multi");
+	MAPISTORE_RETVAL_IF(!mem_ctx, MAPISTORE_ERR_NO_MEMORY, NULL);
+
+	ret = execute_query(MYSQL(ictx), "START TRANSACTION");
+	MAPISTORE_RETVAL_IF(ret != MYSQL_SUCCESS, MAPISTORE_ERR_DATABASE_OPS, mem_ctx);
+
+	for (i = 0; i < count && retval == MAPISTORE_SUCCESS; i += n) {
+		n = (count - i > INDEXING_BATCH_SIZE) ? INDEXING_BATCH_SIZE : count - i;
+
+		/* Check none of the fids/mids already exists within the database */
+		sql = talloc_asprintf(mem_ctx,
+			"SELECT fmid FROM %s "
+			"WHERE username = '%s' AND fmid IN (%s)",
+			INDEXING_TABLE, _sql(mem_ctx, username),
+			_sql_fmid_list(mem_ctx, n, fmids + i));
+		ret = select_without_fetch(MYSQL(ictx), sql, &res);
+		if (ret == MYSQL_SUCCESS) {
+			mysql_free_result(res);
+			retval = MAPISTORE_ERR_EXIST;
+			break;
+		} else if (ret != MYSQL_NOT_FOUND) {
+			retval = MAPISTORE_ERR_DATABASE_OPS;
+			break;
+		}
+
+		sql = talloc_asprintf(mem_ctx,
+			"INSERT INTO %s "
+			"(username, fmid, url, soft_deleted) VALUES ",
+			INDEXING_TABLE);
+		for (j = 0; sql && j < n; j++) {
+			sql = talloc_asprintf_append(sql, "%s('%s', '%"PRIu64"', '%s', '%d')",
+						     j ? "," : "", _sql(mem_ctx, username),
+						     fmids[i + j], _sql(mem_ctx, mapistore_URIs[i + j]), 0);
+		}
+		if (!sql) {
+			retval = MAPISTORE_ERR_NO_MEMORY;
+			break;
+		}
+
+		ret = execute_query(MYSQL(ictx), sql);
+		if (ret != MYSQL_SUCCESS) {
+			retval = MAPISTORE_ERR_DATABASE_OPS;
+		}
+	}
+
+	if (retval != MAPISTORE_SUCCESS) {
+		execute_query(MYSQL(ictx), "ROLLBACK");
+		talloc_free(mem_ctx);
+		return retval;
+	}
+
+	ret = execute_query(MYSQL(ictx), "COMMIT");
+	MAPISTORE_RETVAL_IF(ret != MYSQL_SUCCESS, MAPISTORE_ERR_DATABASE_OPS, mem_ctx);
+
+	for (i = 0; i < count; i++) {
+		retval = _memcached_add_record(ictx, mapistore_URIs[i], fmids[i]);
+		if (retval != MAPISTORE_SUCCESS) {
+			OC_DEBUG(0, "[indexing] Failed to add record `%s: %"PRIu64"` on memcached (%s)",
+				 mapistore_URIs[i], fmids[i], mapistore_errstr(retval));
+		}
+	}
 
-	mysql_free_result(res);
 	talloc_free(mem_ctx);
+	return MAPISTORE_SUCCESS;
+}
+
+
+/**
+  \details Delete a set of FMID mappings from database with one query
+  per INDEXING_BATCH_SIZE records. FMIDs which are not found are ignored.
+
+  \param ictx valid pointer to indexing context
+  \param username samAccountName for current user
+  \param count number of FMIDs to delete
+  \param fmids array of count FMIDs to delete
+  \param flags MAPISTORE_SOFT_DELETE - soft delete the entries,
+	       MAPISTORE_PERMANENT_DELETE - permanently delete
 
+  \return MAPISTORE_SUCCESS on success
+	  MAPISTORE_ERR_NOT_INITIALIZED if ictx pointer is invalid (NULL)
+	  MAPISTORE_ERR_INVALID_PARAMETER in case other parameters are not valid
+	  MAPISTORE_ERR_DATABASE_OPS in case of MySQL error
+ */
+static enum mapistore_error mysql_record_del_multi(struct indexing_context *ictx,
+						   const char *username,
+						   uint32_t count,
+						   const uint64_t *fmids,
+						   uint8_t flags)
+{
+	enum mapistore_error	retval;
+	enum MYSQLRESULT	ret;
+	TALLOC_CTX		*mem_ctx;
+	MYSQL_RES		*res;
+	MYSQL_ROW		row;
+	char			*sql;
+	char			*list;
+	char			**uris;
+	uint32_t		uris_count;
+	uint32_t		i;
+	uint32_t		j;
+	uint32_t		n;
+
+	/* Sanity checks */
+	MAPISTORE_RETVAL_IF(!ictx, MAPISTORE_ERR_NOT_INITIALIZED, NULL);
+	MAPISTORE_RETVAL_IF(!username, MAPISTORE_ERR_INVALID_PARAMETER, NULL);
+	MAPISTORE_RETVAL_IF(!fmids, MAPISTORE_ERR_INVALID_PARAMETER, NULL);
+	MAPISTORE_RETVAL_IF(flags != MAPISTORE_SOFT_DELETE && flags != MAPISTORE_PERMANENT_DELETE,
+			    MAPISTORE_ERR_INVALID_PARAMETER, NULL);
+	MAPISTORE_RETVAL_IF(!count, MAPISTORE_SUCCESS, NULL);
+
+	mem_ctx = talloc_named(NULL, 0, "mysql_record_del_multi");
+	MAPISTORE_RETVAL_IF(!mem_ctx, MAPISTORE_ERR_NO_MEMORY, NULL);
+
+	for (i = 0; i < count; i += n) {
+		n = (count - i > INDEXING_BATCH_SIZE) ? INDEXING_BATCH_SIZE : count - i;
+		list = _sql_fmid_list(mem_ctx, n, fmids + i);
+		MAPISTORE_RETVAL_IF(!list, MAPISTORE_ERR_NO_MEMORY, mem_ctx);
+
+		/* Retrieve the URIs to remove from the cache */
+		sql = talloc_asprintf(mem_ctx,
+			"SELECT url FROM %s "
+			"WHERE username = '%s' AND fmid IN (%s)%s",
+			INDEXING_TABLE, _sql(mem_ctx, username), list,
+			(flags == MAPISTORE_SOFT_DELETE) ? " AND soft_deleted = 0" : "");
+		ret = select_without_fetch(MYSQL(ictx), sql, &res);
+		if (ret == MYSQL_NOT_FOUND) continue;
+		MAPISTORE_RETVAL_IF(ret != MYSQL_SUCCESS, MAPISTORE_ERR_DATABASE_OPS, mem_ctx);
+
+		uris_count = mysql_num_rows(res);
+		uris = talloc_array(mem_ctx, char *, uris_count);
+		if (!uris) {
+			mysql_free_result(res);
+			talloc_free(mem_ctx);
+			return MAPISTORE_ERR_NO_MEMORY;
+		}
+		for (j = 0; j < uris_count; j++) {
+			row = mysql_fetch_row(res);
+			uris[j] = talloc_strdup(uris, row[0]);
+		}
+		mysql_free_result(res);
+
+		if (flags == MAPISTORE_SOFT_DELETE) {
+			sql = talloc_asprintf(mem_ctx,
+				"UPDATE %s "
+				"SET soft_deleted=1 "
+				"WHERE username = '%s' AND fmid IN (%s)",
+				INDEXING_TABLE, _sql(mem_ctx, username), list);
+		} else {
+			sql = talloc_asprintf(mem_ctx,
+				"DELETE FROM %s "
+				"WHERE username = '%s' AND fmid IN (%s)",
+				INDEXING_TABLE, _sql(mem_ctx, username), list);
+		}
+		ret = execute_query(MYSQL(ictx), sql);
+		MAPISTORE_RETVAL_IF(ret != MYSQL_SUCCESS, MAPISTORE_ERR_DATABASE_OPS, mem_ctx);
+
+		for (j = 0; j < uris_count; j++) {
+			retval = _memcached_delete_record(ictx, uris[j]);
+			if (retval != MAPISTORE_SUCCESS) {
+				OC_DEBUG(0, "[indexing] Failed to delete record `%s` on memcached (%s)",
+					 uris[j], mapistore_errstr(retval));
+			}
+		}
+		talloc_free(uris);
+	}
+
+	talloc_free(mem_ctx);
+	return MAPISTORE_SUCCESS;
+}
+
+
+/**
+  \details Get the mapistore URIs of a set of FMIDs with one query per
+  INDEXING_BATCH_SIZE records.
+
+  \param ictx valid pointer to indexing context
+  \param username samAccountName for current user
+  \param mem_ctx TALLOC_CTX to allocate mapistore URIs
+  \param count number of FMIDs to search for
+  \param fmids array of count FMIDs to search for
+  \param uris array of count URIs to fill, NULL if the FMID is not found
+  \param soft_deleted array of count soft deleted states to fill
+
+  \return MAPISTORE_SUCCESS on success
+	  MAPISTORE_ERR_NOT_INITIALIZED if ictx pointer is invalid (NULL)
+	  MAPISTORE_ERR_INVALID_PARAMETER in case other parameters are not valid
+	  MAPISTORE_ERR_DATABASE_OPS in case of MySQL error
+ */
+static enum mapistore_error mysql_record_get_uri_multi(struct indexing_context *ictx,
+						       const char *username,
+						       TALLOC_CTX *mem_ctx,
+						       uint32_t count,
+						       const uint64_t *fmids,
+						       char **uris,
+						       bool *soft_deleted)
+{
+	enum MYSQLRESULT	ret;
+	TALLOC_CTX		*local_mem_ctx;
+	MYSQL_RES		*res;
+	MYSQL_ROW		row;
+	char			*sql;
+	uint64_t		fmid;
+	uint32_t		i;
+	uint32_t		j;
+	uint32_t		n;
+
+	/* Sanity checks */
+	MAPISTORE_RETVAL_IF(!ictx, MAPISTORE_ERR_NOT_INITIALIZED, NULL);
+	MAPISTORE_RETVAL_IF(!username, MAPISTORE_ERR_INVALID_PARAMETER, NULL);
+	MAPISTORE_RETVAL_IF(!fmids, MAPISTORE_ERR_INVALID_PARAMETER, NULL);
+	MAPISTORE_RETVAL_IF(!uris, MAPISTORE_ERR_INVALID_PARAMETER, NULL);
+	MAPISTORE_RETVAL_IF(!soft_deleted, MAPISTORE_ERR_INVALID_PARAMETER, NULL);
+
+	for (i = 0; i < count; i++) {
+		uris[i] = NULL;
+		soft_deleted[i] = false;
+	}
+
+	local_mem_ctx = talloc_named(NULL, 0, "mysql_record_get_uri_multi");
+	MAPISTORE_RETVAL_IF(!local_mem_ctx, MAPISTORE_ERR_NO_MEMORY, NULL);
+
+	for (i = 0; i < count; i += n) {
+		n = (count - i > INDEXING_BATCH_SIZE) ? INDEXING_BATCH_SIZE : count - i;
+
+		sql = talloc_asprintf(local_mem_ctx,
+			"SELECT fmid, url, soft_deleted FROM %s "
+			"WHERE username = '%s' AND fmid IN (%s)",
+			INDEXING_TABLE, _sql(local_mem_ctx, username),
+			_sql_fmid_list(local_mem_ctx, n, fmids + i));
+		ret = select_without_fetch(MYSQL_READ(ictx), sql, &res);
+		if (ret == MYSQL_NOT_FOUND) continue;
+		MAPISTORE_RETVAL_IF(ret != MYSQL_SUCCESS, MAPISTORE_ERR_DATABASE_OPS, local_mem_ctx);
+
+		while ((row = mysql_fetch_row(res))) {
+			fmid = strtoull(row[0], NULL, 0);
+			for (j = i; j < i + n; j++) {
+				if (fmids[j] != fmid || uris[j]) continue;
+				uris[j] = talloc_strdup(mem_ctx, row[1]);
+				soft_deleted[j] = strtoull(row[2], NULL, 0) == 1;
+			}
+		}
+		mysql_free_result(res);
+	}
+
+	talloc_free(local_mem_ctx);
+	return MAPISTORE_SUCCESS;
+}
+
+
+/**
+  \details Get the FMIDs of a set of mapistore URIs. The cache is
+  queried with a single multi-get, then the missing URIs are searched
+  with one query per INDEXING_BATCH_SIZE records.
+
+  \param ictx valid pointer to indexing context
+  \param username samAccountName for current user
+  \param count number of URIs to search for
+  \param uris array of count mapistore URIs to search for (no pattern)
+  \param fmids array of count FMIDs to fill, 0 if the URI is not found
+  \param soft_deleted array of count soft deleted states to fill
+
+  \return MAPISTORE_SUCCESS on success
+	  MAPISTORE_ERR_NOT_INITIALIZED if ictx pointer is invalid (NULL)
+	  MAPISTORE_ERR_INVALID_PARAMETER in case other parameters are not valid
+	  MAPISTORE_ERR_DATABASE_OPS in case of MySQL error
+ */
+static enum mapistore_error mysql_record_get_fmid_multi(struct indexing_context *ictx,
+							const char *username,
+							uint32_t count,
+							const char **uris,
+							uint64_t *fmids,
+							bool *soft_deleted)
+{
+	enum MYSQLRESULT	ret;
+	TALLOC_CTX		*mem_ctx;
+	MYSQL_RES		*res;
+	MYSQL_ROW		row;
+	memcached_return_t	rc;
+	memcached_result_st	*result;
+	char			**keys;
+	size_t			*keys_len;
+	uint32_t		*missing;
+	uint32_t		missing_count = 0;
+	uint64_t		fmid;
+	char			*sql;
+	char			*value;
+	uint32_t		i;
+	uint32_t		j;
+	uint32_t		n;
+
+	/* Sanity checks */
+	MAPISTORE_RETVAL_IF(!ictx, MAPISTORE_ERR_NOT_INITIALIZED, NULL);
+	MAPISTORE_RETVAL_IF(!username, MAPISTORE_ERR_INVALID_PARAMETER, NULL);
+	MAPISTORE_RETVAL_IF(!uris, MAPISTORE_ERR_INVALID_PARAMETER, NULL);
+	MAPISTORE_RETVAL_IF(!fmids, MAPISTORE_ERR_INVALID_PARAMETER, NULL);
+	MAPISTORE_RETVAL_IF(!soft_deleted, MAPISTORE_ERR_INVALID_PARAMETER, NULL);
+	for (i = 0; i < count; i++) {
+		MAPISTORE_RETVAL_IF(!uris[i], MAPISTORE_ERR_INVALID_PARAMETER, NULL);
+		fmids[i] = 0;
+		soft_deleted[i] = false;
+	}
+	MAPISTORE_RETVAL_IF(!count, MAPISTORE_SUCCESS, NULL);
+
+	mem_ctx = talloc_named(NULL, 0, "mysql_record_get_fmid_multi");
+	MAPISTORE_RETVAL_IF(!mem_ctx, MAPISTORE_ERR_NO_MEMORY, NULL);
+
+	/* Step 1. Fetch all the cached records at once */
+	if (ictx->cache) {
+		keys = talloc_array(mem_ctx, char *, count);
+		keys_len = talloc_array(mem_ctx, size_t, count);
+		MAPISTORE_RETVAL_IF(!keys || !keys_len, MAPISTORE_ERR_NO_MEMORY, mem_ctx);
+		for (i = 0; i < count; i++) {
+			keys[i] = _memcached_gen_key(keys, uris[i]);
+			MAPISTORE_RETVAL_IF(!keys[i], MAPISTORE_ERR_NO_MEMORY, mem_ctx);
+			keys_len[i] = strlen(keys[i]);
+		}
+
+		rc = memcached_mget((memcached_st *)ictx->cache, (const char * const *)keys, keys_len, count);
+		if (rc == MEMCACHED_SUCCESS) {
+			while ((result = memcached_fetch_result((memcached_st *)ictx->cache, NULL, &rc))) {
+				value = talloc_strndup(mem_ctx, memcached_result_value(result),
+						       memcached_result_length(result));
+				if (value && convert_string_to_ull(value, &fmid)) {
+					for (j = 0; j < count; j++) {
+						if (keys_len[j] == memcached_result_key_length(result) &&
+						    !strncmp(keys[j], memcached_result_key_value(result), keys_len[j])) {
+							fmids[j] = fmid;
+						}
+					}
+				}
+				talloc_free(value);
+				memcached_result_free(result);
+			}
+		}
+	}
+
+	/* Step 2. Search the missing ones in the database */
+	missing = talloc_array(mem_ctx, uint32_t, count);
+	MAPISTORE_RETVAL_IF(!missing, MAPISTORE_ERR_NO_MEMORY, mem_ctx);
+	for (i = 0; i < count; i++) {
+		if (!fmids[i]) {
+			missing[missing_count++] = i;
+		}
+	}
+
+	for (i = 0; i < missing_count; i += n) {
+		n = (missing_count - i > INDEXING_BATCH_SIZE) ? INDEXING_BATCH_SIZE : missing_count - i;
+
+		sql = talloc_asprintf(mem_ctx,
+			"SELECT fmid, url, soft_deleted FROM %s "
+			"WHERE username = '%s' AND url IN (",
+			INDEXING_TABLE, _sql(mem_ctx, username));
+		for (j = 0; sql && j < n; j++) {
+			sql = talloc_asprintf_append(sql, "%s'%s'", j ? "," : "",
+						     _sql(mem_ctx, uris[missing[i + j]]));
+		}
+		sql = talloc_asprintf_append(sql, ")");
+		MAPISTORE_RETVAL_IF(!sql, MAPISTORE_ERR_NO_MEMORY, mem_ctx);
+
+		ret = select_without_fetch(MYSQL_READ(ictx), sql, &res);
+		if (ret == MYSQL_NOT_FOUND) continue;
+		MAPISTORE_RETVAL_IF(ret != MYSQL_SUCCESS, MAPISTORE_ERR_DATABASE_OPS, mem_ctx);
+
+		while ((row = mysql_fetch_row(res))) {
+			for (j = i; j < i + n; j++) {
+				if (fmids[missing[j]] || strcmp(uris[missing[j]], row[1])) continue;
+				fmids[missing[j]] = strtoull(row[0], NULL, 0);
+				soft_deleted[missing[j]] = strtoull(row[2], NULL, 0) == 1;
+			}
+		}
+		mysql_free_result(res);
+	}
+
+	talloc_free(mem_ctx);
 	return MAPISTORE_SUCCESS;
 }
 
@@ -711,18 +1132,19 @@ static enum mapistore_error mysql_record_allocate_fmids(struct indexing_context
 	MAPISTORE_RETVAL_IF(count < 0, MAPISTORE_ERR_NOT_INITIALIZED, NULL);
 	MAPISTORE_RETVAL_IF(count == 0, MAPISTORE_SUCCESS, NULL);
 
-	/* Retrieve and increment the counter */
-	ret = execute_query(MYSQL(ictx), "START TRANSACTION");
-	MAPISTORE_RETVAL_IF(ret != MYSQL_SUCCESS, MAPISTORE_ERR_DATABASE_OPS, NULL);
-
 	mem_ctx = talloc_new(NULL);
 	MAPISTORE_RETVAL_IF(!mem_ctx, MAPISTORE_ERR_NO_MEMORY, NULL);
 
+	/* Retrieve and increment the counter, the row stays locked
+	 * against other processes until we commit */
+	ret = execute_query(MYSQL(ictx), "START TRANSACTION");
+	MAPISTORE_RETVAL_IF(ret != MYSQL_SUCCESS, MAPISTORE_ERR_DATABASE_OPS, mem_ctx);
+
 	sql = talloc_asprintf(mem_ctx,
 		"SELECT next_fmid FROM %s "
-		"WHERE username = '%s'",
+		"WHERE username = '%s' FOR UPDATE",
 		INDEXING_ALLOC_TABLE, _sql(mem_ctx, username));
-	MAPISTORE_RETVAL_IF(!sql, MAPISTORE_ERR_NO_MEMORY, mem_ctx);
+	if (!sql) goto rollback;
 
 	ret = select_first_uint(MYSQL(ictx), sql, &next_fmid);
 	switch (ret) {
@@ -737,7 +1159,6 @@ static enum mapistore_error mysql_record_allocate_fmids(struct indexing_context
 			INDEXING_ALLOC_TABLE,
 			next_fmid + count,
 			_sql(mem_ctx, username));
-		MAPISTORE_RETVAL_IF(!sql, MAPISTORE_ERR_NO_MEMORY, mem_ctx);
 		break;
 	case MYSQL_NOT_FOUND:
 		// First allocation, insert in the database
@@ -748,16 +1169,15 @@ static enum mapistore_error mysql_record_allocate_fmids(struct indexing_context
 			INDEXING_ALLOC_TABLE,
 			_sql(mem_ctx, username),
 			next_fmid + count);
-		MAPISTORE_RETVAL_IF(!sql, MAPISTORE_ERR_NO_MEMORY, mem_ctx);
 		break;
-
 	default:
 		// Unknown error
-		talloc_free(mem_ctx);
-		return MAPISTORE_ERR_DATABASE_OPS;
+		goto rollback;
 	}
+	if (!sql) goto rollback;
+
 	ret = execute_query(MYSQL(ictx), sql);
-	MAPISTORE_RETVAL_IF(ret != MYSQL_SUCCESS, MAPISTORE_ERR_DATABASE_OPS, mem_ctx);
+	if (ret != MYSQL_SUCCESS) goto rollback;
 
 	ret = execute_query(MYSQL(ictx), "COMMIT");
 	MAPISTORE_RETVAL_IF(ret != MYSQL_SUCCESS, MAPISTORE_ERR_DATABASE_OPS, mem_ctx);
@@ -767,6 +1187,41 @@ static enum mapistore_error mysql_record_allocate_fmids(struct indexing_context
 	talloc_free(mem_ctx);
 
 	return MAPISTORE_SUCCESS;
+
+rollback:
+	execute_query(MYSQL(ictx), "ROLLBACK");
+	talloc_free(mem_ctx);
+	return MAPISTORE_ERR_DATABASE_OPS;
+}
+
+/**
+   \details Give back the unused tail of the FMID lease, provided no
+   other process allocated FMIDs after it. Otherwise the tail is
+   abandoned.
+
+   \param ictx pointer to the indexing context
+ */
+static void mysql_record_release_lease(struct indexing_context *ictx)
+{
+	TALLOC_CTX	*mem_ctx;
+	char		*sql;
+
+	if (ictx->lease_next >= ictx->lease_end) return;
+
+	mem_ctx = talloc_new(NULL);
+	if (!mem_ctx) return;
+
+	sql = talloc_asprintf(mem_ctx,
+		"UPDATE %s SET next_fmid = %"PRIu64" "
+		"WHERE username = '%s' AND next_fmid = '%"PRIu64"'",
+		INDEXING_ALLOC_TABLE, ictx->lease_next,
+		_sql(mem_ctx, ictx->url), ictx->lease_end);
+	if (sql) {
+		execute_query(MYSQL(ictx), sql);
+	}
+	ictx->lease_next = ictx->lease_end;
+
+	talloc_free(mem_ctx);
 }
 
 static enum mapistore_error mysql_record_allocate_fmid(struct indexing_context *ictx,
@@ -776,11 +1231,18 @@ static enum mapistore_error mysql_record_allocate_fmid(struct indexing_context *
 	return mysql_record_allocate_fmids(ictx, username, 1, fmidp);
 }
 
+static void mysql_record_release(struct indexing_context *ictx)
+{
+	mysql_rw_release(ictx->data);
+}
+
 
 static int mapistore_indexing_mysql_destructor(struct indexing_context *ictx)
 {
 	if (ictx && ictx->data) {
-		MYSQL *conn = ictx->data;
+		if (ictx->url) {
+			mysql_record_release_lease(ictx);
+		}
 		if (ictx->cache) {
 			memcached_free((memcached_st *)ictx->cache);
 		}
@@ -789,7 +1251,9 @@ static int mapistore_indexing_mysql_destructor(struct indexing_context *ictx)
 		} else {
 			OC_DEBUG(5, "Destroying unknown indexing context\n");
 		}
-		release_connection(conn);
+		/* Connections are checked in along with the read/write split */
+		talloc_free(ictx->data);
+		ictx->data = NULL;
 	} else {
 		OC_DEBUG(0, "Error: tried to destroy corrupted indexing mysql context\n");
 	}
@@ -815,8 +1279,11 @@ _PUBLIC_ enum mapistore_error mapistore_indexing_mysql_init(struct mapistore_con
 {
 	struct indexing_context	*ictx;
 	MYSQL			*conn = NULL;
+	bool			schema_exists;
 	int			schema_created_ret;
 	char			*cache_url = NULL;
+	const char		*replica;
+	uint32_t		sticky = MAPISTORE_INDEXING_REPLICA_STICKY;
 
 	/* Sanity checks */
 	MAPISTORE_RETVAL_IF(!mstore_ctx, MAPISTORE_ERR_NOT_INITIALIZED, NULL);
@@ -829,11 +1296,15 @@ _PUBLIC_ enum mapistore_error mapistore_indexing_mysql_init(struct mapistore_con
 
 	create_connection(connection_string, &conn);
 	MAPISTORE_RETVAL_IF(!conn, MAPISTORE_ERR_NOT_INITIALIZED, ictx);
-	ictx->data = conn;
-	talloc_set_destructor(ictx, mapistore_indexing_mysql_destructor);
+	schema_exists = table_exists(conn, INDEXING_TABLE);
+	release_connection(conn);
+	/* Optional replica for read-only lookups, FMID allocation stays on the primary */
+	replica = mapistore_get_default_indexing_replica(connection_string, &sticky);
+	ictx->data = mysql_rw_init(ictx, connection_string, replica, sticky);
 	MAPISTORE_RETVAL_IF(!ictx->data, MAPISTORE_ERR_NOT_INITIALIZED, ictx);
+	talloc_set_destructor(ictx, mapistore_indexing_mysql_destructor);
 
-	if (!table_exists(conn, INDEXING_TABLE)) {
+	if (!schema_exists) {
 		OC_DEBUG(3, "Creating schema for indexing on mysql %s\n",
 			  connection_string);
 
@@ -855,12 +1326,18 @@ _PUBLIC_ enum mapistore_error mapistore_indexing_mysql_init(struct mapistore_con
 	ictx->update_fmid = mysql_record_update;
 	ictx->get_uri = mysql_record_get_uri;
 	ictx->get_fmid = mysql_record_get_fmid;
+	ictx->add_fmids = mysql_record_add_multi;
+	ictx->del_fmids = mysql_record_del_multi;
+	ictx->get_uris = mysql_record_get_uri_multi;
+	ictx->get_fmids = mysql_record_get_fmid_multi;
 	ictx->allocate_fmid = mysql_record_allocate_fmid;
 	ictx->allocate_fmids = mysql_record_allocate_fmids;
+	ictx->release = mysql_record_release;
 
 	/* Data pointers */
 	cache_url = mapistore_get_default_cache_url();
 	ictx->cache = _memcached_setup(ictx, cache_url, username);
+	mysql_rw_release(ictx->data);
 
 	*ictxp = ictx;
 
@@ -26,6 +26,9 @@
 #define INDEXING_TABLE		"mapistore_indexing"
 #define INDEXING_ALLOC_TABLE	"mapistore_indexes"
 
+/* Maximum number of records handled by a single batch query */
+#define INDEXING_BATCH_SIZE	500
+
 
 enum mapistore_error mapistore_indexing_mysql_init(struct mapistore_context *,
 						   const char *, const char *,
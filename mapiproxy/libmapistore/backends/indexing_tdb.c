@@ -34,6 +34,339 @@
 
 #define	TDB_WRAP(context)	((struct tdb_wrap*)context->data)
 
+/*
+   Besides the fmid -> URI records, the indexing database keeps two
+   indexes so URI resolution does not have to traverse the database:
+
+   - a reverse index: "URI:<uri>" -> fmid, prev, next. URIs are stored
+     without their trailing slash.
+
+   - a prefix index: "DIR:<parent>" -> first URI whose parent is
+     <parent> (the URI up to and including its last slash). The URIs
+     sharing a parent are chained through the prev/next fields of their
+     reverse index record, so adding or removing a URI only touches its
+     neighbours.
+
+   The fmid record remains the reference: a reverse index entry is only
+   trusted when the fmid it points to still maps back to the URI.
+
+   Records and their index entries are written within a single
+   transaction, so readers never see them out of step.
+ */
+struct tdb_index_entry {
+	uint64_t	fmid;
+	const char	*prev;
+	const char	*next;
+};
+
+static char *tdb_index_normalize(TALLOC_CTX *mem_ctx, const char *uri, size_t len)
+{
+	if (len && uri[len - 1] == '/') {
+		len--;
+	}
+
+	return talloc_strndup(mem_ctx, uri, len);
+}
+
+static char *tdb_index_parent(TALLOC_CTX *mem_ctx, const char *uri)
+{
+	const char	*slash_ptr;
+
+	slash_ptr = strrchr(uri, '/');
+	if (!slash_ptr) {
+		return talloc_strdup(mem_ctx, "");
+	}
+
+	return talloc_strndup(mem_ctx, uri, slash_ptr - uri + 1);
+}
+
+static TDB_DATA tdb_index_key(TALLOC_CTX *mem_ctx, const char *prefix, const char *uri)
+{
+	TDB_DATA	key;
+
+	key.dptr = (unsigned char *) talloc_asprintf(mem_ctx, "%s%s", prefix, uri);
+	key.dsize = key.dptr ? strlen((const char *) key.dptr) : 0;
+
+	return key;
+}
+
+static bool tdb_index_fetch(struct indexing_context *ictx, TALLOC_CTX *mem_ctx,
+			    const char *uri, struct tdb_index_entry *entry)
+{
+	TDB_DATA	key;
+	TDB_DATA	dbuf;
+	char		fmid_str[MAPISTORE_INDEXING_FMID_LEN + 1];
+	const char	*end;
+	const char	*prev;
+	const char	*next;
+
+	key = tdb_index_key(mem_ctx, MAPISTORE_URI_INDEX_TAG, uri);
+	dbuf = tdb_fetch(TDB_WRAP(ictx)->tdb, key);
+	talloc_free(key.dptr);
+	if (!dbuf.dptr) return false;
+
+	/* fmid '\0' prev '\0' next */
+	end = (const char *) dbuf.dptr + dbuf.dsize;
+	prev = (const char *) dbuf.dptr + MAPISTORE_INDEXING_FMID_LEN + 1;
+	next = (prev < end) ? memchr(prev, 0, end - prev) : NULL;
+	if (!next) {
+		OC_DEBUG(3, "Invalid index record for %s\n", uri);
+		free(dbuf.dptr);
+		return false;
+	}
+	next++;
+
+	memcpy(fmid_str, dbuf.dptr, MAPISTORE_INDEXING_FMID_LEN);
+	fmid_str[MAPISTORE_INDEXING_FMID_LEN] = 0;
+	entry->fmid = strtoull(fmid_str, NULL, 16);
+	entry->prev = talloc_strdup(mem_ctx, prev);
+	entry->next = talloc_strndup(mem_ctx, next, end - next);
+	free(dbuf.dptr);
+
+	return true;
+}
+
+static int tdb_index_store(struct indexing_context *ictx, TALLOC_CTX *mem_ctx,
+			   const char *uri, const struct tdb_index_entry *entry)
+{
+	TDB_DATA	key;
+	TDB_DATA	dbuf;
+	size_t		prev_len;
+	size_t		next_len;
+	int		ret;
+
+	prev_len = strlen(entry->prev);
+	next_len = strlen(entry->next);
+
+	dbuf.dsize = MAPISTORE_INDEXING_FMID_LEN + 1 + prev_len + 1 + next_len;
+	dbuf.dptr = talloc_size(mem_ctx, dbuf.dsize + 1);
+	if (!dbuf.dptr) return -1;
+	snprintf((char *) dbuf.dptr, MAPISTORE_INDEXING_FMID_LEN + 1, "0x%.16"PRIx64, entry->fmid);
+	memcpy(dbuf.dptr + MAPISTORE_INDEXING_FMID_LEN + 1, entry->prev, prev_len + 1);
+	memcpy(dbuf.dptr + MAPISTORE_INDEXING_FMID_LEN + 1 + prev_len + 1, entry->next, next_len);
+
+	key = tdb_index_key(mem_ctx, MAPISTORE_URI_INDEX_TAG, uri);
+	ret = tdb_store(TDB_WRAP(ictx)->tdb, key, dbuf, TDB_REPLACE);
+	talloc_free(key.dptr);
+	talloc_free(dbuf.dptr);
+
+	return ret;
+}
+
+static int tdb_index_set_link(struct indexing_context *ictx, TALLOC_CTX *mem_ctx,
+			      const char *uri, const char *prev, const char *next)
+{
+	struct tdb_index_entry	entry;
+
+	/* Nothing to relink: lookups check entries against their record */
+	if (!tdb_index_fetch(ictx, mem_ctx, uri, &entry)) {
+		OC_DEBUG(3, "Missing index record for %s\n", uri);
+		return 0;
+	}
+	if (prev) entry.prev = prev;
+	if (next) entry.next = next;
+
+	return tdb_index_store(ictx, mem_ctx, uri, &entry);
+}
+
+static int tdb_index_set_head(struct indexing_context *ictx, TALLOC_CTX *mem_ctx,
+			      const char *parent, const char *uri)
+{
+	TDB_DATA	key;
+	TDB_DATA	dbuf;
+	int		ret;
+
+	key = tdb_index_key(mem_ctx, MAPISTORE_DIR_INDEX_TAG, parent);
+	if (uri[0]) {
+		dbuf.dptr = (unsigned char *) uri;
+		dbuf.dsize = strlen(uri);
+		ret = tdb_store(TDB_WRAP(ictx)->tdb, key, dbuf, TDB_REPLACE);
+	} else {
+		ret = tdb_delete(TDB_WRAP(ictx)->tdb, key);
+		if (ret == -1 && tdb_error(TDB_WRAP(ictx)->tdb) == TDB_ERR_NOEXIST) {
+			ret = 0;
+		}
+	}
+	talloc_free(key.dptr);
+
+	return ret;
+}
+
+static char *tdb_index_get_head(struct indexing_context *ictx, TALLOC_CTX *mem_ctx,
+				const char *parent)
+{
+	TDB_DATA	key;
+	TDB_DATA	dbuf;
+	char		*head;
+
+	key = tdb_index_key(mem_ctx, MAPISTORE_DIR_INDEX_TAG, parent);
+	dbuf = tdb_fetch(TDB_WRAP(ictx)->tdb, key);
+	talloc_free(key.dptr);
+	if (!dbuf.dptr) return NULL;
+
+	head = talloc_strndup(mem_ctx, (const char *) dbuf.dptr, dbuf.dsize);
+	free(dbuf.dptr);
+
+	return head;
+}
+
+/**
+   \details Add a URI to the reverse and prefix indexes
+
+   \param ictx pointer to the indexing context
+   \param fmid the fmid the URI maps to
+   \param mapistore_URI the URI to index
+
+   \return MAPISTORE_SUCCESS on success, otherwise MAPISTORE error
+ */
+static enum mapistore_error tdb_index_add(struct indexing_context *ictx,
+					  uint64_t fmid,
+					  const char *mapistore_URI)
+{
+	TALLOC_CTX		*mem_ctx;
+	struct tdb_index_entry	entry;
+	char			*uri;
+	char			*parent;
+	char			*head;
+
+	mem_ctx = talloc_new(NULL);
+	MAPISTORE_RETVAL_IF(!mem_ctx, MAPISTORE_ERR_NO_MEMORY, NULL);
+
+	uri = tdb_index_normalize(mem_ctx, mapistore_URI, strlen(mapistore_URI));
+	MAPISTORE_RETVAL_IF(!uri, MAPISTORE_ERR_NO_MEMORY, mem_ctx);
+
+	/* The URI is already indexed: only point it to the new fmid */
+	if (tdb_index_fetch(ictx, mem_ctx, uri, &entry)) {
+		entry.fmid = fmid;
+		MAPISTORE_RETVAL_IF(tdb_index_store(ictx, mem_ctx, uri, &entry) == -1,
+				    MAPISTORE_ERR_DATABASE_OPS, mem_ctx);
+		talloc_free(mem_ctx);
+		return MAPISTORE_SUCCESS;
+	}
+
+	/* Insert the URI at the head of its parent list */
+	parent = tdb_index_parent(mem_ctx, uri);
+	head = tdb_index_get_head(ictx, mem_ctx, parent);
+
+	entry.fmid = fmid;
+	entry.prev = "";
+	entry.next = head ? head : "";
+	MAPISTORE_RETVAL_IF(tdb_index_store(ictx, mem_ctx, uri, &entry) == -1,
+			    MAPISTORE_ERR_DATABASE_OPS, mem_ctx);
+	if (head) {
+		MAPISTORE_RETVAL_IF(tdb_index_set_link(ictx, mem_ctx, head, uri, NULL) == -1,
+				    MAPISTORE_ERR_DATABASE_OPS, mem_ctx);
+	}
+	MAPISTORE_RETVAL_IF(tdb_index_set_head(ictx, mem_ctx, parent, uri) == -1,
+			    MAPISTORE_ERR_DATABASE_OPS, mem_ctx);
+
+	talloc_free(mem_ctx);
+	return MAPISTORE_SUCCESS;
+}
+
+/**
+   \details Remove a URI from the reverse and prefix indexes, provided
+   it still maps to the given fmid
+
+   \param ictx pointer to the indexing context
+   \param fmid the fmid the URI maps to
+   \param mapistore_URI the URI to remove
+   \param len length of mapistore_URI
+
+   \return MAPISTORE_SUCCESS on success, otherwise MAPISTORE error
+ */
+static enum mapistore_error tdb_index_del(struct indexing_context *ictx,
+					  uint64_t fmid,
+					  const char *mapistore_URI,
+					  size_t len)
+{
+	TALLOC_CTX		*mem_ctx;
+	struct tdb_index_entry	entry;
+	TDB_DATA		key;
+	char			*uri;
+	int			ret;
+
+	mem_ctx = talloc_new(NULL);
+	MAPISTORE_RETVAL_IF(!mem_ctx, MAPISTORE_ERR_NO_MEMORY, NULL);
+
+	uri = tdb_index_normalize(mem_ctx, mapistore_URI, len);
+	MAPISTORE_RETVAL_IF(!uri, MAPISTORE_ERR_NO_MEMORY, mem_ctx);
+
+	/* Not indexed, or indexed for another fmid */
+	if (!tdb_index_fetch(ictx, mem_ctx, uri, &entry) || entry.fmid != fmid) {
+		talloc_free(mem_ctx);
+		return MAPISTORE_SUCCESS;
+	}
+
+	/* Unlink the URI from its parent list */
+	if (entry.prev[0]) {
+		ret = tdb_index_set_link(ictx, mem_ctx, entry.prev, NULL, entry.next);
+	} else {
+		ret = tdb_index_set_head(ictx, mem_ctx, tdb_index_parent(mem_ctx, uri), entry.next);
+	}
+	MAPISTORE_RETVAL_IF(ret == -1, MAPISTORE_ERR_DATABASE_OPS, mem_ctx);
+	if (entry.next[0]) {
+		MAPISTORE_RETVAL_IF(tdb_index_set_link(ictx, mem_ctx, entry.next, entry.prev, NULL) == -1,
+				    MAPISTORE_ERR_DATABASE_OPS, mem_ctx);
+	}
+
+	key = tdb_index_key(mem_ctx, MAPISTORE_URI_INDEX_TAG, uri);
+	MAPISTORE_RETVAL_IF(tdb_delete(TDB_WRAP(ictx)->tdb, key) == -1,
+			    MAPISTORE_ERR_DATABASE_OPS, mem_ctx);
+
+	talloc_free(mem_ctx);
+	return MAPISTORE_SUCCESS;
+}
+
+/**
+   \details Check an fmid found in the reverse index against its
+   record and report whether it is soft deleted
+
+   \param ictx pointer to the indexing context
+   \param fmid the fmid found in the index
+   \param uri the normalized URI that was looked up
+   \param soft_deletedp pointer to the soft deleted flag to set
+
+   \return true if the fmid record maps to uri, otherwise false
+ */
+static bool tdb_index_check(struct indexing_context *ictx,
+			    uint64_t fmid,
+			    const char *uri,
+			    bool *soft_deletedp)
+{
+	TALLOC_CTX	*mem_ctx;
+	TDB_DATA	key;
+	TDB_DATA	dbuf;
+	char		*record_uri;
+	bool		ret = false;
+
+	mem_ctx = talloc_new(NULL);
+	if (!mem_ctx) return false;
+
+	key.dptr = (unsigned char *) talloc_asprintf(mem_ctx, "0x%.16"PRIx64, fmid);
+	key.dsize = strlen((const char *) key.dptr);
+	dbuf = tdb_fetch(TDB_WRAP(ictx)->tdb, key);
+	*soft_deletedp = false;
+
+	if (!dbuf.dptr) {
+		key.dptr = (unsigned char *) talloc_asprintf(mem_ctx, "%s0x%.16"PRIx64,
+							     MAPISTORE_SOFT_DELETED_TAG, fmid);
+		key.dsize = strlen((const char *) key.dptr);
+		dbuf = tdb_fetch(TDB_WRAP(ictx)->tdb, key);
+		*soft_deletedp = true;
+	}
+
+	if (dbuf.dptr) {
+		record_uri = tdb_index_normalize(mem_ctx, (const char *) dbuf.dptr, dbuf.dsize);
+		ret = (record_uri && strcmp(record_uri, uri) == 0);
+		free(dbuf.dptr);
+	}
+
+	talloc_free(mem_ctx);
+
+	return ret;
+}
+
 
 
 static enum mapistore_error tdb_search_existing_fmid(struct indexing_context *ictx,
@@ -73,10 +406,10 @@ static enum mapistore_error tdb_search_existing_fmid(struct indexing_context *ic
 	return MAPISTORE_SUCCESS;
 }
 
-static enum mapistore_error tdb_record_add(struct indexing_context *ictx,
-					   const char *username,
-					   uint64_t fmid,
-					   const char *mapistore_URI)
+static enum mapistore_error tdb_record_add_unlocked(struct indexing_context *ictx,
+						    const char *username,
+						    uint64_t fmid,
+						    const char *mapistore_URI)
 {
 	int		ret;
 	TDB_DATA	key;
@@ -110,17 +443,19 @@ static enum mapistore_error tdb_record_add(struct indexing_context *ictx,
 		return MAPISTORE_ERR_DATABASE_OPS;
 	}
 
-	return MAPISTORE_SUCCESS;
+	return tdb_index_add(ictx, fmid, mapistore_URI);
 }
 
-static enum mapistore_error tdb_record_update(struct indexing_context *ictx,
-					      const char *username,
-					      uint64_t fmid,
-					      const char *mapistore_URI)
+static enum mapistore_error tdb_record_update_unlocked(struct indexing_context *ictx,
+						       const char *username,
+						       uint64_t fmid,
+						       const char *mapistore_URI)
 {
+	enum mapistore_error	retval;
 	int		ret;
 	TDB_DATA	key;
 	TDB_DATA	dbuf;
+	TDB_DATA	old_dbuf;
 
 	/* Sanity checks */
 	MAPISTORE_RETVAL_IF(!ictx, MAPISTORE_ERR_NOT_INITIALIZED, NULL);
@@ -135,6 +470,9 @@ static enum mapistore_error tdb_record_update(struct indexing_context *ictx,
 	dbuf.dptr = (unsigned char *) talloc_strdup(ictx, mapistore_URI);
 	dbuf.dsize = strlen((const char *) dbuf.dptr);
 
+	/* Retrieve the previous URI so it can be removed from the index */
+	old_dbuf = tdb_fetch(TDB_WRAP(ictx)->tdb, key);
+
 	ret = tdb_store(TDB_WRAP(ictx)->tdb, key, dbuf, TDB_MODIFY);
 	talloc_free(key.dptr);
 	talloc_free(dbuf.dptr);
@@ -142,16 +480,23 @@ static enum mapistore_error tdb_record_update(struct indexing_context *ictx,
 	if (ret == -1) {
 		OC_DEBUG(3, "Unable to update 0x%.16"PRIx64" record: %s\n",
 			  fmid, mapistore_URI);
+		free(old_dbuf.dptr);
 		return MAPISTORE_ERR_NOT_FOUND;
 	}
 
-	return MAPISTORE_SUCCESS;
+	if (old_dbuf.dptr) {
+		retval = tdb_index_del(ictx, fmid, (const char *) old_dbuf.dptr, old_dbuf.dsize);
+		free(old_dbuf.dptr);
+		MAPISTORE_RETVAL_IF(retval, retval, NULL);
+	}
+
+	return tdb_index_add(ictx, fmid, mapistore_URI);
 }
 
-static enum mapistore_error tdb_record_del(struct indexing_context *ictx,
-					   const char *username,
-					   uint64_t fmid,
-					   uint8_t flags)
+static enum mapistore_error tdb_record_del_unlocked(struct indexing_context *ictx,
+						    const char *username,
+						    uint64_t fmid,
+						    uint8_t flags)
 {
 	int				ret;
 	TDB_DATA			key;
@@ -195,9 +540,18 @@ static enum mapistore_error tdb_record_del(struct indexing_context *ictx,
 		talloc_free(newkey.dptr);
 		break;
 	case MAPISTORE_PERMANENT_DELETE:
+		dbuf = tdb_fetch(TDB_WRAP(ictx)->tdb, key);
 		ret = tdb_delete(TDB_WRAP(ictx)->tdb, key);
 		talloc_free(key.dptr);
-		MAPISTORE_RETVAL_IF(ret, MAPISTORE_ERR_DATABASE_OPS, NULL);
+		if (ret) {
+			free(dbuf.dptr);
+			return MAPISTORE_ERR_DATABASE_OPS;
+		}
+		if (dbuf.dptr) {
+			ret = tdb_index_del(ictx, fmid, (const char *) dbuf.dptr, dbuf.dsize);
+			free(dbuf.dptr);
+			MAPISTORE_RETVAL_IF(ret, ret, NULL);
+		}
 		break;
 	default:
 		return MAPISTORE_ERR_INVALID_PARAMETER;
@@ -206,6 +560,93 @@ static enum mapistore_error tdb_record_del(struct indexing_context *ictx,
 	return MAPISTORE_SUCCESS;
 }
 
+/**
+   \details Add the record of an fmid and index its URI within a
+   single transaction
+
+   \return MAPISTORE_SUCCESS on success, otherwise MAPISTORE error
+ */
+static enum mapistore_error tdb_record_add(struct indexing_context *ictx,
+					   const char *username,
+					   uint64_t fmid,
+					   const char *mapistore_URI)
+{
+	enum mapistore_error	retval;
+
+	MAPISTORE_RETVAL_IF(!ictx, MAPISTORE_ERR_NOT_INITIALIZED, NULL);
+	MAPISTORE_RETVAL_IF(tdb_transaction_start(TDB_WRAP(ictx)->tdb) == -1,
+			    MAPISTORE_ERR_DATABASE_OPS, NULL);
+
+	retval = tdb_record_add_unlocked(ictx, username, fmid, mapistore_URI);
+	if (retval != MAPISTORE_SUCCESS) {
+		tdb_transaction_cancel(TDB_WRAP(ictx)->tdb);
+		return retval;
+	}
+
+	MAPISTORE_RETVAL_IF(tdb_transaction_commit(TDB_WRAP(ictx)->tdb) == -1,
+			    MAPISTORE_ERR_DATABASE_OPS, NULL);
+
+	return MAPISTORE_SUCCESS;
+}
+
+/**
+   \details Update the URI of an fmid and its index entries within a
+   single transaction
+
+   \return MAPISTORE_SUCCESS on success, otherwise MAPISTORE error
+ */
+static enum mapistore_error tdb_record_update(struct indexing_context *ictx,
+					      const char *username,
+					      uint64_t fmid,
+					      const char *mapistore_URI)
+{
+	enum mapistore_error	retval;
+
+	MAPISTORE_RETVAL_IF(!ictx, MAPISTORE_ERR_NOT_INITIALIZED, NULL);
+	MAPISTORE_RETVAL_IF(tdb_transaction_start(TDB_WRAP(ictx)->tdb) == -1,
+			    MAPISTORE_ERR_DATABASE_OPS, NULL);
+
+	retval = tdb_record_update_unlocked(ictx, username, fmid, mapistore_URI);
+	if (retval != MAPISTORE_SUCCESS) {
+		tdb_transaction_cancel(TDB_WRAP(ictx)->tdb);
+		return retval;
+	}
+
+	MAPISTORE_RETVAL_IF(tdb_transaction_commit(TDB_WRAP(ictx)->tdb) == -1,
+			    MAPISTORE_ERR_DATABASE_OPS, NULL);
+
+	return MAPISTORE_SUCCESS;
+}
+
+/**
+   \details Delete the record of an fmid and its index entries within
+   a single transaction
+
+   \return MAPISTORE_SUCCESS on success, otherwise MAPISTORE error
+ */
+static enum mapistore_error tdb_record_del(struct indexing_context *ictx,
+					   const char *username,
+					   uint64_t fmid,
+					   uint8_t flags)
+{
+	enum mapistore_error	retval;
+
+	MAPISTORE_RETVAL_IF(!ictx, MAPISTORE_ERR_NOT_INITIALIZED, NULL);
+	MAPISTORE_RETVAL_IF(tdb_transaction_start(TDB_WRAP(ictx)->tdb) == -1,
+			    MAPISTORE_ERR_DATABASE_OPS, NULL);
+
+	retval = tdb_record_del_unlocked(ictx, username, fmid, flags);
+	if (retval != MAPISTORE_SUCCESS) {
+		tdb_transaction_cancel(TDB_WRAP(ictx)->tdb);
+		return retval;
+	}
+
+	MAPISTORE_RETVAL_IF(tdb_transaction_commit(TDB_WRAP(ictx)->tdb) == -1,
+			    MAPISTORE_ERR_DATABASE_OPS, NULL);
+
+	return MAPISTORE_SUCCESS;
+}
+
 static enum mapistore_error tdb_record_get_uri(struct indexing_context *ictx,
 					       const char *username,
 					       TALLOC_CTX *mem_ctx,
@@ -256,93 +697,169 @@ static enum mapistore_error tdb_record_get_uri(struct indexing_context *ictx,
 }
 
 /**
-   \details A slow but effective way to retrieve an fmid from a uri
+   \details Look up an exact URI in the reverse index
 
-   \param mstore_ctx pointer to the mapistore context
-   \param mem_ctx pointer to the talloc context
-   \param fmid the fmid/key to the record
-   \param urip pointer to the uri pointer
-   \param soft_deletedp pointer to the soft deleted pointer
+   \param ictx pointer to the indexing context
+   \param uri the normalized URI to look up
+   \param fmidp pointer to the fmid to return
+   \param soft_deletedp pointer to the soft deleted flag to return
 
-   \return MAPISTORE_SUCCESS on success, otherwise MAPISTORE error
+   \return true if the URI was found, otherwise false
  */
-struct tdb_get_fid_data {
-	bool		found;
-	uint64_t	fmid;
-	char		*uri;
-	size_t		uri_len;
-	uint32_t	wildcard_count;
-	char		*startswith;
-	char		*endswith;
-};
-
-static int tdb_get_fid_traverse(struct tdb_context *tdb_ctx, TDB_DATA key, TDB_DATA value, void *data)
+static bool tdb_index_lookup(struct indexing_context *ictx,
+			     const char *uri,
+			     uint64_t *fmidp,
+			     bool *soft_deletedp)
 {
-	struct tdb_get_fid_data	*tdb_data;
-	char			*key_str, *cmp_uri, *slash_ptr;
 	TALLOC_CTX		*mem_ctx;
-	int			ret = 0;
+	struct tdb_index_entry	entry;
+	bool			ret = false;
 
-	mem_ctx = talloc_zero(NULL, void);
-	tdb_data = data;
-	cmp_uri = talloc_array(mem_ctx, char, value.dsize + 1);
-	memcpy(cmp_uri, value.dptr, value.dsize);
-	*(cmp_uri + value.dsize) = 0;
-	slash_ptr = cmp_uri + value.dsize - 1;
-	if (*slash_ptr == '/') {
-		*slash_ptr = 0;
-	}
-	if (strcmp(cmp_uri, tdb_data->uri) == 0) {
-		key_str = talloc_strndup(mem_ctx, (char *) key.dptr, key.dsize);
-		tdb_data->fmid = strtoull(key_str, NULL, 16);
-		tdb_data->found = true;
-		ret = 1;
+	mem_ctx = talloc_new(NULL);
+	if (!mem_ctx) return false;
+
+	if (tdb_index_fetch(ictx, mem_ctx, uri, &entry) &&
+	    tdb_index_check(ictx, entry.fmid, uri, soft_deletedp)) {
+		*fmidp = entry.fmid;
+		ret = true;
 	}
-	
 	talloc_free(mem_ctx);
 
 	return ret;
 }
 
-static int tdb_get_fid_traverse_partial(struct tdb_context *tdb_ctx, TDB_DATA key, TDB_DATA value, void *data)
+static bool tdb_index_match(const char *uri, size_t uri_len,
+			    const char *startswith, const char *endswith)
+{
+	size_t	start_len = strlen(startswith);
+	size_t	end_len = strlen(endswith);
+
+	if (uri_len < start_len + end_len) return false;
+
+	return (!strncmp(uri, startswith, start_len) &&
+		!strncmp(uri + uri_len - end_len, endswith, end_len));
+}
+
+/**
+   \details Look up a single wildcard URI among the URIs sharing the
+   parent of the part before the wildcard
+
+   TDB is a hash database and has no range reads, so this walks the
+   list of the parent's children: the cost is bounded by the number of
+   siblings rather than by the size of the database.
+
+   \param ictx pointer to the indexing context
+   \param startswith the part of the URI before the wildcard
+   \param endswith the part of the URI after the wildcard
+   \param fmidp pointer to the fmid to return
+   \param soft_deletedp pointer to the soft deleted flag to return
+
+   \return true if a matching URI was found, otherwise false
+ */
+static bool tdb_index_lookup_prefix(struct indexing_context *ictx,
+				    const char *startswith,
+				    const char *endswith,
+				    uint64_t *fmidp,
+				    bool *soft_deletedp)
 {
-	struct tdb_get_fid_data	*tdb_data;
-	char			*key_str, *cmp_uri, *slash_ptr;
 	TALLOC_CTX		*mem_ctx;
+	struct tdb_index_entry	entry;
+	char			*uri;
+
+	mem_ctx = talloc_new(NULL);
+	if (!mem_ctx) return false;
+
+	uri = tdb_index_get_head(ictx, mem_ctx, tdb_index_parent(mem_ctx, startswith));
+	while (uri && uri[0] && tdb_index_fetch(ictx, mem_ctx, uri, &entry)) {
+		if (tdb_index_match(uri, strlen(uri), startswith, endswith) &&
+		    tdb_index_check(ictx, entry.fmid, uri, soft_deletedp)) {
+			*fmidp = entry.fmid;
+			talloc_free(mem_ctx);
+			return true;
+		}
+		uri = talloc_strdup(mem_ctx, entry.next);
+	}
+	talloc_free(mem_ctx);
+
+	return false;
+}
+
+struct tdb_get_fid_data {
+	struct indexing_context	*ictx;
+	bool			found;
+	bool			soft_deleted;
+	uint64_t		fmid;
+	const char		*startswith;
+	const char		*endswith;
+};
+
+static int tdb_get_fid_traverse_partial(struct tdb_context *tdb_ctx, TDB_DATA key, TDB_DATA value, void *data)
+{
+	struct tdb_get_fid_data	*tdb_data = data;
+	char			fmid_str[MAPISTORE_INDEXING_FMID_LEN + 1];
+	char			*uri;
+	uint64_t		fmid;
+	size_t			tag_len = strlen(MAPISTORE_URI_INDEX_TAG);
 	int			ret = 0;
 
-	mem_ctx = talloc_zero(NULL, void);
-	tdb_data = data;
-	cmp_uri = talloc_array(mem_ctx, char, value.dsize + 1);
-	memcpy(cmp_uri, value.dptr, value.dsize);
-	*(cmp_uri + value.dsize) = 0;
-	slash_ptr = cmp_uri + value.dsize - 1;
-	if (*slash_ptr == '/') {
-		*slash_ptr = 0;
-	}
-
-	if (!strncmp(cmp_uri, tdb_data->startswith, strlen(tdb_data->startswith)) &&
-	    !strncmp(cmp_uri + (strlen(cmp_uri) - strlen(tdb_data->endswith)), tdb_data->endswith, 
-		     strlen(tdb_data->endswith))) {
-		    key_str = talloc_strndup(mem_ctx, (char *) key.dptr, key.dsize);
-		    tdb_data->fmid = strtoull(key_str, NULL, 16);
-		    tdb_data->found = true;
-		    ret = 1;
-	}
-	
-	talloc_free(mem_ctx);
+	/* Only reverse index records are considered */
+	if (key.dsize < tag_len || memcmp(key.dptr, MAPISTORE_URI_INDEX_TAG, tag_len)) {
+		return 0;
+	}
+	if (value.dsize < MAPISTORE_INDEXING_FMID_LEN) {
+		return 0;
+	}
+
+	/* The key is not NUL terminated, compare it in place */
+	if (key.dsize - tag_len < strlen(tdb_data->startswith) + strlen(tdb_data->endswith) ||
+	    strncmp((const char *) key.dptr + tag_len, tdb_data->startswith, strlen(tdb_data->startswith)) ||
+	    memcmp(key.dptr + key.dsize - strlen(tdb_data->endswith), tdb_data->endswith, strlen(tdb_data->endswith))) {
+		return 0;
+	}
+
+	memcpy(fmid_str, value.dptr, MAPISTORE_INDEXING_FMID_LEN);
+	fmid_str[MAPISTORE_INDEXING_FMID_LEN] = 0;
+	fmid = strtoull(fmid_str, NULL, 16);
+
+	/* Skip stale index records */
+	uri = talloc_strndup(NULL, (const char *) key.dptr + tag_len, key.dsize - tag_len);
+	if (uri && tdb_index_check(tdb_data->ictx, fmid, uri, &tdb_data->soft_deleted)) {
+		tdb_data->fmid = fmid;
+		tdb_data->found = true;
+		ret = 1;
+	}
+	talloc_free(uri);
 
 	return ret;
 }
 
+/**
+   \details Retrieve the fmid of a URI. Exact URIs are resolved through
+   the reverse index. In URIs with a single wildcard within their last
+   component, the wildcard stands for part of that component: they are
+   only searched among the URIs sharing the parent of the part before
+   the wildcard. The reverse index is traversed for the other
+   wildcards, which may span several components.
+
+   \param ictx pointer to the indexing context
+   \param username the user the index belongs to
+   \param uri the URI to look up
+   \param partial whether uri may contain a wildcard
+   \param fmidp pointer to the fmid to return
+   \param soft_deletedp pointer to the soft deleted flag to return
+
+   \return MAPISTORE_SUCCESS on success, otherwise MAPISTORE error
+ */
 static enum mapistore_error tdb_record_get_fmid(struct indexing_context *ictx,
 					        const char *username,
 					        const char *uri, bool partial,
 					        uint64_t *fmidp, bool *soft_deletedp)
 {
-	int				ret;
+	TALLOC_CTX			*mem_ctx;
 	struct tdb_get_fid_data		tdb_data;
-	char				*slash_ptr;
+	char				*norm_uri;
+	char				*wildcard;
+	uint32_t			wildcard_count = 0;
 	uint32_t			i;
 
 	/* SANITY checks */
@@ -352,69 +869,227 @@ static enum mapistore_error tdb_record_get_fmid(struct indexing_context *ictx,
 	MAPISTORE_RETVAL_IF(!fmidp, MAPISTORE_ERR_INVALID_PARAMETER, NULL);
 	MAPISTORE_RETVAL_IF(!soft_deletedp, MAPISTORE_ERR_INVALID_PARAMETER, NULL);
 
-	/* Check if the fmid exists within the database */
-	tdb_data.found = false;
-	tdb_data.uri = talloc_strdup(NULL, uri);
-	tdb_data.uri_len = strlen(uri);
+	mem_ctx = talloc_named(NULL, 0, "tdb_record_get_fmid");
+	norm_uri = tdb_index_normalize(mem_ctx, uri, strlen(uri));
+	MAPISTORE_RETVAL_IF(!norm_uri, MAPISTORE_ERR_NO_MEMORY, mem_ctx);
+
+	if (partial == true) {
+		for (i = 0; norm_uri[i]; i++) {
+			if (norm_uri[i] == '*') wildcard_count += 1;
+		}
+	}
 
-	tdb_data.startswith = NULL;
-	tdb_data.endswith = NULL;
-	tdb_data.wildcard_count = 0;
+	switch (wildcard_count) {
+	case 0: /* complete URI */
+		if (tdb_index_lookup(ictx, norm_uri, fmidp, soft_deletedp)) {
+			talloc_free(mem_ctx);
+			return MAPISTORE_SUCCESS;
+		}
+		break;
+	case 1: /* start and end only */
+		wildcard = strchr(norm_uri, '*');
+		*wildcard = 0;
+		tdb_data.startswith = norm_uri;
+		tdb_data.endswith = wildcard + 1;
+
+		if (strchr(tdb_data.startswith, '/') && !strchr(tdb_data.endswith, '/')) {
+			if (tdb_index_lookup_prefix(ictx, tdb_data.startswith, tdb_data.endswith,
+						    fmidp, soft_deletedp)) {
+				talloc_free(mem_ctx);
+				return MAPISTORE_SUCCESS;
+			}
+			break;
+		}
 
-	slash_ptr = tdb_data.uri + tdb_data.uri_len - 1;
-	if (*slash_ptr == '/') {
-		*slash_ptr = 0;
-		tdb_data.uri_len--;
+		tdb_data.ictx = ictx;
+		tdb_data.found = false;
+		tdb_traverse_read(TDB_WRAP(ictx)->tdb, tdb_get_fid_traverse_partial, &tdb_data);
+		if (tdb_data.found) {
+			*fmidp = tdb_data.fmid;
+			*soft_deletedp = tdb_data.soft_deleted;
+			talloc_free(mem_ctx);
+			return MAPISTORE_SUCCESS;
+		}
+		break;
+	default:
+		OC_DEBUG(0, "Too many wildcards found (1 maximum)\n");
+		break;
 	}
-	if (partial == false) {
-		tdb_traverse_read(TDB_WRAP(ictx)->tdb, tdb_get_fid_traverse, &tdb_data);
-	} else {
-		for (tdb_data.wildcard_count = 0, i = 0; i < strlen(uri); i++) {
-			if (uri[i] == '*') tdb_data.wildcard_count += 1;
+
+	talloc_free(mem_ctx);
+	return MAPISTORE_ERR_NOT_FOUND;
+}
+
+
+/**
+   \details Add a set of records within a single transaction: either
+   all of them are added or none
+
+   \return MAPISTORE_SUCCESS on success, otherwise MAPISTORE error
+ */
+static enum mapistore_error tdb_record_add_multi(struct indexing_context *ictx,
+						 const char *username,
+						 uint32_t count,
+						 const uint64_t *fmids,
+						 const char **mapistore_URIs)
+{
+	enum mapistore_error	retval;
+	uint32_t		i;
+
+	/* Sanity checks */
+	MAPISTORE_RETVAL_IF(!ictx, MAPISTORE_ERR_NOT_INITIALIZED, NULL);
+	MAPISTORE_RETVAL_IF(!username, MAPISTORE_ERR_INVALID_PARAMETER, NULL);
+	MAPISTORE_RETVAL_IF(!fmids, MAPISTORE_ERR_INVALID_PARAMETER, NULL);
+	MAPISTORE_RETVAL_IF(!mapistore_URIs, MAPISTORE_ERR_INVALID_PARAMETER, NULL);
+
+	MAPISTORE_RETVAL_IF(tdb_transaction_start(TDB_WRAP(ictx)->tdb) == -1,
+			    MAPISTORE_ERR_DATABASE_OPS, NULL);
+
+	for (i = 0; i < count; i++) {
+		retval = tdb_record_add_unlocked(ictx, username, fmids[i], mapistore_URIs[i]);
+		if (retval != MAPISTORE_SUCCESS) {
+			tdb_transaction_cancel(TDB_WRAP(ictx)->tdb);
+			return retval;
 		}
+	}
 
-		switch (tdb_data.wildcard_count) {
-		case 0: /* complete URI */
-			partial = true;
-			break;
-		case 1: /* start and end only */
-			tdb_data.endswith = strchr(uri, '*') + 1;
-			tdb_data.startswith = talloc_strndup(NULL, uri, strlen(uri) - strlen(tdb_data.endswith) - 1);
-			break;
-		default:
-			OC_DEBUG(0, "Too many wildcards found (1 maximum)\n");
-			talloc_free(tdb_data.uri);
-			return MAPISTORE_ERR_NOT_FOUND;
+	MAPISTORE_RETVAL_IF(tdb_transaction_commit(TDB_WRAP(ictx)->tdb) == -1,
+			    MAPISTORE_ERR_DATABASE_OPS, NULL);
+
+	return MAPISTORE_SUCCESS;
+}
+
+/**
+   \details Delete a set of records within a single transaction
+
+   \return MAPISTORE_SUCCESS on success, otherwise MAPISTORE error
+ */
+static enum mapistore_error tdb_record_del_multi(struct indexing_context *ictx,
+						 const char *username,
+						 uint32_t count,
+						 const uint64_t *fmids,
+						 uint8_t flags)
+{
+	enum mapistore_error	retval;
+	uint32_t		i;
+
+	/* Sanity checks */
+	MAPISTORE_RETVAL_IF(!ictx, MAPISTORE_ERR_NOT_INITIALIZED, NULL);
+	MAPISTORE_RETVAL_IF(!username, MAPISTORE_ERR_INVALID_PARAMETER, NULL);
+	MAPISTORE_RETVAL_IF(!fmids, MAPISTORE_ERR_INVALID_PARAMETER, NULL);
+
+	MAPISTORE_RETVAL_IF(tdb_transaction_start(TDB_WRAP(ictx)->tdb) == -1,
+			    MAPISTORE_ERR_DATABASE_OPS, NULL);
+
+	for (i = 0; i < count; i++) {
+		retval = tdb_record_del_unlocked(ictx, username, fmids[i], flags);
+		if (retval != MAPISTORE_SUCCESS) {
+			tdb_transaction_cancel(TDB_WRAP(ictx)->tdb);
+			return retval;
 		}
+	}
+
+	MAPISTORE_RETVAL_IF(tdb_transaction_commit(TDB_WRAP(ictx)->tdb) == -1,
+			    MAPISTORE_ERR_DATABASE_OPS, NULL);
+
+	return MAPISTORE_SUCCESS;
+}
 
-		if (partial == true) {
-			tdb_traverse_read(TDB_WRAP(ictx)->tdb, tdb_get_fid_traverse_partial, &tdb_data);
-			talloc_free(tdb_data.startswith);
-		} else {
-			tdb_traverse_read(TDB_WRAP(ictx)->tdb, tdb_get_fid_traverse, &tdb_data);
+static enum mapistore_error tdb_record_get_uri_multi(struct indexing_context *ictx,
+						     const char *username,
+						     TALLOC_CTX *mem_ctx,
+						     uint32_t count,
+						     const uint64_t *fmids,
+						     char **uris,
+						     bool *soft_deleted)
+{
+	enum mapistore_error	retval;
+	uint32_t		i;
+
+	/* Sanity checks */
+	MAPISTORE_RETVAL_IF(!ictx, MAPISTORE_ERR_NOT_INITIALIZED, NULL);
+	MAPISTORE_RETVAL_IF(!username, MAPISTORE_ERR_INVALID_PARAMETER, NULL);
+	MAPISTORE_RETVAL_IF(!fmids, MAPISTORE_ERR_INVALID_PARAMETER, NULL);
+	MAPISTORE_RETVAL_IF(!uris, MAPISTORE_ERR_INVALID_PARAMETER, NULL);
+	MAPISTORE_RETVAL_IF(!soft_deleted, MAPISTORE_ERR_INVALID_PARAMETER, NULL);
+
+	for (i = 0; i < count; i++) {
+		soft_deleted[i] = false;
+		retval = tdb_record_get_uri(ictx, username, mem_ctx, fmids[i], &uris[i], &soft_deleted[i]);
+		if (retval != MAPISTORE_SUCCESS) {
+			uris[i] = NULL;
 		}
 	}
 
-	talloc_free(tdb_data.uri);
-	if (tdb_data.found) {
-		*fmidp = tdb_data.fmid;
-		*soft_deletedp = false; /* TODO: implement the feature */
-		ret = MAPISTORE_SUCCESS;
+	return MAPISTORE_SUCCESS;
+}
+
+static enum mapistore_error tdb_record_get_fmid_multi(struct indexing_context *ictx,
+						      const char *username,
+						      uint32_t count,
+						      const char **uris,
+						      uint64_t *fmids,
+						      bool *soft_deleted)
+{
+	enum mapistore_error	retval;
+	uint32_t		i;
+
+	/* Sanity checks */
+	MAPISTORE_RETVAL_IF(!ictx, MAPISTORE_ERR_NOT_INITIALIZED, NULL);
+	MAPISTORE_RETVAL_IF(!username, MAPISTORE_ERR_INVALID_PARAMETER, NULL);
+	MAPISTORE_RETVAL_IF(!uris, MAPISTORE_ERR_INVALID_PARAMETER, NULL);
+	MAPISTORE_RETVAL_IF(!fmids, MAPISTORE_ERR_INVALID_PARAMETER, NULL);
+	MAPISTORE_RETVAL_IF(!soft_deleted, MAPISTORE_ERR_INVALID_PARAMETER, NULL);
+	for (i = 0; i < count; i++) {
+		MAPISTORE_RETVAL_IF(!uris[i], MAPISTORE_ERR_INVALID_PARAMETER, NULL);
 	}
-	else {
-		ret = MAPISTORE_ERR_NOT_FOUND;
+
+	for (i = 0; i < count; i++) {
+		soft_deleted[i] = false;
+		retval = tdb_record_get_fmid(ictx, username, uris[i], false, &fmids[i], &soft_deleted[i]);
+		if (retval != MAPISTORE_SUCCESS) {
+			fmids[i] = 0;
+		}
 	}
 
-	return ret;
+	return MAPISTORE_SUCCESS;
+}
+
+
+static uint64_t tdb_record_get_global_count(struct indexing_context *ictx, TDB_DATA key)
+{
+	TDB_DATA	data;
+	uint64_t	GlobalCount = 1;
+
+	data = tdb_fetch(TDB_WRAP(ictx)->tdb, key);
+	if (data.dptr && data.dsize) {
+		GlobalCount = strtoull((const char*)data.dptr, NULL, 16);
+	}
+	free(data.dptr);
+
+	return GlobalCount;
 }
 
+static int tdb_record_set_global_count(struct indexing_context *ictx, TDB_DATA key, uint64_t GlobalCount)
+{
+	TDB_DATA	data;
+	int		ret;
+
+	data.dptr = (unsigned char *) talloc_asprintf(ictx, "0x%.16"PRIx64, GlobalCount);
+	if (!data.dptr) return -1;
+	data.dsize = strlen((const char *) data.dptr);
+	ret = tdb_store(TDB_WRAP(ictx)->tdb, key, data, TDB_REPLACE);
+	talloc_free(data.dptr);
+
+	return ret;
+}
 
 static enum mapistore_error tdb_record_allocate_fmids(struct indexing_context *ictx,
 						      const char *username,
 						      int count,
 						      uint64_t *fmidp)
 {
-	TDB_DATA		key, data;
+	TDB_DATA		key;
 	int			ret;
 	uint64_t		GlobalCount;
 
@@ -422,28 +1097,23 @@ static enum mapistore_error tdb_record_allocate_fmids(struct indexing_context *i
 	MAPISTORE_RETVAL_IF(!ictx, MAPISTORE_ERR_NOT_INITIALIZED, NULL);
 	MAPISTORE_RETVAL_IF(!username, MAPISTORE_ERR_NOT_INITIALIZED, NULL);
 	MAPISTORE_RETVAL_IF(!fmidp, MAPISTORE_ERR_NOT_INITIALIZED, NULL);
+	MAPISTORE_RETVAL_IF(count < 0, MAPISTORE_ERR_INVALID_PARAMETER, NULL);
 
-	/* Retrieve current counter */
 	key.dptr = (unsigned char*)"GlobalCount";
 	key.dsize = strlen((const char *)key.dptr);
 
-	data = tdb_fetch(TDB_WRAP(ictx)->tdb, key);
-	if (!data.dptr || !data.dsize) {
-		GlobalCount = 1;
-	}
-	else {
-		GlobalCount = strtoull((const char*)data.dptr, NULL, 16);
-	}
+	/* Other processes share the counter: hold its lock while we
+	 * retrieve, increment and store it */
+	MAPISTORE_RETVAL_IF(tdb_chainlock(TDB_WRAP(ictx)->tdb, key) == -1,
+			    MAPISTORE_ERR_DATABASE_OPS, NULL);
 
 	/* Save and increment the counter (reserve) */
+	GlobalCount = tdb_record_get_global_count(ictx, key);
 	*fmidp = GlobalCount;
-	GlobalCount += count,
+	GlobalCount += count;
 
-	/* Store new counter */
-	data.dptr = (unsigned char *) talloc_asprintf(ictx, "0x%.16"PRIx64, GlobalCount);
-	data.dsize = strlen((const char *) data.dptr);
-	ret = tdb_store(TDB_WRAP(ictx)->tdb, key, data, TDB_REPLACE);
-	talloc_free(data.dptr);
+	ret = tdb_record_set_global_count(ictx, key, GlobalCount);
+	tdb_chainunlock(TDB_WRAP(ictx)->tdb, key);
 
 	if (ret == -1) {
 		OC_DEBUG(3, "Unable to create %s record: 0x%.16"PRIx64" \n",
@@ -454,6 +1124,31 @@ static enum mapistore_error tdb_record_allocate_fmids(struct indexing_context *i
 	return MAPISTORE_SUCCESS;
 }
 
+/**
+   \details Give back the unused tail of the FMID lease, provided no
+   other process allocated FMIDs after it. Otherwise the tail is
+   abandoned.
+
+   \param ictx pointer to the indexing context
+ */
+static void tdb_record_release_lease(struct indexing_context *ictx)
+{
+	TDB_DATA	key;
+
+	if (ictx->lease_next >= ictx->lease_end) return;
+
+	key.dptr = (unsigned char*)"GlobalCount";
+	key.dsize = strlen((const char *)key.dptr);
+
+	if (tdb_chainlock(TDB_WRAP(ictx)->tdb, key) == -1) return;
+	if (tdb_record_get_global_count(ictx, key) == ictx->lease_end) {
+		tdb_record_set_global_count(ictx, key, ictx->lease_next);
+	}
+	tdb_chainunlock(TDB_WRAP(ictx)->tdb, key);
+
+	ictx->lease_next = ictx->lease_end;
+}
+
 static enum mapistore_error tdb_record_allocate_fmid(struct indexing_context *ictx,
 						     const char *username,
 						     uint64_t *fmidp)
@@ -462,6 +1157,151 @@ static enum mapistore_error tdb_record_allocate_fmid(struct indexing_context *ic
 }
 
 
+struct tdb_index_rebuild_data {
+	TALLOC_CTX	*mem_ctx;
+	bool		failed;
+	uint32_t	count;
+	uint64_t	*fmids;
+	char		**uris;
+};
+
+static int tdb_index_rebuild_traverse(struct tdb_context *tdb_ctx, TDB_DATA key, TDB_DATA value, void *data)
+{
+	struct tdb_index_rebuild_data	*rebuild = data;
+	size_t				tag_len = strlen(MAPISTORE_SOFT_DELETED_TAG);
+	char				*key_str;
+
+	/* Only fmid records are indexed */
+	if (key.dsize > tag_len && !memcmp(key.dptr, MAPISTORE_SOFT_DELETED_TAG, tag_len)) {
+		key.dptr += tag_len;
+		key.dsize -= tag_len;
+	}
+	if (key.dsize != MAPISTORE_INDEXING_FMID_LEN || memcmp(key.dptr, "0x", 2)) {
+		return 0;
+	}
+
+	rebuild->fmids = talloc_realloc(rebuild->mem_ctx, rebuild->fmids, uint64_t, rebuild->count + 1);
+	rebuild->uris = talloc_realloc(rebuild->mem_ctx, rebuild->uris, char *, rebuild->count + 1);
+	if (!rebuild->fmids || !rebuild->uris) {
+		rebuild->failed = true;
+		return 1;
+	}
+
+	key_str = talloc_strndup(rebuild->mem_ctx, (const char *) key.dptr, key.dsize);
+	rebuild->fmids[rebuild->count] = strtoull(key_str, NULL, 16);
+	rebuild->uris[rebuild->count] = talloc_strndup(rebuild->mem_ctx, (const char *) value.dptr, value.dsize);
+	talloc_free(key_str);
+	rebuild->count++;
+
+	return 0;
+}
+
+/**
+   \details Check whether the URI indexes of the indexing database are
+   up to date
+
+   \param tdb pointer to the indexing database
+   \param key the index version key
+
+   \return true if the indexes are current, otherwise false
+ */
+static bool tdb_index_is_current(struct tdb_context *tdb, TDB_DATA key)
+{
+	TDB_DATA	dbuf;
+	unsigned long	version;
+
+	dbuf = tdb_fetch(tdb, key);
+	if (!dbuf.dptr) return false;
+
+	version = strtoul((const char *) dbuf.dptr, NULL, 10);
+	free(dbuf.dptr);
+
+	return version >= MAPISTORE_INDEXING_VERSION;
+}
+
+/**
+   \details Build the URI indexes of an indexing database created
+   before they were introduced
+
+   \param ictx pointer to the indexing context
+
+   \return MAPISTORE_SUCCESS on success, otherwise MAPISTORE error
+ */
+static enum mapistore_error tdb_index_rebuild(struct indexing_context *ictx)
+{
+	enum mapistore_error		retval;
+	struct tdb_index_rebuild_data	rebuild;
+	struct tdb_context		*tdb = TDB_WRAP(ictx)->tdb;
+	TDB_DATA			key;
+	TDB_DATA			dbuf;
+	uint32_t			i;
+	int				ret;
+
+	key.dptr = (unsigned char *) MAPISTORE_INDEXING_VERSION_KEY;
+	key.dsize = strlen((const char *) key.dptr);
+
+	if (tdb_index_is_current(tdb, key)) {
+		return MAPISTORE_SUCCESS;
+	}
+
+	/* Another process opening the same store may be building the
+	   index too: check the version again once we hold the
+	   transaction lock, and build the whole index atomically */
+	MAPISTORE_RETVAL_IF(tdb_transaction_start(tdb) == -1, MAPISTORE_ERR_DATABASE_OPS, NULL);
+	if (tdb_index_is_current(tdb, key)) {
+		tdb_transaction_cancel(tdb);
+		return MAPISTORE_SUCCESS;
+	}
+
+	rebuild.mem_ctx = talloc_named(NULL, 0, "tdb_index_rebuild");
+	rebuild.failed = false;
+	rebuild.count = 0;
+	rebuild.fmids = NULL;
+	rebuild.uris = NULL;
+
+	/* Collect the records first: the traversal must not add records */
+	ret = tdb_traverse_read(tdb, tdb_index_rebuild_traverse, &rebuild);
+	if (ret == -1 || rebuild.failed) {
+		retval = MAPISTORE_ERR_DATABASE_OPS;
+		goto cancel;
+	}
+
+	for (i = 0; i < rebuild.count; i++) {
+		if (!rebuild.uris[i]) continue;
+		retval = tdb_index_add(ictx, rebuild.fmids[i], rebuild.uris[i]);
+		if (retval != MAPISTORE_SUCCESS) goto cancel;
+	}
+
+	dbuf.dptr = (unsigned char *) talloc_asprintf(rebuild.mem_ctx, "%d", MAPISTORE_INDEXING_VERSION);
+	dbuf.dsize = strlen((const char *) dbuf.dptr);
+	if (tdb_store(tdb, key, dbuf, TDB_REPLACE) == -1) {
+		retval = MAPISTORE_ERR_DATABASE_OPS;
+		goto cancel;
+	}
+
+	ret = tdb_transaction_commit(tdb);
+	MAPISTORE_RETVAL_IF(ret == -1, MAPISTORE_ERR_DATABASE_OPS, rebuild.mem_ctx);
+	OC_DEBUG(3, "URI index built for %d records of %s\n", rebuild.count, ictx->url);
+	talloc_free(rebuild.mem_ctx);
+
+	return MAPISTORE_SUCCESS;
+
+cancel:
+	tdb_transaction_cancel(tdb);
+	talloc_free(rebuild.mem_ctx);
+	return retval;
+}
+
+
+static int mapistore_indexing_tdb_destructor(struct indexing_context *ictx)
+{
+	if (TDB_WRAP(ictx)) {
+		tdb_record_release_lease(ictx);
+	}
+	return 0;
+}
+
+
 /**
    \details Open connection to indexing database for a given user
 
@@ -497,7 +1337,10 @@ _PUBLIC_ enum mapistore_error mapistore_indexing_tdb_init(struct mapistore_conte
 	dbpath = talloc_asprintf(mem_ctx, "%s/%s/indexing.tdb",
 				 mapistore_get_mapping_path(), username);
 
-	ictx->data = mapistore_tdb_wrap_open(ictx, dbpath, 0, 0, O_RDWR|O_CREAT, 0600);
+	/* Every add, update and delete runs in a transaction: do not
+	   fsync each commit. Plain stores were never synced either, and
+	   the URI index can be rebuilt from the fmid records */
+	ictx->data = mapistore_tdb_wrap_open(ictx, dbpath, MAPISTORE_INDEXING_HASH_SIZE, TDB_NOSYNC, O_RDWR|O_CREAT, 0600);
 	talloc_free(dbpath);
 	if (!TDB_WRAP(ictx)) {
 		OC_DEBUG(3, "%s\n", strerror(errno));
@@ -508,6 +1351,15 @@ _PUBLIC_ enum mapistore_error mapistore_indexing_tdb_init(struct mapistore_conte
 
 	/* TODO: extract url from backend mapping, by the moment we use the username */
 	ictx->url = talloc_strdup(ictx, username);
+	talloc_set_destructor(ictx, mapistore_indexing_tdb_destructor);
+
+	/* Step 2. Index the URIs of databases created without indexes */
+	if (tdb_index_rebuild(ictx) != MAPISTORE_SUCCESS) {
+		OC_DEBUG(3, "Unable to build the URI index of %s\n", username);
+		talloc_free(ictx);
+		talloc_free(mem_ctx);
+		return MAPISTORE_ERR_DATABASE_INIT;
+	}
 
 	/* Fill function pointers */
 	ictx->add_fmid = tdb_record_add;
@@ -515,6 +1367,10 @@ _PUBLIC_ enum mapistore_error mapistore_indexing_tdb_init(struct mapistore_conte
 	ictx->update_fmid = tdb_record_update;
 	ictx->get_uri = tdb_record_get_uri;
 	ictx->get_fmid = tdb_record_get_fmid;
+	ictx->add_fmids = tdb_record_add_multi;
+	ictx->del_fmids = tdb_record_del_multi;
+	ictx->get_uris = tdb_record_get_uri_multi;
+	ictx->get_fmids = tdb_record_get_fmid_multi;
 	ictx->allocate_fmid = tdb_record_allocate_fmid;
 	ictx->allocate_fmids = tdb_record_allocate_fmids;
 
@@ -26,6 +26,12 @@
 
 #define	MAPISTORE_DB_INDEXING		"indexing.tdb"
 #define	MAPISTORE_SOFT_DELETED_TAG	"SOFT_DELETED:"
+#define	MAPISTORE_URI_INDEX_TAG		"URI:"
+#define	MAPISTORE_DIR_INDEX_TAG		"DIR:"
+#define	MAPISTORE_INDEXING_FMID_LEN	18
+#define	MAPISTORE_INDEXING_VERSION_KEY	"IndexVersion"
+#define	MAPISTORE_INDEXING_VERSION	1
+#define	MAPISTORE_INDEXING_HASH_SIZE	10007
 
 
 enum mapistore_error mapistore_indexing_tdb_init(struct mapistore_context *,
@@ -40,10 +40,24 @@ struct namedprops_context {
 	enum mapistore_error (*transaction_start)(struct namedprops_context *);
 	enum mapistore_error (*transaction_commit)(struct namedprops_context *);
 
+	/* Give back the resources held for the last call - optional */
+	void (*release)(struct namedprops_context *);
+
 	const char *backend_type;
 	void *data;
 };
 
+/* Called once the backend is done with a call: let it give back what it
+   held for it, such as database connections, and pass the result on */
+static inline enum mapistore_error mapistore_namedprops_done(struct namedprops_context *nprops,
+							     enum mapistore_error ret)
+{
+	if (nprops->release) {
+		nprops->release(nprops);
+	}
+	return ret;
+}
+
 
 #ifndef __BEGIN_DECLS
 #ifdef __cplusplus
@@ -31,6 +31,8 @@
 #include <mysql/mysqld_error.h>
 #include <ldb.h>
 
+/* Connections are checked out per call, see mysql_rw_init */
+#define CONNECTION(self)	mysql_rw_writer((struct mysql_rw *)(self)->data, NULL)
 
 static enum mapistore_error get_mapped_id(struct namedprops_context *self,
 					  struct MAPINAMEID nameid,
@@ -39,38 +41,30 @@ static enum mapistore_error get_mapped_id(struct namedprops_context *self,
 	TALLOC_CTX *mem_ctx = talloc_zero(NULL, TALLOC_CTX);
 	int type = nameid.ulKind;
 	char *guid = GUID_string(mem_ctx, &nameid.lpguid);
-	MYSQL *conn = self->data;
+	MYSQL *conn = CONNECTION(self);
+	struct stmt_value params[3] = { STMT_UINT_VALUE(type), STMT_STRING_VALUE(guid) };
+	struct stmt_value result = STMT_UINT_VALUE(0);
+	enum MYSQLRESULT ret;
 
-	char *sql = NULL;
 	if (type == MNID_ID) {
-		uint32_t prop_id = nameid.kind.lid;
-		sql = talloc_asprintf(mem_ctx,
+		params[2] = (struct stmt_value) STMT_UINT_VALUE(nameid.kind.lid);
+		ret = stmt_select_first(mem_ctx, conn,
 			"SELECT mappedId FROM "NAMEDPROPS_MYSQL_TABLE" "
-			"WHERE `type`=%d AND `oleguid`='%s' AND `propId`=%d",
-			type, guid, prop_id);
+			"WHERE `type`=? AND `oleguid`=? AND `propId`=?",
+			params, 3, &result, 1);
 	} else if (type == MNID_STRING) {
-		const char *prop_name = nameid.kind.lpwstr.Name;
-		sql = talloc_asprintf(mem_ctx,
+		params[2] = (struct stmt_value) STMT_STRING_VALUE(nameid.kind.lpwstr.Name);
+		ret = stmt_select_first(mem_ctx, conn,
 			"SELECT mappedId FROM "NAMEDPROPS_MYSQL_TABLE" "
-			"WHERE `type`=%d AND `oleguid`='%s' AND `propName`='%s'",
-			type, guid, prop_name);
+			"WHERE `type`=? AND `oleguid`=? AND `propName`=?",
+			params, 3, &result, 1);
 	} else {
 		MAPISTORE_RETVAL_IF(true, MAPISTORE_ERROR, mem_ctx);
 	}
 
-	if (mysql_query(conn, sql) != 0) {
-		MAPISTORE_RETVAL_IF(true, MAPISTORE_ERR_DATABASE_OPS, mem_ctx);
-	}
-
-	MYSQL_RES *res = mysql_store_result(conn);
-	if (mysql_num_rows(res) == 0) {
-		// Not found
-		mysql_free_result(res);
-		MAPISTORE_RETVAL_IF(true, MAPISTORE_ERR_NOT_FOUND, mem_ctx);
-	}
-	MYSQL_ROW row = mysql_fetch_row(res);
-	*mapped_id = strtol(row[0], NULL, 10);
-	mysql_free_result(res);
+	MAPISTORE_RETVAL_IF(ret == MYSQL_NOT_FOUND, MAPISTORE_ERR_NOT_FOUND, mem_ctx);
+	MAPISTORE_RETVAL_IF(ret != MYSQL_SUCCESS, MAPISTORE_ERR_DATABASE_OPS, mem_ctx);
+	*mapped_id = result.n;
 
 	talloc_free(mem_ctx);
 	return MAPISTORE_SUCCESS;
@@ -99,7 +93,7 @@ static enum mapistore_error next_unused_id(struct namedprops_context *nprops,
 	MAPISTORE_RETVAL_IF(!nprops, MAPISTORE_ERR_INVALID_PARAMETER, NULL);
 	MAPISTORE_RETVAL_IF(!highest_id, MAPISTORE_ERR_INVALID_PARAMETER, NULL);
 
-	conn = (MYSQL *) nprops->data;
+	conn = CONNECTION(nprops);
 	MAPISTORE_RETVAL_IF(!conn, MAPISTORE_ERR_DATABASE_OPS, NULL);
 
 	mem_ctx = talloc_named(NULL, 0, "next_unused_id");
@@ -165,8 +159,8 @@ static enum mapistore_error create_id(struct namedprops_context *self,
 	char *sql = talloc_asprintf(mem_ctx,
 		"INSERT INTO " NAMEDPROPS_MYSQL_TABLE " SET %s", fields_sql);
 	OC_DEBUG(5, "Inserting record:\n%s\n", sql);
-	MYSQL *conn = self->data;
-	if (mysql_query(conn, sql) != 0) {
+	MYSQL *conn = CONNECTION(self);
+	if (!conn || mysql_query(conn, sql) != 0) {
 		MAPISTORE_RETVAL_IF(true, MAPISTORE_ERR_DATABASE_OPS, mem_ctx);
 	}
 
@@ -180,43 +174,38 @@ static enum mapistore_error get_nameid(struct namedprops_context *self,
 				       struct MAPINAMEID **nameidp)
 {
 	TALLOC_CTX *local_mem_ctx = talloc_zero(NULL, TALLOC_CTX);
-	MYSQL *conn = self->data;
-	const char *sql = talloc_asprintf(local_mem_ctx,
+	MYSQL *conn = CONNECTION(self);
+	struct stmt_value params[] = { STMT_UINT_VALUE(mapped_id) };
+	struct stmt_value results[] = { STMT_UINT_VALUE(0), STMT_STRING_VALUE(NULL),
+					STMT_STRING_VALUE(NULL), STMT_UINT_VALUE(0) };
+	enum MYSQLRESULT sql_ret;
+
+	sql_ret = stmt_select_first(local_mem_ctx, conn,
 		"SELECT type, oleguid, propName, propId FROM "NAMEDPROPS_MYSQL_TABLE" "
-		"WHERE mappedId=%d", mapped_id);
-	if (mysql_query(conn, sql) != 0) {
-		MAPISTORE_RETVAL_IF(true, MAPISTORE_ERR_DATABASE_OPS,
-				    local_mem_ctx);
-	}
-	MYSQL_RES *res = mysql_store_result(conn);
-	if (mysql_num_rows(res) == 0) {
-		// Not found
-		mysql_free_result(res);
-		MAPISTORE_RETVAL_IF(true, MAPISTORE_ERR_NOT_FOUND,
-				    local_mem_ctx);
-	}
-	MYSQL_ROW row = mysql_fetch_row(res);
+		"WHERE mappedId=?", params, 1, results, 4);
+	MAPISTORE_RETVAL_IF(sql_ret == MYSQL_NOT_FOUND, MAPISTORE_ERR_NOT_FOUND, local_mem_ctx);
+	MAPISTORE_RETVAL_IF(sql_ret != MYSQL_SUCCESS, MAPISTORE_ERR_DATABASE_OPS, local_mem_ctx);
 
 	enum mapistore_error ret = MAPISTORE_SUCCESS;
 	struct MAPINAMEID *nameid = talloc_zero(mem_ctx, struct MAPINAMEID);
-	const char *guid = row[1];
+	const char *guid = results[1].s;
 	GUID_from_string(guid, &nameid->lpguid);
-	int type = strtol(row[0], NULL, 10);
+	int type = results[0].n;
 	nameid->ulKind = type;
 	if (type == MNID_ID) {
-		nameid->kind.lid = strtol(row[3], NULL, 10);
-	} else if (type == MNID_STRING) {
-		const char *propName = row[2];
+		nameid->kind.lid = results[3].n;
+	} else if (type == MNID_STRING && results[2].s) {
+		const char *propName = results[2].s;
 		nameid->kind.lpwstr.NameSize = strlen(propName) * 2 + 2;//FIXME WHY *2+2 and not just +1?
 		nameid->kind.lpwstr.Name = talloc_strdup(nameid, propName);
 	} else {
+		talloc_free(nameid);
 		nameid = NULL;
 		ret = MAPISTORE_ERROR;
 	}
 
 	*nameidp = nameid;
 
-	mysql_free_result(res);
 	talloc_free(local_mem_ctx);
 
 	return ret;
@@ -226,50 +215,54 @@ static enum mapistore_error get_nameid_type(struct namedprops_context *self,
 					    uint16_t mapped_id,
 					    uint16_t *prop_type)
 {
-	TALLOC_CTX *mem_ctx = talloc_zero(NULL, TALLOC_CTX);
-	MYSQL *conn = self->data;
-	const char *sql = talloc_asprintf(mem_ctx,
-		//FIXME mappedId or propId? mappedId is not unique
-		"SELECT propType FROM "NAMEDPROPS_MYSQL_TABLE" WHERE mappedId=%d",
-		mapped_id);
-	if (mysql_query(conn, sql) != 0) {
-		MAPISTORE_RETVAL_IF(true, MAPISTORE_ERR_DATABASE_OPS, mem_ctx);
-	}
-	MYSQL_RES *res = mysql_store_result(conn);
-	if (mysql_num_rows(res) == 0) {
-		// Not found
-		mysql_free_result(res);
-		MAPISTORE_RETVAL_IF(true, MAPISTORE_ERR_NOT_FOUND, mem_ctx);
-	}
-	MYSQL_ROW row = mysql_fetch_row(res);
-	*prop_type = strtol(row[0], NULL, 10);
-	mysql_free_result(res);
-	talloc_free(mem_ctx);
+	MYSQL *conn = CONNECTION(self);
+	struct stmt_value params[] = { STMT_UINT_VALUE(mapped_id) };
+	struct stmt_value result = STMT_UINT_VALUE(0);
+	enum MYSQLRESULT ret;
+
+	//FIXME mappedId or propId? mappedId is not unique
+	ret = stmt_select_first(NULL, conn,
+		"SELECT propType FROM "NAMEDPROPS_MYSQL_TABLE" WHERE mappedId=?",
+		params, 1, &result, 1);
+	MAPISTORE_RETVAL_IF(ret == MYSQL_NOT_FOUND, MAPISTORE_ERR_NOT_FOUND, NULL);
+	MAPISTORE_RETVAL_IF(ret != MYSQL_SUCCESS, MAPISTORE_ERR_DATABASE_OPS, NULL);
+	*prop_type = result.n;
 	return MAPISTORE_SUCCESS;
 }
 
 static enum mapistore_error transaction_start(struct namedprops_context *self)
 {
-	MYSQL *conn = self->data;
+	MYSQL *conn = CONNECTION(self);
+	MAPISTORE_RETVAL_IF(!conn, MAPISTORE_ERR_DATABASE_OPS, NULL);
 	int res = mysql_query(conn, "START TRANSACTION");
 	MAPISTORE_RETVAL_IF(res, MAPISTORE_ERR_DATABASE_OPS, NULL);
+	/* Keep the connection until the transaction ends */
+	mysql_rw_pin(self->data, true);
 	return MAPISTORE_SUCCESS;
 }
 
 static enum mapistore_error transaction_commit(struct namedprops_context *self)
 {
-	MYSQL *conn = self->data;
+	MYSQL *conn = CONNECTION(self);
+	MAPISTORE_RETVAL_IF(!conn, MAPISTORE_ERR_DATABASE_OPS, NULL);
 	int res = mysql_query(conn, "COMMIT");
+	mysql_rw_pin(self->data, false);
 	MAPISTORE_RETVAL_IF(res, MAPISTORE_ERR_DATABASE_OPS, NULL);
 	return MAPISTORE_SUCCESS;
 }
 
+static void release(struct namedprops_context *self)
+{
+	mysql_rw_release(self->data);
+}
+
 static int mapistore_namedprops_mysql_destructor(struct namedprops_context *self)
 {
 	OC_DEBUG(5, "Destroying namedprops mysql context\n");
 	if (self && self->data) {
-		MYSQL *conn = self->data;
-		release_connection(conn);
+		/* Connections are checked in along with the read/write split */
+		talloc_free(self->data);
+		self->data = NULL;
 	} else {
 		OC_DEBUG(0, "Error: tried to destroy corrupted namedprops mysql context\n");
 	}
@@ -301,6 +294,7 @@ enum mapistore_error mapistore_namedprops_mysql_parameters(struct loadparm_conte
 	p->host = lpcfg_parm_string(lp_ctx, NULL, "namedproperties", "mysql_host");
 	p->port = lpcfg_parm_int(lp_ctx, NULL, "namedproperties", "mysql_port", 3306);
 	p->db = lpcfg_parm_string(lp_ctx, NULL, "namedproperties", "mysql_db");
+	p->pool = lpcfg_parm_string(lp_ctx, NULL, "namedproperties", "mysql_pool");
 
 	/* Enforce the logic */
 	MAPISTORE_RETVAL_IF(!p->user, MAPISTORE_ERR_BACKEND_INIT, NULL);
@@ -326,7 +320,13 @@ static char *connection_string_from_parameters(TALLOC_CTX *mem_ctx, struct named
 		connection_string = talloc_asprintf_append(connection_string, ":%d", parms->port);
 		if (!connection_string) return NULL;
 	}
-	return talloc_asprintf_append(connection_string, "/%s", parms->db);
+	connection_string = talloc_asprintf_append(connection_string, "/%s", parms->db);
+	if (!connection_string) return NULL;
+	if (parms->pool && parms->pool[0]) {
+		/* Connection pool options, e.g. min=1&max=4 */
+		connection_string = talloc_asprintf_append(connection_string, "?%s", parms->pool);
+	}
+	return connection_string;
 }
 
 /**
@@ -348,6 +348,7 @@ enum mapistore_error mapistore_namedprops_mysql_init(TALLOC_CTX *mem_ctx,
 	struct namedprops_mysql_params	parms;
 	MYSQL				*conn = NULL;
 	char				*connection_string = NULL;
+	bool				schema_exists;
 	int				schema_created_ret;
 
 	/* Sanity checks */
@@ -374,9 +375,11 @@ enum mapistore_error mapistore_namedprops_mysql_init(TALLOC_CTX *mem_ctx,
 		create_connection(connection_string, &conn);
 	}
 	MAPISTORE_RETVAL_IF(!conn, MAPISTORE_ERR_NOT_INITIALIZED, NULL);
+	schema_exists = table_exists(conn, NAMEDPROPS_MYSQL_TABLE);
+	release_connection(conn);
 
 	/* Initialize the database */
-	if (!table_exists(conn, NAMEDPROPS_MYSQL_TABLE)) {
+	if (!schema_exists) {
 		OC_DEBUG(3, "Creating schema for named_properties on mysql %s\n",
 			 connection_string);
 		schema_created_ret = migrate_named_properties_schema(connection_string);
@@ -387,11 +390,9 @@ enum mapistore_error mapistore_namedprops_mysql_init(TALLOC_CTX *mem_ctx,
 		}
 	}
 
-	talloc_free(connection_string);
-
 	/* Create context */
 	nprops = talloc_zero(mem_ctx, struct namedprops_context);
-	MAPISTORE_RETVAL_IF(!nprops, MAPISTORE_ERR_NO_MEMORY, NULL);
+	MAPISTORE_RETVAL_IF(!nprops, MAPISTORE_ERR_NO_MEMORY, connection_string);
 
 	nprops->backend_type = NAMEDPROPS_BACKEND_MYSQL;
 
@@ -402,8 +403,11 @@ enum mapistore_error mapistore_namedprops_mysql_init(TALLOC_CTX *mem_ctx,
 	nprops->next_unused_id = next_unused_id;
 	nprops->transaction_commit = transaction_commit;
 	nprops->transaction_start = transaction_start;
+	nprops->release = release;
 
-	nprops->data = conn;
+	nprops->data = mysql_rw_init(nprops, connection_string, NULL, 0);
+	talloc_free(connection_string);
+	MAPISTORE_RETVAL_IF(!nprops->data, MAPISTORE_ERR_NO_MEMORY, nprops);
 	talloc_set_destructor(nprops, mapistore_namedprops_mysql_destructor);
 
 	*nprops_ctx = nprops;
@@ -36,6 +36,7 @@ struct namedprops_mysql_params {
 	const char	*user;
 	const char	*pass;
 	const char	*db;
+	const char	*pool;
 	int		port;
 };
 
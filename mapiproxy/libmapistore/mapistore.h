@@ -67,6 +67,12 @@ typedef	int (*init_backend_fn) (void);
 #define	MAPISTORE_SOFT_DELETE		1
 #define	MAPISTORE_PERMANENT_DELETE	2
 
+/* Default number of FMIDs leased from the indexing backend at once */
+#define	MAPISTORE_FMID_LEASE_SIZE	1024
+
+/* Default seconds a user keeps reading from the indexing backend after a write */
+#define	MAPISTORE_INDEXING_REPLICA_STICKY	5
+
 /* Default filename for named properties backend using ldb */
 #define MAPISTORE_DB_NAMED  "named_properties.ldb"
 
@@ -153,9 +159,22 @@ struct indexing_context {
 	enum mapistore_error	(*get_uri)(struct indexing_context *, const char *, TALLOC_CTX *, uint64_t, char **, bool *);
 	enum mapistore_error	(*get_fmid)(struct indexing_context *, const char *, const char *, bool, uint64_t *, bool *);
 
+	/* Batch variants: one database round trip for a set of records */
+	enum mapistore_error	(*add_fmids)(struct indexing_context *, const char *, uint32_t, const uint64_t *, const char **);
+	enum mapistore_error	(*del_fmids)(struct indexing_context *, const char *, uint32_t, const uint64_t *, uint8_t);
+	enum mapistore_error	(*get_uris)(struct indexing_context *, const char *, TALLOC_CTX *, uint32_t, const uint64_t *, char **, bool *);
+	enum mapistore_error	(*get_fmids)(struct indexing_context *, const char *, uint32_t, const char **, uint64_t *, bool *);
+
 	enum mapistore_error	(*allocate_fmid)(struct indexing_context *, const char *, uint64_t *);
 	enum mapistore_error	(*allocate_fmids)(struct indexing_context *, const char *, int, uint64_t *);
 
+	/* Give back the resources held for the last call - optional */
+	void			(*release)(struct indexing_context *);
+
+	/* FMID range leased from the backend, [lease_next, lease_end) is still unused */
+	uint64_t		lease_next;
+	uint64_t		lease_end;
+
 	/* Backend URL */
 	const char *url;
 
@@ -166,6 +185,17 @@ struct indexing_context {
 	void *cache;
 };
 
+/* Called once the backend is done with a call: let it give back what it
+   held for it, such as database connections, and pass the result on */
+static inline enum mapistore_error mapistore_indexing_done(struct indexing_context *ictx,
+							   enum mapistore_error ret)
+{
+	if (ictx->release) {
+		ictx->release(ictx);
+	}
+	return ret;
+}
+
 struct mapistore_backend {
 	/** backend operations */
 	struct {
@@ -315,6 +345,9 @@ struct mapistore_context *mapistore_init(TALLOC_CTX *, struct loadparm_context *
 void mapistore_set_default_indexing_url(const char *);
 void mapistore_set_default_cache_url(const char *);
 char *mapistore_get_default_cache_url(void);
+void mapistore_set_default_indexing_replica(const char *, uint32_t);
+const char *mapistore_get_default_indexing_replica(const char *, uint32_t *);
+void mapistore_set_default_fmid_lease_size(uint32_t);
 enum mapistore_error mapistore_release(struct mapistore_context *);
 enum mapistore_error mapistore_set_connection_info(struct mapistore_context *, struct ldb_context *, struct openchangedb_context *, const char *);
 enum mapistore_error mapistore_add_context(struct mapistore_context *, const char *, const char *, uint64_t, uint32_t *, void **);
@@ -393,11 +426,16 @@ enum mapistore_error mapistore_indexing_record_del_mid(struct mapistore_context
 enum mapistore_error mapistore_indexing_record_add_fmid_for_uri(struct mapistore_context *, uint32_t, const char *, uint64_t, const char *);
 enum mapistore_error mapistore_indexing_record_get_uri(struct mapistore_context *, const char *, TALLOC_CTX *, uint64_t, char **, bool *);
 enum mapistore_error mapistore_indexing_record_get_fmid(struct mapistore_context *, const char *, const char *, bool, uint64_t *, bool *);
+enum mapistore_error mapistore_indexing_record_add_fmids(struct mapistore_context *, uint32_t, const char *, uint32_t, const uint64_t *, const char **);
+enum mapistore_error mapistore_indexing_record_del_fmids(struct mapistore_context *, uint32_t, const char *, uint32_t, const uint64_t *, uint8_t);
+enum mapistore_error mapistore_indexing_record_get_uris(struct mapistore_context *, const char *, TALLOC_CTX *, uint32_t, const uint64_t *, char **, bool *);
+enum mapistore_error mapistore_indexing_record_get_fmids(struct mapistore_context *, const char *, uint32_t, const char **, uint64_t *, bool *);
 
 enum mapistore_error mapistore_indexing_get_new_folderID(struct mapistore_context *, uint64_t *);
 enum mapistore_error mapistore_indexing_get_new_folderID_as_user(struct mapistore_context *, const char *, uint64_t *);
 enum mapistore_error mapistore_indexing_get_new_folderIDs(struct mapistore_context *, TALLOC_CTX *, uint64_t, struct UI8Array_r **);
 enum mapistore_error mapistore_indexing_reserve_fmid_range(struct mapistore_context *, uint64_t, uint64_t *);
+void mapistore_indexing_get_lease_stats(uint64_t *, double *);
 
 /* definitions from mapistore_replica_mapping.c */
 enum mapistore_error mapistore_replica_mapping_add(struct mapistore_context *, const char *, struct replica_mapping_context_list **);
@@ -39,6 +39,13 @@
 
 char *default_indexing_url = NULL;
 char *default_cache_url = NULL;
+static char *default_indexing_replica = NULL;
+static uint32_t default_indexing_replica_sticky = MAPISTORE_INDEXING_REPLICA_STICKY;
+static uint32_t default_fmid_lease_size = MAPISTORE_FMID_LEASE_SIZE;
+
+/* Lease refills done by this process */
+static uint64_t fmid_lease_refills = 0;
+static time_t fmid_lease_since = 0;
 
 /**
    \details Set the default backend url. If none is set, a tdb file per user
@@ -85,6 +92,102 @@ _PUBLIC_ char *mapistore_get_default_cache_url(void)
 	return default_cache_url;
 }
 
+/**
+   \details Set the replica read-only indexing queries are sent to when
+   the default MySQL indexing backend is used. If none is set, every
+   query goes to the indexing backend.
+
+   \param url replica url to be used
+   \param sticky seconds a user keeps reading from the indexing
+   backend after a write
+ */
+_PUBLIC_ void mapistore_set_default_indexing_replica(const char *url, uint32_t sticky)
+{
+	TALLOC_CTX *mem_ctx;
+
+	if (default_indexing_replica) talloc_free(default_indexing_replica);
+
+	if (url == NULL) {
+		default_indexing_replica = NULL;
+	} else {
+		mem_ctx = talloc_autofree_context();
+		default_indexing_replica = talloc_strdup(mem_ctx, url);
+	}
+	default_indexing_replica_sticky = sticky;
+}
+
+/**
+   \details Retrieve the replica of an indexing backend
+
+   \param url the indexing backend url
+   \param sticky pointer to the returned read-your-writes delay
+
+   \return the replica url, NULL if url has no replica
+ */
+_PUBLIC_ const char *mapistore_get_default_indexing_replica(const char *url, uint32_t *sticky)
+{
+	/* Per-user indexing backends are not replicated */
+	if (!url || !default_indexing_url || strcmp(url, default_indexing_url)) {
+		return NULL;
+	}
+	if (sticky) {
+		*sticky = default_indexing_replica_sticky;
+	}
+
+	return default_indexing_replica;
+}
+
+/* Write the FMID lease counters into a statistics file */
+static void mapistore_indexing_dump_lease_stats(FILE *fp)
+{
+	uint64_t	refills;
+	double		rate;
+
+	mapistore_indexing_get_lease_stats(&refills, &rate);
+	fprintf(fp, "# fmid lease refills %"PRIu64", %.2f/s\n", refills, rate);
+}
+
+/* Forget the FMID lease counters */
+static void mapistore_indexing_reset_lease_stats(void)
+{
+	fmid_lease_refills = 0;
+	fmid_lease_since = 0;
+}
+
+/**
+   \details Set the number of FMIDs leased from the indexing backend
+   at once. Leased FMIDs are handed out locally without going to the
+   backend until the lease is exhausted.
+
+   \param lease_size number of FMIDs to lease, 0 disables leasing
+ */
+_PUBLIC_ void mapistore_set_default_fmid_lease_size(uint32_t lease_size)
+{
+	default_fmid_lease_size = lease_size;
+	mapiproxy_stats_register("fmid_lease", mapistore_indexing_dump_lease_stats,
+				 mapistore_indexing_reset_lease_stats);
+}
+
+/**
+   \details Retrieve the FMID lease statistics of this process
+
+   \param refills pointer to the number of leases taken from the
+   backend
+   \param rate pointer to the number of leases taken per second
+ */
+_PUBLIC_ void mapistore_indexing_get_lease_stats(uint64_t *refills, double *rate)
+{
+	time_t	elapsed;
+
+	if (refills) {
+		*refills = fmid_lease_refills;
+	}
+	if (rate) {
+		elapsed = fmid_lease_since ? time(NULL) - fmid_lease_since : 0;
+		*rate = (double) fmid_lease_refills / (elapsed > 0 ? elapsed : 1);
+	}
+}
+
 /**
    \details Search the indexing record matching the username
 
@@ -212,7 +315,8 @@ enum mapistore_error mapistore_indexing_record_add_fmid(struct mapistore_context
 	MAPISTORE_RETVAL_IF(ret != MAPISTORE_SUCCESS, MAPISTORE_ERROR, mem_ctx);
 
 	/* Add the record given its fid and mapistore_uri */
-	ret = ictx->add_fmid(ictx, username, fmid, mapistore_URI);
+	ret = mapistore_indexing_done(ictx,
+		ictx->add_fmid(ictx, username, fmid, mapistore_URI));
 
 	talloc_free(mem_ctx);
 	return ret;
@@ -257,7 +361,8 @@ enum mapistore_error mapistore_indexing_record_add_fmid_for_uri(struct mapistore
 	MAPISTORE_RETVAL_IF(!ictx, MAPISTORE_ERROR, NULL);
 
 	/* Add the record given its fmid and mapistore_uri */
-	ret = ictx->add_fmid(ictx, username, fmid, mapistore_uri);
+	ret = mapistore_indexing_done(ictx,
+		ictx->add_fmid(ictx, username, fmid, mapistore_uri));
 	return ret;
 }
 
@@ -300,7 +405,8 @@ enum mapistore_error mapistore_indexing_record_del_fmid(struct mapistore_context
 	switch(type) {
 	case MAPISTORE_FOLDER:
 	case MAPISTORE_MESSAGE:
-		ret = ictx->del_fmid(ictx, username, fmid, flags);
+		ret = mapistore_indexing_done(ictx,
+			ictx->del_fmid(ictx, username, fmid, flags));
 		break;
 	default:
 		return MAPISTORE_ERR_INVALID_PARAMETER;
@@ -338,7 +444,8 @@ _PUBLIC_ enum mapistore_error mapistore_indexing_record_get_uri(struct mapistore
 	MAPISTORE_RETVAL_IF(ret, MAPISTORE_ERROR, NULL);
 	MAPISTORE_RETVAL_IF(!ictx, MAPISTORE_ERROR, NULL);
 
-	return ictx->get_uri(ictx, username, mem_ctx, fmid, urip, soft_deletedp);
+	return mapistore_indexing_done(ictx,
+		ictx->get_uri(ictx, username, mem_ctx, fmid, urip, soft_deletedp));
 }
 
 _PUBLIC_ enum mapistore_error mapistore_indexing_record_get_fmid(struct mapistore_context *mstore_ctx, const char *username, const char *uri, bool partial, uint64_t *fmidp, bool *soft_deletedp)
@@ -357,7 +464,175 @@ _PUBLIC_ enum mapistore_error mapistore_indexing_record_get_fmid(struct mapistor
 	MAPISTORE_RETVAL_IF(ret, MAPISTORE_ERROR, NULL);
 	MAPISTORE_RETVAL_IF(!ictx, MAPISTORE_ERROR, NULL);
 
-	return ictx->get_fmid(ictx, username, uri, partial, fmidp, soft_deletedp);
+	return mapistore_indexing_done(ictx,
+		ictx->get_fmid(ictx, username, uri, partial, fmidp, soft_deletedp));
+}
+
+/**
+   \details Add a set of folder or message records to the indexing
+   database in a single operation
+
+   \param mstore_ctx pointer to the mapistore context
+   \param context_id the context identifier referencing the indexing
+   database to update
+   \param username the username who owns the new entries
+   \param count the number of records to add
+   \param fmids array of count folder or message IDs to add
+   \param mapistore_uris array of count URIs to map against the fmids
+
+   \note No record is added if one of the fmids already exists.
+
+   \return MAPISTORE_SUCCESS on success, otherwise MAPISTORE error
+ */
+_PUBLIC_ enum mapistore_error mapistore_indexing_record_add_fmids(struct mapistore_context *mstore_ctx,
+								  uint32_t context_id, const char *username,
+								  uint32_t count, const uint64_t *fmids,
+								  const char **mapistore_uris)
+{
+	struct backend_context		*backend_ctx;
+	struct indexing_context		*ictx;
+	enum mapistore_error		ret;
+
+	/* Sanity checks */
+	MAPISTORE_RETVAL_IF(!mstore_ctx, MAPISTORE_ERR_INVALID_PARAMETER, NULL);
+	MAPISTORE_RETVAL_IF(!context_id, MAPISTORE_ERR_INVALID_PARAMETER, NULL);
+	MAPISTORE_RETVAL_IF(!username, MAPISTORE_ERR_INVALID_PARAMETER, NULL);
+	MAPISTORE_RETVAL_IF(!count, MAPISTORE_SUCCESS, NULL);
+	MAPISTORE_RETVAL_IF(!fmids, MAPISTORE_ERR_INVALID_PARAMETER, NULL);
+	MAPISTORE_RETVAL_IF(!mapistore_uris, MAPISTORE_ERR_INVALID_PARAMETER, NULL);
+
+	/* Ensure the context exists */
+	backend_ctx = mapistore_backend_lookup(mstore_ctx->context_list, context_id);
+	MAPISTORE_RETVAL_IF(!backend_ctx, MAPISTORE_ERR_INVALID_PARAMETER, NULL);
+	MAPISTORE_RETVAL_IF(!backend_ctx->indexing, MAPISTORE_ERR_INVALID_PARAMETER, NULL);
+
+	ret = mapistore_indexing_add(mstore_ctx, username, &ictx);
+	MAPISTORE_RETVAL_IF(ret, MAPISTORE_ERROR, NULL);
+	MAPISTORE_RETVAL_IF(!ictx, MAPISTORE_ERROR, NULL);
+
+	return mapistore_indexing_done(ictx,
+		ictx->add_fmids(ictx, username, count, fmids, mapistore_uris));
+}
+
+/**
+   \details Remove a set of folder or message records from the indexing
+   database in a single operation
+
+   \param mstore_ctx pointer to the mapistore context
+   \param context_id the context identifier referencing the indexing
+   database to update
+   \param username the username who owns the entries
+   \param count the number of records to remove
+   \param fmids array of count folder or message IDs to remove
+   \param flags the type of deletion MAPISTORE_SOFT_DELETE or
+   MAPISTORE_PERMANENT_DELETE
+
+   \note fmids which are not indexed are ignored.
+
+   \return MAPISTORE_SUCCESS on success, otherwise MAPISTORE error
+ */
+_PUBLIC_ enum mapistore_error mapistore_indexing_record_del_fmids(struct mapistore_context *mstore_ctx,
+								  uint32_t context_id, const char *username,
+								  uint32_t count, const uint64_t *fmids,
+								  uint8_t flags)
+{
+	struct backend_context		*backend_ctx;
+	struct indexing_context		*ictx;
+	enum mapistore_error		ret;
+
+	/* Sanity checks */
+	MAPISTORE_RETVAL_IF(!mstore_ctx, MAPISTORE_ERR_INVALID_PARAMETER, NULL);
+	MAPISTORE_RETVAL_IF(!context_id, MAPISTORE_ERR_INVALID_PARAMETER, NULL);
+	MAPISTORE_RETVAL_IF(!username, MAPISTORE_ERR_INVALID_PARAMETER, NULL);
+	MAPISTORE_RETVAL_IF(!count, MAPISTORE_SUCCESS, NULL);
+	MAPISTORE_RETVAL_IF(!fmids, MAPISTORE_ERR_INVALID_PARAMETER, NULL);
+
+	/* Ensure the context exists */
+	backend_ctx = mapistore_backend_lookup(mstore_ctx->context_list, context_id);
+	MAPISTORE_RETVAL_IF(!backend_ctx, MAPISTORE_ERR_INVALID_PARAMETER, NULL);
+	MAPISTORE_RETVAL_IF(!backend_ctx->indexing, MAPISTORE_ERR_INVALID_PARAMETER, NULL);
+
+	ret = mapistore_indexing_add(mstore_ctx, username, &ictx);
+	MAPISTORE_RETVAL_IF(ret, MAPISTORE_ERROR, NULL);
+	MAPISTORE_RETVAL_IF(!ictx, MAPISTORE_ERROR, NULL);
+
+	return mapistore_indexing_done(ictx,
+		ictx->del_fmids(ictx, username, count, fmids, flags));
+}
+
+/**
+   \details Returns the URIs of a set of records
+
+   \param mstore_ctx pointer to the mapistore context
+   \param username the name of the account where to look for the
+   indexing database
+   \param mem_ctx pointer to the memory context
+   \param count the number of records to look up
+   \param fmids array of count fmids to look up
+   \param uris array of count URIs to fill, NULL for unknown fmids
+   \param soft_deleted array of count soft deleted flags to fill
+
+   \return MAPISTORE_SUCCESS on success, otherwise MAPISTORE error
+ */
+_PUBLIC_ enum mapistore_error mapistore_indexing_record_get_uris(struct mapistore_context *mstore_ctx,
+								 const char *username, TALLOC_CTX *mem_ctx,
+								 uint32_t count, const uint64_t *fmids,
+								 char **uris, bool *soft_deleted)
+{
+	struct indexing_context	*ictx;
+	enum mapistore_error	ret;
+
+	/* Sanity checks */
+	MAPISTORE_RETVAL_IF(!mstore_ctx, MAPISTORE_ERR_NOT_INITIALIZED, NULL);
+	MAPISTORE_RETVAL_IF(!username, MAPISTORE_ERR_NOT_INITIALIZED, NULL);
+	MAPISTORE_RETVAL_IF(!count, MAPISTORE_SUCCESS, NULL);
+	MAPISTORE_RETVAL_IF(!fmids, MAPISTORE_ERR_INVALID_PARAMETER, NULL);
+	MAPISTORE_RETVAL_IF(!uris, MAPISTORE_ERR_INVALID_PARAMETER, NULL);
+	MAPISTORE_RETVAL_IF(!soft_deleted, MAPISTORE_ERR_INVALID_PARAMETER, NULL);
+
+	ret = mapistore_indexing_add(mstore_ctx, username, &ictx);
+	MAPISTORE_RETVAL_IF(ret, MAPISTORE_ERROR, NULL);
+	MAPISTORE_RETVAL_IF(!ictx, MAPISTORE_ERROR, NULL);
+
+	return mapistore_indexing_done(ictx,
+		ictx->get_uris(ictx, username, mem_ctx, count, fmids, uris, soft_deleted));
+}
+
+/**
+   \details Returns the fmids of a set of URIs
+
+   \param mstore_ctx pointer to the mapistore context
+   \param username the name of the account where to look for the
+   indexing database
+   \param count the number of URIs to look up
+   \param uris array of count URIs to look up (no wildcard)
+   \param fmids array of count fmids to fill, 0 for unknown URIs
+   \param soft_deleted array of count soft deleted flags to fill
+
+   \return MAPISTORE_SUCCESS on success, otherwise MAPISTORE error
+ */
+_PUBLIC_ enum mapistore_error mapistore_indexing_record_get_fmids(struct mapistore_context *mstore_ctx,
+								  const char *username, uint32_t count,
+								  const char **uris, uint64_t *fmids,
+								  bool *soft_deleted)
+{
+	struct indexing_context	*ictx;
+	enum mapistore_error	ret;
+
+	/* Sanity checks */
+	MAPISTORE_RETVAL_IF(!mstore_ctx, MAPISTORE_ERR_NOT_INITIALIZED, NULL);
+	MAPISTORE_RETVAL_IF(!username, MAPISTORE_ERR_NOT_INITIALIZED, NULL);
+	MAPISTORE_RETVAL_IF(!count, MAPISTORE_SUCCESS, NULL);
+	MAPISTORE_RETVAL_IF(!uris, MAPISTORE_ERR_INVALID_PARAMETER, NULL);
+	MAPISTORE_RETVAL_IF(!fmids, MAPISTORE_ERR_INVALID_PARAMETER, NULL);
+	MAPISTORE_RETVAL_IF(!soft_deleted, MAPISTORE_ERR_INVALID_PARAMETER, NULL);
+
+	ret = mapistore_indexing_add(mstore_ctx, username, &ictx);
+	MAPISTORE_RETVAL_IF(ret, MAPISTORE_ERROR, NULL);
+	MAPISTORE_RETVAL_IF(!ictx, MAPISTORE_ERROR, NULL);
+
+	return mapistore_indexing_done(ictx,
+		ictx->get_fmids(ictx, username, count, uris, fmids, soft_deleted));
 }
 
 /**
@@ -439,6 +714,56 @@ _PUBLIC_ enum mapistore_error mapistore_indexing_record_del_mid(struct mapistore
 	return mapistore_indexing_record_del_fmid(mstore_ctx, context_id, username, mid, flags, MAPISTORE_MESSAGE);
 }
 
+/**
+   \details Allocate a contiguous range of FMIDs from the lease held on
+   the indexing context, taking a new lease from the backend when the
+   current one is too short.
+
+   The tail of a lease too short for the requested range is abandoned:
+   FMIDs only have to be unique, not dense. Ranges as large as a lease
+   are allocated from the backend directly.
+
+   \param ictx pointer to the indexing context
+   \param username the mailbox the FMIDs are allocated for
+   \param range_len number of FMIDs to allocate
+   \param fid pointer to the first allocated FMID the function returns
+
+   \return MAPISTORE_SUCCESS on success, otherwise MAPISTORE error
+ */
+static enum mapistore_error mapistore_indexing_lease_fmids(struct indexing_context *ictx,
+							   const char *username,
+							   uint64_t range_len, uint64_t *fid)
+{
+	enum mapistore_error	ret;
+	uint64_t		first;
+
+	if (range_len >= default_fmid_lease_size) {
+		return mapistore_indexing_done(ictx,
+			ictx->allocate_fmids(ictx, username, range_len, fid));
+	}
+
+	if (ictx->lease_end - ictx->lease_next < range_len) {
+		ret = mapistore_indexing_done(ictx,
+			ictx->allocate_fmids(ictx, username, default_fmid_lease_size, &first));
+		MAPISTORE_RETVAL_IF(ret != MAPISTORE_SUCCESS, ret, NULL);
+
+		OC_DEBUG(5, "FMID lease 0x%.16"PRIx64" - 0x%.16"PRIx64" for %s, abandoning %"PRIu64" FMIDs\n",
+			 first, first + default_fmid_lease_size, username, ictx->lease_end - ictx->lease_next);
+		ictx->lease_next = first;
+		ictx->lease_end = first + default_fmid_lease_size;
+
+		if (!fmid_lease_since) {
+			fmid_lease_since = time(NULL);
+		}
+		fmid_lease_refills++;
+	}
+
+	*fid = ictx->lease_next;
+	ictx->lease_next += range_len;
+
+	return MAPISTORE_SUCCESS;
+}
+
 static enum mapistore_error mapistore_indexing_allocate_fid(struct mapistore_context *mstore_ctx,
 							    const char *username,
 							    uint64_t range_len, uint64_t *fid)
@@ -453,7 +778,7 @@ static enum mapistore_error mapistore_indexing_allocate_fid(struct mapistore_con
 	MAPISTORE_RETVAL_IF(ret != MAPISTORE_SUCCESS, MAPISTORE_ERROR, NULL);
 	MAPISTORE_RETVAL_IF(!ictx, MAPISTORE_ERR_INVALID_PARAMETER, NULL);
 
-	ret = ictx->allocate_fmids(ictx, username, range_len, fid);
+	ret = mapistore_indexing_lease_fmids(ictx, username, range_len, fid);
 	MAPISTORE_RETVAL_IF(ret != MAPISTORE_SUCCESS, ret, NULL);
 
 	return MAPISTORE_SUCCESS;
@@ -557,7 +882,7 @@ _PUBLIC_ enum mapistore_error mapistore_indexing_reserve_fmid_range(struct mapis
 	ictx = mapistore_indexing_search(mstore_ctx, username);
 	MAPISTORE_RETVAL_IF(!ictx, MAPISTORE_ERR_INVALID_PARAMETER, NULL);
 
-	ret = ictx->allocate_fmids(ictx, username, range_len, &fmid);
+	ret = mapistore_indexing_lease_fmids(ictx, username, range_len, &fmid);
 	MAPISTORE_RETVAL_IF(ret != MAPISTORE_SUCCESS, ret, NULL);
 
 	*first_fmidp = (exchange_globcnt(fmid) << 16) | 0x0001;
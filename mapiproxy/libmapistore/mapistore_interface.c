@@ -50,6 +50,8 @@ _PUBLIC_ struct mapistore_context *mapistore_init(TALLOC_CTX *mem_ctx, struct lo
 	char				*mapping_path;
 	const char			*indexing_url;
 	const char			*cache_url;
+	int				lease_size;
+	int				sticky;
 
 	if (!lp_ctx) {
 		return NULL;
@@ -100,6 +102,9 @@ _PUBLIC_ struct mapistore_context *mapistore_init(TALLOC_CTX *mem_ctx, struct lo
 
 	indexing_url = lpcfg_parm_string(lp_ctx, NULL, "mapistore", "indexing_backend");
 	mapistore_set_default_indexing_url(indexing_url);
+	sticky = lpcfg_parm_int(lp_ctx, NULL, "mapistore", "indexing_replica_sticky", MAPISTORE_INDEXING_REPLICA_STICKY);
+	mapistore_set_default_indexing_replica(lpcfg_parm_string(lp_ctx, NULL, "mapistore", "indexing_replica"),
+					       sticky > 0 ? sticky : 0);
 
 	mstore_ctx->nprops_ctx = NULL;
 	retval = mapistore_namedprops_init(mstore_ctx, lp_ctx, &(mstore_ctx->nprops_ctx));
@@ -119,6 +124,9 @@ _PUBLIC_ struct mapistore_context *mapistore_init(TALLOC_CTX *mem_ctx, struct lo
 	cache_url = lpcfg_parm_string(lp_ctx, NULL, "mapistore", "indexing_cache");
 	mapistore_set_default_cache_url(cache_url);
 
+	lease_size = lpcfg_parm_int(lp_ctx, NULL, "mapistore", "fmid_lease_size", MAPISTORE_FMID_LEASE_SIZE);
+	mapistore_set_default_fmid_lease_size(lease_size > 0 ? lease_size : 0);
+
 	return mstore_ctx;
 }
 
@@ -98,7 +98,7 @@ _PUBLIC_ enum mapistore_error mapistore_namedprops_next_unused_id(struct namedpr
 	MAPISTORE_RETVAL_IF(!nprops, MAPISTORE_ERR_INVALID_PARAMETER, NULL);
 	MAPISTORE_RETVAL_IF(!highest_id, MAPISTORE_ERR_INVALID_PARAMETER, NULL);
 
-	retval = nprops->next_unused_id(nprops, &nid);
+	retval = mapistore_namedprops_done(nprops, nprops->next_unused_id(nprops, &nid));
 	if (retval == MAPISTORE_SUCCESS) {
 		*highest_id = nid;
 		OC_DEBUG(5, "next unused id: 0x%x", *highest_id);
@@ -123,7 +123,7 @@ _PUBLIC_ enum mapistore_error mapistore_namedprops_create_id(struct namedprops_c
 {
 	MAPISTORE_RETVAL_IF(!nprops, MAPISTORE_ERROR, NULL);
 
-	return nprops->create_id(nprops, nameid, mapped_id);
+	return mapistore_namedprops_done(nprops, nprops->create_id(nprops, nameid, mapped_id));
 }
 
 /**
@@ -143,7 +143,7 @@ _PUBLIC_ enum mapistore_error mapistore_namedprops_get_mapped_id(struct namedpro
 	MAPISTORE_RETVAL_IF(!nprops, MAPISTORE_ERROR, NULL);
 	MAPISTORE_RETVAL_IF(!propID, MAPISTORE_ERROR, NULL);
 
-	return nprops->get_mapped_id(nprops, nameid, propID);
+	return mapistore_namedprops_done(nprops, nprops->get_mapped_id(nprops, nameid, propID));
 }
 
 /**
@@ -165,7 +165,7 @@ _PUBLIC_ enum mapistore_error mapistore_namedprops_get_nameid(struct namedprops_
 	MAPISTORE_RETVAL_IF(propID < 0x8000, MAPISTORE_ERROR, NULL);
 	MAPISTORE_RETVAL_IF(!nameidp, MAPISTORE_ERROR, NULL);
 
-	return nprops->get_nameid(nprops, propID, mem_ctx, nameidp);
+	return mapistore_namedprops_done(nprops, nprops->get_nameid(nprops, propID, mem_ctx, nameidp));
 }
 
 /**
@@ -185,7 +185,7 @@ _PUBLIC_ enum mapistore_error mapistore_namedprops_get_nameid_type(struct namedp
 	MAPISTORE_RETVAL_IF(propID < 0x8000, MAPISTORE_ERROR, NULL);
 	MAPISTORE_RETVAL_IF(!propTypeP, MAPISTORE_ERROR, NULL);
 
-	int ret = nprops->get_nameid_type(nprops, propID, propTypeP);
+	int ret = mapistore_namedprops_done(nprops, nprops->get_nameid_type(nprops, propID, propTypeP));
 	MAPISTORE_RETVAL_IF(ret != MAPISTORE_SUCCESS, ret, NULL);
 
 	switch (*propTypeP) {
@@ -302,12 +302,12 @@ _PUBLIC_ enum mapistore_error mapistore_namedprops_transaction_start(struct name
 {
 	MAPISTORE_RETVAL_IF(!nprops, MAPISTORE_ERR_INVALID_PARAMETER, NULL);
 
-	return nprops->transaction_start(nprops);
+	return mapistore_namedprops_done(nprops, nprops->transaction_start(nprops));
 }
 
 _PUBLIC_ enum mapistore_error mapistore_namedprops_transaction_commit(struct namedprops_context *nprops)
 {
 	MAPISTORE_RETVAL_IF(!nprops, MAPISTORE_ERR_INVALID_PARAMETER, NULL);
 
-	return nprops->transaction_commit(nprops);
+	return mapistore_namedprops_done(nprops, nprops->transaction_commit(nprops));
 }
@@ -752,7 +752,8 @@ static int process_newmail_notification(TALLOC_CTX *mem_ctx,
 	}
 
 	/* Register message */
-	ret = ictx->add_fmid(ictx, p->username, mid, message_uri);
+	ret = mapistore_indexing_done(ictx,
+		ictx->add_fmid(ictx, p->username, mid, message_uri));
 	if (ret != MAPISTORE_SUCCESS) {
 		OC_DEBUG(0, "Unable to register 0x%"PRIx64" with URL=%s", mid, message_uri);
 		talloc_free(message_uri);
@@ -33,20 +33,10 @@
 #include "dcesrv_exchange_emsmdb.h"
 
 struct exchange_emsmdb_session		*emsmdb_session = NULL;
+static struct emsmdbp_sessions		*emsmdb_sessions = NULL;
 void					*openchange_db_ctx = NULL;
-
-static struct exchange_emsmdb_session *dcesrv_find_emsmdb_session(struct GUID *uuid)
-{
-	struct exchange_emsmdb_session	*session, *found_session = NULL;
-
-	for (session = emsmdb_session; !found_session && session; session = session->next) {
-		if (GUID_equal(uuid, &session->uuid)) {
-			found_session = session;
-		}
-	}
-
-	return found_session;
-}
+static struct emsmdbp_compression	emsmdb_compression = { EMSMDB_COMPRESSION_THRESHOLD };
+static struct emsmdbp_stats_settings	emsmdb_stats = { true, false, NULL, NULL };
 
 /* FIXME: See _unbind below */
 /* static struct exchange_emsmdb_session *dcesrv_find_emsmdb_session_by_server_id(const struct server_id *server_id, uint32_t context_id) */
@@ -202,7 +192,7 @@ static enum MAPISTATUS dcesrv_EcDoConnect(struct dcesrv_call_state *dce_call,
 	r->out.result = MAPI_E_SUCCESS;
 
 	/* Search for an existing session and increment ref_count, otherwise create it */
-	session = dcesrv_find_emsmdb_session(&handle->wire_handle.uuid);
+	session = emsmdbp_sessions_find(emsmdb_sessions, &handle->wire_handle.uuid);
 	if (session) {
 		OC_DEBUG(0, "[exchange_emsmdb]: Increment session ref count for %d\n",
 				 session->session->context_id);
@@ -211,20 +201,25 @@ static enum MAPISTATUS dcesrv_EcDoConnect(struct dcesrv_call_state *dce_call,
 	else {
 		/* Step 7. Associate this emsmdbp context to the session */
 		session = talloc_zero(emsmdb_session, struct exchange_emsmdb_session);
-		OPENCHANGE_RETVAL_IF(!session, MAPI_E_NOT_ENOUGH_RESOURCES, emsmdbp_ctx);
-
-		session->pullTimeStamp = *r->out.pullTimeStamp;
-		session->session = mpm_session_init(session, dce_call);
-		OPENCHANGE_RETVAL_IF(!session->session, MAPI_E_NOT_ENOUGH_RESOURCES, emsmdbp_ctx);
+		if (session) {
+			session->pullTimeStamp = *r->out.pullTimeStamp;
+			session->uuid = handle->wire_handle.uuid;
+			session->session = mpm_session_init(session, dce_call);
+		}
 
-		session->uuid = handle->wire_handle.uuid;
+		/* Register the session before handing it the context, so
+		 * a failure leaves nothing pointing to the freed context */
+		if (!session || !session->session || !emsmdbp_sessions_add(emsmdb_sessions, session)) {
+			talloc_free(session);
+			talloc_free(handle);
+			talloc_free(emsmdbp_ctx);
+			goto failure;
+		}
 
 		mpm_session_set_private_data(session->session, (void *) emsmdbp_ctx);
 		mpm_session_set_destructor(session->session, emsmdbp_destructor);
 
 		OC_DEBUG(0, "[exchange_emsmdb]: New session added: %d\n", session->session->context_id);
-
-		DLIST_ADD_END(emsmdb_session, session, struct exchange_emsmdb_session *);
 	}
 
 	return MAPI_E_SUCCESS;
@@ -259,11 +254,11 @@ static enum MAPISTATUS dcesrv_EcDoDisconnect(struct dcesrv_call_state *dce_call,
 	/* Step 1. Retrieve handle and free if emsmdbp context and session are available */
 	h = dcesrv_handle_fetch(dce_call->context, r->in.handle, DCESRV_HANDLE_ANY);
 	if (h) {
-		session = dcesrv_find_emsmdb_session(&r->in.handle->uuid);
+		session = emsmdbp_sessions_find(emsmdb_sessions, &r->in.handle->uuid);
 		if (session) {
 			ret = mpm_session_release(session->session);
 			if (ret == true) {
-				DLIST_REMOVE(emsmdb_session, session);
+				emsmdbp_sessions_remove(emsmdb_sessions, session);
 				OC_DEBUG(5, "Session found and released\n");
 			} else {
 				OC_DEBUG(5, "Session found and ref_count decreased\n");
@@ -283,14 +278,18 @@ static enum MAPISTATUS dcesrv_EcDoDisconnect(struct dcesrv_call_state *dce_call,
 
 static struct mapi_response *EcDoRpc_process_transaction(TALLOC_CTX *mem_ctx, 
 							 struct emsmdbp_context *emsmdbp_ctx,
-							 struct mapi_request *mapi_request)
+							 struct mapi_request *mapi_request,
+							 bool notifications)
 {
 	enum MAPISTATUS		retval;
 	struct mapi_response	*mapi_response;
 	uint32_t		handles_length;
 	uint16_t		size = 0;
+	uint16_t		rop_size;
 	uint32_t		i;
 	uint32_t		idx;
+	struct timespec		rop_start;
+	struct timespec		rop_end;
 
 	/* Sanity checks */
 	if (!emsmdbp_ctx) return NULL;
@@ -311,13 +310,18 @@ static struct mapi_response *EcDoRpc_process_transaction(TALLOC_CTX *mem_ctx,
 	/* Step 2. Process serialized MAPI requests */
 	mapi_response->mapi_repl = talloc_zero(mem_ctx, struct EcDoRpc_MAPI_REPL);
 	for (i = 0, idx = 0, size = 0; mapi_request->mapi_req[i].opnum != 0; i++) {
-		OC_DEBUG(0, "MAPI Rop: 0x%.2x (%d)\n", mapi_request->mapi_req[i].opnum, size);
+		OC_DEBUG(5, "MAPI Rop: 0x%.2x (%d)\n", mapi_request->mapi_req[i].opnum, size);
 
 		if (mapi_request->mapi_req[i].opnum != op_MAPI_Release) {
 			mapi_response->mapi_repl = talloc_realloc(mem_ctx, mapi_response->mapi_repl,
 								  struct EcDoRpc_MAPI_REPL, idx + 2);
 		}
 
+		rop_size = size;
+		if (emsmdb_stats.enabled) {
+			clock_gettime(CLOCK_MONOTONIC, &rop_start);
+		}
+
 		switch (mapi_request->mapi_req[i].opnum) {
 		case op_MAPI_Release: /* 0x01 */
 			retval = EcDoRpc_RopRelease(mem_ctx, emsmdbp_ctx, 
@@ -879,6 +883,18 @@ static struct mapi_response *EcDoRpc_process_transaction(TALLOC_CTX *mem_ctx,
 		default:
 			OC_DEBUG(1, "MAPI Rop: 0x%.2x not implemented!\n",
 				  mapi_request->mapi_req[i].opnum);
+			retval = MAPI_E_NO_SUPPORT;
+		}
+
+		if (emsmdb_stats.enabled) {
+			clock_gettime(CLOCK_MONOTONIC, &rop_end);
+			emsmdbp_stats_record(mapi_request->mapi_req[i].opnum,
+					     (retval != MAPI_E_SUCCESS) ||
+					     ((mapi_request->mapi_req[i].opnum != op_MAPI_Release) &&
+					      (mapi_response->mapi_repl[idx].error_code != MAPI_E_SUCCESS)),
+					     (uint16_t)(size - rop_size),
+					     (rop_end.tv_sec - rop_start.tv_sec) * 1000000LL +
+					     (rop_end.tv_nsec - rop_start.tv_nsec) / 1000);
 		}
 
 		if (mapi_request->mapi_req[i].opnum != op_MAPI_Release) {
@@ -893,7 +909,7 @@ static struct mapi_response *EcDoRpc_process_transaction(TALLOC_CTX *mem_ctx,
 notif:
 	/* Step 3. Notifications/Pending calls should be processed here */
 	/* Note: GetProps and GetRows are filled with flag NDR_REMAINING, which may hide the content of the following replies. */
-	{
+	if (notifications) {
 		DATA_BLOB		payload;
 		enum mapistore_error	ret;
 		struct ndr_pull		*ndr;
@@ -978,7 +994,7 @@ static enum MAPISTATUS dcesrv_EcDoRpc(struct dcesrv_call_state *dce_call,
 	}
 
 	/* Retrieve the emsmdbp_context from the session management system */
-        session = dcesrv_find_emsmdb_session(&r->in.handle->uuid);
+        session = emsmdbp_sessions_find(emsmdb_sessions, &r->in.handle->uuid);
         if (session) {
                 emsmdbp_ctx = (struct emsmdbp_context *)session->session->private_data;
 	}
@@ -991,7 +1007,7 @@ static enum MAPISTATUS dcesrv_EcDoRpc(struct dcesrv_call_state *dce_call,
 
 	/* Step 1. Process EcDoRpc requests */
 	mapi_request = r->in.mapi_request;
-	mapi_response = EcDoRpc_process_transaction(mem_ctx, emsmdbp_ctx, mapi_request);
+	mapi_response = EcDoRpc_process_transaction(mem_ctx, emsmdbp_ctx, mapi_request, true);
 
 	/* Step 2. Fill EcDoRpc reply */
 	r->out.handle = r->in.handle;
@@ -1053,7 +1069,7 @@ static enum MAPISTATUS dcesrv_EcRRegisterPushNotification(struct dcesrv_call_sta
 	}
 
 	/* Retrieve the emsmdbp_context from the session management system */
-	session = dcesrv_find_emsmdb_session(&r->in.handle->uuid);
+	session = emsmdbp_sessions_find(emsmdb_sessions, &r->in.handle->uuid);
 	if (session) {
 		/* emsmdbp_ctx = (struct emsmdbp_context *)session->session->private_data; */
 	} else {
@@ -1337,7 +1353,7 @@ static enum MAPISTATUS dcesrv_EcDoConnectEx(struct dcesrv_call_state *dce_call,
 	}
 
 	/* Search for an existing session and increment ref_count, otherwise create it */
-	session = dcesrv_find_emsmdb_session(&handle->wire_handle.uuid);
+	session = emsmdbp_sessions_find(emsmdb_sessions, &handle->wire_handle.uuid);
 	if (session) {
 		OC_DEBUG(0, "[exchange_emsmdb]: Increment session ref count for %d\n",
 				 session->session->context_id);
@@ -1346,25 +1362,457 @@ static enum MAPISTATUS dcesrv_EcDoConnectEx(struct dcesrv_call_state *dce_call,
 	else {
 		/* Step 7. Associate this emsmdbp context to the session */
 		session = talloc_zero(emsmdb_session, struct exchange_emsmdb_session);
-		OPENCHANGE_RETVAL_IF(!session, MAPI_E_NOT_ENOUGH_RESOURCES, emsmdbp_ctx);
+		if (session) {
+			session->pullTimeStamp = *r->out.pulTimeStamp;
+			session->uuid = handle->wire_handle.uuid;
+			session->session = mpm_session_init(session, dce_call);
+		}
 
-		session->pullTimeStamp = *r->out.pulTimeStamp;
-		session->session = mpm_session_init(session, dce_call);
-		OPENCHANGE_RETVAL_IF(!session->session, MAPI_E_NOT_ENOUGH_RESOURCES, emsmdbp_ctx);
-		
-		session->uuid = handle->wire_handle.uuid;
+		/* Register the session before handing it the context, so
+		 * a failure leaves nothing pointing to the freed context */
+		if (!session || !session->session || !emsmdbp_sessions_add(emsmdb_sessions, session)) {
+			talloc_free(session);
+			talloc_free(handle);
+			talloc_free(emsmdbp_ctx);
+			goto failure;
+		}
 
 		mpm_session_set_private_data(session->session, (void *) emsmdbp_ctx);
 		mpm_session_set_destructor(session->session, emsmdbp_destructor);
 
 		OC_DEBUG(0, "[exchange_emsmdb]: New session added: %d\n", session->session->context_id);
+	}
+
+	return MAPI_E_SUCCESS;
+}
+
+/**
+   \details Push a RPC_HEADER_EXT and its payload into the rgbOut
+   buffer. The payload is LZXPRESS compressed when the client allows
+   it, it is larger than the compression threshold and compression
+   actually makes it smaller. It is then obfuscated if requested.
 
-		DLIST_ADD_END(emsmdb_session, session, struct exchange_emsmdb_session *);
+   \param mem_ctx pointer to the memory context
+   \param ndr_rgbOut pointer to the rgbOut buffer to push data into
+   \param payload pointer to the uncompressed payload
+   \param pulFlags the pulFlags sent by the client
+   \param xormagic whether the payload needs to be obfuscated
+   \param last whether this is the last extended buffer of the response
+
+   \return MAPI_E_SUCCESS on success, otherwise MAPI error
+ */
+static enum MAPISTATUS dcesrv_EcDoRpcExt2_push_payload(TALLOC_CTX *mem_ctx,
+						       struct ndr_push *ndr_rgbOut,
+						       struct ndr_push *payload,
+						       uint32_t pulFlags,
+						       bool xormagic,
+						       bool last)
+{
+	enum ndr_err_code	ndr_err;
+	struct RPC_HEADER_EXT	RPC_HEADER_EXT;
+	struct ndr_push		*ndr_comp_rgbOut = NULL;
+	struct ndr_push		*ndr_data;
+
+	/* Sanity checks */
+	OPENCHANGE_RETVAL_IF(payload->offset > EMSMDB_PAYLOAD_MAX, MAPI_E_TOO_BIG, NULL);
+
+	RPC_HEADER_EXT.Version = 0x0000;
+	RPC_HEADER_EXT.Flags = last ? RHEF_Last : 0;
+	RPC_HEADER_EXT.SizeActual = payload->offset;
+	ndr_data = payload;
+
+	/* Step 1. Compress if allowed and worth it */
+	if (!(pulFlags & pulFlags_NoCompression) && payload->offset >= emsmdb_compression.threshold) {
+		ndr_comp_rgbOut = ndr_push_init_ctx(mem_ctx);
+		OPENCHANGE_RETVAL_IF(!ndr_comp_rgbOut, MAPI_E_NOT_ENOUGH_RESOURCES, NULL);
+		ndr_set_flags(&ndr_comp_rgbOut->flags, LIBNDR_FLAG_NOALIGN);
+
+		ndr_err = ndr_push_lzxpress_compress(ndr_comp_rgbOut, payload);
+		if (ndr_err == NDR_ERR_SUCCESS && ndr_comp_rgbOut->offset < payload->offset) {
+			RPC_HEADER_EXT.Flags |= RHEF_Compressed;
+			ndr_data = ndr_comp_rgbOut;
+
+			OC_DEBUG(5, "[exchange_emsmdb]: response compressed from %d to %d bytes",
+				 payload->offset, ndr_comp_rgbOut->offset);
+		}
 	}
+	RPC_HEADER_EXT.Size = ndr_data->offset;
+	emsmdbp_stats_compression(payload->offset, ndr_data->offset);
+
+	/* Step 2. Obfuscate content if applicable */
+	if (xormagic) {
+		RPC_HEADER_EXT.Flags |= RHEF_XorMagic;
+		obfuscate_data(ndr_data->data, ndr_data->offset, 0xA5);
+	}
+
+	/* Step 3. Push the header and the payload */
+	ndr_push_RPC_HEADER_EXT(ndr_rgbOut, NDR_SCALARS|NDR_BUFFERS, &RPC_HEADER_EXT);
+	ndr_push_bytes(ndr_rgbOut, ndr_data->data, ndr_data->offset);
+
+	talloc_free(ndr_comp_rgbOut);
 
 	return MAPI_E_SUCCESS;
 }
 
+/**
+   \details Drop the trailing ROP replies of a response which does not
+   fit in a payload of limit bytes. The client gets the replies of the
+   first ROPs only and sends the others again, as when a server stops
+   processing a request whose output buffer is full.
+
+   \param mem_ctx pointer to the memory context
+   \param mapi_response pointer to the MAPI response to clamp
+   \param limit maximum size of the pushed response
+
+   \return number of replies dropped
+ */
+static uint32_t dcesrv_EcDoRpcExt2_clamp(TALLOC_CTX *mem_ctx,
+					 struct mapi_response *mapi_response,
+					 uint32_t limit)
+{
+	struct ndr_push	*ndr;
+	uint32_t	handles_length;
+	uint32_t	kept = 0;
+	uint32_t	i, j;
+
+	if (!mapi_response->mapi_repl) return 0;
+
+	ndr = ndr_push_init_ctx(mem_ctx);
+	if (!ndr) return 0;
+	ndr_set_flags(&ndr->flags, LIBNDR_FLAG_NOALIGN);
+
+	handles_length = mapi_response->mapi_len - mapi_response->length;
+	for (i = 0; mapi_response->mapi_repl[i].opnum != 0; i++) {
+		if (ndr_push_EcDoRpc_MAPI_REPL(ndr, NDR_SCALARS, &mapi_response->mapi_repl[i]) != NDR_ERR_SUCCESS ||
+		    sizeof (uint16_t) + ndr->offset + handles_length > limit) {
+			break;
+		}
+		kept = ndr->offset;
+	}
+	talloc_free(ndr);
+
+	for (j = i; mapi_response->mapi_repl[j].opnum != 0; j++);
+	mapi_response->mapi_repl[i].opnum = 0;
+	mapi_response->length = sizeof (uint16_t) + kept;
+	mapi_response->mapi_len = mapi_response->length + handles_length;
+
+	return j - i;
+}
+
+/**
+   \details Retrieve the last ROP of a request when it can be repeated
+   to fill the remaining space of the rgbOut buffer, along with its
+   reply. Only FastTransferSourceGetBuffer and QueryRows can be
+   chained.
+
+   \param mapi_request pointer to the processed MAPI request
+   \param mapi_response pointer to the MAPI response
+   \param mapi_reqp pointer on pointer to the ROP request to return
+   \param mapi_replp pointer on pointer to the ROP reply to return
+
+   \return true if the request can be chained, otherwise false
+ */
+static bool dcesrv_EcDoRpcExt2_chainable(struct mapi_request *mapi_request,
+					 struct mapi_response *mapi_response,
+					 struct EcDoRpc_MAPI_REQ **mapi_reqp,
+					 struct EcDoRpc_MAPI_REPL **mapi_replp)
+{
+	struct EcDoRpc_MAPI_REQ		*mapi_req;
+	struct EcDoRpc_MAPI_REPL	*mapi_repl;
+	uint32_t			i;
+	uint32_t			idx;
+
+	/* Sanity checks */
+	if (!mapi_request || !mapi_request->mapi_req || !mapi_request->handles) return false;
+	if (!mapi_response || !mapi_response->mapi_repl) return false;
+
+	for (i = 0, idx = 0; mapi_request->mapi_req[i].opnum != 0; i++) {
+		if (mapi_request->mapi_req[i].opnum != op_MAPI_Release) {
+			idx++;
+		}
+	}
+	if (!i || !idx) return false;
+
+	mapi_req = &mapi_request->mapi_req[i - 1];
+	if (mapi_req->opnum != op_MAPI_FastTransferSourceGetBuffer && mapi_req->opnum != op_MAPI_QueryRows) {
+		return false;
+	}
+
+	mapi_repl = &mapi_response->mapi_repl[idx - 1];
+	if (mapi_repl->opnum != mapi_req->opnum) return false;
+
+	*mapi_reqp = mapi_req;
+	*mapi_replp = mapi_repl;
+
+	return true;
+}
+
+/**
+   \details Check if the reply to a chainable ROP leaves more data to
+   be returned by another occurrence of the same ROP
+
+   \param mapi_req pointer to the ROP request
+   \param mapi_repl pointer to the ROP reply
+
+   \return true if more data is available, otherwise false
+ */
+static bool dcesrv_EcDoRpcExt2_chain_more(struct EcDoRpc_MAPI_REQ *mapi_req,
+					  struct EcDoRpc_MAPI_REPL *mapi_repl)
+{
+	if (mapi_repl->error_code != MAPI_E_SUCCESS) return false;
+
+	switch (mapi_req->opnum) {
+	case op_MAPI_FastTransferSourceGetBuffer:
+		return (mapi_repl->u.mapi_FastTransferSourceGetBuffer.TransferStatus == TransferStatus_Partial);
+	case op_MAPI_QueryRows:
+		/* Only forward reads move the cursor where the next segment starts */
+		if (mapi_req->u.mapi_QueryRows.QueryRowsFlags & TBL_NOADVANCE) return false;
+		if (mapi_req->u.mapi_QueryRows.ForwardRead != TBL_FORWARD_READ) return false;
+		if (mapi_repl->u.mapi_QueryRows.Origin == BOOKMARK_END) return false;
+		return (mapi_repl->u.mapi_QueryRows.RowCount == mapi_req->u.mapi_QueryRows.RowCount);
+	default:
+		return false;
+	}
+}
+
+/**
+   \details Retrieve the table object a QueryRows request applies to,
+   so its cursor can be restored when a chained segment is discarded
+
+   \param emsmdbp_ctx pointer to the emsmdb provider context
+   \param mapi_request pointer to the MAPI request
+   \param mapi_req pointer to the QueryRows request
+
+   \return pointer to the table on success, otherwise NULL
+ */
+static struct emsmdbp_object_table *dcesrv_EcDoRpcExt2_chain_table(struct emsmdbp_context *emsmdbp_ctx,
+								   struct mapi_request *mapi_request,
+								   struct EcDoRpc_MAPI_REQ *mapi_req)
+{
+	enum MAPISTATUS		retval;
+	struct mapi_handles	*rec = NULL;
+	struct emsmdbp_object	*object;
+	void			*data = NULL;
+
+	retval = mapi_handles_search(emsmdbp_ctx->handles_ctx, mapi_request->handles[mapi_req->handle_idx], &rec);
+	if (retval) return NULL;
+
+	retval = mapi_handles_get_private_data(rec, &data);
+	if (retval) return NULL;
+
+	object = (struct emsmdbp_object *) data;
+	if (!object || object->type != EMSMDBP_OBJECT_TABLE) return NULL;
+
+	return object->object.table;
+}
+
+/* State of a chained FastTransferSourceGetBuffer or QueryRows ROP */
+struct dcesrv_EcDoRpcExt2_chain_data {
+	struct emsmdbp_context		*emsmdbp_ctx;
+	struct mapi_request		request;
+	struct emsmdbp_object_table	*table;
+	uint32_t			overhead;
+	uint32_t			numerator;
+};
+
+/**
+   \details Run the chained ROP once, building a reply that fits a
+   segment of limit bytes
+
+   \param private_data pointer to the chain state
+   \param mem_ctx pointer to the memory context
+   \param limit size of the segment, header included
+   \param ndrp pointer on pointer to the pushed reply to return
+
+   \return EMSMDBP_CHAIN_MORE or EMSMDBP_CHAIN_LAST if a reply was
+   built, otherwise EMSMDBP_CHAIN_STOP
+ */
+static enum emsmdbp_chain_status dcesrv_EcDoRpcExt2_chain_run(void *private_data,
+							      TALLOC_CTX *mem_ctx,
+							      uint32_t limit,
+							      struct ndr_push **ndrp)
+{
+	struct dcesrv_EcDoRpcExt2_chain_data	*data = private_data;
+	struct EcDoRpc_MAPI_REQ			*mapi_req = &data->request.mapi_req[0];
+	struct FastTransferSourceGetBuffer_req	*fx_request;
+	struct mapi_response			*chain_response;
+	struct ndr_push				*ndr;
+	uint32_t				max_size;
+	uint16_t				buffer_size;
+	bool					more;
+
+	if (mapi_req->opnum == op_MAPI_FastTransferSourceGetBuffer) {
+		/* Never ask for more than the segment can hold */
+		max_size = limit - data->overhead - SIZE_DFLT_MAPI_RESPONSE - SIZE_DFLT_ROPFASTTRANSFERSOURCEGETBUFFER;
+		fx_request = &mapi_req->u.mapi_FastTransferSourceGetBuffer;
+		buffer_size = fx_request->BufferSize;
+		if (buffer_size == 0xBABE) {
+			buffer_size = fx_request->MaximumBufferSize.MaximumBufferSize;
+		}
+		if (buffer_size > max_size) {
+			buffer_size = max_size;
+		}
+		if (buffer_size < EMSMDB_CHAIN_MIN_BUFFER) return EMSMDBP_CHAIN_STOP;
+		fx_request->BufferSize = buffer_size;
+	} else {
+		data->numerator = data->table->numerator;
+	}
+
+	ndr = ndr_push_init_ctx(mem_ctx);
+	if (!ndr) return EMSMDBP_CHAIN_STOP;
+	ndr_set_flags(&ndr->flags, LIBNDR_FLAG_NOALIGN);
+
+	chain_response = EcDoRpc_process_transaction(mem_ctx, data->emsmdbp_ctx, &data->request, false);
+	if (!chain_response || !chain_response->mapi_repl) {
+		talloc_free(ndr);
+		return EMSMDBP_CHAIN_STOP;
+	}
+	ndr_push_mapi_response(ndr, NDR_SCALARS|NDR_BUFFERS, chain_response);
+	more = dcesrv_EcDoRpcExt2_chain_more(mapi_req, &chain_response->mapi_repl[0]);
+	talloc_free(chain_response);
+
+	*ndrp = ndr;
+	return more ? EMSMDBP_CHAIN_MORE : EMSMDBP_CHAIN_LAST;
+}
+
+/**
+   \details Take back a chained QueryRows reply which does not fit its
+   segment: rewind the table cursor and ask for half of the rows
+
+   \param private_data pointer to the chain state
+
+   \return true if the ROP can be run again, otherwise false
+ */
+static bool dcesrv_EcDoRpcExt2_chain_rewind(void *private_data)
+{
+	struct dcesrv_EcDoRpcExt2_chain_data	*data = private_data;
+	struct EcDoRpc_MAPI_REQ			*mapi_req = &data->request.mapi_req[0];
+
+	/* A FastTransfer stream cannot be moved back */
+	if (!data->table) return false;
+
+	data->table->numerator = data->numerator;
+	mapi_req->u.mapi_QueryRows.RowCount /= 2;
+
+	return mapi_req->u.mapi_QueryRows.RowCount != 0;
+}
+
+static const struct emsmdbp_chain_ops dcesrv_EcDoRpcExt2_chain_ops = {
+	.run = dcesrv_EcDoRpcExt2_chain_run,
+	.rewind = dcesrv_EcDoRpcExt2_chain_rewind,
+};
+
+/**
+   \details Fill the remaining space of the rgbOut buffer by repeating
+   the last FastTransferSourceGetBuffer or QueryRows ROP of the request
+   and append each reply as a new chained extended buffer payload.
+
+   Sizes are accounted for uncompressed payloads, so the chained
+   response always fits in the buffer the client provided. Pending
+   notifications are only delivered in the first payload.
+
+   A FastTransferSourceGetBuffer request never asks for more than its
+   segment can hold. Chaining stops at the first payload that can't be
+   built, and the payloads built so far are returned: their ROPs
+   already moved the FastTransfer stream or table cursor past them.
+
+   \param mem_ctx pointer to the memory context
+   \param emsmdbp_ctx pointer to the emsmdb provider context
+   \param mapi_request pointer to the processed MAPI request
+   \param mapi_response pointer to the MAPI response
+   \param available number of bytes still available in rgbOut
+   \param segmentsp pointer on the array of payloads to append to
+   \param countp pointer on the number of payloads in the array
+ */
+static void dcesrv_EcDoRpcExt2_chain(TALLOC_CTX *mem_ctx,
+				     struct emsmdbp_context *emsmdbp_ctx,
+				     struct mapi_request *mapi_request,
+				     struct mapi_response *mapi_response,
+				     uint32_t available,
+				     struct ndr_push ***segmentsp,
+				     uint32_t *countp)
+{
+	struct EcDoRpc_MAPI_REQ			*mapi_req;
+	struct EcDoRpc_MAPI_REPL		*mapi_repl;
+	struct dcesrv_EcDoRpcExt2_chain_data	data;
+
+	if (!dcesrv_EcDoRpcExt2_chainable(mapi_request, mapi_response, &mapi_req, &mapi_repl)) {
+		return;
+	}
+	if (!dcesrv_EcDoRpcExt2_chain_more(mapi_req, mapi_repl)) {
+		return;
+	}
+
+	data.emsmdbp_ctx = emsmdbp_ctx;
+	data.table = NULL;
+	data.numerator = 0;
+	/* Each payload carries its header, the RopSize field and the handle table */
+	data.overhead = EMSMDB_RPC_HEADER_EXT_SIZE + sizeof (uint16_t) + (mapi_request->mapi_len - mapi_request->length);
+
+	data.request = *mapi_request;
+	data.request.mapi_req = talloc_zero_array(mem_ctx, struct EcDoRpc_MAPI_REQ, 2);
+	if (!data.request.mapi_req) return;
+	data.request.mapi_req[0] = *mapi_req;
+	data.request.mapi_req[1].opnum = 0;
+
+	if (mapi_req->opnum == op_MAPI_QueryRows) {
+		data.table = dcesrv_EcDoRpcExt2_chain_table(emsmdbp_ctx, mapi_request, mapi_req);
+		if (!data.table) {
+			OC_DEBUG(5, "[exchange_emsmdb]: QueryRows table not found, response not chained\n");
+			talloc_free(data.request.mapi_req);
+			return;
+		}
+	}
+
+	emsmdbp_chain_fill(mem_ctx, &dcesrv_EcDoRpcExt2_chain_ops, &data, available, data.overhead,
+			   segmentsp, countp);
+
+	OC_DEBUG(5, "[exchange_emsmdb]: EcDoRpcExt2 response chained over %d buffers\n", *countp);
+	talloc_free(data.request.mapi_req);
+}
+
+/**
+   \details Record the client-observed latencies sent by the client in
+   the AUX_PERF blocks of rgbAuxIn
+
+   \param mem_ctx pointer to the memory context
+   \param emsmdbp_ctx pointer to the emsmdb provider context
+   \param rgbAuxIn pointer to the auxiliary input buffer
+   \param cbAuxIn size of the auxiliary input buffer
+ */
+static void dcesrv_EcDoRpcExt2_aux(TALLOC_CTX *mem_ctx,
+				   struct emsmdbp_context *emsmdbp_ctx,
+				   uint8_t *rgbAuxIn,
+				   uint32_t cbAuxIn)
+{
+	enum ndr_err_code	ndr_err;
+	struct ndr_pull		*ndr_pull;
+	struct mapi2k7_AuxInfo	AuxInfo;
+	DATA_BLOB		blob;
+	uint32_t		count;
+
+	if (!rgbAuxIn || !cbAuxIn) return;
+
+	blob.data = rgbAuxIn;
+	blob.length = cbAuxIn;
+
+	ndr_pull = ndr_pull_init_blob(&blob, mem_ctx);
+	if (!ndr_pull) return;
+	ndr_set_flags(&ndr_pull->flags, LIBNDR_FLAG_NOALIGN|LIBNDR_FLAG_REF_ALLOC);
+
+	ndr_err = ndr_pull_mapi2k7_AuxInfo(ndr_pull, NDR_SCALARS|NDR_BUFFERS, &AuxInfo);
+	if (ndr_err != NDR_ERR_SUCCESS) {
+		OC_DEBUG(5, "[exchange_emsmdb]: unable to parse rgbAuxIn (%d bytes)\n", cbAuxIn);
+		talloc_free(ndr_pull);
+		return;
+	}
+
+	count = emsmdbp_stats_client_aux(emsmdbp_ctx->client_stats, AuxInfo.AUX_HEADER);
+	OC_DEBUG(6, "[exchange_emsmdb]: %d client latency samples recorded for %s\n", count,
+		 emsmdbp_ctx->client_stats->username);
+	talloc_free(ndr_pull);
+}
+
 /**
    \details exchange_emsmdb EcDoRpcExt2 (0xB) function
 
@@ -1383,17 +1831,25 @@ static enum MAPISTATUS dcesrv_EcDoRpcExt2(struct dcesrv_call_state *dce_call,
 	struct emsmdbp_context		*emsmdbp_ctx = NULL;
 	struct mapi2k7_request		mapi2k7_request;
 	struct mapi_response		*mapi_response;
-	struct RPC_HEADER_EXT		RPC_HEADER_EXT;
 	struct ndr_pull			*ndr_pull = NULL;
-	struct ndr_push			*ndr_uncomp_rgbOut;
-	struct ndr_push			*ndr_comp_rgbOut;
+	struct ndr_push			**segments;
 	struct ndr_push			*ndr_rgbOut;
+	enum MAPISTATUS			retval;
+	uint32_t			count;
+	uint32_t			dropped;
+	uint32_t			limit;
+	uint32_t			i;
 	uint32_t			pulFlags = 0x0;
 	uint32_t			pulTransTime = 0;
+	uint64_t			usec;
+	struct timespec			start;
+	struct timespec			end;
 	DATA_BLOB			rgbIn;
 
 	OC_DEBUG(3, "exchange_emsmdb: EcDoRpcExt2 (0xB)\n");
 
+	clock_gettime(CLOCK_MONOTONIC, &start);
+
 	r->out.rgbOut = NULL;
 	*r->out.pcbOut = 0;
 	r->out.rgbAuxOut = NULL;
@@ -1409,7 +1865,7 @@ static enum MAPISTATUS dcesrv_EcDoRpcExt2(struct dcesrv_call_state *dce_call,
 	}
 
 	/* Retrieve the emsmdbp_context from the session management system */
-        session = dcesrv_find_emsmdb_session(&r->in.handle->uuid);
+        session = emsmdbp_sessions_find(emsmdb_sessions, &r->in.handle->uuid);
 	if (!session) {
 		r->out.handle->handle_type = 0;
 		r->out.handle->uuid = GUID_zero();
@@ -1418,6 +1874,19 @@ static enum MAPISTATUS dcesrv_EcDoRpcExt2(struct dcesrv_call_state *dce_call,
 	}
 	emsmdbp_ctx = (struct emsmdbp_context *)session->session->private_data;
 
+	/* Record the latencies the client observed on previous calls */
+	if (emsmdb_stats.enabled) {
+		if (!emsmdbp_ctx->client_stats) {
+			emsmdbp_ctx->client_stats = emsmdbp_stats_client_init(emsmdbp_ctx, emsmdbp_ctx->username);
+			if (emsmdbp_ctx->client_stats) {
+				emsmdbp_ctx->client_stats->handles_ctx = emsmdbp_ctx->handles_ctx;
+			}
+		}
+		if (emsmdbp_ctx->client_stats) {
+			dcesrv_EcDoRpcExt2_aux(mem_ctx, emsmdbp_ctx, r->in.rgbAuxIn, r->in.cbAuxIn);
+		}
+	}
+
 	/* Sanity checks on pcbOut input parameter */
 	if (*r->in.pcbOut < 0x00000008) {
 		r->out.result = ecRpcFailed;
@@ -1444,44 +1913,69 @@ static enum MAPISTATUS dcesrv_EcDoRpcExt2(struct dcesrv_call_state *dce_call,
 		return ecRpcFormat;
 	}
 
-	mapi_response = EcDoRpc_process_transaction(mem_ctx, emsmdbp_ctx, mapi2k7_request.mapi_request);
-	talloc_free(mapi2k7_request.mapi_request);
+	mapi_response = EcDoRpc_process_transaction(mem_ctx, emsmdbp_ctx, mapi2k7_request.mapi_request, true);
 
 	/* Fill EcDoRpcExt2 reply */
 	r->out.handle = r->in.handle;
 	*r->out.pulFlags = pulFlags;
 
 	/* Push MAPI response into a DATA blob */
-	ndr_uncomp_rgbOut = ndr_push_init_ctx(mem_ctx);
-	ndr_set_flags(&ndr_uncomp_rgbOut->flags, LIBNDR_FLAG_NOALIGN);
-	ndr_push_mapi_response(ndr_uncomp_rgbOut, NDR_SCALARS|NDR_BUFFERS, mapi_response);
-	talloc_free(mapi_response);
-
-	/* TODO: compress if requested */
-	ndr_comp_rgbOut = ndr_uncomp_rgbOut;
-
-	/* Build RPC_HEADER_EXT header for MAPI response DATA blob */
-	RPC_HEADER_EXT.Version = 0x0000;
-	RPC_HEADER_EXT.Flags = RHEF_Last;
-	RPC_HEADER_EXT.Flags |= (mapi2k7_request.header.Flags & RHEF_XorMagic);
-	RPC_HEADER_EXT.Size = ndr_comp_rgbOut->offset;
-	RPC_HEADER_EXT.SizeActual = ndr_comp_rgbOut->offset;
+	segments = talloc_array(mem_ctx, struct ndr_push *, 1);
+	segments[0] = ndr_push_init_ctx(mem_ctx);
+	ndr_set_flags(&segments[0]->flags, LIBNDR_FLAG_NOALIGN);
+	ndr_push_mapi_response(segments[0], NDR_SCALARS|NDR_BUFFERS, mapi_response);
+	count = 1;
+
+	/* The first payload must fit in rgbOut and in a RPC_HEADER_EXT */
+	limit = *r->in.pcbOut - EMSMDB_RPC_HEADER_EXT_SIZE;
+	if (limit > EMSMDB_PAYLOAD_MAX) {
+		limit = EMSMDB_PAYLOAD_MAX;
+	}
+	if (segments[0]->offset > limit) {
+		dropped = dcesrv_EcDoRpcExt2_clamp(mem_ctx, mapi_response, limit);
+		OC_DEBUG(1, "[exchange_emsmdb]: %d bytes response larger than %d bytes, "
+			 "%d ROP replies dropped\n", segments[0]->offset, limit, dropped);
+		talloc_free(segments[0]);
+		segments[0] = ndr_push_init_ctx(mem_ctx);
+		ndr_set_flags(&segments[0]->flags, LIBNDR_FLAG_NOALIGN);
+		ndr_push_mapi_response(segments[0], NDR_SCALARS|NDR_BUFFERS, mapi_response);
+	}
 
-	/* Obfuscate content if applicable*/
-	if (RPC_HEADER_EXT.Flags & RHEF_XorMagic) {
-		obfuscate_data(ndr_comp_rgbOut->data, ndr_comp_rgbOut->offset, 0xA5);
+	/* Use the remaining of rgbOut for chained responses if the client allows it */
+	if ((*r->in.pulFlags & pulFlags_Chain) &&
+	    (EMSMDB_RPC_HEADER_EXT_SIZE + segments[0]->offset < *r->in.pcbOut)) {
+		dcesrv_EcDoRpcExt2_chain(mem_ctx, emsmdbp_ctx, mapi2k7_request.mapi_request, mapi_response,
+					 *r->in.pcbOut - EMSMDB_RPC_HEADER_EXT_SIZE - segments[0]->offset,
+					 &segments, &count);
 	}
+	talloc_free(mapi_response);
 
-	/* Push the constructed blob */
+	/* Push the constructed blobs */
 	ndr_rgbOut = ndr_push_init_ctx(mem_ctx);
 	ndr_set_flags(&ndr_rgbOut->flags, LIBNDR_FLAG_NOALIGN);
-	ndr_push_RPC_HEADER_EXT(ndr_rgbOut, NDR_SCALARS|NDR_BUFFERS, &RPC_HEADER_EXT);
-	ndr_push_bytes(ndr_rgbOut, ndr_comp_rgbOut->data, ndr_comp_rgbOut->offset);
+	for (i = 0, retval = MAPI_E_SUCCESS; i < count && !retval; i++) {
+		retval = dcesrv_EcDoRpcExt2_push_payload(mem_ctx, ndr_rgbOut, segments[i], *r->in.pulFlags,
+							 (mapi2k7_request.header.Flags & RHEF_XorMagic),
+							 (i == count - 1));
+		talloc_free(segments[i]);
+	}
+	talloc_free(segments);
+	talloc_free(mapi2k7_request.mapi_request);
+	if (retval) {
+		r->out.result = ecRpcFailed;
+		return ecRpcFailed;
+	}
 
 	/* Push MAPI response into a DATA blob */
 	r->out.rgbOut = ndr_rgbOut->data;
 	*r->out.pcbOut = ndr_rgbOut->offset;
 
+	/* Report the time spent processing the request, in milliseconds */
+	clock_gettime(CLOCK_MONOTONIC, &end);
+	usec = (end.tv_sec - start.tv_sec) * 1000000LL + (end.tv_nsec - start.tv_nsec) / 1000;
+	pulTransTime = (uint32_t)(usec / 1000);
+	emsmdbp_stats_client_server_time(emsmdbp_ctx->client_stats, ndr_rgbOut->offset, usec);
+
 	*r->out.pulTransTime = pulTransTime;
 
 	return MAPI_E_SUCCESS;
@@ -1572,7 +2066,7 @@ static enum MAPISTATUS dcesrv_EcDoAsyncConnectEx(struct dcesrv_call_state *dce_c
 	}
 
 	/* Step 1. Retrieve the existing session */
-	session = dcesrv_find_emsmdb_session(&r->in.handle->uuid);
+	session = emsmdbp_sessions_find(emsmdb_sessions, &r->in.handle->uuid);
 	if (session) {
 		emsmdbp_ctx = (struct emsmdbp_context *) session->session->private_data;
 	} else {
@@ -1612,6 +2106,31 @@ static enum MAPISTATUS dcesrv_EcDoAsyncConnectEx(struct dcesrv_call_state *dce_c
 }
 
 
+/**
+   \details Dump the ROP statistics of this process when SIGUSR2 is
+   received, and reset them if configured to do so.
+ */
+static void dcesrv_exchange_emsmdb_stats_signal(struct tevent_context *ev,
+						struct tevent_signal *se,
+						int signum, int count,
+						void *siginfo, void *private_data)
+{
+	enum MAPISTATUS	retval;
+	char		*path;
+
+	path = talloc_asprintf(NULL, "%s/emsmdb-stats.%d", emsmdb_stats.directory, (int) getpid());
+	if (!path) return;
+
+	retval = emsmdbp_stats_dump(path);
+	if (retval == MAPI_E_SUCCESS) {
+		OC_DEBUG(3, "[exchange_emsmdb]: ROP statistics written to %s\n", path);
+		if (emsmdb_stats.reset_on_dump) {
+			emsmdbp_stats_reset();
+		}
+	}
+	talloc_free(path);
+}
+
 /**
    \details Dispatch incoming EMSMDB call to the correct OpenChange
    server function
@@ -1638,6 +2157,16 @@ static NTSTATUS dcesrv_exchange_emsmdb_dispatch(struct dcesrv_call_state *dce_ca
 	if (!table) return NT_STATUS_UNSUCCESSFUL;
 	if (table->name && strcmp(table->name, NDR_EXCHANGE_EMSMDB_NAME)) return NT_STATUS_UNSUCCESSFUL;
 
+	/* Statistics are per process: hook the dump signal in the process serving calls */
+	if (emsmdb_stats.enabled && !emsmdb_stats.signal) {
+		emsmdb_stats.signal = tevent_add_signal(dce_call->event_ctx, emsmdb_session, SIGUSR2, 0,
+							dcesrv_exchange_emsmdb_stats_signal, NULL);
+		if (!emsmdb_stats.signal) {
+			OC_DEBUG(1, "[exchange_emsmdb]: unable to install ROP statistics signal handler\n");
+			emsmdb_stats.enabled = false;
+		}
+	}
+
 	switch (opnum) {
 	case NDR_ECDOCONNECT:
 		dcesrv_EcDoConnect(dce_call, mem_ctx, (struct EcDoConnect *)r);
@@ -1699,10 +2228,27 @@ static NTSTATUS dcesrv_exchange_emsmdb_dispatch(struct dcesrv_call_state *dce_ca
  */
 static NTSTATUS dcesrv_exchange_emsmdb_init(struct dcesrv_context *dce_ctx)
 {
+	const char	*stats_directory;
+
 	/* Initialize exchange_emsmdb session */
 	emsmdb_session = talloc_zero(dce_ctx, struct exchange_emsmdb_session);
 	if (!emsmdb_session) return NT_STATUS_NO_MEMORY;
 	emsmdb_session->session = NULL;
+	emsmdb_sessions = emsmdbp_sessions_init(emsmdb_session);
+	if (!emsmdb_sessions) return NT_STATUS_NO_MEMORY;
+
+	/* Retrieve the minimum size of responses worth compressing */
+	emsmdb_compression.threshold = lpcfg_parm_int(dce_ctx->lp_ctx, NULL, "emsmdb", "compression_threshold",
+						      EMSMDB_COMPRESSION_THRESHOLD);
+
+	/* Retrieve per-ROP statistics settings */
+	emsmdb_stats.enabled = lpcfg_parm_bool(dce_ctx->lp_ctx, NULL, "emsmdb", "rop_stats", true);
+	emsmdb_stats.reset_on_dump = lpcfg_parm_bool(dce_ctx->lp_ctx, NULL, "emsmdb", "rop_stats_reset_on_dump", false);
+	stats_directory = lpcfg_parm_string(dce_ctx->lp_ctx, NULL, "emsmdb", "rop_stats_directory");
+	if (!stats_directory) {
+		stats_directory = lpcfg_lock_directory(dce_ctx->lp_ctx);
+	}
+	emsmdb_stats.directory = talloc_strdup(emsmdb_session, stats_directory);
 
 	/* Open read/write context on OpenChange dispatcher database */
 	openchange_db_ctx = emsmdbp_openchangedb_init(dce_ctx->lp_ctx);
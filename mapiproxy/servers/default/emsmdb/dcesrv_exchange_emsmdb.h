@@ -28,6 +28,7 @@
 #include "mapiproxy/libmapiproxy/libmapiproxy.h"
 #include "mapiproxy/libmapistore/mapistore.h"
 #include "mapiproxy/libmapistore/mapistore_errors.h"
+#include "mapiproxy/util/ccan/htable/htable.h"
 #include <ldb.h>
 #include <ldb_errors.h>
 #include <tevent.h>
@@ -55,6 +56,7 @@ struct emsmdbp_context {
 	struct ldb_context			*samdb_ctx;
 	struct mapistore_context		*mstore_ctx;
 	struct mapi_handles_context		*handles_ctx;
+	struct emsmdbp_client_stats		*client_stats;
 
 	TALLOC_CTX				*mem_ctx;
 	struct GUID				session_uuid;
@@ -68,6 +70,54 @@ struct exchange_emsmdb_session {
 	struct exchange_emsmdb_session	*next;
 };
 
+/* Sessions indexed by handle uuid, see emsmdbp_session.c */
+struct emsmdbp_sessions {
+	struct exchange_emsmdb_session	*list;
+	struct htable			ht;
+};
+
+struct emsmdbp_compression {
+	uint32_t			threshold;
+};
+
+struct emsmdbp_compression_stats {
+	uint64_t			responses;
+	uint64_t			compressed;
+	uint64_t			uncompressed_bytes;
+	uint64_t			compressed_bytes;
+};
+
+#define	EMSMDBP_STATS_OPNUMS		256
+#define	EMSMDBP_STATS_SUB_BUCKET_BITS	2
+#define	EMSMDBP_STATS_SUB_BUCKETS	(1 << EMSMDBP_STATS_SUB_BUCKET_BITS)
+#define	EMSMDBP_STATS_MAGNITUDES	32
+#define	EMSMDBP_STATS_BUCKETS		(EMSMDBP_STATS_MAGNITUDES * EMSMDBP_STATS_SUB_BUCKETS)
+
+struct emsmdbp_stats_settings {
+	bool				enabled;
+	bool				reset_on_dump;
+	const char			*directory;
+	struct tevent_signal		*signal;
+};
+
+struct emsmdbp_rop_stats {
+	uint64_t			count;
+	uint64_t			errors;
+	uint64_t			response_bytes;
+	uint64_t			latency_total;
+	uint64_t			latency_max;
+	uint64_t			buckets[EMSMDBP_STATS_BUCKETS];
+};
+
+struct emsmdbp_client_stats {
+	char				*username;
+	struct emsmdbp_rop_stats	server;
+	struct emsmdbp_rop_stats	reported;
+	struct mapi_handles_context	*handles_ctx;
+	struct emsmdbp_client_stats	*prev;
+	struct emsmdbp_client_stats	*next;
+};
+
 struct emsmdbp_stream {
 	size_t			position;
 	DATA_BLOB		buffer;
@@ -247,6 +297,25 @@ struct emsmdbp_object {
 #define	EMSMDB_PCRETRY			6
 #define	EMSMDB_PCRETRYDELAY		10000
 
+#define	EMSMDB_COMPRESSION_THRESHOLD	1024
+
+#define	EMSMDB_RPC_HEADER_EXT_SIZE	8
+#define	EMSMDB_PAYLOAD_MAX		0xFFFF	/* RPC_HEADER_EXT sizes are 16 bits */
+#define	EMSMDB_CHAIN_SEGMENT_MAX	0x8000
+#define	EMSMDB_CHAIN_MIN_BUFFER		0x400
+
+/* Outcome of running a chained ROP, see emsmdbp_chain_fill */
+enum emsmdbp_chain_status {
+	EMSMDBP_CHAIN_MORE,		/* payload built, the ROP has more data */
+	EMSMDBP_CHAIN_LAST,		/* payload built, the ROP has no more data */
+	EMSMDBP_CHAIN_STOP		/* no payload built */
+};
+
+struct emsmdbp_chain_ops {
+	enum emsmdbp_chain_status	(*run)(void *, TALLOC_CTX *, uint32_t, struct ndr_push **);
+	bool				(*rewind)(void *);
+};
+
 enum emsmdbp_mailbox_systemidx {
 	EMSMDBP_MAILBOX_ROOT = 1,
 	EMSMDBP_DEFERRED_ACTION,
@@ -375,6 +444,29 @@ void emsmdbp_fill_row_blob(TALLOC_CTX *, struct emsmdbp_context *, uint8_t *, DA
 enum MAPISTATUS emsmdbp_object_attach_sharing_metadata_XML_file(struct emsmdbp_context *emsmdbp_ctx, struct emsmdbp_object *sharing_object);
 
 
+/* definitions from emsmdbp_chain.c */
+uint32_t			emsmdbp_chain_fill(TALLOC_CTX *, const struct emsmdbp_chain_ops *, void *, uint32_t, uint32_t, struct ndr_push ***, uint32_t *);
+
+/* definitions from emsmdbp_session.c */
+struct emsmdbp_sessions		*emsmdbp_sessions_init(TALLOC_CTX *);
+struct exchange_emsmdb_session	*emsmdbp_sessions_find(struct emsmdbp_sessions *, struct GUID *);
+bool				emsmdbp_sessions_add(struct emsmdbp_sessions *, struct exchange_emsmdb_session *);
+bool				emsmdbp_sessions_remove(struct emsmdbp_sessions *, struct exchange_emsmdb_session *);
+
+/* definitions from emsmdbp_stats.c */
+uint32_t			emsmdbp_stats_bucket(uint64_t);
+uint64_t			emsmdbp_stats_bucket_max(uint32_t);
+void				emsmdbp_stats_record(uint8_t, bool, uint32_t, uint64_t);
+const struct emsmdbp_rop_stats	*emsmdbp_stats_get(uint8_t);
+uint64_t			emsmdbp_stats_percentile(const struct emsmdbp_rop_stats *, double);
+struct emsmdbp_client_stats	*emsmdbp_stats_client_init(TALLOC_CTX *, const char *);
+void				emsmdbp_stats_client_server_time(struct emsmdbp_client_stats *, uint32_t, uint64_t);
+uint32_t			emsmdbp_stats_client_aux(struct emsmdbp_client_stats *, const struct AUX_HEADER *);
+void				emsmdbp_stats_compression(uint32_t, uint32_t);
+void				emsmdbp_stats_get_compression(struct emsmdbp_compression_stats *);
+void				emsmdbp_stats_reset(void);
+enum MAPISTATUS			emsmdbp_stats_dump(const char *);
+
 /* definitions from oxcfold.c */
 enum MAPISTATUS EcDoRpc_RopOpenFolder(TALLOC_CTX *, struct emsmdbp_context *, struct EcDoRpc_MAPI_REQ *, struct EcDoRpc_MAPI_REPL *, uint32_t *, uint16_t *);
 enum MAPISTATUS EcDoRpc_RopGetHierarchyTable(TALLOC_CTX *, struct emsmdbp_context *, struct EcDoRpc_MAPI_REQ *, struct EcDoRpc_MAPI_REPL *, uint32_t *, uint16_t *);
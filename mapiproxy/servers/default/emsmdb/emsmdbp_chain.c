@@ -0,0 +1,104 @@
+/*
+   OpenChange Server implementation
+
+   EMSMDBP: EMSMDB Provider implementation
+
+   This program is free software; you can redistribute it and/or modify
+   it under the terms of the GNU General Public License as published by
+   the Free Software Foundation; either version 3 of the License, or
+   (at your option) any later version.
+
+   This program is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+   GNU General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/**
+   \file emsmdbp_chain.c
+
+   \brief Chained EcDoRpcExt2 response payloads
+
+   The space of rgbOut left by a response is filled by running its
+   last ROP again and appending each reply as a new extended buffer
+   payload. The ROP itself is run by the caller, this file only
+   decides how much room each payload gets and when to stop.
+ */
+
+#include "dcesrv_exchange_emsmdb.h"
+
+/**
+   \details Append chained payloads to a response until rgbOut is
+   full or the ROP has no more data to return
+
+   Each payload is built by ops->run within a segment of at most
+   EMSMDB_CHAIN_SEGMENT_MAX bytes. A payload which does not fit its
+   segment is discarded: ops->rewind may take the ROP back so it is
+   run again with a smaller reply, otherwise chaining stops. Chaining
+   also stops at the first payload ops->run fails to build. The
+   payloads already appended are always kept, since the ROPs that
+   built them may have moved a stream past their data.
+
+   \param mem_ctx pointer to the memory context
+   \param ops pointer to the functions running the chained ROP
+   \param private_data pointer to the data given to ops
+   \param available number of bytes still available in rgbOut
+   \param overhead number of bytes each payload needs besides the ROP
+   reply
+   \param segmentsp pointer on the array of payloads to append to
+   \param countp pointer on the number of payloads in the array
+
+   \return number of payloads appended
+ */
+_PUBLIC_ uint32_t emsmdbp_chain_fill(TALLOC_CTX *mem_ctx,
+				     const struct emsmdbp_chain_ops *ops,
+				     void *private_data,
+				     uint32_t available,
+				     uint32_t overhead,
+				     struct ndr_push ***segmentsp,
+				     uint32_t *countp)
+{
+	enum emsmdbp_chain_status	status;
+	struct ndr_push			**segments;
+	struct ndr_push			*ndr;
+	uint32_t			limit;
+	uint32_t			added = 0;
+
+	if (!ops || !ops->run || !segmentsp || !countp) return 0;
+
+	while (available > overhead + EMSMDB_CHAIN_MIN_BUFFER) {
+		limit = EMSMDB_RPC_HEADER_EXT_SIZE + EMSMDB_CHAIN_SEGMENT_MAX;
+		if (available < limit) {
+			limit = available;
+		}
+
+		/* Make room for the reply before running the ROP */
+		segments = talloc_realloc(mem_ctx, *segmentsp, struct ndr_push *, *countp + 1);
+		if (!segments) break;
+		*segmentsp = segments;
+
+		ndr = NULL;
+		status = ops->run(private_data, mem_ctx, limit, &ndr);
+		if (status == EMSMDBP_CHAIN_STOP || !ndr) break;
+
+		if (EMSMDB_RPC_HEADER_EXT_SIZE + ndr->offset > limit) {
+			talloc_free(ndr);
+			if (ops->rewind && ops->rewind(private_data)) continue;
+			OC_DEBUG(1, "[exchange_emsmdb]: chained reply overflows its %d bytes segment, "
+				 "chain stopped after %d payloads\n", limit, *countp);
+			break;
+		}
+
+		segments[*countp] = ndr;
+		*countp += 1;
+		added++;
+		available -= EMSMDB_RPC_HEADER_EXT_SIZE + ndr->offset;
+
+		if (status == EMSMDBP_CHAIN_LAST) break;
+	}
+
+	return added;
+}
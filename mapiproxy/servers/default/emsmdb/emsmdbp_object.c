@@ -1670,19 +1670,23 @@ _PUBLIC_ enum mapistore_error emsmdbp_folder_delete_indexing_records(struct mapi
 {
         enum mapistore_error    ret;
         uint8_t                 delete_type_flag;
-        uint32_t                i;
+        uint64_t                *fmids;
 
         delete_type_flag = (flags & DELETE_HARD_DELETE) ? MAPISTORE_PERMANENT_DELETE : MAPISTORE_SOFT_DELETE;
-        ret = mapistore_indexing_record_del_fid(mstore_ctx, context_id, username, fid, delete_type_flag);
-        MAPISTORE_RETVAL_IF(ret != MAPISTORE_SUCCESS, ret, NULL);
 
-        for (i = 0; i < deleted_fmids_count; i++) {
-                ret = mapistore_indexing_record_del_fid(mstore_ctx, context_id, username,
-                                                        deleted_fmids[i], delete_type_flag);
-                MAPISTORE_RETVAL_IF(ret != MAPISTORE_SUCCESS, ret, NULL);
+        /* Remove the folder and its children in a single batch */
+        fmids = talloc_array(NULL, uint64_t, deleted_fmids_count + 1);
+        MAPISTORE_RETVAL_IF(!fmids, MAPISTORE_ERR_NO_MEMORY, NULL);
+        fmids[0] = fid;
+        if (deleted_fmids_count) {
+                memcpy(fmids + 1, deleted_fmids, deleted_fmids_count * sizeof (uint64_t));
         }
 
-        return MAPISTORE_SUCCESS;
+        ret = mapistore_indexing_record_del_fmids(mstore_ctx, context_id, username,
+                                                  deleted_fmids_count + 1, fmids, delete_type_flag);
+        talloc_free(fmids);
+
+        return ret;
 }
 
 /**
@@ -2829,6 +2833,70 @@ _PUBLIC_ int emsmdbp_object_get_available_properties(TALLOC_CTX *mem_ctx, struct
 	return mapistore_properties_get_available_properties(emsmdbp_ctx->mstore_ctx, contextID, object->backend_object, mem_ctx, propertiesp);
 }
 
+/**
+   \details Fetch from openchangedb the folder properties which were
+   not handled by the caller, all at once
+
+   \param emsmdbp_ctx pointer to the emsmdb provider context
+   \param username the mailbox owner
+   \param fid the folder identifier
+   \param properties the properties requested by the client
+   \param indexes positions in properties of the tags to fetch
+   \param count number of elements in indexes
+   \param data_pointers the array of values to fill in
+   \param retvals the array of status to fill in
+ */
+static void emsmdbp_object_get_openchangedb_folder_properties(struct emsmdbp_context *emsmdbp_ctx,
+							      const char *username, uint64_t fid,
+							      struct SPropTagArray *properties,
+							      uint32_t *indexes, uint32_t count,
+							      void **data_pointers, enum MAPISTATUS *retvals)
+{
+	TALLOC_CTX		*local_mem_ctx;
+	struct SPropTagArray	*tags;
+	void			**data;
+	enum MAPISTATUS		*tag_retvals;
+	enum MAPISTATUS		retval;
+	uint32_t		i;
+
+	if (!count) return;
+
+	local_mem_ctx = talloc_new(NULL);
+	tags = talloc_zero(local_mem_ctx, struct SPropTagArray);
+	data = talloc_array(local_mem_ctx, void *, count);
+	tag_retvals = talloc_array(local_mem_ctx, enum MAPISTATUS, count);
+	if (!tags || !data || !tag_retvals) {
+		retval = MAPI_E_NOT_ENOUGH_MEMORY;
+		goto end;
+	}
+	tags->cValues = count;
+	tags->aulPropTag = talloc_array(tags, enum MAPITAGS, count);
+	if (!tags->aulPropTag) {
+		retval = MAPI_E_NOT_ENOUGH_MEMORY;
+		goto end;
+	}
+	for (i = 0; i < count; i++) {
+		tags->aulPropTag[i] = properties->aulPropTag[indexes[i]];
+	}
+
+	retval = openchangedb_get_folder_properties(data_pointers, emsmdbp_ctx->oc_ctx, username, fid,
+						    tags, data, tag_retvals);
+	if (retval == MAPI_E_SUCCESS) {
+		for (i = 0; i < count; i++) {
+			data_pointers[indexes[i]] = data[i];
+			retvals[indexes[i]] = tag_retvals[i];
+		}
+		talloc_free(local_mem_ctx);
+		return;
+	}
+
+end:
+	for (i = 0; i < count; i++) {
+		retvals[indexes[i]] = retval;
+	}
+	talloc_free(local_mem_ctx);
+}
+
 static int emsmdbp_object_get_properties_systemspecialfolder(TALLOC_CTX *mem_ctx, struct emsmdbp_context *emsmdbp_ctx, struct emsmdbp_object *object, struct SPropTagArray *properties, void **data_pointers, enum MAPISTATUS *retvals)
 {
 	enum MAPISTATUS			retval = MAPI_E_SUCCESS;
@@ -2841,6 +2909,11 @@ static int emsmdbp_object_get_properties_systemspecialfolder(TALLOC_CTX *mem_ctx
 	time_t				unix_time;
 	NTTIME				nt_time;
 	struct FILETIME			*ft;
+	uint32_t			*indexes;
+	uint32_t			count = 0;
+
+	indexes = talloc_array(mem_ctx, uint32_t, properties->cValues);
+	MAPISTORE_RETVAL_IF(!indexes, MAPISTORE_ERR_NO_MEMORY, NULL);
 
 	folder = (struct emsmdbp_object_folder *) object->object.folder;
         for (i = 0; i < properties->cValues; i++) {
@@ -2883,11 +2956,17 @@ static int emsmdbp_object_get_properties_systemspecialfolder(TALLOC_CTX *mem_ctx
 			retval = MAPI_E_SUCCESS;
 		}
                 else {
-			retval = openchangedb_get_folder_property(data_pointers, emsmdbp_ctx->oc_ctx, emsmdbp_ctx->username, properties->aulPropTag[i], folder->folderID, data_pointers + i);
+			/* Fetched below along with the other stored properties */
+			indexes[count++] = i;
+			continue;
                 }
 		retvals[i] = retval;
         }
 
+	emsmdbp_object_get_openchangedb_folder_properties(emsmdbp_ctx, emsmdbp_ctx->username, folder->folderID,
+							  properties, indexes, count, data_pointers, retvals);
+	talloc_free(indexes);
+
 	return MAPISTORE_SUCCESS;
 }
 
@@ -3137,6 +3216,11 @@ static int emsmdbp_object_get_properties_mailbox(TALLOC_CTX *mem_ctx, struct ems
 {
 	uint32_t			i;
 	struct SBinary_short		*bin;
+	uint32_t			*indexes;
+	uint32_t			count = 0;
+
+	indexes = talloc_array(mem_ctx, uint32_t, properties->cValues);
+	MAPISTORE_RETVAL_IF(!indexes, MAPISTORE_ERR_NO_MEMORY, NULL);
 
 	for (i = 0; i < properties->cValues; i++) {
 		switch (properties->aulPropTag[i]) {
@@ -3168,10 +3252,16 @@ static int emsmdbp_object_get_properties_mailbox(TALLOC_CTX *mem_ctx, struct ems
 			}
 			break;
 		default:
-			retvals[i] = openchangedb_get_folder_property(data_pointers, emsmdbp_ctx->oc_ctx, object->object.mailbox->owner_username, properties->aulPropTag[i], object->object.mailbox->folderID, data_pointers + i);
+			/* Fetched below along with the other stored properties */
+			indexes[count++] = i;
 		}
 	}
 
+	emsmdbp_object_get_openchangedb_folder_properties(emsmdbp_ctx, object->object.mailbox->owner_username,
+							  object->object.mailbox->folderID, properties,
+							  indexes, count, data_pointers, retvals);
+	talloc_free(indexes);
+
 	return MAPISTORE_SUCCESS;
 }
 
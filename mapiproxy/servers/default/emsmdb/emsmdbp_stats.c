@@ -0,0 +1,468 @@
+/*
+   OpenChange Server implementation
+
+   EMSMDBP: EMSMDB Provider implementation
+
+   This program is free software; you can redistribute it and/or modify
+   it under the terms of the GNU General Public License as published by
+   the Free Software Foundation; either version 3 of the License, or
+   (at your option) any later version.
+
+   This program is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+   GNU General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/**
+   \file emsmdbp_stats.c
+
+   \brief Per-ROP counters and latency histograms
+
+   Statistics are kept per process and per ROP opnum. Latencies are
+   recorded in microseconds into log-linear buckets: each power of two
+   is split into EMSMDBP_STATS_SUB_BUCKETS linear sub-buckets, so the
+   relative error of any reported percentile is bounded regardless of
+   the magnitude of the value.
+
+   Statistics are also kept per client session: the time the server
+   spent on its EcDoRpcExt2 calls, the latency the client itself
+   observed, as reported in the AUX_PERF blocks of rgbAuxIn, and how
+   many handles its RopRelease calls released.
+
+   The statistics the other subsystems of the process registered are
+   dumped and reset along with these ones.
+ */
+
+#include "dcesrv_exchange_emsmdb.h"
+#include "utils/dlinklist.h"
+
+#include <stdio.h>
+#include <inttypes.h>
+
+static TALLOC_CTX		*emsmdbp_stats_ctx = NULL;
+static struct emsmdbp_rop_stats	*emsmdbp_stats_rops[EMSMDBP_STATS_OPNUMS];
+static time_t			emsmdbp_stats_since = 0;
+static struct emsmdbp_client_stats	*emsmdbp_stats_clients = NULL;
+static struct emsmdbp_compression_stats	emsmdbp_stats_compressed;
+
+/**
+   \details Return the histogram bucket a latency falls in
+
+   \param usec the latency in microseconds
+
+   \return the bucket index
+ */
+_PUBLIC_ uint32_t emsmdbp_stats_bucket(uint64_t usec)
+{
+	uint32_t	msb;
+	uint32_t	shift;
+	uint32_t	idx;
+
+	if (usec < EMSMDBP_STATS_SUB_BUCKETS) {
+		return (uint32_t) usec;
+	}
+
+	for (msb = 0; (usec >> msb) > 1; msb++);
+	shift = msb - EMSMDBP_STATS_SUB_BUCKET_BITS;
+	idx = (shift + 1) * EMSMDBP_STATS_SUB_BUCKETS + ((usec >> shift) & (EMSMDBP_STATS_SUB_BUCKETS - 1));
+
+	return (idx < EMSMDBP_STATS_BUCKETS) ? idx : EMSMDBP_STATS_BUCKETS - 1;
+}
+
+/**
+   \details Return the highest latency recorded in a histogram bucket
+
+   \param idx the bucket index
+
+   \return the bucket upper bound in microseconds
+ */
+_PUBLIC_ uint64_t emsmdbp_stats_bucket_max(uint32_t idx)
+{
+	uint32_t	magnitude;
+	uint64_t	sub;
+
+	if (idx < EMSMDBP_STATS_SUB_BUCKETS) {
+		return idx;
+	}
+
+	magnitude = idx / EMSMDBP_STATS_SUB_BUCKETS;
+	sub = EMSMDBP_STATS_SUB_BUCKETS | (idx % EMSMDBP_STATS_SUB_BUCKETS);
+
+	return ((sub + 1) << (magnitude - 1)) - 1;
+}
+
+/**
+   \details Add one sample to a set of statistics
+ */
+static void emsmdbp_stats_add(struct emsmdbp_rop_stats *stats, bool error, uint32_t bytes, uint64_t usec)
+{
+	stats->count++;
+	if (error) {
+		stats->errors++;
+	}
+	stats->response_bytes += bytes;
+	stats->latency_total += usec;
+	if (usec > stats->latency_max) {
+		stats->latency_max = usec;
+	}
+	stats->buckets[emsmdbp_stats_bucket(usec)]++;
+}
+
+/**
+   \details Record the outcome of a ROP
+
+   \param opnum the ROP opnum
+   \param error whether the ROP failed
+   \param bytes number of bytes the ROP added to the response
+   \param usec time spent processing the ROP in microseconds
+ */
+_PUBLIC_ void emsmdbp_stats_record(uint8_t opnum, bool error, uint32_t bytes, uint64_t usec)
+{
+	struct emsmdbp_rop_stats	*stats;
+
+	if (!emsmdbp_stats_ctx) {
+		emsmdbp_stats_ctx = talloc_named(NULL, 0, "emsmdbp_stats");
+		if (!emsmdbp_stats_ctx) return;
+		emsmdbp_stats_since = time(NULL);
+	}
+
+	stats = emsmdbp_stats_rops[opnum];
+	if (!stats) {
+		stats = talloc_zero(emsmdbp_stats_ctx, struct emsmdbp_rop_stats);
+		if (!stats) return;
+		emsmdbp_stats_rops[opnum] = stats;
+	}
+
+	emsmdbp_stats_add(stats, error, bytes, usec);
+}
+
+/**
+   \details Retrieve the statistics recorded for a ROP
+
+   \param opnum the ROP opnum
+
+   \return pointer to the statistics, or NULL if the ROP was never
+   recorded since the last reset
+ */
+_PUBLIC_ const struct emsmdbp_rop_stats *emsmdbp_stats_get(uint8_t opnum)
+{
+	return emsmdbp_stats_rops[opnum];
+}
+
+/**
+   \details Estimate a latency percentile from a ROP histogram
+
+   \param stats pointer to the ROP statistics
+   \param percentile the percentile to compute, between 0 and 100
+
+   \return the upper bound in microseconds of the bucket holding the
+   percentile
+ */
+_PUBLIC_ uint64_t emsmdbp_stats_percentile(const struct emsmdbp_rop_stats *stats, double percentile)
+{
+	uint64_t	target;
+	uint64_t	seen = 0;
+	uint32_t	i;
+
+	if (!stats || !stats->count) return 0;
+
+	target = (uint64_t)((percentile / 100.0) * stats->count + 0.5);
+	if (target < 1) target = 1;
+	if (target > stats->count) target = stats->count;
+
+	for (i = 0; i < EMSMDBP_STATS_BUCKETS; i++) {
+		seen += stats->buckets[i];
+		if (seen >= target) {
+			break;
+		}
+	}
+	if (i == EMSMDBP_STATS_BUCKETS) {
+		return stats->latency_max;
+	}
+
+	return (emsmdbp_stats_bucket_max(i) < stats->latency_max) ? emsmdbp_stats_bucket_max(i) : stats->latency_max;
+}
+
+static int emsmdbp_stats_client_destructor(struct emsmdbp_client_stats *client)
+{
+	DLIST_REMOVE(emsmdbp_stats_clients, client);
+	return 0;
+}
+
+/**
+   \details Create the statistics of a client session. They are
+   released along with the memory context, which is expected to be
+   the session's one.
+
+   \param mem_ctx pointer to the memory context
+   \param username the name of the user owning the session
+
+   \return pointer to the client statistics on success, otherwise NULL
+ */
+_PUBLIC_ struct emsmdbp_client_stats *emsmdbp_stats_client_init(TALLOC_CTX *mem_ctx, const char *username)
+{
+	struct emsmdbp_client_stats	*client;
+
+	client = talloc_zero(mem_ctx, struct emsmdbp_client_stats);
+	if (!client) return NULL;
+
+	client->username = talloc_strdup(client, username ? username : "");
+	DLIST_ADD(emsmdbp_stats_clients, client);
+	talloc_set_destructor(client, emsmdbp_stats_client_destructor);
+
+	return client;
+}
+
+/**
+   \details Record the time the server spent processing a client call
+
+   \param client pointer to the client statistics
+   \param bytes number of bytes returned to the client
+   \param usec processing time in microseconds
+ */
+_PUBLIC_ void emsmdbp_stats_client_server_time(struct emsmdbp_client_stats *client, uint32_t bytes, uint64_t usec)
+{
+	if (!client) return;
+
+	emsmdbp_stats_add(&client->server, false, bytes, usec);
+}
+
+/**
+   \details Record the client-observed latencies reported in the
+   AUX_PERF blocks sent along with a client call
+
+   Only the blocks about mailbox requests are considered: their
+   TimeToCompleteRequest (or TimeToFailRequest) is the latency in
+   milliseconds the client observed for one of its previous requests.
+
+   \param client pointer to the client statistics
+   \param aux_header array of AUX_HEADER, terminated by a zero Size
+
+   \return number of latency samples recorded
+ */
+_PUBLIC_ uint32_t emsmdbp_stats_client_aux(struct emsmdbp_client_stats *client, const struct AUX_HEADER *aux_header)
+{
+	uint32_t	i;
+	uint32_t	count = 0;
+
+	if (!client || !aux_header) return 0;
+
+	for (i = 0; aux_header[i].Size; i++) {
+		const union AUX_HEADER_TYPE_UNION_1	*v1 = &aux_header[i].Payload_1;
+		const union AUX_HEADER_TYPE_UNION_2	*v2 = &aux_header[i].Payload_2;
+
+		switch (aux_header[i].Version) {
+		case AUX_VERSION_1:
+			switch (aux_header[i].Type) {
+			case AUX_TYPE_PERF_MDB_SUCCESS:
+			case AUX_TYPE_PERF_BG_MDB_SUCCESS:
+			case AUX_TYPE_PERF_FG_MDB_SUCCESS:
+				emsmdbp_stats_add(&client->reported, false, 0,
+						  v1->AUX_PERF_MDB_SUCCESS.TimeToCompleteRequest * 1000ULL);
+				break;
+			case AUX_TYPE_PERF_DEFMDB_SUCCESS:
+			case AUX_TYPE_PERF_BG_DEFMDB_SUCCESS:
+			case AUX_TYPE_PERF_FG_DEFMDB_SUCCESS:
+				emsmdbp_stats_add(&client->reported, false, 0,
+						  v1->AUX_PERF_DEFMDB_SUCCESS.TimeToCompleteRequest * 1000ULL);
+				break;
+			case AUX_TYPE_PERF_FAILURE:
+			case AUX_TYPE_PERF_BG_FAILURE:
+			case AUX_TYPE_PERF_FG_FAILURE:
+				emsmdbp_stats_add(&client->reported, true, 0,
+						  v1->AUX_PERF_FAILURE.TimeToFailRequest * 1000ULL);
+				break;
+			default:
+				continue;
+			}
+			break;
+		case AUX_VERSION_2:
+			switch (aux_header[i].Type) {
+			case AUX_TYPE_PERF_MDB_SUCCESS_2:
+				emsmdbp_stats_add(&client->reported, false, 0,
+						  v2->AUX_PERF_MDB_SUCCESS_V2.TimeToCompleteRequest * 1000ULL);
+				break;
+			case AUX_TYPE_PERF_BG_MDB_SUCCESS:
+			case AUX_TYPE_PERF_FG_MDB_SUCCESS:
+				emsmdbp_stats_add(&client->reported, false, 0,
+						  v2->AUX_PERF_MDB_SUCCESS.TimeToCompleteRequest * 1000ULL);
+				break;
+			case AUX_TYPE_PERF_DEFMDB_SUCCESS:
+			case AUX_TYPE_PERF_BG_DEFMDB_SUCCESS:
+			case AUX_TYPE_PERF_FG_DEFMDB_SUCCESS:
+				emsmdbp_stats_add(&client->reported, false, 0,
+						  v2->AUX_PERF_DEFMDB_SUCCESS.TimeToCompleteRequest * 1000ULL);
+				break;
+			case AUX_TYPE_PERF_FAILURE_2:
+				emsmdbp_stats_add(&client->reported, true, 0,
+						  v2->AUX_PERF_FAILURE_V2.TimeToFailRequest * 1000ULL);
+				break;
+			case AUX_TYPE_PERF_BG_FAILURE:
+			case AUX_TYPE_PERF_FG_FAILURE:
+				emsmdbp_stats_add(&client->reported, true, 0,
+						  v2->AUX_PERF_FAILURE.TimeToFailRequest * 1000ULL);
+				break;
+			default:
+				continue;
+			}
+			break;
+		default:
+			continue;
+		}
+		count++;
+	}
+
+	return count;
+}
+
+/**
+   \details Record the size of an EcDoRpcExt2 response payload before
+   and after compression
+
+   \param size the size of the payload
+   \param compressed_size the size sent to the client, equal to size
+   when the payload was not compressed
+ */
+_PUBLIC_ void emsmdbp_stats_compression(uint32_t size, uint32_t compressed_size)
+{
+	emsmdbp_stats_compressed.responses++;
+	if (compressed_size < size) {
+		emsmdbp_stats_compressed.compressed++;
+		emsmdbp_stats_compressed.uncompressed_bytes += size;
+		emsmdbp_stats_compressed.compressed_bytes += compressed_size;
+	}
+}
+
+/**
+   \details Retrieve the response compression counters
+
+   \param stats pointer to the structure the function fills
+ */
+_PUBLIC_ void emsmdbp_stats_get_compression(struct emsmdbp_compression_stats *stats)
+{
+	if (!stats) return;
+
+	*stats = emsmdbp_stats_compressed;
+}
+
+/**
+   \details Forget all the statistics recorded so far, including the
+   ones the other subsystems registered
+ */
+_PUBLIC_ void emsmdbp_stats_reset(void)
+{
+	struct emsmdbp_client_stats	*client;
+	uint32_t			i;
+
+	for (i = 0; i < EMSMDBP_STATS_OPNUMS; i++) {
+		emsmdbp_stats_rops[i] = NULL;
+	}
+	for (client = emsmdbp_stats_clients; client; client = client->next) {
+		memset(&client->server, 0, sizeof (struct emsmdbp_rop_stats));
+		memset(&client->reported, 0, sizeof (struct emsmdbp_rop_stats));
+		if (client->handles_ctx) {
+			memset(&client->handles_ctx->stats, 0, sizeof (struct mapi_handles_stats));
+		}
+	}
+	memset(&emsmdbp_stats_compressed, 0, sizeof (struct emsmdbp_compression_stats));
+	talloc_free(emsmdbp_stats_ctx);
+	emsmdbp_stats_ctx = NULL;
+	emsmdbp_stats_since = time(NULL);
+	mapiproxy_stats_reset();
+}
+
+/**
+   \details Write the statistics of every recorded ROP into a file
+
+   The file is written next to its final location and renamed over
+   it, so readers never see a partial dump.
+
+   \param path the path of the file to write
+
+   \return MAPI_E_SUCCESS on success, otherwise MAPI error
+ */
+_PUBLIC_ enum MAPISTATUS emsmdbp_stats_dump(const char *path)
+{
+	struct emsmdbp_rop_stats	*stats;
+	struct emsmdbp_client_stats	*client;
+	char				*tmp_path;
+	FILE				*fp;
+	uint32_t			i;
+	struct mapi_handles_stats	handles;
+	struct emsmdbp_compression_stats	compression;
+
+	/* Sanity checks */
+	OPENCHANGE_RETVAL_IF(!path, MAPI_E_INVALID_PARAMETER, NULL);
+
+	tmp_path = talloc_asprintf(NULL, "%s.tmp", path);
+	OPENCHANGE_RETVAL_IF(!tmp_path, MAPI_E_NOT_ENOUGH_RESOURCES, NULL);
+
+	fp = fopen(tmp_path, "w");
+	OPENCHANGE_RETVAL_IF(!fp, MAPI_E_NO_ACCESS, tmp_path);
+
+	fprintf(fp, "# pid %d, since %"PRIu64", now %"PRIu64"\n", (int) getpid(),
+		(uint64_t) emsmdbp_stats_since, (uint64_t) time(NULL));
+	fprintf(fp, "# opnum count errors bytes avg_us max_us p50_us p90_us p99_us p999_us\n");
+	for (i = 0; i < EMSMDBP_STATS_OPNUMS; i++) {
+		stats = emsmdbp_stats_rops[i];
+		if (!stats || !stats->count) continue;
+
+		fprintf(fp, "0x%.2x %"PRIu64" %"PRIu64" %"PRIu64" %"PRIu64" %"PRIu64" %"PRIu64" %"PRIu64" %"PRIu64" %"PRIu64"\n",
+			i, stats->count, stats->errors, stats->response_bytes,
+			stats->latency_total / stats->count, stats->latency_max,
+			emsmdbp_stats_percentile(stats, 50.0),
+			emsmdbp_stats_percentile(stats, 90.0),
+			emsmdbp_stats_percentile(stats, 99.0),
+			emsmdbp_stats_percentile(stats, 99.9));
+	}
+
+	fprintf(fp, "# client rpcs server_avg_us server_max_us reported failures reported_avg_us reported_p50_us reported_p90_us reported_p99_us\n");
+	for (client = emsmdbp_stats_clients; client; client = client->next) {
+		if (!client->server.count && !client->reported.count) continue;
+
+		fprintf(fp, "%s %"PRIu64" %"PRIu64" %"PRIu64" %"PRIu64" %"PRIu64" %"PRIu64" %"PRIu64" %"PRIu64" %"PRIu64"\n",
+			client->username, client->server.count,
+			client->server.count ? client->server.latency_total / client->server.count : 0,
+			client->server.latency_max,
+			client->reported.count, client->reported.errors,
+			client->reported.count ? client->reported.latency_total / client->reported.count : 0,
+			emsmdbp_stats_percentile(&client->reported, 50.0),
+			emsmdbp_stats_percentile(&client->reported, 90.0),
+			emsmdbp_stats_percentile(&client->reported, 99.0));
+	}
+
+	fprintf(fp, "# handles client release_calls released_handles avg_fanout last_fanout max_fanout\n");
+	for (client = emsmdbp_stats_clients; client; client = client->next) {
+		if (!client->handles_ctx) continue;
+		if (mapi_handles_get_stats(client->handles_ctx, &handles) != MAPI_E_SUCCESS) continue;
+		if (!handles.release_calls) continue;
+
+		fprintf(fp, "%s %"PRIu64" %"PRIu64" %"PRIu64" %"PRIu32" %"PRIu32"\n",
+			client->username, handles.release_calls, handles.released_handles,
+			handles.released_handles / handles.release_calls,
+			handles.last_fanout, handles.max_fanout);
+	}
+
+	emsmdbp_stats_get_compression(&compression);
+	fprintf(fp, "# compression responses compressed uncompressed_bytes compressed_bytes saved_bytes\n");
+	fprintf(fp, "compression %"PRIu64" %"PRIu64" %"PRIu64" %"PRIu64" %"PRIu64"\n",
+		compression.responses, compression.compressed,
+		compression.uncompressed_bytes, compression.compressed_bytes,
+		compression.uncompressed_bytes - compression.compressed_bytes);
+
+	mapiproxy_stats_dump(fp);
+
+	if (fclose(fp) != 0 || rename(tmp_path, path) != 0) {
+		OC_DEBUG(1, "[exchange_emsmdb]: unable to write ROP statistics to %s\n", path);
+		unlink(tmp_path);
+		talloc_free(tmp_path);
+		return MAPI_E_CALL_FAILED;
+	}
+	talloc_free(tmp_path);
+
+	return MAPI_E_SUCCESS;
+}
@@ -612,9 +612,11 @@ _PUBLIC_ enum MAPISTATUS EcDoRpc_RopDeleteMessages(TALLOC_CTX *mem_ctx,
 	struct mapi_handles	*parent_folder = NULL;
 	void			*parent_folder_private_data;
 	struct emsmdbp_object	*parent_object;
-	char			*owner;
+	char			*owner = NULL;
 	enum MAPISTATUS		retval;
-	uint32_t		contextID;
+	uint32_t		contextID = 0;
+	uint64_t		*deleted_mids = NULL;
+	uint32_t		deleted_count = 0;
 	int 			i;
 
 	OC_DEBUG(4, "exchange_emsmdb: [OXCFOLD] DeleteMessage (0x1e)\n");
@@ -652,6 +654,12 @@ _PUBLIC_ enum MAPISTATUS EcDoRpc_RopDeleteMessages(TALLOC_CTX *mem_ctx,
 
 	contextID = emsmdbp_get_contextID(parent_object);
 	owner = emsmdbp_get_owner(parent_object);
+	deleted_mids = talloc_array(mem_ctx, uint64_t, mapi_req->u.mapi_DeleteMessages.cn_ids);
+	if (!deleted_mids) {
+		mapi_repl->error_code = MAPI_E_NOT_ENOUGH_MEMORY;
+		goto delete_message_response;
+	}
+
 	for (i = 0; i < mapi_req->u.mapi_DeleteMessages.cn_ids; ++i) {
 		int ret;
 		uint64_t mid = mapi_req->u.mapi_DeleteMessages.message_ids[i];
@@ -666,15 +674,22 @@ _PUBLIC_ enum MAPISTATUS EcDoRpc_RopDeleteMessages(TALLOC_CTX *mem_ctx,
 			}
 			goto delete_message_response;
 		}
+		deleted_mids[deleted_count++] = mid;
+	}
 
-		ret = mapistore_indexing_record_del_mid(emsmdbp_ctx->mstore_ctx, contextID, owner, mid, MAPISTORE_SOFT_DELETE);
+delete_message_response:
+	/* Remove the index records of the deleted messages at once */
+	if (deleted_count) {
+		int ret;
+
+		ret = mapistore_indexing_record_del_fmids(emsmdbp_ctx->mstore_ctx, contextID, owner,
+							  deleted_count, deleted_mids, MAPISTORE_SOFT_DELETE);
 		if (ret != MAPISTORE_SUCCESS) {
 			mapi_repl->error_code = MAPI_E_CALL_FAILED;
-			goto delete_message_response;
 		}
 	}
+	talloc_free(deleted_mids);
 
-delete_message_response:
 	*size += libmapiserver_RopDeleteMessage_size(mapi_repl);
 
 	return MAPI_E_SUCCESS;
@@ -944,8 +959,7 @@ _PUBLIC_ enum MAPISTATUS EcDoRpc_RopMoveCopyMessages(TALLOC_CTX *mem_ctx,
 	void			*private_data = NULL;
 	struct emsmdbp_object	*destination_object;
 	struct emsmdbp_object   *source_object;
-	uint64_t                *targetMIDs;
-        uint32_t                i;
+	struct UI8Array_r	*targetMIDs;
 	bool			mapistore = false;
 
 	OC_DEBUG(4, "exchange_emsmdb: [OXCFOLD] RopMoveCopyMessages (0x33)\n");
@@ -1002,14 +1016,16 @@ _PUBLIC_ enum MAPISTATUS EcDoRpc_RopMoveCopyMessages(TALLOC_CTX *mem_ctx,
 	contextID = emsmdbp_get_contextID(destination_object);
 	mapistore = emsmdbp_is_mapistore(source_object);
 	if (mapistore) {
-		/* We prepare a set of new MIDs for the backend */
-		targetMIDs = talloc_array(NULL, uint64_t, mapi_req->u.mapi_MoveCopyMessages.count);
-		for (i = 0; i < mapi_req->u.mapi_MoveCopyMessages.count; i++) {
-			mapistore_indexing_get_new_folderID(emsmdbp_ctx->mstore_ctx, &targetMIDs[i]);
+		/* We prepare a set of new MIDs for the backend, allocated at once */
+		if (mapistore_indexing_get_new_folderIDs(emsmdbp_ctx->mstore_ctx, NULL,
+							 mapi_req->u.mapi_MoveCopyMessages.count,
+							 &targetMIDs) != MAPISTORE_SUCCESS) {
+			mapi_repl->error_code = MAPI_E_CALL_FAILED;
+			goto end;
 		}
 
 		/* We invoke the backend method */
-		mapistore_folder_move_copy_messages(emsmdbp_ctx->mstore_ctx, contextID, destination_object->backend_object, source_object->backend_object, mem_ctx, mapi_req->u.mapi_MoveCopyMessages.count, mapi_req->u.mapi_MoveCopyMessages.message_id, targetMIDs, NULL, NULL, mapi_req->u.mapi_MoveCopyMessages.WantCopy);
+		mapistore_folder_move_copy_messages(emsmdbp_ctx->mstore_ctx, contextID, destination_object->backend_object, source_object->backend_object, mem_ctx, mapi_req->u.mapi_MoveCopyMessages.count, mapi_req->u.mapi_MoveCopyMessages.message_id, targetMIDs->lpui8, NULL, NULL, mapi_req->u.mapi_MoveCopyMessages.WantCopy);
 		talloc_free(targetMIDs);
 
 		/* /\* The backend might do this for us. In any case, we try to add it ourselves *\/ */
@@ -2535,6 +2535,8 @@ _PUBLIC_ enum MAPISTATUS EcDoRpc_RopSyncImportDeletes(TALLOC_CTX *mem_ctx,
 	uint16_t				repl_id;
 	struct mapi_SBinaryArray		*object_array;
 	uint64_t				*object_ids = NULL;
+	uint64_t				*indexed_ids = NULL;
+	uint32_t				indexed_count = 0;
 	uint8_t					delete_type;
 	uint32_t				i;
 	int						ret;
@@ -2607,6 +2609,12 @@ _PUBLIC_ enum MAPISTATUS EcDoRpc_RopSyncImportDeletes(TALLOC_CTX *mem_ctx,
 
 		contextID = emsmdbp_get_contextID(synccontext_object);
 
+		indexed_ids = talloc_array(object_ids, uint64_t, object_array->cValues);
+		if (!indexed_ids) {
+			mapi_repl->error_code = MAPI_E_NOT_ENOUGH_MEMORY;
+			goto end;
+		}
+
 		for (i = 0; i < object_array->cValues; i++) {
 			ret = oxcfxics_fmid_from_source_key(emsmdbp_ctx, owner, object_array->bin + i, &objectID);
 			if (ret == MAPISTORE_SUCCESS) {
@@ -2616,12 +2624,16 @@ _PUBLIC_ enum MAPISTATUS EcDoRpc_RopSyncImportDeletes(TALLOC_CTX *mem_ctx,
 				} else {
 					OC_DEBUG(5, "message deletion failed for fmid: 0x%.16"PRIx64"\n", objectID);
 				}
-				ret = mapistore_indexing_record_del_mid(emsmdbp_ctx->mstore_ctx, contextID, owner, objectID, delete_type);
-				if (ret != MAPISTORE_SUCCESS) {
-					OC_DEBUG(5, "message deletion of index record failed for fmid: 0x%.16"PRIx64"\n", objectID);
-				}
+				indexed_ids[indexed_count++] = objectID;
 			}
 		}
+
+		/* Remove the index records in a single batch */
+		ret = mapistore_indexing_record_del_fmids(emsmdbp_ctx->mstore_ctx, contextID, owner,
+							  indexed_count, indexed_ids, delete_type);
+		if (ret != MAPISTORE_SUCCESS) {
+			OC_DEBUG(5, "message deletion of %d index records failed\n", indexed_count);
+		}
 	}
 
 	/* Store the fid in the involved fmids of the upload operations */
@@ -30,27 +30,15 @@
 #include "dcesrv_exchange_nsp.h"
 
 static struct exchange_nsp_session	*nsp_session = NULL;
+static struct emsabp_sessions		*nsp_sessions = NULL;
 static TDB_CONTEXT			*emsabp_tdb_ctx = NULL;
 
-static struct exchange_nsp_session *dcesrv_find_nsp_session(struct GUID *uuid)
-{
-	struct exchange_nsp_session *session, *found_session = NULL;
-
-	for (session = nsp_session; !found_session && session; session = session->next) {
-		if (GUID_equal(uuid, &session->uuid)) {
-			found_session = session;
-		}
-	}
-
-	return found_session;
-}
-
 static struct emsabp_context *dcesrv_find_emsabp_context(struct GUID *uuid)
 {
 	struct exchange_nsp_session	*session;
 	struct emsabp_context		*emsabp_ctx = NULL;
 
-	session = dcesrv_find_nsp_session(uuid);
+	session = emsabp_sessions_find(nsp_sessions, uuid);
 	if (session) {
 		emsabp_ctx = (struct emsabp_context *)session->session->private_data;;
 	}
@@ -156,7 +144,7 @@ static void dcesrv_NspiBind(struct dcesrv_call_state *dce_call,
 	r->out.mapiuid = guid;
 
 	/* Search for an existing session and increment ref_count, otherwise create it */
-	session = dcesrv_find_nsp_session(&handle->wire_handle.uuid);
+	session = emsabp_sessions_find(nsp_sessions, &handle->wire_handle.uuid);
 	if (session) {
 		mpm_session_increment_ref_count(session->session);
 		OC_DEBUG(5, "  [unexpected]: existing nsp_session: %p; session: %p (ref++)", session, session->session);
@@ -165,17 +153,22 @@ static void dcesrv_NspiBind(struct dcesrv_call_state *dce_call,
 
 		/* Step 6. Associate this emsabp context to the session */
 		session = talloc((TALLOC_CTX *)nsp_session, struct exchange_nsp_session);
-		DCESRV_NSP_RETURN_IF(!session, r, MAPI_E_NOT_ENOUGH_RESOURCES, emsabp_ctx);
-
-		session->session = mpm_session_init((TALLOC_CTX *)nsp_session, dce_call);
-		DCESRV_NSP_RETURN_IF(!session->session, r, MAPI_E_NOT_ENOUGH_RESOURCES, emsabp_ctx);
+		if (session) {
+			session->uuid = handle->wire_handle.uuid;
+			session->session = mpm_session_init(session, dce_call);
+		}
 
-		session->uuid = handle->wire_handle.uuid;
+		/* Register the session before handing it the context, so
+		 * a failure leaves nothing pointing to the freed context */
+		if (!session || !session->session || !emsabp_sessions_add(nsp_sessions, session)) {
+			talloc_free(session);
+			talloc_free(handle);
+			retval = MAPI_E_NOT_ENOUGH_RESOURCES;
+			goto failure;
+		}
 
 		mpm_session_set_private_data(session->session, (void *) emsabp_ctx);
 		mpm_session_set_destructor(session->session, emsabp_destructor);
-
-		DLIST_ADD_END(nsp_session, session, struct exchange_nsp_session *);
 	}
 
 	DCESRV_NSP_RETURN(r, MAPI_E_SUCCESS, NULL);
@@ -215,10 +208,10 @@ static void dcesrv_NspiUnbind(struct dcesrv_call_state *dce_call,
 	/* Step 1. Retrieve handle and free if emsabp context and session are available */
 	h = dcesrv_handle_fetch(dce_call->context, r->in.handle, DCESRV_HANDLE_ANY);
 	if (h) {
-		session = dcesrv_find_nsp_session(&r->in.handle->uuid);
+		session = emsabp_sessions_find(nsp_sessions, &r->in.handle->uuid);
 		if (session) {
 			if (mpm_session_release(session->session)) {
-				DLIST_REMOVE(nsp_session, session);
+				emsabp_sessions_remove(nsp_sessions, session);
 				OC_DEBUG(5, "Session found and released\n");
 			} else {
 				OC_DEBUG(5, "Session found and ref_count decreased\n");
@@ -238,31 +231,36 @@ static void dcesrv_NspiUnbind(struct dcesrv_call_state *dce_call,
 
 /**
    \details Get the current position and the last row position as defined by the pStat argument.
-   In the case of an empty table it return 0 for both positions. The caller can discriminate between empty tables and one-row tables looking at the cValues of the PropertyTagArray_r
+   In the case of an empty table it return 0 for both positions. The caller can discriminate between empty tables and one-row tables looking at the count of the snapshot
 
 
+   \param emsabp_ctx pointer to the EMSABP context
    \param pStat pointer to struct STAT which will be used to get the positions
-   \param mids pointer to struct PropertyTagArray_r which contains the table as MIDs array
+   \param snapshot pointer to the snapshot of the container the table is made of
    \param[out] out_row pointer to the uint32_t which will cotaint the current row
    \param[out] out_last_row pointer to the uint32_t which will cotaint the last row in table
  */
-static void position_in_table(struct STAT *pStat,
-			      struct PropertyTagArray_r *mids,
+static void position_in_table(struct emsabp_context *emsabp_ctx,
+			      struct STAT *pStat,
+			      struct emsabp_snapshot *snapshot,
 			      uint32_t *out_row, uint32_t *out_last_row)
 {
-	bool		found;
 	uint32_t	row;
 	uint32_t	last_row;
 
-	if (mids->cValues > 0) {
-		last_row = mids->cValues - 1;
+	if (snapshot->count > 0) {
+		last_row = snapshot->count - 1;
 	} else {
 		last_row = 0;
 	}
 
 	if (pStat->CurrentRec == MID_CURRENT) {
 		/* Fractional positioning (3.1.4.5.2) */
-		row = pStat->NumPos * (last_row+1) / pStat->TotalRecs;
+		if (pStat->TotalRecs) {
+			row = (uint64_t)pStat->NumPos * (last_row+1) / pStat->TotalRecs;
+		} else {
+			row = 0;
+		}
 		if (row > last_row) {
 			row = last_row;
 		}
@@ -273,21 +271,10 @@ static void position_in_table(struct STAT *pStat,
 		}
 		else if (pStat->CurrentRec == MID_END_OF_TABLE) {
 			row = last_row;
-		} else {
-			found = false;
+		} else if (emsabp_snapshot_MId_to_row(snapshot, emsabp_ctx->ttdb_ctx,
+						      pStat->CurrentRec, &row) != MAPI_E_SUCCESS) {
+			/* In this case the position is undefined. To avoid problems we will use first row */
 			row = 0;
-			while (row <= last_row) {
-				if (mids->aulPropTag[row] == pStat->CurrentRec) {
-					found = true;
-					break;
-				} else {
-					row++;
-				}
-			}
-			if (!found) {
-				/* In this case the position is undefined. To avoid problems we will use first row */
-				row = 0;
-			}
 		}
 	}
 
@@ -299,15 +286,18 @@ static void position_in_table(struct STAT *pStat,
    \details This method does the main work of NspiUpdateStat. It is separated from dcesrv_NspiUpdateStat to be called from NspiQueryRows to update correctly the pStat struct. Also is called from NspiUpdateStat to avoid repeating code.
 
    \param[in,out] r pointer to the NspiUpdateStat request data
-   \param mids pointer to struct PropertyTagArray_r which contains the table as MIDs array
+   \param emsabp_ctx pointer to the EMSABP context
+   \param snapshot pointer to the snapshot of the container the table is made of
 */
 static void dcesrv_do_NspiUpdateStat(struct NspiUpdateStat *r,
-				     struct PropertyTagArray_r *mids)
+				     struct emsabp_context *emsabp_ctx,
+				     struct emsabp_snapshot *snapshot)
 {
 	enum MAPISTATUS			retval = MAPI_E_SUCCESS;
 	uint32_t			row, last_row;
+	uint32_t			MId;
 
-	position_in_table(r->in.pStat, mids, &row, &last_row);
+	position_in_table(emsabp_ctx, r->in.pStat, snapshot, &row, &last_row);
 
 	if (r->in.pStat->Delta != 0) {
 		/* Adjust row  by Delta */
@@ -331,12 +321,14 @@ static void dcesrv_do_NspiUpdateStat(struct NspiUpdateStat *r,
 	} else if (row == 0) {
 		r->out.pStat->CurrentRec = MID_BEGINNING_OF_TABLE;
 	} else {
-		r->out.pStat->CurrentRec = mids->aulPropTag[row];
+		retval = emsabp_snapshot_row_to_MId(snapshot, emsabp_ctx->ttdb_ctx, row, &MId);
+		DCESRV_NSP_RETURN_IF(retval != MAPI_E_SUCCESS, r, retval, NULL);
+		r->out.pStat->CurrentRec = MId;
 	}
 
 	r->out.pStat->Delta = 0;
 	r->out.pStat->NumPos = row;
-	r->out.pStat->TotalRecs = mids->cValues;
+	r->out.pStat->TotalRecs = snapshot->count;
 	r->out.plDelta = r->in.plDelta;
 	if (r->in.plDelta != NULL) {
 		*(r->out.plDelta) = r->out.pStat->NumPos - r->in.pStat->NumPos;
@@ -361,7 +353,7 @@ static void dcesrv_NspiUpdateStat(struct dcesrv_call_state *dce_call, TALLOC_CTX
 {
 	struct emsabp_context		*emsabp_ctx = NULL;
 	bool				container_exists;
-	struct PropertyTagArray_r	*mids;
+	struct emsabp_snapshot		*snapshot;
 	enum MAPISTATUS			retval = MAPI_E_SUCCESS;
 
 	OC_DEBUG(3, "exchange_nsp: NspiUpdateStat (0x2)");
@@ -382,14 +374,12 @@ static void dcesrv_NspiUpdateStat(struct dcesrv_call_state *dce_call, TALLOC_CTX
 		DCESRV_NSP_RETURN_IF(!container_exists, r, MAPI_E_INVALID_BOOKMARK, NULL);
 	}
 
-	/* Step 1. Search in the directory */
-	mids = talloc_zero(mem_ctx, struct PropertyTagArray_r);
-	DCESRV_NSP_RETURN_IF(!mids, r, MAPI_E_NOT_ENOUGH_MEMORY, NULL);
-	retval = emsabp_search(mem_ctx, emsabp_ctx, mids, NULL, r->in.pStat, 0);
+	/* Step 1. Retrieve the container records */
+	retval = emsabp_ab_container_snapshot(emsabp_ctx, r->in.pStat->ContainerID, &snapshot);
 	DCESRV_NSP_RETURN_IF(retval != MAPI_E_SUCCESS, r, retval, NULL);
 
 	/* Step 2. Do the update stat with the result */
-	dcesrv_do_NspiUpdateStat(r, mids);
+	dcesrv_do_NspiUpdateStat(r, emsabp_ctx, snapshot);
 }
 
 /**
@@ -399,12 +389,10 @@ static void dcesrv_NspiUpdateStat(struct dcesrv_call_state *dce_call, TALLOC_CTX
    \param mem_ctx pointer to the memory context
    \param[in,out] r pointer to the NspiQueryRows request data
    \param emsabp_ctx pointer to the emsabp context
-   \param mids pointer to struct PropertyTagArray_r which contains the table as MIDs array
    \param updateStat update the out stat struct inside the NspiQueryRows request data. The update is not necessary when called from NspiSeekEntries
 */
 static void dcesrv_do_NspiQueryRows(TALLOC_CTX *mem_ctx, struct NspiQueryRows *r,
-				    struct emsabp_context *emsabp_ctx,  struct PropertyTagArray_r *mids,
-				    bool updateStat)
+				    struct emsabp_context *emsabp_ctx, bool updateStat)
 {
 	enum MAPISTATUS			retval = MAPI_E_SUCCESS;
 	struct SPropTagArray		*pPropTags;
@@ -451,26 +439,25 @@ static void dcesrv_do_NspiQueryRows(TALLOC_CTX *mem_ctx, struct NspiQueryRows *r
 	/* Step 2. Fill ppRows  */
 	if (r->in.lpETable == NULL) {
 		/* Step 2.1 Fill ppRows for supplied Container ID */
-		struct ldb_result	*ldb_res;
+		struct emsabp_snapshot	*snapshot;
 		uint32_t		start_pos;
 		uint32_t		last_row;
 
-		position_in_table(r->in.pStat, mids, &start_pos, &last_row);
-		retval = emsabp_ab_container_enum(mem_ctx, emsabp_ctx,
-						  r->in.pStat->ContainerID, &ldb_res);
+		retval = emsabp_ab_container_snapshot(emsabp_ctx, r->in.pStat->ContainerID, &snapshot);
 		if (retval != MAPI_E_SUCCESS)  {
 			goto failure;
 		}
-		if (ldb_res == NULL) {
+		if (snapshot->count == 0) {
 			/* No elements in this container */
 			*r->out.ppRows = pRows;
 			DCESRV_NSP_RETURN(r, MAPI_E_SUCCESS, NULL);
 		}
 
+		position_in_table(emsabp_ctx, r->in.pStat, snapshot, &start_pos, &last_row);
 		if (r->in.pStat->Delta >= 0) {
 			start_pos = start_pos + r->in.pStat->Delta;
-			if (start_pos >= ldb_res->count) {
-				start_pos = ldb_res->count;
+			if (start_pos >= snapshot->count) {
+				start_pos = snapshot->count;
 			}
 		} else {
 			if (abs(r->in.pStat->Delta) > r->in.pStat->NumPos) {
@@ -480,7 +467,7 @@ static void dcesrv_do_NspiQueryRows(TALLOC_CTX *mem_ctx, struct NspiQueryRows *r
 			}
 		}
 
-		count = ldb_res->count - start_pos;
+		count = snapshot->count - start_pos;
 		if (r->in.Count < count) {
 			count = r->in.Count;
 		}
@@ -496,7 +483,7 @@ static void dcesrv_do_NspiQueryRows(TALLOC_CTX *mem_ctx, struct NspiQueryRows *r
 			/* fetch required attributes for every entry found */
 			for (i = 0; i < count; i++) {
 				retval = emsabp_fetch_attrs_from_msg(mem_ctx, emsabp_ctx, pRows->aRow + i,
-								     ldb_res->msgs[start_pos+i], 0, r->in.dwFlags, pPropTags);
+								     snapshot->entries[start_pos+i]->msg, 0, r->in.dwFlags, pPropTags);
 				if (retval != MAPI_E_SUCCESS) {
 					goto failure;
 				}
@@ -512,9 +499,9 @@ static void dcesrv_do_NspiQueryRows(TALLOC_CTX *mem_ctx, struct NspiQueryRows *r
 			r_UpdateStat.in.pStat = r->in.pStat;
 			r_UpdateStat.in.pStat->Delta += pRows->cRows;
 			r_UpdateStat.in.plDelta = NULL;
-			r_UpdateStat.in.pStat->TotalRecs = ldb_res->count;
+			r_UpdateStat.in.pStat->TotalRecs = snapshot->count;
 			r_UpdateStat.out.pStat = r->out.pStat;
-			dcesrv_do_NspiUpdateStat(&r_UpdateStat, mids);
+			dcesrv_do_NspiUpdateStat(&r_UpdateStat, emsabp_ctx, snapshot);
 			if (r_UpdateStat.out.result != MAPI_E_SUCCESS) {
 				/* Not clear in the spec what to do if updateStat fails, ignoring it and logging error for the moment */
 				OC_DEBUG(1, "NSPI UpdateStat after GetRows failed: %u\n", r_UpdateStat.out.result);
@@ -571,9 +558,7 @@ failure:
 static void dcesrv_NspiQueryRows(struct dcesrv_call_state *dce_call, TALLOC_CTX *mem_ctx,
 				 struct NspiQueryRows *r)
 {
-	enum MAPISTATUS			retval = MAPI_E_SUCCESS;
 	struct emsabp_context		*emsabp_ctx = NULL;
-	struct PropertyTagArray_r	*mids;
 
 	OC_DEBUG(3, "exchange_nsp: NspiQueryRows (0x3)\n");
 
@@ -598,16 +583,9 @@ static void dcesrv_NspiQueryRows(struct dcesrv_call_state *dce_call, TALLOC_CTX
 			r, MAPI_E_INVALID_BOOKMARK, NULL);
 	}
 
-	mids = talloc_zero(mem_ctx, struct PropertyTagArray_r);
-	DCESRV_NSP_RETURN_IF(!mids, r, MAPI_E_NOT_ENOUGH_MEMORY, NULL);
-
-	/* Step 2. Perform the search */
-	retval = emsabp_search(mem_ctx, emsabp_ctx, mids, NULL, r->in.pStat, 0);
-	DCESRV_NSP_RETURN_IF(retval != MAPI_E_SUCCESS, r, retval, NULL);
-
-	/* Step 3. Now we have passed session verifications and have
-	   the data we can do the operation */
-	dcesrv_do_NspiQueryRows(mem_ctx, r, emsabp_ctx, mids, true);
+	/* Step 2. Now we have passed session verifications we can
+	   do the operation */
+	dcesrv_do_NspiQueryRows(mem_ctx, r, emsabp_ctx, true);
 }
 
 
@@ -626,7 +604,11 @@ static void dcesrv_NspiSeekEntries(struct dcesrv_call_state *dce_call, TALLOC_CT
 	enum MAPISTATUS			retval = MAPI_E_SUCCESS;
 	struct emsabp_context		*emsabp_ctx = NULL;
 	uint32_t			row;
-	struct PropertyTagArray_r	*mids, *all_mids;
+	uint32_t			total;
+	uint32_t			MId;
+	bool				found;
+	struct emsabp_snapshot		*snapshot = NULL;
+	struct PropertyTagArray_r	*mids;
 	struct Restriction_r		*seek_restriction;
 	bool				container_exists;
 	struct NspiQueryRows		r_QueryRows;
@@ -669,51 +651,72 @@ static void dcesrv_NspiSeekEntries(struct dcesrv_call_state *dce_call, TALLOC_CT
 	}
 
 	if (r->in.lpETable) {
-		all_mids = r->in.lpETable;
+		total = r->in.lpETable->cValues;
 	} else {
-		all_mids = talloc_zero(mem_ctx, struct PropertyTagArray_r);
-		if (all_mids == NULL) {
-			retval = MAPI_E_NOT_ENOUGH_MEMORY;
-			goto failure;
-		}
-
-		retval = emsabp_search(mem_ctx, emsabp_ctx, all_mids, NULL, r->in.pStat, 0);
+		retval = emsabp_ab_container_snapshot(emsabp_ctx, r->in.pStat->ContainerID, &snapshot);
 		if (retval != MAPI_E_SUCCESS) {
 			goto failure;
 		}
+		total = snapshot->count;
 	}
 
-	/* find the records matching the qualifier */
-	seek_restriction = talloc_zero(mem_ctx, struct Restriction_r);
-	if (seek_restriction == NULL) {
-		retval = MAPI_E_NOT_ENOUGH_MEMORY;
-		goto failure;
-	}
-	seek_restriction->rt = RES_PROPERTY;
-	seek_restriction->res.resProperty.relop = RELOP_GE;
-	seek_restriction->res.resProperty.ulPropTag = r->in.pTarget->ulPropTag;
-	seek_restriction->res.resProperty.lpProp = r->in.pTarget;
+	found = false;
+	row = 0;
+	if (r->in.lpETable == NULL && (r->in.pTarget->ulPropTag == PR_DISPLAY_NAME ||
+				       r->in.pTarget->ulPropTag == PR_DISPLAY_NAME_UNICODE)) {
+		/* The container is sorted on displayName, look the target up */
+		row = emsabp_snapshot_seek(snapshot, (const char *)get_PropertyValue_data(r->in.pTarget));
+		found = (row < total);
+	} else {
+		/* find the records matching the qualifier */
+		seek_restriction = talloc_zero(mem_ctx, struct Restriction_r);
+		if (seek_restriction == NULL) {
+			retval = MAPI_E_NOT_ENOUGH_MEMORY;
+			goto failure;
+		}
+		seek_restriction->rt = RES_PROPERTY;
+		seek_restriction->res.resProperty.relop = RELOP_GE;
+		seek_restriction->res.resProperty.ulPropTag = r->in.pTarget->ulPropTag;
+		seek_restriction->res.resProperty.lpProp = r->in.pTarget;
 
-	mids = talloc_zero(mem_ctx, struct PropertyTagArray_r);
-	if (mids == NULL) {
-		retval = MAPI_E_NOT_ENOUGH_MEMORY;
-		goto failure;
-	}
-	if (emsabp_search(mem_ctx, emsabp_ctx, mids, seek_restriction, r->in.pStat, 0) != MAPI_E_SUCCESS) {
-		mids = all_mids;
-		retval = MAPI_E_NOT_FOUND;
+		mids = talloc_zero(mem_ctx, struct PropertyTagArray_r);
+		if (mids == NULL) {
+			retval = MAPI_E_NOT_ENOUGH_MEMORY;
+			goto failure;
+		}
+		if (emsabp_search(mem_ctx, emsabp_ctx, mids, seek_restriction, r->in.pStat, 0) == MAPI_E_SUCCESS) {
+			if (r->in.lpETable) {
+				for (row = 0; row < total; row++) {
+					if (r->in.lpETable->aulPropTag[row] == mids->aulPropTag[0]) {
+						found = true;
+						break;
+					}
+				}
+			} else {
+				found = (emsabp_snapshot_MId_to_row(snapshot, emsabp_ctx->ttdb_ctx,
+								    mids->aulPropTag[0], &row) == MAPI_E_SUCCESS);
+			}
+		}
 	}
 
-	r->out.pStat->CurrentRec = MID_END_OF_TABLE;
-	r->out.pStat->NumPos = all_mids->cValues - 1;
-	r->out.pStat->TotalRecs = all_mids->cValues;
-	for (row = 0; row < all_mids->cValues; row++) {
-		if (all_mids->aulPropTag[row] == mids->aulPropTag[0]) {
-			r->out.pStat->CurrentRec = mids->aulPropTag[0];
-			r->out.pStat->NumPos = row;
-			break;
+	if (found) {
+		if (r->in.lpETable) {
+			MId = r->in.lpETable->aulPropTag[row];
+		} else {
+			retval = emsabp_snapshot_row_to_MId(snapshot, emsabp_ctx->ttdb_ctx, row, &MId);
+			if (retval != MAPI_E_SUCCESS) {
+				goto failure;
+			}
 		}
+		r->out.pStat->CurrentRec = MId;
+		r->out.pStat->NumPos = row;
+	} else {
+		/* No row satisfies the target: position at the end of the table */
+		retval = MAPI_E_NOT_FOUND;
+		r->out.pStat->CurrentRec = MID_END_OF_TABLE;
+		r->out.pStat->NumPos = total ? total - 1 : 0;
 	}
+	r->out.pStat->TotalRecs = total;
 
 	/* now we need to populate the rows, if properties were requested */
 	if (!r->in.pPropTags || !r->in.pPropTags->cValues) {
@@ -761,7 +764,7 @@ static void dcesrv_NspiSeekEntries(struct dcesrv_call_state *dce_call, TALLOC_CT
 	/* The returned rows from QueryRows are used as returned value */
 	r_QueryRows.out.ppRows = r->out.pRows;
 
-	dcesrv_do_NspiQueryRows(mem_ctx, &r_QueryRows, emsabp_ctx, all_mids, false);
+	dcesrv_do_NspiQueryRows(mem_ctx, &r_QueryRows, emsabp_ctx, false);
 	if (r_QueryRows.out.result != MAPI_E_SUCCESS) {
 		retval = r_QueryRows.out.result;
 		goto failure;
@@ -1268,7 +1271,8 @@ static void dcesrv_NspiGetIDsFromNames(struct dcesrv_call_state *dce_call,
             NspiResolveNamesW struct since const char* is used to both 8-bits and Unicode strings
             it could be done without problems.
 
-            The ANR implementation in this function does a search of fields values beginning with the search string.
+            The ANR implementation in emsabp_anr.c does a search of fields values beginning with the search string.
+            The names are searched by chunks and recent resolutions are cached, see emsabp_anr_resolve.
             A possible enhancement would be to trim superfluous spaces and/or split the search string by spaces so the order
             of the elements would not be important.
 
@@ -1290,18 +1294,9 @@ static void dcesrv_do_NspiResolveNamesW(struct dcesrv_call_state *dce_call,
 	struct PropertyTagArray_r	*pMIds = NULL;
 	struct PropertyRowSet_r		*pRows = NULL;
 	struct StringsArrayW_r		*paWStr;
+	struct ldb_message		**msgs;
 	uint32_t			i;
-	int				ret;
-	const char * const		recipient_attrs[] = { "*", NULL };
-	/* Attributes for ANR search */
-	const char * const		search_attr[] = { "mailNickName", "mail", "name",
-							  "displayName", "givenName", "sn",
-							  "sAMAccountName",
-							  "legacyExchangeDN",
-							  "physicalDeliveryOfficeName"};
-	/* We do not use proxyAddresses attribute for search because we do not expect the user to type in the protocol.
-	   We do not use RDN attribute because it seems samba lack support for it.
-	   However in user objects RDN should be the same than name, so this case is covered. */
+	int				ttl;
 
 	/* Step 0. Ensure incoming user is authenticated */
 	if (!dcesrv_call_authenticated(dce_call)) {
@@ -1369,63 +1364,39 @@ static void dcesrv_do_NspiResolveNamesW(struct dcesrv_call_state *dce_call,
 		goto failure;
 	}
 
-	/* Step 2. Fetch AB container records */
-	for (i = 0; i < paWStr->Count; i++) {
-		struct ldb_result	*ldb_res;
-		char			*filter;
-		int			j;
+	/* Step 2. Resolve the names in the AB container */
+	msgs = talloc_array(mem_ctx, struct ldb_message *, pMIds->cValues + 1);
+	if (!msgs) {
+		retval = MAPI_E_NOT_ENOUGH_MEMORY;
+		goto failure;
+	}
 
-		filter = talloc_strdup(mem_ctx, "");
-		if (!filter) {
-			retval = MAPI_E_NOT_ENOUGH_MEMORY;
-			goto failure;
-		}
-		/* Build search filter */
-		for (j = 0; j < ARRAY_SIZE(search_attr); j++) {
-			char *attr_filter = talloc_asprintf(mem_ctx, "(%s=%s*)", search_attr[j],
-							    ldb_binary_encode_string(mem_ctx, paWStr->Strings[i]));
-			if (!attr_filter) {
-				retval = MAPI_E_NOT_ENOUGH_MEMORY;
-				goto failure;
-			}
-			filter = talloc_strdup_append(filter, attr_filter);
-			if (!filter) {
-				retval = MAPI_E_NOT_ENOUGH_MEMORY;
-				goto failure;
-			}
-			talloc_free(attr_filter);
-		}
+	ttl = lpcfg_parm_int(emsabp_ctx->lp_ctx, NULL, "exchange_nsp", "anr_cache_ttl",
+			     EMSABP_ANR_CACHE_TTL);
+	retval = emsabp_anr_resolve(mem_ctx, emsabp_ctx->samdb_ctx,
+				    ldb_get_default_basedn(emsabp_ctx->samdb_ctx),
+				    emsabp_ctx->organization_name, filter_search,
+				    ttl < 0 ? 0 : ttl, paWStr->Count, paWStr->Strings,
+				    pMIds->aulPropTag, msgs);
+	if (retval != MAPI_E_SUCCESS) {
+		OC_DEBUG(5, "[nspi] emsabp_anr_resolve failed");
+		goto failure;
+	}
 
-		/* Search AD */
-		filter = talloc_asprintf(mem_ctx, "(&%s(|%s))", filter_search, filter);
-		if (!filter) {
-			retval = MAPI_E_NOT_ENOUGH_MEMORY;
+	for (i = 0; i < paWStr->Count; i++) {
+		if (pMIds->aulPropTag[i] != MAPI_RESOLVED) continue;
+
+		/* The standard says that we must have a call to NspiQueryRows to fill the rows.
+		   However with our actual implementation it would imply extract the dn, use it to
+		   get the mid and then call to QueryRows, where the element data would be fetched again.
+		   So for efficiency we will build the row here, with the data we already have */
+		retval = emsabp_fetch_attrs_from_msg(mem_ctx, emsabp_ctx, &pRows->aRow[pRows->cRows],
+						     msgs[i], 0, 0, pPropTags);
+		if (retval != MAPI_E_SUCCESS) {
+			OC_DEBUG(5, "[nspi] emsabp_fetch_attrs_from_msg failed");
 			goto failure;
 		}
-
-		ret = ldb_search(emsabp_ctx->samdb_ctx, mem_ctx, &ldb_res,
-				 ldb_get_default_basedn(emsabp_ctx->samdb_ctx),
-				 LDB_SCOPE_SUBTREE, recipient_attrs, "%s", filter);
-
-		/* Determine name resolution status and fetch object upon success */
-		if (ret != LDB_SUCCESS || ldb_res->count == 0) {
-			pMIds->aulPropTag[i] = MAPI_UNRESOLVED;
-		} else if (ldb_res->count > 1) {
-			pMIds->aulPropTag[i] = MAPI_AMBIGUOUS;
-		} else {
-			pMIds->aulPropTag[i] = MAPI_RESOLVED;
-			/* The standard says that we must have a call to NspiQueryRows to fill the rows.
-			   However with our actual implementation it would imply extract the dn, use it to
-			   get the mid and then call to QueryRows, where the element data would be fetched again.
-			   So for efficiency we will build the row here, with the data we already have */
-			retval = emsabp_fetch_attrs_from_msg(mem_ctx, emsabp_ctx, &pRows->aRow[pRows->cRows],
-							     ldb_res->msgs[0], 0, 0, pPropTags);
-			if (retval != MAPI_E_SUCCESS) {
-				OC_DEBUG(5, "[nspi] emsabp_fetch_attrs_from_msg failed");
-				goto failure;
-			}
-			pRows->cRows++;
-		}
+		pRows->cRows++;
 	}
 
 	*r->out.ppMIds = pMIds;
@@ -1610,6 +1581,8 @@ static NTSTATUS dcesrv_exchange_nsp_init(struct dcesrv_context *dce_ctx)
 	nsp_session = talloc_zero(dce_ctx, struct exchange_nsp_session);
 	if (!nsp_session) return NT_STATUS_NO_MEMORY;
 	nsp_session->session = NULL;
+	nsp_sessions = emsabp_sessions_init(nsp_session);
+	if (!nsp_sessions) return NT_STATUS_NO_MEMORY;
 
 	/* Open a read-write pointer on the EMSABP TDB database */
 	emsabp_tdb_ctx = emsabp_tdb_init((TALLOC_CTX *)dce_ctx, dce_ctx->lp_ctx);
@@ -25,6 +25,7 @@
 #include "libmapi/libmapi.h"
 #include "libmapi/libmapi_private.h"
 #include "mapiproxy/libmapiproxy/libmapiproxy.h"
+#include "mapiproxy/util/ccan/htable/htable.h"
 #include <ldb.h>
 #include <ldb_errors.h>
 #include <tevent.h>
@@ -51,6 +52,44 @@ struct emsabp_context {
 	TALLOC_CTX		*mem_ctx;
 };
 
+/**
+   Record of an address book container snapshot
+ */
+struct emsabp_snapshot_entry {
+	const char		*dn;
+	const char		*displayName;
+	uint32_t		row;
+	struct ldb_message	*msg;
+};
+
+/**
+   Address book container records sorted by displayName, see
+   emsabp_snapshot.c
+ */
+struct emsabp_snapshot {
+	struct emsabp_snapshot		*prev;
+	struct emsabp_snapshot		*next;
+	uint32_t			ContainerID;
+	char				*organization_name;
+	char				*filter;
+	const char			**attrs;
+	TALLOC_CTX			*data;
+	uint32_t			count;
+	struct emsabp_snapshot_entry	**entries;
+	struct emsabp_snapshot_entry	**by_dn;
+	uint64_t			highest_usn;
+	time_t				refreshed;
+	time_t				rebuilt;
+};
+
+/**
+   Offline Address Book attribute: property tag and EMSABP_OAB_* flags
+ */
+struct emsabp_oab_attr {
+	uint32_t			ulPropTag;
+	uint32_t			ulFlags;
+};
+
 struct exchange_nsp_session {
 	struct mpm_session		*session;
 	struct GUID			uuid;
@@ -58,9 +97,10 @@ struct exchange_nsp_session {
 	struct exchange_nsp_session	*next;
 };
 
-struct emsabp_MId {
-	uint32_t	MId;
-	char		*dn;
+/* Sessions indexed by handle uuid, see emsabp_session.c */
+struct emsabp_sessions {
+	struct exchange_nsp_session	*list;
+	struct htable			ht;
 };
 
 /**
@@ -105,6 +145,26 @@ struct EphemeralEntryID {
 #define	EMSABP_TDB_MID_START		0x1b28
 #define	EMSABP_TDB_TMP_MID_START	0x5000
 #define	EMSABP_TDB_DATA_REC		"MId_index"
+/* Each DN -> MId record has a MId -> DN record keyed by this prefix and the MId */
+#define	EMSABP_TDB_MID_REC_PREFIX	"MId:"
+#define	EMSABP_TDB_VERSION_REC		"MId_version"
+#define	EMSABP_TDB_VERSION		2
+
+/* Default number of seconds between two snapshot refreshes and rebuilds */
+#define	EMSABP_SNAPSHOT_REFRESH		10
+#define	EMSABP_SNAPSHOT_REBUILD		600
+
+/* Number of names resolved by a single ANR search, default number of
+   seconds and maximum number of cached resolutions */
+#define	EMSABP_ANR_CHUNK		32
+#define	EMSABP_ANR_CACHE_TTL		30
+#define	EMSABP_ANR_CACHE_SIZE		4096
+
+/* Offline Address Book attribute flags and maximum compressed block size */
+#define	EMSABP_OAB_ANR			0x1
+#define	EMSABP_OAB_RDN			0x2
+#define	EMSABP_OAB_INDEX		0x4
+#define	EMSABP_OAB_BLOCK_MAX		0x40000
 
 #define DCESRV_NSP_RETURN_IF(x,r,c,ctx)		\
 do {						\
@@ -156,7 +216,7 @@ enum MAPISTATUS		emsabp_search(TALLOC_CTX *, struct emsabp_context *, struct Pro
 enum MAPISTATUS		emsabp_search_dn(struct emsabp_context *, const char *, struct ldb_message **);
 enum MAPISTATUS		emsabp_search_legacyExchangeDN(struct emsabp_context *, const char *, struct ldb_message **, bool *);
 enum MAPISTATUS		emsabp_ab_fetch_filter(TALLOC_CTX *, struct emsabp_context *, uint32_t, char **);
-enum MAPISTATUS		emsabp_ab_container_enum(TALLOC_CTX *, struct emsabp_context *, uint32_t, struct ldb_result **);
+enum MAPISTATUS		emsabp_ab_container_snapshot(struct emsabp_context *, uint32_t, struct emsabp_snapshot **);
 
 
 /* definitions from emsabp_tdb.c */
@@ -167,14 +227,41 @@ enum MAPISTATUS		emsabp_tdb_insert(TDB_CONTEXT *, const char *);
 enum MAPISTATUS		emsabp_tdb_fetch_MId(TDB_CONTEXT *, const char *, uint32_t *);
 bool			emsabp_tdb_lookup_MId(TDB_CONTEXT *, uint32_t);
 enum MAPISTATUS		emsabp_tdb_fetch_dn_from_MId(TALLOC_CTX *, TDB_CONTEXT *, uint32_t, char **);
+enum MAPISTATUS		emsabp_tdb_upgrade(TDB_CONTEXT *);
 
 TDB_CONTEXT		*emsabp_tdb_init_tmp(TALLOC_CTX *);
 
+/* definitions from emsabp_snapshot.c */
+struct emsabp_snapshot	*emsabp_snapshot_find(uint32_t, const char *);
+struct emsabp_snapshot	*emsabp_snapshot_add(uint32_t, const char *, const char *);
+enum MAPISTATUS		emsabp_snapshot_refresh(struct emsabp_snapshot *, struct ldb_context *, struct ldb_dn *, uint32_t, uint32_t);
+enum MAPISTATUS		emsabp_snapshot_MId_to_row(struct emsabp_snapshot *, TDB_CONTEXT *, uint32_t, uint32_t *);
+enum MAPISTATUS		emsabp_snapshot_row_to_MId(struct emsabp_snapshot *, TDB_CONTEXT *, uint32_t, uint32_t *);
+uint32_t		emsabp_snapshot_seek(struct emsabp_snapshot *, const char *);
+
+/* definitions from emsabp_anr.c */
+enum MAPISTATUS		emsabp_anr_resolve(TALLOC_CTX *, struct ldb_context *, struct ldb_dn *, const char *, const char *,
+					   uint32_t, uint32_t, const char **, uint32_t *, struct ldb_message **);
+void			emsabp_anr_cache_flush(void);
+
+/* definitions from emsabp_oab.c */
+uint32_t		emsabp_oab_crc(uint32_t, const uint8_t *, size_t);
+enum MAPISTATUS		emsabp_oab_details(TALLOC_CTX *, const struct emsabp_oab_attr *, uint32_t, struct PropertyRow_r *,
+					   const struct emsabp_oab_attr *, uint32_t, struct PropertyRow_r *, uint32_t, DATA_BLOB *);
+enum MAPISTATUS		emsabp_oab_compress(TALLOC_CTX *, const DATA_BLOB *, uint32_t, DATA_BLOB *);
+
+/* definitions from emsabp_session.c */
+struct emsabp_sessions	*emsabp_sessions_init(TALLOC_CTX *);
+struct exchange_nsp_session	*emsabp_sessions_find(struct emsabp_sessions *, struct GUID *);
+bool			emsabp_sessions_add(struct emsabp_sessions *, struct exchange_nsp_session *);
+bool			emsabp_sessions_remove(struct emsabp_sessions *, struct exchange_nsp_session *);
+
 /* definitions from emsabp_property.c */
 const char		*emsabp_property_get_attribute(uint32_t);
 uint32_t		emsabp_property_get_ulPropTag(const char *);
 int			emsabp_property_is_ref(uint32_t);
 const char		*emsabp_property_get_ref_attr(uint32_t);
+const char		**emsabp_property_get_attrs(TALLOC_CTX *, struct SPropTagArray *);
 
 __END_DECLS
 
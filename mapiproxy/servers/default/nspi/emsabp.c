@@ -735,7 +735,7 @@ _PUBLIC_ enum MAPISTATUS emsabp_fetch_attrs(TALLOC_CTX *mem_ctx, struct emsabp_c
 {
 	enum MAPISTATUS		retval;
 	char			*dn;
-	const char * const	recipient_attrs[] = { "*", NULL };
+	const char		**recipient_attrs;
 	struct ldb_result	*res = NULL;
 	struct ldb_dn		*ldb_dn = NULL;
 	int			ret;
@@ -751,10 +751,13 @@ _PUBLIC_ enum MAPISTATUS emsabp_fetch_attrs(TALLOC_CTX *mem_ctx, struct emsabp_c
 	}
 	OPENCHANGE_RETVAL_IF(retval, MAPI_E_INVALID_BOOKMARK, NULL);
 
-	/* Step 1. Fetch the LDB record */
+	/* Step 1. Fetch the attributes of the LDB record the properties are built from */
 	ldb_dn = ldb_dn_new(mem_ctx, emsabp_ctx->samdb_ctx, dn);
 	OPENCHANGE_RETVAL_IF(!ldb_dn_validate(ldb_dn), MAPI_E_CORRUPT_STORE, NULL);
 
+	recipient_attrs = emsabp_property_get_attrs(mem_ctx, pPropTags);
+	OPENCHANGE_RETVAL_IF(!recipient_attrs, MAPI_E_NOT_ENOUGH_MEMORY, NULL);
+
 	ret = ldb_search(emsabp_ctx->samdb_ctx, emsabp_ctx->mem_ctx, &res, ldb_dn, LDB_SCOPE_BASE,
 			 recipient_attrs, NULL);
 	OPENCHANGE_RETVAL_IF(ret != LDB_SUCCESS || !res->count || res->count != 1, MAPI_E_CORRUPT_STORE, NULL);
@@ -1131,7 +1134,8 @@ _PUBLIC_ enum MAPISTATUS emsabp_search(TALLOC_CTX *mem_ctx, struct emsabp_contex
 	enum MAPISTATUS			retval;
 	struct ldb_result		*ldb_res = NULL;
 	struct PropertyRestriction_r	*res_prop = NULL;
-	const char * const		recipient_attrs[] = { "*", NULL };
+	/* Only the session MIds of the records are returned */
+	const char * const		recipient_attrs[] = { "distinguishedName", NULL };
 	uint32_t			i;
 	const char			*dn;
 	char				*fmt_str, *search_filter = NULL;
@@ -1385,77 +1389,62 @@ _PUBLIC_ enum MAPISTATUS emsabp_ab_fetch_filter(TALLOC_CTX *mem_ctx,
 
 
 /**
-   \details Enumerate AB container entries
+   \details Retrieve the snapshot of AB container entries, sorted by
+   displayName, and bring it up to date with the directory
 
-   \param mem_ctx pointer to the memory context
    \param emsabp_ctx pointer to the EMSABP context
    \param ContainerID id of the container to fetch
-   \param ldb_resp pointer on pointer to the LDB result returned by the
+   \param snapshotp pointer on pointer to the snapshot returned by the
    function
 
+   \note The snapshot is shared by every session of the process and
+   must not be modified by the caller
+
    \return MAPI_E_SUCCESS on success, otherwise MAPI error
  */
-_PUBLIC_ enum MAPISTATUS emsabp_ab_container_enum(TALLOC_CTX *mem_ctx,
-						  struct emsabp_context *emsabp_ctx,
-						  uint32_t ContainerID,
-						  struct ldb_result **ldb_resp)
+_PUBLIC_ enum MAPISTATUS emsabp_ab_container_snapshot(struct emsabp_context *emsabp_ctx,
+						      uint32_t ContainerID,
+						      struct emsabp_snapshot **snapshotp)
 {
 	enum MAPISTATUS			retval;
-	int				ldb_ret;
-	struct ldb_request		*ldb_req;
-	struct ldb_result		*ldb_res;
+	struct emsabp_snapshot		*snapshot;
 	char				*filter_search;
-	const char * const		recipient_attrs[] = { "*", NULL };
-	struct ldb_server_sort_control	**ldb_sort_controls;
-
-	/* Fetch AB container record */
-	retval = emsabp_ab_fetch_filter(mem_ctx, emsabp_ctx, ContainerID, &filter_search);
-	OPENCHANGE_RETVAL_IF(retval != MAPI_E_SUCCESS, MAPI_E_INVALID_BOOKMARK, NULL);
-	if (filter_search == NULL) {
-		/* this container is not meant to have entries */
-		*ldb_resp = NULL;
-		return MAPI_E_SUCCESS;
-	}
+	int				refresh;
+	int				rebuild;
 
-	/* Search AD with filter_search */
-	ldb_res = talloc_zero(mem_ctx, struct ldb_result);
-	OPENCHANGE_RETVAL_IF(!ldb_res, MAPI_E_NOT_ENOUGH_MEMORY, NULL);
-
-	ldb_req = NULL;
-	ldb_ret = ldb_build_search_req(&ldb_req, emsabp_ctx->samdb_ctx, mem_ctx,
-				       ldb_get_default_basedn(emsabp_ctx->samdb_ctx),
-				       LDB_SCOPE_SUBTREE,
-				       filter_search,
-				       recipient_attrs,
-				       NULL,
-				       ldb_res,
-				       ldb_search_default_callback,
-				       NULL);
-	if (ldb_ret != LDB_SUCCESS) goto done;
-
-	ldb_sort_controls = talloc_zero_array(filter_search, struct ldb_server_sort_control *, 2);
-	ldb_sort_controls[0] = talloc_zero(ldb_sort_controls, struct ldb_server_sort_control);
-	ldb_sort_controls[0]->attributeName = talloc_strdup(ldb_sort_controls, "displayName");
-	ldb_request_add_control(ldb_req, LDB_CONTROL_SERVER_SORT_OID, false, ldb_sort_controls);
+	/* Sanity checks */
+	OPENCHANGE_RETVAL_IF(!emsabp_ctx, MAPI_E_INVALID_PARAMETER, NULL);
+	OPENCHANGE_RETVAL_IF(!snapshotp, MAPI_E_INVALID_PARAMETER, NULL);
+	OPENCHANGE_RETVAL_IF(!emsabp_ctx->organization_name, MAPI_E_NOT_INITIALIZED, NULL);
 
-	ldb_ret = ldb_request(emsabp_ctx->samdb_ctx, ldb_req);
+	snapshot = emsabp_snapshot_find(ContainerID, emsabp_ctx->organization_name);
+	if (!snapshot) {
+		retval = emsabp_ab_fetch_filter(emsabp_ctx->mem_ctx, emsabp_ctx, ContainerID, &filter_search);
+		OPENCHANGE_RETVAL_IF(retval != MAPI_E_SUCCESS, MAPI_E_INVALID_BOOKMARK, NULL);
 
-	if (ldb_ret == LDB_SUCCESS) {
-		ldb_ret = ldb_wait(ldb_req->handle, LDB_WAIT_ALL);
+		snapshot = emsabp_snapshot_add(ContainerID, emsabp_ctx->organization_name, filter_search);
+		talloc_free(filter_search);
+		OPENCHANGE_RETVAL_IF(!snapshot, MAPI_E_NOT_ENOUGH_MEMORY, NULL);
 	}
 
-done:
-	talloc_free(filter_search);
-	if (ldb_req) {
-		talloc_free(ldb_req);
-	}
+	refresh = lpcfg_parm_int(emsabp_ctx->lp_ctx, NULL, "exchange_nsp", "snapshot_refresh",
+				 EMSABP_SNAPSHOT_REFRESH);
+	rebuild = lpcfg_parm_int(emsabp_ctx->lp_ctx, NULL, "exchange_nsp", "snapshot_rebuild",
+				 EMSABP_SNAPSHOT_REBUILD);
 
-	if (ldb_ret != LDB_SUCCESS) {
-		talloc_free(ldb_res);
-		ldb_res = NULL;
+	retval = emsabp_snapshot_refresh(snapshot, emsabp_ctx->samdb_ctx,
+					 ldb_get_default_basedn(emsabp_ctx->samdb_ctx),
+					 refresh < 0 ? 0 : refresh, rebuild < 0 ? 0 : rebuild);
+	if (retval != MAPI_E_SUCCESS) {
+		OC_DEBUG(1, "[nspi] Unable to refresh container 0x%x snapshot\n", ContainerID);
+		if (!snapshot->rebuilt) {
+			/* Never built: try again on next call */
+			talloc_free(snapshot);
+			return retval;
+		}
 	}
 
-	*ldb_resp = ldb_res;
+	*snapshotp = snapshot;
 
-	return (ldb_ret != LDB_SUCCESS) ? MAPI_E_NOT_FOUND : MAPI_E_SUCCESS;
+	return MAPI_E_SUCCESS;
 }
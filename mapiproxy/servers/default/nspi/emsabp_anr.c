@@ -0,0 +1,427 @@
+/*
+   OpenChange Server implementation.
+
+   EMSABP: Address Book Provider implementation
+
+   OpenChange Project
+
+   This program is free software; you can redistribute it and/or modify
+   it under the terms of the GNU General Public License as published by
+   the Free Software Foundation; either version 3 of the License, or
+   (at your option) any later version.
+
+   This program is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+   GNU General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+/**
+   \file emsabp_anr.c
+
+   \brief Batched ambiguous name resolution
+
+   The names of a NspiResolveNames call are looked up with one directory
+   search per chunk of names, ORing the ANR filters of the chunk. Each
+   record found is then matched against the filter of every name of the
+   chunk in memory. Resolutions are kept per organization and container
+   for a short time, so the recipients of a message resolved again when
+   it is sent are not searched twice. Unresolved and ambiguous names are
+   cached too: a recipient created meanwhile is found once they expire.
+ */
+
+#include "mapiproxy/dcesrv_mapiproxy.h"
+#include "utils/dlinklist.h"
+#include "mapiproxy/util/ccan/htable/htable.h"
+#include "mapiproxy/util/ccan/hash/hash.h"
+#include "dcesrv_exchange_nsp.h"
+
+#include <ldb_module.h>
+
+/* Attributes for ANR search
+
+   We do not use proxyAddresses attribute for search because we do not expect the user to type in the protocol.
+   We do not use RDN attribute because it seems samba lack support for it.
+   However in user objects RDN should be the same than name, so this case is covered. */
+static const char * const emsabp_anr_attrs[] = { "mailNickName", "mail", "name",
+						 "displayName", "givenName", "sn",
+						 "sAMAccountName",
+						 "legacyExchangeDN",
+						 "physicalDeliveryOfficeName",
+						 NULL };
+
+struct emsabp_anr_entry {
+	struct emsabp_anr_entry	*prev, *next;
+	char			*key;
+	time_t			expires;
+	uint32_t		status;
+	struct ldb_message	*msg;
+};
+
+struct emsabp_anr_cache {
+	uint32_t		count;
+	struct htable		ht;
+	struct emsabp_anr_entry	*entries;	/* most recently added first */
+};
+
+static struct emsabp_anr_cache	*emsabp_anr_cache = NULL;
+
+static size_t emsabp_anr_rehash(const void *e, void *unused)
+{
+	return hash_string(((const struct emsabp_anr_entry *)e)->key);
+}
+
+static bool emsabp_anr_cmp(const void *e, void *key)
+{
+	return strcmp(((const struct emsabp_anr_entry *)e)->key, (const char *)key) == 0;
+}
+
+static int emsabp_anr_cache_destructor(struct emsabp_anr_cache *cache)
+{
+	htable_clear(&cache->ht);
+	return 0;
+}
+
+static void emsabp_anr_remove(struct emsabp_anr_entry *entry)
+{
+	htable_del(&emsabp_anr_cache->ht, hash_string(entry->key), entry);
+	DLIST_REMOVE(emsabp_anr_cache->entries, entry);
+	talloc_free(entry);
+	emsabp_anr_cache->count--;
+}
+
+static char *emsabp_anr_key(TALLOC_CTX *mem_ctx, const char *organization_name,
+			    const char *filter, const char *name)
+{
+	return talloc_asprintf(mem_ctx, "%s\n%s\n%s", organization_name, filter, name);
+}
+
+/**
+   \details Look a resolution up, expired resolutions are dropped
+
+   \return pointer to the cached resolution on hit, otherwise NULL
+ */
+static struct emsabp_anr_entry *emsabp_anr_get(const char *organization_name,
+					       const char *filter, const char *name)
+{
+	struct emsabp_anr_entry	*entry;
+	char			*key;
+
+	if (!emsabp_anr_cache) return NULL;
+
+	key = emsabp_anr_key(NULL, organization_name, filter, name);
+	if (!key) return NULL;
+
+	entry = htable_get(&emsabp_anr_cache->ht, hash_string(key), emsabp_anr_cmp, key);
+	talloc_free(key);
+	if (entry && entry->expires <= time(NULL)) {
+		emsabp_anr_remove(entry);
+		entry = NULL;
+	}
+
+	return entry;
+}
+
+/**
+   \details Keep a resolution for ttl seconds, dropping the oldest one
+   when the cache is full. Failing to cache a resolution is not an
+   error.
+ */
+static void emsabp_anr_add(const char *organization_name, const char *filter,
+			   const char *name, uint32_t ttl, uint32_t status,
+			   struct ldb_message *msg)
+{
+	struct emsabp_anr_entry	*entry;
+
+	if (!emsabp_anr_cache) {
+		emsabp_anr_cache = talloc_zero(NULL, struct emsabp_anr_cache);
+		if (!emsabp_anr_cache) return;
+		htable_init(&emsabp_anr_cache->ht, emsabp_anr_rehash, NULL);
+		talloc_set_destructor(emsabp_anr_cache, emsabp_anr_cache_destructor);
+	}
+
+	entry = talloc_zero(emsabp_anr_cache, struct emsabp_anr_entry);
+	if (!entry) return;
+
+	entry->key = emsabp_anr_key(entry, organization_name, filter, name);
+	if (!entry->key) goto fail;
+	entry->expires = time(NULL) + ttl;
+	entry->status = status;
+	if (msg) {
+		entry->msg = ldb_msg_copy(entry, msg);
+		if (!entry->msg) goto fail;
+	}
+
+	/* The same name may be given twice in a call */
+	if (htable_get(&emsabp_anr_cache->ht, hash_string(entry->key), emsabp_anr_cmp, entry->key)) {
+		goto fail;
+	}
+
+	while (emsabp_anr_cache->count >= EMSABP_ANR_CACHE_SIZE && emsabp_anr_cache->entries) {
+		emsabp_anr_remove(DLIST_TAIL(emsabp_anr_cache->entries));
+	}
+
+	if (!htable_add(&emsabp_anr_cache->ht, hash_string(entry->key), entry)) goto fail;
+	DLIST_ADD(emsabp_anr_cache->entries, entry);
+	emsabp_anr_cache->count++;
+
+	return;
+fail:
+	talloc_free(entry);
+}
+
+/**
+   \details Drop every cached resolution of the process
+ */
+_PUBLIC_ void emsabp_anr_cache_flush(void)
+{
+	talloc_free(emsabp_anr_cache);
+	emsabp_anr_cache = NULL;
+}
+
+/**
+   \details Build the ANR filter of a name: any of the ANR attributes
+   begins with the name
+
+   \return the filter on success, otherwise NULL
+ */
+static char *emsabp_anr_filter(TALLOC_CTX *mem_ctx, const char *name)
+{
+	char		*filter;
+	const char	*value;
+	uint32_t	i;
+
+	value = ldb_binary_encode_string(mem_ctx, name);
+	if (!value) return NULL;
+
+	filter = talloc_strdup(mem_ctx, "(|");
+	for (i = 0; filter && emsabp_anr_attrs[i]; i++) {
+		filter = talloc_asprintf_append(filter, "(%s=%s*)", emsabp_anr_attrs[i], value);
+	}
+	if (filter) {
+		filter = talloc_strdup_append(filter, ")");
+	}
+
+	return filter;
+}
+
+/**
+   \details Resolve a chunk of names with a single search
+
+   \param mem_ctx pointer to the memory context the records are
+   allocated with
+   \param ldb_ctx pointer to the directory
+   \param basedn the base DN of the search
+   \param filter the filter of the container the names are resolved in
+   \param attrs the attributes to fetch, including the ANR ones
+   \param names the names to resolve
+   \param indexes the indexes in names of the chunk names
+   \param count the number of names in the chunk
+   \param status array where the status of the chunk names is stored
+   \param msgs array where the records of the resolved names are stored
+
+   \return MAPI_E_SUCCESS on success, otherwise MAPI error
+ */
+static enum MAPISTATUS emsabp_anr_resolve_chunk(TALLOC_CTX *mem_ctx, struct ldb_context *ldb_ctx,
+						struct ldb_dn *basedn, const char *filter,
+						const char * const *attrs, const char **names,
+						const uint32_t *indexes, uint32_t count,
+						uint32_t *status, struct ldb_message **msgs)
+{
+	TALLOC_CTX		*local_mem_ctx;
+	struct ldb_parse_tree	**trees;
+	struct ldb_result	*res;
+	char			*names_filter;
+	char			*name_filter;
+	uint32_t		*matches;
+	uint32_t		i;
+	uint32_t		j;
+	bool			matched;
+	int			ret;
+
+	local_mem_ctx = talloc_named(NULL, 0, "emsabp_anr_resolve_chunk");
+	OPENCHANGE_RETVAL_IF(!local_mem_ctx, MAPI_E_NOT_ENOUGH_MEMORY, NULL);
+
+	trees = talloc_array(local_mem_ctx, struct ldb_parse_tree *, count);
+	OPENCHANGE_RETVAL_IF(!trees, MAPI_E_NOT_ENOUGH_MEMORY, local_mem_ctx);
+	matches = talloc_zero_array(local_mem_ctx, uint32_t, count);
+	OPENCHANGE_RETVAL_IF(!matches, MAPI_E_NOT_ENOUGH_MEMORY, local_mem_ctx);
+	names_filter = talloc_strdup(local_mem_ctx, "");
+	OPENCHANGE_RETVAL_IF(!names_filter, MAPI_E_NOT_ENOUGH_MEMORY, local_mem_ctx);
+
+	for (i = 0; i < count; i++) {
+		name_filter = emsabp_anr_filter(local_mem_ctx, names[indexes[i]]);
+		OPENCHANGE_RETVAL_IF(!name_filter, MAPI_E_NOT_ENOUGH_MEMORY, local_mem_ctx);
+		trees[i] = ldb_parse_tree(trees, name_filter);
+		OPENCHANGE_RETVAL_IF(!trees[i], MAPI_E_INVALID_PARAMETER, local_mem_ctx);
+		names_filter = talloc_strdup_append(names_filter, name_filter);
+		OPENCHANGE_RETVAL_IF(!names_filter, MAPI_E_NOT_ENOUGH_MEMORY, local_mem_ctx);
+		status[indexes[i]] = MAPI_UNRESOLVED;
+		msgs[indexes[i]] = NULL;
+	}
+
+	ret = ldb_search(ldb_ctx, mem_ctx, &res, basedn, LDB_SCOPE_SUBTREE, attrs,
+			 "(&%s(|%s))", filter, names_filter);
+	if (ret != LDB_SUCCESS) {
+		/* Names the directory can't be searched for are unresolved */
+		OC_DEBUG(5, "[nspi] ANR search failed: %s", ldb_errstring(ldb_ctx));
+		talloc_free(local_mem_ctx);
+		return MAPI_E_SUCCESS;
+	}
+	talloc_steal(local_mem_ctx, res);
+
+	/* Match every record back to the names it was returned for */
+	for (j = 0; j < res->count; j++) {
+		for (i = 0; i < count; i++) {
+			if (matches[i] > 1) continue;
+			ret = ldb_match_msg_error(ldb_ctx, res->msgs[j], trees[i], basedn,
+						  LDB_SCOPE_SUBTREE, &matched);
+			if (ret != LDB_SUCCESS || !matched) continue;
+			if (!matches[i]++) {
+				msgs[indexes[i]] = res->msgs[j];
+			}
+		}
+	}
+
+	for (i = 0; i < count; i++) {
+		if (matches[i] == 1) {
+			status[indexes[i]] = MAPI_RESOLVED;
+			talloc_steal(mem_ctx, msgs[indexes[i]]);
+		} else {
+			status[indexes[i]] = matches[i] ? MAPI_AMBIGUOUS : MAPI_UNRESOLVED;
+			msgs[indexes[i]] = NULL;
+		}
+	}
+
+	talloc_free(local_mem_ctx);
+
+	return MAPI_E_SUCCESS;
+}
+
+/**
+   \details Resolve names with ANR in an address book container
+
+   A name is resolved when exactly one record of the container has one
+   of its ANR attributes beginning with the name, and ambiguous when
+   several records do.
+
+   \param mem_ctx pointer to the memory context the records are
+   allocated with
+   \param ldb_ctx pointer to the directory
+   \param basedn the base DN of the searches
+   \param organization_name the organization the container belongs to
+   \param filter the filter of the container
+   \param ttl the number of seconds resolutions are cached, 0 to
+   disable caching
+   \param count the number of names
+   \param names the names to resolve
+   \param status array of count elements where MAPI_RESOLVED,
+   MAPI_AMBIGUOUS or MAPI_UNRESOLVED is stored for each name
+   \param msgs array of count elements where the record of each
+   resolved name is stored, NULL for the other names
+
+   \return MAPI_E_SUCCESS on success, otherwise MAPI error
+ */
+_PUBLIC_ enum MAPISTATUS emsabp_anr_resolve(TALLOC_CTX *mem_ctx, struct ldb_context *ldb_ctx,
+					    struct ldb_dn *basedn, const char *organization_name,
+					    const char *filter, uint32_t ttl, uint32_t count, const char **names,
+					    uint32_t *status, struct ldb_message **msgs)
+{
+	enum MAPISTATUS		retval;
+	TALLOC_CTX		*local_mem_ctx;
+	struct emsabp_anr_entry	*entry;
+	const char		**attrs;
+	const char		**search_attrs;
+	uint32_t		*pending;
+	uint32_t		pending_count = 0;
+	uint32_t		*chunk;
+	uint32_t		chunk_count = 0;
+	uint32_t		attrs_count;
+	uint32_t		i;
+	uint32_t		j;
+
+	/* Sanity checks */
+	OPENCHANGE_RETVAL_IF(!ldb_ctx || !basedn || !filter, MAPI_E_INVALID_PARAMETER, NULL);
+	OPENCHANGE_RETVAL_IF(count && (!names || !status || !msgs), MAPI_E_INVALID_PARAMETER, NULL);
+	if (!organization_name) organization_name = "";
+
+	local_mem_ctx = talloc_named(NULL, 0, "emsabp_anr_resolve");
+	OPENCHANGE_RETVAL_IF(!local_mem_ctx, MAPI_E_NOT_ENOUGH_MEMORY, NULL);
+
+	pending = talloc_array(local_mem_ctx, uint32_t, count + 1);
+	OPENCHANGE_RETVAL_IF(!pending, MAPI_E_NOT_ENOUGH_MEMORY, local_mem_ctx);
+
+	/* Step 1. Use the cached resolutions */
+	for (i = 0; i < count; i++) {
+		status[i] = MAPI_UNRESOLVED;
+		msgs[i] = NULL;
+		if (!names[i]) continue;
+
+		entry = ttl ? emsabp_anr_get(organization_name, filter, names[i]) : NULL;
+		if (!entry) {
+			pending[pending_count++] = i;
+			continue;
+		}
+		status[i] = entry->status;
+		if (entry->msg) {
+			msgs[i] = ldb_msg_copy(mem_ctx, entry->msg);
+			OPENCHANGE_RETVAL_IF(!msgs[i], MAPI_E_NOT_ENOUGH_MEMORY, local_mem_ctx);
+		}
+	}
+
+	if (!pending_count) {
+		talloc_free(local_mem_ctx);
+		return MAPI_E_SUCCESS;
+	}
+
+	/* Step 2. Records are cached for any property tags, and must
+	 * carry the ANR attributes to be matched back to the names */
+	attrs = emsabp_property_get_attrs(local_mem_ctx, NULL);
+	OPENCHANGE_RETVAL_IF(!attrs, MAPI_E_NOT_ENOUGH_MEMORY, local_mem_ctx);
+	for (attrs_count = 0; attrs[attrs_count]; attrs_count++);
+	search_attrs = talloc_array(local_mem_ctx, const char *, attrs_count + ARRAY_SIZE(emsabp_anr_attrs));
+	OPENCHANGE_RETVAL_IF(!search_attrs, MAPI_E_NOT_ENOUGH_MEMORY, local_mem_ctx);
+	for (i = 0; i < attrs_count; i++) {
+		search_attrs[i] = attrs[i];
+	}
+	for (j = 0; emsabp_anr_attrs[j]; j++) {
+		search_attrs[i++] = emsabp_anr_attrs[j];
+	}
+	search_attrs[i] = NULL;
+
+	/* Step 3. Search the names by chunks. An empty name matches
+	 * every record of the container, so it is searched alone */
+	chunk = talloc_array(local_mem_ctx, uint32_t, pending_count);
+	OPENCHANGE_RETVAL_IF(!chunk, MAPI_E_NOT_ENOUGH_MEMORY, local_mem_ctx);
+	for (i = 0; i < pending_count; i++) {
+		if (names[pending[i]][0]) {
+			chunk[chunk_count++] = pending[i];
+			continue;
+		}
+		retval = emsabp_anr_resolve_chunk(mem_ctx, ldb_ctx, basedn, filter, search_attrs,
+						  names, &pending[i], 1, status, msgs);
+		OPENCHANGE_RETVAL_IF(retval, retval, local_mem_ctx);
+	}
+	for (i = 0; i < chunk_count; i += j) {
+		j = chunk_count - i;
+		if (j > EMSABP_ANR_CHUNK) j = EMSABP_ANR_CHUNK;
+		retval = emsabp_anr_resolve_chunk(mem_ctx, ldb_ctx, basedn, filter, search_attrs,
+						  names, &chunk[i], j, status, msgs);
+		OPENCHANGE_RETVAL_IF(retval, retval, local_mem_ctx);
+	}
+
+	/* Step 4. Cache the resolutions made */
+	if (ttl) {
+		for (i = 0; i < pending_count; i++) {
+			emsabp_anr_add(organization_name, filter, names[pending[i]], ttl,
+				       status[pending[i]], msgs[pending[i]]);
+		}
+	}
+
+	talloc_free(local_mem_ctx);
+
+	return MAPI_E_SUCCESS;
+}
@@ -0,0 +1,377 @@
+/*
+   OpenChange Server implementation.
+
+   EMSABP: Address Book Provider implementation
+
+   OpenChange Project
+
+   This program is free software; you can redistribute it and/or modify
+   it under the terms of the GNU General Public License as published by
+   the Free Software Foundation; either version 3 of the License, or
+   (at your option) any later version.
+
+   This program is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+   GNU General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+/**
+   \file emsabp_oab.c
+
+   \brief Offline Address Book version 4 files [MS-OXOAB]
+
+   The full details file holds a header record describing the address
+   list and one record per recipient, each record carrying the values
+   of the properties present in a presence bit array. It is published
+   in the compressed file format, made of blocks whose CRC clients
+   check. Blocks are stored without LZX compression, which the format
+   allows for blocks that don't compress.
+
+   \todo Compress the blocks with LZX and write differential files
+   (LZX DELTA patches against the previous full details file).
+ */
+
+#include "mapiproxy/dcesrv_mapiproxy.h"
+#include "dcesrv_exchange_nsp.h"
+
+#define	EMSABP_OAB_VERSION		0x20
+#define	EMSABP_OAB_COMPRESSED_HI	0x3
+#define	EMSABP_OAB_COMPRESSED_LO	0x1
+
+/**
+   \details Compute the CRC of OAB files and blocks. The CRC starts at
+   0xFFFFFFFF and is not inverted once computed.
+
+   \param crc the CRC of the previous data, 0xFFFFFFFF to start
+   \param data pointer to the data
+   \param length the length of the data
+
+   \return the CRC of the data
+ */
+_PUBLIC_ uint32_t emsabp_oab_crc(uint32_t crc, const uint8_t *data, size_t length)
+{
+	static uint32_t	table[256];
+	static bool	initialized = false;
+	uint32_t	c;
+	uint32_t	i;
+	uint32_t	j;
+
+	if (!initialized) {
+		for (i = 0; i < 256; i++) {
+			c = i;
+			for (j = 0; j < 8; j++) {
+				c = (c & 1) ? (c >> 1) ^ 0xEDB88320 : c >> 1;
+			}
+			table[i] = c;
+		}
+		initialized = true;
+	}
+
+	while (length--) {
+		crc = (crc >> 8) ^ table[(crc ^ *data++) & 0xFF];
+	}
+
+	return crc;
+}
+
+/**
+   \details Push an integer in its compact form: values up to 0x7F
+   take one byte, larger ones a byte giving their size followed by
+   their 1 to 4 little endian bytes
+ */
+static enum ndr_err_code emsabp_oab_push_int(struct ndr_push *ndr, uint32_t value)
+{
+	if (value <= 0x7F) {
+		return ndr_push_uint8(ndr, NDR_SCALARS, value);
+	}
+	if (value <= 0xFF) {
+		NDR_CHECK(ndr_push_uint8(ndr, NDR_SCALARS, 0x81));
+		return ndr_push_uint8(ndr, NDR_SCALARS, value);
+	}
+	if (value <= 0xFFFF) {
+		NDR_CHECK(ndr_push_uint8(ndr, NDR_SCALARS, 0x82));
+		return ndr_push_uint16(ndr, NDR_SCALARS, value);
+	}
+	if (value <= 0xFFFFFF) {
+		NDR_CHECK(ndr_push_uint8(ndr, NDR_SCALARS, 0x83));
+		NDR_CHECK(ndr_push_uint16(ndr, NDR_SCALARS, value & 0xFFFF));
+		return ndr_push_uint8(ndr, NDR_SCALARS, value >> 16);
+	}
+	NDR_CHECK(ndr_push_uint8(ndr, NDR_SCALARS, 0x84));
+	return ndr_push_uint32(ndr, NDR_SCALARS, value);
+}
+
+/**
+   \details Push a NULL terminated string, Unicode strings are stored
+   UTF-8 encoded
+ */
+static enum ndr_err_code emsabp_oab_push_string(struct ndr_push *ndr, const char *str)
+{
+	if (!str) str = "";
+	return ndr_push_array_uint8(ndr, NDR_SCALARS, (const uint8_t *)str, strlen(str) + 1);
+}
+
+static enum ndr_err_code emsabp_oab_push_binary(struct ndr_push *ndr, const struct Binary_r *bin)
+{
+	NDR_CHECK(emsabp_oab_push_int(ndr, bin->cb));
+	return ndr_push_array_uint8(ndr, NDR_SCALARS, bin->lpb, bin->cb);
+}
+
+static enum ndr_err_code emsabp_oab_push_value(struct ndr_push *ndr, uint32_t ulPropTag,
+					       const union PROP_VAL_UNION *value)
+{
+	uint32_t	i;
+
+	switch (ulPropTag & 0xFFFF) {
+	case PT_LONG:
+		return emsabp_oab_push_int(ndr, value->l);
+	case PT_BOOLEAN:
+		return ndr_push_uint8(ndr, NDR_SCALARS, value->b ? 1 : 0);
+	case PT_STRING8:
+		return emsabp_oab_push_string(ndr, value->lpszA);
+	case PT_UNICODE:
+		return emsabp_oab_push_string(ndr, value->lpszW);
+	case PT_BINARY:
+		return emsabp_oab_push_binary(ndr, &value->bin);
+	case PT_MV_LONG:
+		NDR_CHECK(emsabp_oab_push_int(ndr, value->MVl.cValues));
+		for (i = 0; i < value->MVl.cValues; i++) {
+			NDR_CHECK(emsabp_oab_push_int(ndr, value->MVl.lpl[i]));
+		}
+		return NDR_ERR_SUCCESS;
+	case PT_MV_STRING8:
+		NDR_CHECK(emsabp_oab_push_int(ndr, value->MVszA.cValues));
+		for (i = 0; i < value->MVszA.cValues; i++) {
+			NDR_CHECK(emsabp_oab_push_string(ndr, value->MVszA.lppszA[i]));
+		}
+		return NDR_ERR_SUCCESS;
+	case PT_MV_UNICODE:
+		NDR_CHECK(emsabp_oab_push_int(ndr, value->MVszW.cValues));
+		for (i = 0; i < value->MVszW.cValues; i++) {
+			NDR_CHECK(emsabp_oab_push_string(ndr, value->MVszW.lppszW[i]));
+		}
+		return NDR_ERR_SUCCESS;
+	case PT_MV_BINARY:
+		NDR_CHECK(emsabp_oab_push_int(ndr, value->MVbin.cValues));
+		for (i = 0; i < value->MVbin.cValues; i++) {
+			NDR_CHECK(emsabp_oab_push_binary(ndr, &value->MVbin.lpbin[i]));
+		}
+		return NDR_ERR_SUCCESS;
+	default:
+		return NDR_ERR_BAD_SWITCH;
+	}
+}
+
+/**
+   \details Push a property table: the number of attributes followed
+   by their property tag and flags
+ */
+static enum ndr_err_code emsabp_oab_push_table(struct ndr_push *ndr, const struct emsabp_oab_attr *attrs,
+					       uint32_t count)
+{
+	uint32_t	i;
+
+	NDR_CHECK(ndr_push_uint32(ndr, NDR_SCALARS, count));
+	for (i = 0; i < count; i++) {
+		NDR_CHECK(ndr_push_uint32(ndr, NDR_SCALARS, attrs[i].ulPropTag));
+		NDR_CHECK(ndr_push_uint32(ndr, NDR_SCALARS, attrs[i].ulFlags));
+	}
+
+	return NDR_ERR_SUCCESS;
+}
+
+/**
+   \details Push a record: its size, the presence bit array of the
+   attributes and the values of the present ones. A property of the
+   row is present when its tag is the attribute one, PT_ERROR tags
+   mark missing properties.
+ */
+static enum ndr_err_code emsabp_oab_push_record(struct ndr_push *ndr, const struct emsabp_oab_attr *attrs,
+						uint32_t count, struct PropertyRow_r *row)
+{
+	struct ndr_push		*rec;
+	uint8_t			*presence;
+	uint32_t		i;
+	enum ndr_err_code	ndr_err;
+
+	rec = ndr_push_init_ctx(ndr);
+	NDR_ERR_HAVE_NO_MEMORY(rec);
+	ndr_set_flags(&rec->flags, LIBNDR_FLAG_NOALIGN);
+
+	presence = talloc_zero_array(rec, uint8_t, (count + 7) / 8);
+	NDR_ERR_HAVE_NO_MEMORY(presence);
+	for (i = 0; i < count && i < row->cValues; i++) {
+		if (row->lpProps[i].ulPropTag == attrs[i].ulPropTag) {
+			presence[i / 8] |= 0x80 >> (i % 8);
+		}
+	}
+
+	ndr_err = ndr_push_array_uint8(rec, NDR_SCALARS, presence, (count + 7) / 8);
+	for (i = 0; NDR_ERR_CODE_IS_SUCCESS(ndr_err) && i < count; i++) {
+		if (!(presence[i / 8] & (0x80 >> (i % 8)))) continue;
+		ndr_err = emsabp_oab_push_value(rec, attrs[i].ulPropTag, &row->lpProps[i].value);
+	}
+	if (NDR_ERR_CODE_IS_SUCCESS(ndr_err)) {
+		ndr_err = ndr_push_uint32(ndr, NDR_SCALARS, rec->offset + 4);
+	}
+	if (NDR_ERR_CODE_IS_SUCCESS(ndr_err)) {
+		ndr_err = ndr_push_array_uint8(ndr, NDR_SCALARS, rec->data, rec->offset);
+	}
+
+	talloc_free(rec);
+
+	return ndr_err;
+}
+
+/**
+   \details Build the OAB version 4 full details file
+
+   \param mem_ctx pointer to the memory context
+   \param hdr_attrs the attributes of the header record
+   \param hdr_count the number of header record attributes
+   \param hdr_row the header record values, in hdr_attrs order
+   \param attrs the attributes of the recipient records
+   \param attrs_count the number of recipient record attributes
+   \param rows the recipient records values, in attrs order
+   \param count the number of recipient records
+   \param details pointer to the returned file
+
+   \return MAPI_E_SUCCESS on success, otherwise MAPI error
+ */
+_PUBLIC_ enum MAPISTATUS emsabp_oab_details(TALLOC_CTX *mem_ctx,
+					    const struct emsabp_oab_attr *hdr_attrs, uint32_t hdr_count,
+					    struct PropertyRow_r *hdr_row,
+					    const struct emsabp_oab_attr *attrs, uint32_t attrs_count,
+					    struct PropertyRow_r *rows, uint32_t count,
+					    DATA_BLOB *details)
+{
+	TALLOC_CTX		*local_mem_ctx;
+	struct ndr_push		*body;
+	struct ndr_push		*ndr;
+	enum ndr_err_code	ndr_err;
+	uint32_t		i;
+
+	/* Sanity checks */
+	OPENCHANGE_RETVAL_IF(!hdr_attrs || !hdr_row || !attrs || !details, MAPI_E_INVALID_PARAMETER, NULL);
+	OPENCHANGE_RETVAL_IF(count && !rows, MAPI_E_INVALID_PARAMETER, NULL);
+
+	local_mem_ctx = talloc_named(NULL, 0, "emsabp_oab_details");
+	OPENCHANGE_RETVAL_IF(!local_mem_ctx, MAPI_E_NOT_ENOUGH_MEMORY, NULL);
+
+	body = ndr_push_init_ctx(local_mem_ctx);
+	OPENCHANGE_RETVAL_IF(!body, MAPI_E_NOT_ENOUGH_MEMORY, local_mem_ctx);
+	ndr_set_flags(&body->flags, LIBNDR_FLAG_NOALIGN);
+
+	/* Step 1. Metadata: the header and recipient property tables */
+	ndr_err = ndr_push_uint32(body, NDR_SCALARS, 4 + 4 + hdr_count * 8 + 4 + attrs_count * 8);
+	if (NDR_ERR_CODE_IS_SUCCESS(ndr_err)) {
+		ndr_err = emsabp_oab_push_table(body, hdr_attrs, hdr_count);
+	}
+	if (NDR_ERR_CODE_IS_SUCCESS(ndr_err)) {
+		ndr_err = emsabp_oab_push_table(body, attrs, attrs_count);
+	}
+
+	/* Step 2. Header record and recipient records */
+	if (NDR_ERR_CODE_IS_SUCCESS(ndr_err)) {
+		ndr_err = emsabp_oab_push_record(body, hdr_attrs, hdr_count, hdr_row);
+	}
+	for (i = 0; NDR_ERR_CODE_IS_SUCCESS(ndr_err) && i < count; i++) {
+		ndr_err = emsabp_oab_push_record(body, attrs, attrs_count, &rows[i]);
+	}
+	OPENCHANGE_RETVAL_IF(!NDR_ERR_CODE_IS_SUCCESS(ndr_err), MAPI_E_INVALID_PARAMETER, local_mem_ctx);
+
+	/* Step 3. The file header holds the CRC of what follows it */
+	ndr = ndr_push_init_ctx(local_mem_ctx);
+	OPENCHANGE_RETVAL_IF(!ndr, MAPI_E_NOT_ENOUGH_MEMORY, local_mem_ctx);
+	ndr_set_flags(&ndr->flags, LIBNDR_FLAG_NOALIGN);
+
+	ndr_err = ndr_push_uint32(ndr, NDR_SCALARS, EMSABP_OAB_VERSION);
+	if (NDR_ERR_CODE_IS_SUCCESS(ndr_err)) {
+		ndr_err = ndr_push_uint32(ndr, NDR_SCALARS, emsabp_oab_crc(0xFFFFFFFF, body->data, body->offset));
+	}
+	if (NDR_ERR_CODE_IS_SUCCESS(ndr_err)) {
+		ndr_err = ndr_push_uint32(ndr, NDR_SCALARS, count);
+	}
+	if (NDR_ERR_CODE_IS_SUCCESS(ndr_err)) {
+		ndr_err = ndr_push_array_uint8(ndr, NDR_SCALARS, body->data, body->offset);
+	}
+	OPENCHANGE_RETVAL_IF(!NDR_ERR_CODE_IS_SUCCESS(ndr_err), MAPI_E_NOT_ENOUGH_MEMORY, local_mem_ctx);
+
+	details->length = ndr->offset;
+	details->data = talloc_steal(mem_ctx, ndr->data);
+
+	talloc_free(local_mem_ctx);
+
+	return MAPI_E_SUCCESS;
+}
+
+/**
+   \details Wrap an OAB file in the compressed file format
+
+   \param mem_ctx pointer to the memory context
+   \param data the uncompressed OAB file
+   \param block_max the maximum size of a block, 0 for
+   EMSABP_OAB_BLOCK_MAX
+   \param compressed pointer to the returned file
+
+   \return MAPI_E_SUCCESS on success, otherwise MAPI error
+ */
+_PUBLIC_ enum MAPISTATUS emsabp_oab_compress(TALLOC_CTX *mem_ctx, const DATA_BLOB *data,
+					     uint32_t block_max, DATA_BLOB *compressed)
+{
+	struct ndr_push		*ndr;
+	enum ndr_err_code	ndr_err;
+	size_t			offset;
+	uint32_t		size;
+
+	/* Sanity checks */
+	OPENCHANGE_RETVAL_IF(!data || !compressed, MAPI_E_INVALID_PARAMETER, NULL);
+	OPENCHANGE_RETVAL_IF(data->length > UINT32_MAX, MAPI_E_TOO_BIG, NULL);
+	if (!block_max) block_max = EMSABP_OAB_BLOCK_MAX;
+
+	ndr = ndr_push_init_ctx(NULL);
+	OPENCHANGE_RETVAL_IF(!ndr, MAPI_E_NOT_ENOUGH_MEMORY, NULL);
+	ndr_set_flags(&ndr->flags, LIBNDR_FLAG_NOALIGN);
+
+	ndr_err = ndr_push_uint32(ndr, NDR_SCALARS, EMSABP_OAB_COMPRESSED_HI);
+	if (NDR_ERR_CODE_IS_SUCCESS(ndr_err)) {
+		ndr_err = ndr_push_uint32(ndr, NDR_SCALARS, EMSABP_OAB_COMPRESSED_LO);
+	}
+	if (NDR_ERR_CODE_IS_SUCCESS(ndr_err)) {
+		ndr_err = ndr_push_uint32(ndr, NDR_SCALARS, block_max);
+	}
+	if (NDR_ERR_CODE_IS_SUCCESS(ndr_err)) {
+		ndr_err = ndr_push_uint32(ndr, NDR_SCALARS, data->length);
+	}
+
+	/* Stored blocks: no flag and the same compressed and uncompressed size */
+	for (offset = 0; NDR_ERR_CODE_IS_SUCCESS(ndr_err) && offset < data->length; offset += size) {
+		size = data->length - offset > block_max ? block_max : data->length - offset;
+		ndr_err = ndr_push_uint32(ndr, NDR_SCALARS, 0);
+		if (NDR_ERR_CODE_IS_SUCCESS(ndr_err)) {
+			ndr_err = ndr_push_uint32(ndr, NDR_SCALARS, size);
+		}
+		if (NDR_ERR_CODE_IS_SUCCESS(ndr_err)) {
+			ndr_err = ndr_push_uint32(ndr, NDR_SCALARS, size);
+		}
+		if (NDR_ERR_CODE_IS_SUCCESS(ndr_err)) {
+			ndr_err = ndr_push_uint32(ndr, NDR_SCALARS,
+						  emsabp_oab_crc(0xFFFFFFFF, data->data + offset, size));
+		}
+		if (NDR_ERR_CODE_IS_SUCCESS(ndr_err)) {
+			ndr_err = ndr_push_array_uint8(ndr, NDR_SCALARS, data->data + offset, size);
+		}
+	}
+	OPENCHANGE_RETVAL_IF(!NDR_ERR_CODE_IS_SUCCESS(ndr_err), MAPI_E_NOT_ENOUGH_MEMORY, ndr);
+
+	compressed->length = ndr->offset;
+	compressed->data = talloc_steal(mem_ctx, ndr->data);
+
+	talloc_free(ndr);
+
+	return MAPI_E_SUCCESS;
+}
@@ -196,3 +196,79 @@ _PUBLIC_ const char *emsabp_property_get_ref_attr(uint32_t ulPropTag)
 
 	return NULL;
 }
+
+
+/**
+   \details Add an attribute to a NULL terminated attribute list
+   unless it is already there
+ */
+static const char **emsabp_property_add_attr(TALLOC_CTX *mem_ctx, const char **attrs,
+					     uint32_t *count, const char *attribute)
+{
+	uint32_t	i;
+
+	if (!attrs || !attribute) return attrs;
+
+	for (i = 0; i < *count; i++) {
+		if (!strcasecmp(attrs[i], attribute)) {
+			return attrs;
+		}
+	}
+
+	attrs = talloc_realloc(mem_ctx, attrs, const char *, *count + 2);
+	if (!attrs) return NULL;
+	attrs[(*count)++] = attribute;
+	attrs[*count] = NULL;
+
+	return attrs;
+}
+
+
+/**
+   \details Return the AD attributes to fetch so the given property
+   tags can be built from the record
+
+   distinguishedName is always part of the list, since it is needed
+   to map the record to its MId. Properties computed without the
+   record do not add any attribute.
+
+   \param mem_ctx pointer to the memory context
+   \param pPropTags pointer to the property tags array, NULL for
+   every property tag the address book can map
+
+   \return NULL terminated attribute list on success, otherwise NULL
+ */
+_PUBLIC_ const char **emsabp_property_get_attrs(TALLOC_CTX *mem_ctx,
+						struct SPropTagArray *pPropTags)
+{
+	const char	**attrs;
+	const char	*attribute;
+	uint32_t	count = 0;
+	uint32_t	ulPropTag;
+	uint32_t	i;
+
+	attrs = talloc_array(mem_ctx, const char *, 1);
+	if (!attrs) return NULL;
+	attrs[0] = NULL;
+
+	attrs = emsabp_property_add_attr(mem_ctx, attrs, &count, "distinguishedName");
+	/* PermanentEntryID and search key */
+	attrs = emsabp_property_add_attr(mem_ctx, attrs, &count, "legacyExchangeDN");
+
+	if (!pPropTags) {
+		for (i = 0; emsabp_property[i].attribute; i++) {
+			if (emsabp_property[i].ulPropTag == PidTagAnr) continue;
+			attrs = emsabp_property_add_attr(mem_ctx, attrs, &count, emsabp_property[i].attribute);
+		}
+	} else {
+		for (i = 0; i < pPropTags->cValues; i++) {
+			ulPropTag = pPropTags->aulPropTag[i];
+			/* anr is a search only attribute */
+			if ((ulPropTag & 0xFFFF0000) == (PidTagAnr & 0xFFFF0000)) continue;
+			attribute = emsabp_property_get_attribute(ulPropTag);
+			attrs = emsabp_property_add_attr(mem_ctx, attrs, &count, attribute);
+		}
+	}
+
+	return attrs;
+}
@@ -0,0 +1,133 @@
+/*
+   OpenChange Server implementation
+
+   EMSABP: Address Book Provider implementation
+
+   OpenChange Project
+
+   This program is free software; you can redistribute it and/or modify
+   it under the terms of the GNU General Public License as published by
+   the Free Software Foundation; either version 3 of the License, or
+   (at your option) any later version.
+
+   This program is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+   GNU General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/**
+   \file emsabp_session.c
+
+   \brief NSPI sessions registry
+
+   Sessions are indexed by the uuid of their handle, so each call finds
+   its session without walking the list of all of them. The list is
+   kept for the callers iterating over every session.
+ */
+
+#include "dcesrv_exchange_nsp.h"
+#include "mapiproxy/util/ccan/hash/hash.h"
+#include "utils/dlinklist.h"
+
+/* Rehash function for the sessions ht table */
+static size_t emsabp_sessions_rehash(const void *e, void *unused)
+{
+	return hash(&((const struct exchange_nsp_session *)e)->uuid, 1, 0);
+}
+
+/* Comparison function to get sessions from ht table */
+static bool emsabp_sessions_cmp(const void *e, void *uuid)
+{
+	return GUID_equal(&((const struct exchange_nsp_session *)e)->uuid, (const struct GUID *)uuid);
+}
+
+static int emsabp_sessions_destructor(struct emsabp_sessions *sessions)
+{
+	htable_clear(&sessions->ht);
+	return 0;
+}
+
+/**
+   \details Create an empty sessions registry
+
+   \param mem_ctx pointer to the memory context
+
+   \return pointer to the registry on success, otherwise NULL
+ */
+_PUBLIC_ struct emsabp_sessions *emsabp_sessions_init(TALLOC_CTX *mem_ctx)
+{
+	struct emsabp_sessions	*sessions;
+
+	sessions = talloc_zero(mem_ctx, struct emsabp_sessions);
+	if (!sessions) return NULL;
+
+	htable_init(&sessions->ht, emsabp_sessions_rehash, NULL);
+	talloc_set_destructor(sessions, emsabp_sessions_destructor);
+
+	return sessions;
+}
+
+/**
+   \details Find the session of a handle
+
+   \param sessions pointer to the sessions registry
+   \param uuid pointer to the uuid of the handle
+
+   \return pointer to the session if found, otherwise NULL
+ */
+_PUBLIC_ struct exchange_nsp_session *emsabp_sessions_find(struct emsabp_sessions *sessions,
+							   struct GUID *uuid)
+{
+	if (!sessions || !uuid) return NULL;
+
+	return htable_get(&sessions->ht, hash(uuid, 1, 0), emsabp_sessions_cmp, uuid);
+}
+
+/**
+   \details Add a session to the registry, at the end of its list
+
+   \param sessions pointer to the sessions registry
+   \param session pointer to the session to add
+
+   \return true on success, false if a session already has the same
+   uuid or on memory failure
+ */
+_PUBLIC_ bool emsabp_sessions_add(struct emsabp_sessions *sessions,
+				  struct exchange_nsp_session *session)
+{
+	if (!sessions || !session) return false;
+	if (emsabp_sessions_find(sessions, &session->uuid)) return false;
+
+	if (!htable_add(&sessions->ht, hash(&session->uuid, 1, 0), session)) {
+		return false;
+	}
+	DLIST_ADD_END(sessions->list, session, struct exchange_nsp_session *);
+
+	return true;
+}
+
+/**
+   \details Remove a session from the registry. The session itself is
+   not released.
+
+   \param sessions pointer to the sessions registry
+   \param session pointer to the session to remove
+
+   \return true on success, false if the session was not registered
+ */
+_PUBLIC_ bool emsabp_sessions_remove(struct emsabp_sessions *sessions,
+				     struct exchange_nsp_session *session)
+{
+	if (!sessions || !session) return false;
+
+	if (!htable_del(&sessions->ht, hash(&session->uuid, 1, 0), session)) {
+		return false;
+	}
+	DLIST_REMOVE(sessions->list, session);
+
+	return true;
+}
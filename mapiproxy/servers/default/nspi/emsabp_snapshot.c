@@ -0,0 +1,454 @@
+/*
+   OpenChange Server implementation.
+
+   EMSABP: Address Book Provider implementation
+
+   OpenChange Project
+
+   This program is free software; you can redistribute it and/or modify
+   it under the terms of the GNU General Public License as published by
+   the Free Software Foundation; either version 3 of the License, or
+   (at your option) any later version.
+
+   This program is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+   GNU General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+/**
+   \file emsabp_snapshot.c
+
+   \brief In-memory snapshots of the address book containers
+
+   A snapshot holds the records of an address book container sorted by
+   displayName, so tables can be positioned, seeked and paged without
+   searching the directory. Snapshots are shared by every session of
+   the process. They are brought up to date with the records whose
+   uSNChanged moved since the last refresh, and periodically rebuilt
+   from scratch to drop the records which left the container.
+ */
+
+#include "mapiproxy/dcesrv_mapiproxy.h"
+#include "utils/dlinklist.h"
+#include "dcesrv_exchange_nsp.h"
+
+static struct emsabp_snapshot	*emsabp_snapshots = NULL;
+
+static int emsabp_snapshot_cmp_name(const void *a, const void *b)
+{
+	const struct emsabp_snapshot_entry	*ea = *(const struct emsabp_snapshot_entry **)a;
+	const struct emsabp_snapshot_entry	*eb = *(const struct emsabp_snapshot_entry **)b;
+	int					ret;
+
+	ret = strcasecmp(ea->displayName, eb->displayName);
+	if (ret) return ret;
+
+	return strcasecmp(ea->dn, eb->dn);
+}
+
+static int emsabp_snapshot_cmp_dn(const void *a, const void *b)
+{
+	const struct emsabp_snapshot_entry	*ea = *(const struct emsabp_snapshot_entry **)a;
+	const struct emsabp_snapshot_entry	*eb = *(const struct emsabp_snapshot_entry **)b;
+
+	return strcasecmp(ea->dn, eb->dn);
+}
+
+static int emsabp_snapshot_destructor(struct emsabp_snapshot *snapshot)
+{
+	DLIST_REMOVE(emsabp_snapshots, snapshot);
+	return 0;
+}
+
+/**
+   \details Point an entry to a new version of its record
+ */
+static void emsabp_snapshot_entry_set(struct emsabp_snapshot_entry *entry,
+				      struct ldb_message *msg)
+{
+	entry->msg = talloc_steal(entry, msg);
+	entry->dn = ldb_msg_find_attr_as_string(msg, "distinguishedName", NULL);
+	if (!entry->dn) {
+		entry->dn = ldb_dn_get_linearized(msg->dn);
+	}
+	entry->displayName = ldb_msg_find_attr_as_string(msg, "displayName", "");
+}
+
+/**
+   \details Sort the entries again and record their new rows
+ */
+static void emsabp_snapshot_sort(struct emsabp_snapshot *snapshot)
+{
+	uint32_t	i;
+
+	if (!snapshot->count) return;
+
+	qsort(snapshot->entries, snapshot->count, sizeof (struct emsabp_snapshot_entry *),
+	      emsabp_snapshot_cmp_name);
+	qsort(snapshot->by_dn, snapshot->count, sizeof (struct emsabp_snapshot_entry *),
+	      emsabp_snapshot_cmp_dn);
+
+	for (i = 0; i < snapshot->count; i++) {
+		snapshot->entries[i]->row = i;
+	}
+}
+
+static struct emsabp_snapshot_entry *emsabp_snapshot_find_dn(struct emsabp_snapshot *snapshot,
+							     const char *dn)
+{
+	struct emsabp_snapshot_entry	key;
+	struct emsabp_snapshot_entry	*keyp = &key;
+	struct emsabp_snapshot_entry	**entry;
+
+	if (!snapshot->count) return NULL;
+
+	key.dn = dn;
+	entry = bsearch(&keyp, snapshot->by_dn, snapshot->count, sizeof (struct emsabp_snapshot_entry *),
+			emsabp_snapshot_cmp_dn);
+
+	return entry ? *entry : NULL;
+}
+
+/**
+   \details Merge the records of a search into the snapshot. Records
+   already in the snapshot are replaced, the others are appended.
+
+   \return true if the snapshot changed, otherwise false
+ */
+static bool emsabp_snapshot_merge(struct emsabp_snapshot *snapshot,
+				  struct ldb_result *res)
+{
+	struct emsabp_snapshot_entry	*entry;
+	struct emsabp_snapshot_entry	**entries;
+	struct emsabp_snapshot_entry	**by_dn;
+	const char			*dn;
+	uint64_t			usn;
+	uint32_t			count;
+	uint32_t			i;
+
+	if (!res->count) return false;
+
+	/* Make room for every record being new */
+	count = snapshot->count + res->count;
+	entries = talloc_realloc(snapshot->data, snapshot->entries, struct emsabp_snapshot_entry *, count);
+	if (!entries) return false;
+	snapshot->entries = entries;
+	by_dn = talloc_realloc(snapshot->data, snapshot->by_dn, struct emsabp_snapshot_entry *, count);
+	if (!by_dn) return false;
+	snapshot->by_dn = by_dn;
+
+	count = snapshot->count;
+	for (i = 0; i < res->count; i++) {
+		usn = ldb_msg_find_attr_as_uint64(res->msgs[i], "uSNChanged", 0);
+		if (usn > snapshot->highest_usn) {
+			snapshot->highest_usn = usn;
+		}
+
+		dn = ldb_msg_find_attr_as_string(res->msgs[i], "distinguishedName", NULL);
+		if (!dn) {
+			dn = ldb_dn_get_linearized(res->msgs[i]->dn);
+		}
+		/* Records appended by this merge are not in by_dn order yet */
+		entry = emsabp_snapshot_find_dn(snapshot, dn);
+		if (entry) {
+			talloc_free(entry->msg);
+		} else {
+			entry = talloc_zero(snapshot->data, struct emsabp_snapshot_entry);
+			if (!entry) break;
+			snapshot->entries[count] = entry;
+			snapshot->by_dn[count] = entry;
+			count++;
+		}
+		emsabp_snapshot_entry_set(entry, res->msgs[i]);
+	}
+
+	snapshot->count = count;
+	emsabp_snapshot_sort(snapshot);
+
+	return true;
+}
+
+/**
+   \details Retrieve the snapshot of an address book container
+
+   \param ContainerID the MId of the container, 0 for the GAL
+   \param organization_name the organization the container is
+   restricted to
+
+   \return Pointer to the snapshot, NULL if none was created yet
+ */
+_PUBLIC_ struct emsabp_snapshot *emsabp_snapshot_find(uint32_t ContainerID,
+						      const char *organization_name)
+{
+	struct emsabp_snapshot	*snapshot;
+
+	for (snapshot = emsabp_snapshots; snapshot; snapshot = snapshot->next) {
+		if (snapshot->ContainerID == ContainerID &&
+		    !strcmp(snapshot->organization_name, organization_name)) {
+			return snapshot;
+		}
+	}
+
+	return NULL;
+}
+
+/**
+   \details Create the snapshot of an address book container. It is
+   empty until emsabp_snapshot_refresh is called.
+
+   \param ContainerID the MId of the container, 0 for the GAL
+   \param organization_name the organization the container is
+   restricted to
+   \param filter the LDB filter matching the records of the
+   container, NULL if the container has no records
+
+   \return Pointer to the snapshot on success, otherwise NULL
+ */
+_PUBLIC_ struct emsabp_snapshot *emsabp_snapshot_add(uint32_t ContainerID,
+						     const char *organization_name,
+						     const char *filter)
+{
+	struct emsabp_snapshot	*snapshot;
+	uint32_t		count;
+
+	if (!organization_name) return NULL;
+
+	snapshot = talloc_zero(NULL, struct emsabp_snapshot);
+	if (!snapshot) return NULL;
+
+	snapshot->ContainerID = ContainerID;
+	snapshot->organization_name = talloc_strdup(snapshot, organization_name);
+	snapshot->data = talloc_named(snapshot, 0, "emsabp_snapshot_data");
+	if (!snapshot->organization_name || !snapshot->data) {
+		talloc_free(snapshot);
+		return NULL;
+	}
+
+	/* Keep the attributes any property can be built from, and
+	 * what the refresh needs */
+	snapshot->attrs = emsabp_property_get_attrs(snapshot, NULL);
+	if (!snapshot->attrs) {
+		talloc_free(snapshot);
+		return NULL;
+	}
+	for (count = 0; snapshot->attrs[count]; count++);
+	snapshot->attrs = talloc_realloc(snapshot, snapshot->attrs, const char *, count + 2);
+	if (!snapshot->attrs) {
+		talloc_free(snapshot);
+		return NULL;
+	}
+	snapshot->attrs[count] = "uSNChanged";
+	snapshot->attrs[count + 1] = NULL;
+	if (filter) {
+		snapshot->filter = talloc_strdup(snapshot, filter);
+		if (!snapshot->filter) {
+			talloc_free(snapshot);
+			return NULL;
+		}
+	}
+
+	DLIST_ADD(emsabp_snapshots, snapshot);
+	talloc_set_destructor(snapshot, emsabp_snapshot_destructor);
+
+	return snapshot;
+}
+
+/**
+   \details Bring a snapshot up to date with the directory
+
+   Records changed since the last refresh are fetched every refresh
+   seconds. The snapshot is searched again from scratch every rebuild
+   seconds, since records deleted or no longer matching the container
+   filter are not returned by the incremental search.
+
+   \param snapshot pointer to the snapshot to refresh
+   \param ldb_ctx pointer to the directory LDB context
+   \param basedn the DN under which the container records are searched
+   \param refresh number of seconds between two incremental refreshes
+   \param rebuild number of seconds between two full rebuilds
+
+   \return MAPI_E_SUCCESS on success, otherwise MAPI error
+ */
+_PUBLIC_ enum MAPISTATUS emsabp_snapshot_refresh(struct emsabp_snapshot *snapshot,
+						 struct ldb_context *ldb_ctx,
+						 struct ldb_dn *basedn,
+						 uint32_t refresh,
+						 uint32_t rebuild)
+{
+	TALLOC_CTX			*mem_ctx;
+	struct ldb_result		*res = NULL;
+	struct emsabp_snapshot		fresh;
+	time_t				now;
+	int				ret;
+
+	/* Sanity checks */
+	OPENCHANGE_RETVAL_IF(!snapshot, MAPI_E_INVALID_PARAMETER, NULL);
+	OPENCHANGE_RETVAL_IF(!ldb_ctx, MAPI_E_INVALID_PARAMETER, NULL);
+
+	/* The container is not meant to have records */
+	if (!snapshot->filter) return MAPI_E_SUCCESS;
+
+	now = time(NULL);
+	if (snapshot->rebuilt && now - snapshot->rebuilt < rebuild) {
+		if (now - snapshot->refreshed < refresh) {
+			return MAPI_E_SUCCESS;
+		}
+
+		mem_ctx = talloc_named(NULL, 0, "emsabp_snapshot_refresh");
+		OPENCHANGE_RETVAL_IF(!mem_ctx, MAPI_E_NOT_ENOUGH_MEMORY, NULL);
+
+		ret = ldb_search(ldb_ctx, mem_ctx, &res, basedn, LDB_SCOPE_SUBTREE, snapshot->attrs,
+				 "(&%s(uSNChanged>=%"PRIu64"))", snapshot->filter, snapshot->highest_usn + 1);
+		OPENCHANGE_RETVAL_IF(ret != LDB_SUCCESS, MAPI_E_NOT_FOUND, mem_ctx);
+
+		if (emsabp_snapshot_merge(snapshot, res)) {
+			OC_DEBUG(5, "[nspi] %u records of container 0x%x changed\n",
+				 res->count, snapshot->ContainerID);
+		}
+		snapshot->refreshed = now;
+		talloc_free(mem_ctx);
+
+		return MAPI_E_SUCCESS;
+	}
+
+	/* Build the new entries aside, so a failed search keeps the
+	 * current ones */
+	ZERO_STRUCT(fresh);
+	fresh.data = talloc_named(snapshot, 0, "emsabp_snapshot_data");
+	OPENCHANGE_RETVAL_IF(!fresh.data, MAPI_E_NOT_ENOUGH_MEMORY, NULL);
+
+	ret = ldb_search(ldb_ctx, fresh.data, &res, basedn, LDB_SCOPE_SUBTREE, snapshot->attrs,
+			 "%s", snapshot->filter);
+	OPENCHANGE_RETVAL_IF(ret != LDB_SUCCESS, MAPI_E_NOT_FOUND, fresh.data);
+
+	emsabp_snapshot_merge(&fresh, res);
+	if (fresh.count != res->count) {
+		OC_DEBUG(1, "[nspi] Unable to snapshot container 0x%x\n", snapshot->ContainerID);
+		talloc_free(fresh.data);
+		return MAPI_E_NOT_ENOUGH_MEMORY;
+	}
+	talloc_free(res);
+
+	talloc_free(snapshot->data);
+	snapshot->data = fresh.data;
+	snapshot->entries = fresh.entries;
+	snapshot->by_dn = fresh.by_dn;
+	snapshot->count = fresh.count;
+	snapshot->highest_usn = fresh.highest_usn;
+	snapshot->refreshed = now;
+	snapshot->rebuilt = now;
+
+	OC_DEBUG(5, "[nspi] Container 0x%x snapshot holds %u records\n",
+		 snapshot->ContainerID, snapshot->count);
+
+	return MAPI_E_SUCCESS;
+}
+
+/**
+   \details Retrieve the row of the snapshot matching a session MId
+
+   \param snapshot pointer to the snapshot
+   \param ttdb_ctx pointer to the session temporary TDB context
+   \param MId the MId to look for
+   \param row pointer to the row returned by the function
+
+   \return MAPI_E_SUCCESS on success, MAPI_E_NOT_FOUND if the MId is
+   not a record of the container
+ */
+_PUBLIC_ enum MAPISTATUS emsabp_snapshot_MId_to_row(struct emsabp_snapshot *snapshot,
+						    TDB_CONTEXT *ttdb_ctx,
+						    uint32_t MId, uint32_t *row)
+{
+	TALLOC_CTX			*mem_ctx;
+	enum MAPISTATUS			retval;
+	struct emsabp_snapshot_entry	*entry;
+	char				*dn;
+
+	/* Sanity checks */
+	OPENCHANGE_RETVAL_IF(!snapshot, MAPI_E_INVALID_PARAMETER, NULL);
+	OPENCHANGE_RETVAL_IF(!row, MAPI_E_INVALID_PARAMETER, NULL);
+
+	mem_ctx = talloc_named(NULL, 0, "emsabp_snapshot_MId_to_row");
+	OPENCHANGE_RETVAL_IF(!mem_ctx, MAPI_E_NOT_ENOUGH_MEMORY, NULL);
+
+	retval = emsabp_tdb_fetch_dn_from_MId(mem_ctx, ttdb_ctx, MId, &dn);
+	OPENCHANGE_RETVAL_IF(retval, MAPI_E_NOT_FOUND, mem_ctx);
+
+	entry = emsabp_snapshot_find_dn(snapshot, dn);
+	OPENCHANGE_RETVAL_IF(!entry, MAPI_E_NOT_FOUND, mem_ctx);
+
+	*row = entry->row;
+	talloc_free(mem_ctx);
+
+	return MAPI_E_SUCCESS;
+}
+
+/**
+   \details Retrieve the session MId of a row of the snapshot,
+   creating it if necessary
+
+   \param snapshot pointer to the snapshot
+   \param ttdb_ctx pointer to the session temporary TDB context
+   \param row the row of the record
+   \param MId pointer to the MId returned by the function
+
+   \return MAPI_E_SUCCESS on success, otherwise MAPI error
+ */
+_PUBLIC_ enum MAPISTATUS emsabp_snapshot_row_to_MId(struct emsabp_snapshot *snapshot,
+						    TDB_CONTEXT *ttdb_ctx,
+						    uint32_t row, uint32_t *MId)
+{
+	enum MAPISTATUS	retval;
+	const char	*dn;
+
+	/* Sanity checks */
+	OPENCHANGE_RETVAL_IF(!snapshot, MAPI_E_INVALID_PARAMETER, NULL);
+	OPENCHANGE_RETVAL_IF(!MId, MAPI_E_INVALID_PARAMETER, NULL);
+	OPENCHANGE_RETVAL_IF(row >= snapshot->count, MAPI_E_NOT_FOUND, NULL);
+
+	dn = snapshot->entries[row]->dn;
+	retval = emsabp_tdb_fetch_MId(ttdb_ctx, dn, MId);
+	if (retval != MAPI_E_SUCCESS) {
+		retval = emsabp_tdb_insert(ttdb_ctx, dn);
+		OPENCHANGE_RETVAL_IF(retval, MAPI_E_CORRUPT_STORE, NULL);
+		retval = emsabp_tdb_fetch_MId(ttdb_ctx, dn, MId);
+		OPENCHANGE_RETVAL_IF(retval, MAPI_E_CORRUPT_STORE, NULL);
+	}
+
+	return MAPI_E_SUCCESS;
+}
+
+/**
+   \details Retrieve the first row of the snapshot whose displayName
+   is greater than or equal to the given one
+
+   \param snapshot pointer to the snapshot
+   \param displayName the displayName to seek
+
+   \return the row found, the number of rows if there is none
+ */
+_PUBLIC_ uint32_t emsabp_snapshot_seek(struct emsabp_snapshot *snapshot,
+				       const char *displayName)
+{
+	uint32_t	low = 0;
+	uint32_t	high;
+	uint32_t	middle;
+
+	if (!snapshot || !displayName) return 0;
+
+	high = snapshot->count;
+	while (low < high) {
+		middle = low + (high - low) / 2;
+		if (strcasecmp(snapshot->entries[middle]->displayName, displayName) < 0) {
+			low = middle + 1;
+		} else {
+			high = middle;
+		}
+	}
+
+	return low;
+}
@@ -29,13 +29,21 @@
 #include "dcesrv_exchange_nsp.h"
 
 /**
-   \details Structure to be used for MId traversal within TDB
+   \details Structure to be used for the MId records upgrade traversal
  */
-struct traverse_MId {
-	uint32_t	MId;
-	bool		found;
+struct upgrade_MId {
+	uint32_t	count;
+	bool		failed;
 };
 
+/* Room for EMSABP_TDB_MID_REC_PREFIX and a 32 bits hexadecimal MId */
+#define	EMSABP_TDB_MID_KEY_SIZE		32
+
+static void emsabp_tdb_MId_key(char *keyname, uint32_t MId)
+{
+	snprintf(keyname, EMSABP_TDB_MID_KEY_SIZE, EMSABP_TDB_MID_REC_PREFIX "0x%x", MId);
+}
+
 /**
    \details Open EMSABP TDB database
 
@@ -80,6 +88,14 @@ _PUBLIC_ TDB_CONTEXT *emsabp_tdb_init(TALLOC_CTX *mem_ctx,
 		free (dbuf.dptr);
 	}
 
+	/* Step 2. Add the MId records missing from databases created so far */
+	retval = emsabp_tdb_upgrade(tdb_ctx);
+	if (retval != MAPI_E_SUCCESS) {
+		OC_DEBUG(3, "Unable to upgrade the EMSABP TDB database: %s", mapi_get_errstr(retval));
+		tdb_close(tdb_ctx);
+		return NULL;
+	}
+
 	return tdb_ctx;
 }
 
@@ -221,108 +237,167 @@ _PUBLIC_ enum MAPISTATUS emsabp_tdb_fetch_MId(TDB_CONTEXT *tdb_ctx,
 }
 
 
-static int emsabp_tdb_traverse_MId(TDB_CONTEXT *tdb_ctx, 
-				   TDB_DATA key, TDB_DATA dbuf, 
-				   void *state)
+static int emsabp_tdb_traverse_upgrade(TDB_CONTEXT *tdb_ctx,
+				       TDB_DATA key, TDB_DATA dbuf,
+				       void *state)
 {
 	TALLOC_CTX		*mem_ctx;
+	TDB_DATA		mid_key;
+	char			keyname[EMSABP_TDB_MID_KEY_SIZE];
+	char			*value_str;
 	uint32_t		value;
-	char			*value_str = NULL;
-	struct traverse_MId	*mid_trav = (struct traverse_MId *) state;
+	struct upgrade_MId	*upgrade = (struct upgrade_MId *) state;
+
+	if (!key.dptr || key.dsize < 3 || strncmp((const char *)key.dptr, "CN=", 3)) {
+		return 0;
+	}
 
-	mem_ctx = talloc_named(NULL, 0, "emsabp_tdb_traverse_MId");
+	mem_ctx = talloc_named(NULL, 0, "emsabp_tdb_traverse_upgrade");
 	value_str = talloc_strndup(mem_ctx, (char *)dbuf.dptr, dbuf.dsize);
 	value = strtol((const char *)value_str, NULL, 16);
 	talloc_free(mem_ctx);
 
-	if (value == mid_trav->MId) {
-		mid_trav->found = true;
+	emsabp_tdb_MId_key(keyname, value);
+	mid_key.dptr = (unsigned char *)keyname;
+	mid_key.dsize = strlen(keyname);
+
+	if (tdb_store(tdb_ctx, mid_key, key, TDB_REPLACE) == -1) {
+		upgrade->failed = true;
 		return 1;
 	}
+	upgrade->count++;
 
 	return 0;
 }
 
 
 /**
-   \details Traverse the EMSABP TDB database and look for the input
-   MId
+   \details Add a MId -> DN record for every DN -> MId record of an
+   EMSABP TDB database created before these records existed
 
    \param tdb_ctx pointer to the EMSABP TDB context
-   \param MId MID to lookup
 
-   \return true on success, otherwise false
+   \return MAPI_E_SUCCESS on success, otherwise MAPI error
  */
-_PUBLIC_ bool emsabp_tdb_lookup_MId(TDB_CONTEXT *tdb_ctx,
-				    uint32_t MId)
+_PUBLIC_ enum MAPISTATUS emsabp_tdb_upgrade(TDB_CONTEXT *tdb_ctx)
 {
+	TALLOC_CTX		*mem_ctx;
+	TDB_DATA		key;
+	TDB_DATA		dbuf;
+	char			*str;
+	uint32_t		version = 0;
+	bool			transaction;
+	struct upgrade_MId	upgrade = { 0, false };
 	int			ret;
-	struct traverse_MId	mid_trav = { MId, false };
 
-	ret = tdb_traverse(tdb_ctx, emsabp_tdb_traverse_MId, (void *)&mid_trav);
+	/* Sanity checks */
+	OPENCHANGE_RETVAL_IF(!tdb_ctx, MAPI_E_NOT_INITIALIZED, NULL);
 
-	return (ret > 0) && mid_trav.found;
-}
+	mem_ctx = talloc_named(NULL, 0, "emsabp_tdb_upgrade");
+	OPENCHANGE_RETVAL_IF(!mem_ctx, MAPI_E_NOT_ENOUGH_RESOURCES, NULL);
 
+	/* Step 1. Check the version of the database */
+	if (emsabp_tdb_fetch(tdb_ctx, EMSABP_TDB_VERSION_REC, &dbuf) == MAPI_E_SUCCESS) {
+		str = talloc_strndup(mem_ctx, (char *)dbuf.dptr, dbuf.dsize);
+		version = strtol(str, NULL, 16);
+		free(dbuf.dptr);
+	}
+	if (version >= EMSABP_TDB_VERSION) {
+		talloc_free(mem_ctx);
+		return MAPI_E_SUCCESS;
+	}
 
-static int emsabp_tdb_traverse_MId_DN(TDB_CONTEXT *tdb_ctx,
-				      TDB_DATA key, TDB_DATA dbuf,
-				      void *state)
-{
-	char			*MId;
-	uint32_t		value;
-	struct emsabp_MId	*emsabp_MId = (struct emsabp_MId *) state;
-
-	if (key.dptr) {
-		if (!strncmp((const char *)key.dptr, "CN=", 3)) {
-			MId = talloc_strndup(emsabp_MId, (char *)dbuf.dptr, dbuf.dsize);
-			value = strtol((const char *)MId, NULL, 16);
-			talloc_free(MId);
-			if (value == emsabp_MId->MId) {
-				emsabp_MId->dn = talloc_strndup(emsabp_MId, (char *)key.dptr, key.dsize);
-				return 1;
-			}
+	/* Step 2. Add the MId records, atomically if the database supports transactions */
+	transaction = (tdb_transaction_start(tdb_ctx) == 0);
+
+	ret = tdb_traverse(tdb_ctx, emsabp_tdb_traverse_upgrade, (void *)&upgrade);
+	if (ret == -1 || upgrade.failed) {
+		OC_DEBUG(3, "Unable to add MId records: %s", tdb_errorstr(tdb_ctx));
+		if (transaction) {
+			tdb_transaction_cancel(tdb_ctx);
 		}
+		talloc_free(mem_ctx);
+		return MAPI_E_CORRUPT_STORE;
 	}
 
-	return 0;
+	/* Step 3. Record the new version */
+	key.dptr = (unsigned char *) EMSABP_TDB_VERSION_REC;
+	key.dsize = strlen(EMSABP_TDB_VERSION_REC);
+
+	dbuf.dptr = (unsigned char *) talloc_asprintf(mem_ctx, "0x%x", EMSABP_TDB_VERSION);
+	dbuf.dsize = strlen((const char *)dbuf.dptr);
+
+	ret = tdb_store(tdb_ctx, key, dbuf, TDB_REPLACE);
+	if (ret == -1 || (transaction && tdb_transaction_commit(tdb_ctx) == -1)) {
+		OC_DEBUG(3, "Unable to record the EMSABP TDB version: %s", tdb_errorstr(tdb_ctx));
+		if (transaction && ret == -1) {
+			tdb_transaction_cancel(tdb_ctx);
+		}
+		talloc_free(mem_ctx);
+		return MAPI_E_CORRUPT_STORE;
+	}
+
+	OC_DEBUG(3, "EMSABP TDB database upgraded, %u MId records added", upgrade.count);
+	talloc_free(mem_ctx);
+
+	return MAPI_E_SUCCESS;
+}
+
+
+/**
+   \details Check whether a MId exists within the EMSABP TDB database
+
+   \param tdb_ctx pointer to the EMSABP TDB context
+   \param MId MID to lookup
+
+   \return true on success, otherwise false
+ */
+_PUBLIC_ bool emsabp_tdb_lookup_MId(TDB_CONTEXT *tdb_ctx,
+				    uint32_t MId)
+{
+	char	keyname[EMSABP_TDB_MID_KEY_SIZE];
+
+	if (!tdb_ctx) return false;
+
+	emsabp_tdb_MId_key(keyname, MId);
+
+	return emsabp_tdb_fetch(tdb_ctx, keyname, NULL) == MAPI_E_SUCCESS;
 }
 
 
 /**
-   \details Traverse the EMSABP TDB and fetch the DN associated with
-   the MId
+   \details Fetch the DN associated with the MId from the EMSABP TDB
 
    \param mem_ctx pointer to the memory context
    \param tdb_ctx pointer to the EMSABP TDB context
    \param MId MID to search
    \param dn pointer on pointer to the dn to return
 
-   \return MAPI_E_SUCCESS on success, otherwise false
+   \return MAPI_E_SUCCESS on success, otherwise MAPI_E_NOT_FOUND
  */
 _PUBLIC_ enum MAPISTATUS emsabp_tdb_fetch_dn_from_MId(TALLOC_CTX *mem_ctx,
 						      TDB_CONTEXT *tdb_ctx,
 						      uint32_t MId,
 						      char **dn)
 {
-	int			ret;
-	struct emsabp_MId	*emsabp_MId;
-	
-	emsabp_MId = talloc_zero(mem_ctx, struct emsabp_MId);
-	emsabp_MId->dn = NULL;
-	emsabp_MId->MId = MId;
-	
-	ret = tdb_traverse(tdb_ctx, emsabp_tdb_traverse_MId_DN, (void *)emsabp_MId);
-	if (ret > -1 && emsabp_MId->dn) {
-		*dn = talloc_strdup(mem_ctx, emsabp_MId->dn);
-		talloc_free(emsabp_MId);
-		return MAPI_E_SUCCESS;
-	}
+	enum MAPISTATUS		retval;
+	TDB_DATA		dbuf;
+	char			keyname[EMSABP_TDB_MID_KEY_SIZE];
+
+	/* Sanity checks */
+	OPENCHANGE_RETVAL_IF(!dn, MAPI_E_INVALID_PARAMETER, NULL);
 
 	*dn = NULL;
-	talloc_free(emsabp_MId);
+	emsabp_tdb_MId_key(keyname, MId);
 
-	return MAPI_E_NOT_FOUND;
+	retval = emsabp_tdb_fetch(tdb_ctx, keyname, &dbuf);
+	OPENCHANGE_RETVAL_IF(retval, MAPI_E_NOT_FOUND, NULL);
+
+	*dn = talloc_strndup(mem_ctx, (char *)dbuf.dptr, dbuf.dsize);
+	free(dbuf.dptr);
+	OPENCHANGE_RETVAL_IF(!*dn, MAPI_E_NOT_ENOUGH_MEMORY, NULL);
+
+	return MAPI_E_SUCCESS;
 }
 
 
@@ -341,6 +416,8 @@ _PUBLIC_ enum MAPISTATUS emsabp_tdb_insert(TDB_CONTEXT *tdb_ctx,
 	TALLOC_CTX	*mem_ctx;
 	TDB_DATA	key;
 	TDB_DATA	dbuf;
+	TDB_DATA	mid_key;
+	char		mid_keyname[EMSABP_TDB_MID_KEY_SIZE];
 	char		*str;
 	int		index;
 	int		ret;
@@ -376,7 +453,15 @@ _PUBLIC_ enum MAPISTATUS emsabp_tdb_insert(TDB_CONTEXT *tdb_ctx,
 	ret = tdb_store(tdb_ctx, key, dbuf, TDB_INSERT);
 	OPENCHANGE_RETVAL_IF(ret == -1, MAPI_E_CORRUPT_STORE, mem_ctx);
 
-	/* Step 4. Update Data record */
+	/* Step 4. Insert the MId -> DN record */
+	emsabp_tdb_MId_key(mid_keyname, index);
+	mid_key.dptr = (unsigned char *)mid_keyname;
+	mid_key.dsize = strlen(mid_keyname);
+
+	ret = tdb_store(tdb_ctx, mid_key, key, TDB_REPLACE);
+	OPENCHANGE_RETVAL_IF(ret == -1, MAPI_E_CORRUPT_STORE, mem_ctx);
+
+	/* Step 5. Update Data record */
 	key.dptr = (unsigned char *) EMSABP_TDB_DATA_REC;
 	key.dsize = strlen((const char *)key.dptr);
 
@@ -16,24 +16,120 @@
 # along with this program.  If not, see <http://www.gnu.org/licenses/>.
 #
 """
-This module provides the retrieval of the offline address book. 
-For now only an empty address book is retrieved
+This module provides the retrieval of the offline address book. [MS-OXWOAB]
+
+The OAB files are written by openchange_oabgen in the configured
+directory, along with an oab.info file describing them. An empty
+address book is retrieved until openchange_oabgen has been run, which
+the cron entry installed along with it does every hour.
+
+Only the full details file is published: openchange_oabgen writes no
+differential files, so clients download the whole address book again
+each time its sequence number changes.
 """
-from pylons.decorators.rest import restrict
+import hashlib
+import os
+import re
+from xml.sax.saxutils import quoteattr, escape
+
+from paste.fileapp import FileApp
+from pylons import config
 from pylons import response
+from pylons.controllers.util import abort, forward
 from ocsmanager.lib.base import BaseController
+import logging
+logger = logging.getLogger(__name__)
+
+OAB_INFO = "oab.info"
+OAB_FILE_RE = re.compile(r'^[A-Za-z0-9._-]+\.lzx$')
+EMPTY_OAB = """<?xml version="1.0" encoding="UTF-8"?>
+        <OAB>
+        </OAB>"""
+
+# SHA-1 of the published files, keyed by path and modification time
+_sha_cache = {}
+
+
+def _file_sha(path):
+    mtime = os.stat(path).st_mtime
+    key = (path, mtime)
+    if key not in _sha_cache:
+        sha = hashlib.sha1()
+        with open(path, 'rb') as f:
+            for chunk in iter(lambda: f.read(65536), ''):
+                sha.update(chunk)
+        _sha_cache.clear()
+        _sha_cache[key] = sha.hexdigest()
+    return _sha_cache[key]
+
+
+def _read_info(directory):
+    """Return the description of the OAB written by openchange_oabgen,
+    None if there is none.
+    """
+    info = {}
+    try:
+        with open(os.path.join(directory, OAB_INFO)) as f:
+            for line in f:
+                key, sep, value = line.rstrip('\n').partition('=')
+                if sep:
+                    info[key] = value
+    except IOError:
+        return None
+
+    for key in ('sequence', 'name', 'dn', 'guid', 'file', 'size', 'uncompressedsize'):
+        if key not in info:
+            logger.warn("%s: missing %s", OAB_INFO, key)
+            return None
+    if not OAB_FILE_RE.match(info['file']):
+        logger.warn("%s: invalid file name %s", OAB_INFO, info['file'])
+        return None
+
+    return info
+
 
 class OabController(BaseController):
     """The constroller class for OAB requests."""
 
+    def _oab_xml(self):
+        directory = config['ocsmanager']['oab']['directory']
+        info = _read_info(directory)
+        if info is None:
+            return EMPTY_OAB
+
+        try:
+            sha = _file_sha(os.path.join(directory, info['file']))
+        except (IOError, OSError) as e:
+            logger.warn("Unable to read %s: %s", info['file'], e)
+            return EMPTY_OAB
+
+        return """<?xml version="1.0" encoding="UTF-8"?>
+        <OAB>
+          <OAL id=%s dn=%s name=%s>
+            <Full seq=%s ver="32" size=%s uncompressedsize=%s SHA=%s>%s</Full>
+          </OAL>
+        </OAB>""" % (quoteattr(info['guid']), quoteattr(info['dn']),
+                     quoteattr(info['name']), quoteattr(info['sequence']),
+                     quoteattr(info['size']), quoteattr(info['uncompressedsize']),
+                     quoteattr(sha), escape(info['file']))
+
     def get_oab(self, **kwargs):
-        # TODO
         response.headers["content-type"] = "application/xml"
-        body = """<?xml version="1.0" encoding="UTF-8"?>
-        <OAB>
-        </OAB>"""
-        return body
+        return self._oab_xml()
 
     def head_oab(self, **kwargs):
-        # TODO
-        pass
+        # The server drops the body, keeping the headers of a GET
+        return self.get_oab(**kwargs)
+
+    def get_file(self, filename, **kwargs):
+        """Serve the OAB files listed in oab.xml, supporting the range
+        requests clients resume downloads with.
+        """
+        if not OAB_FILE_RE.match(filename):
+            abort(404)
+
+        path = os.path.join(config['ocsmanager']['oab']['directory'], filename)
+        if not os.path.isfile(path):
+            abort(404)
+
+        return forward(FileApp(path, content_type="application/octet-stream"))
@@ -177,6 +177,10 @@ class OCSConfig(object):
             log.error('Invalid outofoffice backend: %s' % self.d['outofoffice']['backend'])
             sys.exit()
 
+    def __parse_oab(self):
+        # Optional section: OAB files are served once openchange_oabgen has run
+        self.__get_option('oab', 'directory', dflt='/var/lib/openchange/oab')
+
     def load(self):
         """Load the configuration file.
         """
@@ -199,5 +203,6 @@ class OCSConfig(object):
         self.__parse_autodiscover()
         self.__parse_autodiscover_rpcproxy()
         self.__parse_outofoffice()
+        self.__parse_oab()
 
         return self.d
@@ -25,12 +25,51 @@
 #include <mysql/mysql.h>
 #include <talloc.h>
 #include <stdbool.h>
+#include <stdio.h>
+#include <time.h>
 #include <gen_ndr/exchange.h>
 
 #define THRESHOLD_SLOW_QUERIES 0.25
+
+/* Connection pool defaults, see create_connection */
+#define MYSQL_POOL_DEFAULT_MIN	1
+#define MYSQL_POOL_DEFAULT_MAX	8
+#define MYSQL_POOL_DEFAULT_WAIT	1000
+#define MYSQL_POOL_DEFAULT_PING	60
+
+/* Read/write split, see mysql_rw_init */
+#define MYSQL_RW_DEFAULT_STICKY	5
+
+struct mysql_rw_session {
+	struct mysql_rw_session	*next;
+	const char		*name;
+	time_t			last_write;
+};
+
+struct mysql_rw {
+	const char		*primary_connection_string;
+	const char		*replica_connection_string;
+	uint32_t		sticky_s;
+	time_t			last_write;
+	struct mysql_rw_session	*sessions;
+	uint64_t		primary_reads;
+	uint64_t		replica_reads;
+};
+
+struct mysql_pool_stats {
+	uint32_t	open;
+	uint32_t	in_use;
+	uint64_t	checkouts;
+	uint64_t	waits;
+	uint64_t	exhausted;
+	uint64_t	reconnects;
+	uint64_t	wait_total_us;
+	uint64_t	wait_max_us;
+};
 #define _sql(A, B) _sql_escape(A, B, '\'')
 
 const char* _sql_escape(TALLOC_CTX *mem_ctx, const char *s, char c);
+char *_sql_real_escape(TALLOC_CTX *, MYSQL *, const char *);
 
 enum MYSQLRESULT execute_query(MYSQL *, const char *);
 enum MYSQLRESULT select_without_fetch(MYSQL *, const char *, MYSQL_RES **);
@@ -45,7 +84,37 @@ bool convert_string_to_ull(const char *, uint64_t *);
 MYSQL *create_connection(const char *, MYSQL **);
 void release_connection(MYSQL *);
 void close_all_connections(void);
+bool mysql_pool_get_stats(const char *, struct mysql_pool_stats *);
+void mysql_pool_dump_stats(FILE *);
+void mysql_pool_reset_stats(void);
+
+struct mysql_rw *mysql_rw_init(TALLOC_CTX *, const char *, const char *, uint32_t);
+void mysql_rw_release(struct mysql_rw *);
+MYSQL *mysql_rw_reader(struct mysql_rw *, const char *);
+MYSQL *mysql_rw_reader_any(struct mysql_rw *);
+MYSQL *mysql_rw_writer(struct mysql_rw *, const char *);
+MYSQL *mysql_rw_primary(struct mysql_rw *);
+void mysql_rw_pin(struct mysql_rw *, bool);
 
 enum MYSQLRESULT { MYSQL_SUCCESS, MYSQL_NOT_FOUND, MYSQL_ERROR };
 
+/* Prepared statements */
+#define STMT_MAX_PARAMS 16
+
+enum STMTTYPE { STMT_STRING, STMT_UINT };
+
+struct stmt_value {
+	enum STMTTYPE	type;
+	const char	*s;
+	uint64_t	n;
+	bool		is_null;
+};
+
+#define STMT_STRING_VALUE(S) { .type = STMT_STRING, .s = (S), .n = 0, .is_null = ((S) == NULL) }
+#define STMT_UINT_VALUE(N) { .type = STMT_UINT, .s = NULL, .n = (N), .is_null = false }
+
+enum MYSQLRESULT stmt_execute(MYSQL *, const char *, struct stmt_value *, size_t, uint64_t *);
+enum MYSQLRESULT stmt_select_first(TALLOC_CTX *, MYSQL *, const char *, struct stmt_value *, size_t, struct stmt_value *, size_t);
+size_t stmt_cache_count(MYSQL *);
+
 #endif /* __MYSQL_H__ */
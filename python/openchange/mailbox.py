@@ -80,6 +80,17 @@ checkBaseOnSearch: TRUE
 
 dn: @INDEXLIST
 @IDXATTR: cn
+@IDXATTR: objectClass
+@IDXATTR: PidTagFolderId
+@IDXATTR: PidTagParentFolderId
+@IDXATTR: PidTagMessageId
+@IDXATTR: MAPIStoreURI
+@IDXATTR: SystemIdx
+@IDXATTR: PidTagMessageClass
+@IDXATTR: PidTagDisplayName
+@IDXATTR: PidTagNormalizedSubject
+@IDXATTR: MailboxGUID
+@IDXATTR: mailboxDN
 
 dn: @ATTRIBUTES
 cn: CASE_INSENSITIVE
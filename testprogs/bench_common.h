@@ -0,0 +1,39 @@
+/*
+   Helpers shared by the benchmark programs
+
+   OpenChange Project
+
+   This program is free software; you can redistribute it and/or modify
+   it under the terms of the GNU General Public License as published by
+   the Free Software Foundation; either version 3 of the License, or
+   (at your option) any later version.
+
+   This program is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+   GNU General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#ifndef	__BENCH_COMMON_H__
+#define	__BENCH_COMMON_H__
+
+#include <stdint.h>
+#include <time.h>
+
+/**
+   \details Read the monotonic clock
+
+   \return the current time in nanoseconds
+ */
+static inline uint64_t bench_now(void)
+{
+	struct timespec	ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (uint64_t)ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+#endif /* ! __BENCH_COMMON_H__ */
@@ -0,0 +1,253 @@
+/*
+   Benchmark the writes of the mapistore TDB indexing backend
+
+   OpenChange Project
+
+   This program is free software; you can redistribute it and/or modify
+   it under the terms of the GNU General Public License as published by
+   the Free Software Foundation; either version 3 of the License, or
+   (at your option) any later version.
+
+   This program is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+   GNU General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+/*
+  This program measures adding, updating and deleting fmids through
+  the TDB indexing backend, where each operation writes the fmid record
+  and its URI index entries within a transaction. It compares them
+  with:
+
+  - plain: the single fmid record store the backend did before it
+    indexed URIs, outside any transaction.
+
+  - synced: the same plain store wrapped in a transaction of a
+    database opened without TDB_NOSYNC, so every commit fsyncs.
+ */
+
+#include "mapiproxy/libmapistore/mapistore.h"
+#include "mapiproxy/libmapistore/mapistore_errors.h"
+#include "mapiproxy/libmapistore/mapistore_private.h"
+#include "mapiproxy/libmapistore/backends/indexing_tdb.h"
+#include "testprogs/bench_common.h"
+#include "utils/openchange-tools.h"
+
+#include <talloc.h>
+#include <inttypes.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <tdb.h>
+
+#define	BENCH_USERNAME		"bench_indexing_tdb"
+#define	BENCH_FOLDER_MESSAGES	16
+#define	BENCH_FMID_BASE		0x10000
+
+enum bench_op {
+	BENCH_ADD = 0,
+	BENCH_UPDATE,
+	BENCH_DEL,
+	BENCH_OPS
+};
+
+static const char * const bench_op_names[BENCH_OPS] = { "add", "update", "del" };
+
+static char *bench_uri(TALLOC_CTX *mem_ctx, uint32_t i, bool updated)
+{
+	return talloc_asprintf(mem_ctx, "sogo://bench@mail/folder%u/%s%u.eml",
+			       i / BENCH_FOLDER_MESSAGES, updated ? "moved" : "msg", i);
+}
+
+/* Operations through the indexing backend */
+static uint64_t bench_backend(struct indexing_context *ictx, enum bench_op op,
+			      uint32_t count, uint32_t *failures)
+{
+	TALLOC_CTX		*mem_ctx;
+	enum mapistore_error	retval;
+	uint64_t		start;
+	uint64_t		elapsed = 0;
+	uint32_t		i;
+
+	for (i = 0; i < count; i++) {
+		mem_ctx = talloc_new(NULL);
+		start = bench_now();
+		switch (op) {
+		case BENCH_ADD:
+			retval = ictx->add_fmid(ictx, BENCH_USERNAME, BENCH_FMID_BASE + i,
+						bench_uri(mem_ctx, i, false));
+			break;
+		case BENCH_UPDATE:
+			retval = ictx->update_fmid(ictx, BENCH_USERNAME, BENCH_FMID_BASE + i,
+						   bench_uri(mem_ctx, i, true));
+			break;
+		default:
+			retval = ictx->del_fmid(ictx, BENCH_USERNAME, BENCH_FMID_BASE + i,
+						MAPISTORE_PERMANENT_DELETE);
+			break;
+		}
+		elapsed += bench_now() - start;
+		if (retval != MAPISTORE_SUCCESS) {
+			(*failures)++;
+		}
+		talloc_free(mem_ctx);
+	}
+
+	return elapsed;
+}
+
+/* The fmid record store alone, optionally within a transaction */
+static uint64_t bench_plain(struct tdb_context *tdb, enum bench_op op, bool transaction,
+			    uint32_t count, uint32_t *failures)
+{
+	TALLOC_CTX	*mem_ctx;
+	TDB_DATA	key;
+	TDB_DATA	dbuf;
+	uint64_t	start;
+	uint64_t	elapsed = 0;
+	uint32_t	i;
+	int		ret;
+
+	for (i = 0; i < count; i++) {
+		mem_ctx = talloc_new(NULL);
+		key.dptr = (unsigned char *) talloc_asprintf(mem_ctx, "0x%.16"PRIx64,
+							     (uint64_t) BENCH_FMID_BASE + i);
+		key.dsize = strlen((const char *) key.dptr);
+		dbuf.dptr = (unsigned char *) bench_uri(mem_ctx, i, op == BENCH_UPDATE);
+		dbuf.dsize = strlen((const char *) dbuf.dptr);
+
+		start = bench_now();
+		ret = transaction ? tdb_transaction_start(tdb) : 0;
+		if (ret == 0) {
+			switch (op) {
+			case BENCH_ADD:
+				ret = tdb_store(tdb, key, dbuf, TDB_INSERT);
+				break;
+			case BENCH_UPDATE:
+				ret = tdb_store(tdb, key, dbuf, TDB_MODIFY);
+				break;
+			default:
+				ret = tdb_delete(tdb, key);
+				break;
+			}
+			if (transaction) {
+				if (ret == 0) {
+					ret = tdb_transaction_commit(tdb);
+				} else {
+					tdb_transaction_cancel(tdb);
+				}
+			}
+		}
+		elapsed += bench_now() - start;
+		if (ret != 0) {
+			(*failures)++;
+		}
+		talloc_free(mem_ctx);
+	}
+
+	return elapsed;
+}
+
+int main(int argc, const char *argv[])
+{
+	TALLOC_CTX		*mem_ctx;
+	poptContext		pc;
+	int			opt;
+	struct mapistore_context	*mstore_ctx;
+	struct indexing_context	*ictx;
+	struct tdb_context	*plain_tdb;
+	struct tdb_context	*synced_tdb;
+	enum mapistore_error	retval;
+	const char		*opt_path = "/tmp/";
+	uint32_t		opt_count = 10000;
+	uint32_t		failures = 0;
+	uint64_t		backend[BENCH_OPS];
+	uint64_t		plain[BENCH_OPS];
+	uint64_t		synced[BENCH_OPS];
+	char			*indexing_path;
+	char			*plain_path;
+	char			*synced_path;
+	int			op;
+
+	enum {OPT_PATH=1000, OPT_COUNT};
+
+	struct poptOption long_options[] = {
+		POPT_AUTOHELP
+		{"path", 'p', POPT_ARG_STRING, NULL, OPT_PATH, "set the scratch directory", "PATH"},
+		{"count", 'c', POPT_ARG_STRING, NULL, OPT_COUNT, "set the number of fmids", "COUNT"},
+		POPT_OPENCHANGE_VERSION
+		{ NULL, 0, POPT_ARG_NONE, NULL, 0, NULL, NULL }
+	};
+
+	pc = poptGetContext("bench_indexing_tdb", argc, argv, long_options, 0);
+
+	while ((opt = poptGetNextOpt(pc)) != -1) {
+		switch (opt) {
+		case OPT_PATH:
+			opt_path = poptGetOptArg(pc);
+			break;
+		case OPT_COUNT:
+			opt_count = strtoul(poptGetOptArg(pc), NULL, 10);
+			break;
+		}
+	}
+	poptFreeContext(pc);
+
+	if (!opt_count) {
+		fprintf(stderr, "At least one fmid is required\n");
+		exit (1);
+	}
+
+	mem_ctx = talloc_named(NULL, 0, "bench_indexing_tdb");
+	indexing_path = talloc_asprintf(mem_ctx, "%s/%s/%s", opt_path, BENCH_USERNAME, MAPISTORE_DB_INDEXING);
+	plain_path = talloc_asprintf(mem_ctx, "%s/bench_indexing_plain.tdb", opt_path);
+	synced_path = talloc_asprintf(mem_ctx, "%s/bench_indexing_synced.tdb", opt_path);
+	unlink(indexing_path);
+	unlink(plain_path);
+	unlink(synced_path);
+
+	retval = mapistore_set_mapping_path(opt_path);
+	if (retval != MAPISTORE_SUCCESS) {
+		fprintf(stderr, "Invalid scratch directory %s\n", opt_path);
+		talloc_free(mem_ctx);
+		exit (1);
+	}
+
+	mstore_ctx = talloc_zero(mem_ctx, struct mapistore_context);
+	retval = mapistore_indexing_tdb_init(mstore_ctx, BENCH_USERNAME, &ictx);
+	plain_tdb = tdb_open(plain_path, MAPISTORE_INDEXING_HASH_SIZE, 0, O_RDWR|O_CREAT, 0600);
+	synced_tdb = tdb_open(synced_path, MAPISTORE_INDEXING_HASH_SIZE, 0, O_RDWR|O_CREAT, 0600);
+	if (retval != MAPISTORE_SUCCESS || !plain_tdb || !synced_tdb) {
+		fprintf(stderr, "Unable to open the scratch databases in %s\n", opt_path);
+		exit (1);
+	}
+
+	/* Deleting needs the records added and updated first */
+	for (op = BENCH_ADD; op < BENCH_OPS; op++) {
+		backend[op] = bench_backend(ictx, op, opt_count, &failures);
+		plain[op] = bench_plain(plain_tdb, op, false, opt_count, &failures);
+		synced[op] = bench_plain(synced_tdb, op, true, opt_count, &failures);
+	}
+
+	printf("%u fmids, %u per folder\n", opt_count, BENCH_FOLDER_MESSAGES);
+	printf("%10s %14s %14s %14s\n", "operation", "plain (ns)", "backend (ns)", "synced (ns)");
+	for (op = BENCH_ADD; op < BENCH_OPS; op++) {
+		printf("%10s %14"PRIu64" %14"PRIu64" %14"PRIu64"\n", bench_op_names[op],
+		       plain[op] / opt_count, backend[op] / opt_count, synced[op] / opt_count);
+	}
+	if (failures) {
+		printf("%u operations failed\n", failures);
+	}
+
+	tdb_close(plain_tdb);
+	tdb_close(synced_tdb);
+	talloc_free(mem_ctx);
+	unlink(indexing_path);
+	unlink(plain_path);
+	unlink(synced_path);
+
+	return failures ? 1 : 0;
+}
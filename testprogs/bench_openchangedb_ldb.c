@@ -0,0 +1,240 @@
+/*
+   Benchmark openchangedb LDB lookups with and without attribute indexes
+
+   OpenChange Project
+
+   This program is free software; you can redistribute it and/or modify
+   it under the terms of the GNU General Public License as published by
+   the Free Software Foundation; either version 3 of the License, or
+   (at your option) any later version.
+
+   This program is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+   GNU General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+/*
+  This program measures the searches done by the openchangedb LDB
+  backend against mailboxes of growing size. Each size is first
+  searched as databases were provisioned before (only cn indexed, so
+  every search scans the whole database) and then again once
+  openchangedb_ldb_update_indexes has indexed the searched attributes.
+ */
+
+#include "libmapi/libmapi.h"
+#include "mapiproxy/libmapiproxy/backends/openchangedb_ldb.h"
+#include "testprogs/bench_common.h"
+#include "utils/openchange-tools.h"
+
+#include <talloc.h>
+#include <inttypes.h>
+#include <unistd.h>
+#include <ldb.h>
+
+#define	BENCH_BASEDN		"CN=bench,CN=First Organization,CN=OpenChange"
+#define	BENCH_FOLDER_MESSAGES	4
+
+static int bench_add(struct ldb_context *ldb_ctx, TALLOC_CTX *mem_ctx, const char *dn,
+		     const char *object_class, uint64_t id, uint64_t parent_id, bool folder)
+{
+	struct ldb_message	*msg;
+	int			ret;
+
+	msg = ldb_msg_new(mem_ctx);
+	if (!msg) return LDB_ERR_OPERATIONS_ERROR;
+
+	msg->dn = ldb_dn_new(msg, ldb_ctx, dn);
+	ldb_msg_add_string(msg, "objectClass", object_class);
+	ldb_msg_add_fmt(msg, "cn", "%"PRIu64, id);
+	ldb_msg_add_fmt(msg, "PidTagParentFolderId", "%"PRIu64, parent_id);
+	if (folder) {
+		ldb_msg_add_fmt(msg, "PidTagFolderId", "%"PRIu64, id);
+		ldb_msg_add_fmt(msg, "PidTagDisplayName", "Folder %"PRIu64, id);
+		ldb_msg_add_fmt(msg, "MAPIStoreURI", "sogo://bench@mail/folder%"PRIu64"/", id);
+	} else {
+		ldb_msg_add_fmt(msg, "PidTagMessageId", "%"PRIu64, id);
+		ldb_msg_add_fmt(msg, "PidTagNormalizedSubject", "Message %"PRIu64, id);
+	}
+	ret = ldb_add(ldb_ctx, msg);
+	talloc_free(msg);
+
+	return ret;
+}
+
+/* Mailbox of count folders holding a few messages each */
+static struct ldb_context *bench_populate(TALLOC_CTX *mem_ctx, const char *path, uint32_t count)
+{
+	struct ldb_context	*ldb_ctx;
+	struct ldb_message	*msg;
+	char			*dn;
+	uint64_t		fid;
+	uint32_t		i, j;
+	int			ret;
+
+	unlink(path);
+	ldb_ctx = ldb_init(mem_ctx, NULL);
+	if (!ldb_ctx) return NULL;
+	if (ldb_connect(ldb_ctx, path, 0, NULL) != LDB_SUCCESS) return NULL;
+
+	/* Index list of the databases provisioned so far */
+	msg = ldb_msg_new(mem_ctx);
+	msg->dn = ldb_dn_new(msg, ldb_ctx, "@INDEXLIST");
+	ldb_msg_add_string(msg, "@IDXATTR", "cn");
+	ret = ldb_add(ldb_ctx, msg);
+	talloc_free(msg);
+	if (ret != LDB_SUCCESS) return NULL;
+
+	ldb_transaction_start(ldb_ctx);
+	ret = bench_add(ldb_ctx, mem_ctx, BENCH_BASEDN, "mailbox", 1, 0, true);
+	for (i = 0; ret == LDB_SUCCESS && i < count; i++) {
+		fid = 0x10000 + i;
+		dn = talloc_asprintf(mem_ctx, "CN=%"PRIu64",%s", fid, BENCH_BASEDN);
+		ret = bench_add(ldb_ctx, mem_ctx, dn, "systemfolder", fid, 1, true);
+		for (j = 0; ret == LDB_SUCCESS && j < BENCH_FOLDER_MESSAGES; j++) {
+			ret = bench_add(ldb_ctx, mem_ctx,
+					talloc_asprintf(mem_ctx, "CN=%"PRIu64",%s", fid * 16 + j, dn),
+					"systemMessage", fid * 16 + j, fid, false);
+		}
+		talloc_free(dn);
+	}
+	if (ret != LDB_SUCCESS) {
+		fprintf(stderr, "Unable to populate %s: %s\n", path, ldb_errstring(ldb_ctx));
+		ldb_transaction_cancel(ldb_ctx);
+		return NULL;
+	}
+	ldb_transaction_commit(ldb_ctx);
+
+	return ldb_ctx;
+}
+
+/* Searches shaped like the ones of openchangedb_ldb.c */
+static uint64_t bench_run(struct ldb_context *ldb_ctx, uint32_t iterations, uint32_t count,
+			  uint32_t *failures)
+{
+	TALLOC_CTX		*mem_ctx;
+	struct ldb_result	*res;
+	struct ldb_dn		*basedn;
+	const char * const	attrs[] = { "*", NULL };
+	uint64_t		start;
+	uint64_t		fid;
+	uint32_t		i;
+	int			ret;
+
+	*failures = 0;
+	start = bench_now();
+	for (i = 0; i < iterations; i++) {
+		mem_ctx = talloc_new(NULL);
+		basedn = ldb_dn_new(mem_ctx, ldb_ctx, BENCH_BASEDN);
+		fid = 0x10000 + (i * 7919) % count;
+		switch (i % 3) {
+		case 0:
+			ret = ldb_search(ldb_ctx, mem_ctx, &res, basedn, LDB_SCOPE_SUBTREE, attrs,
+					 "(PidTagFolderId=%"PRIu64")", fid);
+			break;
+		case 1:
+			ret = ldb_search(ldb_ctx, mem_ctx, &res, basedn, LDB_SCOPE_SUBTREE, attrs,
+					 "(&(PidTagParentFolderId=%"PRIu64")(PidTagMessageId=%"PRIu64"))",
+					 fid, fid * 16 + 1);
+			break;
+		default:
+			ret = ldb_search(ldb_ctx, mem_ctx, &res, basedn, LDB_SCOPE_SUBTREE, attrs,
+					 "(MAPIStoreURI=sogo://bench@mail/folder%"PRIu64"/)", fid);
+			break;
+		}
+		if (ret != LDB_SUCCESS || res->count != 1) {
+			(*failures)++;
+		}
+		talloc_free(mem_ctx);
+	}
+
+	return bench_now() - start;
+}
+
+int main(int argc, const char *argv[])
+{
+	TALLOC_CTX		*mem_ctx;
+	poptContext		pc;
+	int			opt;
+	struct ldb_context	*ldb_ctx;
+	const char		*opt_path = "/tmp/bench_openchangedb_ldb.ldb";
+	uint32_t		opt_iterations = 1000;
+	uint32_t		opt_min = 100;
+	uint32_t		opt_max = 10000;
+	uint32_t		failures_before;
+	uint32_t		failures_after;
+	uint32_t		count;
+	uint64_t		before;
+	uint64_t		after;
+
+	enum {OPT_PATH=1000, OPT_ITERATIONS, OPT_MIN, OPT_MAX};
+
+	struct poptOption long_options[] = {
+		POPT_AUTOHELP
+		{"path", 'p', POPT_ARG_STRING, NULL, OPT_PATH, "set the scratch database path", "PATH"},
+		{"iterations", 'i', POPT_ARG_STRING, NULL, OPT_ITERATIONS, "set the number of lookups per size", "COUNT"},
+		{"min", 0, POPT_ARG_STRING, NULL, OPT_MIN, "set the smallest number of folders", "COUNT"},
+		{"max", 0, POPT_ARG_STRING, NULL, OPT_MAX, "set the largest number of folders", "COUNT"},
+		POPT_OPENCHANGE_VERSION
+		{ NULL, 0, POPT_ARG_NONE, NULL, 0, NULL, NULL }
+	};
+
+	pc = poptGetContext("bench_openchangedb_ldb", argc, argv, long_options, 0);
+
+	while ((opt = poptGetNextOpt(pc)) != -1) {
+		switch (opt) {
+		case OPT_PATH:
+			opt_path = poptGetOptArg(pc);
+			break;
+		case OPT_ITERATIONS:
+			opt_iterations = strtoul(poptGetOptArg(pc), NULL, 10);
+			break;
+		case OPT_MIN:
+			opt_min = strtoul(poptGetOptArg(pc), NULL, 10);
+			break;
+		case OPT_MAX:
+			opt_max = strtoul(poptGetOptArg(pc), NULL, 10);
+			break;
+		}
+	}
+	poptFreeContext(pc);
+
+	if (!opt_iterations || !opt_min || opt_min > opt_max) {
+		fprintf(stderr, "At least one iteration and a valid range of folders are required\n");
+		exit (1);
+	}
+
+	printf("%u lookups per mailbox, %u messages per folder\n", opt_iterations, BENCH_FOLDER_MESSAGES);
+	printf("%10s %18s %18s\n", "folders", "cn index (ns)", "all indexes (ns)");
+	for (count = opt_min; count <= opt_max; count *= 10) {
+		mem_ctx = talloc_new(NULL);
+		ldb_ctx = bench_populate(mem_ctx, opt_path, count);
+		if (!ldb_ctx) {
+			talloc_free(mem_ctx);
+			unlink(opt_path);
+			exit (1);
+		}
+
+		before = bench_run(ldb_ctx, opt_iterations, count, &failures_before);
+		if (openchangedb_ldb_update_indexes(ldb_ctx, NULL) != MAPI_E_SUCCESS) {
+			fprintf(stderr, "Unable to index %s\n", opt_path);
+			talloc_free(mem_ctx);
+			unlink(opt_path);
+			exit (1);
+		}
+		after = bench_run(ldb_ctx, opt_iterations, count, &failures_after);
+
+		printf("%10u %18"PRIu64" %18"PRIu64"%s\n", count,
+		       before / opt_iterations, after / opt_iterations,
+		       (failures_before || failures_after) ? " (lookups failed)" : "");
+
+		talloc_free(mem_ctx);
+		if (count > UINT32_MAX / 10) break;
+	}
+	unlink(opt_path);
+
+	return 0;
+}
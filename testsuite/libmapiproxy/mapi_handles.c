@@ -0,0 +1,188 @@
+/*
+   MAPI handles Unit Testing
+
+   OpenChange Project
+
+   This program is free software; you can redistribute it and/or modify
+   it under the terms of the GNU General Public License as published by
+   the Free Software Foundation; either version 3 of the License, or
+   (at your option) any later version.
+
+   This program is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+   GNU General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "testsuite.h"
+#include "mapiproxy/libmapiproxy/libmapiproxy.h"
+#include "libmapi/libmapi.h"
+#include "libmapi/libmapi_private.h"
+
+#define CHECK_SUCCESS(fncall) do { \
+	enum MAPISTATUS ret = fncall; \
+	ck_assert_int_eq(ret, MAPI_E_SUCCESS); \
+} while(0)
+
+/* Global test variables */
+static TALLOC_CTX			*mem_ctx;
+static struct mapi_handles_context	*handles_ctx;
+
+// v Unit test ----------------------------------------------------------------
+
+START_TEST (test_add_search) {
+	struct mapi_handles	*rec = NULL;
+	struct mapi_handles	*found = NULL;
+	uint32_t		handle;
+
+	CHECK_SUCCESS(mapi_handles_add(handles_ctx, 0, &rec));
+	ck_assert(rec != NULL);
+	ck_assert_int_ne(rec->handle, 0);
+	ck_assert_int_ne(rec->handle, MAPI_HANDLES_RESERVED);
+	ck_assert_int_eq(rec->parent_handle, 0);
+	handle = rec->handle;
+
+	CHECK_SUCCESS(mapi_handles_search(handles_ctx, handle, &found));
+	ck_assert(found == rec);
+
+	ck_assert_int_eq(mapi_handles_search(handles_ctx, handle + 1, &found), MAPI_E_NOT_FOUND);
+	ck_assert_int_eq(mapi_handles_search(handles_ctx, MAPI_HANDLES_RESERVED, &found), MAPI_E_INVALID_PARAMETER);
+	ck_assert_int_eq(handles_ctx->handles_count, 1);
+} END_TEST
+
+START_TEST (test_stale_handle) {
+	struct mapi_handles	*rec = NULL;
+	uint32_t		handle;
+
+	CHECK_SUCCESS(mapi_handles_add(handles_ctx, 0, &rec));
+	handle = rec->handle;
+	CHECK_SUCCESS(mapi_handles_delete(handles_ctx, handle));
+
+	/* The slot is reused but the handle value must differ */
+	CHECK_SUCCESS(mapi_handles_add(handles_ctx, 0, &rec));
+	ck_assert_int_eq(rec->handle & MAPI_HANDLES_INDEX_MASK, handle & MAPI_HANDLES_INDEX_MASK);
+	ck_assert_int_ne(rec->handle, handle);
+
+	ck_assert_int_eq(mapi_handles_search(handles_ctx, handle, &rec), MAPI_E_NOT_FOUND);
+	ck_assert_int_eq(mapi_handles_delete(handles_ctx, handle), MAPI_E_NOT_FOUND);
+} END_TEST
+
+START_TEST (test_grow) {
+	struct mapi_handles	*rec = NULL;
+	uint32_t		handles[MAPI_HANDLES_INITIAL_SLOTS * 4];
+	uint32_t		i;
+
+	for (i = 0; i < MAPI_HANDLES_INITIAL_SLOTS * 4; i++) {
+		CHECK_SUCCESS(mapi_handles_add(handles_ctx, 0, &rec));
+		handles[i] = rec->handle;
+	}
+	ck_assert_int_eq(handles_ctx->handles_count, MAPI_HANDLES_INITIAL_SLOTS * 4);
+
+	for (i = 0; i < MAPI_HANDLES_INITIAL_SLOTS * 4; i++) {
+		CHECK_SUCCESS(mapi_handles_search(handles_ctx, handles[i], &rec));
+		ck_assert_int_eq(rec->handle, handles[i]);
+	}
+} END_TEST
+
+START_TEST (test_delete_children) {
+	struct mapi_handles	*rec = NULL;
+	uint32_t		folder;
+	uint32_t		message;
+	uint32_t		attachment;
+	uint32_t		other;
+
+	CHECK_SUCCESS(mapi_handles_add(handles_ctx, 0, &rec));
+	folder = rec->handle;
+	CHECK_SUCCESS(mapi_handles_add(handles_ctx, folder, &rec));
+	message = rec->handle;
+	CHECK_SUCCESS(mapi_handles_add(handles_ctx, message, &rec));
+	attachment = rec->handle;
+	CHECK_SUCCESS(mapi_handles_add(handles_ctx, 0, &rec));
+	other = rec->handle;
+
+	CHECK_SUCCESS(mapi_handles_delete(handles_ctx, folder));
+
+	ck_assert_int_eq(mapi_handles_search(handles_ctx, folder, &rec), MAPI_E_NOT_FOUND);
+	ck_assert_int_eq(mapi_handles_search(handles_ctx, message, &rec), MAPI_E_NOT_FOUND);
+	ck_assert_int_eq(mapi_handles_search(handles_ctx, attachment, &rec), MAPI_E_NOT_FOUND);
+	CHECK_SUCCESS(mapi_handles_search(handles_ctx, other, &rec));
+	ck_assert_int_eq(handles_ctx->handles_count, 1);
+	ck_assert(rec->children == NULL);
+} END_TEST
+
+START_TEST (test_delete_subtree_stats) {
+	struct mapi_handles		*rec = NULL;
+	struct mapi_handles		*folder = NULL;
+	struct mapi_handles_stats	stats;
+	uint32_t			message;
+	uint32_t			i;
+
+	CHECK_SUCCESS(mapi_handles_add(handles_ctx, 0, &folder));
+	for (i = 0; i < 10; i++) {
+		CHECK_SUCCESS(mapi_handles_add(handles_ctx, folder->handle, &rec));
+		ck_assert(rec->parent == folder);
+		message = rec->handle;
+		CHECK_SUCCESS(mapi_handles_add(handles_ctx, message, &rec));
+		CHECK_SUCCESS(mapi_handles_add(handles_ctx, message, &rec));
+	}
+	ck_assert_int_eq(handles_ctx->handles_count, 31);
+
+	/* Releasing a leaf only releases itself and unlinks it from its parent */
+	CHECK_SUCCESS(mapi_handles_delete(handles_ctx, rec->handle));
+	CHECK_SUCCESS(mapi_handles_search(handles_ctx, message, &rec));
+	ck_assert(rec->children != NULL);
+	ck_assert(rec->children->sibling_next == NULL);
+	CHECK_SUCCESS(mapi_handles_get_stats(handles_ctx, &stats));
+	ck_assert_int_eq(stats.release_calls, 1);
+	ck_assert_int_eq(stats.last_fanout, 1);
+
+	CHECK_SUCCESS(mapi_handles_delete(handles_ctx, folder->handle));
+	ck_assert_int_eq(handles_ctx->handles_count, 0);
+	ck_assert(handles_ctx->handles == NULL);
+
+	CHECK_SUCCESS(mapi_handles_get_stats(handles_ctx, &stats));
+	ck_assert_int_eq(stats.release_calls, 2);
+	ck_assert_int_eq(stats.released_handles, 31);
+	ck_assert_int_eq(stats.last_fanout, 30);
+	ck_assert_int_eq(stats.max_fanout, 30);
+} END_TEST
+
+// ^ unit tests ---------------------------------------------------------------
+
+// v suite definition ---------------------------------------------------------
+
+static void mapi_handles_setup(void)
+{
+	mem_ctx = talloc_new(NULL);
+	handles_ctx = mapi_handles_init(mem_ctx);
+	ck_assert(handles_ctx != NULL);
+}
+
+static void mapi_handles_teardown(void)
+{
+	talloc_free(mem_ctx);
+}
+
+Suite *mapiproxy_mapi_handles_suite(void)
+{
+	Suite	*s;
+	TCase	*tc;
+
+	s = suite_create("libmapiproxy: MAPI handles");
+
+	tc = tcase_create("MAPI handles interface");
+	tcase_add_checked_fixture(tc, mapi_handles_setup, mapi_handles_teardown);
+
+	tcase_add_test(tc, test_add_search);
+	tcase_add_test(tc, test_stale_handle);
+	tcase_add_test(tc, test_grow);
+	tcase_add_test(tc, test_delete_children);
+	tcase_add_test(tc, test_delete_subtree_stats);
+
+	suite_add_tcase(s, tc);
+
+	return s;
+}
@@ -428,6 +428,31 @@ START_TEST (test_get_folder_property) {
 	ck_assert_int_eq(46, ((struct Binary_r *)data)->cb);
 } END_TEST
 
+START_TEST (test_get_folder_properties) {
+	struct SPropTagArray	properties;
+	enum MAPITAGS		proptags[3];
+	void			*data[3];
+	enum MAPISTATUS		retvals[3];
+	uint64_t		fid;
+
+	proptags[0] = PidTagDisplayName;
+	proptags[1] = PidTagRights;
+	proptags[2] = PidTagComment;
+	properties.cValues = 3;
+	properties.aulPropTag = proptags;
+
+	fid = 14124414331340718081ul;
+	retval = openchangedb_get_folder_properties(g_mem_ctx, g_oc_ctx, USER1, fid,
+						    &properties, data, retvals);
+	CHECK_SUCCESS;
+	ck_assert_int_eq(MAPI_E_SUCCESS, retvals[0]);
+	ck_assert_str_eq("A3", (char *)data[0]);
+	ck_assert_int_eq(MAPI_E_SUCCESS, retvals[1]);
+	ck_assert_int_eq(2043, *(int *)data[1]);
+	ck_assert_int_eq(MAPI_E_NOT_FOUND, retvals[2]);
+	ck_assert(data[2] == NULL);
+} END_TEST
+
 START_TEST (test_get_public_folder_property) {
 	void *data;
 	uint32_t proptag;
@@ -1225,6 +1250,58 @@ START_TEST (test_build_table_folders_live_filtering) {
 	ck_assert_str_eq("Schedule", (char *)data);
 } END_TEST
 
+START_TEST (test_build_table_folders_live_filtering_after_change) {
+	void *table, *data;
+	uint64_t fid, row_fid = 0;
+	uint32_t i;
+	struct mapi_SRestriction res;
+	struct SRow *row = talloc_zero(g_mem_ctx, struct SRow);
+	int idx = -1;
+
+	fid = 17438782182108692481ul;
+	retval = openchangedb_table_init(g_mem_ctx, g_oc_ctx, USER1, 1, fid, &table);
+	CHECK_SUCCESS;
+
+	res.rt = RES_PROPERTY;
+	res.res.resProperty.ulPropTag = PidTagDisplayName;
+	res.res.resProperty.lpProp.ulPropTag = PidTagDisplayName;
+	res.res.resProperty.lpProp.value.lpszW = "Schedule";
+	openchangedb_table_set_restrictions(g_oc_ctx, table, &res);
+	CHECK_SUCCESS;
+
+	for (i = 0; i < 13; i++) {
+		retval = openchangedb_table_get_property(g_mem_ctx, g_oc_ctx, table,
+							 PidTagFolderId, i, true, &data);
+		if (retval == MAPI_E_SUCCESS) {
+			idx = i;
+			row_fid = *(uint64_t *)data;
+		}
+	}
+	ck_assert_int_ne(-1, idx);
+
+	// The row stops matching once its properties change
+	row->cValues = 1;
+	row->lpProps = talloc_zero(g_mem_ctx, struct SPropValue);
+	row->lpProps[0].ulPropTag = PidTagDisplayName;
+	row->lpProps[0].value.lpszW = talloc_strdup(g_mem_ctx, "Not Schedule");
+	retval = openchangedb_set_folder_properties(g_oc_ctx, USER1, row_fid, row);
+	CHECK_SUCCESS;
+
+	retval = openchangedb_table_get_property(g_mem_ctx, g_oc_ctx, table,
+						 PidTagDisplayName, idx, true, &data);
+	ck_assert_int_eq(retval, MAPI_E_INVALID_OBJECT);
+
+	// And matches again once they are restored
+	row->lpProps[0].value.lpszW = talloc_strdup(g_mem_ctx, "Schedule");
+	retval = openchangedb_set_folder_properties(g_oc_ctx, USER1, row_fid, row);
+	CHECK_SUCCESS;
+
+	retval = openchangedb_table_get_property(g_mem_ctx, g_oc_ctx, table,
+						 PidTagDisplayName, idx, true, &data);
+	CHECK_SUCCESS;
+	ck_assert_str_eq("Schedule", (char *)data);
+} END_TEST
+
 START_TEST (test_set_locale) {
 	ck_assert(openchangedb_set_locale(g_oc_ctx, USER1, 0x1001));
 	ck_assert(!openchangedb_set_locale(g_oc_ctx, USER1, 0x1001));
@@ -1281,6 +1358,39 @@ START_TEST (test_get_indexing_url) {
 	ck_assert_int_eq(retval, MAPI_E_NOT_FOUND);
 } END_TEST
 
+START_TEST (test_ldb_indexes) {
+	struct ldb_context		*ldb_ctx = g_oc_ctx->data;
+	struct ldb_result		*res = NULL;
+	struct ldb_message_element	*el;
+	const char * const		attrs[] = { "@IDXATTR", NULL };
+	uint32_t			added = 0;
+	uint32_t			i;
+	bool				found = false;
+	int				ret;
+
+	/* The sample database only indexes cn, the rest is added on startup */
+	ret = ldb_search(ldb_ctx, g_mem_ctx, &res, ldb_dn_new(g_mem_ctx, ldb_ctx, "@INDEXLIST"),
+			 LDB_SCOPE_BASE, attrs, NULL);
+	ck_assert_int_eq(ret, LDB_SUCCESS);
+	ck_assert_int_eq(res->count, 1);
+	el = ldb_msg_find_element(res->msgs[0], "@IDXATTR");
+	ck_assert(el != NULL);
+	for (i = 0; i < el->num_values; i++) {
+		if (!strcmp((const char *)el->values[i].data, "PidTagParentFolderId")) {
+			found = true;
+		}
+	}
+	ck_assert(found);
+
+	/* Existing indexes are left alone */
+	retval = openchangedb_ldb_update_indexes(ldb_ctx, &added);
+	CHECK_SUCCESS;
+	ck_assert_int_eq(added, 0);
+
+	retval = openchangedb_ldb_update_indexes(NULL, &added);
+	CHECK_FAILURE;
+} END_TEST
+
 // ^ Unit test ----------------------------------------------------------------
 
 // v Suite definition ---------------------------------------------------------
@@ -1357,7 +1467,7 @@ static void mysql_setup(void)
 
 static void mysql_teardown(void)
 {
-	drop_mysql_database(g_oc_ctx->data, OC_TESTSUITE_MYSQL_DB);
+	drop_mysql_database(mysql_rw_primary(g_oc_ctx->data), OC_TESTSUITE_MYSQL_DB);
 	talloc_free(g_mem_ctx);
 }
 
@@ -1393,6 +1503,7 @@ static Suite *openchangedb_create_suite(const char *backend_name,
 	tcase_add_test(tc, test_get_new_changeNumbers);
 	tcase_add_test(tc, test_get_next_changeNumber);
 	tcase_add_test(tc, test_get_folder_property);
+	tcase_add_test(tc, test_get_folder_properties);
 	tcase_add_test(tc, test_get_public_folder_property);
 	tcase_add_test(tc, test_set_folder_properties);
 	tcase_add_test(tc, test_set_folder_properties_on_mailbox);
@@ -1425,6 +1536,7 @@ static Suite *openchangedb_create_suite(const char *backend_name,
 	tcase_add_test(tc, test_build_table_folders);
 	tcase_add_test(tc, test_build_table_folders_with_restrictions);
 	tcase_add_test(tc, test_build_table_folders_live_filtering);
+	tcase_add_test(tc, test_build_table_folders_live_filtering_after_change);
 	tcase_add_test(tc, test_get_Transport_folder_when_has_unusual_display_name);
 
 	if (strcmp(backend_name, "MySQL") == 0) {
@@ -1432,6 +1544,8 @@ static Suite *openchangedb_create_suite(const char *backend_name,
 		tcase_add_test(tc, test_set_locale);
 		tcase_add_test(tc, test_get_folders_names);
 		tcase_add_test(tc, test_get_indexing_url);
+	} else {
+		tcase_add_test(tc, test_ldb_indexes);
 	}
 
 	tcase_add_test(tc, test_set_receive_folder_to_mailbox);
@@ -0,0 +1,383 @@
+/*
+   OpenChange Unit Testing
+
+   OpenChange Project
+
+   This program is free software; you can redistribute it and/or modify
+   it under the terms of the GNU General Public License as published by
+   the Free Software Foundation; either version 3 of the License, or
+   (at your option) any later version.
+
+   This program is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+   GNU General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "testsuite.h"
+#include "mapiproxy/libmapiproxy/libmapiproxy.h"
+#include "mapiproxy/libmapiproxy/backends/openchangedb_cache.h"
+#include "libmapi/libmapi.h"
+#include "libmapi/libmapi_private.h"
+#include <inttypes.h>
+
+
+#define FOLDER_ID_EXPECTED 289356276058554369ul
+#define PARENT_FOLDER_ID 289356276058554368ul
+#define MISSING_SYSTEM_IDX 42
+#define MOCKED_URL "mocked_url"
+
+#define CHECK_SUCCESS(fncall) do { \
+	enum MAPISTATUS ret = fncall; \
+	ck_assert_int_eq(ret, MAPI_E_SUCCESS); \
+} while(0)
+#define CHECK_FAILURE(fncall) do { \
+	enum MAPISTATUS ret = fncall; \
+	ck_assert_int_ne(ret, MAPI_E_SUCCESS); \
+} while(0)
+
+
+struct openchangedb_context_checker {
+	int get_SystemFolderID;
+	int get_MailboxReplica;
+	int get_parent_fid;
+	int get_mapistoreURI;
+	int set_mapistoreURI;
+	int set_folder_properties;
+	int create_folder;
+	int delete_folder;
+};
+
+
+static TALLOC_CTX *mem_ctx;
+static struct openchangedb_context *backend_ctx;
+static struct openchangedb_context *oc_ctx;
+static struct openchangedb_context_checker functions_called;
+static struct openchangedb_cache_stats stats_before;
+
+static uint64_t stats_delta(size_t offset)
+{
+	struct openchangedb_cache_stats	stats;
+
+	openchangedb_cache_get_stats(&stats);
+	return *(uint64_t *)((char *)&stats + offset) - *(uint64_t *)((char *)&stats_before + offset);
+}
+
+#define STATS_DELTA(field) stats_delta(offsetof(struct openchangedb_cache_stats, field))
+
+// v Unit test ----------------------------------------------------------------
+
+START_TEST (test_hit) {
+	uint64_t folder_id;
+
+	CHECK_SUCCESS(openchangedb_get_SystemFolderID(oc_ctx, "recipient", 1, &folder_id));
+	CHECK_SUCCESS(openchangedb_get_SystemFolderID(oc_ctx, "recipient", 1, &folder_id));
+
+	ck_assert_int_eq(folder_id, FOLDER_ID_EXPECTED + 1);
+	ck_assert_int_eq(functions_called.get_SystemFolderID, 1);
+	ck_assert_int_eq(STATS_DELTA(hits), 1);
+	ck_assert_int_eq(STATS_DELTA(misses), 1);
+	ck_assert_int_eq(STATS_DELTA(entries), 1);
+
+	/* Entries are per user */
+	CHECK_SUCCESS(openchangedb_get_SystemFolderID(oc_ctx, "other", 1, &folder_id));
+	ck_assert_int_eq(functions_called.get_SystemFolderID, 2);
+} END_TEST
+
+START_TEST (test_failure_not_cached) {
+	uint64_t folder_id;
+
+	CHECK_FAILURE(openchangedb_get_SystemFolderID(oc_ctx, "recipient", MISSING_SYSTEM_IDX, &folder_id));
+	CHECK_FAILURE(openchangedb_get_SystemFolderID(oc_ctx, "recipient", MISSING_SYSTEM_IDX, &folder_id));
+
+	ck_assert_int_eq(functions_called.get_SystemFolderID, 2);
+	ck_assert_int_eq(STATS_DELTA(entries), 0);
+} END_TEST
+
+START_TEST (test_replica) {
+	uint16_t ReplID = 0;
+	struct GUID ReplGUID;
+
+	/* The first caller only wants the GUID, the second the id */
+	CHECK_SUCCESS(openchangedb_get_MailboxReplica(oc_ctx, "recipient", NULL, &ReplGUID));
+	CHECK_SUCCESS(openchangedb_get_MailboxReplica(oc_ctx, "recipient", &ReplID, NULL));
+
+	ck_assert_int_eq(functions_called.get_MailboxReplica, 1);
+	ck_assert_int_eq(ReplID, 1);
+} END_TEST
+
+START_TEST (test_set_mapistoreURI) {
+	char *mapistoreURL;
+
+	CHECK_SUCCESS(openchangedb_get_mapistoreURI(mem_ctx, oc_ctx, "usera", FOLDER_ID_EXPECTED, &mapistoreURL, true));
+	CHECK_SUCCESS(openchangedb_get_mapistoreURI(mem_ctx, oc_ctx, "usera", FOLDER_ID_EXPECTED, &mapistoreURL, true));
+	ck_assert_int_eq(functions_called.get_mapistoreURI, 1);
+	ck_assert_str_eq(mapistoreURL, MOCKED_URL);
+
+	CHECK_SUCCESS(openchangedb_set_mapistoreURI(oc_ctx, "usera", FOLDER_ID_EXPECTED, "mapistoreURL"));
+	ck_assert_int_eq(functions_called.set_mapistoreURI, 1);
+	ck_assert_int_eq(STATS_DELTA(invalidations), 1);
+
+	CHECK_SUCCESS(openchangedb_get_mapistoreURI(mem_ctx, oc_ctx, "usera", FOLDER_ID_EXPECTED, &mapistoreURL, true));
+	ck_assert_int_eq(functions_called.get_mapistoreURI, 2);
+} END_TEST
+
+START_TEST (test_set_folder_properties) {
+	uint64_t parent_fid;
+	char *mapistoreURL;
+	struct SRow row;
+
+	CHECK_SUCCESS(openchangedb_get_parent_fid(oc_ctx, "usera", FOLDER_ID_EXPECTED, &parent_fid, true));
+	CHECK_SUCCESS(openchangedb_get_mapistoreURI(mem_ctx, oc_ctx, "usera", FOLDER_ID_EXPECTED, &mapistoreURL, true));
+	CHECK_SUCCESS(openchangedb_get_mapistoreURI(mem_ctx, oc_ctx, "usera", PARENT_FOLDER_ID, &mapistoreURL, true));
+
+	/* Only the entries of the folder changed are dropped */
+	ZERO_STRUCT(row);
+	CHECK_SUCCESS(openchangedb_set_folder_properties(oc_ctx, "usera", FOLDER_ID_EXPECTED, &row));
+	ck_assert_int_eq(functions_called.set_folder_properties, 1);
+	ck_assert_int_eq(STATS_DELTA(invalidations), 2);
+
+	CHECK_SUCCESS(openchangedb_get_parent_fid(oc_ctx, "usera", FOLDER_ID_EXPECTED, &parent_fid, true));
+	CHECK_SUCCESS(openchangedb_get_mapistoreURI(mem_ctx, oc_ctx, "usera", FOLDER_ID_EXPECTED, &mapistoreURL, true));
+	CHECK_SUCCESS(openchangedb_get_mapistoreURI(mem_ctx, oc_ctx, "usera", PARENT_FOLDER_ID, &mapistoreURL, true));
+	ck_assert_int_eq(functions_called.get_parent_fid, 2);
+	ck_assert_int_eq(functions_called.get_mapistoreURI, 3);
+} END_TEST
+
+START_TEST (test_delete_folder) {
+	uint64_t parent_fid;
+
+	CHECK_SUCCESS(openchangedb_get_parent_fid(oc_ctx, "usera", FOLDER_ID_EXPECTED, &parent_fid, true));
+	ck_assert_int_eq(parent_fid, PARENT_FOLDER_ID);
+
+	/* Deleting the parent drops what is known about its children */
+	CHECK_SUCCESS(openchangedb_delete_folder(oc_ctx, "usera", PARENT_FOLDER_ID));
+	ck_assert_int_eq(functions_called.delete_folder, 1);
+	ck_assert_int_eq(STATS_DELTA(invalidations), 1);
+
+	CHECK_SUCCESS(openchangedb_get_parent_fid(oc_ctx, "usera", FOLDER_ID_EXPECTED, &parent_fid, true));
+	ck_assert_int_eq(functions_called.get_parent_fid, 2);
+} END_TEST
+
+START_TEST (test_create_folder) {
+	uint64_t folder_id;
+	uint64_t parent_fid;
+
+	CHECK_SUCCESS(openchangedb_get_SystemFolderID(oc_ctx, "usera", 1, &folder_id));
+	CHECK_SUCCESS(openchangedb_get_SystemFolderID(oc_ctx, "userb", 1, &folder_id));
+	CHECK_SUCCESS(openchangedb_get_parent_fid(oc_ctx, "usera", FOLDER_ID_EXPECTED, &parent_fid, true));
+
+	/* A plain folder leaves the system folders alone */
+	CHECK_SUCCESS(openchangedb_create_folder(oc_ctx, "usera", PARENT_FOLDER_ID, 0x42, 1, MOCKED_URL, 0));
+	ck_assert_int_eq(STATS_DELTA(invalidations), 0);
+
+	/* A system folder drops the entries of its user only */
+	CHECK_SUCCESS(openchangedb_create_folder(oc_ctx, "usera", PARENT_FOLDER_ID, 0x43, 2, MOCKED_URL, 1));
+	ck_assert_int_eq(functions_called.create_folder, 2);
+	ck_assert_int_eq(STATS_DELTA(invalidations), 2);
+
+	CHECK_SUCCESS(openchangedb_get_SystemFolderID(oc_ctx, "usera", 1, &folder_id));
+	CHECK_SUCCESS(openchangedb_get_SystemFolderID(oc_ctx, "userb", 1, &folder_id));
+	ck_assert_int_eq(functions_called.get_SystemFolderID, 3);
+} END_TEST
+
+START_TEST (test_eviction) {
+	struct openchangedb_context *small_ctx;
+	uint64_t folder_id;
+
+	CHECK_SUCCESS(openchangedb_cache_initialize(mem_ctx, 2, 300, backend_ctx, &small_ctx));
+
+	CHECK_SUCCESS(openchangedb_get_SystemFolderID(small_ctx, "recipient", 1, &folder_id));
+	CHECK_SUCCESS(openchangedb_get_SystemFolderID(small_ctx, "recipient", 2, &folder_id));
+	/* Make 1 the most recently used, so 2 is evicted */
+	CHECK_SUCCESS(openchangedb_get_SystemFolderID(small_ctx, "recipient", 1, &folder_id));
+	CHECK_SUCCESS(openchangedb_get_SystemFolderID(small_ctx, "recipient", 3, &folder_id));
+	ck_assert_int_eq(functions_called.get_SystemFolderID, 3);
+	ck_assert_int_eq(STATS_DELTA(evictions), 1);
+	ck_assert_int_eq(STATS_DELTA(entries), 2);
+
+	CHECK_SUCCESS(openchangedb_get_SystemFolderID(small_ctx, "recipient", 1, &folder_id));
+	ck_assert_int_eq(functions_called.get_SystemFolderID, 3);
+	CHECK_SUCCESS(openchangedb_get_SystemFolderID(small_ctx, "recipient", 2, &folder_id));
+	ck_assert_int_eq(functions_called.get_SystemFolderID, 4);
+
+	talloc_free(small_ctx);
+	ck_assert_int_eq(STATS_DELTA(entries), 0);
+} END_TEST
+
+START_TEST (test_ttl) {
+	struct openchangedb_context *expired_ctx;
+	uint64_t folder_id;
+
+	/* Entries of a zero TTL are stale as soon as they are added */
+	CHECK_SUCCESS(openchangedb_cache_initialize(mem_ctx, 16, 0, backend_ctx, &expired_ctx));
+
+	CHECK_SUCCESS(openchangedb_get_SystemFolderID(expired_ctx, "recipient", 1, &folder_id));
+	CHECK_SUCCESS(openchangedb_get_SystemFolderID(expired_ctx, "recipient", 1, &folder_id));
+	ck_assert_int_eq(functions_called.get_SystemFolderID, 2);
+	ck_assert_int_eq(STATS_DELTA(expirations), 1);
+	ck_assert_int_eq(STATS_DELTA(hits), 0);
+
+	talloc_free(expired_ctx);
+} END_TEST
+
+// ^ Unit test ----------------------------------------------------------------
+
+
+// v Mocked backend ----------------------------------------------------------------
+static enum MAPISTATUS get_SystemFolderID(struct openchangedb_context *self,
+					  const char *recipient, uint32_t SystemIdx,
+					  uint64_t *FolderId)
+{
+	functions_called.get_SystemFolderID++;
+	if (SystemIdx == MISSING_SYSTEM_IDX) {
+		return MAPI_E_NOT_FOUND;
+	}
+	*FolderId = FOLDER_ID_EXPECTED + SystemIdx;
+
+	return MAPI_E_SUCCESS;
+}
+
+static enum MAPISTATUS get_MailboxReplica(struct openchangedb_context *self,
+					  const char *recipient, uint16_t *ReplID,
+					  struct GUID *ReplGUID)
+{
+	functions_called.get_MailboxReplica++;
+	if (ReplID) *ReplID = 1;
+	if (ReplGUID) ZERO_STRUCTP(ReplGUID);
+
+	return MAPI_E_SUCCESS;
+}
+
+static enum MAPISTATUS get_parent_fid(struct openchangedb_context *self,
+				      const char *username, uint64_t fid,
+				      uint64_t *parent_fidp, bool mailboxstore)
+{
+	functions_called.get_parent_fid++;
+	*parent_fidp = PARENT_FOLDER_ID;
+	return MAPI_E_SUCCESS;
+}
+
+static enum MAPISTATUS get_mapistoreURI(TALLOC_CTX *parent_ctx,
+					struct openchangedb_context *self,
+					const char *username,
+					uint64_t fid, char **mapistoreURL,
+					bool mailboxstore)
+{
+	functions_called.get_mapistoreURI++;
+	*mapistoreURL = talloc_strdup(parent_ctx, MOCKED_URL);
+	return MAPI_E_SUCCESS;
+}
+
+static enum MAPISTATUS set_mapistoreURI(struct openchangedb_context *self,
+					const char *username, uint64_t fid,
+					const char *mapistoreURL)
+{
+	functions_called.set_mapistoreURI++;
+	return MAPI_E_SUCCESS;
+}
+
+static enum MAPISTATUS set_folder_properties(struct openchangedb_context *self,
+					     const char *username, uint64_t fid,
+					     struct SRow *row)
+{
+	functions_called.set_folder_properties++;
+	return MAPI_E_SUCCESS;
+}
+
+static enum MAPISTATUS create_folder(struct openchangedb_context *self,
+				     const char *username,
+				     uint64_t parentFolderID, uint64_t fid,
+				     uint64_t changeNumber,
+				     const char *MAPIStoreURI, int systemIdx)
+{
+	functions_called.create_folder++;
+	return MAPI_E_SUCCESS;
+}
+
+static enum MAPISTATUS delete_folder(struct openchangedb_context *self,
+				     const char *username, uint64_t fid)
+{
+	functions_called.delete_folder++;
+	return MAPI_E_SUCCESS;
+}
+
+/* Only the functions exercised above are mocked */
+static enum MAPISTATUS mock_backend_init(TALLOC_CTX *mem_ctx,
+					 struct openchangedb_context **ctx)
+{
+	struct openchangedb_context	*oc_ctx = talloc_zero(mem_ctx, struct openchangedb_context);
+
+	OPENCHANGE_RETVAL_IF(oc_ctx == NULL, MAPI_E_NOT_ENOUGH_RESOURCES, NULL);
+
+	oc_ctx->backend_type = talloc_strdup(oc_ctx, "mocked_backend");
+	OPENCHANGE_RETVAL_IF(oc_ctx->backend_type == NULL, MAPI_E_NOT_ENOUGH_RESOURCES, oc_ctx);
+
+	oc_ctx->get_SystemFolderID = get_SystemFolderID;
+	oc_ctx->get_MailboxReplica = get_MailboxReplica;
+	oc_ctx->get_parent_fid = get_parent_fid;
+	oc_ctx->get_mapistoreURI = get_mapistoreURI;
+	oc_ctx->set_mapistoreURI = set_mapistoreURI;
+	oc_ctx->set_folder_properties = set_folder_properties;
+	oc_ctx->create_folder = create_folder;
+	oc_ctx->delete_folder = delete_folder;
+
+	*ctx = oc_ctx;
+
+	return MAPI_E_SUCCESS;
+}
+// ^ Mocked backend ----------------------------------------------------------------
+
+// v Suite definition ---------------------------------------------------------
+
+static void ocdb_cache_setup(void)
+{
+	enum MAPISTATUS mapi_status;
+
+	mem_ctx = talloc_new(NULL);
+
+	mapi_status = mock_backend_init(mem_ctx, &backend_ctx);
+	if (mapi_status != MAPI_E_SUCCESS) {
+		fprintf(stderr, "Failed to initialize Mocked backend %d\n", mapi_status);
+		ck_abort();
+	}
+	mapi_status = openchangedb_cache_initialize(mem_ctx, OPENCHANGEDB_CACHE_DEFAULT_SIZE,
+						    OPENCHANGEDB_CACHE_DEFAULT_TTL, backend_ctx, &oc_ctx);
+	if (mapi_status != MAPI_E_SUCCESS) {
+		fprintf(stderr, "Failed to initialize Cache backend %d\n", mapi_status);
+		ck_abort();
+	}
+
+	ZERO_STRUCT(functions_called);
+	openchangedb_cache_get_stats(&stats_before);
+}
+
+static void ocdb_cache_teardown(void)
+{
+	talloc_free(mem_ctx);
+}
+
+
+Suite *mapiproxy_openchangedb_cache_suite(void)
+{
+	Suite *s = suite_create("Openchangedb Cache backend");
+
+	TCase *tc = tcase_create("Openchangedb Cache interface");
+	tcase_add_checked_fixture(tc, ocdb_cache_setup, ocdb_cache_teardown);
+
+	tcase_add_test(tc, test_hit);
+	tcase_add_test(tc, test_failure_not_cached);
+	tcase_add_test(tc, test_replica);
+	tcase_add_test(tc, test_set_mapistoreURI);
+	tcase_add_test(tc, test_set_folder_properties);
+	tcase_add_test(tc, test_delete_folder);
+	tcase_add_test(tc, test_create_folder);
+	tcase_add_test(tc, test_eviction);
+	tcase_add_test(tc, test_ttl);
+
+	suite_add_tcase(s, tc);
+	return s;
+}
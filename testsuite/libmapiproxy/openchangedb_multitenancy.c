@@ -496,6 +496,34 @@ START_TEST (test_get_next_changeNumber) {
 	}
 } END_TEST
 
+START_TEST (test_get_new_changeNumber_from_zero) {
+	MYSQL *conn = mysql_rw_primary(g_oc_ctx->data);
+	uint64_t cn = 0, saved = 0;
+	const char *server = "UPDATE servers s "
+		"JOIN mailboxes m ON m.ou_id = s.ou_id AND m.name = '"USER1"' "
+		"SET s.change_number = ";
+	char sql[256];
+
+	ck_assert(select_first_uint(conn,
+		"SELECT s.change_number FROM servers s "
+		"JOIN mailboxes m ON m.ou_id = s.ou_id AND m.name = '"USER1"'",
+		&saved) == MYSQL_SUCCESS);
+	snprintf(sql, sizeof(sql), "%s0", server);
+	ck_assert(execute_query(conn, sql) == MYSQL_SUCCESS);
+
+	ret = openchangedb_get_new_changeNumber(g_oc_ctx, USER1, &cn);
+	CHECK_SUCCESS;
+	ck_assert(cn == ((exchange_globcnt(0) << 16) | 0x0001));
+
+	ret = openchangedb_get_new_changeNumber(g_oc_ctx, "nobody@foobar.com", &cn);
+	ck_assert_int_eq(ret, MAPI_E_NOT_FOUND);
+
+	conn = mysql_rw_primary(g_oc_ctx->data);
+	snprintf(sql, sizeof(sql), "%s%"PRIu64, server, saved);
+	ck_assert(execute_query(conn, sql) == MYSQL_SUCCESS);
+	mysql_rw_release(g_oc_ctx->data);
+} END_TEST
+
 START_TEST (test_get_folder_property) {
 	void *data;
 	uint64_t fid;
@@ -552,6 +580,45 @@ START_TEST (test_get_folder_property) {
 	ck_assert_int_eq(46, ((struct Binary_r *)data)->cb);
 } END_TEST
 
+START_TEST (test_get_folder_properties) {
+	struct SPropTagArray	*properties;
+	void			*data[4];
+	enum MAPISTATUS		retvals[4];
+	uint64_t		fid;
+
+	// Folder
+	fid = 14124414331340718081ul;
+	properties = set_SPropTagArray(g_mem_ctx, 0x3, PidTagDisplayName,
+				       PidTagRights, PidTagFolderId);
+	ret = openchangedb_get_folder_properties(g_mem_ctx, g_oc_ctx, USER1, fid,
+						 properties, data, retvals);
+	CHECK_SUCCESS;
+	ck_assert_int_eq(retvals[0], MAPI_E_SUCCESS);
+	ck_assert_str_eq("A3", (char *)data[0]);
+	ck_assert_int_eq(retvals[1], MAPI_E_SUCCESS);
+	ck_assert_int_eq(2043, *(int *)data[1]);
+	ck_assert_int_eq(retvals[2], MAPI_E_SUCCESS);
+	ck_assert(*(uint64_t *)data[2] == fid);
+
+	// Mailbox, with a property which is not stored
+	fid = 17438782182108692481ul;
+	properties = set_SPropTagArray(g_mem_ctx, 0x4, PidTagLastModificationTime,
+				       0x7e010003, PidTagDisplayName,
+				       PidTagIpmDraftsEntryId);
+	ret = openchangedb_get_folder_properties(g_mem_ctx, g_oc_ctx, USER2, fid,
+						 properties, data, retvals);
+	CHECK_SUCCESS;
+	ck_assert_int_eq(retvals[0], MAPI_E_SUCCESS);
+	ck_assert_int_eq(130268260180000000 >> 32,
+			 ((struct FILETIME *)data[0])->dwHighDateTime);
+	ck_assert_int_eq(retvals[1], MAPI_E_NOT_FOUND);
+	ck_assert(data[1] == NULL);
+	ck_assert_int_eq(retvals[2], MAPI_E_SUCCESS);
+	ck_assert_str_eq("OpenChange Mailbox: "USER2, (char *)data[2]);
+	ck_assert_int_eq(retvals[3], MAPI_E_SUCCESS);
+	ck_assert_int_eq(46, ((struct Binary_r *)data[3])->cb);
+} END_TEST
+
 START_TEST (test_get_public_folder_property) {
 	void *data;
 	uint32_t proptag;
@@ -1406,6 +1473,7 @@ START_TEST (test_build_table_folders_with_restrictions) {
 	CHECK_SUCCESS;
 
 	res.rt = RES_PROPERTY;
+	res.res.resProperty.relop = RELOP_EQ;
 	res.res.resProperty.ulPropTag = PidTagDisplayName;
 	res.res.resProperty.lpProp.ulPropTag = PidTagDisplayName;
 	res.res.resProperty.lpProp.value.lpszW = "Schedule";
@@ -1425,6 +1493,127 @@ START_TEST (test_build_table_folders_with_restrictions) {
 	ck_assert_str_eq("Schedule", (char *)data);
 } END_TEST
 
+START_TEST (test_build_table_folders_with_complex_restrictions) {
+	void *table, *data;
+	uint64_t fid;
+	struct mapi_SRestriction res;
+	struct mapi_SRestriction_or *or_res;
+	const char *first;
+
+	fid = 17438782182108692481ul;
+	ret = openchangedb_table_init(g_mem_ctx, g_oc_ctx, USER1, 1, fid, &table);
+	CHECK_SUCCESS;
+
+	// OR of property restrictions
+	or_res = talloc_zero_array(g_mem_ctx, struct mapi_SRestriction_or, 2);
+	ck_assert(or_res != NULL);
+	or_res[0].rt = RES_PROPERTY;
+	or_res[0].res.resProperty.relop = RELOP_EQ;
+	or_res[0].res.resProperty.ulPropTag = PidTagDisplayName;
+	or_res[0].res.resProperty.lpProp.ulPropTag = PidTagDisplayName;
+	or_res[0].res.resProperty.lpProp.value.lpszW = "Schedule";
+	or_res[1].rt = RES_PROPERTY;
+	or_res[1].res.resProperty.relop = RELOP_EQ;
+	or_res[1].res.resProperty.ulPropTag = PidTagDisplayName;
+	or_res[1].res.resProperty.lpProp.ulPropTag = PidTagDisplayName;
+	or_res[1].res.resProperty.lpProp.value.lpszW = "Views";
+	res.rt = RES_OR;
+	res.res.resOr.cRes = 2;
+	res.res.resOr.res = or_res;
+	ret = openchangedb_table_set_restrictions(g_oc_ctx, table, &res);
+	CHECK_SUCCESS;
+
+	ret = openchangedb_table_get_property(g_mem_ctx, g_oc_ctx, table,
+					      PidTagDisplayName, 0, false, &data);
+	CHECK_SUCCESS;
+	first = (const char *)data;
+	ret = openchangedb_table_get_property(g_mem_ctx, g_oc_ctx, table,
+					      PidTagDisplayName, 1, false, &data);
+	CHECK_SUCCESS;
+	ck_assert(strcmp(first, data) != 0);
+	ck_assert(!strcmp(first, "Schedule") || !strcmp(first, "Views"));
+	ck_assert(!strcmp(data, "Schedule") || !strcmp(data, "Views"));
+	ret = openchangedb_table_get_property(g_mem_ctx, g_oc_ctx, table,
+					      PidTagDisplayName, 2, false, &data);
+	ck_assert_int_eq(ret, MAPI_E_INVALID_OBJECT);
+
+	// Case insensitive prefix
+	res.rt = RES_CONTENT;
+	res.res.resContent.fuzzy = FL_PREFIX | FL_IGNORECASE;
+	res.res.resContent.ulPropTag = PidTagDisplayName;
+	res.res.resContent.lpProp.ulPropTag = PidTagDisplayName;
+	res.res.resContent.lpProp.value.lpszW = "sched";
+	ret = openchangedb_table_set_restrictions(g_oc_ctx, table, &res);
+	CHECK_SUCCESS;
+
+	ret = openchangedb_table_get_property(g_mem_ctx, g_oc_ctx, table,
+					      PidTagDisplayName, 0, false, &data);
+	CHECK_SUCCESS;
+	ck_assert_str_eq("Schedule", (char *)data);
+	ret = openchangedb_table_get_property(g_mem_ctx, g_oc_ctx, table,
+					      PidTagDisplayName, 1, false, &data);
+	ck_assert_int_eq(ret, MAPI_E_INVALID_OBJECT);
+
+	// Evaluated against each row instead of by MySQL
+	res.rt = RES_COMPAREPROPS;
+	res.res.resCompareProps.relop = RELOP_NE;
+	res.res.resCompareProps.ulPropTag1 = PidTagDisplayName;
+	res.res.resCompareProps.ulPropTag2 = PidTagDisplayName;
+	ret = openchangedb_table_set_restrictions(g_oc_ctx, table, &res);
+	CHECK_SUCCESS;
+
+	ret = openchangedb_table_get_property(g_mem_ctx, g_oc_ctx, table,
+					      PidTagDisplayName, 0, false, &data);
+	ck_assert_int_eq(ret, MAPI_E_INVALID_OBJECT);
+
+	res.res.resCompareProps.relop = RELOP_EQ;
+	ret = openchangedb_table_set_restrictions(g_oc_ctx, table, &res);
+	CHECK_SUCCESS;
+
+	ret = openchangedb_table_get_property(g_mem_ctx, g_oc_ctx, table,
+					      PidTagDisplayName, 0, false, &data);
+	CHECK_SUCCESS;
+} END_TEST
+
+START_TEST (test_build_table_folders_with_quoted_restrictions) {
+	void *table, *data;
+	uint64_t fid;
+	struct mapi_SRestriction res;
+	const char *values[] = { "Schedule\\", "\\' OR TRUE OR '", "Sched%", "\\" };
+	uint32_t i;
+
+	fid = 17438782182108692481ul;
+	ret = openchangedb_table_init(g_mem_ctx, g_oc_ctx, USER1, 1, fid, &table);
+	CHECK_SUCCESS;
+
+	// Quotes and backslashes are compared as is, not as SQL
+	for (i = 0; i < sizeof(values) / sizeof(values[0]); i++) {
+		res.rt = RES_PROPERTY;
+		res.res.resProperty.relop = RELOP_EQ;
+		res.res.resProperty.ulPropTag = PidTagDisplayName;
+		res.res.resProperty.lpProp.ulPropTag = PidTagDisplayName;
+		res.res.resProperty.lpProp.value.lpszW = values[i];
+		ret = openchangedb_table_set_restrictions(g_oc_ctx, table, &res);
+		CHECK_SUCCESS;
+
+		ret = openchangedb_table_get_property(g_mem_ctx, g_oc_ctx, table,
+						      PidTagDisplayName, 0, false, &data);
+		ck_assert_int_eq(ret, MAPI_E_INVALID_OBJECT);
+
+		res.rt = RES_CONTENT;
+		res.res.resContent.fuzzy = FL_SUBSTRING | FL_IGNORECASE;
+		res.res.resContent.ulPropTag = PidTagDisplayName;
+		res.res.resContent.lpProp.ulPropTag = PidTagDisplayName;
+		res.res.resContent.lpProp.value.lpszW = values[i];
+		ret = openchangedb_table_set_restrictions(g_oc_ctx, table, &res);
+		CHECK_SUCCESS;
+
+		ret = openchangedb_table_get_property(g_mem_ctx, g_oc_ctx, table,
+						      PidTagDisplayName, 0, false, &data);
+		ck_assert_int_eq(ret, MAPI_E_INVALID_OBJECT);
+	}
+} END_TEST
+
 START_TEST (test_build_table_folders_live_filtering) {
 	void *table, *table_2, *data;
 	uint64_t fid;
@@ -1441,6 +1630,7 @@ START_TEST (test_build_table_folders_live_filtering) {
 	CHECK_SUCCESS;
 
 	res.rt = RES_PROPERTY;
+	res.res.resProperty.relop = RELOP_EQ;
 	res.res.resProperty.ulPropTag = PidTagDisplayName;
 	res.res.resProperty.lpProp.ulPropTag = PidTagDisplayName;
 	res.res.resProperty.lpProp.value.lpszW = "Schedule";
@@ -1541,7 +1731,7 @@ static void mysql_setup(void)
 
 static void mysql_teardown(void)
 {
-	drop_mysql_database(g_oc_ctx->data, OC_TESTSUITE_MYSQL_DB);
+	drop_mysql_database(mysql_rw_primary(g_oc_ctx->data), OC_TESTSUITE_MYSQL_DB);
 	talloc_free(g_mem_ctx);
 }
 
@@ -1575,7 +1765,9 @@ static Suite *openchangedb_create_suite(const char *backend_name,
 	tcase_add_test(tc, test_get_new_changeNumber);
 	tcase_add_test(tc, test_get_new_changeNumbers);
 	tcase_add_test(tc, test_get_next_changeNumber);
+	tcase_add_test(tc, test_get_new_changeNumber_from_zero);
 	tcase_add_test(tc, test_get_folder_property);
+	tcase_add_test(tc, test_get_folder_properties);
 	tcase_add_test(tc, test_get_public_folder_property);
 	tcase_add_test(tc, test_set_folder_properties);
 	tcase_add_test(tc, test_set_folder_properties_on_mailbox);
@@ -1602,6 +1794,8 @@ static Suite *openchangedb_create_suite(const char *backend_name,
 
 	tcase_add_test(tc, test_build_table_folders);
 	tcase_add_test(tc, test_build_table_folders_with_restrictions);
+	tcase_add_test(tc, test_build_table_folders_with_complex_restrictions);
+	tcase_add_test(tc, test_build_table_folders_with_quoted_restrictions);
 	tcase_add_test(tc, test_build_table_folders_live_filtering);
 	tcase_add_test(tc, test_get_Transport_folder_when_has_unusual_display_name);
 
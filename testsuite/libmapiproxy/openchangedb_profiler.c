@@ -0,0 +1,258 @@
+/*
+   OpenChange Unit Testing
+
+   OpenChange Project
+
+   This program is free software; you can redistribute it and/or modify
+   it under the terms of the GNU General Public License as published by
+   the Free Software Foundation; either version 3 of the License, or
+   (at your option) any later version.
+
+   This program is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+   GNU General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "testsuite.h"
+#include "mapiproxy/libmapiproxy/libmapiproxy.h"
+#include "mapiproxy/libmapiproxy/backends/openchangedb_profiler.h"
+#include "libmapi/libmapi.h"
+#include "libmapi/libmapi_private.h"
+#include <inttypes.h>
+#include <unistd.h>
+
+
+#define FOLDER_ID_EXPECTED 289356276058554369ul
+#define MISSING_SYSTEM_IDX 42
+#define SLOW_SYSTEM_IDX 43
+#define SLOW_USEC 20000
+
+#define CHECK_SUCCESS(fncall) do { \
+	enum MAPISTATUS ret = fncall; \
+	ck_assert_int_eq(ret, MAPI_E_SUCCESS); \
+} while(0)
+#define CHECK_FAILURE(fncall) do { \
+	enum MAPISTATUS ret = fncall; \
+	ck_assert_int_ne(ret, MAPI_E_SUCCESS); \
+} while(0)
+
+
+static TALLOC_CTX *mem_ctx;
+static struct openchangedb_context *oc_ctx;
+
+static enum MAPISTATUS mock_backend_init(TALLOC_CTX *, struct openchangedb_context **);
+
+// v Unit test ----------------------------------------------------------------
+
+START_TEST (test_counts) {
+	const struct openchangedb_profiler_stats *stats;
+	uint64_t folder_id;
+	uint32_t i;
+
+	ck_assert(openchangedb_profiler_get_stats("get_SystemFolderID") == NULL);
+
+	for (i = 0; i < 10; i++) {
+		CHECK_SUCCESS(openchangedb_get_SystemFolderID(oc_ctx, "recipient", 1, &folder_id));
+	}
+	CHECK_FAILURE(openchangedb_get_SystemFolderID(oc_ctx, "recipient", MISSING_SYSTEM_IDX, &folder_id));
+	CHECK_FAILURE(openchangedb_delete_folder(oc_ctx, "recipient", FOLDER_ID_EXPECTED));
+
+	stats = openchangedb_profiler_get_stats("get_SystemFolderID");
+	ck_assert(stats != NULL);
+	ck_assert_int_eq(stats->count, 11);
+	ck_assert_int_eq(stats->not_found, 1);
+	ck_assert_int_eq(stats->errors, 0);
+	ck_assert(stats->latency_total >= stats->latency_max);
+
+	stats = openchangedb_profiler_get_stats("delete_folder");
+	ck_assert(stats != NULL);
+	ck_assert_int_eq(stats->count, 1);
+	ck_assert_int_eq(stats->errors, 1);
+
+	ck_assert(openchangedb_profiler_get_stats("get_MailboxGuid") == NULL);
+	ck_assert(openchangedb_profiler_get_stats("no_such_operation") == NULL);
+
+	/* None of these calls is slow */
+	ck_assert(openchangedb_profiler_get_sample(0) == NULL);
+} END_TEST
+
+START_TEST (test_percentile) {
+	struct openchangedb_profiler_stats stats;
+
+	memset(&stats, 0, sizeof (stats));
+	ck_assert_int_eq(openchangedb_profiler_percentile(&stats, 50.0), 0);
+
+	/* 90 calls in [512, 1023] and 10 calls of 5000us */
+	stats.count = 100;
+	stats.buckets[10] = 90;
+	stats.buckets[13] = 10;
+	stats.latency_max = 5000;
+
+	ck_assert_int_eq(openchangedb_profiler_percentile(&stats, 50.0), 1023);
+	ck_assert_int_eq(openchangedb_profiler_percentile(&stats, 90.0), 1023);
+	ck_assert_int_eq(openchangedb_profiler_percentile(&stats, 99.0), 5000);
+} END_TEST
+
+START_TEST (test_slow_sample) {
+	const struct openchangedb_profiler_sample *sample;
+	uint64_t folder_id;
+
+	CHECK_SUCCESS(openchangedb_get_SystemFolderID(oc_ctx, "slow_user", SLOW_SYSTEM_IDX, &folder_id));
+
+	sample = openchangedb_profiler_get_sample(0);
+	ck_assert(sample != NULL);
+	ck_assert_str_eq(sample->op, "get_SystemFolderID");
+	ck_assert(sample->usec >= SLOW_USEC);
+	ck_assert_int_eq(sample->retval, MAPI_E_SUCCESS);
+	ck_assert(strstr(sample->args, "recipient=[slow_user]") != NULL);
+	ck_assert(openchangedb_profiler_get_sample(1) == NULL);
+
+	openchangedb_profiler_reset();
+	ck_assert(openchangedb_profiler_get_sample(0) == NULL);
+	ck_assert(openchangedb_profiler_get_stats("get_SystemFolderID") == NULL);
+} END_TEST
+
+START_TEST (test_slow_disabled) {
+	struct openchangedb_context *backend_ctx = NULL;
+	struct openchangedb_context *unsampled_ctx = NULL;
+	const struct openchangedb_profiler_stats *stats;
+	uint64_t folder_id;
+
+	CHECK_SUCCESS(mock_backend_init(mem_ctx, &backend_ctx));
+	CHECK_SUCCESS(openchangedb_profiler_initialize(mem_ctx, 0, backend_ctx, &unsampled_ctx));
+
+	/* Calls are counted, but none is kept as slow */
+	CHECK_SUCCESS(openchangedb_get_SystemFolderID(unsampled_ctx, "recipient", 1, &folder_id));
+	CHECK_SUCCESS(openchangedb_get_SystemFolderID(unsampled_ctx, "slow_user", SLOW_SYSTEM_IDX, &folder_id));
+
+	stats = openchangedb_profiler_get_stats("get_SystemFolderID");
+	ck_assert(stats != NULL);
+	ck_assert_int_eq(stats->count, 2);
+	ck_assert(openchangedb_profiler_get_sample(0) == NULL);
+} END_TEST
+
+START_TEST (test_dump) {
+	char path[] = "/tmp/openchangedb_profiler_XXXXXX";
+	char line[512];
+	uint64_t folder_id;
+	FILE *fp;
+	int fd;
+	int rows = 0;
+	int samples = 0;
+
+	CHECK_SUCCESS(openchangedb_get_SystemFolderID(oc_ctx, "recipient", 1, &folder_id));
+	CHECK_SUCCESS(openchangedb_get_SystemFolderID(oc_ctx, "slow_user", SLOW_SYSTEM_IDX, &folder_id));
+
+	fd = mkstemp(path);
+	ck_assert(fd != -1);
+	fp = fdopen(fd, "w+");
+	ck_assert(fp != NULL);
+
+	openchangedb_profiler_dump_stats(fp);
+	rewind(fp);
+	while (fgets(line, sizeof (line), fp)) {
+		if (!strncmp(line, "get_SystemFolderID 2 ", 21)) rows++;
+		if (!strncmp(line, "# slow get_SystemFolderID ", 26)) samples++;
+	}
+	fclose(fp);
+	unlink(path);
+
+	ck_assert_int_eq(rows, 1);
+	ck_assert_int_eq(samples, 1);
+} END_TEST
+
+// ^ Unit test ----------------------------------------------------------------
+
+
+// v Mocked backend ----------------------------------------------------------------
+static enum MAPISTATUS get_SystemFolderID(struct openchangedb_context *self,
+					  const char *recipient, uint32_t SystemIdx,
+					  uint64_t *FolderId)
+{
+	if (SystemIdx == MISSING_SYSTEM_IDX) {
+		return MAPI_E_NOT_FOUND;
+	}
+	if (SystemIdx == SLOW_SYSTEM_IDX) {
+		usleep(SLOW_USEC);
+	}
+	*FolderId = FOLDER_ID_EXPECTED;
+
+	return MAPI_E_SUCCESS;
+}
+
+static enum MAPISTATUS delete_folder(struct openchangedb_context *self,
+				     const char *username, uint64_t fid)
+{
+	return MAPI_E_NO_ACCESS;
+}
+
+/* Only the functions exercised above are mocked */
+static enum MAPISTATUS mock_backend_init(TALLOC_CTX *mem_ctx,
+					 struct openchangedb_context **ctx)
+{
+	struct openchangedb_context	*oc_ctx = talloc_zero(mem_ctx, struct openchangedb_context);
+
+	OPENCHANGE_RETVAL_IF(oc_ctx == NULL, MAPI_E_NOT_ENOUGH_RESOURCES, NULL);
+
+	oc_ctx->backend_type = talloc_strdup(oc_ctx, "mocked_backend");
+	OPENCHANGE_RETVAL_IF(oc_ctx->backend_type == NULL, MAPI_E_NOT_ENOUGH_RESOURCES, oc_ctx);
+
+	oc_ctx->get_SystemFolderID = get_SystemFolderID;
+	oc_ctx->delete_folder = delete_folder;
+
+	*ctx = oc_ctx;
+
+	return MAPI_E_SUCCESS;
+}
+// ^ Mocked backend ----------------------------------------------------------------
+
+// v Suite definition ---------------------------------------------------------
+
+static void ocdb_profiler_setup(void)
+{
+	enum MAPISTATUS mapi_status;
+	struct openchangedb_context *backend_ctx = NULL;
+
+	mem_ctx = talloc_new(NULL);
+
+	mapi_status = mock_backend_init(mem_ctx, &backend_ctx);
+	if (mapi_status != MAPI_E_SUCCESS) {
+		fprintf(stderr, "Failed to initialize Mocked backend %d\n", mapi_status);
+		ck_abort();
+	}
+	mapi_status = openchangedb_profiler_initialize(mem_ctx, SLOW_USEC, backend_ctx, &oc_ctx);
+	if (mapi_status != MAPI_E_SUCCESS) {
+		fprintf(stderr, "Failed to initialize Profiler backend %d\n", mapi_status);
+		ck_abort();
+	}
+
+	openchangedb_profiler_reset();
+}
+
+static void ocdb_profiler_teardown(void)
+{
+	openchangedb_profiler_reset();
+	talloc_free(mem_ctx);
+}
+
+
+Suite *mapiproxy_openchangedb_profiler_suite(void)
+{
+	Suite *s = suite_create("Openchangedb Profiler backend");
+
+	TCase *tc = tcase_create("Openchangedb Profiler interface");
+	tcase_add_checked_fixture(tc, ocdb_profiler_setup, ocdb_profiler_teardown);
+
+	tcase_add_test(tc, test_counts);
+	tcase_add_test(tc, test_percentile);
+	tcase_add_test(tc, test_slow_sample);
+	tcase_add_test(tc, test_slow_disabled);
+	tcase_add_test(tc, test_dump);
+
+	suite_add_tcase(s, tc);
+	return s;
+}
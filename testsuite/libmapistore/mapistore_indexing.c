@@ -456,6 +456,51 @@ START_TEST(test_get_fmid_with_wildcard) {
 } END_TEST
 
 
+/* batch operations */
+
+START_TEST(test_batch_fmids) {
+	enum mapistore_error	retval;
+	uint64_t		fmids[3];
+	uint64_t		fmids_res[4];
+	const char		*uris[4] = { "foo://bar/b1", "foo://bar/b2", "foo://bar/b3", "foo://bar/none" };
+	char			*uris_res[4];
+	bool			soft_deleted[4];
+	uint32_t		i;
+
+	for (i = 0; i < 3; i++) {
+		fmids[i] = INDEXING_TEST_FMID + i;
+	}
+
+	retval = g_ictx->add_fmids(g_ictx, g_test_username, 3, fmids, uris);
+	ck_assert_int_eq(retval, MAPISTORE_SUCCESS);
+
+	/* Any existing record makes the whole batch fail */
+	retval = g_ictx->add_fmids(g_ictx, g_test_username, 3, fmids, uris);
+	ck_assert_int_eq(retval, MAPISTORE_ERR_EXIST);
+
+	retval = g_ictx->get_fmids(g_ictx, g_test_username, 4, uris, fmids_res, soft_deleted);
+	ck_assert_int_eq(retval, MAPISTORE_SUCCESS);
+	for (i = 0; i < 3; i++) {
+		ck_assert(fmids_res[i] == fmids[i]);
+		ck_assert(!soft_deleted[i]);
+	}
+	ck_assert(fmids_res[3] == 0);
+
+	retval = g_ictx->del_fmids(g_ictx, g_test_username, 2, fmids, MAPISTORE_SOFT_DELETE);
+	ck_assert_int_eq(retval, MAPISTORE_SUCCESS);
+	retval = g_ictx->del_fmids(g_ictx, g_test_username, 1, fmids + 2, MAPISTORE_PERMANENT_DELETE);
+	ck_assert_int_eq(retval, MAPISTORE_SUCCESS);
+
+	retval = g_ictx->get_uris(g_ictx, g_test_username, g_ictx, 3, fmids, uris_res, soft_deleted);
+	ck_assert_int_eq(retval, MAPISTORE_SUCCESS);
+	for (i = 0; i < 2; i++) {
+		ck_assert_str_eq(uris_res[i], uris[i]);
+		ck_assert(soft_deleted[i]);
+	}
+	ck_assert(uris_res[2] == NULL);
+} END_TEST
+
+
 /* allocate_fmid */
 
 START_TEST (test_allocate_fmid) {
@@ -472,6 +517,151 @@ START_TEST (test_allocate_fmid) {
 	ck_assert(fmid1 != fmid2);
 } END_TEST
 
+START_TEST (test_fmid_lease) {
+	enum mapistore_error		ret;
+	struct indexing_context_list	*el;
+	uint64_t			fmid1, fmid2, fmid3;
+	uint64_t			raw_fmid;
+	uint64_t			refills_before, refills_after;
+
+	/* Let the public allocation functions find our context */
+	g_mstore_ctx->conn_info = talloc_zero(g_mstore_ctx, struct mapistore_connection_info);
+	g_mstore_ctx->conn_info->username = talloc_strdup(g_mstore_ctx->conn_info, g_test_username);
+	el = talloc_zero(g_mstore_ctx, struct indexing_context_list);
+	el->ctx = g_ictx;
+	g_mstore_ctx->indexing_list = el;
+
+	mapistore_set_default_fmid_lease_size(16);
+	mapistore_indexing_get_lease_stats(&refills_before, NULL);
+
+	ret = mapistore_indexing_reserve_fmid_range(g_mstore_ctx, 1, &fmid1);
+	ck_assert_int_eq(ret, MAPISTORE_SUCCESS);
+	ret = mapistore_indexing_reserve_fmid_range(g_mstore_ctx, 3, &fmid2);
+	ck_assert_int_eq(ret, MAPISTORE_SUCCESS);
+	ck_assert(fmid1 != fmid2);
+	ck_assert(g_ictx->lease_end - g_ictx->lease_next == 12);
+
+	/* Only one lease was taken from the backend */
+	ret = g_ictx->allocate_fmid(g_ictx, g_test_username, &raw_fmid);
+	ck_assert_int_eq(ret, MAPISTORE_SUCCESS);
+	ck_assert(raw_fmid == g_ictx->lease_end);
+	mapistore_indexing_get_lease_stats(&refills_after, NULL);
+	ck_assert(refills_after == refills_before + 1);
+
+	/* Ranges as large as the lease bypass it */
+	ret = mapistore_indexing_reserve_fmid_range(g_mstore_ctx, 32, &fmid3);
+	ck_assert_int_eq(ret, MAPISTORE_SUCCESS);
+	ck_assert(g_ictx->lease_end - g_ictx->lease_next == 12);
+
+	/* A range longer than the lease tail takes a new lease */
+	ret = mapistore_indexing_reserve_fmid_range(g_mstore_ctx, 13, &fmid3);
+	ck_assert_int_eq(ret, MAPISTORE_SUCCESS);
+	ck_assert(g_ictx->lease_end - g_ictx->lease_next == 3);
+	mapistore_indexing_get_lease_stats(&refills_after, NULL);
+	ck_assert(refills_after == refills_before + 2);
+
+	mapistore_set_default_fmid_lease_size(MAPISTORE_FMID_LEASE_SIZE);
+} END_TEST
+
+/* TDB URI indexes */
+
+START_TEST (test_tdb_get_fmid_follows_changes) {
+	enum mapistore_error	ret;
+	uint64_t		fmid_res;
+	bool			soft_deleted;
+
+	ret = g_ictx->add_fmid(g_ictx, g_test_username, INDEXING_TEST_FMID, INDEXING_TEST_URI);
+	ck_assert_int_eq(ret, MAPISTORE_SUCCESS);
+
+	/* Updated URIs resolve to the fmid, previous ones don't */
+	ret = g_ictx->update_fmid(g_ictx, g_test_username, INDEXING_TEST_FMID, INDEXING_TEST_URI_2);
+	ck_assert_int_eq(ret, MAPISTORE_SUCCESS);
+	ret = g_ictx->get_fmid(g_ictx, g_test_username, INDEXING_TEST_URI, false, &fmid_res, &soft_deleted);
+	ck_assert_int_eq(ret, MAPISTORE_ERR_NOT_FOUND);
+	ret = g_ictx->get_fmid(g_ictx, g_test_username, "idxtest://url/test2/", false, &fmid_res, &soft_deleted);
+	ck_assert_int_eq(ret, MAPISTORE_SUCCESS);
+	ck_assert_int_eq(fmid_res, INDEXING_TEST_FMID);
+
+	/* Soft deleted records are still resolved */
+	ret = g_ictx->del_fmid(g_ictx, g_test_username, INDEXING_TEST_FMID, MAPISTORE_SOFT_DELETE);
+	ck_assert_int_eq(ret, MAPISTORE_SUCCESS);
+	ret = g_ictx->get_fmid(g_ictx, g_test_username, "idxtest://url/te*2", true, &fmid_res, &soft_deleted);
+	ck_assert_int_eq(ret, MAPISTORE_SUCCESS);
+	ck_assert_int_eq(fmid_res, INDEXING_TEST_FMID);
+	ck_assert(soft_deleted);
+
+	ret = g_ictx->del_fmid(g_ictx, g_test_username, INDEXING_TEST_FMID, MAPISTORE_PERMANENT_DELETE);
+	ck_assert_int_eq(ret, MAPISTORE_SUCCESS);
+	ret = g_ictx->get_fmid(g_ictx, g_test_username, "idxtest://url/*", true, &fmid_res, &soft_deleted);
+	ck_assert_int_eq(ret, MAPISTORE_ERR_NOT_FOUND);
+
+	/* Other records sharing the parent are left untouched */
+	ret = g_ictx->get_fmid(g_ictx, g_test_username, "idxtest://existing*", true, &fmid_res, &soft_deleted);
+	ck_assert_int_eq(ret, MAPISTORE_SUCCESS);
+	ck_assert_int_eq(fmid_res, INDEXING_EXIST_FMID);
+} END_TEST
+
+START_TEST (test_tdb_get_fmid_wildcard_scope) {
+	enum mapistore_error	ret;
+	uint64_t		fmid_res;
+	bool			soft_deleted;
+
+	ret = g_ictx->add_fmid(g_ictx, g_test_username, INDEXING_TEST_FMID, "foo://bar/u1/deep");
+	ck_assert_int_eq(ret, MAPISTORE_SUCCESS);
+
+	/* A wildcard within the last component only matches siblings */
+	ret = g_ictx->get_fmid(g_ictx, g_test_username, "foo://bar/u1*p", true, &fmid_res, &soft_deleted);
+	ck_assert_int_eq(ret, MAPISTORE_ERR_NOT_FOUND);
+	ret = g_ictx->get_fmid(g_ictx, g_test_username, "foo://bar/u1/d*", true, &fmid_res, &soft_deleted);
+	ck_assert_int_eq(ret, MAPISTORE_SUCCESS);
+	ck_assert_int_eq(fmid_res, INDEXING_TEST_FMID);
+
+	/* Others may span several components */
+	ret = g_ictx->get_fmid(g_ictx, g_test_username, "foo://*/deep", true, &fmid_res, &soft_deleted);
+	ck_assert_int_eq(ret, MAPISTORE_SUCCESS);
+	ck_assert_int_eq(fmid_res, INDEXING_TEST_FMID);
+	ret = g_ictx->get_fmid(g_ictx, g_test_username, "*deep", true, &fmid_res, &soft_deleted);
+	ck_assert_int_eq(ret, MAPISTORE_SUCCESS);
+	ck_assert_int_eq(fmid_res, INDEXING_TEST_FMID);
+} END_TEST
+
+static int _tdb_drop_index(struct tdb_context *tdb_ctx, TDB_DATA key, TDB_DATA value, void *data)
+{
+	if ((key.dsize > 4 && (!memcmp(key.dptr, MAPISTORE_URI_INDEX_TAG, 4) ||
+			       !memcmp(key.dptr, MAPISTORE_DIR_INDEX_TAG, 4))) ||
+	    (key.dsize == strlen(MAPISTORE_INDEXING_VERSION_KEY) &&
+	     !memcmp(key.dptr, MAPISTORE_INDEXING_VERSION_KEY, key.dsize))) {
+		tdb_delete(tdb_ctx, key);
+	}
+
+	return 0;
+}
+
+START_TEST (test_tdb_index_rebuild) {
+	enum mapistore_error	ret;
+	struct indexing_context	*ictx;
+	uint64_t		fmid_res;
+	bool			soft_deleted;
+
+	ret = g_ictx->add_fmid(g_ictx, g_test_username, INDEXING_TEST_FMID, INDEXING_TEST_URI);
+	ck_assert_int_eq(ret, MAPISTORE_SUCCESS);
+
+	/* Simulate a database created without URI indexes */
+	tdb_traverse(((struct tdb_wrap *)g_ictx->data)->tdb, _tdb_drop_index, NULL);
+	ret = g_ictx->get_fmid(g_ictx, g_test_username, INDEXING_TEST_URI, false, &fmid_res, &soft_deleted);
+	ck_assert_int_eq(ret, MAPISTORE_ERR_NOT_FOUND);
+
+	ret = mapistore_indexing_tdb_init(g_mstore_ctx, g_test_username, &ictx);
+	ck_assert_int_eq(ret, MAPISTORE_SUCCESS);
+
+	ret = ictx->get_fmid(ictx, g_test_username, INDEXING_TEST_URI, false, &fmid_res, &soft_deleted);
+	ck_assert_int_eq(ret, MAPISTORE_SUCCESS);
+	ck_assert_int_eq(fmid_res, INDEXING_TEST_FMID);
+	ret = ictx->get_fmid(ictx, g_test_username, INDEXING_EXIST_URL, false, &fmid_res, &soft_deleted);
+	ck_assert_int_eq(ret, MAPISTORE_SUCCESS);
+	ck_assert_int_eq(fmid_res, INDEXING_EXIST_FMID);
+} END_TEST
+
 // ^ unit tests ---------------------------------------------------------------
 
 // v suite definition ---------------------------------------------------------
@@ -502,7 +692,7 @@ static void mysql_setup(void)
 
 static void mysql_teardown(void)
 {
-	drop_mysql_database(g_ictx->data, INDEXING_MYSQL_DB);
+	drop_mysql_database(mysql_rw_primary(g_ictx->data), INDEXING_MYSQL_DB);
 	talloc_free(g_mstore_ctx);
 }
 
@@ -564,7 +754,9 @@ static TCase *create_test_case_indexing_interface(const char *name, SFun setup,
 	tcase_add_test(tc_interface, test_get_fmid_sanity);
 	tcase_add_test(tc_interface, test_get_fmid);
 	tcase_add_test(tc_interface, test_get_fmid_with_wildcard);
+	tcase_add_test(tc_interface, test_batch_fmids);
 	tcase_add_test(tc_interface, test_allocate_fmid);
+	tcase_add_test(tc_interface, test_fmid_lease);
 
 	return tc_interface;
 }
@@ -598,6 +790,7 @@ Suite *mapistore_indexing_mysql_suite(void)
 Suite *mapistore_indexing_tdb_suite(void)
 {
 	Suite *s;
+	TCase *tc_internal;
 	TCase *tc_interface;
 
 	s = suite_create("libmapistore indexing: TDB backend");
@@ -605,5 +798,13 @@ Suite *mapistore_indexing_tdb_suite(void)
 	tc_interface = create_test_case_indexing_interface("TDB", tdb_setup, tdb_teardown);
 	suite_add_tcase(s, tc_interface);
 
+	/* test URI indexes */
+	tc_internal = tcase_create("indexing: TDB backend URI indexes");
+	tcase_add_checked_fixture(tc_internal, tdb_setup, tdb_teardown);
+	tcase_add_test(tc_internal, test_tdb_get_fmid_follows_changes);
+	tcase_add_test(tc_internal, test_tdb_get_fmid_wildcard_scope);
+	tcase_add_test(tc_internal, test_tdb_index_rebuild);
+	suite_add_tcase(s, tc_internal);
+
 	return s;
 }
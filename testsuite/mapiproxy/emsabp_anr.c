@@ -0,0 +1,194 @@
+/*
+   EMSABP ambiguous name resolution Unit Testing
+
+   OpenChange Project
+
+   This program is free software; you can redistribute it and/or modify
+   it under the terms of the GNU General Public License as published by
+   the Free Software Foundation; either version 3 of the License, or
+   (at your option) any later version.
+
+   This program is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+   GNU General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "testsuite.h"
+#include "mapiproxy/servers/default/nspi/dcesrv_exchange_nsp.h"
+#include <unistd.h>
+
+#define	BASE_DN		"DC=example,DC=com"
+#define	FILTER		"(objectClass=user)"
+#define	ORGANIZATION	"First Organization"
+#define	CACHE_TTL	3600
+
+static TALLOC_CTX		*mem_ctx;
+static struct ldb_context	*ldb_ctx;
+static struct ldb_dn		*basedn;
+static char			*ldb_path;
+
+static void add_user(const char *cn, const char *displayName, const char *mail)
+{
+	struct ldb_message	*msg;
+
+	msg = ldb_msg_new(mem_ctx);
+	msg->dn = ldb_dn_new_fmt(msg, ldb_ctx, "CN=%s,CN=Users," BASE_DN, cn);
+	ldb_msg_add_string(msg, "objectClass", "user");
+	ldb_msg_add_string(msg, "displayName", displayName);
+	if (mail) {
+		ldb_msg_add_string(msg, "mail", mail);
+	}
+	ck_assert_int_eq(ldb_add(ldb_ctx, msg), LDB_SUCCESS);
+	talloc_free(msg);
+}
+
+static void delete_user(const char *cn)
+{
+	struct ldb_dn	*dn;
+
+	dn = ldb_dn_new_fmt(mem_ctx, ldb_ctx, "CN=%s,CN=Users," BASE_DN, cn);
+	ck_assert_int_eq(ldb_delete(ldb_ctx, dn), LDB_SUCCESS);
+	talloc_free(dn);
+}
+
+static uint32_t resolve(const char *filter, uint32_t ttl, const char *name, struct ldb_message **msg)
+{
+	const char	*names[] = { name };
+	uint32_t	status;
+
+	ck_assert_int_eq(emsabp_anr_resolve(mem_ctx, ldb_ctx, basedn, ORGANIZATION, filter, ttl,
+					    1, names, &status, msg), MAPI_E_SUCCESS);
+	return status;
+}
+
+// v Unit test ----------------------------------------------------------------
+
+START_TEST (test_resolve) {
+	const char		*names[] = { "alice", "Al", "zed", "Bob", "", NULL };
+	uint32_t		status[6];
+	struct ldb_message	*msgs[6];
+
+	add_user("alice", "Alice Smith", "alice@example.com");
+	add_user("alan", "Alan Smithee", "alan@example.com");
+	add_user("bob", "Bob Jones", NULL);
+
+	ck_assert_int_eq(emsabp_anr_resolve(mem_ctx, ldb_ctx, basedn, ORGANIZATION, FILTER, 0,
+					    6, names, status, msgs), MAPI_E_SUCCESS);
+
+	ck_assert_int_eq(status[0], MAPI_RESOLVED);
+	ck_assert(msgs[0] != NULL);
+	ck_assert_str_eq(ldb_msg_find_attr_as_string(msgs[0], "displayName", ""), "Alice Smith");
+	ck_assert_int_eq(status[1], MAPI_AMBIGUOUS);
+	ck_assert(msgs[1] == NULL);
+	ck_assert_int_eq(status[2], MAPI_UNRESOLVED);
+	ck_assert(msgs[2] == NULL);
+	ck_assert_int_eq(status[3], MAPI_RESOLVED);
+	ck_assert_str_eq(ldb_msg_find_attr_as_string(msgs[3], "displayName", ""), "Bob Jones");
+	/* An empty name matches every record */
+	ck_assert_int_eq(status[4], MAPI_AMBIGUOUS);
+	ck_assert_int_eq(status[5], MAPI_UNRESOLVED);
+
+	/* Only records of the container are resolved */
+	ck_assert_int_eq(resolve("(objectClass=group)", 0, "alice", &msgs[0]), MAPI_UNRESOLVED);
+} END_TEST
+
+START_TEST (test_chunks) {
+	const char		**names;
+	uint32_t		*status;
+	struct ldb_message	**msgs;
+	uint32_t		count = EMSABP_ANR_CHUNK * 2 + 5;
+	uint32_t		i;
+
+	names = talloc_array(mem_ctx, const char *, count);
+	status = talloc_array(mem_ctx, uint32_t, count);
+	msgs = talloc_array(mem_ctx, struct ldb_message *, count);
+	for (i = 0; i < count; i++) {
+		names[i] = talloc_asprintf(names, "user%03u", i);
+		add_user(names[i], names[i], NULL);
+	}
+
+	/* Names given in reverse order are matched back to their record */
+	for (i = 0; i < count / 2; i++) {
+		const char *name = names[i];
+		names[i] = names[count - i - 1];
+		names[count - i - 1] = name;
+	}
+
+	ck_assert_int_eq(emsabp_anr_resolve(mem_ctx, ldb_ctx, basedn, ORGANIZATION, FILTER, 0,
+					    count, names, status, msgs), MAPI_E_SUCCESS);
+	for (i = 0; i < count; i++) {
+		ck_assert_int_eq(status[i], MAPI_RESOLVED);
+		ck_assert_str_eq(ldb_msg_find_attr_as_string(msgs[i], "displayName", ""), names[i]);
+	}
+} END_TEST
+
+START_TEST (test_cache) {
+	struct ldb_message	*msg;
+
+	add_user("alice", "Alice Smith", "alice@example.com");
+
+	ck_assert_int_eq(resolve(FILTER, CACHE_TTL, "alice", &msg), MAPI_RESOLVED);
+	ck_assert_int_eq(resolve(FILTER, CACHE_TTL, "carol", &msg), MAPI_UNRESOLVED);
+
+	delete_user("alice");
+	add_user("carol", "Carol White", "carol@example.com");
+
+	/* Resolutions are served from the cache until they expire */
+	ck_assert_int_eq(resolve(FILTER, CACHE_TTL, "alice", &msg), MAPI_RESOLVED);
+	ck_assert_str_eq(ldb_msg_find_attr_as_string(msg, "displayName", ""), "Alice Smith");
+	ck_assert_int_eq(resolve(FILTER, CACHE_TTL, "carol", &msg), MAPI_UNRESOLVED);
+
+	/* Not cached for another container, nor looked up when caching is disabled */
+	ck_assert_int_eq(resolve("(&" FILTER "(mail=*))", CACHE_TTL, "alice", &msg), MAPI_UNRESOLVED);
+	ck_assert_int_eq(resolve(FILTER, 0, "carol", &msg), MAPI_RESOLVED);
+
+	emsabp_anr_cache_flush();
+	ck_assert_int_eq(resolve(FILTER, CACHE_TTL, "alice", &msg), MAPI_UNRESOLVED);
+	ck_assert_int_eq(resolve(FILTER, CACHE_TTL, "carol", &msg), MAPI_RESOLVED);
+} END_TEST
+
+// ^ unit tests ---------------------------------------------------------------
+
+// v suite definition ---------------------------------------------------------
+
+static void emsabp_anr_setup(void)
+{
+	mem_ctx = talloc_new(NULL);
+
+	ldb_path = talloc_asprintf(mem_ctx, "/tmp/emsabp_anr_%d.ldb", getpid());
+	unlink(ldb_path);
+	ldb_ctx = ldb_init(mem_ctx, NULL);
+	ck_assert(ldb_ctx != NULL);
+	ck_assert_int_eq(ldb_connect(ldb_ctx, ldb_path, 0, NULL), LDB_SUCCESS);
+	basedn = ldb_dn_new(mem_ctx, ldb_ctx, BASE_DN);
+}
+
+static void emsabp_anr_teardown(void)
+{
+	emsabp_anr_cache_flush();
+	unlink(ldb_path);
+	talloc_free(mem_ctx);
+}
+
+Suite *mapiproxy_emsabp_anr_suite(void)
+{
+	Suite	*s;
+	TCase	*tc;
+
+	s = suite_create("mapiproxy: EMSABP ambiguous name resolution");
+
+	tc = tcase_create("ANR");
+	tcase_add_checked_fixture(tc, emsabp_anr_setup, emsabp_anr_teardown);
+
+	tcase_add_test(tc, test_resolve);
+	tcase_add_test(tc, test_chunks);
+	tcase_add_test(tc, test_cache);
+
+	suite_add_tcase(s, tc);
+
+	return s;
+}
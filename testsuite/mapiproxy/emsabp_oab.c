@@ -0,0 +1,217 @@
+/*
+   EMSABP Offline Address Book Unit Testing
+
+   OpenChange Project
+
+   This program is free software; you can redistribute it and/or modify
+   it under the terms of the GNU General Public License as published by
+   the Free Software Foundation; either version 3 of the License, or
+   (at your option) any later version.
+
+   This program is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+   GNU General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "testsuite.h"
+#include "mapiproxy/servers/default/nspi/dcesrv_exchange_nsp.h"
+
+static TALLOC_CTX	*mem_ctx;
+
+static const struct emsabp_oab_attr hdr_attrs[] = {
+	{ PidTagOfflineAddressBookName,		0				},
+	{ PidTagOfflineAddressBookSequence,	0				}
+};
+
+static const struct emsabp_oab_attr attrs[] = {
+	{ PidTagDisplayName,			EMSABP_OAB_ANR|EMSABP_OAB_INDEX	},
+	{ PidTagDisplayType,			0				},
+	{ PidTagAddressBookProxyAddresses,	0				}
+};
+
+static const struct emsabp_oab_attr double_attrs[] = {
+	{ PidTagDisplayName,				0				},
+	{ (PidTagDisplayType & 0xFFFF0000) | PT_DOUBLE,	0				},
+	{ PidTagAddressBookProxyAddresses,		0				}
+};
+
+static uint32_t get_uint32(const uint8_t *data)
+{
+	return data[0] | (data[1] << 8) | (data[2] << 16) | ((uint32_t)data[3] << 24);
+}
+
+static void set_value(struct PropertyValue_r *prop, uint32_t ulPropTag, bool present)
+{
+	prop->ulPropTag = (enum MAPITAGS) (present ? ulPropTag : (ulPropTag & 0xFFFF0000) | PT_ERROR);
+	prop->dwAlignPad = 0;
+}
+
+// v Unit test ----------------------------------------------------------------
+
+START_TEST (test_crc) {
+	const uint8_t	*data = (const uint8_t *)"123456789";
+
+	/* CRC-32 of the check string, not inverted */
+	ck_assert_int_eq(emsabp_oab_crc(0xFFFFFFFF, data, 9), 0x340BC6D9);
+	ck_assert_int_eq(emsabp_oab_crc(emsabp_oab_crc(0xFFFFFFFF, data, 4), data + 4, 5), 0x340BC6D9);
+	ck_assert_int_eq(emsabp_oab_crc(0xFFFFFFFF, data, 0), 0xFFFFFFFF);
+} END_TEST
+
+START_TEST (test_details) {
+	struct PropertyRow_r	hdr_row;
+	struct PropertyRow_r	rows[2];
+	const char		*proxies[] = { "SMTP:alice@example.com", "X500:/o=First" };
+	const uint8_t		*p;
+	DATA_BLOB		details;
+
+	hdr_row.cValues = 2;
+	hdr_row.lpProps = talloc_zero_array(mem_ctx, struct PropertyValue_r, 2);
+	set_value(&hdr_row.lpProps[0], PidTagOfflineAddressBookName, true);
+	hdr_row.lpProps[0].value.lpszW = "GAL";
+	set_value(&hdr_row.lpProps[1], PidTagOfflineAddressBookSequence, true);
+	hdr_row.lpProps[1].value.l = 300;
+
+	rows[0].cValues = 3;
+	rows[0].lpProps = talloc_zero_array(mem_ctx, struct PropertyValue_r, 3);
+	set_value(&rows[0].lpProps[0], PidTagDisplayName, true);
+	rows[0].lpProps[0].value.lpszW = "Alice";
+	set_value(&rows[0].lpProps[1], PidTagDisplayType, true);
+	rows[0].lpProps[1].value.l = 0x10000;
+	set_value(&rows[0].lpProps[2], PidTagAddressBookProxyAddresses, true);
+	rows[0].lpProps[2].value.MVszW.cValues = 2;
+	rows[0].lpProps[2].value.MVszW.lppszW = proxies;
+
+	/* A record without display type nor proxy addresses */
+	rows[1].cValues = 3;
+	rows[1].lpProps = talloc_zero_array(mem_ctx, struct PropertyValue_r, 3);
+	set_value(&rows[1].lpProps[0], PidTagDisplayName, true);
+	rows[1].lpProps[0].value.lpszW = "Bob";
+	set_value(&rows[1].lpProps[1], PidTagDisplayType, false);
+	set_value(&rows[1].lpProps[2], PidTagAddressBookProxyAddresses, false);
+
+	ck_assert_int_eq(emsabp_oab_details(mem_ctx, hdr_attrs, 2, &hdr_row, attrs, 3, rows, 2, &details),
+			 MAPI_E_SUCCESS);
+
+	/* Header: version, CRC of what follows and number of records */
+	p = details.data;
+	ck_assert_int_eq(get_uint32(p), 0x20);
+	ck_assert_int_eq(get_uint32(p + 4), emsabp_oab_crc(0xFFFFFFFF, p + 12, details.length - 12));
+	ck_assert_int_eq(get_uint32(p + 8), 2);
+	p += 12;
+
+	/* Metadata: the header and record property tables */
+	ck_assert_int_eq(get_uint32(p), 4 + 4 + 2 * 8 + 4 + 3 * 8);
+	ck_assert_int_eq(get_uint32(p + 4), 2);
+	ck_assert_int_eq(get_uint32(p + 8), PidTagOfflineAddressBookName);
+	ck_assert_int_eq(get_uint32(p + 16), PidTagOfflineAddressBookSequence);
+	ck_assert_int_eq(get_uint32(p + 24), 3);
+	ck_assert_int_eq(get_uint32(p + 28), PidTagDisplayName);
+	ck_assert_int_eq(get_uint32(p + 32), EMSABP_OAB_ANR|EMSABP_OAB_INDEX);
+	p += get_uint32(p);
+
+	/* Header record: size, presence bits, "GAL" and 300 on 3 bytes */
+	ck_assert_int_eq(get_uint32(p), 4 + 1 + 4 + 3);
+	ck_assert_int_eq(p[4], 0xC0);
+	ck_assert(memcmp(p + 5, "GAL\0\x82\x2C\x01", 7) == 0);
+	p += get_uint32(p);
+
+	/* Alice: every property, 0x10000 on 4 bytes and 2 addresses */
+	ck_assert_int_eq(get_uint32(p), 4 + 1 + 6 + 4 + 1 + 23 + 14);
+	ck_assert_int_eq(p[4], 0xE0);
+	ck_assert(memcmp(p + 5, "Alice\0\x83\x00\x00\x01\x02SMTP:", 16) == 0);
+	p += get_uint32(p);
+
+	/* Bob: only the display name */
+	ck_assert_int_eq(get_uint32(p), 4 + 1 + 4);
+	ck_assert_int_eq(p[4], 0x80);
+	ck_assert(memcmp(p + 5, "Bob", 4) == 0);
+	p += get_uint32(p);
+
+	ck_assert(p == details.data + details.length);
+
+	/* Property types the format can't hold are rejected */
+	rows[1].lpProps[1].ulPropTag = (enum MAPITAGS) double_attrs[1].ulPropTag;
+	ck_assert_int_eq(emsabp_oab_details(mem_ctx, hdr_attrs, 2, &hdr_row, double_attrs, 3, rows, 2, &details),
+			 MAPI_E_INVALID_PARAMETER);
+} END_TEST
+
+START_TEST (test_compress) {
+	const uint8_t	*data = (const uint8_t *)"0123456789";
+	DATA_BLOB	in;
+	DATA_BLOB	out;
+	const uint8_t	*p;
+
+	in.data = (uint8_t *)data;
+	in.length = 10;
+
+	ck_assert_int_eq(emsabp_oab_compress(mem_ctx, &in, 4, &out), MAPI_E_SUCCESS);
+	ck_assert_int_eq(out.length, 16 + 3 * 16 + 10);
+
+	/* Header: version, maximum block size and uncompressed size */
+	p = out.data;
+	ck_assert_int_eq(get_uint32(p), 3);
+	ck_assert_int_eq(get_uint32(p + 4), 1);
+	ck_assert_int_eq(get_uint32(p + 8), 4);
+	ck_assert_int_eq(get_uint32(p + 12), 10);
+	p += 16;
+
+	/* Stored blocks of 4, 4 and 2 bytes */
+	ck_assert_int_eq(get_uint32(p), 0);
+	ck_assert_int_eq(get_uint32(p + 4), 4);
+	ck_assert_int_eq(get_uint32(p + 8), 4);
+	ck_assert_int_eq(get_uint32(p + 12), emsabp_oab_crc(0xFFFFFFFF, data, 4));
+	ck_assert(memcmp(p + 16, data, 4) == 0);
+	p += 20;
+	ck_assert_int_eq(get_uint32(p + 4), 4);
+	ck_assert(memcmp(p + 16, data + 4, 4) == 0);
+	p += 20;
+	ck_assert_int_eq(get_uint32(p + 4), 2);
+	ck_assert_int_eq(get_uint32(p + 8), 2);
+	ck_assert_int_eq(get_uint32(p + 12), emsabp_oab_crc(0xFFFFFFFF, data + 8, 2));
+	ck_assert(memcmp(p + 16, data + 8, 2) == 0);
+
+	/* Default block size and empty files */
+	ck_assert_int_eq(emsabp_oab_compress(mem_ctx, &in, 0, &out), MAPI_E_SUCCESS);
+	ck_assert_int_eq(get_uint32(out.data + 8), EMSABP_OAB_BLOCK_MAX);
+	ck_assert_int_eq(out.length, 16 + 16 + 10);
+	in.length = 0;
+	ck_assert_int_eq(emsabp_oab_compress(mem_ctx, &in, 0, &out), MAPI_E_SUCCESS);
+	ck_assert_int_eq(out.length, 16);
+} END_TEST
+
+// ^ unit tests ---------------------------------------------------------------
+
+// v suite definition ---------------------------------------------------------
+
+static void emsabp_oab_setup(void)
+{
+	mem_ctx = talloc_new(NULL);
+}
+
+static void emsabp_oab_teardown(void)
+{
+	talloc_free(mem_ctx);
+}
+
+Suite *mapiproxy_emsabp_oab_suite(void)
+{
+	Suite	*s;
+	TCase	*tc;
+
+	s = suite_create("mapiproxy: EMSABP Offline Address Book");
+
+	tc = tcase_create("OAB");
+	tcase_add_checked_fixture(tc, emsabp_oab_setup, emsabp_oab_teardown);
+
+	tcase_add_test(tc, test_crc);
+	tcase_add_test(tc, test_details);
+	tcase_add_test(tc, test_compress);
+
+	suite_add_tcase(s, tc);
+
+	return s;
+}
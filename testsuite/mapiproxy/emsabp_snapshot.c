@@ -0,0 +1,249 @@
+/*
+   EMSABP container snapshots Unit Testing
+
+   OpenChange Project
+
+   This program is free software; you can redistribute it and/or modify
+   it under the terms of the GNU General Public License as published by
+   the Free Software Foundation; either version 3 of the License, or
+   (at your option) any later version.
+
+   This program is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+   GNU General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "testsuite.h"
+#include "mapiproxy/servers/default/nspi/dcesrv_exchange_nsp.h"
+#include <unistd.h>
+
+#define	BASE_DN		"DC=example,DC=com"
+#define	FILTER		"(objectClass=user)"
+#define	ORGANIZATION	"First Organization"
+#define	NO_REBUILD	3600
+
+static TALLOC_CTX		*mem_ctx;
+static TDB_CONTEXT		*ttdb_ctx;
+static struct ldb_context	*ldb_ctx;
+static struct ldb_dn		*basedn;
+static char			*ldb_path;
+
+static void add_user(const char *cn, const char *displayName, uint64_t usn)
+{
+	struct ldb_message	*msg;
+
+	msg = ldb_msg_new(mem_ctx);
+	msg->dn = ldb_dn_new_fmt(msg, ldb_ctx, "CN=%s,CN=Users," BASE_DN, cn);
+	ldb_msg_add_string(msg, "objectClass", "user");
+	ldb_msg_add_string(msg, "displayName", displayName);
+	ldb_msg_add_fmt(msg, "uSNChanged", "%"PRIu64, usn);
+	ck_assert_int_eq(ldb_add(ldb_ctx, msg), LDB_SUCCESS);
+	talloc_free(msg);
+}
+
+static void delete_user(const char *cn)
+{
+	struct ldb_dn	*dn;
+
+	dn = ldb_dn_new_fmt(mem_ctx, ldb_ctx, "CN=%s,CN=Users," BASE_DN, cn);
+	ck_assert_int_eq(ldb_delete(ldb_ctx, dn), LDB_SUCCESS);
+	talloc_free(dn);
+}
+
+static void check_order(struct emsabp_snapshot *snapshot, uint32_t count, const char **names)
+{
+	uint32_t	i;
+
+	ck_assert_int_eq(snapshot->count, count);
+	for (i = 0; i < count; i++) {
+		ck_assert_str_eq(snapshot->entries[i]->displayName, names[i]);
+		ck_assert_int_eq(snapshot->entries[i]->row, i);
+	}
+}
+
+// v Unit test ----------------------------------------------------------------
+
+START_TEST (test_sorted) {
+	struct emsabp_snapshot	*snapshot;
+	const char		*names[] = { "alice", "Bob", "Charlie" };
+	uint32_t		MId;
+	uint32_t		row;
+
+	add_user("charlie", "Charlie", 1);
+	add_user("alice", "alice", 2);
+	add_user("bob", "Bob", 3);
+
+	ck_assert(emsabp_snapshot_find(1, ORGANIZATION) == NULL);
+	snapshot = emsabp_snapshot_add(1, ORGANIZATION, FILTER);
+	ck_assert(snapshot != NULL);
+	ck_assert(emsabp_snapshot_find(1, ORGANIZATION) == snapshot);
+	ck_assert(emsabp_snapshot_find(1, "Other Organization") == NULL);
+
+	ck_assert_int_eq(emsabp_snapshot_refresh(snapshot, ldb_ctx, basedn, 0, NO_REBUILD), MAPI_E_SUCCESS);
+	check_order(snapshot, 3, names);
+	ck_assert_int_eq(snapshot->highest_usn, 3);
+
+	ck_assert_int_eq(emsabp_snapshot_seek(snapshot, "b"), 1);
+	ck_assert_int_eq(emsabp_snapshot_seek(snapshot, "BOB"), 1);
+	ck_assert_int_eq(emsabp_snapshot_seek(snapshot, "Bz"), 2);
+	ck_assert_int_eq(emsabp_snapshot_seek(snapshot, "zz"), 3);
+
+	/* Session MIds are only created for the rows asked for */
+	ck_assert_int_eq(emsabp_snapshot_row_to_MId(snapshot, ttdb_ctx, 2, &MId), MAPI_E_SUCCESS);
+	ck_assert_int_eq(MId, EMSABP_TDB_TMP_MID_START + 1);
+	ck_assert_int_eq(emsabp_snapshot_MId_to_row(snapshot, ttdb_ctx, MId, &row), MAPI_E_SUCCESS);
+	ck_assert_int_eq(row, 2);
+	ck_assert_int_eq(emsabp_snapshot_MId_to_row(snapshot, ttdb_ctx, MId + 1, &row), MAPI_E_NOT_FOUND);
+	ck_assert_int_eq(emsabp_snapshot_row_to_MId(snapshot, ttdb_ctx, 3, &MId), MAPI_E_NOT_FOUND);
+
+	talloc_free(snapshot);
+	ck_assert(emsabp_snapshot_find(1, ORGANIZATION) == NULL);
+} END_TEST
+
+START_TEST (test_refresh) {
+	struct emsabp_snapshot	*snapshot;
+	const char		*names[] = { "alice", "Charlie", "Dave", "Eve" };
+	uint32_t		MId;
+	uint32_t		row;
+
+	add_user("charlie", "Charlie", 1);
+	add_user("alice", "alice", 2);
+	add_user("bob", "Bob", 3);
+
+	snapshot = emsabp_snapshot_add(2, ORGANIZATION, FILTER);
+	ck_assert(snapshot != NULL);
+	ck_assert_int_eq(emsabp_snapshot_refresh(snapshot, ldb_ctx, basedn, 0, NO_REBUILD), MAPI_E_SUCCESS);
+	ck_assert_int_eq(emsabp_snapshot_row_to_MId(snapshot, ttdb_ctx, 1, &MId), MAPI_E_SUCCESS);
+
+	/* bob is renamed and eve is created */
+	delete_user("bob");
+	add_user("bob", "Dave", 10);
+	add_user("eve", "Eve", 11);
+
+	/* Not due yet */
+	ck_assert_int_eq(emsabp_snapshot_refresh(snapshot, ldb_ctx, basedn, NO_REBUILD, NO_REBUILD), MAPI_E_SUCCESS);
+	ck_assert_int_eq(snapshot->count, 3);
+
+	ck_assert_int_eq(emsabp_snapshot_refresh(snapshot, ldb_ctx, basedn, 0, NO_REBUILD), MAPI_E_SUCCESS);
+	check_order(snapshot, 4, names);
+	ck_assert_int_eq(snapshot->highest_usn, 11);
+
+	/* The MId follows the record to its new row */
+	ck_assert_int_eq(emsabp_snapshot_MId_to_row(snapshot, ttdb_ctx, MId, &row), MAPI_E_SUCCESS);
+	ck_assert_int_eq(row, 2);
+
+	/* Deleted records are only dropped by a rebuild */
+	delete_user("alice");
+	ck_assert_int_eq(emsabp_snapshot_refresh(snapshot, ldb_ctx, basedn, 0, NO_REBUILD), MAPI_E_SUCCESS);
+	ck_assert_int_eq(snapshot->count, 4);
+	ck_assert_int_eq(emsabp_snapshot_refresh(snapshot, ldb_ctx, basedn, 0, 0), MAPI_E_SUCCESS);
+	check_order(snapshot, 3, names + 1);
+
+	talloc_free(snapshot);
+} END_TEST
+
+START_TEST (test_empty) {
+	struct emsabp_snapshot	*snapshot;
+
+	add_user("alice", "alice", 1);
+
+	/* A container without purportedSearch has no records */
+	snapshot = emsabp_snapshot_add(3, ORGANIZATION, NULL);
+	ck_assert(snapshot != NULL);
+	ck_assert_int_eq(emsabp_snapshot_refresh(snapshot, ldb_ctx, basedn, 0, 0), MAPI_E_SUCCESS);
+	ck_assert_int_eq(snapshot->count, 0);
+	ck_assert_int_eq(emsabp_snapshot_seek(snapshot, "alice"), 0);
+
+	talloc_free(snapshot);
+} END_TEST
+
+START_TEST (test_attrs) {
+	struct emsabp_snapshot	*snapshot;
+	struct SPropTagArray	*pPropTags;
+	const char		**attrs;
+	const char		*expected[] = { "distinguishedName", "legacyExchangeDN", "displayName",
+						"telephoneNumber", NULL };
+	uint32_t		i;
+
+	/* displayName is only listed once, anr and computed properties are skipped */
+	pPropTags = set_SPropTagArray(mem_ctx, 0x6, PR_DISPLAY_NAME, PR_DISPLAY_NAME_UNICODE,
+				      PR_INSTANCE_KEY, PidTagAnr, PR_OFFICE_TELEPHONE_NUMBER,
+				      PR_EMAIL_ADDRESS);
+	attrs = emsabp_property_get_attrs(mem_ctx, pPropTags);
+	ck_assert(attrs != NULL);
+	for (i = 0; expected[i]; i++) {
+		ck_assert(attrs[i] != NULL);
+		ck_assert_str_eq(attrs[i], expected[i]);
+	}
+	ck_assert(attrs[i] == NULL);
+	talloc_free(attrs);
+
+	/* Snapshot records only carry the attributes properties are built from */
+	add_user("alice", "alice", 1);
+	snapshot = emsabp_snapshot_add(4, ORGANIZATION, FILTER);
+	ck_assert(snapshot != NULL);
+	ck_assert_int_eq(emsabp_snapshot_refresh(snapshot, ldb_ctx, basedn, 0, 0), MAPI_E_SUCCESS);
+	ck_assert_int_eq(snapshot->count, 1);
+	ck_assert(ldb_msg_find_element(snapshot->entries[0]->msg, "displayName") != NULL);
+	ck_assert(ldb_msg_find_element(snapshot->entries[0]->msg, "objectClass") == NULL);
+
+	talloc_free(snapshot);
+} END_TEST
+
+// ^ unit tests ---------------------------------------------------------------
+
+// v suite definition ---------------------------------------------------------
+
+static void emsabp_snapshot_setup(void)
+{
+	struct ldb_message	*msg;
+
+	mem_ctx = talloc_new(NULL);
+	ttdb_ctx = emsabp_tdb_init_tmp(mem_ctx);
+	ck_assert(ttdb_ctx != NULL);
+
+	ldb_path = talloc_asprintf(mem_ctx, "/tmp/emsabp_snapshot_%d.ldb", getpid());
+	unlink(ldb_path);
+	ldb_ctx = ldb_init(mem_ctx, NULL);
+	ck_assert(ldb_ctx != NULL);
+	ck_assert_int_eq(ldb_connect(ldb_ctx, ldb_path, 0, NULL), LDB_SUCCESS);
+	basedn = ldb_dn_new(mem_ctx, ldb_ctx, BASE_DN);
+
+	/* uSNChanged is compared as a number, as in the directory */
+	msg = ldb_msg_new(mem_ctx);
+	msg->dn = ldb_dn_new(msg, ldb_ctx, "@ATTRIBUTES");
+	ldb_msg_add_string(msg, "uSNChanged", "INTEGER");
+	ck_assert_int_eq(ldb_add(ldb_ctx, msg), LDB_SUCCESS);
+	talloc_free(msg);
+}
+
+static void emsabp_snapshot_teardown(void)
+{
+	tdb_close(ttdb_ctx);
+	unlink(ldb_path);
+	talloc_free(mem_ctx);
+}
+
+Suite *mapiproxy_emsabp_snapshot_suite(void)
+{
+	Suite	*s;
+	TCase	*tc;
+
+	s = suite_create("mapiproxy: EMSABP container snapshots");
+
+	tc = tcase_create("Snapshots");
+	tcase_add_checked_fixture(tc, emsabp_snapshot_setup, emsabp_snapshot_teardown);
+
+	tcase_add_test(tc, test_sorted);
+	tcase_add_test(tc, test_refresh);
+	tcase_add_test(tc, test_empty);
+	tcase_add_test(tc, test_attrs);
+
+	suite_add_tcase(s, tc);
+
+	return s;
+}
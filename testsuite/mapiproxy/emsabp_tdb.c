@@ -0,0 +1,125 @@
+/*
+   EMSABP TDB database Unit Testing
+
+   OpenChange Project
+
+   This program is free software; you can redistribute it and/or modify
+   it under the terms of the GNU General Public License as published by
+   the Free Software Foundation; either version 3 of the License, or
+   (at your option) any later version.
+
+   This program is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+   GNU General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "testsuite.h"
+#include "mapiproxy/servers/default/nspi/dcesrv_exchange_nsp.h"
+
+#define	DN_USER1	"CN=user1,CN=Users,DC=example,DC=com"
+#define	DN_USER2	"CN=user2,CN=Users,DC=example,DC=com"
+
+static TALLOC_CTX	*mem_ctx;
+static TDB_CONTEXT	*tdb_ctx;
+
+static void store(const char *keyname, const char *value)
+{
+	TDB_DATA	key;
+	TDB_DATA	dbuf;
+
+	key.dptr = (unsigned char *) keyname;
+	key.dsize = strlen(keyname);
+	dbuf.dptr = (unsigned char *) value;
+	dbuf.dsize = strlen(value);
+
+	ck_assert_int_eq(tdb_store(tdb_ctx, key, dbuf, TDB_REPLACE), 0);
+}
+
+// v Unit test ----------------------------------------------------------------
+
+START_TEST (test_insert) {
+	uint32_t	MId1;
+	uint32_t	MId2;
+	char		*dn;
+
+	ck_assert_int_eq(emsabp_tdb_insert(tdb_ctx, DN_USER1), MAPI_E_SUCCESS);
+	ck_assert_int_eq(emsabp_tdb_insert(tdb_ctx, DN_USER2), MAPI_E_SUCCESS);
+	ck_assert_int_eq(emsabp_tdb_fetch_MId(tdb_ctx, DN_USER1, &MId1), MAPI_E_SUCCESS);
+	ck_assert_int_eq(emsabp_tdb_fetch_MId(tdb_ctx, DN_USER2, &MId2), MAPI_E_SUCCESS);
+	ck_assert_int_eq(MId1, EMSABP_TDB_TMP_MID_START + 1);
+	ck_assert_int_eq(MId2, EMSABP_TDB_TMP_MID_START + 2);
+
+	ck_assert(emsabp_tdb_lookup_MId(tdb_ctx, MId1));
+	ck_assert(emsabp_tdb_lookup_MId(tdb_ctx, MId2));
+	ck_assert(!emsabp_tdb_lookup_MId(tdb_ctx, MId2 + 1));
+
+	ck_assert_int_eq(emsabp_tdb_fetch_dn_from_MId(mem_ctx, tdb_ctx, MId2, &dn), MAPI_E_SUCCESS);
+	ck_assert_str_eq(dn, DN_USER2);
+	ck_assert_int_eq(emsabp_tdb_fetch_dn_from_MId(mem_ctx, tdb_ctx, MId2 + 1, &dn), MAPI_E_NOT_FOUND);
+	ck_assert(dn == NULL);
+
+	/* A DN only gets one MId */
+	ck_assert_int_ne(emsabp_tdb_insert(tdb_ctx, DN_USER1), MAPI_E_SUCCESS);
+} END_TEST
+
+START_TEST (test_upgrade) {
+	char		*dn;
+
+	/* Records as written before the MId -> DN records existed */
+	store(DN_USER1, "0x1b29");
+	store(DN_USER2, "0x1b2a");
+	store(EMSABP_TDB_DATA_REC, "0x1b2a");
+
+	ck_assert(!emsabp_tdb_lookup_MId(tdb_ctx, 0x1b29));
+
+	ck_assert_int_eq(emsabp_tdb_upgrade(tdb_ctx), MAPI_E_SUCCESS);
+	ck_assert(emsabp_tdb_lookup_MId(tdb_ctx, 0x1b29));
+	ck_assert_int_eq(emsabp_tdb_fetch_dn_from_MId(mem_ctx, tdb_ctx, 0x1b2a, &dn), MAPI_E_SUCCESS);
+	ck_assert_str_eq(dn, DN_USER2);
+	ck_assert_int_eq(emsabp_tdb_fetch(tdb_ctx, EMSABP_TDB_VERSION_REC, NULL), MAPI_E_SUCCESS);
+
+	/* Upgraded databases are left alone */
+	store(EMSABP_TDB_MID_REC_PREFIX "0x1b29", DN_USER2);
+	ck_assert_int_eq(emsabp_tdb_upgrade(tdb_ctx), MAPI_E_SUCCESS);
+	ck_assert_int_eq(emsabp_tdb_fetch_dn_from_MId(mem_ctx, tdb_ctx, 0x1b29, &dn), MAPI_E_SUCCESS);
+	ck_assert_str_eq(dn, DN_USER2);
+} END_TEST
+
+// ^ unit tests ---------------------------------------------------------------
+
+// v suite definition ---------------------------------------------------------
+
+static void emsabp_tdb_setup(void)
+{
+	mem_ctx = talloc_new(NULL);
+	tdb_ctx = emsabp_tdb_init_tmp(mem_ctx);
+	ck_assert(tdb_ctx != NULL);
+}
+
+static void emsabp_tdb_teardown(void)
+{
+	tdb_close(tdb_ctx);
+	talloc_free(mem_ctx);
+}
+
+Suite *mapiproxy_emsabp_tdb_suite(void)
+{
+	Suite	*s;
+	TCase	*tc;
+
+	s = suite_create("mapiproxy: EMSABP TDB database");
+
+	tc = tcase_create("MId records");
+	tcase_add_checked_fixture(tc, emsabp_tdb_setup, emsabp_tdb_teardown);
+
+	tcase_add_test(tc, test_insert);
+	tcase_add_test(tc, test_upgrade);
+
+	suite_add_tcase(s, tc);
+
+	return s;
+}
@@ -0,0 +1,189 @@
+/*
+   EMSMDB provider chained responses Unit Testing
+
+   OpenChange Project
+
+   This program is free software; you can redistribute it and/or modify
+   it under the terms of the GNU General Public License as published by
+   the Free Software Foundation; either version 3 of the License, or
+   (at your option) any later version.
+
+   This program is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+   GNU General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "testsuite.h"
+#include "mapiproxy/servers/default/emsmdb/dcesrv_exchange_emsmdb.h"
+
+#define	CHAIN_OVERHEAD		32
+#define	CHAIN_PAYLOAD		0x1000
+#define	CHAIN_AVAILABLE		0x40000
+#define	CHAIN_FAIL		0xFFFFFFFF
+
+/* Chained ROP whose replies are described by sizes, 0 ending the data
+   and CHAIN_FAIL failing the ROP */
+struct chain_test {
+	const uint32_t	*sizes;
+	uint32_t	runs;
+	uint32_t	rewinds;
+	bool		can_rewind;
+};
+
+static enum emsmdbp_chain_status chain_test_run(void *private_data, TALLOC_CTX *mem_ctx,
+						uint32_t limit, struct ndr_push **ndrp)
+{
+	struct chain_test	*test = private_data;
+	struct ndr_push		*ndr;
+	uint32_t		size;
+
+	size = test->sizes[test->runs++];
+	if (!size || size == CHAIN_FAIL) return EMSMDBP_CHAIN_STOP;
+
+	ndr = ndr_push_init_ctx(mem_ctx);
+	ck_assert(ndr != NULL);
+	ck_assert(NDR_ERR_CODE_IS_SUCCESS(ndr_push_zero(ndr, size)));
+	*ndrp = ndr;
+
+	return test->sizes[test->runs] ? EMSMDBP_CHAIN_MORE : EMSMDBP_CHAIN_LAST;
+}
+
+static bool chain_test_rewind(void *private_data)
+{
+	struct chain_test	*test = private_data;
+
+	test->rewinds++;
+	return test->can_rewind;
+}
+
+static const struct emsmdbp_chain_ops chain_test_ops = {
+	.run = chain_test_run,
+	.rewind = chain_test_rewind,
+};
+
+static uint32_t chain_test_fill(TALLOC_CTX *mem_ctx, struct chain_test *test,
+				struct ndr_push ***segmentsp, uint32_t *countp)
+{
+	/* The first payload is the response itself */
+	*segmentsp = talloc_array(mem_ctx, struct ndr_push *, 1);
+	(*segmentsp)[0] = ndr_push_init_ctx(mem_ctx);
+	*countp = 1;
+
+	return emsmdbp_chain_fill(mem_ctx, &chain_test_ops, test, CHAIN_AVAILABLE, CHAIN_OVERHEAD,
+				  segmentsp, countp);
+}
+
+// v Unit test ----------------------------------------------------------------
+
+START_TEST (test_chain_all) {
+	TALLOC_CTX		*mem_ctx = talloc_new(NULL);
+	const uint32_t		sizes[] = { CHAIN_PAYLOAD, CHAIN_PAYLOAD, CHAIN_PAYLOAD, 0 };
+	struct chain_test	test = { sizes, 0, 0, false };
+	struct ndr_push		**segments;
+	uint32_t		count;
+
+	ck_assert_int_eq(chain_test_fill(mem_ctx, &test, &segments, &count), 3);
+	ck_assert_int_eq(count, 4);
+	ck_assert_int_eq(segments[3]->offset, CHAIN_PAYLOAD);
+	/* The last reply had no more data: the ROP was not run again */
+	ck_assert_int_eq(test.runs, 3);
+
+	talloc_free(mem_ctx);
+} END_TEST
+
+START_TEST (test_chain_overflow) {
+	TALLOC_CTX		*mem_ctx = talloc_new(NULL);
+	const uint32_t		sizes[] = { CHAIN_PAYLOAD, CHAIN_PAYLOAD,
+					    EMSMDB_CHAIN_SEGMENT_MAX + 1, CHAIN_PAYLOAD, 0 };
+	struct chain_test	test = { sizes, 0, 0, false };
+	struct ndr_push		**segments;
+	uint32_t		count;
+
+	/* The third reply overflows: the first two are kept */
+	ck_assert_int_eq(chain_test_fill(mem_ctx, &test, &segments, &count), 2);
+	ck_assert_int_eq(count, 3);
+	ck_assert_int_eq(segments[1]->offset, CHAIN_PAYLOAD);
+	ck_assert_int_eq(segments[2]->offset, CHAIN_PAYLOAD);
+	ck_assert_int_eq(test.runs, 3);
+	ck_assert_int_eq(test.rewinds, 1);
+
+	talloc_free(mem_ctx);
+} END_TEST
+
+START_TEST (test_chain_rewind) {
+	TALLOC_CTX		*mem_ctx = talloc_new(NULL);
+	const uint32_t		sizes[] = { CHAIN_PAYLOAD, EMSMDB_CHAIN_SEGMENT_MAX + 1,
+					    CHAIN_PAYLOAD, 0 };
+	struct chain_test	test = { sizes, 0, 0, true };
+	struct ndr_push		**segments;
+	uint32_t		count;
+
+	/* The overflowing reply is run again once taken back */
+	ck_assert_int_eq(chain_test_fill(mem_ctx, &test, &segments, &count), 2);
+	ck_assert_int_eq(count, 3);
+	ck_assert_int_eq(test.runs, 3);
+	ck_assert_int_eq(test.rewinds, 1);
+
+	talloc_free(mem_ctx);
+} END_TEST
+
+START_TEST (test_chain_failure) {
+	TALLOC_CTX		*mem_ctx = talloc_new(NULL);
+	const uint32_t		sizes[] = { CHAIN_PAYLOAD, CHAIN_FAIL, CHAIN_PAYLOAD, 0 };
+	struct chain_test	test = { sizes, 0, 0, false };
+	struct ndr_push		**segments;
+	uint32_t		count;
+
+	/* The payload built before the failure is kept */
+	ck_assert_int_eq(chain_test_fill(mem_ctx, &test, &segments, &count), 1);
+	ck_assert_int_eq(count, 2);
+	ck_assert_int_eq(test.runs, 2);
+
+	talloc_free(mem_ctx);
+} END_TEST
+
+START_TEST (test_chain_available) {
+	TALLOC_CTX		*mem_ctx = talloc_new(NULL);
+	const uint32_t		sizes[] = { CHAIN_PAYLOAD, CHAIN_PAYLOAD, 0 };
+	struct chain_test	test = { sizes, 0, 0, false };
+	struct ndr_push		**segments;
+	uint32_t		count = 0;
+
+	/* No room for another payload */
+	segments = NULL;
+	ck_assert_int_eq(emsmdbp_chain_fill(mem_ctx, &chain_test_ops, &test,
+					    CHAIN_OVERHEAD + EMSMDB_CHAIN_MIN_BUFFER, CHAIN_OVERHEAD,
+					    &segments, &count), 0);
+	ck_assert_int_eq(count, 0);
+	ck_assert_int_eq(test.runs, 0);
+
+	talloc_free(mem_ctx);
+} END_TEST
+
+// ^ unit tests ---------------------------------------------------------------
+
+// v suite definition ---------------------------------------------------------
+
+Suite *mapiproxy_emsmdbp_chain_suite(void)
+{
+	Suite	*s;
+	TCase	*tc;
+
+	s = suite_create("mapiproxy: EMSMDB provider chained responses");
+
+	tc = tcase_create("chained payloads");
+
+	tcase_add_test(tc, test_chain_all);
+	tcase_add_test(tc, test_chain_overflow);
+	tcase_add_test(tc, test_chain_rewind);
+	tcase_add_test(tc, test_chain_failure);
+	tcase_add_test(tc, test_chain_available);
+
+	suite_add_tcase(s, tc);
+
+	return s;
+}
@@ -0,0 +1,202 @@
+/*
+   EMSMDB sessions registry Unit Testing
+
+   OpenChange Project
+
+   This program is free software; you can redistribute it and/or modify
+   it under the terms of the GNU General Public License as published by
+   the Free Software Foundation; either version 3 of the License, or
+   (at your option) any later version.
+
+   This program is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+   GNU General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "testsuite.h"
+#include "mapiproxy/servers/default/emsmdb/dcesrv_exchange_emsmdb.h"
+
+/* Enough sessions for the ht table to grow several times */
+#define	SESSIONS_COUNT	100
+
+/* Global test variables */
+static TALLOC_CTX		*mem_ctx;
+static struct emsmdbp_sessions	*sessions;
+
+static struct exchange_emsmdb_session *new_session(uint32_t id)
+{
+	struct exchange_emsmdb_session	*session;
+
+	session = talloc_zero(mem_ctx, struct exchange_emsmdb_session);
+	ck_assert(session != NULL);
+	session->uuid.time_low = id;
+	session->uuid.node[5] = id & 0xff;
+
+	return session;
+}
+
+static uint32_t list_length(void)
+{
+	struct exchange_emsmdb_session	*session;
+	uint32_t			count = 0;
+
+	for (session = sessions->list; session; session = session->next) {
+		count++;
+	}
+
+	return count;
+}
+
+// v Unit test ----------------------------------------------------------------
+
+START_TEST (test_add_find) {
+	struct exchange_emsmdb_session	*session[SESSIONS_COUNT];
+	struct GUID			uuid;
+	uint32_t			i;
+
+	for (i = 0; i < SESSIONS_COUNT; i++) {
+		session[i] = new_session(i + 1);
+		ck_assert(emsmdbp_sessions_add(sessions, session[i]));
+	}
+	ck_assert_int_eq(list_length(), SESSIONS_COUNT);
+
+	/* Sessions are listed in the order they were added */
+	ck_assert(sessions->list == session[0]);
+	ck_assert(session[0]->next == session[1]);
+
+	for (i = 0; i < SESSIONS_COUNT; i++) {
+		uuid = session[i]->uuid;
+		ck_assert(emsmdbp_sessions_find(sessions, &uuid) == session[i]);
+	}
+
+	uuid = session[0]->uuid;
+	uuid.time_low = SESSIONS_COUNT + 1;
+	ck_assert(emsmdbp_sessions_find(sessions, &uuid) == NULL);
+	ck_assert(emsmdbp_sessions_find(sessions, NULL) == NULL);
+	ck_assert(emsmdbp_sessions_find(NULL, &uuid) == NULL);
+} END_TEST
+
+START_TEST (test_add_duplicate) {
+	struct exchange_emsmdb_session	*session;
+	struct exchange_emsmdb_session	*duplicate;
+
+	session = new_session(1);
+	duplicate = new_session(1);
+
+	ck_assert(emsmdbp_sessions_add(sessions, session));
+	ck_assert(!emsmdbp_sessions_add(sessions, duplicate));
+	ck_assert(!emsmdbp_sessions_add(sessions, NULL));
+	ck_assert(emsmdbp_sessions_find(sessions, &duplicate->uuid) == session);
+	ck_assert_int_eq(list_length(), 1);
+} END_TEST
+
+START_TEST (test_remove) {
+	struct exchange_emsmdb_session	*session[3];
+	uint32_t			i;
+
+	for (i = 0; i < 3; i++) {
+		session[i] = new_session(i + 1);
+		ck_assert(emsmdbp_sessions_add(sessions, session[i]));
+	}
+
+	/* Middle, last then first session of the list */
+	ck_assert(emsmdbp_sessions_remove(sessions, session[1]));
+	ck_assert(emsmdbp_sessions_find(sessions, &session[1]->uuid) == NULL);
+	ck_assert(emsmdbp_sessions_find(sessions, &session[0]->uuid) == session[0]);
+	ck_assert(emsmdbp_sessions_find(sessions, &session[2]->uuid) == session[2]);
+	ck_assert_int_eq(list_length(), 2);
+
+	ck_assert(emsmdbp_sessions_remove(sessions, session[2]));
+	ck_assert(emsmdbp_sessions_remove(sessions, session[0]));
+	ck_assert(sessions->list == NULL);
+	ck_assert(emsmdbp_sessions_find(sessions, &session[0]->uuid) == NULL);
+
+	/* Removing twice does not touch the list */
+	ck_assert(emsmdbp_sessions_add(sessions, session[0]));
+	ck_assert(!emsmdbp_sessions_remove(sessions, session[1]));
+	ck_assert(sessions->list == session[0]);
+	ck_assert_int_eq(list_length(), 1);
+
+	/* A removed session can be added again */
+	ck_assert(emsmdbp_sessions_add(sessions, session[1]));
+	ck_assert(emsmdbp_sessions_find(sessions, &session[1]->uuid) == session[1]);
+	ck_assert_int_eq(list_length(), 2);
+} END_TEST
+
+START_TEST (test_remove_iterating) {
+	struct exchange_emsmdb_session	*session[SESSIONS_COUNT];
+	struct exchange_emsmdb_session	*cur, *next;
+	uint32_t			i;
+
+	for (i = 0; i < SESSIONS_COUNT; i++) {
+		session[i] = new_session(i + 1);
+		ck_assert(emsmdbp_sessions_add(sessions, session[i]));
+	}
+
+	/* Remove every other session while walking the list */
+	for (cur = sessions->list, i = 0; cur; cur = next, i++) {
+		next = cur->next;
+		if (i % 2) {
+			ck_assert(emsmdbp_sessions_remove(sessions, cur));
+		}
+	}
+	ck_assert_int_eq(i, SESSIONS_COUNT);
+	ck_assert_int_eq(list_length(), SESSIONS_COUNT / 2);
+	for (i = 0; i < SESSIONS_COUNT; i++) {
+		if (i % 2) {
+			ck_assert(emsmdbp_sessions_find(sessions, &session[i]->uuid) == NULL);
+		} else {
+			ck_assert(emsmdbp_sessions_find(sessions, &session[i]->uuid) == session[i]);
+		}
+	}
+
+	/* Then all the remaining ones */
+	for (cur = sessions->list; cur; cur = next) {
+		next = cur->next;
+		ck_assert(emsmdbp_sessions_remove(sessions, cur));
+	}
+	ck_assert(sessions->list == NULL);
+	for (i = 0; i < SESSIONS_COUNT; i++) {
+		ck_assert(emsmdbp_sessions_find(sessions, &session[i]->uuid) == NULL);
+	}
+} END_TEST
+
+// ^ unit tests ---------------------------------------------------------------
+
+// v suite definition ---------------------------------------------------------
+
+static void emsmdbp_session_setup(void)
+{
+	mem_ctx = talloc_new(NULL);
+	sessions = emsmdbp_sessions_init(mem_ctx);
+	ck_assert(sessions != NULL);
+}
+
+static void emsmdbp_session_teardown(void)
+{
+	talloc_free(mem_ctx);
+}
+
+Suite *mapiproxy_emsmdbp_session_suite(void)
+{
+	Suite	*s;
+	TCase	*tc;
+
+	s = suite_create("mapiproxy: EMSMDB sessions registry");
+
+	tc = tcase_create("EMSMDB sessions interface");
+	tcase_add_checked_fixture(tc, emsmdbp_session_setup, emsmdbp_session_teardown);
+
+	tcase_add_test(tc, test_add_find);
+	tcase_add_test(tc, test_add_duplicate);
+	tcase_add_test(tc, test_remove);
+	tcase_add_test(tc, test_remove_iterating);
+
+	suite_add_tcase(s, tc);
+
+	return s;
+}
@@ -0,0 +1,252 @@
+/*
+   EMSMDB provider ROP statistics Unit Testing
+
+   OpenChange Project
+
+   This program is free software; you can redistribute it and/or modify
+   it under the terms of the GNU General Public License as published by
+   the Free Software Foundation; either version 3 of the License, or
+   (at your option) any later version.
+
+   This program is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+   GNU General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "testsuite.h"
+#include "mapiproxy/servers/default/emsmdb/dcesrv_exchange_emsmdb.h"
+
+#include <stdio.h>
+
+// v Unit test ----------------------------------------------------------------
+
+START_TEST (test_buckets) {
+	uint64_t	usec;
+	uint32_t	idx;
+	uint32_t	prev = 0;
+
+	/* Small values map to their own bucket */
+	for (usec = 0; usec < EMSMDBP_STATS_SUB_BUCKETS; usec++) {
+		ck_assert_int_eq(emsmdbp_stats_bucket(usec), usec);
+	}
+
+	/* Buckets are monotonic and always contain the value */
+	for (usec = 1; usec < 10000000; usec = usec * 5 / 4 + 1) {
+		idx = emsmdbp_stats_bucket(usec);
+		ck_assert(idx >= prev);
+		ck_assert(emsmdbp_stats_bucket_max(idx) >= usec);
+		if (idx) {
+			ck_assert(emsmdbp_stats_bucket_max(idx - 1) < usec);
+		}
+		prev = idx;
+	}
+
+	/* Huge values are clamped into the last bucket */
+	ck_assert_int_eq(emsmdbp_stats_bucket(UINT64_MAX), EMSMDBP_STATS_BUCKETS - 1);
+} END_TEST
+
+START_TEST (test_record) {
+	const struct emsmdbp_rop_stats	*stats;
+	uint32_t			i;
+
+	ck_assert(emsmdbp_stats_get(op_MAPI_QueryRows) == NULL);
+
+	for (i = 1; i <= 100; i++) {
+		emsmdbp_stats_record(op_MAPI_QueryRows, (i % 10) == 0, 10, i * 100);
+	}
+
+	stats = emsmdbp_stats_get(op_MAPI_QueryRows);
+	ck_assert(stats != NULL);
+	ck_assert_int_eq(stats->count, 100);
+	ck_assert_int_eq(stats->errors, 10);
+	ck_assert_int_eq(stats->response_bytes, 1000);
+	ck_assert_int_eq(stats->latency_max, 10000);
+	ck_assert_int_eq(stats->latency_total, 505000);
+
+	/* Percentiles are bucket upper bounds, within 25% of the exact value */
+	ck_assert(emsmdbp_stats_percentile(stats, 50.0) >= 5000);
+	ck_assert(emsmdbp_stats_percentile(stats, 50.0) <= 6250);
+	ck_assert(emsmdbp_stats_percentile(stats, 90.0) >= 9000);
+	ck_assert_int_eq(emsmdbp_stats_percentile(stats, 100.0), 10000);
+
+	ck_assert(emsmdbp_stats_get(op_MAPI_GetProps) == NULL);
+} END_TEST
+
+START_TEST (test_reset) {
+	emsmdbp_stats_record(op_MAPI_GetProps, false, 20, 50);
+	ck_assert(emsmdbp_stats_get(op_MAPI_GetProps) != NULL);
+
+	emsmdbp_stats_reset();
+	ck_assert(emsmdbp_stats_get(op_MAPI_GetProps) == NULL);
+} END_TEST
+
+START_TEST (test_dump) {
+	char	path[] = "/tmp/emsmdbp_stats_XXXXXX";
+	char	line[256];
+	FILE	*fp;
+	int	fd;
+	int	rows = 0;
+
+	fd = mkstemp(path);
+	ck_assert(fd != -1);
+	close(fd);
+
+	emsmdbp_stats_record(op_MAPI_GetProps, false, 20, 50);
+	emsmdbp_stats_record(op_MAPI_SetProps, true, 6, 70);
+	ck_assert_int_eq(emsmdbp_stats_dump(path), MAPI_E_SUCCESS);
+
+	fp = fopen(path, "r");
+	ck_assert(fp != NULL);
+	while (fgets(line, sizeof (line), fp)) {
+		/* ROP rows only, client and pool rows come afterwards */
+		if (strncmp(line, "0x", 2)) continue;
+		rows++;
+	}
+	fclose(fp);
+	unlink(path);
+
+	ck_assert_int_eq(rows, 2);
+	ck_assert_int_eq(emsmdbp_stats_dump(NULL), MAPI_E_INVALID_PARAMETER);
+} END_TEST
+
+START_TEST (test_client) {
+	TALLOC_CTX			*mem_ctx;
+	struct emsmdbp_client_stats	*client;
+	struct AUX_HEADER		aux_header[4];
+
+	mem_ctx = talloc_new(NULL);
+	client = emsmdbp_stats_client_init(mem_ctx, "user1");
+	ck_assert(client != NULL);
+	ck_assert_str_eq(client->username, "user1");
+
+	emsmdbp_stats_client_server_time(client, 100, 2000);
+	emsmdbp_stats_client_server_time(NULL, 100, 2000);
+	ck_assert_int_eq(client->server.count, 1);
+	ck_assert_int_eq(client->server.response_bytes, 100);
+
+	memset(aux_header, 0, sizeof (aux_header));
+	aux_header[0].Size = 0x18;
+	aux_header[0].Version = AUX_VERSION_1;
+	aux_header[0].Type = AUX_TYPE_PERF_MDB_SUCCESS;
+	aux_header[0].Payload_1.AUX_PERF_MDB_SUCCESS.TimeToCompleteRequest = 12;
+	aux_header[1].Size = 0x20;
+	aux_header[1].Version = AUX_VERSION_1;
+	aux_header[1].Type = AUX_TYPE_PERF_FAILURE;
+	aux_header[1].Payload_1.AUX_PERF_FAILURE.TimeToFailRequest = 30;
+	/* Global catalog blocks are not recorded */
+	aux_header[2].Size = 0x18;
+	aux_header[2].Version = AUX_VERSION_1;
+	aux_header[2].Type = AUX_TYPE_PERF_GC_SUCCESS;
+
+	ck_assert_int_eq(emsmdbp_stats_client_aux(client, aux_header), 2);
+	ck_assert_int_eq(client->reported.count, 2);
+	ck_assert_int_eq(client->reported.errors, 1);
+	ck_assert_int_eq(client->reported.latency_max, 30000);
+	ck_assert_int_eq(emsmdbp_stats_client_aux(client, NULL), 0);
+
+	emsmdbp_stats_reset();
+	ck_assert_int_eq(client->server.count, 0);
+	ck_assert_int_eq(client->reported.count, 0);
+
+	talloc_free(mem_ctx);
+} END_TEST
+
+START_TEST (test_compression) {
+	struct emsmdbp_compression_stats	stats;
+
+	emsmdbp_stats_compression(2000, 500);
+	emsmdbp_stats_compression(3000, 1000);
+	/* Responses sent uncompressed */
+	emsmdbp_stats_compression(100, 100);
+
+	emsmdbp_stats_get_compression(&stats);
+	ck_assert_int_eq(stats.responses, 3);
+	ck_assert_int_eq(stats.compressed, 2);
+	ck_assert_int_eq(stats.uncompressed_bytes, 5000);
+	ck_assert_int_eq(stats.compressed_bytes, 1500);
+
+	emsmdbp_stats_reset();
+	emsmdbp_stats_get_compression(&stats);
+	ck_assert_int_eq(stats.responses, 0);
+	ck_assert_int_eq(stats.compressed_bytes, 0);
+} END_TEST
+
+// ^ unit tests ---------------------------------------------------------------
+
+static uint32_t	subsystem_calls;
+
+static void subsystem_dump(FILE *fp)
+{
+	fprintf(fp, "subsystem %u\n", subsystem_calls);
+}
+
+static void subsystem_reset(void)
+{
+	subsystem_calls = 0;
+}
+
+START_TEST (test_subsystem) {
+	char		path[] = "/tmp/emsmdbp_stats_XXXXXX";
+	char		line[256];
+	FILE		*fp;
+	int		fd;
+	int		rows = 0;
+
+	fd = mkstemp(path);
+	ck_assert(fd != -1);
+	close(fd);
+
+	ck_assert(mapiproxy_stats_register("subsystem", subsystem_dump, subsystem_reset));
+	/* Registering again keeps a single entry */
+	ck_assert(mapiproxy_stats_register("subsystem", subsystem_dump, subsystem_reset));
+	ck_assert(!mapiproxy_stats_register("subsystem", NULL, subsystem_reset));
+
+	subsystem_calls = 42;
+	ck_assert_int_eq(emsmdbp_stats_dump(path), MAPI_E_SUCCESS);
+	fp = fopen(path, "r");
+	ck_assert(fp != NULL);
+	while (fgets(line, sizeof (line), fp)) {
+		if (!strcmp(line, "subsystem 42\n")) rows++;
+	}
+	fclose(fp);
+	unlink(path);
+	ck_assert_int_eq(rows, 1);
+
+	/* Resetting the ROP statistics resets the subsystems ones */
+	emsmdbp_stats_reset();
+	ck_assert_int_eq(subsystem_calls, 0);
+} END_TEST
+
+// v suite definition ---------------------------------------------------------
+
+static void emsmdbp_stats_teardown(void)
+{
+	emsmdbp_stats_reset();
+}
+
+Suite *mapiproxy_emsmdbp_stats_suite(void)
+{
+	Suite	*s;
+	TCase	*tc;
+
+	s = suite_create("mapiproxy: EMSMDB provider ROP statistics");
+
+	tc = tcase_create("ROP statistics interface");
+	tcase_add_checked_fixture(tc, NULL, emsmdbp_stats_teardown);
+
+	tcase_add_test(tc, test_buckets);
+	tcase_add_test(tc, test_record);
+	tcase_add_test(tc, test_reset);
+	tcase_add_test(tc, test_dump);
+	tcase_add_test(tc, test_client);
+	tcase_add_test(tc, test_compression);
+	tcase_add_test(tc, test_subsystem);
+
+	suite_add_tcase(s, tc);
+
+	return s;
+}
@@ -244,6 +244,188 @@ START_TEST (test_create_schema) {
 
 } END_TEST
 
+START_TEST (test_prepared_statements) {
+	enum MYSQLRESULT	ret;
+	uint64_t		affected_rows = 0;
+	size_t			cached;
+	struct stmt_value	params[] = { STMT_UINT_VALUE(1), STMT_STRING_VALUE("it's a value") };
+	struct stmt_value	key[] = { STMT_UINT_VALUE(1) };
+	struct stmt_value	results[] = { STMT_UINT_VALUE(0), STMT_STRING_VALUE(NULL) };
+
+	ret = execute_query(conn, "CREATE TABLE IF NOT EXISTS stmt_test ("
+			    "id INT UNSIGNED NOT NULL PRIMARY KEY, "
+			    "value VARCHAR(255) DEFAULT NULL)");
+	ck_assert_int_eq(ret, MYSQL_SUCCESS);
+
+	cached = stmt_cache_count(conn);
+
+	ret = stmt_execute(conn, "INSERT INTO stmt_test (id, value) VALUES (?, ?)",
+			   params, 2, &affected_rows);
+	ck_assert_int_eq(ret, MYSQL_SUCCESS);
+	ck_assert_int_eq(affected_rows, 1);
+
+	/* Same template reuses the cached statement */
+	params[0].n = 2;
+	params[1].is_null = true;
+	ret = stmt_execute(conn, "INSERT INTO stmt_test (id, value) VALUES (?, ?)",
+			   params, 2, NULL);
+	ck_assert_int_eq(ret, MYSQL_SUCCESS);
+	ck_assert_int_eq(stmt_cache_count(conn), cached + 1);
+
+	/* Wrong number of parameters */
+	ret = stmt_execute(conn, "INSERT INTO stmt_test (id, value) VALUES (?, ?)",
+			   params, 1, NULL);
+	ck_assert_int_eq(ret, MYSQL_ERROR);
+
+	ret = stmt_select_first(mem_ctx, conn, "SELECT id, value FROM stmt_test WHERE id = ?",
+				key, 1, results, 2);
+	ck_assert_int_eq(ret, MYSQL_SUCCESS);
+	ck_assert_int_eq(results[0].n, 1);
+	ck_assert_str_eq(results[1].s, "it's a value");
+
+	key[0].n = 2;
+	ret = stmt_select_first(mem_ctx, conn, "SELECT id, value FROM stmt_test WHERE id = ?",
+				key, 1, results, 2);
+	ck_assert_int_eq(ret, MYSQL_SUCCESS);
+	ck_assert(results[1].is_null);
+	ck_assert(results[1].s == NULL);
+	ck_assert_int_eq(stmt_cache_count(conn), cached + 2);
+
+	key[0].n = 3;
+	ret = stmt_select_first(mem_ctx, conn, "SELECT id, value FROM stmt_test WHERE id = ?",
+				key, 1, results, 2);
+	ck_assert_int_eq(ret, MYSQL_NOT_FOUND);
+
+	/* Statements which cannot be prepared are not cached */
+	ret = stmt_execute(conn, "INSERT INTO stmt_missing (id) VALUES (?)", key, 1, NULL);
+	ck_assert_int_eq(ret, MYSQL_ERROR);
+	ck_assert_int_eq(stmt_cache_count(conn), cached + 2);
+
+	ret = execute_query(conn, "DROP TABLE stmt_test");
+	ck_assert_int_eq(ret, MYSQL_SUCCESS);
+} END_TEST
+
+START_TEST (test_connection_pool) {
+	const char		*connection_string;
+	struct mysql_pool_stats	stats;
+	MYSQL			*c1 = NULL, *c2 = NULL, *c3 = NULL, *c4 = NULL;
+
+	connection_string = "mysql://"OC_TESTSUITE_MYSQL_USER":"OC_TESTSUITE_MYSQL_PASS
+			    "@"OC_TESTSUITE_MYSQL_HOST"/"OC_TESTSUITE_MYSQL_DB"?min=1&max=2&wait=0";
+
+	/* Invalid pool options */
+	ck_assert(create_connection("mysql://"OC_TESTSUITE_MYSQL_USER"@"OC_TESTSUITE_MYSQL_HOST
+				    "/"OC_TESTSUITE_MYSQL_DB"?max=0", &c4) == NULL);
+	ck_assert(create_connection("mysql://"OC_TESTSUITE_MYSQL_USER"@"OC_TESTSUITE_MYSQL_HOST
+				    "/"OC_TESTSUITE_MYSQL_DB"?batman=1", &c4) == NULL);
+	ck_assert(!mysql_pool_get_stats("mysql://nobody@localhost/db", &stats));
+
+	/* Checked out connections are not handed out twice... */
+	ck_assert(create_connection(connection_string, &c1) != NULL);
+	ck_assert(create_connection(connection_string, &c2) != NULL);
+	ck_assert(c1 != c2);
+
+	/* ...not even when the pool is exhausted */
+	ck_assert(create_connection(connection_string, &c3) == NULL);
+	ck_assert(c3 == NULL);
+
+	ck_assert(mysql_pool_get_stats(connection_string, &stats));
+	ck_assert_int_eq(stats.open, 2);
+	ck_assert_int_eq(stats.in_use, 2);
+	ck_assert_int_eq(stats.checkouts, 2);
+	ck_assert_int_eq(stats.exhausted, 1);
+
+	release_connection(c2);
+	ck_assert(mysql_pool_get_stats(connection_string, &stats));
+	ck_assert_int_eq(stats.in_use, 1);
+
+	/* Checked in connections are reused */
+	ck_assert(create_connection(connection_string, &c4) == c2);
+	ck_assert_int_eq(mysql_ping(c4), 0);
+
+	release_connection(c4);
+	release_connection(c1);
+	ck_assert(mysql_pool_get_stats(connection_string, &stats));
+	ck_assert_int_eq(stats.open, 2);
+	ck_assert_int_eq(stats.in_use, 0);
+	ck_assert_int_eq(stats.checkouts, 3);
+} END_TEST
+
+START_TEST (test_read_write_split) {
+	const char		*connection_string;
+	const char		*replica_string;
+	struct mysql_rw		*rw;
+	struct mysql_pool_stats	stats;
+	MYSQL			*primary, *replica;
+
+	connection_string = "mysql://"OC_TESTSUITE_MYSQL_USER":"OC_TESTSUITE_MYSQL_PASS
+			    "@"OC_TESTSUITE_MYSQL_HOST"/"OC_TESTSUITE_MYSQL_DB"?max=4";
+	/* Same database, its own pool */
+	replica_string = "mysql://"OC_TESTSUITE_MYSQL_USER":"OC_TESTSUITE_MYSQL_PASS
+			 "@"OC_TESTSUITE_MYSQL_HOST"/"OC_TESTSUITE_MYSQL_DB"?max=3";
+
+	/* Without replica everything goes to the primary */
+	ck_assert(mysql_rw_init(mem_ctx, NULL, replica_string, 5) == NULL);
+	rw = mysql_rw_init(mem_ctx, connection_string, NULL, 5);
+	ck_assert(rw != NULL);
+	primary = mysql_rw_writer(rw, "user1");
+	ck_assert(primary != NULL);
+	ck_assert(mysql_rw_reader(rw, "user1") == primary);
+	ck_assert(mysql_rw_reader(rw, "user2") == primary);
+
+	/* Connections are checked out until the operation is done */
+	ck_assert(mysql_pool_get_stats(connection_string, &stats));
+	ck_assert_int_eq(stats.in_use, 1);
+	mysql_rw_release(rw);
+	ck_assert(mysql_pool_get_stats(connection_string, &stats));
+	ck_assert_int_eq(stats.in_use, 0);
+	talloc_free(rw);
+
+	rw = mysql_rw_init(mem_ctx, connection_string, replica_string, 60);
+	ck_assert(rw != NULL);
+	replica = mysql_rw_reader(rw, "user1");
+	ck_assert(replica != NULL);
+	ck_assert(mysql_rw_reader(rw, NULL) == replica);
+
+	/* A session reads its own writes... */
+	primary = mysql_rw_writer(rw, "user1");
+	ck_assert(primary != NULL);
+	ck_assert(primary != replica);
+	ck_assert(mysql_rw_reader(rw, "user1") == primary);
+	/* ...without affecting other sessions */
+	ck_assert(mysql_rw_reader(rw, "user2") == replica);
+	ck_assert(mysql_rw_reader(rw, NULL) == replica);
+	/* Reads which can't tell their session see every write */
+	ck_assert(mysql_rw_reader_any(rw) == primary);
+
+	/* Transactions keep the primary and read from it until they end */
+	mysql_rw_pin(rw, true);
+	ck_assert(mysql_rw_reader(rw, "user2") == primary);
+	mysql_rw_release(rw);
+	ck_assert(mysql_pool_get_stats(connection_string, &stats));
+	ck_assert_int_eq(stats.in_use, 1);
+	ck_assert(mysql_pool_get_stats(replica_string, &stats));
+	ck_assert_int_eq(stats.in_use, 0);
+	ck_assert(mysql_rw_writer(rw, "user1") == primary);
+	mysql_rw_pin(rw, false);
+	mysql_rw_pin(rw, false);
+	replica = mysql_rw_reader(rw, "user2");
+	ck_assert(replica != NULL);
+	ck_assert(replica != primary);
+
+	/* Writes without session are seen by every session */
+	ck_assert(mysql_rw_writer(rw, NULL) == primary);
+	ck_assert(mysql_rw_reader(rw, "user2") == primary);
+	ck_assert_int_eq(rw->replica_reads, 5);
+
+	/* Both connections are checked in along with the split */
+	talloc_free(rw);
+	ck_assert(mysql_pool_get_stats(connection_string, &stats));
+	ck_assert_int_eq(stats.in_use, 0);
+	ck_assert(mysql_pool_get_stats(replica_string, &stats));
+	ck_assert_int_eq(stats.in_use, 0);
+} END_TEST
+
 // ^ unit tests ---------------------------------------------------------------
 
 // v suite definition ---------------------------------------------------------
@@ -285,6 +467,9 @@ Suite *mapiproxy_util_mysql_suite(void)
 	tcase_add_test(tc, test_parse_connection_string_fail);
 	tcase_add_test(tc, test_parse_connection_string_success);
 	tcase_add_test(tc, test_create_schema);
+	tcase_add_test(tc, test_prepared_statements);
+	tcase_add_test(tc, test_connection_pool);
+	tcase_add_test(tc, test_read_write_split);
 
 	suite_add_tcase(s, tc);
 
@@ -107,6 +107,9 @@ int main(int argc, const char *argv[])
 	srunner_add_suite(sr, mapiproxy_openchangedb_ldb_suite());
 	srunner_add_suite(sr, mapiproxy_openchangedb_multitenancy_mysql_suite());
 	srunner_add_suite(sr, mapiproxy_openchangedb_logger_suite());
+	srunner_add_suite(sr, mapiproxy_openchangedb_cache_suite());
+	srunner_add_suite(sr, mapiproxy_openchangedb_profiler_suite());
+	srunner_add_suite(sr, mapiproxy_mapi_handles_suite());
 	/* libmapistore */
 	srunner_add_suite(sr, mapistore_namedprops_suite());
 	srunner_add_suite(sr, mapistore_namedprops_mysql_suite());
@@ -117,6 +120,14 @@ int main(int argc, const char *argv[])
 	/* mapiproxy */
 	srunner_add_suite(sr, mapiproxy_util_mysql_suite());
 	srunner_add_suite(sr, mapiproxy_util_schema_migration_suite());
+	srunner_add_suite(sr, mapiproxy_emsmdbp_stats_suite());
+	srunner_add_suite(sr, mapiproxy_emsmdbp_chain_suite());
+	srunner_add_suite(sr, mapiproxy_emsmdbp_session_suite());
+	srunner_add_suite(sr, mapiproxy_emsabp_tdb_suite());
+	srunner_add_suite(sr, mapiproxy_emsabp_snapshot_suite());
+	srunner_add_suite(sr, mapiproxy_emsabp_anr_suite());
+	srunner_add_suite(sr, mapiproxy_emsabp_oab_suite());
+	srunner_add_suite(sr, mapiproxy_emsabp_session_suite());
 
 	srunner_run_all(sr, CK_ENV);
 	nf = srunner_ntests_failed(sr);
@@ -51,6 +51,9 @@ Suite *mapiproxy_openchangedb_mysql_suite(void);
 Suite *mapiproxy_openchangedb_ldb_suite(void);
 Suite *mapiproxy_openchangedb_multitenancy_mysql_suite(void);
 Suite *mapiproxy_openchangedb_logger_suite(void);
+Suite *mapiproxy_openchangedb_cache_suite(void);
+Suite *mapiproxy_openchangedb_profiler_suite(void);
+Suite *mapiproxy_mapi_handles_suite(void);
 /* libmapistore */
 Suite *mapistore_namedprops_suite(void);
 Suite *mapistore_namedprops_mysql_suite(void);
@@ -61,6 +64,14 @@ Suite *mapistore_notification_suite(void);
 /* mapiproxy */
 Suite *mapiproxy_util_mysql_suite(void);
 Suite *mapiproxy_util_schema_migration_suite(void);
+Suite *mapiproxy_emsmdbp_stats_suite(void);
+Suite *mapiproxy_emsmdbp_chain_suite(void);
+Suite *mapiproxy_emsmdbp_session_suite(void);
+Suite *mapiproxy_emsabp_tdb_suite(void);
+Suite *mapiproxy_emsabp_snapshot_suite(void);
+Suite *mapiproxy_emsabp_anr_suite(void);
+Suite *mapiproxy_emsabp_oab_suite(void);
+Suite *mapiproxy_emsabp_session_suite(void);
 
 __END_DECLS
 
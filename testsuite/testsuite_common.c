@@ -62,7 +62,7 @@ void initialize_mysql_with_file(TALLOC_CTX *mem_ctx, const char *sql_file_path,
 	}
 
 	// Populate database with sample data
-	conn = (*oc_ctx)->data;
+	conn = mysql_rw_primary((*oc_ctx)->data);
 	f = fopen(sql_file_path, "r");
 	if (!f) {
 		fprintf(stderr, "file %s not found", sql_file_path);
@@ -88,6 +88,7 @@ void initialize_mysql_with_file(TALLOC_CTX *mem_ctx, const char *sql_file_path,
 		insert = strtok(NULL, ";");
 		inserts_to_execute = insert && strlen(insert) > 10;
 	}
+	mysql_rw_release((*oc_ctx)->data);
 }
 
 void drop_mysql_database(MYSQL *conn, const char *database)
@@ -0,0 +1,435 @@
+/*
+   Generate the Offline Address Book of an OpenChange organization
+
+   OpenChange Project
+
+   This program is free software; you can redistribute it and/or modify
+   it under the terms of the GNU General Public License as published by
+   the Free Software Foundation; either version 3 of the License, or
+   (at your option) any later version.
+
+   This program is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+   GNU General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+/*
+  This program writes the Global Address List of an organization as
+  an OAB version 4 full details file in the compressed file format,
+  along with an oab.info file describing it. ocsmanager publishes
+  them through the OAB URL given by autodiscover, so Outlook downloads
+  the address book once and stops browsing it through NSPI.
+
+  The sequence number is only increased when the address list
+  changed, so clients only download the file again when needed. The
+  previous file is kept for the clients downloading it while a new one
+  is written. It is meant to be run on a schedule: the cron entry in
+  setup/openchange_oabgen.cron runs it every hour and is installed in
+  /etc/cron.d.
+
+  Only full details files are written, with blocks stored without LZX
+  compression. Differential files, which need LZX DELTA patches
+  against the previous full details file, and LZX compression of the
+  blocks are left for a follow-up: until then clients download the
+  whole uncompressed address book again whenever the sequence number
+  changes.
+ */
+
+#include "mapiproxy/servers/default/nspi/dcesrv_exchange_nsp.h"
+#include "openchange-tools.h"
+
+#include <talloc.h>
+#include <param.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/stat.h>
+
+#define	OABGEN_DIRECTORY	"/var/lib/openchange/oab"
+#define	OABGEN_INFO		"oab.info"
+#define	OABGEN_NAME		"\\Global Address List"
+#define	OABGEN_FILE		"%s-data-%u.lzx"
+
+/* Properties of the header record */
+static const struct emsabp_oab_attr oabgen_hdr_attrs[] = {
+	{ PidTagOfflineAddressBookName,			0				},
+	{ PidTagOfflineAddressBookDistinguishedName,	0				},
+	{ PidTagOfflineAddressBookSequence,		0				},
+	{ PidTagOfflineAddressBookContainerGuid,	0				}
+};
+
+/* Properties of the recipient records */
+static const struct emsabp_oab_attr oabgen_attrs[] = {
+	{ PidTagEmailAddress,				EMSABP_OAB_RDN			},
+	{ PidTagDisplayName,				EMSABP_OAB_ANR|EMSABP_OAB_INDEX	},
+	{ PidTagAccount,				EMSABP_OAB_ANR			},
+	{ PidTagSurname,				EMSABP_OAB_ANR			},
+	{ PidTagGivenName,				EMSABP_OAB_ANR			},
+	{ PidTagSmtpAddress,				EMSABP_OAB_ANR			},
+	{ PidTagOfficeLocation,				EMSABP_OAB_ANR			},
+	{ PidTagObjectType,				0				},
+	{ PidTagDisplayType,				0				},
+	{ PidTagAddressBookProxyAddresses,		0				},
+	{ PidTagTitle,					0				},
+	{ PidTagDepartmentName,				0				},
+	{ PidTagCompanyName,				0				},
+	{ PidTagBusinessTelephoneNumber,		0				}
+};
+
+#define	OABGEN_COUNT(a)		(sizeof (a) / sizeof (a[0]))
+
+/**
+   Read the sequence number and CRC of the OAB described by oab.info
+ */
+static bool oabgen_read_info(const char *path, uint32_t *sequence, uint32_t *crc)
+{
+	FILE		*f;
+	char		line[1024];
+	bool		has_sequence = false;
+	bool		has_crc = false;
+
+	f = fopen(path, "r");
+	if (!f) return false;
+
+	while (fgets(line, sizeof (line), f)) {
+		if (!strncmp(line, "sequence=", 9)) {
+			*sequence = strtoul(line + 9, NULL, 10);
+			has_sequence = true;
+		} else if (!strncmp(line, "crc=", 4)) {
+			*crc = strtoul(line + 4, NULL, 16);
+			has_crc = true;
+		}
+	}
+	fclose(f);
+
+	return has_sequence && has_crc;
+}
+
+/**
+   Write a file under a temporary name and rename it, so readers never
+   see it partially written
+ */
+static bool oabgen_write_file(TALLOC_CTX *mem_ctx, const char *path, const uint8_t *data, size_t length)
+{
+	char		*tmp_path;
+	ssize_t		written;
+	size_t		offset;
+	bool		ret;
+	int		fd;
+
+	tmp_path = talloc_asprintf(mem_ctx, "%s.tmp", path);
+	if (!tmp_path) return false;
+
+	fd = open(tmp_path, O_WRONLY|O_CREAT|O_TRUNC, 0644);
+	if (fd == -1) {
+		fprintf(stderr, "Unable to create %s: %s\n", tmp_path, strerror(errno));
+		talloc_free(tmp_path);
+		return false;
+	}
+
+	for (offset = 0; offset < length; offset += written) {
+		written = write(fd, data + offset, length - offset);
+		if (written <= 0) {
+			if (written == -1 && errno == EINTR) {
+				written = 0;
+				continue;
+			}
+			break;
+		}
+	}
+	ret = (offset == length && fsync(fd) == 0);
+	if (close(fd) == -1) ret = false;
+	if (!ret) {
+		fprintf(stderr, "Unable to write %s: %s\n", tmp_path, strerror(errno));
+		unlink(tmp_path);
+		talloc_free(tmp_path);
+		return false;
+	}
+
+	if (rename(tmp_path, path) == -1) {
+		fprintf(stderr, "Unable to rename %s: %s\n", tmp_path, strerror(errno));
+		unlink(tmp_path);
+		talloc_free(tmp_path);
+		return false;
+	}
+
+	talloc_free(tmp_path);
+	return true;
+}
+
+/**
+   Find the name of the first organization, as ocsmanager does
+ */
+static const char *oabgen_get_organization(TALLOC_CTX *mem_ctx, struct emsabp_context *emsabp_ctx)
+{
+	struct ldb_result	*res;
+	const char * const	attrs[] = { "cn", NULL };
+	int			ret;
+
+	ret = ldb_search(emsabp_ctx->samdb_ctx, mem_ctx, &res,
+			 ldb_get_config_basedn(emsabp_ctx->samdb_ctx), LDB_SCOPE_SUBTREE,
+			 attrs, "(objectClass=msExchOrganizationContainer)");
+	if (ret != LDB_SUCCESS || !res->count) return NULL;
+	if (res->count > 1) {
+		fprintf(stderr, "More than one organization found, using the first one\n");
+	}
+
+	return ldb_msg_find_attr_as_string(res->msgs[0], "cn", NULL);
+}
+
+/**
+   Retrieve the objectGUID of the Global Address List, along with its
+   container DN as the NSPI server builds it
+ */
+static char *oabgen_get_gal_guid(TALLOC_CTX *mem_ctx, struct emsabp_context *emsabp_ctx,
+				 char **dnp)
+{
+	struct ldb_result	*res;
+	const char * const	gal_attrs[] = { "globalAddressList", NULL };
+	const char * const	guid_attrs[] = { "objectGUID", NULL };
+	const char		*dn;
+	const struct ldb_val	*val;
+	struct GUID		guid;
+	int			ret;
+
+	ret = ldb_search(emsabp_ctx->samdb_ctx, mem_ctx, &res,
+			 ldb_get_config_basedn(emsabp_ctx->samdb_ctx), LDB_SCOPE_SUBTREE,
+			 gal_attrs, "(globalAddressList=*)");
+	if (ret != LDB_SUCCESS || !res->count) return NULL;
+
+	dn = ldb_msg_find_attr_as_string(res->msgs[0], "globalAddressList", NULL);
+	if (!dn) return NULL;
+
+	ret = ldb_search(emsabp_ctx->samdb_ctx, mem_ctx, &res,
+			 ldb_dn_new(mem_ctx, emsabp_ctx->samdb_ctx, dn), LDB_SCOPE_BASE,
+			 guid_attrs, NULL);
+	if (ret != LDB_SUCCESS || res->count != 1) return NULL;
+
+	val = ldb_msg_find_ldb_val(res->msgs[0], "objectGUID");
+	if (!val || !NT_STATUS_IS_OK(GUID_from_data_blob(val, &guid))) return NULL;
+
+	*dnp = talloc_asprintf(mem_ctx, EMSABP_DN, guid.time_low, guid.time_mid,
+			       guid.time_hi_and_version, guid.clock_seq[0], guid.clock_seq[1],
+			       guid.node[0], guid.node[1], guid.node[2],
+			       guid.node[3], guid.node[4], guid.node[5]);
+	if (!*dnp) return NULL;
+
+	return GUID_string(mem_ctx, &guid);
+}
+
+/**
+   Return the serial number of a details file, i.e. the CRC of its
+   records
+ */
+static uint32_t oabgen_get_serial(const DATA_BLOB *details)
+{
+	return details->data[4] | (details->data[5] << 8) |
+		(details->data[6] << 16) | ((uint32_t)details->data[7] << 24);
+}
+
+/**
+   Build the header record of the address list
+ */
+static void oabgen_set_header(TALLOC_CTX *mem_ctx, struct PropertyRow_r *row,
+			      uint32_t sequence, const char *dn, const char *guid)
+{
+	uint32_t	i;
+
+	row->Reserved = 0;
+	row->cValues = OABGEN_COUNT(oabgen_hdr_attrs);
+	row->lpProps = talloc_zero_array(mem_ctx, struct PropertyValue_r, row->cValues);
+	for (i = 0; i < row->cValues; i++) {
+		row->lpProps[i].ulPropTag = (enum MAPITAGS) oabgen_hdr_attrs[i].ulPropTag;
+	}
+	row->lpProps[0].value.lpszW = OABGEN_NAME;
+	row->lpProps[1].value.lpszA = dn;
+	row->lpProps[2].value.l = sequence;
+	row->lpProps[3].value.lpszA = guid;
+}
+
+int main(int argc, const char *argv[])
+{
+	TALLOC_CTX			*mem_ctx;
+	enum MAPISTATUS			retval;
+	poptContext			pc;
+	int				opt;
+	struct loadparm_context		*lp_ctx;
+	struct emsabp_context		*emsabp_ctx;
+	struct emsabp_snapshot		*snapshot;
+	struct SPropTagArray		*pPropTags;
+	struct PropertyRow_r		hdr_row;
+	struct PropertyRow_r		*rows;
+	DATA_BLOB			details;
+	DATA_BLOB			compressed;
+	const char			*opt_directory = OABGEN_DIRECTORY;
+	const char			*opt_organization = NULL;
+	const char			*guid;
+	char				*dn = NULL;
+	char				*info_path;
+	char				*info;
+	char				*file;
+	uint32_t			sequence = 0;
+	uint32_t			crc = 0;
+	bool				has_info;
+	uint32_t			i;
+
+	enum {OPT_DIRECTORY=1000, OPT_ORGANIZATION, OPT_OPTION, OPT_DEBUG_LEVEL};
+
+	struct poptOption long_options[] = {
+		POPT_AUTOHELP
+		{"directory", 'D', POPT_ARG_STRING, NULL, OPT_DIRECTORY, "set the directory the OAB is written to", "PATH"},
+		{"organization", 'o', POPT_ARG_STRING, NULL, OPT_ORGANIZATION, "set the organization, the first one by default", "NAME"},
+		{"option", 0, POPT_ARG_STRING, NULL, OPT_OPTION, "set smb.conf option from command line", "name=value"},
+		{"debuglevel", 'd', POPT_ARG_STRING, NULL, OPT_DEBUG_LEVEL, "set debug level", "DEBUGLEVEL"},
+		POPT_OPENCHANGE_VERSION
+		{ NULL, 0, POPT_ARG_NONE, NULL, 0, NULL, NULL }
+	};
+
+	mem_ctx = talloc_named(NULL, 0, "openchange_oabgen");
+	lp_ctx = loadparm_init_global(false);
+
+	pc = poptGetContext("openchange_oabgen", argc, argv, long_options, 0);
+
+	while ((opt = poptGetNextOpt(pc)) != -1) {
+		switch (opt) {
+		case OPT_DIRECTORY:
+			opt_directory = talloc_strdup(mem_ctx, poptGetOptArg(pc));
+			break;
+		case OPT_ORGANIZATION:
+			opt_organization = talloc_strdup(mem_ctx, poptGetOptArg(pc));
+			break;
+		case OPT_OPTION:
+			lpcfg_set_option(lp_ctx, poptGetOptArg(pc));
+			break;
+		case OPT_DEBUG_LEVEL:
+			lpcfg_set_cmdline(lp_ctx, "log level", poptGetOptArg(pc));
+			break;
+		}
+	}
+	poptFreeContext(pc);
+
+	if (lpcfg_configfile(lp_ctx) == NULL) {
+		lpcfg_load_default(lp_ctx);
+	}
+
+	/* Records are fetched from the snapshot, the MId database of
+	 * the NSPI server is not needed */
+	emsabp_ctx = emsabp_init(lp_ctx, NULL);
+	if (!emsabp_ctx) {
+		fprintf(stderr, "Unable to initialize the address book provider\n");
+		talloc_free(mem_ctx);
+		exit (1);
+	}
+
+	if (!opt_organization) {
+		opt_organization = oabgen_get_organization(mem_ctx, emsabp_ctx);
+		if (!opt_organization) {
+			fprintf(stderr, "No organization found\n");
+			goto end;
+		}
+	}
+	emsabp_ctx->organization_name = talloc_strdup(emsabp_ctx->mem_ctx, opt_organization);
+
+	guid = oabgen_get_gal_guid(mem_ctx, emsabp_ctx, &dn);
+	if (!guid) {
+		fprintf(stderr, "Unable to find the Global Address List\n");
+		goto end;
+	}
+
+	/* Step 1. Build the recipient records from the GAL snapshot */
+	retval = emsabp_ab_container_snapshot(emsabp_ctx, 0, &snapshot);
+	if (retval != MAPI_E_SUCCESS) {
+		fprintf(stderr, "Unable to enumerate the Global Address List: %s\n", mapi_get_errstr(retval));
+		goto end;
+	}
+
+	pPropTags = talloc_zero(mem_ctx, struct SPropTagArray);
+	pPropTags->cValues = OABGEN_COUNT(oabgen_attrs);
+	pPropTags->aulPropTag = talloc_array(pPropTags, enum MAPITAGS, pPropTags->cValues);
+	for (i = 0; i < pPropTags->cValues; i++) {
+		pPropTags->aulPropTag[i] = (enum MAPITAGS) oabgen_attrs[i].ulPropTag;
+	}
+
+	rows = talloc_zero_array(mem_ctx, struct PropertyRow_r, snapshot->count);
+	for (i = 0; i < snapshot->count; i++) {
+		retval = emsabp_fetch_attrs_from_msg(rows, emsabp_ctx, &rows[i], snapshot->entries[i]->msg,
+						     0, 0, pPropTags);
+		if (retval != MAPI_E_SUCCESS) {
+			fprintf(stderr, "Unable to fetch %s: %s\n", snapshot->entries[i]->dn, mapi_get_errstr(retval));
+			goto end;
+		}
+	}
+
+	/* Step 2. Keep the current sequence unless the address list changed */
+	info_path = talloc_asprintf(mem_ctx, "%s/%s", opt_directory, OABGEN_INFO);
+	has_info = oabgen_read_info(info_path, &sequence, &crc);
+	if (!has_info) sequence = 1;
+
+	oabgen_set_header(mem_ctx, &hdr_row, sequence, dn, guid);
+	retval = emsabp_oab_details(mem_ctx, oabgen_hdr_attrs, OABGEN_COUNT(oabgen_hdr_attrs), &hdr_row,
+				    oabgen_attrs, OABGEN_COUNT(oabgen_attrs), rows, snapshot->count, &details);
+	if (retval == MAPI_E_SUCCESS && has_info && oabgen_get_serial(&details) == crc) {
+		printf("Offline Address Book is up to date at sequence %u\n", sequence);
+		talloc_free(mem_ctx);
+		emsabp_destructor(emsabp_ctx);
+		return 0;
+	}
+	if (retval == MAPI_E_SUCCESS && has_info) {
+		sequence++;
+		talloc_free(details.data);
+		oabgen_set_header(mem_ctx, &hdr_row, sequence, dn, guid);
+		retval = emsabp_oab_details(mem_ctx, oabgen_hdr_attrs, OABGEN_COUNT(oabgen_hdr_attrs), &hdr_row,
+					    oabgen_attrs, OABGEN_COUNT(oabgen_attrs), rows, snapshot->count, &details);
+	}
+	if (retval == MAPI_E_SUCCESS) {
+		retval = emsabp_oab_compress(mem_ctx, &details, EMSABP_OAB_BLOCK_MAX, &compressed);
+	}
+	if (retval != MAPI_E_SUCCESS) {
+		fprintf(stderr, "Unable to build the Offline Address Book: %s\n", mapi_get_errstr(retval));
+		goto end;
+	}
+
+	/* Step 3. Write the file, then the description ocsmanager reads */
+	if (mkdir(opt_directory, 0755) == -1 && errno != EEXIST) {
+		fprintf(stderr, "Unable to create %s: %s\n", opt_directory, strerror(errno));
+		goto end;
+	}
+
+	file = talloc_asprintf(mem_ctx, OABGEN_FILE, guid, sequence);
+	if (!oabgen_write_file(mem_ctx, talloc_asprintf(mem_ctx, "%s/%s", opt_directory, file),
+			       compressed.data, compressed.length)) {
+		goto end;
+	}
+
+	info = talloc_asprintf(mem_ctx,
+			       "sequence=%u\nname=%s\ndn=%s\nguid=%s\nfile=%s\n"
+			       "size=%zu\nuncompressedsize=%zu\ncrc=%08x\n",
+			       sequence, OABGEN_NAME, dn, guid, file,
+			       compressed.length, details.length, oabgen_get_serial(&details));
+	if (!oabgen_write_file(mem_ctx, info_path, (const uint8_t *)info, strlen(info))) {
+		goto end;
+	}
+
+	/* Keep the previous file for the clients still downloading it */
+	if (sequence > 2) {
+		unlink(talloc_asprintf(mem_ctx, "%s/" OABGEN_FILE, opt_directory, guid, sequence - 2));
+	}
+
+	printf("Offline Address Book written at sequence %u: %u records, %zu bytes\n",
+	       sequence, snapshot->count, compressed.length);
+
+	talloc_free(mem_ctx);
+	emsabp_destructor(emsabp_ctx);
+
+	return 0;
+
+end:
+	talloc_free(mem_ctx);
+	emsabp_destructor(emsabp_ctx);
+
+	return 1;
+}